@@ -0,0 +1,140 @@
+#include "bus_poller.h"
+#include <string.h>
+#include <sys/epoll.h>
+
+bool PosixModbusSerial::write(const uint8_t* data, size_t length) {
+    // A request is far below the tty's output buffer; short means the line is stuck
+    return serial.write(data, length) == length;
+}
+
+int PosixModbusSerial::read(uint8_t* data, size_t capacity) {
+    return (int)serial.read(data, capacity);
+}
+
+uint32_t PosixModbusSerial::getBaud() const {
+    return baud;
+}
+
+BusPoller::BusPoller(EventLoop& loop, PosixSerialTransport& serial, uint32_t baud)
+    : loop(loop)
+    , serial(serial)
+    , line(serial, baud)
+    , master(line)
+    , sampleCallback(nullptr)
+    , timer(0)
+    , watching(false)
+{
+    master.setClock(EventLoop::monotonicMs);
+    memset(&stats, 0, sizeof(stats));
+}
+
+BusPoller::~BusPoller() {
+    end();
+}
+
+void BusPoller::setResponseTimeout(uint32_t ms) {
+    master.setResponseTimeout(ms);
+}
+
+void BusPoller::setSampleCallback(SampleCallback callback) {
+    sampleCallback = callback;
+}
+
+int BusPoller::addBlock(uint8_t unit, uint8_t function, uint16_t start, uint16_t count, uint32_t intervalMs,
+                        uint16_t firstPoint) {
+    int index = cache.addBlock(unit, function, start, count, intervalMs, intervalMs);
+    if (index >= 0) {
+        firstPoints.push_back(firstPoint);
+    }
+    return index;
+}
+
+bool BusPoller::begin() {
+    if (watching) {
+        return true;
+    }
+    if (!loop.watch(serial.getFd(), EPOLLIN, [this](uint32_t) {
+            stats.wakeups++;
+            service();
+        })) {
+        return false;
+    }
+    // Every block is due at once; the first poll goes out on the next turn
+    timer = loop.addTimer(0, 0, [this]() {
+        stats.wakeups++;
+        service();
+    });
+    watching = true;
+    return true;
+}
+
+void BusPoller::end() {
+    if (!watching) {
+        return;
+    }
+    loop.unwatch(serial.getFd());
+    loop.removeTimer(timer);
+    watching = false;
+}
+
+size_t BusPoller::getPointCount() const {
+    size_t points = 0;
+    for (size_t i = 0; i < cache.getBlockCount(); i++) {
+        points += cache.getBlock(i).count;
+    }
+    return points;
+}
+
+const BusPollerStats& BusPoller::getStats() const {
+    return stats;
+}
+
+const ModbusRtuStats& BusPoller::getBusStats() const {
+    return master.getStats();
+}
+
+void BusPoller::service() {
+    // Reads response bytes, sends after the frame gap or times out; a
+    // finished read delivers its samples from in here
+    master.update();
+    if (!master.isBusy()) {
+        startPoll(EventLoop::monotonicMs());
+    }
+    uint32_t due = master.isBusy() ? master.msUntilDue() : cache.nextPollDueIn(EventLoop::monotonicMs());
+    loop.rearmTimer(timer, due == RegisterCache::NO_POLL_DUE ? EventLoop::NEVER : due);
+}
+
+void BusPoller::startPoll(uint32_t now) {
+    int index = cache.nextPoll(now);
+    if (index < 0) {
+        return;
+    }
+    const RegisterCache::Block& block = cache.getBlock(index);
+    // From the start of the poll, so the interval does not drift by the exchange time
+    cache.markPolled(index, now);
+    stats.polls++;
+    bool started = master.read(block.unit, block.function, block.start, block.count,
+                               [this, index](uint8_t exception, const uint16_t* values, uint16_t count) {
+        if (exception != ModbusException::NONE) {
+            stats.failures++;
+            return;
+        }
+        const RegisterCache::Block& done = cache.getBlock(index);
+        uint32_t sampledAt = master.getSampledAt();
+        cache.store(done.unit, done.function, done.start, count, values, sampledAt);
+        samples.resize(count);
+        for (uint16_t i = 0; i < count; i++) {
+            samples[i].pointId = (uint16_t)(firstPoints[index] + i);
+            samples[i].source = SampleSource::MODBUS;
+            samples[i].value = (float)values[i];
+            samples[i].timestampMs = sampledAt;
+        }
+        stats.samples += count;
+        if (sampleCallback) {
+            sampleCallback(samples.data(), count);
+        }
+    });
+    if (!started) {
+        stats.failures++;
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef BUS_POLLER_H
+#define BUS_POLLER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <vector>
+#include "event_loop.h"
+#include "modbus_gateway.h"
+#include "posix_serial.h"
+#include "sample.h"
+
+// RS-485 line on a tty, see PosixSerialTransport::enableRs485()
+class PosixModbusSerial : public ModbusSerial {
+public:
+    // baud is the line's nominal rate, used for frame timing even on a pty
+    PosixModbusSerial(PosixSerialTransport& serial, uint32_t baud) : serial(serial), baud(baud) {}
+
+    bool write(const uint8_t* data, size_t length) override;
+    int read(uint8_t* data, size_t capacity) override;
+    uint32_t getBaud() const override;
+
+private:
+    PosixSerialTransport& serial;
+    uint32_t baud;
+};
+
+struct BusPollerStats {
+    uint32_t polls;
+    uint32_t samples;
+    uint32_t failures;      // timeouts, exceptions and bad frames
+    uint32_t wakeups;       // descriptor and timer callbacks
+};
+
+// Polls the register blocks of one line from the event loop. The descriptor
+// wakes it for response bytes and a single timer for whatever comes next
+// (the frame gap, the response timeout or the next block due), so a line
+// costs nothing between polls. Registers become samples with consecutive
+// point IDs, raw values, stamped when the slave read them.
+class BusPoller {
+public:
+    typedef std::function<void(const Sample* samples, size_t count)> SampleCallback;
+
+    BusPoller(EventLoop& loop, PosixSerialTransport& serial, uint32_t baud);
+    ~BusPoller();
+
+    void setResponseTimeout(uint32_t ms);
+    void setSampleCallback(SampleCallback callback);
+    // Up to RegisterCache::MAX_BLOCKS; returns the block index or -1
+    int addBlock(uint8_t unit, uint8_t function, uint16_t start, uint16_t count, uint32_t intervalMs,
+                 uint16_t firstPoint);
+
+    bool begin();
+    void end();
+
+    size_t getPointCount() const;
+    const BusPollerStats& getStats() const;
+    const ModbusRtuStats& getBusStats() const;
+
+private:
+    EventLoop& loop;
+    PosixSerialTransport& serial;
+    PosixModbusSerial line;
+    ModbusRtuMaster master;
+    RegisterCache cache;
+    std::vector<uint16_t> firstPoints;
+    std::vector<Sample> samples;
+    SampleCallback sampleCallback;
+    uint32_t timer;
+    bool watching;
+    BusPollerStats stats;
+
+    // Helper methods
+    void service();
+    void startPoll(uint32_t now);
+};
+
+#endif // BUS_POLLER_H
@@ -0,0 +1,330 @@
+// cerised: the gateway as a Linux daemon, for sites with more field devices
+// than an ESP32 serves. Polls Modbus RTU lines and publishes sample batches
+// over MQTT from a single thread: every UART, the broker socket, signals and
+// timers are descriptors in one epoll set, so the process sleeps until one
+// of them has something.
+//
+//   cerised [-c /etc/cerise/cerised.conf]
+//
+// One directive per line; blocks belong to the line above them:
+//   mqtt <host> <port> <client id> <topic prefix>
+//   line <device> <baud> <frame, e.g. 8E1> [rs485]
+//   block <unit> <function 3|4> <start> <count> <interval ms> <first point ID>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include "bus_poller.h"
+#include "event_loop.h"
+#include "mqtt_session.h"
+#include "payload_encoder.h"
+#include "posix_mqtt.h"
+#include "posix_serial.h"
+
+static const uint32_t STATS_INTERVAL_MS = 10000;
+// Keep-alive, retransmit and reconnect timers of the session, and the
+// partial batch, are looked at once a second
+static const uint32_t SESSION_TICK_MS = 1000;
+static const size_t BATCH_SIZE = 128;
+static const size_t MAX_BACKLOG = 100000;
+
+struct BlockConfig {
+    uint8_t unit;
+    uint8_t function;
+    uint16_t start;
+    uint16_t count;
+    uint32_t intervalMs;
+    uint16_t firstPoint;
+};
+
+struct LineConfig {
+    std::string device;
+    uint32_t baud;
+    std::string frame;
+    bool rs485;
+    std::vector<BlockConfig> blocks;
+};
+
+struct DaemonConfig {
+    std::string mqttHost;
+    uint16_t mqttPort;
+    std::string clientId;
+    std::string topicPrefix;
+    std::vector<LineConfig> lines;
+};
+
+static bool loadConfig(const char* path, DaemonConfig& config, std::string& error) {
+    std::ifstream file(path);
+    if (!file) {
+        error = std::string("cannot open ") + path;
+        return false;
+    }
+    config.mqttPort = 1883;
+    config.clientId = "cerised";
+    config.topicPrefix = "cerise";
+    std::string text;
+    int number = 0;
+    while (std::getline(file, text)) {
+        number++;
+        std::istringstream line(text);
+        std::string directive;
+        if (!(line >> directive) || directive[0] == '#') {
+            continue;
+        }
+        bool ok;
+        if (directive == "mqtt") {
+            ok = (bool)(line >> config.mqttHost >> config.mqttPort >> config.clientId >> config.topicPrefix);
+        } else if (directive == "line") {
+            LineConfig entry;
+            std::string option;
+            ok = (bool)(line >> entry.device >> entry.baud >> entry.frame);
+            entry.rs485 = (line >> option) && option == "rs485";
+            config.lines.push_back(entry);
+        } else if (directive == "block") {
+            unsigned unit, function, start, count, intervalMs, firstPoint;
+            ok = !config.lines.empty() && (line >> unit >> function >> start >> count >> intervalMs >> firstPoint)
+                 && unit <= 247 && (function == 3 || function == 4) && intervalMs > 0;
+            if (ok) {
+                config.lines.back().blocks.push_back({(uint8_t)unit, (uint8_t)function, (uint16_t)start,
+                                                      (uint16_t)count, intervalMs, (uint16_t)firstPoint});
+            }
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            error = std::string(path) + ":" + std::to_string(number) + ": invalid " + directive;
+            return false;
+        }
+    }
+    if (config.mqttHost.empty() || config.lines.empty()) {
+        error = "an mqtt directive and at least one line are required";
+        return false;
+    }
+    return true;
+}
+
+// Batches samples and publishes them as CBOR, QoS 1, on <prefix>/samples.
+// The session runs off its socket's readiness and a once-a-second tick; a
+// broker that falls behind leaves samples in a bounded backlog.
+class Uplink {
+public:
+    Uplink(EventLoop& loop, const DaemonConfig& config)
+        : loop(loop), session(transport), topic(config.topicPrefix + "/samples"), watchedFd(-1), watchedEvents(0),
+          published(0), dropped(0) {
+        session.setServer(config.mqttHost, config.mqttPort);
+        session.setCredentials(config.clientId, "", "");
+        session.setClock(EventLoop::monotonicMs);
+    }
+
+    void begin() {
+        session.connect();
+        loop.addTimer(SESSION_TICK_MS, SESSION_TICK_MS, [this]() { service(true); });
+        syncWatch();
+    }
+
+    void add(const Sample* samples, size_t count) {
+        backlog.insert(backlog.end(), samples, samples + count);
+        if (backlog.size() > MAX_BACKLOG) {
+            size_t excess = backlog.size() - MAX_BACKLOG;
+            backlog.erase(backlog.begin(), backlog.begin() + excess);
+            dropped += excess;
+        }
+        if (backlog.size() >= BATCH_SIZE) {
+            publishBacklog(false);
+            syncWatch();
+        }
+    }
+
+    bool isConnected() const {
+        return session.isConnected();
+    }
+
+    size_t getBacklog() const {
+        return backlog.size();
+    }
+
+    uint64_t getPublished() const {
+        return published;
+    }
+
+    uint64_t getDropped() const {
+        return dropped;
+    }
+
+private:
+    EventLoop& loop;
+    PosixMqttTransport transport;
+    MqttSession session;
+    std::string topic;
+    std::vector<Sample> backlog;
+    uint8_t payload[4096];
+    int watchedFd;
+    uint32_t watchedEvents;
+    uint64_t published;
+    uint64_t dropped;
+
+    void service(bool tick) {
+        session.loop();
+        publishBacklog(tick);
+        syncWatch();
+    }
+
+    // Whole batches only, unless the tick flushes the remainder
+    void publishBacklog(bool partial) {
+        size_t offset = 0;
+        while (backlog.size() - offset >= (partial ? 1 : BATCH_SIZE) && session.canPublish(1)) {
+            size_t count = backlog.size() - offset < BATCH_SIZE ? backlog.size() - offset : BATCH_SIZE;
+            PayloadBuffer buffer(payload, sizeof(payload));
+            // The host clock is kept by the OS (NTP or PTP)
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            TimeBase timeBase;
+            timeBase.unixMs = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+            timeBase.monotonicMs = EventLoop::monotonicMs();
+            timeBase.synced = true;
+            size_t length = encodeSamples(PayloadFormat::CBOR, backlog.data() + offset, count, buffer, nullptr,
+                                          &timeBase);
+            if (length == 0 || !session.publish(topic.c_str(), payload, length, 1)) {
+                break;
+            }
+            offset += count;
+            published += count;
+        }
+        backlog.erase(backlog.begin(), backlog.begin() + offset);
+    }
+
+    // The socket changes on every reconnect
+    void syncWatch() {
+        int fd = transport.isOpen() ? transport.getFd() : -1;
+        uint32_t events = EPOLLIN | (transport.wantsWrite() ? (uint32_t)EPOLLOUT : 0);
+        if (fd != watchedFd) {
+            if (watchedFd >= 0) {
+                loop.unwatch(watchedFd);
+            }
+            watchedFd = -1;
+            if (fd >= 0 && loop.watch(fd, events, [this](uint32_t ready) {
+                    if (ready & EPOLLOUT) {
+                        transport.flush();
+                    }
+                    service(false);
+                })) {
+                watchedFd = fd;
+                watchedEvents = events;
+            }
+        } else if (fd >= 0 && events != watchedEvents && loop.modify(fd, events)) {
+            watchedEvents = events;
+        }
+    }
+};
+
+static double cpuSeconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-c config]\n", name);
+}
+
+int main(int argc, char** argv) {
+    const char* configPath = "/etc/cerise/cerised.conf";
+    int option;
+    while ((option = getopt(argc, argv, "c:h")) != -1) {
+        switch (option) {
+            case 'c': configPath = optarg; break;
+            default:
+                usage(argv[0]);
+                return option == 'h' ? 0 : 2;
+        }
+    }
+    DaemonConfig config;
+    std::string error;
+    if (!loadConfig(configPath, config, error)) {
+        fprintf(stderr, "[Config] %s\n", error.c_str());
+        return 2;
+    }
+
+    EventLoop loop;
+    if (!loop.begin()) {
+        fprintf(stderr, "[Loop] %s\n", loop.getLastError().c_str());
+        return 1;
+    }
+    // Signals arrive as a descriptor like everything else
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signals, nullptr);
+    int signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    loop.watch(signalFd, EPOLLIN, [&loop, signalFd](uint32_t) {
+        struct signalfd_siginfo info;
+        while (read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+            loop.stop();
+        }
+    });
+
+    Uplink uplink(loop, config);
+    std::vector<std::unique_ptr<PosixSerialTransport>> serials;
+    std::vector<std::unique_ptr<BusPoller>> pollers;
+    size_t points = 0;
+    for (const LineConfig& line : config.lines) {
+        std::unique_ptr<PosixSerialTransport> serial(new PosixSerialTransport());
+        if (!serial->open(line.device.c_str(), line.baud, line.frame.c_str())) {
+            fprintf(stderr, "[Bus] %s\n", serial->getLastError().c_str());
+            return 1;
+        }
+        if (line.rs485 && !serial->enableRs485()) {
+            fprintf(stderr, "[Bus] %s: %s\n", line.device.c_str(), serial->getLastError().c_str());
+        }
+        std::unique_ptr<BusPoller> poller(new BusPoller(loop, *serial, line.baud));
+        for (const BlockConfig& block : line.blocks) {
+            if (poller->addBlock(block.unit, block.function, block.start, block.count, block.intervalMs,
+                                 block.firstPoint) < 0) {
+                fprintf(stderr, "[Bus] %s: block at %u rejected\n", line.device.c_str(), (unsigned)block.start);
+            }
+        }
+        poller->setSampleCallback([&uplink](const Sample* samples, size_t count) { uplink.add(samples, count); });
+        poller->begin();
+        points += poller->getPointCount();
+        serials.push_back(std::move(serial));
+        pollers.push_back(std::move(poller));
+    }
+    uplink.begin();
+
+    uint64_t lastWakeups = 0;
+    double lastCpu = cpuSeconds();
+    loop.addTimer(STATS_INTERVAL_MS, STATS_INTERVAL_MS, [&]() {
+        uint32_t polls = 0;
+        uint32_t failures = 0;
+        for (const auto& poller : pollers) {
+            polls += poller->getStats().polls;
+            failures += poller->getStats().failures;
+        }
+        double cpu = cpuSeconds();
+        uint64_t wakeups = loop.getStats().wakeups;
+        fprintf(stderr, "[Stats] %.2f%% cpu, %.0f wakeups/s, %u polls, %u failures, %llu published, "
+                        "%zu backlog, %llu dropped, MQTT %s\n",
+                (cpu - lastCpu) * 100000.0 / STATS_INTERVAL_MS, (wakeups - lastWakeups) * 1000.0 / STATS_INTERVAL_MS,
+                (unsigned)polls, (unsigned)failures, (unsigned long long)uplink.getPublished(), uplink.getBacklog(),
+                (unsigned long long)uplink.getDropped(), uplink.isConnected() ? "up" : "down");
+        lastCpu = cpu;
+        lastWakeups = wakeups;
+    });
+
+    fprintf(stderr, "[Bus] %zu lines, %zu points\n", pollers.size(), points);
+    loop.run();
+    fprintf(stderr, "[Loop] Stopped\n");
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include "delta_diff.h"
+#include <string.h>
+#include <unordered_map>
+#include "delta_update.h"
+
+static const size_t BLOCK = 16;
+
+struct DeltaRecord {
+    uint32_t diffStart;
+    uint32_t diffLength;
+    uint32_t sourceStart;
+    uint32_t extraLength;
+};
+
+static void putVarint(std::vector<uint8_t>& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+static void putLe32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back((uint8_t)(value >> (8 * i)));
+    }
+}
+
+static uint64_t blockKey(const uint8_t* data) {
+    uint64_t key;
+    memcpy(&key, data, 8);
+    return key ^ (uint64_t)data[8] << 3 ^ (uint64_t)data[15] << 11;
+}
+
+std::vector<uint8_t> makeDeltaPatch(const std::vector<uint8_t>& src, const std::vector<uint8_t>& dst) {
+    std::unordered_map<uint64_t, uint32_t> index;
+    for (size_t i = 0; i + BLOCK <= src.size(); i++) {
+        index.emplace(blockKey(&src[i]), (uint32_t)i);
+    }
+
+    // At least half the bytes equal: the diff bytes then compress to runs
+    auto similar = [&](size_t p, size_t o) {
+        size_t n = BLOCK;
+        if (p + n > dst.size()) n = dst.size() - p;
+        if (o + n > src.size()) return false;
+        size_t same = 0;
+        for (size_t k = 0; k < n; k++) {
+            same += dst[p + k] == src[o + k];
+        }
+        return same * 2 >= n;
+    };
+
+    std::vector<DeltaRecord> records;
+    DeltaRecord current = {0, 0, 0, 0};
+    size_t p = 0;
+    size_t o = 0;
+    while (p < dst.size()) {
+        size_t n = dst.size() - p < BLOCK ? dst.size() - p : BLOCK;
+        if (current.extraLength == 0 && similar(p, o)) {
+            current.diffLength += n;
+            p += n;
+            o += n;
+            continue;
+        }
+        bool found = false;
+        if (p + BLOCK <= dst.size()) {
+            auto it = index.find(blockKey(&dst[p]));
+            found = it != index.end() && similar(p, it->second);
+            if (found) {
+                records.push_back(current);
+                current = {(uint32_t)p, 0, it->second, 0};
+                o = it->second;
+            }
+        }
+        if (!found) {
+            current.extraLength += n;
+            p += n;
+        }
+    }
+    records.push_back(current);
+
+    std::vector<uint8_t> patch = {'C', 'D', 'P', '1'};
+    putLe32(patch, (uint32_t)dst.size());
+    putLe32(patch, deltaCrc32(0, dst.data(), dst.size()));
+    for (size_t r = 0; r < records.size(); r++) {
+        const DeltaRecord& rec = records[r];
+        uint32_t sourceEnd = rec.sourceStart + rec.diffLength;
+        int32_t seek = r + 1 < records.size() ? (int32_t)(records[r + 1].sourceStart - sourceEnd) : 0;
+        putVarint(patch, rec.diffLength);
+        putVarint(patch, rec.extraLength);
+        putVarint(patch, (uint32_t)((seek << 1) ^ (seek >> 31)));
+        uint32_t k = 0;
+        while (k < rec.diffLength) {
+            uint8_t diff = dst[rec.diffStart + k] - src[rec.sourceStart + k];
+            if (diff != 0) {
+                patch.push_back(diff);
+                k++;
+                continue;
+            }
+            uint32_t run = 0;
+            while (k < rec.diffLength && dst[rec.diffStart + k] == src[rec.sourceStart + k]) {
+                run++;
+                k++;
+            }
+            patch.push_back(0);
+            putVarint(patch, run);
+        }
+        uint32_t extraStart = rec.diffStart + rec.diffLength;
+        patch.insert(patch.end(), dst.begin() + extraStart, dst.begin() + extraStart + rec.extraLength);
+    }
+    return patch;
+}
@@ -0,0 +1,13 @@
+#ifndef DELTA_DIFF_H
+#define DELTA_DIFF_H
+
+#include <stdint.h>
+#include <vector>
+
+// Builds a CDP1 patch (see delta_update.h) that turns src into dst. src must
+// be the exact image the device runs: the patcher reads zeros past its end.
+// Greedy 16-byte block matching, so relocated code and inserted or removed
+// functions stay cheap without bsdiff's suffix sort.
+std::vector<uint8_t> makeDeltaPatch(const std::vector<uint8_t>& src, const std::vector<uint8_t>& dst);
+
+#endif // DELTA_DIFF_H
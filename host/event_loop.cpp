@@ -0,0 +1,295 @@
+#include "event_loop.h"
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+// epoll data: generation in the high half, descriptor in the low one. The
+// loop's own timerfd and eventfd use generation 0, watches start at 1, so a
+// descriptor closed and reused within one batch is not mistaken for the old.
+static uint64_t tag(uint32_t generation, int fd) {
+    return ((uint64_t)generation << 32) | (uint32_t)fd;
+}
+
+EventLoop::EventLoop()
+    : epollFd(-1)
+    , timerFd(-1)
+    , wakeFd(-1)
+    , stopRequested(false)
+    , nextGeneration(1)
+    , nextTimerId(1)
+    , armedForMs(0)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+EventLoop::~EventLoop() {
+    if (epollFd >= 0) {
+        close(epollFd);
+    }
+    if (timerFd >= 0) {
+        close(timerFd);
+    }
+    if (wakeFd >= 0) {
+        close(wakeFd);
+    }
+}
+
+bool EventLoop::begin() {
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd < 0 || timerFd < 0 || wakeFd < 0) {
+        return fail(std::string("epoll/timerfd/eventfd: ") + strerror(errno));
+    }
+    for (int fd : {timerFd, wakeFd}) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u64 = tag(0, fd);
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            return fail(std::string("epoll_ctl: ") + strerror(errno));
+        }
+    }
+    stopRequested = false;
+    return true;
+}
+
+bool EventLoop::watch(int fd, uint32_t events, FdCallback callback) {
+    if (fd < 0 || watches.count(fd) != 0) {
+        return fail("descriptor " + std::to_string(fd) + " invalid or already watched");
+    }
+    std::shared_ptr<Watch> entry = std::make_shared<Watch>();
+    entry->generation = nextGeneration++;
+    if (nextGeneration == 0) {
+        nextGeneration = 1;
+    }
+    entry->callback = callback;
+    struct epoll_event event;
+    event.events = events;
+    event.data.u64 = tag(entry->generation, fd);
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        return fail(std::string("epoll_ctl add: ") + strerror(errno));
+    }
+    watches[fd] = entry;
+    return true;
+}
+
+bool EventLoop::modify(int fd, uint32_t events) {
+    auto found = watches.find(fd);
+    if (found == watches.end()) {
+        return fail("descriptor " + std::to_string(fd) + " not watched");
+    }
+    struct epoll_event event;
+    event.events = events;
+    event.data.u64 = tag(found->second->generation, fd);
+    if (epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event) != 0) {
+        return fail(std::string("epoll_ctl mod: ") + strerror(errno));
+    }
+    return true;
+}
+
+void EventLoop::unwatch(int fd) {
+    if (watches.erase(fd) != 0) {
+        // Fails harmlessly when the descriptor was closed first
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+}
+
+uint32_t EventLoop::addTimer(uint32_t delayMs, uint32_t periodMs, TimerCallback callback) {
+    uint32_t id = nextTimerId++;
+    if (nextTimerId == 0) {
+        nextTimerId = 1;
+    }
+    std::shared_ptr<Timer> timer = std::make_shared<Timer>();
+    timer->deadlineMs = 0;
+    timer->periodMs = periodMs;
+    timer->version = 0;
+    timer->armed = false;
+    timer->callback = callback;
+    timers[id] = timer;
+    rearmTimer(id, delayMs);
+    return id;
+}
+
+bool EventLoop::rearmTimer(uint32_t id, uint32_t delayMs) {
+    auto found = timers.find(id);
+    if (found == timers.end()) {
+        return false;
+    }
+    Timer& timer = *found->second;
+    if (delayMs == NEVER) {
+        timer.armed = false;
+        timer.version++;
+        return true;
+    }
+    schedule(id, timer, clockMs() + delayMs);
+    return true;
+}
+
+void EventLoop::removeTimer(uint32_t id) {
+    timers.erase(id);
+}
+
+int EventLoop::runOnce(int maxWaitMs) {
+    armTimerFd();
+    struct epoll_event events[MAX_EVENTS];
+    int count = epoll_wait(epollFd, events, MAX_EVENTS, maxWaitMs);
+    if (count < 0) {
+        if (errno != EINTR) {
+            fail(std::string("epoll_wait: ") + strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+    stats.wakeups++;
+
+    int handled = 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t generation = (uint32_t)(events[i].data.u64 >> 32);
+        int fd = (int)(uint32_t)events[i].data.u64;
+        if (generation == 0) {
+            uint64_t value;
+            ssize_t ignored = read(fd, &value, sizeof(value));
+            (void)ignored;
+            if (fd == timerFd) {
+                armedForMs = 0;
+            }
+            continue;
+        }
+        auto found = watches.find(fd);
+        if (found == watches.end() || found->second->generation != generation) {
+            continue;
+        }
+        // Keeps the callback alive should it unwatch itself
+        std::shared_ptr<Watch> entry = found->second;
+        stats.fdEvents++;
+        handled++;
+        entry->callback(events[i].events);
+    }
+    handled += fireTimers();
+    armTimerFd();
+    return handled;
+}
+
+void EventLoop::run() {
+    while (!stopRequested && runOnce(-1) >= 0) {
+    }
+    stopRequested = false;
+}
+
+void EventLoop::stop() {
+    stopRequested = true;
+    uint64_t one = 1;
+    ssize_t ignored = write(wakeFd, &one, sizeof(one));
+    (void)ignored;
+}
+
+uint32_t EventLoop::monotonicMs() {
+    return (uint32_t)clockMs();
+}
+
+size_t EventLoop::getWatchCount() const {
+    return watches.size();
+}
+
+size_t EventLoop::getTimerCount() const {
+    return timers.size();
+}
+
+const EventLoopStats& EventLoop::getStats() const {
+    return stats;
+}
+
+const std::string& EventLoop::getLastError() const {
+    return lastError;
+}
+
+uint64_t EventLoop::clockMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void EventLoop::schedule(uint32_t id, Timer& timer, uint64_t atMs) {
+    timer.version++;
+    timer.deadlineMs = atMs;
+    timer.armed = true;
+    deadlines.push_back({atMs, id, timer.version});
+    std::push_heap(deadlines.begin(), deadlines.end(), std::greater<Deadline>());
+    // Timers rearmed far ahead of their old deadline leave stale entries behind
+    if (deadlines.size() > 2 * timers.size() + 64) {
+        compactDeadlines();
+    }
+}
+
+int EventLoop::fireTimers() {
+    uint64_t now = clockMs();
+    int fired = 0;
+    while (!deadlines.empty() && deadlines.front().atMs <= now) {
+        Deadline due = deadlines.front();
+        std::pop_heap(deadlines.begin(), deadlines.end(), std::greater<Deadline>());
+        deadlines.pop_back();
+        auto found = timers.find(due.id);
+        if (found == timers.end() || !found->second->armed || found->second->version != due.version) {
+            continue;
+        }
+        std::shared_ptr<Timer> timer = found->second;
+        if (timer->periodMs > 0) {
+            // Keeps the phase, unless a whole period was missed
+            uint64_t next = due.atMs + timer->periodMs;
+            schedule(due.id, *timer, next > now ? next : now + timer->periodMs);
+        } else {
+            timer->armed = false;
+        }
+        stats.timersFired++;
+        fired++;
+        timer->callback();
+    }
+    return fired;
+}
+
+void EventLoop::armTimerFd() {
+    while (!deadlines.empty()) {
+        const Deadline& top = deadlines.front();
+        auto found = timers.find(top.id);
+        if (found != timers.end() && found->second->armed && found->second->version == top.version) {
+            break;
+        }
+        std::pop_heap(deadlines.begin(), deadlines.end(), std::greater<Deadline>());
+        deadlines.pop_back();
+    }
+    uint64_t target = deadlines.empty() ? 0 : deadlines.front().atMs;
+    if (target == armedForMs) {
+        return;
+    }
+    // Absolute, so time spent dispatching does not push the deadline out;
+    // one already past fires at once. All zero disarms.
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = (time_t)(target / 1000);
+    spec.it_value.tv_nsec = (long)(target % 1000) * 1000000;
+    if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr) != 0) {
+        fail(std::string("timerfd_settime: ") + strerror(errno));
+        return;
+    }
+    armedForMs = target;
+}
+
+void EventLoop::compactDeadlines() {
+    deadlines.clear();
+    for (const auto& entry : timers) {
+        if (entry.second->armed) {
+            deadlines.push_back({entry.second->deadlineMs, entry.first, entry.second->version});
+        }
+    }
+    std::make_heap(deadlines.begin(), deadlines.end(), std::greater<Deadline>());
+}
+
+bool EventLoop::fail(const std::string& error) {
+    lastError = error;
+    return false;
+}
@@ -0,0 +1,109 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct EventLoopStats {
+    uint64_t wakeups;       // returns from epoll_wait
+    uint64_t fdEvents;      // descriptor callbacks run
+    uint64_t timersFired;
+};
+
+// Single-threaded reactor for the Linux host: descriptors (UARTs, sockets)
+// are watched through epoll, and every timer shares one timerfd armed for
+// the earliest deadline, so the process sleeps in epoll_wait until there is
+// I/O or a timer is due. Callbacks may add and remove watches and timers,
+// their own included.
+class EventLoop {
+public:
+    static const uint32_t NEVER = 0xFFFFFFFF;
+    static const size_t MAX_EVENTS = 64;
+
+    // events is the epoll mask that fired (EPOLLIN, EPOLLOUT, EPOLLERR...)
+    typedef std::function<void(uint32_t events)> FdCallback;
+    typedef std::function<void()> TimerCallback;
+
+    EventLoop();
+    ~EventLoop();
+
+    bool begin();
+
+    bool watch(int fd, uint32_t events, FdCallback callback);
+    bool modify(int fd, uint32_t events);
+    void unwatch(int fd);
+
+    // Fires after delayMs, then every periodMs (0: once, then stays disarmed
+    // until rearmed). Returns the timer ID, never 0.
+    uint32_t addTimer(uint32_t delayMs, uint32_t periodMs, TimerCallback callback);
+    // delayMs NEVER disarms; the timer keeps its ID and callback
+    bool rearmTimer(uint32_t id, uint32_t delayMs);
+    void removeTimer(uint32_t id);
+
+    // Waits up to maxWaitMs (-1: until something happens) and dispatches;
+    // returns the callbacks run, or -1 when epoll itself fails
+    int runOnce(int maxWaitMs = -1);
+    void run();
+    // Safe from callbacks, other threads and signal handlers
+    void stop();
+
+    // CLOCK_MONOTONIC in milliseconds
+    static uint32_t monotonicMs();
+    size_t getWatchCount() const;
+    size_t getTimerCount() const;
+    const EventLoopStats& getStats() const;
+    const std::string& getLastError() const;
+
+private:
+    struct Watch {
+        uint32_t generation;
+        FdCallback callback;
+    };
+
+    struct Timer {
+        uint64_t deadlineMs;
+        uint32_t periodMs;
+        uint32_t version;
+        bool armed;
+        TimerCallback callback;
+    };
+
+    // Heap entries go stale when their timer is rearmed or removed; they are
+    // skipped when they reach the top
+    struct Deadline {
+        uint64_t atMs;
+        uint32_t id;
+        uint32_t version;
+        bool operator>(const Deadline& other) const {
+            return atMs > other.atMs;
+        }
+    };
+
+    int epollFd;
+    int timerFd;
+    int wakeFd;
+    volatile bool stopRequested;
+    std::unordered_map<int, std::shared_ptr<Watch>> watches;
+    std::unordered_map<uint32_t, std::shared_ptr<Timer>> timers;
+    std::vector<Deadline> deadlines;
+    uint32_t nextGeneration;
+    uint32_t nextTimerId;
+    uint64_t armedForMs;
+    EventLoopStats stats;
+    std::string lastError;
+
+    // Helper methods
+    static uint64_t clockMs();
+    void schedule(uint32_t id, Timer& timer, uint64_t atMs);
+    int fireTimers();
+    void armTimerFd();
+    void compactDeadlines();
+    bool fail(const std::string& error);
+};
+
+#endif // EVENT_LOOP_H
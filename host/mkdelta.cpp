@@ -0,0 +1,46 @@
+// mkdelta: builds the CDP1 patch that the update server lists under "delta"
+// next to the full image. The old image must be the .bin the devices run,
+// byte for byte.
+//
+//   mkdelta old.bin new.bin patch.cdp
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "delta_diff.h"
+
+static bool loadFile(const char* path, std::vector<uint8_t>& out) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        out.insert(out.end(), buffer, buffer + n);
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 4) {
+        fprintf(stderr, "usage: %s old.bin new.bin patch.cdp\n", argv[0]);
+        return 2;
+    }
+    std::vector<uint8_t> oldImage;
+    std::vector<uint8_t> newImage;
+    if (!loadFile(argv[1], oldImage) || !loadFile(argv[2], newImage)) {
+        perror("[Delta] read");
+        return 1;
+    }
+    std::vector<uint8_t> patch = makeDeltaPatch(oldImage, newImage);
+    FILE* file = fopen(argv[3], "wb");
+    if (!file || fwrite(patch.data(), 1, patch.size(), file) != patch.size() || fclose(file) != 0) {
+        perror("[Delta] write");
+        return 1;
+    }
+    fprintf(stderr, "[Delta] %zu -> %zu bytes, patch %zu bytes (%.1f%%)\n", oldImage.size(), newImage.size(),
+            patch.size(), newImage.empty() ? 0.0 : 100.0 * patch.size() / newImage.size());
+    return 0;
+}
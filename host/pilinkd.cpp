@@ -0,0 +1,198 @@
+// pilinkd: the Raspberry Pi end of the gateway link. Echoes link checks
+// and appends sample batches to one file per UTC day for long-term storage.
+//
+//   pilinkd [-d /dev/serial0] [-b 2000000] [-o /var/lib/cerise]
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include "pi_link.h"
+#include "posix_serial.h"
+
+static const uint32_t STATS_INTERVAL_MS = 10000;
+static const uint32_t FLUSH_INTERVAL_MS = 1000;
+static volatile sig_atomic_t stopRequested = 0;
+
+static uint64_t unixMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static uint32_t monotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+// Records of: received at (u64 LE, Unix ms) | length (u16 LE) | payload
+class SampleStore {
+public:
+    explicit SampleStore(const std::string& directory) : directory(directory), file(nullptr), day(-1), records(0) {}
+
+    ~SampleStore() {
+        close();
+    }
+
+    bool append(const uint8_t* data, size_t length) {
+        uint64_t now = unixMs();
+        if (!openFor(now)) {
+            return false;
+        }
+        uint8_t header[10];
+        for (int i = 0; i < 8; i++) {
+            header[i] = (uint8_t)(now >> (8 * i));
+        }
+        header[8] = (uint8_t)length;
+        header[9] = (uint8_t)(length >> 8);
+        if (fwrite(header, 1, sizeof(header), file) != sizeof(header) || fwrite(data, 1, length, file) != length) {
+            fprintf(stderr, "[Store] Write failed: %s\n", strerror(errno));
+            return false;
+        }
+        records++;
+        return true;
+    }
+
+    void flush() {
+        if (file != nullptr) {
+            fflush(file);
+        }
+    }
+
+    void close() {
+        if (file != nullptr) {
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+    uint32_t getRecords() const {
+        return records;
+    }
+
+private:
+    std::string directory;
+    FILE* file;
+    long day;
+    uint32_t records;
+
+    bool openFor(uint64_t now) {
+        time_t seconds = (time_t)(now / 1000);
+        long today = (long)(seconds / 86400);
+        if (file != nullptr && today == day) {
+            return true;
+        }
+        close();
+        struct tm utc;
+        gmtime_r(&seconds, &utc);
+        char name[32];
+        strftime(name, sizeof(name), "/samples-%Y%m%d.bin", &utc);
+        std::string path = directory + name;
+        file = fopen(path.c_str(), "ab");
+        if (file == nullptr) {
+            fprintf(stderr, "[Store] Cannot open %s: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+        day = today;
+        return true;
+    }
+};
+
+static void onSignal(int) {
+    stopRequested = 1;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-d device] [-b baud] [-o directory]\n", name);
+}
+
+int main(int argc, char** argv) {
+    const char* device = "/dev/serial0";
+    uint32_t baud = 2000000;
+    std::string directory = "/var/lib/cerise";
+    int option;
+    while ((option = getopt(argc, argv, "d:b:o:h")) != -1) {
+        switch (option) {
+            case 'd': device = optarg; break;
+            case 'b': baud = (uint32_t)strtoul(optarg, nullptr, 10); break;
+            case 'o': directory = optarg; break;
+            default:
+                usage(argv[0]);
+                return option == 'h' ? 0 : 2;
+        }
+    }
+
+    PosixSerialTransport serial;
+    if (!serial.open(device, baud)) {
+        fprintf(stderr, "%s\n", serial.getLastError().c_str());
+        return 1;
+    }
+    mkdir(directory.c_str(), 0755);
+    SampleStore store(directory);
+
+    PiLink link(serial);
+    link.setClock(monotonicMs);
+    link.setReceiveCallback([&link, &store](PiChannel channel, const uint8_t* data, size_t length) {
+        switch (channel) {
+            case PiChannel::LOOPBACK:
+                link.send(PiChannel::LOOPBACK, data, length);
+                break;
+            case PiChannel::SAMPLES:
+                store.append(data, length);
+                break;
+            default:
+                fprintf(stderr, "[Link] Unknown channel %u\n", (unsigned)channel);
+                break;
+        }
+    });
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    fprintf(stderr, "[Link] %s at %u baud, storing in %s\n", device, (unsigned)baud, directory.c_str());
+    link.begin();
+    PiLinkState lastState = link.getState();
+    uint32_t lastStats = monotonicMs();
+    uint32_t lastFlush = lastStats;
+    while (!stopRequested) {
+        // Sleep until the UART has bytes or the link has timed work
+        struct pollfd descriptor = {serial.getFd(), (short)(POLLIN | (link.wantsWrite() ? POLLOUT : 0)), 0};
+        uint32_t due = link.msUntilDue();
+        int timeout = due > FLUSH_INTERVAL_MS ? (int)FLUSH_INTERVAL_MS : (int)due;
+        if (poll(&descriptor, 1, timeout) < 0 && errno != EINTR) {
+            fprintf(stderr, "[Link] poll: %s\n", strerror(errno));
+            break;
+        }
+        link.update();
+
+        if (link.getState() != lastState) {
+            lastState = link.getState();
+            fprintf(stderr, "[Link] %s\n", link.isUp() ? "up" : "syncing");
+        }
+        uint32_t now = monotonicMs();
+        if (now - lastFlush >= FLUSH_INTERVAL_MS) {
+            lastFlush = now;
+            store.flush();
+        }
+        if (now - lastStats >= STATS_INTERVAL_MS) {
+            lastStats = now;
+            const PiLinkStats& stats = link.getStats();
+            fprintf(stderr, "[Link] %u frames in, %u out, %u retransmits, %u CRC errors, %u framing errors, "
+                            "%u records stored\n",
+                    (unsigned)stats.framesReceived, (unsigned)stats.framesSent, (unsigned)stats.retransmits,
+                    (unsigned)stats.crcErrors, (unsigned)stats.framingErrors, (unsigned)store.getRecords());
+        }
+    }
+    store.close();
+    fprintf(stderr, "[Link] Stopped\n");
+    return 0;
+}
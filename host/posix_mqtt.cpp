@@ -0,0 +1,136 @@
+#include "posix_mqtt.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+PosixMqttTransport::PosixMqttTransport() : fd(-1), connected(false), outboxOffset(0) {}
+
+PosixMqttTransport::~PosixMqttTransport() {
+    close();
+}
+
+bool PosixMqttTransport::open(const char* host, uint16_t port) {
+    close();
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses = nullptr;
+    int error = getaddrinfo(host, std::to_string(port).c_str(), &hints, &addresses);
+    if (error != 0) {
+        fail(std::string("resolve ") + host + ": " + gai_strerror(error));
+        return false;
+    }
+    for (struct addrinfo* address = addresses; address != nullptr && !connected; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        bool done = ::connect(fd, address->ai_addr, address->ai_addrlen) == 0;
+        if (!done && errno == EINPROGRESS) {
+            struct pollfd descriptor = {fd, POLLOUT, 0};
+            int socketError = 0;
+            socklen_t size = sizeof(socketError);
+            done = poll(&descriptor, 1, CONNECT_TIMEOUT_MS) == 1
+                   && getsockopt(fd, SOL_SOCKET, SO_ERROR, &socketError, &size) == 0 && socketError == 0;
+            if (!done) {
+                errno = socketError != 0 ? socketError : ETIMEDOUT;
+            }
+        }
+        if (done) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            connected = true;
+        } else {
+            fail(std::string("connect ") + host + ": " + strerror(errno));
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    return connected;
+}
+
+void PosixMqttTransport::close() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    connected = false;
+    outbox.clear();
+    outboxOffset = 0;
+}
+
+bool PosixMqttTransport::isOpen() {
+    return connected;
+}
+
+int PosixMqttTransport::read(uint8_t* data, size_t length) {
+    if (!connected) {
+        return 0;
+    }
+    ssize_t count = recv(fd, data, length, MSG_DONTWAIT);
+    if (count == 0) {
+        fail("connection closed by broker");
+        connected = false;
+        return 0;
+    }
+    if (count < 0) {
+        if (errno != EAGAIN && errno != EINTR) {
+            fail(std::string("recv: ") + strerror(errno));
+            connected = false;
+        }
+        return 0;
+    }
+    return (int)count;
+}
+
+size_t PosixMqttTransport::write(const uint8_t* data, size_t length) {
+    if (!connected || outbox.size() - outboxOffset + length > MAX_OUTBOX) {
+        return 0;
+    }
+    outbox.insert(outbox.end(), data, data + length);
+    flush();
+    return length;
+}
+
+void PosixMqttTransport::flush() {
+    while (connected && outboxOffset < outbox.size()) {
+        ssize_t sent = send(fd, outbox.data() + outboxOffset, outbox.size() - outboxOffset,
+                            MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                fail(std::string("send: ") + strerror(errno));
+                connected = false;
+            }
+            break;
+        }
+        outboxOffset += (size_t)sent;
+    }
+    if (outboxOffset == outbox.size()) {
+        outbox.clear();
+        outboxOffset = 0;
+    }
+}
+
+bool PosixMqttTransport::wantsWrite() const {
+    return connected && outboxOffset < outbox.size();
+}
+
+int PosixMqttTransport::getFd() const {
+    return fd;
+}
+
+const std::string& PosixMqttTransport::getLastError() const {
+    return lastError;
+}
+
+void PosixMqttTransport::fail(const std::string& error) {
+    lastError = error;
+}
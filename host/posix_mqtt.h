@@ -0,0 +1,46 @@
+#ifndef POSIX_MQTT_H
+#define POSIX_MQTT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "mqtt_session.h"
+
+// TCP to the broker for MqttSession on the Linux host. Writes never block:
+// what the socket does not take waits in an outbox that the event loop
+// flushes on EPOLLOUT. open() resolves and connects with a bounded wait; it
+// only runs on (re)connect, never in the data path.
+class PosixMqttTransport : public MqttTransport {
+public:
+    static const int CONNECT_TIMEOUT_MS = 3000;
+    // Beyond this the broker is not keeping up; the session reconnects
+    static const size_t MAX_OUTBOX = 1 << 20;
+
+    PosixMqttTransport();
+    ~PosixMqttTransport();
+
+    bool open(const char* host, uint16_t port) override;
+    void close() override;
+    bool isOpen() override;
+    int read(uint8_t* data, size_t length) override;
+    size_t write(const uint8_t* data, size_t length) override;
+
+    // Writes what the socket takes of the outbox
+    void flush();
+    bool wantsWrite() const;
+    // -1 while closed
+    int getFd() const;
+    const std::string& getLastError() const;
+
+private:
+    int fd;
+    bool connected;
+    std::vector<uint8_t> outbox;
+    size_t outboxOffset;
+    std::string lastError;
+
+    void fail(const std::string& error);
+};
+
+#endif // POSIX_MQTT_H
@@ -0,0 +1,140 @@
+#include "posix_serial.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+
+static bool toSpeed(uint32_t baud, speed_t& speed) {
+    static const struct {
+        uint32_t baud;
+        speed_t speed;
+    } speeds[] = {
+        {9600, B9600}, {19200, B19200}, {38400, B38400}, {57600, B57600}, {115200, B115200},
+        {230400, B230400}, {460800, B460800}, {921600, B921600}, {1000000, B1000000},
+        {1500000, B1500000}, {2000000, B2000000}, {3000000, B3000000}, {4000000, B4000000},
+    };
+    for (const auto& entry : speeds) {
+        if (entry.baud == baud) {
+            speed = entry.speed;
+            return true;
+        }
+    }
+    return false;
+}
+
+PosixSerialTransport::PosixSerialTransport() : fd(-1) {}
+
+PosixSerialTransport::~PosixSerialTransport() {
+    close();
+}
+
+bool PosixSerialTransport::open(const char* path, uint32_t baud, const char* frame) {
+    close();
+    fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        return fail(std::string("open ") + path + ": " + strerror(errno));
+    }
+    return configure(baud, frame);
+}
+
+bool PosixSerialTransport::adopt(int newFd, uint32_t baud) {
+    close();
+    fd = newFd;
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return fail(std::string("fcntl: ") + strerror(errno));
+    }
+    return configure(baud, "8N1");
+}
+
+void PosixSerialTransport::close() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool PosixSerialTransport::enableRs485() {
+    struct serial_rs485 rs485;
+    memset(&rs485, 0, sizeof(rs485));
+    rs485.flags = SER_RS485_ENABLED | SER_RS485_RTS_ON_SEND;
+    if (ioctl(fd, TIOCSRS485, &rs485) != 0) {
+        return fail(std::string("TIOCSRS485: ") + strerror(errno));
+    }
+    return true;
+}
+
+size_t PosixSerialTransport::write(const uint8_t* data, size_t length) {
+    ssize_t written = ::write(fd, data, length);
+    if (written < 0) {
+        if (errno != EAGAIN && errno != EINTR) {
+            fail(std::string("write: ") + strerror(errno));
+        }
+        return 0;
+    }
+    return (size_t)written;
+}
+
+size_t PosixSerialTransport::read(uint8_t* data, size_t capacity) {
+    ssize_t count = ::read(fd, data, capacity);
+    if (count < 0) {
+        // EIO: the other end of a pty is closed
+        if (errno != EAGAIN && errno != EINTR) {
+            fail(std::string("read: ") + strerror(errno));
+        }
+        return 0;
+    }
+    return (size_t)count;
+}
+
+int PosixSerialTransport::getFd() const {
+    return fd;
+}
+
+const std::string& PosixSerialTransport::getLastError() const {
+    return lastError;
+}
+
+bool PosixSerialTransport::configure(uint32_t baud, const char* frame) {
+    if (strlen(frame) != 3 || (frame[0] != '7' && frame[0] != '8') || strchr("NEO", frame[1]) == nullptr
+        || (frame[2] != '1' && frame[2] != '2')) {
+        return fail(std::string("unsupported frame format ") + frame);
+    }
+    struct termios tty;
+    if (tcgetattr(fd, &tty) != 0) {
+        return fail(std::string("tcgetattr: ") + strerror(errno));
+    }
+    cfmakeraw(&tty);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB | CRTSCTS);
+    tty.c_cflag |= frame[0] == '7' ? CS7 : CS8;
+    if (frame[1] != 'N') {
+        tty.c_cflag |= PARENB | (frame[1] == 'O' ? PARODD : 0);
+    }
+    if (frame[2] == '2') {
+        tty.c_cflag |= CSTOPB;
+    }
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 0;
+    if (baud != 0) {
+        speed_t speed;
+        if (!toSpeed(baud, speed)) {
+            return fail("unsupported baud rate " + std::to_string(baud));
+        }
+        cfsetispeed(&tty, speed);
+        cfsetospeed(&tty, speed);
+    }
+    if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+        return fail(std::string("tcsetattr: ") + strerror(errno));
+    }
+    tcflush(fd, TCIOFLUSH);
+    return true;
+}
+
+bool PosixSerialTransport::fail(const std::string& error) {
+    lastError = error;
+    return false;
+}
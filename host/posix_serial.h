@@ -0,0 +1,41 @@
+#ifndef POSIX_SERIAL_H
+#define POSIX_SERIAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include "pi_link.h"
+
+// A tty in raw mode, non-blocking: a UART or USB adapter (RS-485 ones
+// included) on the Pi or an edge box, or either end of a pty pair in tests
+class PosixSerialTransport : public PiLinkTransport {
+public:
+    PosixSerialTransport();
+    ~PosixSerialTransport();
+
+    // baud 0 keeps the current speed (a pty has none). frame is data bits,
+    // parity and stop bits, as in "8N1" or "8E1".
+    bool open(const char* path, uint32_t baud, const char* frame = "8N1");
+    // Takes over an open descriptor, e.g. a pty master
+    bool adopt(int fd, uint32_t baud);
+    void close();
+    // Auto-direction RS-485 adapters (HW-685 and most USB ones) need
+    // nothing; with DE/RE wired to RTS, the kernel driver toggles it around
+    // each frame in this mode. False when the driver has no RS-485 support.
+    bool enableRs485();
+
+    size_t write(const uint8_t* data, size_t length) override;
+    size_t read(uint8_t* data, size_t capacity) override;
+
+    int getFd() const;
+    const std::string& getLastError() const;
+
+private:
+    int fd;
+    std::string lastError;
+
+    bool configure(uint32_t baud, const char* frame);
+    bool fail(const std::string& error);
+};
+
+#endif // POSIX_SERIAL_H
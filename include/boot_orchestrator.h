@@ -0,0 +1,129 @@
+#ifndef BOOT_ORCHESTRATOR_H
+#define BOOT_ORCHESTRATOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <functional>
+#include <string>
+
+// What a stage contributes to the minimal forwarding set
+enum class BootRole : uint8_t {
+    NONE,
+    SOURCE,     // produces samples
+    UPLINK      // carries them off the gateway
+};
+
+enum class BootStageState : uint8_t {
+    WAITING,    // dependencies not ready yet
+    STARTING,   // started, readiness not signalled yet
+    READY,
+    FAILED,     // reported failure or timed out
+    SKIPPED     // a dependency failed
+};
+
+// Returned by a stage's start function: done inline, or signalled later
+// through markReady()/markFailed() from whichever task finishes the work
+enum class BootStartResult : uint8_t {
+    READY,
+    PENDING,
+    FAILED
+};
+
+// One line of the boot timeline; times are ms since begin()
+struct BootStageRecord {
+    const char* name;
+    BootRole role;
+    BootStageState state;
+    uint32_t startedAtMs;
+    uint32_t finishedAtMs;
+};
+
+// Boot as a dependency graph. update() starts every stage whose
+// dependencies are ready, so independent modules come up side by side;
+// long work runs on its own task and signals readiness asynchronously. A
+// stage may only depend on stages added before it, which rules out cycles.
+// Forwarding may start as soon as one SOURCE and one UPLINK stage are
+// ready; the rest keeps booting behind it.
+class BootOrchestrator {
+public:
+    static const size_t MAX_STAGES = 16;
+    static const size_t MAX_DEPENDENCIES = 4;
+    static const uint32_t NO_TIMEOUT = 0;
+    static const uint32_t NOT_YET = 0xFFFFFFFF;
+
+    typedef std::function<BootStartResult()> StartFunction;
+
+    BootOrchestrator();
+
+    void setClock(uint32_t (*clock)());
+    void setLogCallback(std::function<void(const char* line)> callback);
+
+    // Returns the stage index, or -1 when full or after the boot completed
+    int addStage(const char* name, BootRole role, StartFunction start, uint32_t timeoutMs = NO_TIMEOUT);
+    bool addDependency(int stage, int dependsOn);
+    int findStage(const char* name) const;
+
+    // Starts the timeline; stages start on the following update() calls
+    void begin();
+    // Starts what can start and applies timeouts; call from one task
+    void update();
+
+    // Any task. Signals sent before the stage started are ignored.
+    void markReady(int stage);
+    void markFailed(int stage);
+
+    BootStageState getState(int stage) const;
+    bool isReady(int stage) const;
+    // Ready, failed or skipped: the stage will not change any more
+    bool isSettled(int stage) const;
+    bool isForwardingReady() const;
+    bool isComplete() const;
+    uint32_t getForwardingReadyAt() const;
+    uint32_t getCompletedAt() const;
+
+    size_t getStageCount() const;
+    bool getStage(size_t index, BootStageRecord& record) const;
+    // {"forwardingMs", "completeMs", "stages": [{"name", "role", "state",
+    //  "startMs", "endMs", "durationMs", "after": [...]}]}
+    std::string exportTimeline() const;
+
+private:
+    enum Signal : uint8_t {
+        SIGNAL_NONE,
+        SIGNAL_READY,
+        SIGNAL_FAILED
+    };
+
+    struct Stage {
+        const char* name;
+        BootRole role;
+        StartFunction start;
+        uint32_t timeoutMs;
+        uint8_t dependencyCount;
+        uint8_t dependencies[MAX_DEPENDENCIES];
+        std::atomic<BootStageState> state;
+        std::atomic<uint8_t> signal;
+        std::atomic<uint32_t> signalledAt;
+        uint32_t startedAt;
+        uint32_t finishedAt;
+    };
+
+    uint32_t (*clock)();
+    std::function<void(const char*)> logCallback;
+    Stage stages[MAX_STAGES];
+    size_t stageCount;
+    bool started;
+    uint32_t beganAt;
+    std::atomic<uint32_t> forwardingReadyAt;
+    std::atomic<uint32_t> completedAt;
+
+    // Helper methods
+    bool startReadyStages(uint32_t now);
+    void collectSignals();
+    void finish(Stage& stage, BootStageState state, uint32_t at);
+    void checkMilestones(uint32_t now);
+    void emitLog(const char* format, ...);
+};
+
+#endif // BOOT_ORCHESTRATOR_H
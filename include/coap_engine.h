@@ -0,0 +1,241 @@
+#ifndef COAP_ENGINE_H
+#define COAP_ENGINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Datagram link to the CoAP server (WiFiUDP on the device, loopback in tests)
+class CoapTransport {
+public:
+    virtual ~CoapTransport() {}
+    virtual bool send(const uint8_t* data, size_t length) = 0;
+    // Non-blocking; returns the size of the next datagram or 0
+    virtual int receive(uint8_t* data, size_t capacity) = 0;
+};
+
+#ifdef ARDUINO
+#include <Udp.h>
+#include <IPAddress.h>
+
+class UdpCoapTransport : public CoapTransport {
+public:
+    explicit UdpCoapTransport(UDP& udp) : udp(udp), serverPort(5683) {}
+    bool begin(uint16_t localPort);
+    void setServer(const IPAddress& address, uint16_t port);
+    bool send(const uint8_t* data, size_t length) override;
+    int receive(uint8_t* data, size_t capacity) override;
+
+private:
+    UDP& udp;
+    IPAddress serverAddress;
+    uint16_t serverPort;
+};
+#endif
+
+// RFC 7252 message types, codes and the options this client uses
+enum class CoapType : uint8_t {
+    CON = 0,
+    NON = 1,
+    ACK = 2,
+    RST = 3
+};
+
+enum class CoapMethod : uint8_t {
+    GET = 1,
+    POST = 2,
+    PUT = 3,
+    DELETE = 4
+};
+
+namespace CoapOptionNumber {
+    const uint16_t OBSERVE = 6;
+    const uint16_t URI_PATH = 11;
+    const uint16_t CONTENT_FORMAT = 12;
+    const uint16_t BLOCK2 = 23;
+    const uint16_t BLOCK1 = 27;
+}
+
+namespace CoapCode {
+    const uint8_t EMPTY = 0x00;
+    const uint8_t CREATED = 0x41;   // 2.01
+    const uint8_t CHANGED = 0x44;   // 2.04
+    const uint8_t CONTENT = 0x45;   // 2.05
+    const uint8_t CONTINUE = 0x5F;  // 2.31
+    const uint8_t NOT_FOUND = 0x84; // 4.04
+}
+
+struct CoapOption {
+    uint16_t number;
+    const uint8_t* value;
+    uint16_t length;
+};
+
+// Parsed view of a datagram; option values and payload point into it
+struct CoapMessage {
+    static const size_t MAX_OPTIONS = 16;
+
+    CoapType type;
+    uint8_t code;
+    uint16_t messageId;
+    uint8_t token[8];
+    uint8_t tokenLength;
+    CoapOption options[MAX_OPTIONS];
+    size_t optionCount;
+    const uint8_t* payload;
+    size_t payloadLength;
+
+    const CoapOption* find(uint16_t number) const;
+    bool getUint(uint16_t number, uint32_t& value) const;
+};
+
+bool coapParse(const uint8_t* data, size_t length, CoapMessage& message);
+
+// Serializer; options must be added in ascending option number
+class CoapWriter {
+public:
+    CoapWriter(uint8_t* out, size_t capacity);
+
+    void header(CoapType type, uint8_t code, uint16_t messageId, const uint8_t* token, uint8_t tokenLength);
+    void option(uint16_t number, const uint8_t* value, size_t length);
+    void optionUint(uint16_t number, uint32_t value);
+    void uriPath(const char* path);
+    void payload(const uint8_t* data, size_t length);
+
+    size_t length() const;
+    bool overflowed() const;
+
+private:
+    uint8_t* out;
+    size_t capacity;
+    size_t used;
+    uint16_t lastOption;
+    bool overflow;
+
+    void put(uint8_t byte);
+    void put(const uint8_t* data, size_t length);
+};
+
+enum class CoapStatus : uint8_t {
+    RESPONSE,
+    TIMEOUT,
+    RESET,
+    TOO_LARGE
+};
+
+struct CoapResponse {
+    CoapStatus status;
+    uint8_t code;
+    const uint8_t* payload;
+    size_t length;
+    bool notification;
+    uint32_t observeSequence;
+};
+
+typedef std::function<void(uint32_t handle, const CoapResponse&)> CoapCallback;
+
+struct CoapStats {
+    uint32_t requests;
+    uint32_t responses;
+    uint32_t retransmits;
+    uint32_t timeouts;
+    uint32_t notifications;
+    uint32_t duplicates;
+    uint32_t blocksSent;
+    uint32_t blocksReceived;
+    uint32_t datagramsSent;
+};
+
+// Non-blocking CoAP client. Confirmable requests are retransmitted with
+// exponential back-off (RFC 7252 4.2), Observe keeps a registration open
+// for server-pushed notifications (RFC 7641), and bodies larger than the
+// block size travel as Block1/Block2 sequences (RFC 7959). Call update()
+// regularly; results are reported through the request callback.
+class CoapEngine {
+public:
+    static const size_t MAX_EXCHANGES = 8;
+    static const size_t MAX_DATAGRAM_SIZE = 1152;
+    static const size_t MAX_BODY_SIZE = 4096;
+    static const uint32_t ACK_TIMEOUT_MS = 2000;
+    static const uint8_t MAX_RETRANSMIT = 4;
+    static const uint32_t RESPONSE_TIMEOUT_MS = 30000;
+
+    explicit CoapEngine(CoapTransport& transport);
+
+    // Configuration
+    void setClock(uint32_t (*clock)());
+    void setSeed(uint32_t seed);
+    bool setBlockSize(size_t size);
+    void setAckTimeout(uint32_t ms);
+
+    // Requests return a handle, or 0 when no exchange slot is free
+    uint32_t request(CoapMethod method, const char* path, const uint8_t* payload = nullptr, size_t length = 0,
+                     int contentFormat = -1, bool confirmable = true, CoapCallback callback = nullptr);
+    uint32_t observe(const char* path, CoapCallback callback);
+    bool cancel(uint32_t handle);
+    void update();
+
+    // Status methods
+    size_t getActiveCount() const;
+    bool isObserving(uint32_t handle) const;
+    const CoapStats& getStats() const;
+
+private:
+    struct Exchange {
+        bool active;
+        bool observe;
+        bool cancelling;
+        bool confirmable;
+        bool awaitingAck;
+        uint32_t handle;
+        CoapMethod method;
+        std::string path;
+        int contentFormat;
+        std::vector<uint8_t> body;
+        std::vector<uint8_t> response;
+        uint32_t block1Num;
+        uint32_t block2Num;
+        uint8_t block2Szx;
+        uint16_t messageId;
+        uint8_t retransmits;
+        uint32_t sentAt;
+        uint32_t timeoutMs;
+        uint32_t deadline;
+        bool hasObserveSequence;
+        uint32_t observeSequence;
+        uint32_t lastNotificationAt;
+        CoapCallback callback;
+        std::vector<uint8_t> datagram;
+    };
+
+    CoapTransport& transport;
+    uint32_t (*clock)();
+    uint32_t rngState;
+    uint8_t blockSzx;
+    uint32_t ackTimeoutMs;
+    uint16_t nextMessageId;
+    uint32_t nextHandle;
+    Exchange exchanges[MAX_EXCHANGES];
+    uint16_t recentIds[8];
+    size_t recentCount;
+    CoapStats stats;
+    uint8_t rxBuffer[MAX_DATAGRAM_SIZE];
+
+    // Helper methods
+    Exchange* allocate();
+    Exchange* findByHandle(uint32_t handle);
+    Exchange* findByToken(const CoapMessage& message);
+    Exchange* findByMessageId(uint16_t messageId);
+    bool sendExchange(Exchange& exchange);
+    void handleMessage(const CoapMessage& message);
+    void handleResponse(Exchange& exchange, const CoapMessage& message);
+    void complete(Exchange& exchange, CoapStatus status, uint8_t code, const uint8_t* payload, size_t length);
+    void sendEmpty(CoapType type, uint16_t messageId);
+    bool seenRecently(uint16_t messageId);
+    uint32_t nextRandom();
+    size_t blockSize(uint8_t szx) const;
+};
+
+#endif // COAP_ENGINE_H
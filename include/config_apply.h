@@ -0,0 +1,157 @@
+#ifndef CONFIG_APPLY_H
+#define CONFIG_APPLY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "protocol_types.h"
+
+// One setting as text, keyed like the persisted JSON
+struct ConfigField {
+    std::string key;
+    std::string value;
+};
+
+typedef std::vector<ConfigField> ConfigValues;
+
+inline uint8_t protocolBit(ProtocolType protocol) {
+    return (uint8_t)(1u << static_cast<uint8_t>(protocol));
+}
+
+static const uint8_t ALL_PROTOCOLS = (uint8_t)((1u << PROTOCOL_TYPE_COUNT) - 1);
+
+// How a changed field reaches the running uplinks
+enum class FieldEffect : uint8_t {
+    LIVE,        // picked up in place; nothing reconnects
+    RECONNECT,   // the drivers in the mask drain and reconnect
+    TLS          // credentials reload; the drivers in the mask reconnect
+};
+
+struct FieldRule {
+    const char* key;
+    uint8_t protocols;      // protocolBit() mask
+    FieldEffect effect;
+};
+
+struct ConfigDiff {
+    std::vector<std::string> changed;
+    uint8_t reconnect;      // protocolBit() mask
+    bool tlsReload;
+};
+
+// Field by field. A field without a rule reconnects every protocol.
+void diffConfig(const ConfigValues& from, const ConfigValues& to, const FieldRule* rules, size_t ruleCount,
+                ConfigDiff& diff);
+
+// The uplink side of a transaction; ProtocolManager on the device, a fake
+// in tests. install() swaps the live configuration without touching
+// connections; a held protocol takes no new messages, so the router sends
+// them elsewhere or they wait in the queue.
+class ConfigTarget {
+public:
+    virtual ~ConfigTarget() {}
+    virtual ConfigValues currentValues() const = 0;
+    virtual bool validate(const ConfigValues& values, std::string& error) = 0;
+    virtual void install(const ConfigValues& values, bool reloadTls) = 0;
+    virtual bool persist(const ConfigValues& values) = 0;
+    virtual void hold(ProtocolType protocol, bool held) = 0;
+    // Messages handed to the driver but not yet acknowledged
+    virtual size_t inflight(ProtocolType protocol) const = 0;
+    virtual bool isConfigured(ProtocolType protocol) = 0;
+    virtual bool connect(ProtocolType protocol) = 0;
+    virtual void disconnect(ProtocolType protocol) = 0;
+    virtual bool isConnected(ProtocolType protocol) const = 0;
+};
+
+enum class ApplyState : uint8_t {
+    IDLE,
+    DRAINING,
+    RECONNECTING,
+    ROLLING_BACK
+};
+
+enum class ApplyResult : uint8_t {
+    APPLIED,
+    UNCHANGED,
+    REJECTED,         // busy, unknown field or failed validation
+    ROLLED_BACK,      // a reconnect failed; the old config is back
+    ROLLBACK_FAILED   // the old config is back but did not reconnect either
+};
+
+struct ApplyReport {
+    uint32_t id;
+    ApplyResult result;
+    std::vector<std::string> changed;
+    uint8_t reconnected;    // protocolBit() mask
+    uint8_t failed;         // protocolBit() mask
+    uint32_t drainMs;
+    uint32_t durationMs;
+    std::string error;
+};
+
+// {"id", "result", "changed": [...], "reconnected": [...], "failed": [...],
+//  "drainMs", "durationMs", "error"}
+std::string exportApplyReport(const ApplyReport& report);
+
+// Applies a configuration as a transaction: diff against the running one,
+// hold and drain only the affected uplinks (in-flight messages acked or
+// the drain timeout), swap, reconnect those, and persist once every uplink
+// that was connected before is connected again. Otherwise the previous
+// configuration is reinstalled and reconnected, and nothing is persisted.
+// Unaffected uplinks keep flowing throughout. Drive update() from the
+// task that owns the target.
+class ConfigApplier {
+public:
+    static const uint32_t DEFAULT_DRAIN_TIMEOUT_MS = 5000;
+    static const uint32_t DEFAULT_CONNECT_TIMEOUT_MS = 15000;
+
+    typedef std::function<void(const ApplyReport& report)> ReportCallback;
+
+    ConfigApplier(ConfigTarget& target, const FieldRule* rules, size_t ruleCount);
+
+    void setClock(uint32_t (*clock)());
+    void setTimeouts(uint32_t drainMs, uint32_t connectMs);
+    void setReportCallback(ReportCallback callback);
+
+    // Fields not given keep their current value. Returns the transaction
+    // ID, or 0 when refused at once; the outcome is always reported.
+    uint32_t apply(const ConfigValues& changes);
+    void update();
+
+    bool isBusy() const;
+    ApplyState getState() const;
+    const ApplyReport& getLastReport() const;
+
+private:
+    ConfigTarget& target;
+    const FieldRule* rules;
+    size_t ruleCount;
+    uint32_t (*clock)();
+    ReportCallback reportCallback;
+    uint32_t drainTimeoutMs;
+    uint32_t connectTimeoutMs;
+    uint32_t nextId;
+
+    ApplyState state;
+    ConfigValues previous;
+    ConfigValues pending;
+    ConfigDiff diff;
+    uint8_t affected;
+    uint8_t connectedBefore;
+    uint8_t required;       // must be connected before the phase ends
+    uint8_t connectFailed;
+    uint32_t startedAt;
+    uint32_t phaseStartedAt;
+    ApplyReport report;
+
+    // Helper methods
+    bool drained() const;
+    // Installs values and reconnects the affected uplinks; returns those configured
+    uint8_t swap(const ConfigValues& values, uint32_t now);
+    uint8_t connectedMask() const;
+    void finish(ApplyResult result, uint32_t now, const std::string& error);
+};
+
+#endif // CONFIG_APPLY_H
@@ -0,0 +1,85 @@
+#ifndef DEFLATE_ENCODER_H
+#define DEFLATE_ENCODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+
+// Framing around the deflate stream: raw for framed WebSocket messages,
+// gzip for HTTP Content-Encoding, zlib for anything that wants a checksum
+enum class DeflateContainer : uint8_t {
+    RAW,
+    ZLIB,
+    GZIP
+};
+
+// Streaming deflate compressor (RFC 1951) with a bounded window. Output is
+// one block with the fixed Huffman codes, so nothing is buffered beyond the
+// window and any zlib can decode it. All working memory (window, hash
+// chains, output staging) is part of the object: allocate it once and reuse
+// it for every message.
+class DeflateEncoder {
+public:
+    static const size_t WINDOW_SIZE = 2048;
+    static const size_t MIN_MATCH = 3;
+    static const size_t MAX_MATCH = 258;
+    static const size_t MAX_CHAIN = 32;
+
+    // Receives compressed bytes as they are produced; false aborts the stream
+    typedef std::function<bool(const uint8_t* data, size_t length)> Sink;
+
+    DeflateEncoder();
+
+    void begin(DeflateContainer container, Sink sink);
+    bool write(const uint8_t* data, size_t length);
+    bool finish();
+
+    // One-shot into a caller buffer; returns 0 if the output does not fit
+    size_t compress(DeflateContainer container, const uint8_t* input, size_t length, uint8_t* output,
+                    size_t capacity);
+
+    size_t getTotalIn() const;
+    size_t getTotalOut() const;
+
+    static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t length);
+    static uint32_t adler32(uint32_t adler, const uint8_t* data, size_t length);
+
+private:
+    static const size_t HASH_BITS = 10;
+    static const uint16_t NO_POSITION = 0xFFFF;
+    static const size_t OUTPUT_SIZE = 128;
+
+    uint8_t window[2 * WINDOW_SIZE];
+    uint16_t head[1 << HASH_BITS];
+    uint16_t prev[WINDOW_SIZE];
+    size_t position;
+    size_t end;
+
+    uint32_t bitBuffer;
+    uint8_t bitCount;
+    uint8_t output[OUTPUT_SIZE];
+    size_t outputLength;
+
+    DeflateContainer container;
+    Sink sink;
+    bool failed;
+    uint32_t checksum;
+    size_t totalIn;
+    size_t totalOut;
+
+    // Helper methods
+    static uint16_t hash(const uint8_t* p);
+    void insert(size_t at);
+    size_t findMatch(size_t at, size_t available, size_t& distance) const;
+    void slide();
+    void encode(bool flush);
+    void putBits(uint32_t value, uint8_t count);
+    void putCode(uint16_t code, uint8_t length);
+    void putLiteral(uint8_t value);
+    void putSymbol(uint16_t symbol);
+    void putMatch(size_t length, size_t distance);
+    void putByte(uint8_t value);
+    void flushOutput();
+};
+
+#endif // DEFLATE_ENCODER_H
@@ -0,0 +1,93 @@
+#ifndef DELTA_UPDATE_H
+#define DELTA_UPDATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+
+// Delta patch format (bsdiff-style, streamed):
+//   header:  "CDP1" | targetSize (u32 LE) | targetCrc32 (u32 LE)
+//   records: diffLen | extraLen | seek (varints, seek zigzag encoded)
+//            followed by diffLen encoded diff bytes and extraLen raw bytes
+// Diff bytes are added to the source image byte by byte. A zero diff byte
+// is followed by a varint run length, so unchanged regions cost 2-3 bytes.
+
+enum class DeltaState {
+    HEADER,
+    CONTROL,
+    DIFF,
+    DIFF_RUN,
+    EXTRA,
+    DONE,
+    ERROR
+};
+
+class DeltaPatcher {
+public:
+    typedef std::function<bool(uint32_t offset, uint8_t* buffer, size_t length)> SourceReader;
+    typedef std::function<bool(const uint8_t* data, size_t length)> TargetWriter;
+
+    // Working memory is fixed: one source window and one output buffer
+    static const size_t BUFFER_SIZE = 512;
+    static const size_t HEADER_SIZE = 12;
+
+    DeltaPatcher();
+    void begin(SourceReader reader, TargetWriter writer, uint32_t sourceSize);
+
+    // Feed patch bytes in arbitrary chunks as they arrive from the network
+    bool write(const uint8_t* data, size_t length);
+    // Flushes pending output and checks target size and CRC
+    bool finish();
+
+    // Status methods
+    DeltaState getState() const;
+    bool hasHeader() const;
+    uint32_t getTargetSize() const;
+    uint32_t getBytesWritten() const;
+    const char* getLastError() const;
+
+private:
+    SourceReader sourceReader;
+    TargetWriter targetWriter;
+    uint32_t sourceSize;
+    DeltaState state;
+    const char* lastError;
+
+    // Header
+    uint8_t header[HEADER_SIZE];
+    size_t headerPos;
+    uint32_t targetSize;
+    uint32_t targetCrc;
+
+    // Current control record
+    uint32_t control[3];
+    uint8_t controlField;
+    uint32_t varintValue;
+    uint8_t varintShift;
+    uint32_t diffRemaining;
+    uint32_t extraRemaining;
+    uint32_t sourcePos;
+
+    // Buffers
+    uint8_t sourceWindow[BUFFER_SIZE];
+    uint32_t windowStart;
+    size_t windowLength;
+    uint8_t output[BUFFER_SIZE];
+    size_t outputLength;
+    uint32_t written;
+    uint32_t crc;
+
+    // Helper methods
+    bool parseHeader();
+    bool feedVarint(uint8_t byte, uint32_t& value);
+    bool startRecord();
+    bool sourceByte(uint8_t& value);
+    bool emit(uint8_t value);
+    bool emitUnchanged(uint32_t count);
+    bool flush();
+    bool fail(const char* error);
+};
+
+uint32_t deltaCrc32(uint32_t crc, const uint8_t* data, size_t length);
+
+#endif // DELTA_UPDATE_H
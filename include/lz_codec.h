@@ -0,0 +1,35 @@
+#ifndef LZ_CODEC_H
+#define LZ_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// LZSS block codec in the spirit of heatshrink: 4 KB window, matches of
+// 3..18 bytes, one flag byte per eight tokens. The compressor's only working
+// memory is its hash table, so it can live in a long-lived object instead of
+// on the stack.
+class LzCodec {
+public:
+    static const size_t WINDOW_SIZE = 4096;
+    static const size_t MIN_MATCH = 3;
+    static const size_t MAX_MATCH = 18;
+    static const size_t MAX_INPUT = 0xFFFE;
+
+    LzCodec();
+
+    // Return the number of bytes produced, or 0 if the output does not fit
+    size_t compress(const uint8_t* input, size_t length, uint8_t* output, size_t capacity);
+    static size_t decompress(const uint8_t* input, size_t length, uint8_t* output, size_t capacity);
+
+    // Worst case output size for an incompressible block
+    static size_t maxCompressedSize(size_t length);
+
+private:
+    static const size_t HASH_BITS = 10;
+    static const uint16_t NO_POSITION = 0xFFFF;
+    uint16_t head[1 << HASH_BITS];
+
+    static uint16_t hash(const uint8_t* p);
+};
+
+#endif // LZ_CODEC_H
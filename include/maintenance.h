@@ -7,7 +7,14 @@
 #include <HTTPClient.h>
 #include <SPIFFS.h>
 #include <ArduinoJson.h>
-#include <WebServer.h>
+#include <atomic>
+#include <ESPAsyncWebServer.h>
+#include "delta_update.h"
+#include "telemetry_hub.h"
+#include "snapshot_store.h"
+
+// Field-bus capture written on stop (RAM) or as it runs (flash)
+#define CAPTURE_TRACE_FILE "/capture.trc"
 
 // Maintenance states
 enum class MaintenanceState {
@@ -21,6 +28,32 @@ enum class MaintenanceState {
     ERROR
 };
 
+// Long-running operations requested over HTTP are queued as jobs and
+// executed from update(), so handlers on the async_tcp task return at once
+enum class MaintenanceJobStatus {
+    QUEUED,
+    RUNNING,
+    DONE,
+    FAILED
+};
+
+struct MaintenanceJob {
+    uint32_t id;
+    MaintenanceState action;
+    MaintenanceJobStatus status;
+    char message[64];
+};
+
+// SPIFFS backend for configuration snapshots
+class SpiffsSnapshotStorage : public SnapshotStorage {
+public:
+    bool writeFile(const std::string& path, const uint8_t* data, size_t length) override;
+    bool readFile(const std::string& path, std::vector<uint8_t>& data) override;
+    bool exists(const std::string& path) override;
+    bool remove(const std::string& path) override;
+    void list(const std::string& prefix, std::vector<std::string>& paths) override;
+};
+
 // Configuration structure
 struct SystemConfig {
     String deviceId;
@@ -36,18 +69,29 @@ struct SystemConfig {
 class Maintenance {
 public:
     Maintenance();
+    // Routes and state only; storage is mounted separately, since
+    // formatting a blank partition can take seconds
     void begin();
+    bool mountStorage();
     void update();
     
     // OTA Update methods
     bool checkForUpdates();
     bool performUpdate(const String& url);
+    bool performDeltaUpdate(const String& url, const String& md5);
     void setUpdateServer(const String& server);
     
     // Backup and Restore methods
     bool backupSystem();
     bool restoreSystem();
     bool factoryReset();
+    void addSnapshotSource(const String& name,
+                           std::function<bool(std::vector<uint8_t>&)> exportData,
+                           std::function<bool(const uint8_t*, size_t)> importData);
+    // A restore that changes a file only read at boot reports that a
+    // reboot is needed to apply it
+    void addSnapshotFile(const String& name, const String& path, bool readAtBoot = false);
+    void setBackupRetention(size_t count);
     
     // Configuration methods
     bool saveConfig();
@@ -68,15 +112,61 @@ public:
     void startWebServer();
     void stopWebServer();
     bool isWebServerRunning() const;
+    TelemetryHub& getTelemetry();
+
+    // Called while long transfers make progress, so a supervisor
+    // watching the calling task sees it alive
+    void setProgressHook(std::function<void()> hook);
+
+    // Starts (toFlash picks the sink) or stops a serial capture; the hook
+    // only queues the request for the acquisition task
+    void setCaptureControl(std::function<bool(bool start, bool toFlash)> control);
+
+    // JSON served at GET /boot
+    void setBootTimeline(std::function<String()> timeline);
+
+    // POST /config/protocols takes a JSON object of protocol fields to
+    // change; the hook only queues it for the network task. GET serves the
+    // report of the last change.
+    void setProtocolConfigControl(std::function<bool(const String& json)> control);
+    void setProtocolConfigReport(std::function<String()> report);
+    // Hands a restored protocol config to the protocol manager; called from
+    // the task running update()
+    void setProtocolConfigRestore(std::function<bool(const String& json)> restore);
+
+    // Job methods
+    uint32_t queueJob(MaintenanceState action);
+    bool getJob(uint32_t id, MaintenanceJob& job) const;
 
 private:
-    MaintenanceState currentState;
+    // Jobs run on the network task; the LED and HTTP handlers read these
+    std::atomic<MaintenanceState> currentState;
     SystemConfig config;
     String lastError;
-    float updateProgress;
+    std::atomic<float> updateProgress;
     bool remoteDebugEnabled;
-    WebServer webServer;
+    AsyncWebServer webServer;
     bool webServerRunning;
+    SemaphoreHandle_t stateMutex;
+    TelemetryHub telemetry;
+    SpiffsSnapshotStorage snapshotStorage;
+    SnapshotStore snapshots;
+
+    // Job queue
+    static const size_t MAX_JOBS = 8;
+    MaintenanceJob jobs[MAX_JOBS];
+    uint32_t nextJobId;
+    uint32_t activeJobId;
+    DeltaPatcher deltaPatcher;
+    std::function<void()> progressHook;
+    std::function<bool(bool, bool)> captureControl;
+    std::function<String()> bootTimeline;
+    std::function<bool(const String&)> protocolConfigControl;
+    std::function<String()> protocolConfigReport;
+    std::function<bool(const String&)> protocolConfigRestore;
+    String rebootNeededFor;
+    static const size_t MAX_CONFIG_BODY = 2048;
+    static const unsigned long OTA_STALL_TIMEOUT_MS = 10000;
     
     // Helper methods
     bool downloadFile(const String& url, const String& path);
@@ -87,18 +177,26 @@ private:
     bool formatStorage();
     bool backupConfig();
     bool restoreConfig();
+    void noteRebootNeeded(const String& name);
     void logMaintenanceEvent(const String& event);
+    void startNextJob();
+    void finishJob(bool success);
     
     // Web server handlers
-    void handleRoot();
-    void handleUpdate();
-    void handleBackup();
-    void handleRestore();
-    void handleFactoryReset();
-    void handleConfig();
-    void handleNotFound();
-    void handleUpdateProgress();
-    void handleSystemStatus();
+    void handleRoot(AsyncWebServerRequest* request);
+    void handleJobRequest(AsyncWebServerRequest* request, MaintenanceState action);
+    void handleJobStatus(AsyncWebServerRequest* request);
+    void handleConfig(AsyncWebServerRequest* request);
+    void handleNotFound(AsyncWebServerRequest* request);
+    void handleUpdateProgress(AsyncWebServerRequest* request);
+    void handleSystemStatus(AsyncWebServerRequest* request);
+    void handleCaptureRequest(AsyncWebServerRequest* request, bool start);
+    void handleCaptureDownload(AsyncWebServerRequest* request);
+    void handleProtocolConfigBody(AsyncWebServerRequest* request, uint8_t* data, size_t length, size_t index,
+                                  size_t total);
+    void handleProtocolConfigRequest(AsyncWebServerRequest* request);
+    void handleProtocolConfigReport(AsyncWebServerRequest* request);
+    void handleBootTimeline(AsyncWebServerRequest* request);
 };
 
 #endif // MAINTENANCE_H 
\ No newline at end of file
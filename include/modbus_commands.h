@@ -0,0 +1,149 @@
+#ifndef MODBUS_COMMANDS_H
+#define MODBUS_COMMANDS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <vector>
+#include "modbus_gateway.h"
+
+// Remote write of holding registers, e.g. from an MQTT control topic
+struct ModbusCommand {
+    static const size_t MAX_ID_LENGTH = 32;
+
+    char id[MAX_ID_LENGTH];         // correlation ID echoed in the ack
+    uint8_t unit;
+    uint8_t priority;               // 0 is the most urgent
+    bool verify;                    // read the registers back after the write
+    uint16_t start;
+    uint16_t count;
+    uint16_t values[ModbusRtuMaster::MAX_WRITE_REGISTERS];
+    uint32_t expiryMs;              // 0 for the queue default
+};
+
+enum class CommandStatus : uint8_t {
+    OK,
+    REJECTED,        // failed validation
+    QUEUE_FULL,
+    EXPIRED,         // never reached the bus in time
+    EXCEPTION,       // slave exception or no response
+    VERIFY_FAILED    // read-back differs from what was written
+};
+
+struct ModbusCommandAck {
+    char id[ModbusCommand::MAX_ID_LENGTH];
+    uint8_t unit;
+    CommandStatus status;
+    uint8_t exception;
+    uint8_t attempts;
+    uint32_t latencyMs;     // from submit to ack
+};
+
+struct ModbusCommandStats {
+    uint32_t submitted;
+    uint32_t rejected;
+    uint32_t completed;
+    uint32_t failed;
+    uint32_t writes;        // bus transactions, after merging
+    uint32_t merged;        // commands that shared a write with another
+    uint32_t deferred;      // commands held back at least once for a due poll
+};
+
+// Downlink commands for the RTU slaves. Commands are validated against the
+// writable ranges, queued per slave by priority, and written when the
+// gateway offers an idle bus: only if the write (and its read-back) fits
+// before the next poll is due, unless the command has waited MAX_DEFER_MS or
+// is urgent. Pending commands for adjacent or overlapping registers of the
+// same slave go out as one FC16 write, newest values winning; a single
+// register uses FC06. Every command ends in exactly one ack.
+class ModbusCommandQueue {
+public:
+    static const size_t MAX_COMMANDS = 16;
+    static const uint32_t DEFAULT_EXPIRY_MS = 10000;
+    static const uint32_t MAX_DEFER_MS = 250;
+    static const uint8_t URGENT_PRIORITY = 0;
+    static const uint8_t MAX_ATTEMPTS = 2;
+    // Slave processing time assumed per exchange when fitting between polls
+    static const uint32_t TURNAROUND_MS = 10;
+
+    typedef std::function<void(const ModbusCommandAck& ack)> AckCallback;
+    // Registers changed on the slave, so cached copies can be dropped
+    typedef std::function<void(uint8_t unit, uint16_t start, uint16_t count)> WriteCallback;
+
+    explicit ModbusCommandQueue(ModbusRtuMaster& master);
+
+    void setClock(uint32_t (*clock)());
+    void setAckCallback(AckCallback callback);
+    void setWriteCallback(WriteCallback callback);
+
+    // Commands outside every writable range are rejected; none means none
+    bool addWritableRange(uint8_t unit, uint16_t start, uint16_t count);
+    void clearWritableRanges();
+
+    // Validates and queues; a refused command is acked at once
+    bool submit(const ModbusCommand& command);
+    // Expires stale commands; call every loop
+    void update();
+    // Starts the next write if the bus can spare it; for ModbusTcpGateway::setIdleTask
+    bool dispatch(uint32_t now, uint32_t pollDueInMs);
+
+    bool isActive() const;
+    size_t getPendingCount() const;
+    const ModbusCommandStats& getStats() const;
+
+private:
+    struct Entry {
+        bool used;
+        bool inFlight;
+        bool deferred;
+        uint32_t sequence;
+        uint32_t receivedAt;
+        uint32_t expiresAt;
+        uint8_t attempts;
+        ModbusCommand command;
+    };
+
+    struct WritableRange {
+        uint8_t unit;
+        uint16_t start;
+        uint16_t count;
+    };
+
+    enum class Phase : uint8_t {
+        IDLE,
+        WRITING,
+        VERIFYING
+    };
+
+    ModbusRtuMaster& master;
+    uint32_t (*clock)();
+    AckCallback ackCallback;
+    WriteCallback writeCallback;
+    std::vector<WritableRange> writable;
+    Entry entries[MAX_COMMANDS];
+    uint32_t nextSequence;
+    uint8_t lastUnit;
+    ModbusCommandStats stats;
+
+    // The write on the bus: merged range and values
+    Phase phase;
+    uint8_t batchUnit;
+    uint16_t batchStart;
+    uint16_t batchCount;
+    bool batchVerify;
+    uint16_t batchValues[ModbusRtuMaster::MAX_WRITE_REGISTERS];
+
+    // Helper methods
+    bool isWritable(uint8_t unit, uint16_t start, uint16_t count) const;
+    Entry* selectNext();
+    void buildBatch(Entry& first);
+    uint32_t estimateMs() const;
+    bool startWrite();
+    void onWritten(uint8_t exception);
+    void onVerified(uint8_t exception, const uint16_t* values, uint16_t count);
+    void finishBatch(CommandStatus status, uint8_t exception);
+    void acknowledge(Entry& entry, CommandStatus status, uint8_t exception);
+    void reject(const ModbusCommand& command, CommandStatus status);
+};
+
+#endif // MODBUS_COMMANDS_H
@@ -0,0 +1,317 @@
+#ifndef MODBUS_GATEWAY_H
+#define MODBUS_GATEWAY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <vector>
+
+namespace ModbusFunction {
+    const uint8_t READ_HOLDING_REGISTERS = 0x03;
+    const uint8_t READ_INPUT_REGISTERS = 0x04;
+    const uint8_t WRITE_SINGLE_REGISTER = 0x06;
+    const uint8_t WRITE_MULTIPLE_REGISTERS = 0x10;
+}
+
+namespace ModbusException {
+    const uint8_t NONE = 0x00;
+    const uint8_t ILLEGAL_FUNCTION = 0x01;
+    const uint8_t ILLEGAL_DATA_ADDRESS = 0x02;
+    const uint8_t ILLEGAL_DATA_VALUE = 0x03;
+    const uint8_t SLAVE_DEVICE_BUSY = 0x06;
+    const uint8_t GATEWAY_TARGET_NO_RESPONSE = 0x0B;
+    // Local conditions, never sent on the wire
+    const uint8_t TIMEOUT = 0xF0;
+    const uint8_t BAD_FRAME = 0xF1;
+}
+
+uint16_t modbusCrc16(const uint8_t* data, size_t length);
+
+// Half-duplex RS-485 line; the device implementation drives DE/RE around writes
+class ModbusSerial {
+public:
+    virtual ~ModbusSerial() {}
+    virtual bool write(const uint8_t* data, size_t length) = 0;
+    // Non-blocking; returns the number of bytes copied
+    virtual int read(uint8_t* data, size_t capacity) = 0;
+    virtual uint32_t getBaud() const = 0;
+};
+
+struct ModbusRtuStats {
+    uint32_t transactions;
+    uint32_t timeouts;
+    uint32_t badFrames;
+    uint32_t exceptions;
+    uint32_t busyMs;
+};
+
+// Non-blocking RTU master: one transaction at a time, completed from update()
+class ModbusRtuMaster {
+public:
+    static const uint32_t DEFAULT_RESPONSE_TIMEOUT_MS = 250;
+    static const uint16_t MAX_READ_REGISTERS = 125;
+    static const uint16_t MAX_WRITE_REGISTERS = 123;
+    static const uint32_t NEVER = 0xFFFFFFFF;
+
+    typedef std::function<void(uint8_t exception, const uint16_t* values, uint16_t count)> Callback;
+
+    explicit ModbusRtuMaster(ModbusSerial& serial);
+
+    void setClock(uint32_t (*clock)());
+    void setResponseTimeout(uint32_t ms);
+
+    bool read(uint8_t unit, uint8_t function, uint16_t start, uint16_t count, Callback callback);
+    // FC 6 for a single register, FC 16 otherwise
+    bool write(uint8_t unit, uint16_t start, const uint16_t* values, uint16_t count, Callback callback);
+    void update();
+
+    bool isBusy() const;
+    // For event loops: ms until update() has timed work (the frame gap
+    // before our request, or the response timeout), NEVER when idle
+    uint32_t msUntilDue() const;
+    // Bus time of one exchange at this baud rate, frame gap included; the
+    // slave's own turnaround is not
+    uint32_t exchangeMs(size_t requestBytes, size_t responseBytes) const;
+    // When the slave read the registers of the current or last transaction:
+    // the end of our request on the wire
+    uint32_t getSampledAt() const;
+    const ModbusRtuStats& getStats() const;
+
+private:
+    ModbusSerial& serial;
+    uint32_t (*clock)();
+    uint32_t responseTimeoutMs;
+    bool busy;
+    uint8_t unit;
+    uint8_t function;
+    uint16_t count;
+    uint32_t sentAt;
+    uint32_t sampledAt;
+    uint32_t idleSince;
+    uint8_t tx[9 + 2 * MAX_WRITE_REGISTERS];
+    size_t txLength;
+    uint8_t rx[256];
+    size_t rxLength;
+    Callback callback;
+    ModbusRtuStats stats;
+
+    // Helper methods
+    bool send(uint8_t* frame, size_t length, Callback done);
+    void finish(uint8_t exception, const uint16_t* values, uint16_t valueCount);
+    size_t expectedLength() const;
+    uint32_t silentIntervalMs() const;
+    uint32_t responseWireMs() const;
+};
+
+// Register values polled from RTU slaves. Each configured block has its own
+// max-age: a TCP read is answered from the cache only while every register
+// it touches is younger than that.
+class RegisterCache {
+public:
+    static const size_t MAX_BLOCKS = 16;
+    static const uint32_t NO_POLL_DUE = 0xFFFFFFFF;
+
+    struct Block {
+        uint8_t unit;
+        uint8_t function;
+        uint16_t start;
+        uint16_t count;
+        uint32_t maxAgeMs;
+        uint32_t pollIntervalMs;
+        uint32_t lastPollAt;
+        bool polled;
+        std::vector<uint16_t> values;
+        std::vector<uint32_t> updatedAt;
+        std::vector<uint8_t> valid;
+    };
+
+    RegisterCache();
+
+    // pollIntervalMs 0 means half the max-age; returns the block index or -1
+    int addBlock(uint8_t unit, uint8_t function, uint16_t start, uint16_t count, uint32_t maxAgeMs,
+                 uint32_t pollIntervalMs = 0);
+    void clear();
+
+    bool lookup(uint8_t unit, uint8_t function, uint16_t start, uint16_t count, uint32_t now, uint16_t* out) const;
+    void store(uint8_t unit, uint8_t function, uint16_t start, uint16_t count, const uint16_t* values, uint32_t now);
+    void invalidate(uint8_t unit, uint8_t function, uint16_t start, uint16_t count);
+
+    // Block wholly containing the range, or -1
+    int findBlock(uint8_t unit, uint8_t function, uint16_t start, uint16_t count) const;
+    // Most overdue block for the background poller, or -1
+    int nextPoll(uint32_t now) const;
+    // Milliseconds until a block is due: 0 when one is overdue, NO_POLL_DUE
+    // when nothing is configured
+    uint32_t nextPollDueIn(uint32_t now) const;
+    void markPolled(size_t block, uint32_t now);
+
+    size_t getBlockCount() const;
+    const Block& getBlock(size_t index) const;
+
+private:
+    std::vector<Block> blocks;
+};
+
+// TCP side: a listening socket with a few client slots
+class ModbusTcpServerPort {
+public:
+    static const size_t MAX_CLIENTS = 4;
+
+    virtual ~ModbusTcpServerPort() {}
+    virtual bool begin(uint16_t port) = 0;
+    // Slot of a newly accepted client, or -1
+    virtual int accept() = 0;
+    virtual bool connected(int slot) = 0;
+    virtual int read(int slot, uint8_t* data, size_t capacity) = 0;
+    virtual size_t write(int slot, const uint8_t* data, size_t length) = 0;
+    virtual void close(int slot) = 0;
+};
+
+#ifdef ARDUINO
+#include <Stream.h>
+#include <WiFi.h>
+
+class StreamModbusSerial : public ModbusSerial {
+public:
+    StreamModbusSerial(Stream& stream, int dePin, int rePin, uint32_t baud)
+        : stream(stream), dePin(dePin), rePin(rePin), baud(baud) {}
+    bool write(const uint8_t* data, size_t length) override;
+    int read(uint8_t* data, size_t capacity) override;
+    uint32_t getBaud() const override { return baud; }
+
+private:
+    Stream& stream;
+    int dePin;
+    int rePin;
+    uint32_t baud;
+};
+
+class WiFiModbusServerPort : public ModbusTcpServerPort {
+public:
+    WiFiModbusServerPort() : server(502), port(502), started(false) {}
+    bool begin(uint16_t port) override;
+    int accept() override;
+    bool connected(int slot) override;
+    int read(int slot, uint8_t* data, size_t capacity) override;
+    size_t write(int slot, const uint8_t* data, size_t length) override;
+    void close(int slot) override;
+
+private:
+    WiFiServer server;
+    WiFiClient clients[MAX_CLIENTS];
+    uint16_t port;
+    bool started;
+};
+#else
+// BSD sockets, for host builds and the native tests
+class PosixModbusServerPort : public ModbusTcpServerPort {
+public:
+    PosixModbusServerPort();
+    ~PosixModbusServerPort();
+    // Port 0 picks a free port; see getLocalPort()
+    bool begin(uint16_t port) override;
+    int accept() override;
+    bool connected(int slot) override;
+    int read(int slot, uint8_t* data, size_t capacity) override;
+    size_t write(int slot, const uint8_t* data, size_t length) override;
+    void close(int slot) override;
+    uint16_t getLocalPort() const;
+
+private:
+    int listener;
+    int clients[MAX_CLIENTS];
+    uint16_t localPort;
+};
+#endif
+
+struct ModbusGatewayStats {
+    uint32_t requests;
+    uint32_t cacheHits;
+    uint32_t serialReads;
+    uint32_t serialWrites;
+    uint32_t coalesced;
+    uint32_t polls;
+    uint32_t exceptions;
+    uint32_t busyRejects;
+};
+
+// Modbus TCP server in front of the RS-485 bus. Reads are answered from the
+// register cache when fresh; otherwise pending reads for the same unit and
+// function are merged into one serial transaction, and the background poller
+// keeps configured blocks fresh while the bus is otherwise idle.
+class ModbusTcpGateway {
+public:
+    static const size_t MAX_PENDING = 16;
+    static const size_t MAX_FRAME_SIZE = 260;
+
+    ModbusTcpGateway(ModbusTcpServerPort& port, ModbusRtuMaster& master);
+
+    void setClock(uint32_t (*clock)());
+    RegisterCache& getCache();
+    // Called whenever a configured block is refreshed from the bus, with the
+    // time the slave sampled it
+    void setBlockCallback(std::function<void(size_t block, const uint16_t* values, uint16_t count,
+                                             uint32_t sampledAt)> callback);
+    // Offered the bus when no TCP request waits, before the poller, with the
+    // time until the next poll is due; returns true if it started a transaction
+    void setIdleTask(std::function<bool(uint32_t now, uint32_t pollDueInMs)> task);
+
+    bool begin(uint16_t port = 502);
+    void update();
+
+    size_t getPendingCount() const;
+    const ModbusGatewayStats& getStats() const;
+
+private:
+    struct Pending {
+        bool active;
+        bool inFlight;
+        uint32_t sequence;
+        uint8_t slot;
+        uint32_t generation;
+        uint16_t transaction;
+        uint8_t unit;
+        uint8_t function;
+        uint16_t start;
+        uint16_t count;
+        std::vector<uint16_t> writeValues;
+    };
+
+    ModbusTcpServerPort& port;
+    ModbusRtuMaster& master;
+    uint32_t (*clock)();
+    RegisterCache cache;
+    std::function<void(size_t, const uint16_t*, uint16_t, uint32_t)> blockCallback;
+    std::function<bool(uint32_t, uint32_t)> idleTask;
+    uint8_t rx[ModbusTcpServerPort::MAX_CLIENTS][MAX_FRAME_SIZE];
+    size_t rxLength[ModbusTcpServerPort::MAX_CLIENTS];
+    bool slotOpen[ModbusTcpServerPort::MAX_CLIENTS];
+    uint32_t generation[ModbusTcpServerPort::MAX_CLIENTS];
+    Pending pending[MAX_PENDING];
+    uint32_t nextSequence;
+    // Range of the read currently on the bus; later requests inside it join it
+    bool readInFlight;
+    uint8_t flightUnit;
+    uint8_t flightFunction;
+    uint16_t flightStart;
+    uint16_t flightCount;
+    uint32_t flightStartedAt;
+    ModbusGatewayStats stats;
+
+    // Helper methods
+    void receive(int slot);
+    void dropClient(int slot);
+    void handleFrame(int slot, const uint8_t* frame, size_t length);
+    void serveFromCache(uint32_t now);
+    bool joinFlight(Pending& request) const;
+    void startTransaction(uint32_t now);
+    void completeRead(uint8_t unit, uint8_t function, uint16_t start, uint8_t exception,
+                      const uint16_t* values, uint16_t count);
+    void completeWrite(Pending& request, uint8_t exception);
+    void respondRead(const Pending& request, const uint16_t* values);
+    void respondException(const Pending& request, uint8_t exception);
+    void respond(uint8_t slot, uint32_t generation, uint16_t transaction, uint8_t unit,
+                 const uint8_t* pdu, size_t length);
+};
+
+#endif // MODBUS_GATEWAY_H
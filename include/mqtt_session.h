@@ -0,0 +1,225 @@
+#ifndef MQTT_SESSION_H
+#define MQTT_SESSION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Byte stream the session runs over (TCP socket on the device, loopback in tests)
+class MqttTransport {
+public:
+    virtual ~MqttTransport() {}
+    virtual bool open(const char* host, uint16_t port) = 0;
+    virtual void close() = 0;
+    virtual bool isOpen() = 0;
+    // Non-blocking; returns the number of bytes copied into data
+    virtual int read(uint8_t* data, size_t length) = 0;
+    virtual size_t write(const uint8_t* data, size_t length) = 0;
+};
+
+#ifdef ARDUINO
+#include <Client.h>
+
+class ClientMqttTransport : public MqttTransport {
+public:
+    explicit ClientMqttTransport(Client& client) : client(client) {}
+    bool open(const char* host, uint16_t port) override;
+    void close() override;
+    bool isOpen() override;
+    int read(uint8_t* data, size_t length) override;
+    size_t write(const uint8_t* data, size_t length) override;
+
+private:
+    Client& client;
+};
+#endif
+
+// MQTT 3.1.1 control packet types
+enum class MqttPacketType : uint8_t {
+    CONNECT = 1,
+    CONNACK,
+    PUBLISH,
+    PUBACK,
+    PUBREC,
+    PUBREL,
+    PUBCOMP,
+    SUBSCRIBE,
+    SUBACK,
+    UNSUBSCRIBE,
+    UNSUBACK,
+    PINGREQ,
+    PINGRESP,
+    DISCONNECT
+};
+
+// Incremental frame decoder; feed it bytes as they arrive
+class MqttPacketReader {
+public:
+    static const size_t MAX_PACKET_SIZE = 1536;
+
+    MqttPacketReader();
+
+    // Returns true once a complete packet is available. Bodies larger than
+    // MAX_PACKET_SIZE are consumed but flagged as truncated.
+    bool feed(uint8_t byte);
+    void reset();
+
+    MqttPacketType getType() const;
+    uint8_t getFlags() const;
+    const uint8_t* getBody() const;
+    size_t getBodyLength() const;
+    bool isTruncated() const;
+    bool isMalformed() const;
+
+private:
+    enum class Stage {
+        HEADER,
+        LENGTH,
+        BODY,
+        COMPLETE
+    };
+
+    Stage stage;
+    uint8_t header;
+    uint32_t remaining;
+    uint32_t received;
+    uint8_t lengthBytes;
+    bool truncated;
+    bool malformed;
+    uint8_t body[MAX_PACKET_SIZE];
+};
+
+enum class MqttSessionState {
+    DISCONNECTED,
+    CONNECTING,
+    CONNECTED
+};
+
+struct MqttSessionStats {
+    uint32_t published;
+    uint32_t acknowledged;
+    uint32_t retransmits;
+    uint32_t windowFull;
+    uint32_t connects;
+    uint32_t resumed;
+    uint32_t connectionsLost;
+    uint32_t maxAckLatencyMs;
+    uint64_t totalAckLatencyMs;
+};
+
+// Client-side MQTT session with a window of outstanding QoS 1/2 publishes.
+// Packet IDs, retransmit timers and the in-flight messages live here, so
+// unacknowledged messages survive a dropped connection and are re-sent
+// (PUBLISH with DUP, or PUBREL) as soon as the next CONNACK arrives.
+class MqttSession {
+public:
+    static const size_t MAX_INFLIGHT = 32;
+    static const size_t MAX_TOPIC_LENGTH = 128;
+    static const size_t MAX_QOS2_RECEIVED = 16;
+    static const uint32_t CONNECT_TIMEOUT_MS = 10000;
+
+    explicit MqttSession(MqttTransport& transport);
+
+    // Configuration
+    void setServer(const std::string& host, uint16_t port);
+    void setCredentials(const std::string& clientId, const std::string& username, const std::string& password);
+    void setKeepAlive(uint16_t seconds);
+    void setCleanSession(bool clean);
+    void setInflightWindow(size_t window);
+    void setRetransmitInterval(uint32_t ms);
+    void setReconnectInterval(uint32_t ms);
+    void setMessageCallback(std::function<void(const char*, const uint8_t*, size_t)> callback);
+    void setClock(uint32_t (*clock)());
+
+    // Connection methods; connect() only starts the handshake, loop() completes it
+    bool connect();
+    void disconnect();
+    void loop();
+
+    // Message handling
+    bool publish(const char* topic, const uint8_t* payload, size_t length, uint8_t qos = 0, bool retain = false);
+    bool subscribe(const char* topic, uint8_t qos = 0);
+    bool canPublish(uint8_t qos) const;
+
+    // Status methods
+    MqttSessionState getState() const;
+    bool isConnected() const;
+    size_t getInflightCount() const;
+    size_t getInflightWindow() const;
+    const MqttSessionStats& getStats() const;
+    const std::string& getLastError() const;
+
+private:
+    enum class Stage : uint8_t {
+        FREE,
+        AWAIT_PUBACK,
+        AWAIT_PUBREC,
+        AWAIT_PUBCOMP
+    };
+
+    struct InflightSlot {
+        Stage stage;
+        uint16_t packetId;
+        uint8_t attempts;
+        uint32_t sequence;
+        uint32_t firstSentAt;
+        uint32_t sentAt;
+        std::vector<uint8_t> packet;
+    };
+
+    MqttTransport& transport;
+    MqttPacketReader reader;
+    MqttSessionState state;
+    std::string host;
+    uint16_t port;
+    std::string clientId;
+    std::string username;
+    std::string password;
+    uint16_t keepAliveSec;
+    bool cleanSession;
+    size_t window;
+    uint32_t retransmitMs;
+    uint32_t reconnectMs;
+    bool autoReconnect;
+    uint32_t (*clock)();
+    std::function<void(const char*, const uint8_t*, size_t)> messageCallback;
+
+    InflightSlot slots[MAX_INFLIGHT];
+    size_t inflightCount;
+    uint16_t nextPacketId;
+    uint32_t nextSequence;
+    uint16_t qos2Received[MAX_QOS2_RECEIVED];
+    size_t qos2ReceivedCount;
+
+    uint32_t connectStartedAt;
+    uint32_t lastAttemptAt;
+    uint32_t lastOutbound;
+    uint32_t pingSentAt;
+    bool pingOutstanding;
+    std::vector<uint8_t> txBuffer;
+    char topicBuffer[MAX_TOPIC_LENGTH + 1];
+    MqttSessionStats stats;
+    std::string lastError;
+
+    // Helper methods
+    void handlePacket();
+    void handlePublish();
+    void handleAck(MqttPacketType type, uint16_t packetId);
+    void resendInflight();
+    void checkTimers(uint32_t now);
+    void connectionLost(const std::string& error);
+    bool send(const uint8_t* data, size_t length);
+    bool sendAck(MqttPacketType type, uint16_t packetId);
+    bool sendSlot(InflightSlot& slot, bool duplicate);
+    InflightSlot* findSlot(uint16_t packetId);
+    uint16_t allocatePacketId();
+    void releaseSlot(InflightSlot& slot, uint32_t now);
+};
+
+// Encoding helpers shared with the test broker
+size_t mqttEncodeLength(uint8_t* out, uint32_t length);
+void mqttAppendString(std::vector<uint8_t>& out, const char* value, size_t length);
+
+#endif // MQTT_SESSION_H
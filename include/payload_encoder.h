@@ -0,0 +1,154 @@
+#ifndef PAYLOAD_ENCODER_H
+#define PAYLOAD_ENCODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sample.h"
+
+// Wire formats for uplink payloads
+enum class PayloadFormat : uint8_t {
+    JSON,
+    CBOR,
+    MSGPACK,
+    PROTOBUF
+};
+
+// Caller-owned output buffer. Writers never allocate; running out of space
+// sets the overflow flag and drops further bytes.
+class PayloadBuffer {
+public:
+    PayloadBuffer(uint8_t* data, size_t capacity);
+
+    void put(uint8_t byte);
+    void put(const void* data, size_t length);
+    void reset();
+
+    const uint8_t* data() const;
+    size_t length() const;
+    bool overflowed() const;
+
+private:
+    uint8_t* buffer;
+    size_t capacity;
+    size_t used;
+    bool overflow;
+};
+
+// Streaming structured writer shared by the self-describing formats
+class PayloadWriter {
+public:
+    explicit PayloadWriter(PayloadBuffer& out) : out(out) {}
+    virtual ~PayloadWriter() {}
+
+    virtual void beginMap(size_t count) = 0;
+    virtual void endMap() = 0;
+    virtual void beginArray(size_t count) = 0;
+    virtual void endArray() = 0;
+    virtual void key(const char* name) = 0;
+    virtual void writeUint(uint64_t value) = 0;
+    virtual void writeInt(int64_t value) = 0;
+    virtual void writeFloat(float value) = 0;
+    virtual void writeBool(bool value) = 0;
+    virtual void writeString(const char* value) = 0;
+
+protected:
+    PayloadBuffer& out;
+};
+
+class CborWriter : public PayloadWriter {
+public:
+    explicit CborWriter(PayloadBuffer& out) : PayloadWriter(out) {}
+    void beginMap(size_t count) override;
+    void endMap() override {}
+    void beginArray(size_t count) override;
+    void endArray() override {}
+    void key(const char* name) override;
+    void writeUint(uint64_t value) override;
+    void writeInt(int64_t value) override;
+    void writeFloat(float value) override;
+    void writeBool(bool value) override;
+    void writeString(const char* value) override;
+
+private:
+    void writeHead(uint8_t major, uint64_t value);
+};
+
+class MsgPackWriter : public PayloadWriter {
+public:
+    explicit MsgPackWriter(PayloadBuffer& out) : PayloadWriter(out) {}
+    void beginMap(size_t count) override;
+    void endMap() override {}
+    void beginArray(size_t count) override;
+    void endArray() override {}
+    void key(const char* name) override;
+    void writeUint(uint64_t value) override;
+    void writeInt(int64_t value) override;
+    void writeFloat(float value) override;
+    void writeBool(bool value) override;
+    void writeString(const char* value) override;
+
+private:
+    void writeBigEndian(uint64_t value, size_t bytes);
+};
+
+class JsonWriter : public PayloadWriter {
+public:
+    static const size_t MAX_DEPTH = 8;
+
+    explicit JsonWriter(PayloadBuffer& out);
+    void beginMap(size_t count) override;
+    void endMap() override;
+    void beginArray(size_t count) override;
+    void endArray() override;
+    void key(const char* name) override;
+    void writeUint(uint64_t value) override;
+    void writeInt(int64_t value) override;
+    void writeFloat(float value) override;
+    void writeBool(bool value) override;
+    void writeString(const char* value) override;
+
+private:
+    bool first[MAX_DEPTH];
+    size_t depth;
+    bool afterKey;
+
+    void separator();
+    void putDecimal(uint64_t value);
+    void appendf(const char* format, ...);
+};
+
+// Schema for the fixed point set carried in protobuf frames. Field 1 is
+// reserved for the frame timestamp.
+enum class ProtobufType : uint8_t {
+    FLOAT,
+    SINT32,
+    UINT32
+};
+
+struct ProtobufField {
+    uint16_t pointId;
+    uint8_t fieldNumber;
+    ProtobufType type;
+};
+
+struct ProtobufSchema {
+    const ProtobufField* fields;
+    size_t count;
+};
+
+// Batch layout for self-describing formats:
+//   {"t": <base timestamp>, "s": [[pointId, value, dt], ...]}
+// Protobuf frames carry the latest value of each schema point.
+// With a synced time base the base timestamp is Unix milliseconds;
+// otherwise it is milliseconds since boot, which a backend can tell apart
+// by magnitude (below 2^32).
+size_t encodeSamples(PayloadFormat format, const Sample* samples, size_t count,
+                     PayloadBuffer& out, const ProtobufSchema* schema = nullptr,
+                     const TimeBase* time = nullptr);
+size_t encodeProtobuf(const ProtobufSchema& schema, const Sample* samples, size_t count, PayloadBuffer& out,
+                      const TimeBase* time = nullptr);
+
+const char* payloadContentType(PayloadFormat format);
+bool isBinaryPayload(PayloadFormat format);
+
+#endif // PAYLOAD_ENCODER_H
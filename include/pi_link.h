@@ -0,0 +1,197 @@
+#ifndef PI_LINK_H
+#define PI_LINK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+
+// COBS: the output holds no zero byte, so 0x00 delimits frames on the wire.
+// out needs length + length / 254 + 1 bytes.
+size_t cobsEncode(const uint8_t* data, size_t length, uint8_t* out);
+// Returns the decoded length, or 0 when malformed or over capacity (link
+// frames are never empty)
+size_t cobsDecode(const uint8_t* data, size_t length, uint8_t* out, size_t capacity);
+
+uint32_t piLinkCrc32(uint32_t crc, const uint8_t* data, size_t length);
+
+// Byte pipe to the companion Raspberry Pi: a UART on the gateway, a tty (or
+// a pty in tests) on the Pi. Neither call may block.
+class PiLinkTransport {
+public:
+    virtual ~PiLinkTransport() {}
+    // Returns the bytes taken, possibly fewer than offered
+    virtual size_t write(const uint8_t* data, size_t length) = 0;
+    virtual size_t read(uint8_t* data, size_t capacity) = 0;
+};
+
+#ifdef ARDUINO
+#include <HardwareSerial.h>
+
+// The IDF UART driver moves the hardware FIFO into RAM ring buffers from
+// its ISR; buffers this size cover a 10 ms network task period at 2 Mbaud
+class UartPiTransport : public PiLinkTransport {
+public:
+    static const size_t RX_BUFFER_SIZE = 8192;
+    static const size_t TX_BUFFER_SIZE = 4096;
+
+    UartPiTransport(HardwareSerial& serial, int rxPin, int txPin, uint32_t baud)
+        : serial(serial), rxPin(rxPin), txPin(txPin), baud(baud) {}
+    void begin();
+    size_t write(const uint8_t* data, size_t length) override;
+    size_t read(uint8_t* data, size_t capacity) override;
+
+private:
+    HardwareSerial& serial;
+    int rxPin;
+    int txPin;
+    uint32_t baud;
+};
+#endif
+
+// What a payload is for; the daemon on the Pi dispatches on it
+enum class PiChannel : uint8_t {
+    LOOPBACK,   // sent back unchanged: link checks and latency
+    SAMPLES     // encoded sample batches for long-term storage on the Pi
+};
+
+enum class PiLinkState : uint8_t {
+    DOWN,       // begin() not called
+    SYNCING,    // a direction has not completed its reset handshake
+    UP
+};
+
+struct PiLinkStats {
+    uint32_t framesSent;        // data frames, retransmissions included
+    uint32_t framesReceived;    // data frames delivered
+    uint32_t retransmits;
+    uint32_t crcErrors;
+    uint32_t framingErrors;     // bad COBS, short or oversized frames
+    uint32_t duplicates;
+    uint32_t outOfOrder;
+    uint32_t resets;            // handshakes started by the peer
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+};
+
+// Reliable, ordered messages over a byte pipe. Every frame is
+//   type | seq | ack | channel | payload | CRC-32 (LE)
+// COBS-encoded and followed by 0x00. Data frames carry 8-bit sequence
+// numbers; up to WINDOW of them are in flight. Acks are cumulative and
+// ride on data frames or go out alone after ACK_DELAY_MS or half a window.
+// A gap is answered with a NACK and the sender goes back to it; a lost
+// tail is resent after the retransmit timeout. Each direction starts with
+// a RESET/RESET_ACK handshake, and a RESET from a restarted peer also
+// restarts ours, so either side may reboot. Unacknowledged messages are
+// resent after a restart, so a message can arrive twice then.
+class PiLink {
+public:
+    static const size_t MAX_PAYLOAD = 512;
+    static const uint8_t WINDOW = 16;
+    static const uint32_t DEFAULT_RETRANSMIT_MS = 50;
+    static const uint32_t ACK_DELAY_MS = 1;
+    static const uint32_t SYNC_INTERVAL_MS = 250;
+    static const uint32_t NEVER = 0xFFFFFFFF;
+
+    typedef std::function<void(PiChannel channel, const uint8_t* data, size_t length)> ReceiveCallback;
+
+    explicit PiLink(PiLinkTransport& transport);
+
+    void setClock(uint32_t (*clock)());
+    void setRetransmitTimeout(uint32_t ms);
+    void setReceiveCallback(ReceiveCallback callback);
+
+    // Starts both handshakes; sends are queued until ours completes
+    void begin();
+    // Reads, delivers, acks, retransmits and writes what the transport takes
+    void update();
+    // False when the window is full or the payload too long
+    bool send(PiChannel channel, const uint8_t* data, size_t length);
+
+    PiLinkState getState() const;
+    bool isUp() const;
+    // Queued or unacknowledged messages
+    size_t getPending() const;
+    // For event loops: ms until update() has timed work, NEVER when none
+    uint32_t msUntilDue() const;
+    // Encoded bytes the transport has not taken yet
+    bool wantsWrite() const;
+    const PiLinkStats& getStats() const;
+
+private:
+    enum FrameType : uint8_t {
+        FRAME_DATA = 1,
+        FRAME_ACK = 2,
+        FRAME_NACK = 3,
+        FRAME_RESET = 4,
+        FRAME_RESET_ACK = 5
+    };
+
+    static const size_t HEADER_SIZE = 4;
+    static const size_t CRC_SIZE = 4;
+    static const size_t MAX_FRAME = HEADER_SIZE + MAX_PAYLOAD + CRC_SIZE;
+    static const size_t MAX_ENCODED = MAX_FRAME + MAX_FRAME / 254 + 2;
+    static const size_t TX_BUFFER_SIZE = 4 * MAX_ENCODED;
+
+    struct Slot {
+        PiChannel channel;
+        uint16_t length;
+        uint32_t sentAt;
+        uint8_t payload[MAX_PAYLOAD];
+    };
+
+    PiLinkTransport& transport;
+    uint32_t (*clock)();
+    ReceiveCallback receiveCallback;
+    uint32_t retransmitMs;
+    bool started;
+
+    // Transmit direction
+    bool txUp;
+    bool syncDue;
+    uint32_t txNonce;
+    uint32_t syncSentAt;
+    Slot slots[WINDOW];
+    uint8_t firstSlot;
+    uint8_t base;           // oldest unacknowledged
+    uint8_t sendNext;       // next to put on the wire
+    uint8_t sentEnd;        // one past the furthest ever sent
+    uint8_t nextSeq;        // next to assign
+    bool wentBack;          // NACK honoured since the last progress
+
+    // Receive direction
+    bool rxSynced;
+    uint8_t expected;
+    uint8_t unacked;
+    uint32_t ackDueAt;
+    bool ackNow;
+    bool nackSent;
+    bool nackDue;
+    bool resetAckDue;
+    uint32_t peerNonce;
+
+    uint8_t rxBuffer[MAX_ENCODED];
+    size_t rxLength;
+    bool rxDiscarding;
+    // Separate, since a receive callback may send
+    uint8_t rxFrame[MAX_FRAME];
+    uint8_t txFrame[MAX_FRAME];
+    uint8_t txBuffer[TX_BUFFER_SIZE];
+    size_t txLength;
+    size_t txOffset;
+    PiLinkStats stats;
+
+    // Helper methods
+    void reset();
+    void startSync(uint32_t now);
+    void receive(uint32_t now);
+    void handleFrame(const uint8_t* frame, size_t length, uint32_t now);
+    void handleAck(uint8_t ack, bool nack);
+    void transmit(uint32_t now);
+    bool queueFrame(FrameType type, uint8_t seq, uint8_t channel, const uint8_t* payload, size_t length);
+    bool queueNonce(FrameType type, uint32_t nonce);
+    void flush();
+    Slot& slotFor(uint8_t seq);
+    uint8_t inFlight() const;
+};
+
+#endif // PI_LINK_H
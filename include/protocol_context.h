@@ -0,0 +1,168 @@
+#ifndef PROTOCOL_CONTEXT_H
+#define PROTOCOL_CONTEXT_H
+
+#include <Arduino.h>
+#include "protocol_types.h"
+#include "payload_encoder.h"
+#include "uplink_scheduler.h"
+#include "uplink_router.h"
+#include "tls_context.h"
+#include "deflate_encoder.h"
+
+// Message structure
+struct ProtocolMessage {
+    String topic;
+    String payload;
+    ProtocolType protocol;
+    bool retain;
+    uint8_t qos;
+    bool isResponse;
+    PayloadFormat format = PayloadFormat::JSON;
+    MessagePriority priority = MessagePriority::TELEMETRY;
+};
+
+// Protocol configuration
+struct ProtocolConfig {
+    // MQTT
+    String mqttBroker;
+    uint16_t mqttPort;
+    String mqttUsername;
+    String mqttPassword;
+    String mqttClientId;
+    String mqttTopicPrefix;
+    uint8_t mqttInflightWindow;
+    uint32_t mqttRetransmitMs;
+    bool mqttUseTls;
+    
+    // HTTP/HTTPS
+    String httpServer;
+    uint16_t httpPort;
+    bool useHttps;
+    String httpUsername;
+    String httpPassword;
+    // gzip request bodies (Content-Encoding); the server must accept them
+    bool httpCompress;
+    
+    // WebSocket
+    String wsServer;
+    uint16_t wsPort;
+    String wsPath;
+    bool wsSecure;
+    // Framed messages with deflate, announced as the "cerise.deflate" subprotocol
+    bool wsCompress;
+    
+    // TLS credentials (PEM files on SPIFFS), shared by MQTT, HTTPS and WSS
+    String tlsCaFile;
+    String tlsCertFile;
+    String tlsKeyFile;
+    
+    // CoAP
+    String coapServer;
+    uint16_t coapPort;
+    
+    // Custom ("tcp" with customConfig "host:port" is a raw TCP sink)
+    String customProtocol;
+    String customConfig;
+};
+
+struct CompressionStats {
+    uint32_t messages;
+    uint32_t skipped;      // too small, or no smaller once compressed
+    uint32_t bytesIn;
+    uint32_t bytesOut;
+    uint32_t busyUs;
+};
+
+// What ProtocolManager shares with its drivers: configuration, TLS
+// credentials, routing health, the payload compressor and the per-protocol
+// state, kept in flat arrays indexed by ProtocolType
+class ProtocolContext {
+public:
+    // Below this, headers and framing cost more than compression saves
+    static const size_t MIN_COMPRESS_SIZE = 128;
+    static const size_t COMPRESS_BUFFER_SIZE = 2048;
+
+    ProtocolContext();
+
+    ProtocolConfig config;
+    TlsContextManager tls;
+    UplinkRouter router;
+    void (*messageCallback)(const ProtocolMessage&);
+
+    ProtocolState getState(ProtocolType protocol) const;
+    void setState(ProtocolType protocol, ProtocolState state);
+    bool isConnected(ProtocolType protocol) const;
+
+    const String& getLastError(ProtocolType protocol) const;
+    void setError(ProtocolType protocol, const String& error);
+    void clearError(ProtocolType protocol);
+
+    void setName(ProtocolType protocol, const char* name);
+    void log(ProtocolType protocol, const String& event) const;
+    // Hands an incoming message to the application callback
+    void deliver(const ProtocolMessage& message) const;
+
+    // Compresses into the shared buffer (drivers run on one task), after
+    // headroom bytes left free for the caller's framing. Returns the
+    // compressed length, or 0 when the payload should go out as is.
+    size_t compress(const String& payload, DeflateContainer container, size_t headroom = 0);
+    uint8_t* compressed();
+    const CompressionStats& getCompressionStats() const;
+
+private:
+    DeflateEncoder deflate;
+    uint8_t compressBuffer[COMPRESS_BUFFER_SIZE];
+    CompressionStats compressionStats;
+
+    ProtocolState states[PROTOCOL_TYPE_COUNT];
+    String lastErrors[PROTOCOL_TYPE_COUNT];
+    const char* names[PROTOCOL_TYPE_COUNT];
+};
+
+// Defaults for the optional parts of the driver interface; drivers derive
+// from this and hide what they implement. Calls go through the registry to
+// the concrete type, so hiding is enough and nothing here is virtual.
+template <ProtocolType Type>
+class ProtocolDriver {
+public:
+    static constexpr ProtocolType TYPE = Type;
+
+    explicit ProtocolDriver(ProtocolContext& context) : context(context) {}
+
+    void begin() {}
+    void update() {}
+    void disconnect() {
+        context.setState(TYPE, ProtocolState::DISCONNECTED);
+    }
+    // Wi-Fi lost: mark the uplink failed so the router moves traffic away
+    void linkDown() {
+        if (context.getState(TYPE) != ProtocolState::DISCONNECTED) {
+            context.setState(TYPE, ProtocolState::ERROR);
+            context.setError(TYPE, "Wi-Fi link down");
+        }
+    }
+    bool canSend(const ProtocolMessage&) const {
+        return true;
+    }
+    // Latency reported to the router for a send that took measuredMs
+    uint32_t latencyMs(uint32_t measuredMs) const {
+        return measuredMs;
+    }
+    bool subscribe(const String&) {
+        return false;
+    }
+    // The config changed in place; pick up what applies without reconnecting
+    void reconfigure() {}
+    // Messages sent but not acknowledged yet
+    size_t inflight() const {
+        return 0;
+    }
+
+protected:
+    ProtocolContext& context;
+};
+
+template <ProtocolType Type>
+constexpr ProtocolType ProtocolDriver<Type>::TYPE;
+
+#endif // PROTOCOL_CONTEXT_H
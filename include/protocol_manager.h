@@ -2,151 +2,152 @@
 #define PROTOCOL_MANAGER_H
 
 #include <Arduino.h>
-#include <PubSubClient.h>
-#include <WiFiClientSecure.h>
-#include <WebSocketsClient.h>
-#include <coap-simple.h>
 #include <ArduinoJson.h>
-#include <map>
 #include <vector>
 #include <SPIFFS.h>
-#include <HTTPClient.h>
+#include "sample.h"
+#include "payload_encoder.h"
+#include "time_service.h"
+#include "protocol_types.h"
+#include "protocol_context.h"
+#include "protocol_registry.h"
+#include "wifi_manager.h"
+#include "uplink_scheduler.h"
+#include "config_apply.h"
+#include "Drivers/MqttDriver.h"
+#include "Drivers/HttpDriver.h"
+#include "Drivers/WebSocketDriver.h"
+#include "Drivers/CoapDriver.h"
+#include "Drivers/RawTcpDriver.h"
 
-// Forward declarations
-class CoapPacket;
-class UDP;
+// Every uplink the manager knows; a new protocol is a driver appended here
+typedef DriverRegistry<MqttDriver,
+                       HttpDriver<ProtocolType::HTTP>,
+                       HttpDriver<ProtocolType::HTTPS>,
+                       WebSocketDriver,
+                       CoapDriver,
+                       RawTcpDriver> ProtocolDrivers;
 
-// Protocol types
-enum class ProtocolType {
-    MQTT,
-    HTTP,
-    HTTPS,
-    WEBSOCKET,
-    COAP,
-    CUSTOM
-};
-
-// Protocol states
-enum class ProtocolState {
-    DISCONNECTED,
-    CONNECTING,
-    CONNECTED,
-    ERROR
-};
-
-// Message structure
-struct ProtocolMessage {
-    String topic;
-    String payload;
-    ProtocolType protocol;
-    bool retain;
-    uint8_t qos;
-    bool isResponse;
-};
-
-// Protocol configuration
-struct ProtocolConfig {
-    // MQTT
-    String mqttBroker;
-    uint16_t mqttPort;
-    String mqttUsername;
-    String mqttPassword;
-    String mqttClientId;
-    String mqttTopicPrefix;
-    
-    // HTTP/HTTPS
-    String httpServer;
-    uint16_t httpPort;
-    bool useHttps;
-    String httpUsername;
-    String httpPassword;
-    
-    // WebSocket
-    String wsServer;
-    uint16_t wsPort;
-    String wsPath;
-    bool wsSecure;
-    
-    // CoAP
-    String coapServer;
-    uint16_t coapPort;
-    
-    // Custom
-    String customProtocol;
-    String customConfig;
-};
-
-class ProtocolManager {
+class ProtocolManager : public ConfigTarget {
 public:
     ProtocolManager();
     void begin();
     void update();
     
     // Connection methods
-    bool connect(ProtocolType protocol);
-    void disconnect(ProtocolType protocol);
-    bool isConnected(ProtocolType protocol) const;
+    bool connect(ProtocolType protocol) override;
+    void disconnect(ProtocolType protocol) override;
+    bool isConnected(ProtocolType protocol) const override;
+    bool isConfigured(ProtocolType protocol) override;
+    // Wi-Fi link changes: reconnect configured protocols once the link is back
+    void handleLinkEvent(WifiEvent event);
+    // Tears down every uplink and reconnects the configured ones
+    bool resetConnections();
     
     // Message handling
     bool publish(const ProtocolMessage& message);
+    bool publishSamples(const String& topic, const Sample* samples, size_t count,
+                        ProtocolType protocol = ProtocolType::MQTT, uint8_t qos = 0,
+                        MessagePriority priority = MessagePriority::TELEMETRY);
+
+    // Payload encoding: a topic prefix rule overrides the protocol default
+    void setPayloadFormat(ProtocolType protocol, PayloadFormat format);
+    void setTopicPayloadFormat(const String& topicPrefix, PayloadFormat format);
+    void setProtobufSchema(const ProtobufSchema* schema);
+    // Sample batches carry Unix timestamps once this clock is synced
+    void setTimeService(const TimeService* time);
+    PayloadFormat getPayloadFormat(ProtocolType protocol, const String& topic) const;
+
+    // Uplink routing: messages whose topic matches a route may leave through
+    // another protocol than the one they were published on
+    bool setRoute(const String& topicPrefix, RoutePolicy policy, const UplinkChoice* uplinks, size_t count);
+    bool removeRoute(const String& topicPrefix);
+    const UplinkHealth& getUplinkHealth(ProtocolType protocol) const;
+    // Any uplink connected and not cooling down after a failure
+    bool hasHealthyUplink() const;
+
+    // Outgoing traffic is queued per priority class; token buckets per
+    // topic prefix and per uplink cap the send rate
+    void setSchedulingMode(SchedulingMode mode);
+    void setPriorityWeight(MessagePriority priority, uint8_t weight);
+    void setRateLimit(ProtocolType protocol, float messagesPerSecond, uint16_t burst);
+    bool setTopicRateLimit(const String& topicPrefix, float messagesPerSecond, uint16_t burst);
+    const PriorityStats& getPriorityStats(MessagePriority priority) const;
+
     bool subscribe(const String& topic, ProtocolType protocol);
     void setMessageCallback(void (*callback)(const ProtocolMessage&));
     
-    // Configuration
+    // Configuration. Changes go through the config applier: only the
+    // uplinks a changed field belongs to drain and reconnect, and a failed
+    // reconnect rolls the change back. Call from the task running update().
     void setConfig(const ProtocolConfig& config);
     ProtocolConfig getConfig() const;
     bool saveConfig();
     bool loadConfig();
+    // A JSON object of the fields to change, keyed as in the saved config.
+    // Returns the transaction ID, or 0 when refused; either way the outcome
+    // goes to the report callback.
+    uint32_t applyConfigJson(const String& json);
+    void setConfigReportCallback(ConfigApplier::ReportCallback callback);
+    const ApplyReport& getConfigReport() const;
+    bool isApplyingConfig() const;
+
+    // ConfigTarget
+    ConfigValues currentValues() const override;
+    bool validate(const ConfigValues& values, std::string& error) override;
+    void install(const ConfigValues& values, bool reloadTls) override;
+    bool persist(const ConfigValues& values) override;
+    void hold(ProtocolType protocol, bool held) override;
+    size_t inflight(ProtocolType protocol) const override;
     
     // Protocol-specific methods
     void setMqttCallback(void (*callback)(char*, uint8_t*, unsigned int));
     void setWebSocketCallback(void (*callback)(WStype_t, uint8_t*, size_t));
-    void setCoapCallback(void (*callback)(CoapPacket&, IPAddress, int));
+    void setCoapCallback(void (*callback)(const String&, const CoapResponse&));
     
     // Status methods
     ProtocolState getState(ProtocolType protocol) const;
     String getLastError(ProtocolType protocol) const;
+    size_t getQueueSize() const;
+    const MqttSessionStats& getMqttStats() const;
+    const TlsHandshakeStats& getTlsStats() const;
+    const CompressionStats& getCompressionStats() const;
 
 private:
-    // Protocol instances
-    WiFiClient wifiClient;
-    WiFiClientSecure wifiClientSecure;
-    PubSubClient mqttClient;
-    WebSocketsClient webSocket;
-    UDP* udp;
-    Coap coap;
-    
-    // Configuration and state
-    ProtocolConfig config;
-    std::map<ProtocolType, ProtocolState> states;
-    std::map<ProtocolType, String> lastErrors;
-    void (*messageCallback)(const ProtocolMessage&);
+    // Shared state first: the drivers keep a reference to it
+    ProtocolContext context;
+    ProtocolDrivers drivers;
     
     // Helper methods
-    void handleMqttMessage(char* topic, byte* payload, unsigned int length);
-    void handleWebSocketEvent(WStype_t type, uint8_t* payload, size_t length);
-    void handleCoapResponse(CoapPacket& packet, IPAddress ip, int port);
-    void setError(ProtocolType protocol, const String& error);
-    void clearError(ProtocolType protocol);
-    bool validateConfig(const ProtocolConfig& config);
-    void logProtocolEvent(ProtocolType protocol, const String& event);
-    
-    // Connection methods
-    bool connectMqtt();
-    bool connectHttp(bool useHttps);
-    bool connectWebSocket();
-    bool connectCoap();
-    bool connectCustom();
+    bool validateConfig(const ProtocolConfig& config, std::string& error);
+    bool loadTlsCredentials();
+
+    // Config hot-reload
+    ConfigApplier configApplier;
+    ConfigApplier::ReportCallback configReportCallback;
+    bool held[PROTOCOL_TYPE_COUNT];
     
     // Publishing methods
-    bool publishHttp(const ProtocolMessage& message);
-    bool publishCoap(const ProtocolMessage& message);
-    bool publishCustom(const ProtocolMessage& message);
-    bool subscribeCoap(const String& topic);
+    bool dispatch(const ProtocolMessage& message);
+    bool sendVia(const ProtocolMessage& message, ProtocolType protocol);
+    
+    // Payload encoding
+    static const size_t MAX_PAYLOAD_SIZE = 1024;
+    PayloadFormat protocolFormats[PROTOCOL_TYPE_COUNT];
+    std::vector<std::pair<String, PayloadFormat>> topicFormats;
+    const ProtobufSchema* protobufSchema;
+    const TimeService* timeService;
+    uint8_t payloadBuffer[MAX_PAYLOAD_SIZE];
+    
+    // Uplink routing; the rate limit is charged to the uplink actually used
+    TokenBucket uplinkBuckets[PROTOCOL_TYPE_COUNT];
+    void refreshUplinkHealth();
     
-    // Message queue
+    // Message queue: messages live in a fixed pool, the scheduler orders handles
     static const size_t MAX_QUEUE_SIZE = 50;
-    std::vector<ProtocolMessage> messageQueue;
+    std::vector<ProtocolMessage> messagePool;
+    std::vector<uint16_t> freeSlots;
+    UplinkScheduler scheduler;
     void processMessageQueue();
     bool addToQueue(const ProtocolMessage& message);
 };
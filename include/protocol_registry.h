@@ -0,0 +1,122 @@
+#ifndef PROTOCOL_REGISTRY_H
+#define PROTOCOL_REGISTRY_H
+
+#include <stddef.h>
+#include "protocol_types.h"
+
+// Compile-time list of protocol drivers. A driver is a plain class with a
+// static TYPE, a static name() and a constructor taking the shared context;
+// its operations are found by name, not through virtual calls:
+//
+//   typedef DriverRegistry<MqttDriver, CoapDriver> Drivers;
+//   Drivers drivers(context);
+//   drivers.visit(ProtocolType::COAP, connectOp);  // calls CoapDriver::connect via the visitor
+//
+// visit() unrolls into a chain of constant comparisons, so calls on the
+// chosen driver inline. Adding a protocol means appending its driver to
+// the list; nothing else switches on ProtocolType.
+template <typename... Drivers>
+class DriverRegistry;
+
+template <>
+class DriverRegistry<> {
+public:
+    static const size_t COUNT = 0;
+
+    template <typename Context>
+    explicit DriverRegistry(Context&) {}
+
+    static constexpr bool contains(ProtocolType) {
+        return false;
+    }
+
+    template <typename Visitor>
+    bool visit(ProtocolType, Visitor&) {
+        return false;
+    }
+
+    template <typename Visitor>
+    bool visit(ProtocolType, Visitor&) const {
+        return false;
+    }
+
+    template <typename Visitor>
+    void forEach(Visitor&) {}
+};
+
+template <typename First, typename... Rest>
+class DriverRegistry<First, Rest...> {
+public:
+    static const size_t COUNT = 1 + sizeof...(Rest);
+
+    static_assert(static_cast<size_t>(First::TYPE) < PROTOCOL_TYPE_COUNT, "driver TYPE outside ProtocolType");
+    static_assert(!DriverRegistry<Rest...>::contains(First::TYPE), "two drivers registered for one ProtocolType");
+
+    template <typename Context>
+    explicit DriverRegistry(Context& context) : driver(context), rest(context) {}
+
+    static constexpr bool contains(ProtocolType type) {
+        return type == First::TYPE || DriverRegistry<Rest...>::contains(type);
+    }
+
+    // Calls visitor(driver) on the driver for type; false when none is registered
+    template <typename Visitor>
+    bool visit(ProtocolType type, Visitor& visitor) {
+        if (type == First::TYPE) {
+            visitor(driver);
+            return true;
+        }
+        return rest.visit(type, visitor);
+    }
+
+    template <typename Visitor>
+    bool visit(ProtocolType type, Visitor& visitor) const {
+        if (type == First::TYPE) {
+            visitor(driver);
+            return true;
+        }
+        return rest.visit(type, visitor);
+    }
+
+    // Registration order
+    template <typename Visitor>
+    void forEach(Visitor& visitor) {
+        visitor(driver);
+        rest.forEach(visitor);
+    }
+
+    // Typed access for driver-specific calls, e.g. get<MqttDriver>().getSession()
+    template <typename Driver>
+    Driver& get() {
+        return find(static_cast<Driver*>(nullptr));
+    }
+
+    template <typename Driver>
+    const Driver& get() const {
+        return find(static_cast<Driver*>(nullptr));
+    }
+
+    First& find(First*) {
+        return driver;
+    }
+
+    const First& find(First*) const {
+        return driver;
+    }
+
+    template <typename Driver>
+    Driver& find(Driver* tag) {
+        return rest.find(tag);
+    }
+
+    template <typename Driver>
+    const Driver& find(Driver* tag) const {
+        return rest.find(tag);
+    }
+
+private:
+    First driver;
+    DriverRegistry<Rest...> rest;
+};
+
+#endif // PROTOCOL_REGISTRY_H
@@ -0,0 +1,27 @@
+#ifndef PROTOCOL_TYPES_H
+#define PROTOCOL_TYPES_H
+
+#include <stddef.h>
+
+// Protocol types
+enum class ProtocolType {
+    MQTT,
+    HTTP,
+    HTTPS,
+    WEBSOCKET,
+    COAP,
+    CUSTOM
+};
+
+// Per-protocol tables are flat arrays indexed by the enum value
+static const size_t PROTOCOL_TYPE_COUNT = 6;
+
+// Protocol states
+enum class ProtocolState {
+    DISCONNECTED,
+    CONNECTING,
+    CONNECTED,
+    ERROR
+};
+
+#endif // PROTOCOL_TYPES_H
@@ -0,0 +1,141 @@
+#ifndef RULES_ENGINE_H
+#define RULES_ENGINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Stack machine instructions; operands follow the opcode little-endian
+enum class RuleOp : uint8_t {
+    CONST,  // u16 index into the constant pool
+    POINT,  // u16 point id
+    NEG,
+    NOT,
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    MOD,
+    LT,
+    LE,
+    GT,
+    GE,
+    EQ,
+    NE,
+    AND,
+    OR,
+    SELECT, // cond ? a : b
+    ABS,
+    SQRT,
+    ROUND,
+    MIN,
+    MAX,
+    CLAMP,
+    SCALE   // x, inLo, inHi, outLo, outHi
+};
+
+enum class RuleKind : uint8_t {
+    DERIVED,
+    ALARM
+};
+
+struct RulesStats {
+    uint32_t samples;
+    uint32_t evaluations;
+    uint32_t skipped;  // an input had no value yet
+    uint32_t invalid;  // result was NaN or infinite
+    uint32_t alarmsRaised;
+    uint32_t alarmsCleared;
+};
+
+// Rules are expressions over the point table, e.g.
+//   derived 100: scale(p0, 0, 4095, 4, 20)
+//   alarm tank_high: p100 > 18 && level_ok
+// Points are referenced as p<id> or by a name bound with definePoint().
+// Each rule is compiled once into bytecode; samples then only re-run the
+// rules that read the updated point, without allocating. A derived rule may
+// read the targets of rules added before it, which keeps the graph acyclic.
+class RulesEngine {
+public:
+    static const uint16_t MAX_POINTS = 256;
+    static const uint16_t NO_POINT = 0xFFFF;
+    static const size_t MAX_RULES = 128;
+    static const size_t MAX_STACK = 16;
+    static const size_t MAX_CODE_SIZE = 8192;
+
+    RulesEngine();
+
+    // Configuration
+    void setClock(uint32_t (*clock)());
+    bool definePoint(const char* name, uint16_t id);
+    // Both return the rule index, or -1 with getLastError() set
+    int addDerived(uint16_t target, const char* expression);
+    int addAlarm(const char* name, const char* expression, uint32_t holdMs = 0, uint16_t statePoint = NO_POINT);
+    void clear();
+
+    // Derived values and alarm state points go to the output
+    void setOutput(std::function<void(uint16_t pointId, float value)> output);
+    void setAlarmCallback(std::function<void(const char* name, bool active)> callback);
+
+    // Stores the value and re-evaluates every rule depending on it
+    void onSample(uint16_t pointId, float value);
+    // Raises alarms whose hold time ran out without a new sample
+    void update();
+
+    // Status methods
+    bool getPoint(uint16_t pointId, float& value) const;
+    bool isAlarmActive(size_t rule) const;
+    size_t getRuleCount() const;
+    size_t getCodeSize() const;
+    const RulesStats& getStats() const;
+    const std::string& getLastError() const;
+
+private:
+    struct Rule {
+        RuleKind kind;
+        uint16_t target;
+        uint32_t codeStart;
+        uint16_t codeLength;
+        uint16_t inputStart;
+        uint16_t inputCount;
+        uint32_t holdMs;
+        bool active;
+        bool pending;
+        uint32_t pendingSince;
+        std::string name;
+    };
+
+    struct Dependent {
+        uint16_t rule;
+        int16_t next;
+    };
+
+    uint32_t (*clock)();
+    float values[MAX_POINTS];
+    bool known[MAX_POINTS];
+    std::vector<std::pair<std::string, uint16_t>> names;
+    std::vector<Rule> rules;
+    std::vector<uint8_t> code;
+    std::vector<float> constants;
+    std::vector<uint16_t> inputs;
+    int16_t firstDependent[MAX_POINTS];
+    std::vector<Dependent> dependents;
+    bool isTarget[MAX_POINTS];
+    std::function<void(uint16_t, float)> output;
+    std::function<void(const char*, bool)> alarmCallback;
+    RulesStats stats;
+    std::string lastError;
+
+    // Helper methods
+    int addRule(RuleKind kind, uint16_t target, const char* expression, const char* name, uint32_t holdMs);
+    bool execute(const Rule& rule, float& result);
+    void evaluate(size_t index, uint32_t now);
+    void propagate(uint16_t pointId, uint32_t now);
+    void setAlarm(Rule& rule, bool active);
+
+    friend class RuleCompiler;
+};
+
+#endif // RULES_ENGINE_H
@@ -0,0 +1,32 @@
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdint.h>
+
+// Field-bus origin of a sample
+enum class SampleSource : uint8_t {
+    LORA,
+    ZIGBEE,
+    MODBUS,
+    ANALOG,
+    DERIVED
+};
+
+// A single acquired point value, small enough to copy through queues.
+// timestampMs is millis() when the value was acquired; a TimeBase maps it
+// to wall time when the batch is encoded.
+struct Sample {
+    uint16_t pointId;
+    SampleSource source;
+    float value;
+    uint32_t timestampMs;
+};
+
+// Wall time at one monotonic instant: unixMs + (timestampMs - monotonicMs)
+struct TimeBase {
+    uint64_t unixMs;
+    uint32_t monotonicMs;
+    bool synced;
+};
+
+#endif // SAMPLE_H
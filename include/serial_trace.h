@@ -0,0 +1,257 @@
+#ifndef SERIAL_TRACE_H
+#define SERIAL_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include "modbus_gateway.h"
+
+enum class TraceChannel : uint8_t {
+    LORA,
+    ZIGBEE,
+    MODBUS
+};
+
+enum class TraceDirection : uint8_t {
+    RX,
+    TX
+};
+
+// One burst of bytes on one UART; data points into the trace
+struct TraceRecord {
+    uint64_t timeUs;        // since the start of the capture
+    TraceChannel channel;
+    TraceDirection direction;
+    const uint8_t* data;
+    uint16_t length;
+};
+
+// Where the encoded trace goes: a RAM buffer or a file on flash
+class TraceSink {
+public:
+    virtual ~TraceSink() {}
+    // All or nothing; false once the sink is full
+    virtual bool write(const uint8_t* data, size_t length) = 0;
+    virtual void flush() {}
+};
+
+// Caller-owned buffer; writes that do not fit are refused
+class RamTraceSink : public TraceSink {
+public:
+    RamTraceSink(uint8_t* buffer, size_t capacity);
+    bool write(const uint8_t* data, size_t length) override;
+    void reset();
+    void setBuffer(uint8_t* buffer, size_t capacity);
+    const uint8_t* data() const;
+    size_t length() const;
+
+private:
+    uint8_t* buffer;
+    size_t capacity;
+    size_t used;
+};
+
+#ifdef ARDUINO
+#include <FS.h>
+#include <Stream.h>
+
+class SpiffsTraceSink : public TraceSink {
+public:
+    static const size_t BUFFER_SIZE = 512;
+
+    explicit SpiffsTraceSink(size_t maxBytes) : maxBytes(maxBytes), written(0), buffered(0) {}
+    bool open(const char* path);
+    void close();
+    bool write(const uint8_t* data, size_t length) override;
+    void flush() override;
+
+private:
+    File file;
+    size_t maxBytes;
+    size_t written;
+    uint8_t buffer[BUFFER_SIZE];
+    size_t buffered;
+};
+#endif
+
+struct TraceRecorderStats {
+    uint32_t records;
+    uint32_t bytes;          // bus bytes captured
+    uint32_t droppedBytes;   // refused by a full sink
+    uint32_t traceBytes;     // encoded size
+};
+
+// Captures raw UART traffic into a compact binary trace:
+//   "SBT1", then per record: tag (channel, bit 3 = TX), varint microseconds
+//   since the previous record, varint length, the bytes.
+// Bytes on the same channel and direction that follow each other within
+// COALESCE_US become one record, so byte-wise reads stay cheap. Runs on the
+// acquisition task, like the UARTs it wraps.
+class TraceRecorder {
+public:
+    static const size_t MAX_PENDING = 64;
+    static const uint32_t COALESCE_US = 2000;
+
+    TraceRecorder();
+
+    void setClock(uint64_t (*clock)());
+    bool begin(TraceSink& sink);
+    void end();
+    bool isRecording() const;
+
+    void record(TraceChannel channel, TraceDirection direction, const uint8_t* data, size_t length);
+    void flush();
+    const TraceRecorderStats& getStats() const;
+
+private:
+    // Tag, time delta and length varints
+    static const size_t MAX_HEADER = 1 + 10 + 3;
+
+    uint64_t (*clock)();
+    TraceSink* sink;
+    uint64_t startedAt;
+    uint64_t lastRecordAt;
+    bool hasPending;
+    TraceChannel pendingChannel;
+    TraceDirection pendingDirection;
+    uint64_t pendingAt;
+    uint64_t pendingLastByteAt;
+    uint8_t pending[MAX_PENDING];
+    size_t pendingLength;
+    TraceRecorderStats stats;
+
+    void emit(const uint8_t* data, size_t length);
+};
+
+class TraceReader {
+public:
+    TraceReader(const uint8_t* data, size_t length);
+    bool isValid() const;
+    bool next(TraceRecord& record);
+    void rewind();
+
+private:
+    const uint8_t* data;
+    size_t length;
+    size_t offset;
+    uint64_t timeUs;
+    bool valid;
+
+    bool readVarint(uint64_t& value);
+};
+
+enum class ReplaySpeed : uint8_t {
+    RECORDED,
+    AS_FAST_AS_POSSIBLE
+};
+
+// Feeds a trace back to per-channel handlers, either on the recorded
+// timeline (driven by update() against the clock) or back to back
+class TraceReplayer {
+public:
+    typedef std::function<void(const TraceRecord&)> Handler;
+
+    TraceReplayer(const uint8_t* data, size_t length);
+
+    void setClock(uint64_t (*clock)());
+    void setSpeed(ReplaySpeed speed);
+    void setHandler(TraceChannel channel, Handler handler);
+
+    bool begin();
+    // Delivers every record that is due; false once the trace is exhausted
+    bool update();
+    // Delivers the rest of the trace without waiting; returns the record count
+    size_t run();
+    bool isFinished() const;
+
+private:
+    static const size_t CHANNEL_COUNT = 3;
+
+    TraceReader reader;
+    uint64_t (*clock)();
+    ReplaySpeed speed;
+    Handler handlers[CHANNEL_COUNT];
+    uint64_t startedAt;
+    bool hasNext;
+    bool finished;
+    TraceRecord nextRecord;
+
+    void deliver(const TraceRecord& record);
+};
+
+// Taps a Modbus serial port: TX frames and RX bytes go to the recorder
+// while it is recording, and pass through untouched otherwise
+class CaptureModbusSerial : public ModbusSerial {
+public:
+    CaptureModbusSerial(ModbusSerial& serial, TraceRecorder& recorder) : serial(serial), recorder(recorder) {}
+    bool write(const uint8_t* data, size_t length) override;
+    int read(uint8_t* data, size_t capacity) override;
+    uint32_t getBaud() const override { return serial.getBaud(); }
+
+private:
+    ModbusSerial& serial;
+    TraceRecorder& recorder;
+};
+
+struct ReplayModbusStats {
+    uint32_t requests;
+    uint32_t mismatches;     // request differs from the recorded one
+    uint32_t unanswered;     // trace ran out
+};
+
+// Stands in for the RS-485 port: every request the master writes consumes
+// the next recorded TX frame and makes the RX bytes that followed it
+// readable, after their recorded delay or at once
+class ReplayModbusSerial : public ModbusSerial {
+public:
+    static const size_t MAX_RESPONSE = 256;
+
+    ReplayModbusSerial(const uint8_t* data, size_t length, uint32_t baud);
+
+    void setClock(uint64_t (*clock)());
+    void setSpeed(ReplaySpeed speed);
+    bool write(const uint8_t* data, size_t length) override;
+    int read(uint8_t* data, size_t capacity) override;
+    uint32_t getBaud() const override { return baud; }
+
+    bool isFinished() const;
+    const ReplayModbusStats& getStats() const;
+
+private:
+    TraceReader reader;
+    uint32_t baud;
+    uint64_t (*clock)();
+    ReplaySpeed speed;
+    bool hasNext;
+    TraceRecord nextRecord;
+    uint8_t response[MAX_RESPONSE];
+    uint64_t responseAt[MAX_RESPONSE];
+    size_t responseLength;
+    size_t responseRead;
+    ReplayModbusStats stats;
+
+    void advance();
+};
+
+#ifdef ARDUINO
+// Taps a byte stream (the LoRa and Zigbee SoftwareSerial ports); parsers
+// read through it
+class CaptureStream : public Stream {
+public:
+    CaptureStream(Stream& stream, TraceRecorder& recorder, TraceChannel channel)
+        : stream(stream), recorder(recorder), channel(channel) {}
+    int available() override { return stream.available(); }
+    int peek() override { return stream.peek(); }
+    int read() override;
+    size_t write(uint8_t value) override;
+    size_t write(const uint8_t* data, size_t length) override;
+    void flush() override { stream.flush(); }
+
+private:
+    Stream& stream;
+    TraceRecorder& recorder;
+    TraceChannel channel;
+};
+#endif
+
+#endif // SERIAL_TRACE_H
@@ -0,0 +1,107 @@
+#ifndef SNAPSHOT_STORE_H
+#define SNAPSHOT_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "lz_codec.h"
+
+// Flash access used by the snapshot store (SPIFFS on the device, memory in tests)
+class SnapshotStorage {
+public:
+    virtual ~SnapshotStorage() {}
+    virtual bool writeFile(const std::string& path, const uint8_t* data, size_t length) = 0;
+    virtual bool readFile(const std::string& path, std::vector<uint8_t>& data) = 0;
+    virtual bool exists(const std::string& path) = 0;
+    virtual bool remove(const std::string& path) = 0;
+    // Full paths of every file whose path starts with prefix
+    virtual void list(const std::string& prefix, std::vector<std::string>& paths) = 0;
+};
+
+// A config store included in every snapshot
+struct SnapshotSource {
+    std::string name;
+    std::function<bool(std::vector<uint8_t>&)> exportData;
+    std::function<bool(const uint8_t*, size_t)> importData;
+};
+
+struct SnapshotStats {
+    uint32_t chunksWritten;
+    uint32_t chunksReused;
+    uint32_t chunksRepaired;     // existing chunk failed its check, rewritten
+    uint32_t chunksRemoved;
+    uint32_t bytesWritten;
+};
+
+// Snapshots are manifests listing, for each source, the content hashes of its
+// fixed-size chunks. Chunks are LZ-compressed and stored once under their
+// hash, so unchanged stores cost nothing in later snapshots.
+//   <root>/m_<sequence>  manifest
+//   <root>/c/<hash>      chunk: flags (u8) | raw length (u16) | data
+class SnapshotStore {
+public:
+    static const size_t CHUNK_SIZE = 1024;
+    static const size_t DEFAULT_RETENTION = 4;
+
+    explicit SnapshotStore(SnapshotStorage& storage, const std::string& root = "/backup");
+
+    void addSource(const std::string& name,
+                   std::function<bool(std::vector<uint8_t>&)> exportData,
+                   std::function<bool(const uint8_t*, size_t)> importData);
+    void setRetention(size_t count);
+    void setRoot(const std::string& path);
+
+    // Snapshot methods
+    bool create(uint32_t timestamp);
+    bool restoreLatest();
+    bool verify(uint32_t sequence);
+
+    // Status methods
+    size_t getSnapshotCount();
+    uint32_t getLatestSequence();
+    uint32_t getRestoredSequence() const;
+    const SnapshotStats& getStats() const;
+    const std::string& getLastError() const;
+
+private:
+    struct SourceEntry {
+        std::string name;
+        uint32_t length;
+        std::vector<uint64_t> chunks;
+    };
+
+    struct Manifest {
+        uint32_t sequence;
+        uint32_t timestamp;
+        std::vector<SourceEntry> sources;
+    };
+
+    SnapshotStorage& storage;
+    std::string root;
+    std::vector<SnapshotSource> sources;
+    size_t retention;
+    uint32_t restoredSequence;
+    SnapshotStats stats;
+    std::string lastError;
+    LzCodec codec;
+
+    // Helper methods
+    std::string manifestPath(uint32_t sequence) const;
+    std::string chunkPath(uint64_t hash) const;
+    void listSequences(std::vector<uint32_t>& sequences);
+    bool writeChunk(const uint8_t* data, size_t length, uint64_t& hash);
+    bool readChunk(uint64_t hash, std::vector<uint8_t>& data);
+    bool writeManifest(const Manifest& manifest);
+    bool readManifest(uint32_t sequence, Manifest& manifest);
+    bool loadSources(const Manifest& manifest, std::vector<std::vector<uint8_t>>& contents);
+    // Drops snapshots beyond the retention, then chunks no retained manifest
+    // references; false (nothing collected) if a manifest is unreadable
+    bool prune();
+    bool fail(const std::string& error);
+};
+
+uint64_t snapshotHash(const uint8_t* data, size_t length);
+
+#endif // SNAPSHOT_STORE_H
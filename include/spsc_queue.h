@@ -0,0 +1,59 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <atomic>
+
+// Lock-free single-producer/single-consumer ring buffer. Exactly one task may
+// push and exactly one task may pop; neither side ever blocks. Capacity is
+// Size - 1 and Size must be a power of two.
+template <typename T, size_t Size>
+class SpscQueue {
+    static_assert(Size >= 2 && (Size & (Size - 1)) == 0, "Size must be a power of two");
+
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    bool push(const T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t next = (h + 1) & (Size - 1);
+        if (next == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        items[h] = item;
+        head.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[t];
+        tail.store((t + 1) & (Size - 1), std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const {
+        size_t h = head.load(std::memory_order_acquire);
+        size_t t = tail.load(std::memory_order_acquire);
+        return (h - t) & (Size - 1);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    static constexpr size_t capacity() {
+        return Size - 1;
+    }
+
+private:
+    T items[Size];
+    // Producer and consumer indices on separate cache lines
+    alignas(32) std::atomic<size_t> head;
+    alignas(32) std::atomic<size_t> tail;
+};
+
+#endif // SPSC_QUEUE_H
@@ -3,9 +3,17 @@
 
 #include <Arduino.h>
 #include <SoftwareSerial.h>
-#include <ModbusMaster.h>
-#include <Adafruit_NeoPixel.h>
+#include <atomic>
+#include <functional>
 #include "maintenance.h"
+#include "sample.h"
+#include "rules_engine.h"
+#include "modbus_gateway.h"
+#include "modbus_commands.h"
+#include "spsc_queue.h"
+#include "serial_trace.h"
+#include "status_led.h"
+#include "boot_orchestrator.h"
 
 // Pin Definitions
 // LORA Module (E220-900T22D)
@@ -24,22 +32,39 @@
 #define MODBUS_RX_PIN 22
 #define MODBUS_DE_PIN 23
 #define MODBUS_RE_PIN 5
+#define MODBUS_BAUD 9600
+
+// Modbus TCP gateway in front of the RS-485 bus, configured from SPIFFS
+#define MODBUS_TCP_PORT 502
+#define MODBUS_CONFIG_FILE "/modbus.json"
 
 // 4-20mA Inputs (HW-685)
 #define ANALOG_INPUT_1 34
 #define ANALOG_INPUT_2 35
 
+// Serial capture: RAM traces are written to CAPTURE_TRACE_FILE on stop
+#define CAPTURE_RAM_SIZE 16384
+#define CAPTURE_FLASH_MAX_BYTES (256 * 1024)
+
 // LED RGB
 #define LED_RGB_PIN 13
-#define LED_COUNT 1
+#define LED_RMT_CHANNEL RMT_CHANNEL_0
+#define LED_BRIGHTNESS 50
+
+// Acquisition
+#define ANALOG_POLL_INTERVAL_MS 1000
+
+// Boot: formatting a blank SPIFFS partition takes several seconds
+#define STORAGE_BOOT_TIMEOUT_MS 30000
+#define STORAGE_TASK_STACK 6144
+
+// Edge rules (derived points and alarms), compiled at boot
+#define RULES_CONFIG_FILE "/rules.json"
 
 // States
 enum class SystemState {
     INIT,
-    LORA_CONFIG,
-    ZIGBEE_CONFIG,
-    MODBUS_CONFIG,
-    ANALOG_READING,
+    BOOTING,
     DATA_PROCESSING,
     MAINTENANCE,
     ERROR
@@ -69,6 +94,12 @@ enum class ModbusState {
     ERROR
 };
 
+enum class CaptureTarget : uint8_t {
+    NONE,
+    RAM,
+    FLASH
+};
+
 enum class AnalogState {
     IDLE,
     READING,
@@ -82,7 +113,48 @@ public:
     void update();
     void setState(SystemState newState);
     SystemState getCurrentState() const;
+
+    // Modules come up through the boot graph; other tasks add their own
+    // stages (uplinks) after begin() and before update() first runs
+    BootOrchestrator& getBoot();
+
+    // Acquired samples are handed to the sink (e.g. the uplink queue)
+    void setSampleSink(std::function<bool(const Sample&)> sink);
+    uint32_t getDroppedSamples() const;
+    // Shown on the dashboards and the status LED; both are safe to call
+    // from the network task
+    void setUplinkQueueDepth(size_t depth);
+    void setLinkUp(bool up);
+
+    // Supervision: modules in their error state report a fault, long
+    // maintenance transfers beat (on the network task, see
+    // updateMaintenance()), and a recovery request reinitializes the
+    // field-bus modules at the start of the next update()
+    void setFaultHandler(std::function<void()> handler);
+    void setHeartbeat(std::function<void()> beat);
+    bool requestRecovery();
+
+    // Serial capture of the field buses; like recovery, the request is
+    // carried out by the acquisition task. NONE stops a running capture.
+    bool requestCapture(CaptureTarget target);
+
+    // Downlink Modbus writes: submitted from the network task, executed on
+    // the acquisition task between polls, acknowledged through the sink
+    bool submitModbusCommand(const ModbusCommand& command);
+    void setCommandAckSink(std::function<bool(const ModbusCommandAck&)> sink);
+
+    // Protocol config changes from the web UI: the control only queues the
+    // JSON for the network task, which owns the protocol manager. restore
+    // queues a config restored from a snapshot, from the network task.
+    void setProtocolConfigHooks(std::function<bool(const String& json)> control, std::function<String()> report,
+                                std::function<bool(const String& json)> restore);
     
+    // Maintenance jobs (OTA, snapshots, format) and the web server belong to
+    // the network task: a job blocks its caller for the whole transfer.
+    // The server starts once Wi-Fi is up; jobs run once maintenance is.
+    void startMaintenanceServer();
+    void updateMaintenance();
+
     // Maintenance methods
     void checkForUpdates();
     void backupSystem();
@@ -92,6 +164,7 @@ public:
     MaintenanceState getMaintenanceState() const;
     String getMaintenanceError() const;
     float getUpdateProgress() const;
+    SystemConfig getSystemConfig() const;
 
 private:
     // State variables
@@ -101,31 +174,83 @@ private:
     ModbusState modbusState;
     AnalogState analogState;
 
+    // Boot
+    BootOrchestrator boot;
+    int maintenanceStage;
+    int storageStage;
+    int loraStage;
+    int zigbeeStage;
+    int modbusStage;
+
     // Module instances
+    TraceRecorder traceRecorder;
     SoftwareSerial loraSerial;
     SoftwareSerial zigbeeSerial;
-    ModbusMaster modbus;
-    Adafruit_NeoPixel led;
+    // Parsers read the radios through these so captures see every byte
+    CaptureStream loraStream;
+    CaptureStream zigbeeStream;
+    StreamModbusSerial modbusSerial;
+    CaptureModbusSerial modbusCapture;
+    ModbusRtuMaster modbusMaster;
+    WiFiModbusServerPort modbusPort;
+    ModbusTcpGateway modbusGateway;
+    ModbusCommandQueue modbusCommands;
+    SpscQueue<ModbusCommand, 8> commandInbox;
+    std::function<bool(const ModbusCommandAck&)> commandAckSink;
+    std::vector<uint16_t> modbusBlockPoints;
+    RmtLedDriver ledDriver;
+    StatusIndicator indicator;
     Maintenance maintenance;
+    RulesEngine rules;
+
+    // Supervision
+    std::function<void()> faultHandler;
+    std::atomic<bool> recoveryRequested;
+
+    // Serial capture
+    std::atomic<bool> captureRequested;
+    std::atomic<CaptureTarget> captureRequest;
+    CaptureTarget captureTarget;
+    std::vector<uint8_t> captureRam;
+    RamTraceSink ramTraceSink;
+    SpiffsTraceSink flashTraceSink;
+
+    // Acquisition output
+    std::function<bool(const Sample&)> sampleSink;
+    uint32_t droppedSamples;
+    // Points derived while a sample is evaluated share its timestamp
+    uint32_t evaluatingAt;
+    bool evaluating;
+    unsigned long lastAnalogRead;
 
     // Module methods
+    void initBoot();
+    BootStartResult startStorage();
     void initLora();
     void initZigbee();
     void initModbus();
     void initAnalog();
     void initLed();
     void initMaintenance();
+    void initRules();
+    void initModbusGateway();
 
+    void updateBoot();
     void updateLora();
     void updateZigbee();
     void updateModbus();
     void updateAnalog();
     void updateLed();
-    void updateMaintenance();
 
     // Helper methods
     void handleError();
+    void recoverModules();
+    void startCapture(CaptureTarget target);
+    void stopCapture();
     void updateLedColor(uint8_t r, uint8_t g, uint8_t b);
+    // timestampMs is millis() at acquisition, not when the frame was parsed
+    void emitSample(SampleSource source, uint16_t pointId, float value, uint32_t timestampMs);
+    void pushSample(SampleSource source, uint16_t pointId, float value, uint32_t timestampMs);
 };
 
 #endif // STATE_MACHINE_H 
\ No newline at end of file
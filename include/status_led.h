@@ -0,0 +1,119 @@
+#ifndef STATUS_LED_H
+#define STATUS_LED_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+struct LedColor {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+
+    bool operator==(const LedColor& other) const { return r == other.r && g == other.g && b == other.b; }
+    bool operator!=(const LedColor& other) const { return !(*this == other); }
+};
+
+enum class LedPattern : uint8_t {
+    SOLID,
+    BLINK,
+    BREATHE
+};
+
+// Pixel output; show() starts a transmission and returns without waiting
+class LedDriver {
+public:
+    virtual ~LedDriver() {}
+    virtual bool begin() = 0;
+    virtual bool isBusy() const = 0;
+    virtual bool show(const LedColor* pixels, size_t count) = 0;
+};
+
+#ifdef ARDUINO
+#include <driver/rmt.h>
+
+// WS2812 on an RMT channel. The 24 symbols of a pixel fit in one RMT memory
+// block, so the frame is clocked out by the peripheral while the CPU keeps
+// its interrupts; nothing is bit-banged.
+class RmtLedDriver : public LedDriver {
+public:
+    static const size_t MAX_PIXELS = 2;
+
+    RmtLedDriver(int pin, rmt_channel_t channel) : pin(pin), channel(channel), installed(false) {}
+    bool begin() override;
+    bool isBusy() const override;
+    bool show(const LedColor* pixels, size_t count) override;
+
+private:
+    int pin;
+    rmt_channel_t channel;
+    bool installed;
+    rmt_item32_t items[MAX_PIXELS * 24];
+};
+#endif
+
+struct StatusIndicatorStats {
+    uint32_t frames;         // patterns evaluated
+    uint32_t transmissions;  // frames that changed the LED
+    uint32_t busySkips;      // changes held back by a transmission in progress
+};
+
+// Computes the status LED from the gateway state and the time, and pushes it
+// to the driver only when the color changes. Priority, highest first: fault
+// (solid red), OTA (orange blink whose on-time grows with progress), link
+// down (base color blinking at 1 Hz), uplink backlog (base color breathing
+// faster as the backlog grows), otherwise the base color. Link, backlog and
+// progress may be set from any task; update() runs on one.
+class StatusIndicator {
+public:
+    static const uint32_t FRAME_INTERVAL_MS = 20;
+    static const uint32_t BLINK_PERIOD_MS = 1000;
+    static const uint32_t OTA_PERIOD_MS = 1000;
+    static const uint32_t BREATHE_SLOW_MS = 4000;
+    static const uint32_t BREATHE_FAST_MS = 1000;
+    static const uint16_t DEFAULT_BACKLOG_THRESHOLD = 32;
+    static const uint16_t DEFAULT_BACKLOG_FULL = 256;
+
+    explicit StatusIndicator(LedDriver& driver);
+
+    bool begin();
+    void setBrightness(uint8_t brightness);
+    void setBacklogThresholds(uint16_t threshold, uint16_t full);
+
+    void setBase(LedColor color);
+    void setFault(bool fault);
+    void setLinkUp(bool up);
+    void setBacklog(size_t depth);
+    // Percent; negative when no update is running
+    void setProgress(float percent);
+
+    // Evaluates the pattern at most once per FRAME_INTERVAL_MS
+    void update(uint32_t now);
+
+    // The pure part, for tests: what the LED shows at a given time
+    LedColor compute(uint32_t now) const;
+    LedPattern getPattern() const;
+    const StatusIndicatorStats& getStats() const;
+
+private:
+    LedDriver& driver;
+    uint8_t brightness;
+    uint16_t backlogThreshold;
+    uint16_t backlogFull;
+    LedColor base;
+    std::atomic<bool> fault;
+    std::atomic<bool> linkUp;
+    std::atomic<uint16_t> backlog;
+    std::atomic<int16_t> progressPermille;
+    bool started;
+    bool shown;
+    LedColor lastShown;
+    uint32_t lastFrameAt;
+    StatusIndicatorStats stats;
+
+    // Helper methods
+    static LedColor scale(LedColor color, uint8_t level);
+    uint32_t breathePeriodMs(uint16_t depth) const;
+};
+
+#endif // STATUS_LED_H
@@ -0,0 +1,183 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <functional>
+
+// Hardware reset cause as reported at boot
+enum class ResetCause : uint8_t {
+    UNKNOWN,
+    POWER_ON,
+    EXTERNAL,
+    SOFTWARE,
+    PANIC,
+    TASK_WATCHDOG,
+    OTHER_WATCHDOG,
+    BROWNOUT,
+    DEEP_SLEEP
+};
+
+// Escalation ladder, one step per missed grace period
+enum class RecoveryLevel : uint8_t {
+    NONE,
+    SOFT,            // the module's own reinit handler
+    PROTOCOL_RESET,  // tear down and reconnect every uplink
+    REBOOT
+};
+
+// One post-mortem entry: what the hardware reported at the next boot and
+// what the supervisor was doing about which module before it
+struct ResetRecord {
+    uint32_t bootCount;
+    ResetCause cause;
+    RecoveryLevel level;
+    char module[16];
+    uint32_t uptimeMs;
+    uint32_t staleMs;
+};
+
+// Persisted across reboots. "pending" is written before every escalation
+// step, so a watchdog or panic reset that beats the supervisor to it still
+// names the module that stalled
+struct SupervisorLog {
+    static const size_t MAX_RECORDS = 8;
+
+    uint32_t bootCount;
+    uint8_t count;
+    uint8_t next;
+    bool hasPending;
+    ResetRecord pending;
+    ResetRecord records[MAX_RECORDS];
+};
+
+// Watchdog, restart and storage access; the ESP32 implementation wraps the
+// ESP-IDF task WDT and SPIFFS, tests drive a fake
+class SupervisorHal {
+public:
+    virtual ~SupervisorHal() {}
+    // Subscribes the calling task to the watchdog
+    virtual bool beginWatchdog(uint32_t timeoutMs) = 0;
+    virtual void feedWatchdog() = 0;
+    virtual void restart() = 0;
+    virtual ResetCause resetCause() = 0;
+    virtual bool loadLog(SupervisorLog& log) = 0;
+    virtual bool saveLog(const SupervisorLog& log) = 0;
+};
+
+#ifdef ARDUINO
+class EspSupervisorHal : public SupervisorHal {
+public:
+    bool beginWatchdog(uint32_t timeoutMs) override;
+    void feedWatchdog() override;
+    void restart() override;
+    ResetCause resetCause() override;
+    bool loadLog(SupervisorLog& log) override;
+    bool saveLog(const SupervisorLog& log) override;
+};
+#endif
+
+struct ModuleStatus {
+    const char* name;
+    uint32_t deadlineMs;
+    uint32_t ageMs;
+    bool stale;
+    RecoveryLevel level;
+    uint8_t health;     // 0-100
+    uint32_t misses;
+    uint32_t recoveries;
+};
+
+// Modules and tasks register a heartbeat deadline and call heartbeat() from
+// wherever they make progress. update() runs from one task (the one
+// subscribed to the task WDT) and feeds the watchdog only while every
+// heartbeat is fresh. A stale module walks the ladder: its soft recovery
+// handler, then the protocol reset handler, then a reboot, with one
+// deadline of grace between steps. The level only decays after the module
+// has stayed fresh for a while, so a module that keeps failing climbs the
+// ladder instead of being soft-recovered forever.
+class Supervisor {
+public:
+    typedef std::function<bool()> RecoveryHandler;
+
+    static const size_t MAX_MODULES = 8;
+    static const uint32_t DEFAULT_STABLE_MS = 300000;
+    static const uint8_t MISS_PENALTY = 30;
+    static const uint8_t ESCALATION_PENALTY = 20;
+    static const uint8_t FRESH_CREDIT = 5;
+
+    explicit Supervisor(SupervisorHal& hal);
+
+    // Configuration
+    void setClock(uint32_t (*clock)());
+    void setStableInterval(uint32_t ms);
+    // Returns the module id for heartbeat(), or -1 when the table is full.
+    // A null or failing handler moves on to the next step at once.
+    int addModule(const char* name, uint32_t deadlineMs, RecoveryHandler recover = nullptr);
+    void setProtocolReset(RecoveryHandler reset);
+    void setLogCallback(void (*callback)(const char*));
+
+    // Records the reset cause and starts the watchdog; call after addModule()
+    bool begin();
+    void update();
+
+    // Safe from any task
+    void heartbeat(int module);
+    // The module knows it is broken: start the ladder without waiting
+    void reportFault(int module);
+
+    // Status methods
+    // Sized so the ladder finishes before the hardware watchdog fires
+    uint32_t getWatchdogTimeoutMs() const;
+    size_t getModuleCount() const;
+    bool getModuleStatus(size_t module, ModuleStatus& status) const;
+    uint8_t getHealth() const;
+    ResetCause getResetCause() const;
+    const SupervisorLog& getLog() const;
+    uint32_t getWatchdogFeeds() const;
+
+private:
+    struct Module {
+        const char* name;
+        uint32_t deadlineMs;
+        RecoveryHandler recover;
+        std::atomic<uint32_t> lastBeat;
+        std::atomic<bool> fault;
+        bool faulted;
+        bool stale;
+        RecoveryLevel level;
+        uint32_t nextStepAt;
+        uint32_t freshSince;
+        uint32_t lastCreditAt;
+        uint8_t health;
+        uint32_t misses;
+        uint32_t recoveries;
+    };
+
+    SupervisorHal& hal;
+    uint32_t (*clock)();
+    uint32_t startedAt;
+    uint32_t stableMs;
+    Module modules[MAX_MODULES];
+    size_t moduleCount;
+    RecoveryHandler protocolReset;
+    void (*logCallback)(const char*);
+    SupervisorLog log;
+    ResetCause resetCause;
+    uint32_t watchdogFeeds;
+    bool rebooting;
+
+    // Helper methods
+    void checkModule(Module& module, uint32_t now);
+    void escalate(Module& module, uint32_t now);
+    bool runStep(Module& module);
+    void writePending(const Module& module, uint32_t now);
+    void penalize(Module& module, uint8_t points);
+    void emitLog(const char* format, ...);
+};
+
+const char* resetCauseName(ResetCause cause);
+const char* recoveryLevelName(RecoveryLevel level);
+
+#endif // SUPERVISOR_H
@@ -0,0 +1,81 @@
+#ifndef TASK_TOPOLOGY_H
+#define TASK_TOPOLOGY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <functional>
+
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <thread>
+#endif
+
+// Core assignment: radios and the TCP/IP stack stay on the protocol core,
+// field-bus acquisition gets the application core to itself
+#define NETWORK_CORE 0
+#define ACQUISITION_CORE 1
+
+struct TaskSpec {
+    const char* name;
+    int core;
+    uint8_t priority;
+    uint32_t stackSize;
+    uint32_t periodMs;
+    std::function<void()> body;
+};
+
+struct TaskStats {
+    const char* name;
+    int core;
+    uint32_t iterations;
+    uint32_t maxBusyUs;
+    // Share of wall time spent in the task body since the previous sample
+    float utilization;
+};
+
+class TaskTopology {
+public:
+    static const size_t MAX_TASKS = 4;
+
+    TaskTopology();
+    ~TaskTopology();
+
+    bool addTask(const TaskSpec& spec);
+    bool start();
+    void stop();
+
+    // Status methods
+    size_t getTaskCount() const;
+    bool sampleStats(size_t index, TaskStats& stats);
+    bool isRunning() const;
+
+private:
+    struct TaskSlot {
+        TaskSpec spec;
+        TaskTopology* owner;
+        std::atomic<uint32_t> iterations;
+        std::atomic<uint32_t> busyUs;
+        std::atomic<uint32_t> maxBusyUs;
+        uint32_t lastBusyUs;
+        uint32_t lastSampleUs;
+        std::atomic<bool> finished;
+#ifdef ARDUINO
+        TaskHandle_t handle;
+#else
+        std::thread thread;
+#endif
+    };
+
+    TaskSlot slots[MAX_TASKS];
+    size_t taskCount;
+    std::atomic<bool> running;
+
+    static void runTask(void* arg);
+    static uint32_t nowUs();
+    static void sleepUntilUs(uint32_t deadline);
+};
+
+#endif // TASK_TOPOLOGY_H
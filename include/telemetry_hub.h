@@ -0,0 +1,74 @@
+#ifndef TELEMETRY_HUB_H
+#define TELEMETRY_HUB_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <atomic>
+#include <vector>
+
+// Live values pushed to every dashboard on each tick
+struct TelemetrySnapshot {
+    static const size_t MAX_SENSORS = 8;
+
+    uint32_t uptimeMs;
+    uint32_t freeHeap;
+    uint32_t minFreeHeap;
+    int maintenanceState;
+    float updateProgress;
+    uint16_t queueDepth;
+    uint8_t sensorCount;
+    float sensorValues[MAX_SENSORS];
+};
+
+// Metric sources may be called from any task. The async_tcp task owns the
+// socket's client list; update() reaches clients only through the set
+// kept by the connect/disconnect events, under the hub's lock.
+class TelemetryHub {
+public:
+    static const size_t BUFFER_SIZE = 384;
+    static const uint32_t DEFAULT_INTERVAL_MS = 1000;
+    static const size_t MAX_CLIENTS = 4;
+
+    explicit TelemetryHub(const char* path = "/ws/telemetry");
+    void begin(AsyncWebServer& server);
+    void update();
+
+    // Metric sources
+    void setMaintenanceStatus(int state, float progress);
+    void setQueueDepth(size_t depth);
+    void recordSensorValue(uint8_t channel, float value);
+
+    // Configuration and status
+    void setInterval(uint32_t intervalMs);
+    size_t getClientCount() const;
+    uint32_t getDroppedClients() const;
+
+    // Serializes a snapshot as JSON into a caller-owned buffer
+    static size_t serialize(const TelemetrySnapshot& snapshot, char* buffer, size_t size);
+
+private:
+    AsyncWebSocket socket;
+    SemaphoreHandle_t clientsMutex;
+    // One spare for the oldest client while it closes
+    AsyncWebSocketClient* clients[MAX_CLIENTS + 1];
+    size_t clientCount;
+    // Frames still queued on some client; freed once no client holds them
+    std::vector<AsyncWebSocketMessageBuffer*> sentBuffers;
+    TelemetrySnapshot snapshot;
+    std::atomic<int> maintenanceState;
+    std::atomic<float> updateProgress;
+    std::atomic<uint16_t> queueDepth;
+    std::atomic<uint8_t> sensorCount;
+    std::atomic<float> sensorValues[TelemetrySnapshot::MAX_SENSORS];
+    uint32_t intervalMs;
+    unsigned long lastPush;
+    std::atomic<uint32_t> droppedClients;
+    char buffer[BUFFER_SIZE];
+
+    void handleEvent(AsyncWebSocketClient* client, AwsEventType type);
+    void push();
+    void dropSlowClients();
+    void releaseSentBuffers();
+};
+
+#endif // TELEMETRY_HUB_H
@@ -0,0 +1,150 @@
+#ifndef TIME_SERVICE_H
+#define TIME_SERVICE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sample.h"
+
+struct TimeServiceStats {
+    uint32_t syncs;
+    uint32_t steps;
+    int64_t lastErrorUs;    // measured minus predicted wall time at the last sync
+    int32_t driftPpb;       // frequency correction currently applied
+};
+
+// Wall clock derived from the monotonic microsecond timer (the base millis()
+// uses, so Sample::timestampMs converts directly). Offset measurements
+// discipline it: the first one, or one that disagrees by more than the step
+// threshold, sets the offset outright; smaller errors are slewed out at a
+// bounded rate so wall time never runs backwards, and the residual left
+// between syncs trims a frequency correction for the crystal's drift.
+// Called from the network task only.
+class TimeService {
+public:
+    static const uint32_t DEFAULT_STEP_THRESHOLD_MS = 1000;
+    static const uint32_t DEFAULT_MAX_SLEW_PPM = 500;
+    static const int32_t MAX_DRIFT_PPB = 100000;
+    // Shorter sync intervals say more about network jitter than frequency
+    static const uint32_t MIN_DRIFT_INTERVAL_MS = 64000;
+
+    TimeService();
+
+    // Configuration
+    void setClock(uint64_t (*clock)());
+    void setStepThreshold(uint32_t ms);
+    void setMaxSlew(uint32_t ppm);
+
+    // unixUs was the wall time at monotonic time monoUs
+    void discipline(uint64_t unixUs, uint64_t monoUs);
+    void reset();
+
+    // Conversion methods; wall times are 0 until the first sync
+    uint64_t monotonicUs() const;
+    uint64_t nowUnixUs() const;
+    uint64_t toUnixUs(uint64_t monoUs) const;
+    // Widens a 32-bit millisecond stamp against the current time, so it stays
+    // correct across the 49-day millis() wrap for samples younger than that
+    uint64_t toUnixMs(uint32_t monoMs) const;
+    TimeBase timeBase() const;
+
+    // Status methods
+    bool isSynced() const;
+    const TimeServiceStats& getStats() const;
+
+private:
+    uint64_t (*clock)();
+    uint32_t stepThresholdMs;
+    uint32_t maxSlewPpm;
+    bool synced;
+    uint64_t anchorUs;
+    int64_t anchorOffsetUs;
+    int64_t slewUs;
+    uint64_t lastSyncUs;
+    TimeServiceStats stats;
+
+    int64_t slewApplied(uint64_t monoUs) const;
+    int64_t offsetAt(uint64_t monoUs) const;
+    void reanchor(uint64_t monoUs);
+};
+
+// Datagram link to the NTP server (WiFiUDP on the device, a fake in tests)
+class SntpTransport {
+public:
+    virtual ~SntpTransport() {}
+    virtual bool send(const uint8_t* data, size_t length) = 0;
+    // Non-blocking; returns the size of the next datagram or 0
+    virtual int receive(uint8_t* data, size_t capacity) = 0;
+};
+
+#ifdef ARDUINO
+#include <Udp.h>
+#include <IPAddress.h>
+
+class UdpSntpTransport : public SntpTransport {
+public:
+    static const uint16_t LOCAL_PORT = 2390;
+
+    explicit UdpSntpTransport(UDP& udp) : udp(udp), serverPort(123), started(false) {}
+    // Resolves the server now; call again after a link change
+    bool begin(const char* server, uint16_t port = 123);
+    bool send(const uint8_t* data, size_t length) override;
+    int receive(uint8_t* data, size_t capacity) override;
+
+private:
+    UDP& udp;
+    IPAddress serverAddress;
+    uint16_t serverPort;
+    bool started;
+};
+#endif
+
+struct SntpStats {
+    uint32_t requests;
+    uint32_t responses;
+    uint32_t rejected;
+    uint32_t timeouts;
+    uint32_t lastDelayUs;
+};
+
+// Non-blocking SNTPv4 client (RFC 4330). Each exchange is timed on the
+// monotonic clock: the midpoint of request and response is paired with the
+// midpoint of the server's receive and transmit stamps, and exchanges whose
+// round trip exceeds the maximum delay are discarded. Failures retry with
+// exponential backoff up to the poll interval.
+class SntpClient {
+public:
+    static const size_t PACKET_SIZE = 48;
+    static const uint32_t DEFAULT_POLL_INTERVAL_MS = 1024000;
+    static const uint32_t DEFAULT_MAX_DELAY_MS = 500;
+    static const uint32_t RESPONSE_TIMEOUT_MS = 2000;
+    static const uint32_t MIN_RETRY_MS = 4000;
+
+    SntpClient(SntpTransport& transport, TimeService& time);
+
+    void setPollInterval(uint32_t ms);
+    void setMaxDelay(uint32_t ms);
+    // Sends a request on the next update(), e.g. after the link came up
+    void syncNow();
+    void update();
+
+    bool isWaiting() const;
+    const SntpStats& getStats() const;
+
+private:
+    SntpTransport& transport;
+    TimeService& time;
+    uint32_t pollIntervalMs;
+    uint32_t maxDelayMs;
+    uint32_t retryMs;
+    uint64_t nextRequestAt;
+    uint64_t sentAt;
+    uint64_t nonce;
+    bool waiting;
+    SntpStats stats;
+
+    void sendRequest(uint64_t now);
+    bool handleResponse(const uint8_t* packet, size_t length, uint64_t receivedAt);
+    void scheduleRetry(uint64_t now);
+};
+
+#endif // TIME_SERVICE_H
@@ -0,0 +1,145 @@
+#ifndef TLS_CONTEXT_H
+#define TLS_CONTEXT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include "mqtt_session.h"
+
+enum class TlsCredentialKind : uint8_t {
+    CA,
+    CERTIFICATE,
+    PRIVATE_KEY
+};
+
+// Counts the PEM blocks whose label contains `label` and checks that each
+// decodes to a well-formed DER SEQUENCE. Returns 0 when any block is bad.
+size_t pemCountBlocks(const char* pem, size_t length, const char* label);
+
+// CA bundle, client certificate and key, validated once and kept resident.
+// Every secure client points at the same buffers, so loading the same PEM
+// again (e.g. on reconnect or config reload) costs a hash, not a parse.
+class TlsCredentials {
+public:
+    TlsCredentials();
+
+    bool load(TlsCredentialKind kind, const char* pem, size_t length);
+    void clear(TlsCredentialKind kind);
+
+    // Null-terminated PEM, or nullptr when nothing is loaded
+    const char* get(TlsCredentialKind kind) const;
+    bool hasClientIdentity() const;
+    size_t getCaCount() const;
+    uint32_t getParseCount() const;
+
+private:
+    std::string pem[3];
+    uint32_t fingerprint[3];
+    size_t blocks[3];
+    uint32_t parses;
+};
+
+// Secured connection the manager opens, times and reuses
+class TlsSocket {
+public:
+    virtual ~TlsSocket() {}
+    virtual bool open(const char* host, uint16_t port, const TlsCredentials& credentials) = 0;
+    virtual void close() = 0;
+    virtual bool isOpen() = 0;
+};
+
+struct TlsHandshakeStats {
+    uint32_t handshakes;
+    uint32_t failures;
+    uint32_t reused;
+    uint32_t lastHandshakeMs;
+    uint32_t maxHandshakeMs;
+    uint64_t totalHandshakeMs;
+};
+
+// Shared TLS state for MQTT, HTTPS and WSS: one set of parsed credentials,
+// connections kept open per endpoint so later requests skip the handshake,
+// and handshake counts/durations per endpoint.
+class TlsContextManager {
+public:
+    static const size_t MAX_ENDPOINTS = 4;
+
+    TlsContextManager();
+
+    void setClock(uint32_t (*clock)());
+    TlsCredentials& credentials();
+    const TlsCredentials& credentials() const;
+
+    // Makes sure socket holds an open session to host:port, reusing the
+    // current one when it still points there
+    bool acquire(TlsSocket& socket, const char* host, uint16_t port);
+    void release(TlsSocket& socket);
+
+    // For clients that run their own handshake (e.g. the WebSocket library)
+    void recordHandshake(const char* host, uint16_t port, uint32_t durationMs, bool success);
+
+    // Status methods
+    const TlsHandshakeStats& getStats() const;
+    const TlsHandshakeStats* getEndpointStats(const char* host, uint16_t port) const;
+
+private:
+    struct Endpoint {
+        std::string host;
+        uint16_t port;
+        TlsSocket* socket;
+        uint32_t lastUsedAt;
+        TlsHandshakeStats stats;
+    };
+
+    uint32_t (*clock)();
+    TlsCredentials store;
+    Endpoint endpoints[MAX_ENDPOINTS];
+    size_t endpointCount;
+    TlsHandshakeStats totals;
+
+    // Helper methods
+    Endpoint* findEndpoint(const char* host, uint16_t port);
+    Endpoint& endpointFor(const char* host, uint16_t port);
+    Endpoint* findBySocket(const TlsSocket& socket);
+    void record(Endpoint& endpoint, uint32_t durationMs, bool success);
+};
+
+#ifdef ARDUINO
+#include <WiFiClient.h>
+#include <WiFiClientSecure.h>
+
+class SecureClientSocket : public TlsSocket {
+public:
+    explicit SecureClientSocket(WiFiClientSecure& client) : client(client) {}
+    bool open(const char* host, uint16_t port, const TlsCredentials& credentials) override;
+    void close() override;
+    bool isOpen() override;
+
+private:
+    WiFiClientSecure& client;
+};
+
+// MQTT byte stream over either the plain client or a managed TLS socket
+class TlsMqttTransport : public MqttTransport {
+public:
+    TlsMqttTransport(WiFiClient& plain, WiFiClientSecure& secure, SecureClientSocket& socket,
+                     TlsContextManager& tls);
+    void setSecure(bool secure);
+    bool open(const char* host, uint16_t port) override;
+    void close() override;
+    bool isOpen() override;
+    int read(uint8_t* data, size_t length) override;
+    size_t write(const uint8_t* data, size_t length) override;
+
+private:
+    WiFiClient& plain;
+    WiFiClientSecure& secure;
+    SecureClientSocket& socket;
+    TlsContextManager& tls;
+    bool useTls;
+
+    Client& active();
+};
+#endif
+
+#endif // TLS_CONTEXT_H
@@ -0,0 +1,82 @@
+#ifndef UPLINK_ROUTER_H
+#define UPLINK_ROUTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "protocol_types.h"
+
+// How a topic's traffic is spread over its uplinks
+enum class RoutePolicy : uint8_t {
+    FAILOVER,   // first healthy uplink in priority order
+    MIRROR,     // every healthy uplink
+    WEIGHTED    // smooth weighted round-robin, weights scaled by latency
+};
+
+struct UplinkChoice {
+    ProtocolType protocol;
+    uint8_t weight;
+};
+
+struct UplinkHealth {
+    bool connected;
+    bool errorActive;
+    uint32_t consecutiveFailures;
+    uint32_t lastFailureAt;
+    uint32_t latencyMs;   // moving average of send/ack latency
+    uint32_t sent;
+    uint32_t failed;
+};
+
+// Picks the uplinks for each message from per-topic policies. Health comes
+// from the connection state and last error ProtocolManager already tracks,
+// plus the outcome and latency of every send. A failed uplink is skipped
+// for a cooldown and then probed again.
+class UplinkRouter {
+public:
+    static const size_t MAX_UPLINKS = 4;
+    static const size_t PROTOCOL_COUNT = PROTOCOL_TYPE_COUNT;
+    static const uint32_t DEFAULT_COOLDOWN_MS = 5000;
+
+    UplinkRouter();
+
+    // Routes are matched by longest topic prefix
+    bool setRoute(const std::string& topicPrefix, RoutePolicy policy, const UplinkChoice* uplinks, size_t count);
+    bool removeRoute(const std::string& topicPrefix);
+    void setCooldown(uint32_t ms);
+
+    // Health inputs
+    void updateLink(ProtocolType protocol, bool connected, bool errorActive, uint32_t now);
+    void recordResult(ProtocolType protocol, bool success, uint32_t latencyMs, uint32_t now);
+
+    // Fills targets (MAX_UPLINKS entries) and returns how many were chosen.
+    // Topics without a route go to their own protocol.
+    size_t route(const char* topic, ProtocolType protocol, uint32_t now, ProtocolType* targets);
+
+    // Status methods
+    bool isHealthy(ProtocolType protocol, uint32_t now) const;
+    const UplinkHealth& getHealth(ProtocolType protocol) const;
+    size_t getRouteCount() const;
+
+private:
+    struct Route {
+        std::string prefix;
+        RoutePolicy policy;
+        UplinkChoice uplinks[MAX_UPLINKS];
+        int32_t current[MAX_UPLINKS];
+        size_t count;
+    };
+
+    std::vector<Route> routes;
+    UplinkHealth health[PROTOCOL_COUNT];
+    uint32_t cooldownMs;
+
+    // Helper methods
+    Route* findRoute(const char* topic);
+    int rank(ProtocolType protocol, uint32_t now) const;
+    ProtocolType pickFailover(const Route& route, uint32_t now) const;
+    ProtocolType pickWeighted(Route& route, uint32_t now);
+};
+
+#endif // UPLINK_ROUTER_H
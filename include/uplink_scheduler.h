@@ -0,0 +1,119 @@
+#ifndef UPLINK_SCHEDULER_H
+#define UPLINK_SCHEDULER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "protocol_types.h"
+
+// Message classes, most urgent first
+enum class MessagePriority : uint8_t {
+    ALARM,
+    CONTROL,
+    TELEMETRY,
+    BULK
+};
+
+enum class SchedulingMode : uint8_t {
+    STRICT,   // always the most urgent class with something sendable
+    WEIGHTED  // smooth weighted round-robin between classes
+};
+
+// Token bucket in micro-tokens, so fractional rates need no floats at runtime.
+// A rate of 0 means unlimited.
+class TokenBucket {
+public:
+    TokenBucket();
+
+    void configure(float ratePerSecond, uint16_t burst);
+    bool isLimited() const;
+    bool available(uint32_t now);
+    bool consume(uint32_t now);
+    void refund();
+
+private:
+    uint32_t ratePerMs;
+    uint32_t capacity;
+    uint32_t tokens;
+    uint32_t lastRefill;
+    bool started;
+
+    void refill(uint32_t now);
+};
+
+// A queued message as the scheduler sees it; the message itself stays with
+// the caller, indexed by handle
+struct QueuedEntry {
+    uint16_t handle;
+    MessagePriority priority;
+    ProtocolType protocol;
+    int8_t topicClass;
+    uint32_t enqueuedAt;
+};
+
+struct PriorityStats {
+    uint32_t enqueued;
+    uint32_t delivered;
+    uint32_t dropped;
+    uint32_t throttled;  // pops that found only rate-limited entries in this class
+    uint64_t totalDelayMs;
+    uint32_t maxDelayMs;
+};
+
+// Per-class queues between ProtocolManager::publish() and the uplinks. Each
+// topic class (longest matching prefix) has a token bucket; an entry is only
+// handed out when it allows it. Per-uplink limits are charged by the
+// protocol manager once routing has picked the uplink. Entries whose dispatch
+// fails are restored to the head of their class with their tokens.
+class UplinkScheduler {
+public:
+    static const size_t PRIORITY_COUNT = 4;
+    static const size_t MAX_TOPIC_CLASSES = 8;
+
+    explicit UplinkScheduler(size_t capacity);
+
+    // Configuration
+    void setMode(SchedulingMode mode);
+    void setWeight(MessagePriority priority, uint8_t weight);
+    // Returns the topic class, or -1 when the table is full
+    int setTopicLimit(const std::string& topicPrefix, float ratePerSecond, uint16_t burst);
+    int classify(const char* topic) const;
+
+    // Queueing
+    bool enqueue(const QueuedEntry& entry);
+    // Frees room for a more urgent message: drops the newest entry of the
+    // least urgent class below the given priority
+    bool evictBelow(MessagePriority priority, uint16_t& handle);
+    bool pop(uint32_t now, QueuedEntry& entry);
+    // Restore in reverse pop order to keep the original order
+    void restore(const QueuedEntry& entry);
+    void delivered(const QueuedEntry& entry, uint32_t now);
+
+    // Status methods
+    size_t size() const;
+    size_t size(MessagePriority priority) const;
+    const PriorityStats& getStats(MessagePriority priority) const;
+    uint32_t getMeanDelayMs(MessagePriority priority) const;
+
+private:
+    struct TopicClass {
+        std::string prefix;
+        TokenBucket bucket;
+    };
+
+    size_t capacity;
+    size_t count;
+    SchedulingMode mode;
+    std::vector<QueuedEntry> queues[PRIORITY_COUNT];
+    uint8_t weights[PRIORITY_COUNT];
+    int32_t current[PRIORITY_COUNT];
+    std::vector<TopicClass> topicClasses;
+    PriorityStats stats[PRIORITY_COUNT];
+
+    // Helper methods
+    int findEligible(size_t priority, uint32_t now);
+    TokenBucket* topicBucket(int8_t topicClass);
+};
+
+#endif // UPLINK_SCHEDULER_H
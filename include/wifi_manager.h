@@ -0,0 +1,179 @@
+#ifndef WIFI_MANAGER_H
+#define WIFI_MANAGER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <string>
+
+// IPv4 addresses in the byte order the ESP32 IPAddress uses
+struct WifiIpConfig {
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+};
+
+struct WifiScanResult {
+    char ssid[33];
+    uint8_t bssid[6];
+    int32_t channel;
+    int32_t rssi;
+};
+
+// What the last good association looked like; lets the next boot skip the
+// channel scan and DHCP
+struct WifiFastPath {
+    bool valid;
+    uint8_t bssid[6];
+    int32_t channel;
+    WifiIpConfig ip;
+};
+
+enum class WifiLinkStatus {
+    IDLE,
+    CONNECTING,
+    CONNECTED,
+    FAILED
+};
+
+// Radio and storage access; the ESP32 implementation wraps WiFi and SPIFFS,
+// tests drive a fake
+class WifiHal {
+public:
+    virtual ~WifiHal() {}
+    // Non-blocking. bssid may be null (any AP, channel 0 = all channels);
+    // staticIp null means DHCP
+    virtual void begin(const char* ssid, const char* password, const uint8_t* bssid, int32_t channel,
+                       const WifiIpConfig* staticIp) = 0;
+    virtual void disconnect() = 0;
+    virtual WifiLinkStatus status() = 0;
+    virtual bool startScan() = 0;
+    // -1 while the scan runs, otherwise the number of results copied
+    virtual int scanResults(WifiScanResult* results, size_t capacity) = 0;
+    virtual int32_t rssi() = 0;
+    virtual bool linkInfo(uint8_t bssid[6], int32_t& channel, WifiIpConfig& ip) = 0;
+    virtual bool loadFastPath(WifiFastPath& path) = 0;
+    virtual bool saveFastPath(const WifiFastPath& path) = 0;
+};
+
+#ifdef ARDUINO
+class EspWifiHal : public WifiHal {
+public:
+    void begin(const char* ssid, const char* password, const uint8_t* bssid, int32_t channel,
+               const WifiIpConfig* staticIp) override;
+    void disconnect() override;
+    WifiLinkStatus status() override;
+    bool startScan() override;
+    int scanResults(WifiScanResult* results, size_t capacity) override;
+    int32_t rssi() override;
+    bool linkInfo(uint8_t bssid[6], int32_t& channel, WifiIpConfig& ip) override;
+    bool loadFastPath(WifiFastPath& path) override;
+    bool saveFastPath(const WifiFastPath& path) override;
+};
+#endif
+
+enum class WifiManagerState {
+    IDLE,
+    FAST_CONNECT,
+    SCANNING,
+    CONNECTING,
+    CONNECTED,
+    ROAM_SCANNING,
+    ROAMING,
+    WAITING
+};
+
+enum class WifiEvent {
+    LINK_UP,
+    LINK_DOWN,
+    ROAMED
+};
+
+struct WifiStats {
+    uint32_t connects;
+    uint32_t fastConnects;
+    uint32_t fastPathMisses;
+    uint32_t failures;
+    uint32_t roams;
+    uint32_t linkDowns;
+    uint32_t lastConnectMs;
+};
+
+// Brings the station link up and keeps it up. After a reboot it associates
+// straight to the last BSSID/channel with the last IP configuration; if that
+// fails it scans and picks the strongest AP. While connected it watches RSSI
+// and moves to a clearly better AP of the same network in the background.
+class WifiManager {
+public:
+    static const uint32_t FAST_CONNECT_TIMEOUT_MS = 1500;
+    static const uint32_t CONNECT_TIMEOUT_MS = 10000;
+    static const uint32_t SCAN_TIMEOUT_MS = 8000;
+    static const uint32_t MIN_RETRY_MS = 1000;
+    static const uint32_t MAX_RETRY_MS = 30000;
+    static const uint32_t RSSI_SAMPLE_MS = 1000;
+    static const uint32_t ROAM_SCAN_INTERVAL_MS = 60000;
+    static const int32_t DEFAULT_ROAM_THRESHOLD_DBM = -75;
+    static const int32_t ROAM_HYSTERESIS_DB = 8;
+    static const size_t MAX_LISTENERS = 4;
+    static const size_t MAX_SCAN_RESULTS = 16;
+
+    explicit WifiManager(WifiHal& hal);
+
+    // Configuration
+    void setClock(uint32_t (*clock)());
+    void setRoamThreshold(int32_t dbm);
+    void setStaticIpFastPath(bool enable);
+    bool addListener(std::function<void(WifiEvent)> listener);
+
+    bool begin(const char* ssid, const char* password);
+    void stop();
+    void update();
+
+    // Status methods
+    WifiManagerState getState() const;
+    bool isConnected() const;
+    int32_t getRssi() const;
+    const WifiStats& getStats() const;
+
+private:
+    WifiHal& hal;
+    uint32_t (*clock)();
+    std::string ssid;
+    std::string password;
+    WifiManagerState state;
+    WifiFastPath fastPath;
+    bool staticIpFastPath;
+    int32_t roamThreshold;
+    bool linkUp;
+
+    uint32_t attemptStartedAt;
+    uint32_t outageStartedAt;
+    uint32_t retryAt;
+    uint32_t retryDelayMs;
+    uint32_t lastRssiSampleAt;
+    uint32_t lastRoamScanAt;
+    static const int32_t RSSI_SCALE = 16;
+    int32_t smoothedRssi; // dBm * RSSI_SCALE
+    uint8_t currentBssid[6];
+    WifiScanResult scan[MAX_SCAN_RESULTS];
+
+    std::function<void(WifiEvent)> listeners[MAX_LISTENERS];
+    size_t listenerCount;
+    WifiStats stats;
+
+    // Helper methods
+    void startFastConnect(uint32_t now);
+    void startScan(uint32_t now);
+    void startConnect(const uint8_t* bssid, int32_t channel, uint32_t now);
+    void updateAttempt(uint32_t now);
+    void updateScan(uint32_t now);
+    void updateConnected(uint32_t now);
+    void onConnected(uint32_t now);
+    void onLinkLost(uint32_t now);
+    void scheduleRetry(uint32_t now);
+    const WifiScanResult* strongest(int count, const uint8_t* exclude);
+    void emit(WifiEvent event);
+};
+
+#endif // WIFI_MANAGER_H
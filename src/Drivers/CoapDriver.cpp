@@ -0,0 +1,119 @@
+// CoapDriver.cpp
+#include <WiFi.h>
+#include "CoapDriver.h"
+
+// CoAP Content-Format registry numbers; MessagePack and protobuf have none
+static int coapContentFormat(PayloadFormat format) {
+    switch (format) {
+        case PayloadFormat::JSON:
+            return 50;
+        case PayloadFormat::CBOR:
+            return 60;
+        default:
+            return -1;
+    }
+}
+
+CoapDriver::CoapDriver(ProtocolContext& context)
+    : ProtocolDriver(context)
+    , transport(udp)
+    , coap(transport)
+    , responseCallback(nullptr)
+{
+}
+
+size_t CoapDriver::inflight() const {
+    size_t active = coap.getActiveCount();
+    return active > observations.size() ? active - observations.size() : 0;
+}
+
+bool CoapDriver::isConfigured() const {
+    return !context.config.coapServer.isEmpty();
+}
+
+bool CoapDriver::connect() {
+    const ProtocolConfig& config = context.config;
+    context.setState(TYPE, ProtocolState::CONNECTING);
+    
+    IPAddress server;
+    if (!server.fromString(config.coapServer) && !WiFi.hostByName(config.coapServer.c_str(), server)) {
+        context.setState(TYPE, ProtocolState::ERROR);
+        context.setError(TYPE, "Failed to resolve CoAP server " + config.coapServer);
+        return false;
+    }
+    transport.setServer(server, config.coapPort);
+    
+    if (transport.begin(LOCAL_PORT)) {
+        context.setState(TYPE, ProtocolState::CONNECTED);
+        return true;
+    } else {
+        context.setState(TYPE, ProtocolState::ERROR);
+        context.setError(TYPE, "Failed to open CoAP socket");
+        return false;
+    }
+}
+
+void CoapDriver::update() {
+    // Responses, retransmissions and notifications
+    if (context.isConnected(TYPE)) {
+        coap.update();
+    }
+}
+
+bool CoapDriver::publish(const ProtocolMessage& message) {
+    // Confirmable PUT; bodies over one block go out Block1-wise
+    String path = message.topic;
+    uint32_t handle = coap.request(CoapMethod::PUT, path.c_str(), (const uint8_t*)message.payload.c_str(),
+                                   message.payload.length(), coapContentFormat(message.format), true,
+                                   [this, path](uint32_t, const CoapResponse& response) {
+                                       handleResponse(path, response);
+                                   });
+    return handle != 0;
+}
+
+bool CoapDriver::subscribe(const String& topic) {
+    if (!context.isConnected(TYPE)) {
+        return false;
+    }
+    auto existing = observations.find(topic);
+    if (existing != observations.end() && coap.isObserving(existing->second)) {
+        return true;
+    }
+    uint32_t handle = coap.observe(topic.c_str(), [this, topic](uint32_t, const CoapResponse& response) {
+        handleResponse(topic, response);
+    });
+    if (handle == 0) {
+        context.setError(TYPE, "No free exchange to observe " + topic);
+        return false;
+    }
+    observations[topic] = handle;
+    return true;
+}
+
+void CoapDriver::setResponseCallback(void (*callback)(const String&, const CoapResponse&)) {
+    responseCallback = callback;
+}
+
+void CoapDriver::handleResponse(const String& path, const CoapResponse& response) {
+    // Confirmable exchanges finish asynchronously; report failures to the router
+    if (response.status != CoapStatus::RESPONSE || (response.code >> 5) != 2) {
+        context.setError(TYPE, "Request to " + path + " failed, code " +
+                         String(response.code >> 5) + "." + String(response.code & 0x1F));
+        context.router.recordResult(TYPE, false, 0, millis());
+        if (response.status != CoapStatus::RESPONSE) {
+            observations.erase(path);
+            return;
+        }
+    }
+    if (responseCallback) {
+        responseCallback(path, response);
+    }
+    if (response.length > 0 || response.notification) {
+        ProtocolMessage message;
+        message.topic = path;
+        message.payload.concat((const char*)response.payload, response.length);
+        message.protocol = TYPE;
+        message.isResponse = !response.notification;
+        context.deliver(message);
+    }
+}
@@ -0,0 +1,33 @@
+// CoapDriver.h
+#pragma once
+#include <map>
+#include <WiFiUdp.h>
+#include "protocol_context.h"
+#include "coap_engine.h"
+
+class CoapDriver : public ProtocolDriver<ProtocolType::COAP> {
+public:
+    static const uint16_t LOCAL_PORT = 5683;
+
+    explicit CoapDriver(ProtocolContext& context);
+    static const char* name() { return "CoAP"; }
+
+    bool isConfigured() const;
+    bool connect();
+    void update();
+    bool publish(const ProtocolMessage& message);
+    bool subscribe(const String& topic);
+    // Observations stay open for good and are not counted
+    size_t inflight() const;
+
+    void setResponseCallback(void (*callback)(const String&, const CoapResponse&));
+
+private:
+    WiFiUDP udp;
+    UdpCoapTransport transport;
+    CoapEngine coap;
+    std::map<String, uint32_t> observations;
+    void (*responseCallback)(const String&, const CoapResponse&);
+
+    void handleResponse(const String& path, const CoapResponse& response);
+};
@@ -0,0 +1,75 @@
+// HttpDriver.cpp
+#include <HTTPClient.h>
+#include "HttpDriver.h"
+
+template <ProtocolType Type>
+HttpDriver<Type>::HttpDriver(ProtocolContext& context)
+    : ProtocolDriver<Type>(context)
+    , tlsSocket(secureClient)
+{
+}
+
+template <ProtocolType Type>
+bool HttpDriver<Type>::isConfigured() const {
+    const ProtocolConfig& config = this->context.config;
+    return !config.httpServer.isEmpty() && config.useHttps == (Type == ProtocolType::HTTPS);
+}
+
+template <ProtocolType Type>
+bool HttpDriver<Type>::connect() {
+    // HTTP/HTTPS doesn't maintain a persistent connection
+    this->context.setState(Type, ProtocolState::CONNECTED);
+    return true;
+}
+
+template <ProtocolType Type>
+bool HttpDriver<Type>::publish(const ProtocolMessage& message) {
+    const ProtocolConfig& config = this->context.config;
+    bool secure = isSecure();
+    HTTPClient http;
+    String url = (secure ? "https://" : "http://") + config.httpServer + ":" + String(config.httpPort);
+    // MQTT-style topics rerouted to HTTP have no leading slash
+    if (!message.topic.startsWith("/")) {
+        url += "/";
+    }
+    url += message.topic;
+    
+    if (secure) {
+        // Keep the TLS connection between requests; HTTPClient skips its own
+        // connect while the socket is still open
+        if (!this->context.tls.acquire(tlsSocket, config.httpServer.c_str(), config.httpPort)) {
+            this->context.setError(Type, "TLS handshake with " + config.httpServer + " failed");
+            return false;
+        }
+        http.setReuse(true);
+        http.begin(secureClient, url);
+    } else {
+        http.begin(url);
+    }
+    if (!config.httpUsername.isEmpty()) {
+        http.setAuthorization(config.httpUsername.c_str(), config.httpPassword.c_str());
+    }
+    http.addHeader("Content-Type", payloadContentType(message.format));
+
+    const uint8_t* body = (const uint8_t*)message.payload.c_str();
+    size_t length = message.payload.length();
+    size_t compressed = config.httpCompress ? this->context.compress(message.payload, DeflateContainer::GZIP) : 0;
+    if (compressed > 0) {
+        http.addHeader("Content-Encoding", "gzip");
+        body = this->context.compressed();
+        length = compressed;
+    }
+    
+    int httpCode = http.POST((uint8_t*)body, length);
+    http.end();
+    
+    return httpCode == HTTP_CODE_OK;
+}
+
+template <ProtocolType Type>
+bool HttpDriver<Type>::isSecure() const {
+    return Type == ProtocolType::HTTPS || this->context.config.useHttps;
+}
+
+template class HttpDriver<ProtocolType::HTTP>;
+template class HttpDriver<ProtocolType::HTTPS>;
@@ -0,0 +1,23 @@
+// HttpDriver.h
+#pragma once
+#include <WiFiClientSecure.h>
+#include "protocol_context.h"
+
+// One class for both HTTP and HTTPS; "useHttps" in the configuration
+// upgrades plain HTTP traffic as before
+template <ProtocolType Type>
+class HttpDriver : public ProtocolDriver<Type> {
+public:
+    explicit HttpDriver(ProtocolContext& context);
+    static const char* name() { return Type == ProtocolType::HTTPS ? "HTTPS" : "HTTP"; }
+
+    bool isConfigured() const;
+    bool connect();
+    bool publish(const ProtocolMessage& message);
+
+private:
+    WiFiClientSecure secureClient;
+    SecureClientSocket tlsSocket;
+
+    bool isSecure() const;
+};
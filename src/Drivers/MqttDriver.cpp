@@ -0,0 +1,118 @@
+// MqttDriver.cpp
+#include "MqttDriver.h"
+
+MqttDriver::MqttDriver(ProtocolContext& context)
+    : ProtocolDriver(context)
+    , tlsSocket(secureClient)
+    , transport(plainClient, secureClient, tlsSocket, context.tls)
+    , session(transport)
+    , ackedSeen(0)
+    , latencySeen(0)
+    , ackLatencyMs(0)
+{
+}
+
+void MqttDriver::begin() {
+    session.setMessageCallback([this](const char* topic, const uint8_t* payload, size_t length) {
+        ProtocolMessage message;
+        message.topic = String(topic);
+        message.payload.concat((const char*)payload, length);
+        message.protocol = TYPE;
+        message.isResponse = false;
+        context.deliver(message);
+    });
+}
+
+bool MqttDriver::isConfigured() const {
+    return !context.config.mqttBroker.isEmpty();
+}
+
+bool MqttDriver::connect() {
+    const ProtocolConfig& config = context.config;
+    context.setState(TYPE, ProtocolState::CONNECTING);
+    
+    session.setServer(config.mqttBroker.c_str(), config.mqttPort);
+    session.setCredentials(config.mqttClientId.c_str(),
+                           config.mqttUsername.c_str(),
+                           config.mqttPassword.c_str());
+    session.setInflightWindow(config.mqttInflightWindow);
+    session.setRetransmitInterval(config.mqttRetransmitMs);
+    transport.setSecure(config.mqttUseTls);
+    
+    // The CONNACK is handled in update(); clean session stays off so the
+    // broker keeps our QoS 1/2 state across reconnects
+    if (session.connect()) {
+        context.log(TYPE, "Connecting to MQTT broker");
+        return true;
+    } else {
+        context.setState(TYPE, ProtocolState::ERROR);
+        context.setError(TYPE, "Failed to connect to MQTT broker");
+        return false;
+    }
+}
+
+void MqttDriver::reconfigure() {
+    // A smaller window only holds back new publishes until acks catch up
+    session.setInflightWindow(context.config.mqttInflightWindow);
+    session.setRetransmitInterval(context.config.mqttRetransmitMs);
+}
+
+void MqttDriver::disconnect() {
+    session.disconnect();
+    context.setState(TYPE, ProtocolState::DISCONNECTED);
+}
+
+void MqttDriver::update() {
+    // The session reconnects by itself and keeps unacknowledged messages
+    // across reconnects
+    ProtocolState previous = context.getState(TYPE);
+    if (previous != ProtocolState::DISCONNECTED) {
+        session.loop();
+        switch (session.getState()) {
+            case MqttSessionState::CONNECTED:
+                context.setState(TYPE, ProtocolState::CONNECTED);
+                if (previous != ProtocolState::CONNECTED) {
+                    context.clearError(TYPE);
+                    context.log(TYPE, "Connected to MQTT broker, " +
+                                String(session.getInflightCount()) + " messages in flight");
+                }
+                break;
+            case MqttSessionState::CONNECTING:
+                context.setState(TYPE, ProtocolState::CONNECTING);
+                break;
+            case MqttSessionState::DISCONNECTED:
+                context.setState(TYPE, ProtocolState::ERROR);
+                if (previous != ProtocolState::ERROR) {
+                    context.setError(TYPE, session.getLastError().c_str());
+                }
+                break;
+        }
+    }
+
+    // Mean PUBACK/PUBCOMP latency since the last tick
+    const MqttSessionStats& stats = session.getStats();
+    if (stats.acknowledged > ackedSeen) {
+        ackLatencyMs = (uint32_t)((stats.totalAckLatencyMs - latencySeen) / (stats.acknowledged - ackedSeen));
+        ackedSeen = stats.acknowledged;
+        latencySeen = stats.totalAckLatencyMs;
+    }
+}
+
+bool MqttDriver::canSend(const ProtocolMessage& message) const {
+    // A full in-flight window holds messages back until acks arrive
+    return session.canPublish(message.qos);
+}
+
+uint32_t MqttDriver::latencyMs(uint32_t) const {
+    // publish() only queues bytes; the latency comes from broker acks
+    return ackLatencyMs;
+}
+
+bool MqttDriver::publish(const ProtocolMessage& message) {
+    return session.publish(message.topic.c_str(), (const uint8_t*)message.payload.c_str(),
+                           message.payload.length(), message.qos, message.retain);
+}
+
+bool MqttDriver::subscribe(const String& topic) {
+    return session.subscribe(topic.c_str(), 1);
+}
@@ -0,0 +1,38 @@
+// MqttDriver.h
+#pragma once
+#include <WiFiClientSecure.h>
+#include "protocol_context.h"
+#include "mqtt_session.h"
+
+class MqttDriver : public ProtocolDriver<ProtocolType::MQTT> {
+public:
+    explicit MqttDriver(ProtocolContext& context);
+    static const char* name() { return "MQTT"; }
+
+    void begin();
+    bool isConfigured() const;
+    bool connect();
+    void disconnect();
+    void update();
+    // The session notices a dead socket by itself and keeps its messages
+    void linkDown() {}
+    void reconfigure();
+    size_t inflight() const { return session.getInflightCount(); }
+    bool canSend(const ProtocolMessage& message) const;
+    uint32_t latencyMs(uint32_t measuredMs) const;
+    bool publish(const ProtocolMessage& message);
+    bool subscribe(const String& topic);
+
+    MqttSession& getSession() { return session; }
+    const MqttSession& getSession() const { return session; }
+
+private:
+    WiFiClient plainClient;
+    WiFiClientSecure secureClient;
+    SecureClientSocket tlsSocket;
+    TlsMqttTransport transport;
+    MqttSession session;
+    uint32_t ackedSeen;
+    uint64_t latencySeen;
+    uint32_t ackLatencyMs;
+};
@@ -0,0 +1,70 @@
+// RawTcpDriver.cpp
+#include "RawTcpDriver.h"
+
+RawTcpDriver::RawTcpDriver(ProtocolContext& context)
+    : ProtocolDriver(context)
+{
+}
+
+bool RawTcpDriver::isConfigured() const {
+    return context.config.customProtocol == "tcp" && context.config.customConfig.indexOf(':') > 0;
+}
+
+bool RawTcpDriver::connect() {
+    context.setState(TYPE, ProtocolState::CONNECTING);
+
+    String host;
+    uint16_t port;
+    if (context.config.customProtocol != "tcp" || !parseEndpoint(host, port)) {
+        context.setState(TYPE, ProtocolState::ERROR);
+        context.setError(TYPE, "Unsupported custom protocol \"" + context.config.customProtocol + "\"");
+        return false;
+    }
+
+    if (!client.connect(host.c_str(), port)) {
+        context.setState(TYPE, ProtocolState::ERROR);
+        context.setError(TYPE, "Failed to connect to " + context.config.customConfig);
+        return false;
+    }
+    client.setNoDelay(true);
+    context.setState(TYPE, ProtocolState::CONNECTED);
+    context.log(TYPE, "Connected to " + context.config.customConfig);
+    return true;
+}
+
+void RawTcpDriver::disconnect() {
+    client.stop();
+    context.setState(TYPE, ProtocolState::DISCONNECTED);
+}
+
+void RawTcpDriver::update() {
+    if (context.isConnected(TYPE) && !client.connected()) {
+        client.stop();
+        context.setState(TYPE, ProtocolState::ERROR);
+        context.setError(TYPE, "Connection to " + context.config.customConfig + " closed");
+    }
+}
+
+bool RawTcpDriver::publish(const ProtocolMessage& message) {
+    String header = message.topic + " " + String(message.payload.length()) + "\n";
+    size_t frameLength = header.length() + message.payload.length() + 1;
+    size_t written = client.write((const uint8_t*)header.c_str(), header.length());
+    written += client.write((const uint8_t*)message.payload.c_str(), message.payload.length());
+    written += client.write((const uint8_t*)"\n", 1);
+    return written == frameLength;
+}
+
+bool RawTcpDriver::parseEndpoint(String& host, uint16_t& port) const {
+    const String& endpoint = context.config.customConfig;
+    int colon = endpoint.lastIndexOf(':');
+    if (colon <= 0) {
+        return false;
+    }
+    long value = endpoint.substring(colon + 1).toInt();
+    if (value <= 0 || value > 65535) {
+        return false;
+    }
+    host = endpoint.substring(0, colon);
+    port = (uint16_t)value;
+    return true;
+}
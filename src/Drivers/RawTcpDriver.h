@@ -0,0 +1,24 @@
+// RawTcpDriver.h
+#pragma once
+#include <WiFiClient.h>
+#include "protocol_context.h"
+
+// The CUSTOM uplink: customProtocol "tcp" with customConfig "host:port".
+// Each message goes out as "<topic> <length>\n<payload>\n" on one
+// long-lived connection.
+class RawTcpDriver : public ProtocolDriver<ProtocolType::CUSTOM> {
+public:
+    explicit RawTcpDriver(ProtocolContext& context);
+    static const char* name() { return "TCP"; }
+
+    bool isConfigured() const;
+    bool connect();
+    void disconnect();
+    void update();
+    bool publish(const ProtocolMessage& message);
+
+private:
+    WiFiClient client;
+
+    bool parseEndpoint(String& host, uint16_t& port) const;
+};
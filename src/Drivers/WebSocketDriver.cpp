@@ -0,0 +1,117 @@
+// WebSocketDriver.cpp
+#include "WebSocketDriver.h"
+#include <vector>
+
+WebSocketDriver::WebSocketDriver(ProtocolContext& context)
+    : ProtocolDriver(context)
+    , connectStartedAt(0)
+{
+}
+
+void WebSocketDriver::begin() {
+    webSocket.onEvent([this](WStype_t type, uint8_t* payload, size_t length) {
+        handleEvent(type, payload, length);
+    });
+}
+
+bool WebSocketDriver::isConfigured() const {
+    return !context.config.wsServer.isEmpty();
+}
+
+bool WebSocketDriver::connect() {
+    const ProtocolConfig& config = context.config;
+    context.setState(TYPE, ProtocolState::CONNECTING);
+    
+    connectStartedAt = millis();
+    const char* ca = context.tls.credentials().get(TlsCredentialKind::CA);
+    if (config.wsSecure && ca) {
+        webSocket.beginSslWithCA(config.wsServer.c_str(), config.wsPort, config.wsPath.c_str(), ca, subprotocol());
+    } else if (config.wsSecure) {
+        webSocket.beginSSL(config.wsServer.c_str(), config.wsPort, config.wsPath.c_str(), "", subprotocol());
+    } else {
+        webSocket.begin(config.wsServer.c_str(), config.wsPort, config.wsPath.c_str(), subprotocol());
+    }
+    
+    begin();
+    
+    context.setState(TYPE, ProtocolState::CONNECTED);
+    return true;
+}
+
+void WebSocketDriver::disconnect() {
+    webSocket.disconnect();
+    context.setState(TYPE, ProtocolState::DISCONNECTED);
+}
+
+void WebSocketDriver::update() {
+    if (context.isConnected(TYPE)) {
+        webSocket.loop();
+    }
+}
+
+bool WebSocketDriver::publish(const ProtocolMessage& message) {
+    if (context.config.wsCompress) {
+        return publishFramed(message);
+    }
+    if (isBinaryPayload(message.format)) {
+        return webSocket.sendBIN((const uint8_t*)message.payload.c_str(), message.payload.length());
+    }
+    // Create a non-const copy of the payload for WebSocket
+    String payloadCopy = message.payload;
+    return webSocket.sendTXT(payloadCopy);
+}
+
+bool WebSocketDriver::publishFramed(const ProtocolMessage& message) {
+    uint8_t flags = FRAME_VERSION | (isBinaryPayload(message.format) ? FRAME_BINARY : 0);
+    size_t length = context.compress(message.payload, DeflateContainer::RAW, 1);
+    if (length > 0) {
+        // The compressor left the first byte free for the flags
+        uint8_t* frame = context.compressed();
+        frame[0] = flags | FRAME_DEFLATE;
+        return webSocket.sendBIN(frame, length + 1);
+    }
+    std::vector<uint8_t> frame(message.payload.length() + 1);
+    frame[0] = flags;
+    memcpy(frame.data() + 1, message.payload.c_str(), message.payload.length());
+    return webSocket.sendBIN(frame.data(), frame.size());
+}
+
+const char* WebSocketDriver::subprotocol() const {
+    // The library's default
+    return context.config.wsCompress ? "cerise.deflate" : "arduino";
+}
+
+void WebSocketDriver::setEventCallback(void (*callback)(WStype_t, uint8_t*, size_t)) {
+    webSocket.onEvent(callback);
+}
+
+void WebSocketDriver::handleEvent(WStype_t type, uint8_t* payload, size_t length) {
+    const ProtocolConfig& config = context.config;
+    switch (type) {
+        case WStype_DISCONNECTED:
+            context.setState(TYPE, ProtocolState::DISCONNECTED);
+            // The library reconnects on its own; time the next handshake from here
+            connectStartedAt = millis();
+            break;
+            
+        case WStype_CONNECTED:
+            context.setState(TYPE, ProtocolState::CONNECTED);
+            if (config.wsSecure) {
+                context.tls.recordHandshake(config.wsServer.c_str(), config.wsPort, millis() - connectStartedAt, true);
+            }
+            break;
+            
+        case WStype_TEXT: {
+            ProtocolMessage message;
+            message.topic = "websocket";
+            message.payload = String((char*)payload);
+            message.protocol = TYPE;
+            message.isResponse = false;
+            context.deliver(message);
+            break;
+        }
+            
+        default:
+            break;
+    }
+}
@@ -0,0 +1,36 @@
+// WebSocketDriver.h
+#pragma once
+#include <WebSocketsClient.h>
+#include "protocol_context.h"
+
+// With wsCompress every message is a binary frame: one flags byte, then
+// the payload, as raw deflate when FRAME_DEFLATE is set. The library has no
+// permessage-deflate, so the server opts in through the subprotocol.
+class WebSocketDriver : public ProtocolDriver<ProtocolType::WEBSOCKET> {
+public:
+    static const uint8_t FRAME_VERSION = 0x80;
+    static const uint8_t FRAME_DEFLATE = 0x01;
+    static const uint8_t FRAME_BINARY = 0x02;
+
+    explicit WebSocketDriver(ProtocolContext& context);
+    static const char* name() { return "WebSocket"; }
+
+    void begin();
+    bool isConfigured() const;
+    bool connect();
+    void disconnect();
+    void update();
+    bool publish(const ProtocolMessage& message);
+    // WebSocket doesn't have a subscription mechanism
+    bool subscribe(const String&) { return true; }
+
+    void setEventCallback(void (*callback)(WStype_t, uint8_t*, size_t));
+
+private:
+    WebSocketsClient webSocket;
+    uint32_t connectStartedAt;
+
+    void handleEvent(WStype_t type, uint8_t* payload, size_t length);
+    bool publishFramed(const ProtocolMessage& message);
+    const char* subprotocol() const;
+};
@@ -0,0 +1,350 @@
+#include "boot_orchestrator.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+static uint32_t bootClock() {
+#ifdef ARDUINO
+    return millis();
+#else
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static const char* roleName(BootRole role) {
+    switch (role) {
+        case BootRole::NONE: return "none";
+        case BootRole::SOURCE: return "source";
+        case BootRole::UPLINK: return "uplink";
+    }
+    return "none";
+}
+
+static const char* stateName(BootStageState state) {
+    switch (state) {
+        case BootStageState::WAITING: return "waiting";
+        case BootStageState::STARTING: return "starting";
+        case BootStageState::READY: return "ready";
+        case BootStageState::FAILED: return "failed";
+        case BootStageState::SKIPPED: return "skipped";
+    }
+    return "unknown";
+}
+
+static bool isFinished(BootStageState state) {
+    return state == BootStageState::READY || state == BootStageState::FAILED || state == BootStageState::SKIPPED;
+}
+
+BootOrchestrator::BootOrchestrator()
+    : clock(bootClock)
+    , logCallback(nullptr)
+    , stageCount(0)
+    , started(false)
+    , beganAt(0)
+    , forwardingReadyAt(NOT_YET)
+    , completedAt(NOT_YET)
+{
+    for (size_t i = 0; i < MAX_STAGES; i++) {
+        stages[i].name = "";
+        stages[i].role = BootRole::NONE;
+        stages[i].timeoutMs = NO_TIMEOUT;
+        stages[i].dependencyCount = 0;
+        stages[i].state = BootStageState::WAITING;
+        stages[i].signal = SIGNAL_NONE;
+        stages[i].signalledAt = 0;
+        stages[i].startedAt = 0;
+        stages[i].finishedAt = 0;
+    }
+}
+
+void BootOrchestrator::setClock(uint32_t (*newClock)()) {
+    clock = newClock;
+}
+
+void BootOrchestrator::setLogCallback(std::function<void(const char* line)> callback) {
+    logCallback = callback;
+}
+
+int BootOrchestrator::addStage(const char* name, BootRole role, StartFunction start, uint32_t timeoutMs) {
+    if (stageCount == MAX_STAGES || !name || completedAt.load() != NOT_YET) {
+        return -1;
+    }
+    Stage& stage = stages[stageCount];
+    stage.name = name;
+    stage.role = role;
+    stage.start = start;
+    stage.timeoutMs = timeoutMs;
+    stage.dependencyCount = 0;
+    stage.state = BootStageState::WAITING;
+    stage.signal = SIGNAL_NONE;
+    return (int)stageCount++;
+}
+
+bool BootOrchestrator::addDependency(int stage, int dependsOn) {
+    if (stage < 0 || (size_t)stage >= stageCount || dependsOn < 0 || dependsOn >= stage) {
+        return false;
+    }
+    Stage& dependent = stages[stage];
+    if (dependent.state != BootStageState::WAITING || dependent.dependencyCount == MAX_DEPENDENCIES) {
+        return false;
+    }
+    dependent.dependencies[dependent.dependencyCount++] = (uint8_t)dependsOn;
+    return true;
+}
+
+int BootOrchestrator::findStage(const char* name) const {
+    for (size_t i = 0; i < stageCount; i++) {
+        if (strcmp(stages[i].name, name) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+void BootOrchestrator::begin() {
+    beganAt = clock();
+    started = true;
+}
+
+void BootOrchestrator::update() {
+    if (!started || completedAt.load() != NOT_YET) {
+        return;
+    }
+    uint32_t now = clock();
+    collectSignals();
+    for (size_t i = 0; i < stageCount; i++) {
+        Stage& stage = stages[i];
+        if (stage.state == BootStageState::STARTING && stage.timeoutMs != NO_TIMEOUT
+            && now - stage.startedAt >= stage.timeoutMs) {
+            emitLog("%s timed out after %u ms", stage.name, (unsigned)stage.timeoutMs);
+            finish(stage, BootStageState::FAILED, now);
+        }
+    }
+    // Inline stages finish as they start, which may release their dependents
+    while (startReadyStages(now)) {
+        now = clock();
+    }
+    checkMilestones(clock());
+}
+
+void BootOrchestrator::markReady(int stage) {
+    if (stage < 0 || (size_t)stage >= stageCount) {
+        return;
+    }
+    stages[stage].signalledAt = clock();
+    stages[stage].signal = SIGNAL_READY;
+}
+
+void BootOrchestrator::markFailed(int stage) {
+    if (stage < 0 || (size_t)stage >= stageCount) {
+        return;
+    }
+    stages[stage].signalledAt = clock();
+    stages[stage].signal = SIGNAL_FAILED;
+}
+
+BootStageState BootOrchestrator::getState(int stage) const {
+    if (stage < 0 || (size_t)stage >= stageCount) {
+        return BootStageState::SKIPPED;
+    }
+    return stages[stage].state.load();
+}
+
+bool BootOrchestrator::isReady(int stage) const {
+    return getState(stage) == BootStageState::READY;
+}
+
+bool BootOrchestrator::isSettled(int stage) const {
+    return isFinished(getState(stage));
+}
+
+bool BootOrchestrator::isForwardingReady() const {
+    bool source = false;
+    bool uplink = false;
+    for (size_t i = 0; i < stageCount; i++) {
+        if (stages[i].state.load() != BootStageState::READY) {
+            continue;
+        }
+        source = source || stages[i].role == BootRole::SOURCE;
+        uplink = uplink || stages[i].role == BootRole::UPLINK;
+    }
+    return source && uplink;
+}
+
+bool BootOrchestrator::isComplete() const {
+    return completedAt.load() != NOT_YET;
+}
+
+uint32_t BootOrchestrator::getForwardingReadyAt() const {
+    return forwardingReadyAt.load();
+}
+
+uint32_t BootOrchestrator::getCompletedAt() const {
+    return completedAt.load();
+}
+
+size_t BootOrchestrator::getStageCount() const {
+    return stageCount;
+}
+
+bool BootOrchestrator::getStage(size_t index, BootStageRecord& record) const {
+    if (index >= stageCount) {
+        return false;
+    }
+    const Stage& stage = stages[index];
+    record.name = stage.name;
+    record.role = stage.role;
+    record.state = stage.state.load();
+    record.startedAtMs = record.state == BootStageState::WAITING ? NOT_YET : stage.startedAt - beganAt;
+    record.finishedAtMs = isFinished(record.state) ? stage.finishedAt - beganAt : NOT_YET;
+    return true;
+}
+
+std::string BootOrchestrator::exportTimeline() const {
+    char buffer[96];
+    std::string json = "{";
+    uint32_t forwarding = forwardingReadyAt.load();
+    uint32_t complete = completedAt.load();
+    if (forwarding == NOT_YET) {
+        json += "\"forwardingMs\":null,";
+    } else {
+        snprintf(buffer, sizeof(buffer), "\"forwardingMs\":%u,", (unsigned)forwarding);
+        json += buffer;
+    }
+    if (complete == NOT_YET) {
+        json += "\"completeMs\":null,";
+    } else {
+        snprintf(buffer, sizeof(buffer), "\"completeMs\":%u,", (unsigned)complete);
+        json += buffer;
+    }
+    json += "\"stages\":[";
+    BootStageRecord record;
+    for (size_t i = 0; i < stageCount; i++) {
+        getStage(i, record);
+        snprintf(buffer, sizeof(buffer), "%s{\"name\":\"", i > 0 ? "," : "");
+        json += buffer;
+        json += record.name;
+        snprintf(buffer, sizeof(buffer), "\",\"role\":\"%s\",\"state\":\"%s\"", roleName(record.role),
+                 stateName(record.state));
+        json += buffer;
+        if (record.startedAtMs != NOT_YET) {
+            snprintf(buffer, sizeof(buffer), ",\"startMs\":%u", (unsigned)record.startedAtMs);
+            json += buffer;
+        }
+        if (record.startedAtMs != NOT_YET && record.finishedAtMs != NOT_YET) {
+            snprintf(buffer, sizeof(buffer), ",\"endMs\":%u,\"durationMs\":%u", (unsigned)record.finishedAtMs,
+                     (unsigned)(record.finishedAtMs - record.startedAtMs));
+            json += buffer;
+        }
+        json += ",\"after\":[";
+        for (uint8_t d = 0; d < stages[i].dependencyCount; d++) {
+            json += d > 0 ? ",\"" : "\"";
+            json += stages[stages[i].dependencies[d]].name;
+            json += "\"";
+        }
+        json += "]}";
+    }
+    json += "]}";
+    return json;
+}
+
+bool BootOrchestrator::startReadyStages(uint32_t now) {
+    bool progressed = false;
+    for (size_t i = 0; i < stageCount; i++) {
+        Stage& stage = stages[i];
+        if (stage.state != BootStageState::WAITING) {
+            continue;
+        }
+        bool blocked = false;
+        bool broken = false;
+        for (uint8_t d = 0; d < stage.dependencyCount; d++) {
+            BootStageState dependency = stages[stage.dependencies[d]].state.load();
+            broken = broken || dependency == BootStageState::FAILED || dependency == BootStageState::SKIPPED;
+            blocked = blocked || dependency != BootStageState::READY;
+        }
+        if (broken) {
+            stage.startedAt = now;
+            finish(stage, BootStageState::SKIPPED, now);
+            progressed = true;
+            continue;
+        }
+        if (blocked) {
+            continue;
+        }
+
+        stage.signal = SIGNAL_NONE;
+        stage.startedAt = clock();
+        stage.state = BootStageState::STARTING;
+        BootStartResult result = stage.start ? stage.start() : BootStartResult::READY;
+        if (result == BootStartResult::READY) {
+            finish(stage, BootStageState::READY, clock());
+        } else if (result == BootStartResult::FAILED) {
+            finish(stage, BootStageState::FAILED, clock());
+        }
+        progressed = true;
+    }
+    return progressed;
+}
+
+void BootOrchestrator::collectSignals() {
+    for (size_t i = 0; i < stageCount; i++) {
+        Stage& stage = stages[i];
+        if (stage.state != BootStageState::STARTING) {
+            continue;
+        }
+        uint8_t signal = stage.signal.exchange(SIGNAL_NONE);
+        if (signal == SIGNAL_NONE) {
+            continue;
+        }
+        // A signal stamped before the start belongs to an earlier run
+        uint32_t at = stage.signalledAt.load();
+        if (at - stage.startedAt > 0x7FFFFFFF) {
+            at = stage.startedAt;
+        }
+        finish(stage, signal == SIGNAL_READY ? BootStageState::READY : BootStageState::FAILED, at);
+    }
+}
+
+void BootOrchestrator::finish(Stage& stage, BootStageState state, uint32_t at) {
+    stage.finishedAt = at;
+    stage.state = state;
+    if (state == BootStageState::SKIPPED) {
+        emitLog("%s skipped: a dependency failed", stage.name);
+    } else {
+        emitLog("%s %s at %u ms (%u ms)", stage.name, stateName(state), (unsigned)(at - beganAt),
+                (unsigned)(at - stage.startedAt));
+    }
+}
+
+void BootOrchestrator::checkMilestones(uint32_t now) {
+    if (forwardingReadyAt.load() == NOT_YET && isForwardingReady()) {
+        forwardingReadyAt = now - beganAt;
+        emitLog("forwarding ready at %u ms", (unsigned)(now - beganAt));
+    }
+    for (size_t i = 0; i < stageCount; i++) {
+        if (!isFinished(stages[i].state.load())) {
+            return;
+        }
+    }
+    completedAt = now - beganAt;
+    emitLog("boot complete at %u ms", (unsigned)(now - beganAt));
+}
+
+void BootOrchestrator::emitLog(const char* format, ...) {
+    if (!logCallback) {
+        return;
+    }
+    char line[128];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    logCallback(line);
+}
@@ -0,0 +1,682 @@
+#include "coap_engine.h"
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+static uint32_t defaultClock() {
+#ifdef ARDUINO
+    return millis();
+#else
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+#ifdef ARDUINO
+bool UdpCoapTransport::begin(uint16_t localPort) {
+    return udp.begin(localPort) == 1;
+}
+
+void UdpCoapTransport::setServer(const IPAddress& address, uint16_t port) {
+    serverAddress = address;
+    serverPort = port;
+}
+
+bool UdpCoapTransport::send(const uint8_t* data, size_t length) {
+    if (!udp.beginPacket(serverAddress, serverPort)) {
+        return false;
+    }
+    udp.write(data, length);
+    return udp.endPacket() == 1;
+}
+
+int UdpCoapTransport::receive(uint8_t* data, size_t capacity) {
+    int size = udp.parsePacket();
+    if (size <= 0) {
+        return 0;
+    }
+    // Datagrams from other peers are not ours
+    if (udp.remoteIP() != serverAddress || udp.remotePort() != serverPort) {
+        udp.flush();
+        return 0;
+    }
+    return udp.read(data, capacity);
+}
+#endif
+
+// CoapMessage
+const CoapOption* CoapMessage::find(uint16_t number) const {
+    for (size_t i = 0; i < optionCount; i++) {
+        if (options[i].number == number) {
+            return &options[i];
+        }
+    }
+    return nullptr;
+}
+
+bool CoapMessage::getUint(uint16_t number, uint32_t& value) const {
+    const CoapOption* option = find(number);
+    if (option == nullptr || option->length > 4) {
+        return false;
+    }
+    value = 0;
+    for (uint16_t i = 0; i < option->length; i++) {
+        value = (value << 8) | option->value[i];
+    }
+    return true;
+}
+
+static bool readExtended(uint8_t nibble, const uint8_t*& cursor, const uint8_t* end, uint32_t& value) {
+    if (nibble < 13) {
+        value = nibble;
+    } else if (nibble == 13) {
+        if (cursor + 1 > end) {
+            return false;
+        }
+        value = 13 + cursor[0];
+        cursor += 1;
+    } else if (nibble == 14) {
+        if (cursor + 2 > end) {
+            return false;
+        }
+        value = 269 + ((cursor[0] << 8) | cursor[1]);
+        cursor += 2;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool coapParse(const uint8_t* data, size_t length, CoapMessage& message) {
+    if (length < 4 || (data[0] >> 6) != 1) {
+        return false;
+    }
+    message.type = static_cast<CoapType>((data[0] >> 4) & 0x03);
+    message.tokenLength = data[0] & 0x0F;
+    message.code = data[1];
+    message.messageId = (uint16_t)((data[2] << 8) | data[3]);
+    if (message.tokenLength > 8 || 4u + message.tokenLength > length) {
+        return false;
+    }
+    memcpy(message.token, data + 4, message.tokenLength);
+
+    const uint8_t* cursor = data + 4 + message.tokenLength;
+    const uint8_t* end = data + length;
+    uint32_t number = 0;
+    message.optionCount = 0;
+    message.payload = nullptr;
+    message.payloadLength = 0;
+
+    while (cursor < end) {
+        uint8_t byte = *cursor++;
+        if (byte == 0xFF) {
+            if (cursor == end) {
+                return false; // marker without payload
+            }
+            message.payload = cursor;
+            message.payloadLength = end - cursor;
+            return true;
+        }
+        uint32_t delta;
+        uint32_t optionLength;
+        if (!readExtended(byte >> 4, cursor, end, delta) || !readExtended(byte & 0x0F, cursor, end, optionLength)) {
+            return false;
+        }
+        if (cursor + optionLength > end) {
+            return false;
+        }
+        number += delta;
+        if (message.optionCount < CoapMessage::MAX_OPTIONS) {
+            CoapOption& option = message.options[message.optionCount++];
+            option.number = (uint16_t)number;
+            option.value = cursor;
+            option.length = (uint16_t)optionLength;
+        }
+        cursor += optionLength;
+    }
+    return true;
+}
+
+// CoapWriter
+CoapWriter::CoapWriter(uint8_t* out, size_t capacity)
+    : out(out)
+    , capacity(capacity)
+    , used(0)
+    , lastOption(0)
+    , overflow(false)
+{
+}
+
+void CoapWriter::put(uint8_t byte) {
+    if (used < capacity) {
+        out[used++] = byte;
+    } else {
+        overflow = true;
+    }
+}
+
+void CoapWriter::put(const uint8_t* data, size_t length) {
+    if (length > capacity - used) {
+        overflow = true;
+        return;
+    }
+    memcpy(out + used, data, length);
+    used += length;
+}
+
+void CoapWriter::header(CoapType type, uint8_t code, uint16_t messageId, const uint8_t* token, uint8_t tokenLength) {
+    used = 0;
+    lastOption = 0;
+    overflow = false;
+    put(0x40 | ((uint8_t)type << 4) | (tokenLength & 0x0F));
+    put(code);
+    put((uint8_t)(messageId >> 8));
+    put((uint8_t)messageId);
+    put(token, tokenLength);
+}
+
+static uint8_t extendedNibble(uint32_t value) {
+    return value < 13 ? value : (value < 269 ? 13 : 14);
+}
+
+void CoapWriter::option(uint16_t number, const uint8_t* value, size_t length) {
+    uint32_t delta = number - lastOption;
+    lastOption = number;
+    uint8_t deltaNibble = extendedNibble(delta);
+    uint8_t lengthNibble = extendedNibble(length);
+    put((deltaNibble << 4) | lengthNibble);
+
+    uint32_t fields[2] = {delta, (uint32_t)length};
+    uint8_t nibbles[2] = {deltaNibble, lengthNibble};
+    for (int i = 0; i < 2; i++) {
+        if (nibbles[i] == 13) {
+            put((uint8_t)(fields[i] - 13));
+        } else if (nibbles[i] == 14) {
+            put((uint8_t)((fields[i] - 269) >> 8));
+            put((uint8_t)(fields[i] - 269));
+        }
+    }
+    put(value, length);
+}
+
+void CoapWriter::optionUint(uint16_t number, uint32_t value) {
+    uint8_t bytes[4];
+    size_t length = 0;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        uint8_t byte = (uint8_t)(value >> shift);
+        if (byte != 0 || length > 0) {
+            bytes[length++] = byte;
+        }
+    }
+    option(number, bytes, length);
+}
+
+void CoapWriter::uriPath(const char* path) {
+    while (*path) {
+        while (*path == '/') {
+            path++;
+        }
+        const char* segment = path;
+        while (*path && *path != '/') {
+            path++;
+        }
+        if (path > segment) {
+            option(CoapOptionNumber::URI_PATH, (const uint8_t*)segment, path - segment);
+        }
+    }
+}
+
+void CoapWriter::payload(const uint8_t* data, size_t length) {
+    if (length > 0) {
+        put(0xFF);
+        put(data, length);
+    }
+}
+
+size_t CoapWriter::length() const {
+    return used;
+}
+
+bool CoapWriter::overflowed() const {
+    return overflow;
+}
+
+// CoapEngine
+CoapEngine::CoapEngine(CoapTransport& transport)
+    : transport(transport)
+    , clock(defaultClock)
+    , rngState(0x2545F491)
+    , blockSzx(4)
+    , ackTimeoutMs(ACK_TIMEOUT_MS)
+    , nextMessageId(0)
+    , nextHandle(0)
+    , recentCount(0)
+    , stats()
+{
+    for (size_t i = 0; i < MAX_EXCHANGES; i++) {
+        exchanges[i].active = false;
+    }
+    setSeed(defaultClock());
+}
+
+void CoapEngine::setClock(uint32_t (*newClock)()) {
+    clock = newClock;
+}
+
+void CoapEngine::setSeed(uint32_t seed) {
+    // Message IDs and tokens start at random points (RFC 7252 4.4, 5.3.1)
+    rngState = seed != 0 ? seed : 0x2545F491;
+    nextMessageId = (uint16_t)nextRandom();
+    nextHandle = nextRandom() | 1;
+}
+
+bool CoapEngine::setBlockSize(size_t size) {
+    for (uint8_t szx = 0; szx <= 6; szx++) {
+        if (blockSize(szx) == size) {
+            blockSzx = szx;
+            return true;
+        }
+    }
+    return false;
+}
+
+void CoapEngine::setAckTimeout(uint32_t ms) {
+    ackTimeoutMs = ms;
+}
+
+uint32_t CoapEngine::request(CoapMethod method, const char* path, const uint8_t* payload, size_t length,
+                             int contentFormat, bool confirmable, CoapCallback callback) {
+    if (length > MAX_BODY_SIZE) {
+        return 0;
+    }
+    Exchange* exchange = allocate();
+    if (exchange == nullptr) {
+        return 0;
+    }
+    exchange->method = method;
+    exchange->path = path;
+    exchange->contentFormat = contentFormat;
+    exchange->confirmable = confirmable;
+    exchange->body.assign(payload, payload + length);
+    exchange->callback = callback;
+    stats.requests++;
+    if (!sendExchange(*exchange)) {
+        exchange->active = false;
+        return 0;
+    }
+    return exchange->handle;
+}
+
+uint32_t CoapEngine::observe(const char* path, CoapCallback callback) {
+    Exchange* exchange = allocate();
+    if (exchange == nullptr) {
+        return 0;
+    }
+    exchange->method = CoapMethod::GET;
+    exchange->path = path;
+    exchange->observe = true;
+    exchange->confirmable = true;
+    exchange->callback = callback;
+    stats.requests++;
+    if (!sendExchange(*exchange)) {
+        exchange->active = false;
+        return 0;
+    }
+    return exchange->handle;
+}
+
+bool CoapEngine::cancel(uint32_t handle) {
+    Exchange* exchange = findByHandle(handle);
+    if (exchange == nullptr) {
+        return false;
+    }
+    exchange->callback = nullptr;
+    if (!exchange->observe) {
+        exchange->active = false;
+        return true;
+    }
+    // Deregister explicitly (GET with Observe: 1) instead of waiting for the
+    // next notification to reset
+    exchange->observe = false;
+    exchange->cancelling = true;
+    exchange->hasObserveSequence = false;
+    exchange->block2Num = 0;
+    exchange->response.clear();
+    sendExchange(*exchange);
+    return true;
+}
+
+void CoapEngine::update() {
+    int length;
+    while ((length = transport.receive(rxBuffer, sizeof(rxBuffer))) > 0) {
+        CoapMessage message;
+        if (coapParse(rxBuffer, length, message)) {
+            handleMessage(message);
+        }
+    }
+
+    uint32_t now = clock();
+    for (size_t i = 0; i < MAX_EXCHANGES; i++) {
+        Exchange& exchange = exchanges[i];
+        if (!exchange.active) {
+            continue;
+        }
+        if (exchange.awaitingAck) {
+            if (now - exchange.sentAt < exchange.timeoutMs) {
+                continue;
+            }
+            if (exchange.retransmits >= MAX_RETRANSMIT) {
+                stats.timeouts++;
+                complete(exchange, CoapStatus::TIMEOUT, 0, nullptr, 0);
+                continue;
+            }
+            exchange.retransmits++;
+            exchange.timeoutMs *= 2;
+            exchange.sentAt = now;
+            stats.retransmits++;
+            stats.datagramsSent++;
+            transport.send(exchange.datagram.data(), exchange.datagram.size());
+        } else if (!(exchange.observe && exchange.hasObserveSequence) && (int32_t)(now - exchange.deadline) >= 0) {
+            stats.timeouts++;
+            complete(exchange, CoapStatus::TIMEOUT, 0, nullptr, 0);
+        }
+    }
+}
+
+size_t CoapEngine::getActiveCount() const {
+    size_t count = 0;
+    for (size_t i = 0; i < MAX_EXCHANGES; i++) {
+        if (exchanges[i].active) {
+            count++;
+        }
+    }
+    return count;
+}
+
+bool CoapEngine::isObserving(uint32_t handle) const {
+    for (size_t i = 0; i < MAX_EXCHANGES; i++) {
+        if (exchanges[i].active && exchanges[i].handle == handle) {
+            return exchanges[i].observe && exchanges[i].hasObserveSequence;
+        }
+    }
+    return false;
+}
+
+const CoapStats& CoapEngine::getStats() const {
+    return stats;
+}
+
+// Private methods
+CoapEngine::Exchange* CoapEngine::allocate() {
+    for (size_t i = 0; i < MAX_EXCHANGES; i++) {
+        Exchange& exchange = exchanges[i];
+        if (exchange.active) {
+            continue;
+        }
+        exchange.active = true;
+        exchange.observe = false;
+        exchange.cancelling = false;
+        exchange.awaitingAck = false;
+        exchange.handle = nextHandle++;
+        if (nextHandle == 0) {
+            nextHandle = 1;
+        }
+        exchange.contentFormat = -1;
+        exchange.body.clear();
+        exchange.response.clear();
+        exchange.block1Num = 0;
+        exchange.block2Num = 0;
+        exchange.block2Szx = blockSzx;
+        exchange.hasObserveSequence = false;
+        exchange.observeSequence = 0;
+        exchange.lastNotificationAt = 0;
+        return &exchange;
+    }
+    return nullptr;
+}
+
+CoapEngine::Exchange* CoapEngine::findByHandle(uint32_t handle) {
+    for (size_t i = 0; i < MAX_EXCHANGES; i++) {
+        if (exchanges[i].active && exchanges[i].handle == handle) {
+            return &exchanges[i];
+        }
+    }
+    return nullptr;
+}
+
+CoapEngine::Exchange* CoapEngine::findByToken(const CoapMessage& message) {
+    if (message.tokenLength != 4) {
+        return nullptr;
+    }
+    uint32_t handle = ((uint32_t)message.token[0] << 24) | ((uint32_t)message.token[1] << 16) |
+                      ((uint32_t)message.token[2] << 8) | message.token[3];
+    return findByHandle(handle);
+}
+
+CoapEngine::Exchange* CoapEngine::findByMessageId(uint16_t messageId) {
+    for (size_t i = 0; i < MAX_EXCHANGES; i++) {
+        if (exchanges[i].active && exchanges[i].awaitingAck && exchanges[i].messageId == messageId) {
+            return &exchanges[i];
+        }
+    }
+    return nullptr;
+}
+
+bool CoapEngine::sendExchange(Exchange& exchange) {
+    uint8_t token[4] = {(uint8_t)(exchange.handle >> 24), (uint8_t)(exchange.handle >> 16),
+                        (uint8_t)(exchange.handle >> 8), (uint8_t)exchange.handle};
+    uint8_t datagram[MAX_DATAGRAM_SIZE];
+    CoapWriter writer(datagram, sizeof(datagram));
+    uint32_t now = clock();
+
+    exchange.messageId = nextMessageId++;
+    writer.header(exchange.confirmable ? CoapType::CON : CoapType::NON, (uint8_t)exchange.method,
+                  exchange.messageId, token, sizeof(token));
+
+    bool firstBlock2 = exchange.block2Num == 0;
+    if (firstBlock2 && (exchange.observe || exchange.cancelling)) {
+        writer.optionUint(CoapOptionNumber::OBSERVE, exchange.cancelling ? 1 : 0);
+    }
+    writer.uriPath(exchange.path.c_str());
+
+    // The request body only travels until the first Block2 follow-up
+    const uint8_t* payload = nullptr;
+    size_t payloadLength = 0;
+    bool blockwise = false;
+    if (firstBlock2 && !exchange.body.empty()) {
+        size_t size = blockSize(blockSzx);
+        blockwise = exchange.body.size() > size;
+        size_t offset = blockwise ? exchange.block1Num * size : 0;
+        payload = exchange.body.data() + offset;
+        payloadLength = exchange.body.size() - offset;
+        if (blockwise && payloadLength > size) {
+            payloadLength = size;
+        }
+        if (exchange.contentFormat >= 0) {
+            writer.optionUint(CoapOptionNumber::CONTENT_FORMAT, (uint32_t)exchange.contentFormat);
+        }
+    }
+    if (!firstBlock2) {
+        writer.optionUint(CoapOptionNumber::BLOCK2, (exchange.block2Num << 4) | exchange.block2Szx);
+    }
+    if (blockwise) {
+        bool more = (exchange.block1Num + 1) * blockSize(blockSzx) < exchange.body.size();
+        writer.optionUint(CoapOptionNumber::BLOCK1, (exchange.block1Num << 4) | (more ? 0x08 : 0) | blockSzx);
+        stats.blocksSent++;
+    }
+    writer.payload(payload, payloadLength);
+    if (writer.overflowed()) {
+        return false;
+    }
+
+    exchange.datagram.assign(datagram, datagram + writer.length());
+    exchange.awaitingAck = exchange.confirmable;
+    exchange.retransmits = 0;
+    // Initial timeout is randomized in [ACK_TIMEOUT, 1.5 * ACK_TIMEOUT)
+    exchange.timeoutMs = ackTimeoutMs + nextRandom() % (ackTimeoutMs / 2 + 1);
+    exchange.sentAt = now;
+    exchange.deadline = now + RESPONSE_TIMEOUT_MS;
+    stats.datagramsSent++;
+    return transport.send(exchange.datagram.data(), exchange.datagram.size());
+}
+
+void CoapEngine::handleMessage(const CoapMessage& message) {
+    if (message.type == CoapType::ACK || message.type == CoapType::RST) {
+        Exchange* exchange = findByMessageId(message.messageId);
+        if (exchange == nullptr) {
+            return;
+        }
+        if (message.type == CoapType::RST) {
+            complete(*exchange, CoapStatus::RESET, 0, nullptr, 0);
+            return;
+        }
+        exchange->awaitingAck = false;
+        if (message.code == CoapCode::EMPTY) {
+            // Separate response follows; wait for it without retransmitting
+            exchange->deadline = clock() + RESPONSE_TIMEOUT_MS;
+            return;
+        }
+        if (findByToken(message) == exchange) {
+            handleResponse(*exchange, message);
+        }
+        return;
+    }
+
+    // CON/NON from the server: separate responses and notifications
+    bool confirmable = message.type == CoapType::CON;
+    if ((message.code >> 5) == 0) {
+        // Requests to this client are not served
+        if (confirmable) {
+            sendEmpty(CoapType::RST, message.messageId);
+        }
+        return;
+    }
+    Exchange* exchange = findByToken(message);
+    if (exchange == nullptr) {
+        // Unknown token, e.g. a cancelled observation: tell the server to stop
+        sendEmpty(CoapType::RST, message.messageId);
+        return;
+    }
+    if (confirmable) {
+        sendEmpty(CoapType::ACK, message.messageId);
+    }
+    if (seenRecently(message.messageId)) {
+        stats.duplicates++;
+        return;
+    }
+    exchange->awaitingAck = false;
+    handleResponse(*exchange, message);
+}
+
+void CoapEngine::handleResponse(Exchange& exchange, const CoapMessage& message) {
+    uint32_t now = clock();
+    uint32_t option;
+
+    // Block1: server asks for the next request block
+    if (message.code == CoapCode::CONTINUE && message.getUint(CoapOptionNumber::BLOCK1, option)) {
+        exchange.block1Num = (option >> 4) + 1;
+        if (exchange.block1Num * blockSize(blockSzx) < exchange.body.size()) {
+            sendExchange(exchange);
+            return;
+        }
+    }
+
+    // Observe: drop notifications older than the last one (RFC 7641 3.4)
+    if (exchange.observe && message.getUint(CoapOptionNumber::OBSERVE, option)) {
+        if (exchange.hasObserveSequence) {
+            uint32_t last = exchange.observeSequence;
+            bool newer = (last < option && option - last < (1UL << 23)) ||
+                         (last > option && last - option > (1UL << 23)) ||
+                         now - exchange.lastNotificationAt > 128000;
+            if (!newer) {
+                stats.duplicates++;
+                return;
+            }
+        }
+        exchange.hasObserveSequence = true;
+        exchange.observeSequence = option;
+        exchange.lastNotificationAt = now;
+        exchange.block2Num = 0;
+        exchange.response.clear();
+    }
+
+    // Block2: collect the response body block by block
+    if (message.getUint(CoapOptionNumber::BLOCK2, option)) {
+        uint32_t num = option >> 4;
+        uint8_t szx = option & 0x07;
+        if (num * blockSize(szx) != exchange.response.size()) {
+            return; // out of order; the pending request will be retried
+        }
+        if (exchange.response.size() + message.payloadLength > MAX_BODY_SIZE) {
+            complete(exchange, CoapStatus::TOO_LARGE, message.code, nullptr, 0);
+            return;
+        }
+        exchange.response.insert(exchange.response.end(), message.payload, message.payload + message.payloadLength);
+        stats.blocksReceived++;
+        if (option & 0x08) {
+            exchange.block2Num = num + 1;
+            exchange.block2Szx = szx;
+            sendExchange(exchange);
+            return;
+        }
+        complete(exchange, CoapStatus::RESPONSE, message.code, exchange.response.data(), exchange.response.size());
+        return;
+    }
+    complete(exchange, CoapStatus::RESPONSE, message.code, message.payload, message.payloadLength);
+}
+
+void CoapEngine::complete(Exchange& exchange, CoapStatus status, uint8_t code, const uint8_t* payload, size_t length) {
+    bool notification = status == CoapStatus::RESPONSE && exchange.observe && exchange.hasObserveSequence;
+    CoapResponse response = {status, code, payload, length, notification, exchange.observeSequence};
+    if (status == CoapStatus::RESPONSE) {
+        stats.responses++;
+    }
+    if (notification) {
+        stats.notifications++;
+    }
+    // The callback runs before the slot is released so payload stays valid
+    if (exchange.callback) {
+        exchange.callback(exchange.handle, response);
+    }
+    if (notification) {
+        exchange.block2Num = 0;
+        exchange.response.clear();
+        return;
+    }
+    exchange.active = false;
+    exchange.callback = nullptr;
+}
+
+void CoapEngine::sendEmpty(CoapType type, uint16_t messageId) {
+    const uint8_t packet[] = {(uint8_t)(0x40 | ((uint8_t)type << 4)), 0x00,
+                              (uint8_t)(messageId >> 8), (uint8_t)messageId};
+    stats.datagramsSent++;
+    transport.send(packet, sizeof(packet));
+}
+
+bool CoapEngine::seenRecently(uint16_t messageId) {
+    size_t count = recentCount < 8 ? recentCount : 8;
+    for (size_t i = 0; i < count; i++) {
+        if (recentIds[i] == messageId) {
+            return true;
+        }
+    }
+    recentIds[recentCount++ % 8] = messageId;
+    return false;
+}
+
+uint32_t CoapEngine::nextRandom() {
+    // xorshift32
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+size_t CoapEngine::blockSize(uint8_t szx) const {
+    return (size_t)1 << (szx + 4);
+}
@@ -0,0 +1,354 @@
+#include "config_apply.h"
+#include <stdio.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+static uint32_t applyClock() {
+#ifdef ARDUINO
+    return millis();
+#else
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static const ConfigField* findField(const ConfigValues& values, const std::string& key) {
+    for (const ConfigField& field : values) {
+        if (field.key == key) {
+            return &field;
+        }
+    }
+    return nullptr;
+}
+
+static const FieldRule* findRule(const FieldRule* rules, size_t count, const std::string& key) {
+    for (size_t i = 0; i < count; i++) {
+        if (key == rules[i].key) {
+            return &rules[i];
+        }
+    }
+    return nullptr;
+}
+
+static const char* resultName(ApplyResult result) {
+    switch (result) {
+        case ApplyResult::APPLIED: return "applied";
+        case ApplyResult::UNCHANGED: return "unchanged";
+        case ApplyResult::REJECTED: return "rejected";
+        case ApplyResult::ROLLED_BACK: return "rolled_back";
+        case ApplyResult::ROLLBACK_FAILED: return "rollback_failed";
+    }
+    return "unknown";
+}
+
+static const char* const PROTOCOL_NAMES[PROTOCOL_TYPE_COUNT] = {
+    "mqtt", "http", "https", "websocket", "coap", "custom"
+};
+
+static void appendProtocols(std::string& json, const char* key, uint8_t mask) {
+    json += ",\"";
+    json += key;
+    json += "\":[";
+    bool first = true;
+    for (size_t i = 0; i < PROTOCOL_TYPE_COUNT; i++) {
+        if (mask & (1u << i)) {
+            json += first ? "\"" : ",\"";
+            json += PROTOCOL_NAMES[i];
+            json += "\"";
+            first = false;
+        }
+    }
+    json += "]";
+}
+
+static void appendEscaped(std::string& json, const std::string& text) {
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            json += '\\';
+        }
+        json += (unsigned char)c < 0x20 ? ' ' : c;
+    }
+}
+
+void diffConfig(const ConfigValues& from, const ConfigValues& to, const FieldRule* rules, size_t ruleCount,
+                ConfigDiff& diff) {
+    diff.changed.clear();
+    diff.reconnect = 0;
+    diff.tlsReload = false;
+    for (const ConfigField& field : to) {
+        const ConfigField* old = findField(from, field.key);
+        if (old != nullptr && old->value == field.value) {
+            continue;
+        }
+        diff.changed.push_back(field.key);
+        const FieldRule* rule = findRule(rules, ruleCount, field.key);
+        if (rule == nullptr) {
+            diff.reconnect = ALL_PROTOCOLS;
+        } else if (rule->effect == FieldEffect::RECONNECT) {
+            diff.reconnect |= rule->protocols;
+        } else if (rule->effect == FieldEffect::TLS) {
+            diff.reconnect |= rule->protocols;
+            diff.tlsReload = true;
+        }
+    }
+}
+
+ConfigApplier::ConfigApplier(ConfigTarget& target, const FieldRule* rules, size_t ruleCount)
+    : target(target)
+    , rules(rules)
+    , ruleCount(ruleCount)
+    , clock(applyClock)
+    , reportCallback(nullptr)
+    , drainTimeoutMs(DEFAULT_DRAIN_TIMEOUT_MS)
+    , connectTimeoutMs(DEFAULT_CONNECT_TIMEOUT_MS)
+    , nextId(1)
+    , state(ApplyState::IDLE)
+    , affected(0)
+    , connectedBefore(0)
+    , required(0)
+    , connectFailed(0)
+    , startedAt(0)
+    , phaseStartedAt(0)
+{
+    diff.reconnect = 0;
+    diff.tlsReload = false;
+    report.id = 0;
+    report.result = ApplyResult::UNCHANGED;
+    report.reconnected = 0;
+    report.failed = 0;
+    report.drainMs = 0;
+    report.durationMs = 0;
+}
+
+void ConfigApplier::setClock(uint32_t (*newClock)()) {
+    clock = newClock;
+}
+
+void ConfigApplier::setTimeouts(uint32_t drainMs, uint32_t connectMs) {
+    drainTimeoutMs = drainMs;
+    connectTimeoutMs = connectMs;
+}
+
+void ConfigApplier::setReportCallback(ReportCallback callback) {
+    reportCallback = callback;
+}
+
+uint32_t ConfigApplier::apply(const ConfigValues& changes) {
+    uint32_t now = clock();
+    uint32_t id = nextId++;
+    if (state != ApplyState::IDLE) {
+        // The running transaction keeps its report; this one is refused on its own
+        ApplyReport busy;
+        busy.id = id;
+        busy.result = ApplyResult::REJECTED;
+        busy.reconnected = 0;
+        busy.failed = 0;
+        busy.drainMs = 0;
+        busy.durationMs = 0;
+        busy.error = "another change is being applied";
+        if (reportCallback) {
+            reportCallback(busy);
+        }
+        return 0;
+    }
+
+    report = ApplyReport();
+    report.id = id;
+    startedAt = now;
+    previous = target.currentValues();
+    pending = previous;
+    for (const ConfigField& change : changes) {
+        bool known = false;
+        for (ConfigField& field : pending) {
+            if (field.key == change.key) {
+                field.value = change.value;
+                known = true;
+                break;
+            }
+        }
+        if (!known) {
+            finish(ApplyResult::REJECTED, now, "unknown field " + change.key);
+            return 0;
+        }
+    }
+    std::string error;
+    if (!target.validate(pending, error)) {
+        finish(ApplyResult::REJECTED, now, error);
+        return 0;
+    }
+
+    diffConfig(previous, pending, rules, ruleCount, diff);
+    report.changed = diff.changed;
+    if (diff.changed.empty()) {
+        finish(ApplyResult::UNCHANGED, now, "");
+        return id;
+    }
+
+    affected = diff.reconnect;
+    connectedBefore = 0;
+    connectFailed = 0;
+    for (size_t i = 0; i < PROTOCOL_TYPE_COUNT; i++) {
+        ProtocolType protocol = static_cast<ProtocolType>(i);
+        if (affected & protocolBit(protocol)) {
+            if (target.isConnected(protocol)) {
+                connectedBefore |= protocolBit(protocol);
+            }
+            target.hold(protocol, true);
+        }
+    }
+    state = ApplyState::DRAINING;
+    phaseStartedAt = now;
+    // Live-only changes have nothing to drain
+    update();
+    return id;
+}
+
+void ConfigApplier::update() {
+    if (state == ApplyState::IDLE) {
+        return;
+    }
+    uint32_t now = clock();
+    switch (state) {
+        case ApplyState::DRAINING:
+            if (drained() || now - phaseStartedAt >= drainTimeoutMs) {
+                report.drainMs = now - phaseStartedAt;
+                // An uplink the new config switches off is not expected back
+                required = connectedBefore & swap(pending, now);
+                state = ApplyState::RECONNECTING;
+                update();
+            }
+            break;
+
+        case ApplyState::RECONNECTING: {
+            uint8_t missing = required & ~connectedMask();
+            if (missing == 0) {
+                report.reconnected = affected & connectedMask();
+                std::string error;
+                if (!target.persist(pending)) {
+                    error = "applied but not persisted";
+                }
+                finish(ApplyResult::APPLIED, now, error);
+            } else if ((connectFailed & required) != 0 || now - phaseStartedAt >= connectTimeoutMs) {
+                report.failed = missing;
+                // The previous config brings back every uplink it had up,
+                // including those the new one switched off
+                required = connectedBefore;
+                swap(previous, now);
+                state = ApplyState::ROLLING_BACK;
+            }
+            break;
+        }
+
+        case ApplyState::ROLLING_BACK: {
+            uint8_t missing = required & ~connectedMask();
+            if (missing == 0) {
+                finish(ApplyResult::ROLLED_BACK, now, "reconnect failed");
+            } else if ((connectFailed & required) != 0 || now - phaseStartedAt >= connectTimeoutMs) {
+                finish(ApplyResult::ROLLBACK_FAILED, now, "reconnect failed, and again with the previous config");
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+bool ConfigApplier::isBusy() const {
+    return state != ApplyState::IDLE;
+}
+
+ApplyState ConfigApplier::getState() const {
+    return state;
+}
+
+const ApplyReport& ConfigApplier::getLastReport() const {
+    return report;
+}
+
+bool ConfigApplier::drained() const {
+    for (size_t i = 0; i < PROTOCOL_TYPE_COUNT; i++) {
+        ProtocolType protocol = static_cast<ProtocolType>(i);
+        if ((affected & protocolBit(protocol)) && target.inflight(protocol) > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint8_t ConfigApplier::swap(const ConfigValues& values, uint32_t now) {
+    target.install(values, diff.tlsReload);
+    connectFailed = 0;
+    uint8_t configured = 0;
+    for (size_t i = 0; i < PROTOCOL_TYPE_COUNT; i++) {
+        ProtocolType protocol = static_cast<ProtocolType>(i);
+        if (!(affected & protocolBit(protocol))) {
+            continue;
+        }
+        target.disconnect(protocol);
+        if (!target.isConfigured(protocol)) {
+            continue;
+        }
+        configured |= protocolBit(protocol);
+        if (!target.connect(protocol)) {
+            connectFailed |= protocolBit(protocol);
+        }
+    }
+    phaseStartedAt = now;
+    return configured;
+}
+
+uint8_t ConfigApplier::connectedMask() const {
+    uint8_t mask = 0;
+    for (size_t i = 0; i < PROTOCOL_TYPE_COUNT; i++) {
+        ProtocolType protocol = static_cast<ProtocolType>(i);
+        if (target.isConnected(protocol)) {
+            mask |= protocolBit(protocol);
+        }
+    }
+    return mask;
+}
+
+void ConfigApplier::finish(ApplyResult result, uint32_t now, const std::string& error) {
+    for (size_t i = 0; i < PROTOCOL_TYPE_COUNT; i++) {
+        ProtocolType protocol = static_cast<ProtocolType>(i);
+        if (affected & protocolBit(protocol)) {
+            target.hold(protocol, false);
+        }
+    }
+    affected = 0;
+    state = ApplyState::IDLE;
+    report.result = result;
+    report.durationMs = now - startedAt;
+    report.error = error;
+    previous.clear();
+    pending.clear();
+    if (reportCallback) {
+        reportCallback(report);
+    }
+}
+
+std::string exportApplyReport(const ApplyReport& report) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "{\"id\":%u,\"result\":\"%s\",\"changed\":[", (unsigned)report.id,
+             resultName(report.result));
+    std::string json = buffer;
+    for (size_t i = 0; i < report.changed.size(); i++) {
+        json += i > 0 ? ",\"" : "\"";
+        appendEscaped(json, report.changed[i]);
+        json += "\"";
+    }
+    json += "]";
+    appendProtocols(json, "reconnected", report.reconnected);
+    appendProtocols(json, "failed", report.failed);
+    snprintf(buffer, sizeof(buffer), ",\"drainMs\":%u,\"durationMs\":%u,\"error\":\"", (unsigned)report.drainMs,
+             (unsigned)report.durationMs);
+    json += buffer;
+    appendEscaped(json, report.error);
+    json += "\"}";
+    return json;
+}
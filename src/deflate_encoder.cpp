@@ -0,0 +1,329 @@
+#include "deflate_encoder.h"
+#include <string.h>
+
+// RFC 1951 3.2.5: length codes 257..285 and distance codes 0..29
+static const uint16_t LENGTH_BASE[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t LENGTH_EXTRA[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t DISTANCE_BASE[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t DISTANCE_EXTRA[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+DeflateEncoder::DeflateEncoder()
+    : position(0)
+    , end(0)
+    , bitBuffer(0)
+    , bitCount(0)
+    , outputLength(0)
+    , container(DeflateContainer::RAW)
+    , failed(false)
+    , checksum(0)
+    , totalIn(0)
+    , totalOut(0)
+{
+    memset(head, 0xFF, sizeof(head));
+    memset(prev, 0xFF, sizeof(prev));
+}
+
+uint32_t DeflateEncoder::crc32(uint32_t crc, const uint8_t* data, size_t length) {
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+uint32_t DeflateEncoder::adler32(uint32_t adler, const uint8_t* data, size_t length) {
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+    while (length > 0) {
+        // 5552 bytes is the most that can be summed before b overflows
+        size_t chunk = length < 5552 ? length : 5552;
+        length -= chunk;
+        while (chunk-- > 0) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+uint16_t DeflateEncoder::hash(const uint8_t* p) {
+    uint32_t v = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+    return (uint16_t)((v * 2654435761u) >> (32 - HASH_BITS));
+}
+
+void DeflateEncoder::begin(DeflateContainer container, Sink sink) {
+    this->container = container;
+    this->sink = sink;
+    memset(head, 0xFF, sizeof(head));
+    position = 0;
+    end = 0;
+    bitBuffer = 0;
+    bitCount = 0;
+    outputLength = 0;
+    failed = false;
+    totalIn = 0;
+    totalOut = 0;
+
+    switch (container) {
+        case DeflateContainer::ZLIB: {
+            // Deflate with a 2 KB window (CINFO 3)
+            uint8_t cmf = (uint8_t)((3 << 4) | 8);
+            uint8_t flg = (uint8_t)(31 - ((cmf << 8) % 31));
+            putByte(cmf);
+            putByte(flg);
+            checksum = 1;
+            break;
+        }
+        case DeflateContainer::GZIP: {
+            static const uint8_t header[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+            for (size_t i = 0; i < sizeof(header); i++) {
+                putByte(header[i]);
+            }
+            checksum = 0;
+            break;
+        }
+        default:
+            break;
+    }
+    // A single final block with the fixed codes
+    putBits(1, 1);
+    putBits(1, 2);
+}
+
+bool DeflateEncoder::write(const uint8_t* data, size_t length) {
+    if (failed) {
+        return false;
+    }
+    if (container == DeflateContainer::GZIP) {
+        checksum = crc32(checksum, data, length);
+    } else if (container == DeflateContainer::ZLIB) {
+        checksum = adler32(checksum, data, length);
+    }
+    totalIn += length;
+
+    while (length > 0) {
+        if (end == sizeof(window)) {
+            slide();
+        }
+        size_t chunk = sizeof(window) - end;
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(window + end, data, chunk);
+        end += chunk;
+        data += chunk;
+        length -= chunk;
+        encode(false);
+    }
+    return !failed;
+}
+
+bool DeflateEncoder::finish() {
+    encode(true);
+    putSymbol(256);
+    if (bitCount > 0) {
+        putBits(0, (uint8_t)(8 - bitCount));
+    }
+
+    if (container == DeflateContainer::GZIP) {
+        for (int shift = 0; shift < 32; shift += 8) {
+            putByte((uint8_t)(checksum >> shift));
+        }
+        for (int shift = 0; shift < 32; shift += 8) {
+            putByte((uint8_t)((uint32_t)totalIn >> shift));
+        }
+    } else if (container == DeflateContainer::ZLIB) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            putByte((uint8_t)(checksum >> shift));
+        }
+    }
+    flushOutput();
+    return !failed;
+}
+
+size_t DeflateEncoder::compress(DeflateContainer container, const uint8_t* input, size_t length,
+                                uint8_t* output, size_t capacity) {
+    size_t used = 0;
+    begin(container, [output, capacity, &used](const uint8_t* data, size_t count) {
+        if (count > capacity - used) {
+            return false;
+        }
+        memcpy(output + used, data, count);
+        used += count;
+        return true;
+    });
+    if (!write(input, length) || !finish()) {
+        return 0;
+    }
+    return used;
+}
+
+size_t DeflateEncoder::getTotalIn() const {
+    return totalIn;
+}
+
+size_t DeflateEncoder::getTotalOut() const {
+    return totalOut;
+}
+
+void DeflateEncoder::insert(size_t at) {
+    uint16_t h = hash(window + at);
+    prev[at & (WINDOW_SIZE - 1)] = head[h];
+    head[h] = (uint16_t)at;
+}
+
+size_t DeflateEncoder::findMatch(size_t at, size_t available, size_t& distance) const {
+    size_t limit = available < MAX_MATCH ? available : MAX_MATCH;
+    size_t best = 0;
+    uint16_t candidate = head[hash(window + at)];
+    for (size_t chain = 0; chain < MAX_CHAIN && candidate != NO_POSITION; chain++) {
+        if (candidate >= at || at - candidate > WINDOW_SIZE) {
+            break;
+        }
+        const uint8_t* a = window + candidate;
+        const uint8_t* b = window + at;
+        // The byte that would extend the best match so far rules most candidates out
+        if (a[best] == b[best] && a[0] == b[0]) {
+            size_t length = 0;
+            while (length < limit && a[length] == b[length]) {
+                length++;
+            }
+            if (length > best) {
+                best = length;
+                distance = at - candidate;
+                if (length == limit) {
+                    break;
+                }
+            }
+        }
+        uint16_t next = prev[candidate & (WINDOW_SIZE - 1)];
+        // The slot was reused by a newer position: the chain ends here
+        if (next != NO_POSITION && next >= candidate) {
+            break;
+        }
+        candidate = next;
+    }
+    return best;
+}
+
+void DeflateEncoder::slide() {
+    // Only the look-ahead is unencoded, so the lower half is pure history
+    memmove(window, window + WINDOW_SIZE, WINDOW_SIZE);
+    position -= WINDOW_SIZE;
+    end -= WINDOW_SIZE;
+    for (size_t i = 0; i < (1 << HASH_BITS); i++) {
+        head[i] = head[i] != NO_POSITION && head[i] >= WINDOW_SIZE ? (uint16_t)(head[i] - WINDOW_SIZE) : NO_POSITION;
+    }
+    for (size_t i = 0; i < WINDOW_SIZE; i++) {
+        prev[i] = prev[i] != NO_POSITION && prev[i] >= WINDOW_SIZE ? (uint16_t)(prev[i] - WINDOW_SIZE) : NO_POSITION;
+    }
+}
+
+void DeflateEncoder::encode(bool flush) {
+    // Without flush keep a full match of look-ahead for the next write
+    while (position < end && (flush || end - position >= MAX_MATCH)) {
+        size_t available = end - position;
+        size_t distance = 0;
+        size_t length = available >= MIN_MATCH ? findMatch(position, available, distance) : 0;
+        if (length >= MIN_MATCH) {
+            putMatch(length, distance);
+            for (size_t k = 0; k < length; k++, position++) {
+                if (end - position >= MIN_MATCH) {
+                    insert(position);
+                }
+            }
+        } else {
+            putLiteral(window[position]);
+            if (available >= MIN_MATCH) {
+                insert(position);
+            }
+            position++;
+        }
+    }
+}
+
+void DeflateEncoder::putBits(uint32_t value, uint8_t count) {
+    bitBuffer |= value << bitCount;
+    bitCount += count;
+    while (bitCount >= 8) {
+        putByte((uint8_t)bitBuffer);
+        bitBuffer >>= 8;
+        bitCount -= 8;
+    }
+}
+
+void DeflateEncoder::putCode(uint16_t code, uint8_t length) {
+    // Huffman codes go out most significant bit first
+    uint16_t reversed = 0;
+    for (uint8_t i = 0; i < length; i++) {
+        reversed = (uint16_t)((reversed << 1) | ((code >> i) & 1));
+    }
+    putBits(reversed, length);
+}
+
+void DeflateEncoder::putLiteral(uint8_t value) {
+    if (value < 144) {
+        putCode((uint16_t)(0x30 + value), 8);
+    } else {
+        putCode((uint16_t)(0x190 + value - 144), 9);
+    }
+}
+
+void DeflateEncoder::putSymbol(uint16_t symbol) {
+    if (symbol < 280) {
+        putCode((uint16_t)(symbol - 256), 7);
+    } else {
+        putCode((uint16_t)(0xC0 + symbol - 280), 8);
+    }
+}
+
+void DeflateEncoder::putMatch(size_t length, size_t distance) {
+    size_t code = 28;
+    while (LENGTH_BASE[code] > length) {
+        code--;
+    }
+    putSymbol((uint16_t)(257 + code));
+    putBits((uint32_t)(length - LENGTH_BASE[code]), LENGTH_EXTRA[code]);
+
+    code = 29;
+    while (DISTANCE_BASE[code] > distance) {
+        code--;
+    }
+    putCode((uint16_t)code, 5);
+    putBits((uint32_t)(distance - DISTANCE_BASE[code]), DISTANCE_EXTRA[code]);
+}
+
+void DeflateEncoder::putByte(uint8_t value) {
+    output[outputLength++] = value;
+    if (outputLength == OUTPUT_SIZE) {
+        flushOutput();
+    }
+}
+
+void DeflateEncoder::flushOutput() {
+    if (outputLength == 0) {
+        return;
+    }
+    if (!failed && sink && !sink(output, outputLength)) {
+        failed = true;
+    }
+    totalOut += outputLength;
+    outputLength = 0;
+}
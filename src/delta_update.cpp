@@ -0,0 +1,315 @@
+#include "delta_update.h"
+#include <string.h>
+
+static const uint32_t CRC_TABLE[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t deltaCrc32(uint32_t crc, const uint8_t* data, size_t length) {
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ CRC_TABLE[crc & 0x0F];
+        crc = (crc >> 4) ^ CRC_TABLE[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+static uint32_t readLe32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+DeltaPatcher::DeltaPatcher()
+    : sourceSize(0)
+    , state(DeltaState::HEADER)
+    , lastError("")
+    , headerPos(0)
+    , targetSize(0)
+    , targetCrc(0)
+    , controlField(0)
+    , varintValue(0)
+    , varintShift(0)
+    , diffRemaining(0)
+    , extraRemaining(0)
+    , sourcePos(0)
+    , windowStart(0)
+    , windowLength(0)
+    , outputLength(0)
+    , written(0)
+    , crc(0)
+{
+}
+
+void DeltaPatcher::begin(SourceReader reader, TargetWriter writer, uint32_t size) {
+    sourceReader = reader;
+    targetWriter = writer;
+    sourceSize = size;
+    state = DeltaState::HEADER;
+    lastError = "";
+    headerPos = 0;
+    targetSize = 0;
+    targetCrc = 0;
+    controlField = 0;
+    varintValue = 0;
+    varintShift = 0;
+    diffRemaining = 0;
+    extraRemaining = 0;
+    sourcePos = 0;
+    windowStart = 0;
+    windowLength = 0;
+    outputLength = 0;
+    written = 0;
+    crc = 0;
+}
+
+bool DeltaPatcher::write(const uint8_t* data, size_t length) {
+    size_t i = 0;
+    while (i < length) {
+        switch (state) {
+            case DeltaState::HEADER:
+                header[headerPos++] = data[i++];
+                if (headerPos == HEADER_SIZE && !parseHeader()) {
+                    return false;
+                }
+                break;
+
+            case DeltaState::CONTROL: {
+                uint32_t value;
+                if (!feedVarint(data[i++], value)) {
+                    if (state == DeltaState::ERROR) {
+                        return false;
+                    }
+                    break;
+                }
+                control[controlField++] = value;
+                if (controlField == 3 && !startRecord()) {
+                    return false;
+                }
+                break;
+            }
+
+            case DeltaState::DIFF: {
+                uint8_t diff = data[i++];
+                if (diff == 0) {
+                    state = DeltaState::DIFF_RUN;
+                    break;
+                }
+                uint8_t source;
+                if (!sourceByte(source) || !emit(source + diff)) {
+                    return false;
+                }
+                if (--diffRemaining == 0) {
+                    state = DeltaState::EXTRA;
+                }
+                break;
+            }
+
+            case DeltaState::DIFF_RUN: {
+                uint32_t run;
+                if (!feedVarint(data[i++], run)) {
+                    if (state == DeltaState::ERROR) {
+                        return false;
+                    }
+                    break;
+                }
+                if (run == 0 || run > diffRemaining) {
+                    return fail("Invalid diff run");
+                }
+                if (!emitUnchanged(run)) {
+                    return false;
+                }
+                diffRemaining -= run;
+                state = diffRemaining > 0 ? DeltaState::DIFF : DeltaState::EXTRA;
+                break;
+            }
+
+            case DeltaState::EXTRA: {
+                size_t count = length - i;
+                if (count > extraRemaining) {
+                    count = extraRemaining;
+                }
+                for (size_t n = 0; n < count; n++) {
+                    if (!emit(data[i + n])) {
+                        return false;
+                    }
+                }
+                i += count;
+                extraRemaining -= count;
+                break;
+            }
+
+            case DeltaState::DONE:
+                return fail("Trailing data after patch end");
+
+            case DeltaState::ERROR:
+                return false;
+        }
+
+        // A record ends once its extra section is consumed
+        if (state == DeltaState::EXTRA && extraRemaining == 0) {
+            int32_t seek = (int32_t)((control[2] >> 1) ^ (~(control[2] & 1) + 1));
+            int64_t next = (int64_t)sourcePos + seek;
+            if (next < 0) {
+                return fail("Seek before start of source");
+            }
+            sourcePos = (uint32_t)next;
+            state = written == targetSize ? DeltaState::DONE : DeltaState::CONTROL;
+        }
+    }
+    return true;
+}
+
+bool DeltaPatcher::finish() {
+    if (state == DeltaState::ERROR) {
+        return false;
+    }
+    if (state != DeltaState::DONE) {
+        return fail("Patch truncated");
+    }
+    if (!flush()) {
+        return false;
+    }
+    if (crc != targetCrc) {
+        return fail("Target CRC mismatch");
+    }
+    return true;
+}
+
+DeltaState DeltaPatcher::getState() const {
+    return state;
+}
+
+bool DeltaPatcher::hasHeader() const {
+    return headerPos == HEADER_SIZE;
+}
+
+uint32_t DeltaPatcher::getTargetSize() const {
+    return targetSize;
+}
+
+uint32_t DeltaPatcher::getBytesWritten() const {
+    return written;
+}
+
+const char* DeltaPatcher::getLastError() const {
+    return lastError;
+}
+
+bool DeltaPatcher::parseHeader() {
+    if (memcmp(header, "CDP1", 4) != 0) {
+        return fail("Bad patch magic");
+    }
+    targetSize = readLe32(header + 4);
+    targetCrc = readLe32(header + 8);
+    controlField = 0;
+    state = targetSize > 0 ? DeltaState::CONTROL : DeltaState::DONE;
+    return true;
+}
+
+bool DeltaPatcher::feedVarint(uint8_t byte, uint32_t& value) {
+    if (varintShift > 28) {
+        fail("Varint overflow");
+        return false;
+    }
+    varintValue |= (uint32_t)(byte & 0x7F) << varintShift;
+    varintShift += 7;
+    if (byte & 0x80) {
+        return false;
+    }
+    value = varintValue;
+    varintValue = 0;
+    varintShift = 0;
+    return true;
+}
+
+bool DeltaPatcher::startRecord() {
+    controlField = 0;
+    diffRemaining = control[0];
+    extraRemaining = control[1];
+    if ((uint64_t)written + diffRemaining + extraRemaining > targetSize) {
+        return fail("Record exceeds target size");
+    }
+    state = diffRemaining > 0 ? DeltaState::DIFF : DeltaState::EXTRA;
+    return true;
+}
+
+bool DeltaPatcher::sourceByte(uint8_t& value) {
+    if (sourcePos >= sourceSize) {
+        // bsdiff semantics: bytes past the end of the source read as zero
+        value = 0;
+        sourcePos++;
+        return true;
+    }
+    if (sourcePos < windowStart || sourcePos >= windowStart + windowLength) {
+        size_t length = sourceSize - sourcePos;
+        if (length > BUFFER_SIZE) {
+            length = BUFFER_SIZE;
+        }
+        if (!sourceReader || !sourceReader(sourcePos, sourceWindow, length)) {
+            return fail("Failed to read source image");
+        }
+        windowStart = sourcePos;
+        windowLength = length;
+    }
+    value = sourceWindow[sourcePos - windowStart];
+    sourcePos++;
+    return true;
+}
+
+bool DeltaPatcher::emit(uint8_t value) {
+    output[outputLength++] = value;
+    written++;
+    if (outputLength == BUFFER_SIZE) {
+        return flush();
+    }
+    return true;
+}
+
+bool DeltaPatcher::emitUnchanged(uint32_t count) {
+    while (count > 0) {
+        uint8_t value;
+        if (sourcePos >= windowStart && sourcePos < windowStart + windowLength) {
+            // Fast path: copy straight from the cached source window
+            size_t available = windowStart + windowLength - sourcePos;
+            size_t space = BUFFER_SIZE - outputLength;
+            size_t n = count;
+            if (n > available) n = available;
+            if (n > space) n = space;
+            memcpy(output + outputLength, sourceWindow + (sourcePos - windowStart), n);
+            outputLength += n;
+            written += n;
+            sourcePos += n;
+            count -= n;
+            if (outputLength == BUFFER_SIZE && !flush()) {
+                return false;
+            }
+            continue;
+        }
+        if (!sourceByte(value) || !emit(value)) {
+            return false;
+        }
+        count--;
+    }
+    return true;
+}
+
+bool DeltaPatcher::flush() {
+    if (outputLength == 0) {
+        return true;
+    }
+    crc = deltaCrc32(crc, output, outputLength);
+    if (!targetWriter || !targetWriter(output, outputLength)) {
+        return fail("Failed to write target image");
+    }
+    outputLength = 0;
+    return true;
+}
+
+bool DeltaPatcher::fail(const char* error) {
+    lastError = error;
+    state = DeltaState::ERROR;
+    return false;
+}
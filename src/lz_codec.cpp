@@ -0,0 +1,103 @@
+#include "lz_codec.h"
+#include <string.h>
+
+LzCodec::LzCodec() {
+    memset(head, 0xFF, sizeof(head));
+}
+
+uint16_t LzCodec::hash(const uint8_t* p) {
+    uint32_t v = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+    return (uint16_t)((v * 2654435761u) >> (32 - HASH_BITS));
+}
+
+size_t LzCodec::maxCompressedSize(size_t length) {
+    return length + (length + 7) / 8;
+}
+
+size_t LzCodec::compress(const uint8_t* input, size_t length, uint8_t* output, size_t capacity) {
+    if (length > MAX_INPUT) {
+        return 0;
+    }
+    memset(head, 0xFF, sizeof(head));
+
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < length) {
+        if (op >= capacity) {
+            return 0;
+        }
+        size_t flagPos = op++;
+        uint8_t flags = 0;
+
+        for (uint8_t bit = 0; bit < 8 && ip < length; bit++) {
+            size_t matchLength = 0;
+            size_t matchOffset = 0;
+            if (ip + MIN_MATCH <= length) {
+                uint16_t h = hash(input + ip);
+                uint16_t candidate = head[h];
+                head[h] = (uint16_t)ip;
+                if (candidate != NO_POSITION && ip - candidate <= WINDOW_SIZE) {
+                    size_t limit = length - ip < MAX_MATCH ? length - ip : MAX_MATCH;
+                    while (matchLength < limit && input[candidate + matchLength] == input[ip + matchLength]) {
+                        matchLength++;
+                    }
+                    matchOffset = ip - candidate;
+                }
+            }
+
+            if (matchLength >= MIN_MATCH) {
+                if (op + 2 > capacity) {
+                    return 0;
+                }
+                uint16_t offset = (uint16_t)(matchOffset - 1);
+                output[op++] = (uint8_t)(offset >> 4);
+                output[op++] = (uint8_t)(((offset & 0x0F) << 4) | (matchLength - MIN_MATCH));
+                flags |= (uint8_t)(1 << bit);
+                // Index the covered positions so later data can refer to them
+                for (size_t k = 1; k < matchLength && ip + k + MIN_MATCH <= length; k++) {
+                    head[hash(input + ip + k)] = (uint16_t)(ip + k);
+                }
+                ip += matchLength;
+            } else {
+                if (op >= capacity) {
+                    return 0;
+                }
+                output[op++] = input[ip++];
+            }
+        }
+        output[flagPos] = flags;
+    }
+    return op;
+}
+
+size_t LzCodec::decompress(const uint8_t* input, size_t length, uint8_t* output, size_t capacity) {
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < length) {
+        uint8_t flags = input[ip++];
+        for (uint8_t bit = 0; bit < 8 && ip < length; bit++) {
+            if (flags & (1 << bit)) {
+                if (ip + 2 > length) {
+                    return 0;
+                }
+                size_t offset = (((size_t)input[ip] << 4) | (input[ip + 1] >> 4)) + 1;
+                size_t count = (input[ip + 1] & 0x0F) + MIN_MATCH;
+                ip += 2;
+                if (offset > op || op + count > capacity) {
+                    return 0;
+                }
+                // Byte-wise copy: matches may overlap their own output
+                for (size_t k = 0; k < count; k++) {
+                    output[op] = output[op - offset];
+                    op++;
+                }
+            } else {
+                if (op >= capacity) {
+                    return 0;
+                }
+                output[op++] = input[ip++];
+            }
+        }
+    }
+    return op;
+}
@@ -1,17 +1,451 @@
 // main.cpp
 #include <Arduino.h>
 #include "state_machine.h"
+#include "protocol_manager.h"
+#include "spsc_queue.h"
+#include "task_topology.h"
+#include "wifi_manager.h"
+#include "supervisor.h"
+#include "time_service.h"
+#include "pi_link.h"
+#include <WiFiUdp.h>
 
 StateMachine stateMachine;
+ProtocolManager protocolManager;
+TaskTopology topology;
+EspWifiHal wifiHal;
+WifiManager wifiManager(wifiHal);
+EspSupervisorHal supervisorHal;
+Supervisor supervisor(supervisorHal);
+TimeService timeService;
+WiFiUDP ntpUdp;
+UdpSntpTransport ntpTransport(ntpUdp);
+SntpClient sntp(ntpTransport, timeService);
+static const char* const NTP_SERVER = "pool.ntp.org";
+
+// Companion Raspberry Pi on UART1; it stores every sample batch
+static const int PI_LINK_RX_PIN = 26;
+static const int PI_LINK_TX_PIN = 25;
+static const uint32_t PI_LINK_BAUD = 2000000;
+UartPiTransport piTransport(Serial1, PI_LINK_RX_PIN, PI_LINK_TX_PIN, PI_LINK_BAUD);
+PiLink piLink(piTransport);
+static uint8_t piPayload[PiLink::MAX_PAYLOAD];
+static uint32_t piBatchesDropped = 0;
+
+// Heartbeat deadlines; the network one covers a TLS handshake or a slow
+// HTTP POST, which block the task
+static const uint32_t ACQUISITION_DEADLINE_MS = 5000;
+static const uint32_t NETWORK_DEADLINE_MS = 15000;
+static const uint32_t SUPERVISOR_PERIOD_MS = 100;
+static const uint32_t STATS_INTERVAL_MS = 10000;
+static int acquisitionModule = -1;
+static int networkModule = -1;
+
+// Boot stages owned by the network and loop tasks; the orchestrator runs on
+// the acquisition task, so starting one only raises a flag here
+static const uint32_t WIFI_BOOT_TIMEOUT_MS = 30000;
+static const uint32_t UPLINK_BOOT_TIMEOUT_MS = 30000;
+static const uint32_t TIME_BOOT_TIMEOUT_MS = 30000;
+static int protocolsStage = -1;
+static int wifiStage = -1;
+static int uplinkStage = -1;
+static int timeStage = -1;
+static int supervisorStage = -1;
+static std::atomic<bool> protocolsStartRequested(false);
+static std::atomic<bool> wifiStartRequested(false);
+static std::atomic<bool> supervisorStartRequested(false);
+static bool protocolsStarted = false;
+static bool supervisorStarted = false;
+
+// Recovery steps requested by the supervisor, carried out by the network task
+static std::atomic<bool> wifiRestartRequested(false);
+static std::atomic<bool> protocolResetRequested(false);
+static String wifiSsid;
+static String wifiPassword;
+
+// Acquisition (core 1) -> network (core 0) hand-off
+SpscQueue<Sample, 256> uplinkQueue;
+static const size_t UPLINK_BATCH_SIZE = 32;
+static String samplesTopic;
+
+// Downlink Modbus writes: MQTT (network) -> state machine (acquisition), acks back
+SpscQueue<ModbusCommandAck, 16> commandAckQueue;
+static String commandTopic;
+static String commandAckTopic;
+static bool commandsSubscribed = false;
+
+// Protocol config changes: the web UI (async_tcp task), MQTT and snapshot
+// restores (network task) queue the JSON, one queue per producing task; the
+// network task applies it between protocol updates
+SpscQueue<String, 4> webConfigQueue;
+SpscQueue<String, 4> networkConfigQueue;
+static String configTopic;
+static String configAckTopic;
+static String lastConfigReport;
+static SemaphoreHandle_t configReportMutex = nullptr;
+
+static const char* commandStatusName(CommandStatus status) {
+    switch (status) {
+        case CommandStatus::OK: return "ok";
+        case CommandStatus::REJECTED: return "rejected";
+        case CommandStatus::QUEUE_FULL: return "queue_full";
+        case CommandStatus::EXPIRED: return "expired";
+        case CommandStatus::EXCEPTION: return "exception";
+        case CommandStatus::VERIFY_FAILED: return "verify_failed";
+    }
+    return "unknown";
+}
+
+static void publishCommandAck(const ModbusCommandAck& ack) {
+    StaticJsonDocument<192> doc;
+    doc["id"] = (const char*)ack.id;
+    doc["unit"] = ack.unit;
+    doc["status"] = commandStatusName(ack.status);
+    doc["exception"] = ack.exception;
+    doc["attempts"] = ack.attempts;
+    doc["latencyMs"] = ack.latencyMs;
+    ProtocolMessage message;
+    serializeJson(doc, message.payload);
+    message.topic = commandAckTopic;
+    message.protocol = ProtocolType::MQTT;
+    message.qos = 1;
+    message.retain = false;
+    message.isResponse = true;
+    message.priority = MessagePriority::CONTROL;
+    protocolManager.publish(message);
+}
+
+static void refuseCommand(const ModbusCommand& command, CommandStatus status) {
+    ModbusCommandAck ack;
+    memset(&ack, 0, sizeof(ack));
+    memcpy(ack.id, command.id, sizeof(ack.id));
+    ack.unit = command.unit;
+    ack.status = status;
+    publishCommandAck(ack);
+}
+
+// {"id", "unit", "register", "values": [...] or "value", "priority", "verify", "expiryMs"}
+static void handleCommandMessage(const ProtocolMessage& message) {
+    ModbusCommand command;
+    memset(&command, 0, sizeof(command));
+    StaticJsonDocument<1024> doc;
+    DeserializationError error = deserializeJson(doc, message.payload);
+    if (!error) {
+        strlcpy(command.id, doc["id"] | "", sizeof(command.id));
+        command.unit = doc["unit"] | 0;
+        command.start = doc["register"] | 0;
+        command.priority = doc["priority"] | 5;
+        command.verify = doc["verify"] | true;
+        command.expiryMs = doc["expiryMs"] | 0;
+        JsonArrayConst values = doc["values"];
+        if (values.isNull() && doc["value"].is<uint16_t>()) {
+            command.values[0] = doc["value"];
+            command.count = 1;
+        }
+        for (JsonVariantConst value : values) {
+            if (command.count == ModbusRtuMaster::MAX_WRITE_REGISTERS || !value.is<uint16_t>()) {
+                command.count = 0;
+                break;
+            }
+            command.values[command.count++] = value.as<uint16_t>();
+        }
+    }
+    // Malformed messages never reach the queue; the rest is validated there
+    if (error || command.count == 0) {
+        refuseCommand(command, CommandStatus::REJECTED);
+    } else if (!stateMachine.submitModbusCommand(command)) {
+        refuseCommand(command, CommandStatus::QUEUE_FULL);
+    }
+}
+
+static void handleIncomingMessage(const ProtocolMessage& message) {
+    if (message.topic == commandTopic) {
+        handleCommandMessage(message);
+    } else if (message.topic == configTopic) {
+        // Applying here could disconnect MQTT from inside its own loop
+        if (!networkConfigQueue.push(message.payload)) {
+            Serial.println("[Config] Change dropped, queue full");
+        }
+    }
+}
+
+static void updateTopics() {
+    const String prefix = protocolManager.getConfig().mqttTopicPrefix;
+    samplesTopic = prefix + "/samples";
+    commandTopic = prefix + "/modbus/cmd";
+    commandAckTopic = prefix + "/modbus/ack";
+    configTopic = prefix + "/config/set";
+    configAckTopic = prefix + "/config/ack";
+}
+
+static void handleConfigReport(const ApplyReport& report) {
+    String json = exportApplyReport(report).c_str();
+    xSemaphoreTake(configReportMutex, portMAX_DELAY);
+    lastConfigReport = json;
+    xSemaphoreGive(configReportMutex);
+
+    // The topic prefix may have changed
+    if (report.result == ApplyResult::APPLIED) {
+        updateTopics();
+        commandsSubscribed = false;
+    }
+    ProtocolMessage message;
+    message.topic = configAckTopic;
+    message.payload = json;
+    message.protocol = ProtocolType::MQTT;
+    message.qos = 1;
+    message.retain = false;
+    message.isResponse = true;
+    message.priority = MessagePriority::CONTROL;
+    protocolManager.publish(message);
+}
+
+// CBOR, split until each part fits a link payload. Storage on the Pi is
+// best effort: a full window drops the batch rather than stall the uplinks.
+static void forwardToPi(const Sample* samples, size_t count, const TimeBase* timeBase) {
+    PayloadBuffer buffer(piPayload, sizeof(piPayload));
+    size_t length = encodeSamples(PayloadFormat::CBOR, samples, count, buffer, nullptr, timeBase);
+    if (length == 0 && count > 1) {
+        forwardToPi(samples, count / 2, timeBase);
+        forwardToPi(samples + count / 2, count - count / 2, timeBase);
+        return;
+    }
+    if (length == 0 || !piLink.send(PiChannel::SAMPLES, piPayload, length)) {
+        piBatchesDropped++;
+    }
+}
+
+static void startProtocols() {
+    protocolManager.begin();
+    updateTopics();
+    protocolManager.setMessageCallback(handleIncomingMessage);
+    protocolManager.setConfigReportCallback(handleConfigReport);
+    // Samples are stamped with millis() at acquisition; SNTP maps them to
+    // wall time when a batch is encoded
+    protocolManager.setTimeService(&timeService);
+    protocolsStarted = true;
+    // Wi-Fi boots alongside; catch up on a link that came up first
+    if (wifiManager.isConnected()) {
+        protocolManager.handleLinkEvent(WifiEvent::LINK_UP);
+    }
+    stateMachine.getBoot().markReady(protocolsStage);
+}
+
+static void startWifi() {
+    SystemConfig system = stateMachine.getSystemConfig();
+    wifiSsid = system.wifiSSID;
+    wifiPassword = system.wifiPassword;
+    if (!wifiManager.begin(wifiSsid.c_str(), wifiPassword.c_str())) {
+        Serial.println("No Wi-Fi SSID configured");
+        stateMachine.getBoot().markFailed(wifiStage);
+    }
+}
+
+static BootStartResult requestStart(std::atomic<bool>& request) {
+    request = true;
+    return BootStartResult::PENDING;
+}
+
+static void addNetworkBootStages() {
+    BootOrchestrator& boot = stateMachine.getBoot();
+    int storage = boot.findStage("storage");
+    protocolsStage = boot.addStage("protocols", BootRole::NONE, []() { return requestStart(protocolsStartRequested); });
+    wifiStage = boot.addStage("wifi", BootRole::NONE, []() { return requestStart(wifiStartRequested); },
+                              WIFI_BOOT_TIMEOUT_MS);
+    uplinkStage = boot.addStage("uplink", BootRole::UPLINK, []() { return BootStartResult::PENDING; },
+                                UPLINK_BOOT_TIMEOUT_MS);
+    timeStage = boot.addStage("sntp", BootRole::NONE, []() { return BootStartResult::PENDING; },
+                              TIME_BOOT_TIMEOUT_MS);
+    // The post-mortem log lives on SPIFFS
+    supervisorStage = boot.addStage("supervisor", BootRole::NONE, []() { return requestStart(supervisorStartRequested); });
+    boot.addDependency(protocolsStage, storage);
+    boot.addDependency(wifiStage, storage);
+    boot.addDependency(uplinkStage, wifiStage);
+    boot.addDependency(uplinkStage, protocolsStage);
+    boot.addDependency(timeStage, wifiStage);
+    boot.addDependency(supervisorStage, storage);
+}
+
+static void acquisitionTask() {
+    supervisor.heartbeat(acquisitionModule);
+    stateMachine.update();
+}
+
+static void networkTask() {
+    supervisor.heartbeat(networkModule);
+    if (protocolsStartRequested.exchange(false)) {
+        startProtocols();
+    }
+    if (wifiStartRequested.exchange(false)) {
+        startWifi();
+    }
+    if (wifiRestartRequested.exchange(false)) {
+        wifiManager.stop();
+        wifiManager.begin(wifiSsid.c_str(), wifiPassword.c_str());
+    }
+    if (protocolResetRequested.exchange(false) && protocolsStarted) {
+        protocolManager.resetConnections();
+    }
+    wifiManager.update();
+    sntp.update();
+    if (timeService.isSynced()) {
+        stateMachine.getBoot().markReady(timeStage);
+    }
+    piLink.update();
+    // Jobs may block for a whole OTA transfer; they beat networkModule
+    // The wifi stage only records the boot timeline: it stays failed after a
+    // slow first association, while the link may come up any time later
+    if (wifiManager.isConnected()) {
+        stateMachine.startMaintenanceServer();
+    }
+    stateMachine.updateMaintenance();
+    if (!protocolsStarted) {
+        return;
+    }
+    String configChange;
+    if (!protocolManager.isApplyingConfig()
+        && (webConfigQueue.pop(configChange) || networkConfigQueue.pop(configChange))) {
+        protocolManager.applyConfigJson(configChange);
+    }
+    
+    // Drain the queue in batches so each uplink message carries many points
+    Sample batch[UPLINK_BATCH_SIZE];
+    size_t count = 0;
+    while (count < UPLINK_BATCH_SIZE && uplinkQueue.pop(batch[count])) {
+        count++;
+    }
+    if (count > 0) {
+        protocolManager.publishSamples(samplesTopic, batch, count, ProtocolType::MQTT, 1);
+        if (piLink.isUp()) {
+            TimeBase timeBase = timeService.timeBase();
+            forwardToPi(batch, count, &timeBase);
+        }
+    }
+    ModbusCommandAck ack;
+    while (commandAckQueue.pop(ack)) {
+        publishCommandAck(ack);
+    }
+    // Forwarding starts on whichever uplink the deployment uses
+    if (protocolManager.hasHealthyUplink()) {
+        stateMachine.getBoot().markReady(uplinkStage);
+    }
+    // The broker keeps the subscription across reconnects; renew it anyway
+    bool mqttUp = protocolManager.isConnected(ProtocolType::MQTT);
+    if (mqttUp && !commandsSubscribed) {
+        commandsSubscribed = protocolManager.subscribe(commandTopic, ProtocolType::MQTT)
+                             && protocolManager.subscribe(configTopic, ProtocolType::MQTT);
+    } else if (!mqttUp) {
+        commandsSubscribed = false;
+    }
+    protocolManager.update();
+    stateMachine.setUplinkQueueDepth(uplinkQueue.size() + protocolManager.getQueueSize());
+}
 
 void setup() {
     Serial.begin(115200);
     Serial.println("Starting CERISE Gateway...");
     
+    piTransport.begin();
+    piLink.begin();
+
+    // Nothing blocks here: storage, modules, protocols and Wi-Fi come up
+    // through the boot graph once the tasks run
     stateMachine.begin();
+    addNetworkBootStages();
+    
+    // Wi-Fi comes up in the background; protocols connect on LINK_UP
+    wifiManager.addListener([](WifiEvent event) {
+        if (protocolsStarted) {
+            protocolManager.handleLinkEvent(event);
+        }
+    });
+    wifiManager.addListener([](WifiEvent event) {
+        if (event == WifiEvent::LINK_UP) {
+            stateMachine.getBoot().markReady(wifiStage);
+        }
+        if (event == WifiEvent::LINK_UP || event == WifiEvent::LINK_DOWN) {
+            stateMachine.setLinkUp(event == WifiEvent::LINK_UP);
+        }
+    });
+    wifiManager.addListener([](WifiEvent event) {
+        if (event == WifiEvent::LINK_UP && ntpTransport.begin(NTP_SERVER)) {
+            sntp.syncNow();
+        }
+    });
+    stateMachine.setSampleSink([](const Sample& sample) { return uplinkQueue.push(sample); });
+    stateMachine.setCommandAckSink([](const ModbusCommandAck& ack) { return commandAckQueue.push(ack); });
+    configReportMutex = xSemaphoreCreateMutex();
+    stateMachine.setProtocolConfigHooks([](const String& json) { return webConfigQueue.push(json); }, []() {
+        xSemaphoreTake(configReportMutex, portMAX_DELAY);
+        String report = lastConfigReport.isEmpty() ? String("{\"result\":null}") : lastConfigReport;
+        xSemaphoreGive(configReportMutex);
+        return report;
+    }, [](const String& json) { return networkConfigQueue.push(json); });
+
+    // Both tasks beat every iteration; this (loop) task feeds the task WDT
+    supervisor.setLogCallback([](const char* line) { Serial.printf("[Supervisor] %s\n", line); });
+    acquisitionModule = supervisor.addModule("acquisition", ACQUISITION_DEADLINE_MS,
+                                             []() { return stateMachine.requestRecovery(); });
+    networkModule = supervisor.addModule("network", NETWORK_DEADLINE_MS, []() {
+        wifiRestartRequested = true;
+        return true;
+    });
+    supervisor.setProtocolReset([]() {
+        protocolResetRequested = true;
+        return true;
+    });
+    stateMachine.setFaultHandler([]() { supervisor.reportFault(acquisitionModule); });
+    stateMachine.setHeartbeat([]() { supervisor.heartbeat(networkModule); });
+
+    topology.addTask({"acquisition", ACQUISITION_CORE, 5, 8192, 10, acquisitionTask});
+    topology.addTask({"network", NETWORK_CORE, 4, 8192, 10, networkTask});
+    if (!topology.start()) {
+        Serial.println("Failed to start task topology");
+    }
 }
 
 void loop() {
-    stateMachine.update();
-    delay(10); // Small delay to prevent CPU hogging
+    // The watchdog starts once storage holds the post-mortem log
+    if (supervisorStartRequested.exchange(false)) {
+        if (supervisor.begin()) {
+            stateMachine.getBoot().markReady(supervisorStage);
+        } else {
+            Serial.println("Failed to start task watchdog");
+            stateMachine.getBoot().markFailed(supervisorStage);
+        }
+        supervisorStarted = true;
+    }
+    if (supervisorStarted) {
+        supervisor.update();
+    }
+
+    // Report task load and module health periodically
+    static uint32_t lastReport = 0;
+    if (millis() - lastReport >= STATS_INTERVAL_MS) {
+        lastReport = millis();
+        TaskStats stats;
+        for (size_t i = 0; i < topology.getTaskCount(); i++) {
+            if (topology.sampleStats(i, stats)) {
+                Serial.printf("[Tasks] %s core %d: %.1f%% cpu, max %u us, %u iterations\n",
+                              stats.name, stats.core, stats.utilization * 100.0f,
+                              (unsigned)stats.maxBusyUs, (unsigned)stats.iterations);
+            }
+        }
+        ModuleStatus status;
+        for (size_t i = 0; i < supervisor.getModuleCount(); i++) {
+            if (supervisor.getModuleStatus(i, status)) {
+                Serial.printf("[Supervisor] %s: health %u, last beat %u ms ago, %u misses\n", status.name,
+                              (unsigned)status.health, (unsigned)status.ageMs, (unsigned)status.misses);
+            }
+        }
+        const TimeServiceStats& time = timeService.getStats();
+        Serial.printf("[Time] %s, last error %lld us, drift %ld ppb, %u syncs\n",
+                      timeService.isSynced() ? "synced" : "unsynced", (long long)time.lastErrorUs,
+                      (long)time.driftPpb, (unsigned)time.syncs);
+        const PiLinkStats& pi = piLink.getStats();
+        Serial.printf("[PiLink] %s, %u frames out, %u retransmits, %u CRC errors, %u batches dropped\n",
+                      piLink.isUp() ? "up" : "syncing", (unsigned)pi.framesSent, (unsigned)pi.retransmits,
+                      (unsigned)pi.crcErrors, (unsigned)piBatchesDropped);
+    }
+    delay(SUPERVISOR_PERIOD_MS);
 }
@@ -1,4 +1,7 @@
 #include "maintenance.h"
+#include <esp_ota_ops.h>
+#include <esp_image_format.h>
+#include <algorithm>
 
 Maintenance::Maintenance()
     : currentState(MaintenanceState::IDLE)
@@ -6,7 +9,13 @@ Maintenance::Maintenance()
     , remoteDebugEnabled(false)
     , webServer(80)
     , webServerRunning(false)
+    , stateMutex(nullptr)
+    , snapshots(snapshotStorage)
+    , nextJobId(1)
+    , activeJobId(0)
 {
+    memset(jobs, 0, sizeof(jobs));
+
     // Initialize default configuration
     config.deviceId = "CERISE-GW-" + String((uint32_t)ESP.getEfuseMac(), HEX);
     config.firmwareVersion = "1.0.0";
@@ -19,9 +28,50 @@ Maintenance::Maintenance()
 }
 
 void Maintenance::begin() {
+    stateMutex = xSemaphoreCreateMutex();
+
+    // Setup web server routes
+    webServer.on("/", HTTP_GET, [this](AsyncWebServerRequest* request) { handleRoot(request); });
+    webServer.on("/update", HTTP_POST, [this](AsyncWebServerRequest* request) {
+        handleJobRequest(request, MaintenanceState::CHECKING_UPDATE);
+    });
+    webServer.on("/backup", HTTP_POST, [this](AsyncWebServerRequest* request) {
+        handleJobRequest(request, MaintenanceState::BACKING_UP);
+    });
+    webServer.on("/restore", HTTP_POST, [this](AsyncWebServerRequest* request) {
+        handleJobRequest(request, MaintenanceState::RESTORING);
+    });
+    webServer.on("/factory-reset", HTTP_POST, [this](AsyncWebServerRequest* request) {
+        handleJobRequest(request, MaintenanceState::FACTORY_RESET);
+    });
+    webServer.on("/jobs", HTTP_GET, [this](AsyncWebServerRequest* request) { handleJobStatus(request); });
+    // Before "/config", which would otherwise match its subpaths
+    webServer.on("/config/protocols", HTTP_POST,
+                 [this](AsyncWebServerRequest* request) { handleProtocolConfigRequest(request); }, nullptr,
+                 [this](AsyncWebServerRequest* request, uint8_t* data, size_t length, size_t index, size_t total) {
+                     handleProtocolConfigBody(request, data, length, index, total);
+                 });
+    webServer.on("/config/protocols", HTTP_GET,
+                 [this](AsyncWebServerRequest* request) { handleProtocolConfigReport(request); });
+    webServer.on("/config", HTTP_GET, [this](AsyncWebServerRequest* request) { handleConfig(request); });
+    webServer.on("/progress", HTTP_GET, [this](AsyncWebServerRequest* request) { handleUpdateProgress(request); });
+    webServer.on("/status", HTTP_GET, [this](AsyncWebServerRequest* request) { handleSystemStatus(request); });
+    webServer.on("/capture/start", HTTP_POST, [this](AsyncWebServerRequest* request) {
+        handleCaptureRequest(request, true);
+    });
+    webServer.on("/capture/stop", HTTP_POST, [this](AsyncWebServerRequest* request) {
+        handleCaptureRequest(request, false);
+    });
+    webServer.on("/capture", HTTP_GET, [this](AsyncWebServerRequest* request) { handleCaptureDownload(request); });
+    webServer.on("/boot", HTTP_GET, [this](AsyncWebServerRequest* request) { handleBootTimeline(request); });
+    webServer.onNotFound([this](AsyncWebServerRequest* request) { handleNotFound(request); });
+    telemetry.begin(webServer);
+}
+
+bool Maintenance::mountStorage() {
     if (!SPIFFS.begin(true)) {
         setError("Failed to mount SPIFFS");
-        return;
+        return false;
     }
     
     // Create backup directory if it doesn't exist
@@ -34,30 +84,29 @@ void Maintenance::begin() {
         setError("Failed to load configuration");
     }
 
-    // Setup web server routes
-    webServer.on("/", HTTP_GET, [this]() { handleRoot(); });
-    webServer.on("/update", HTTP_POST, [this]() { handleUpdate(); });
-    webServer.on("/backup", HTTP_POST, [this]() { handleBackup(); });
-    webServer.on("/restore", HTTP_POST, [this]() { handleRestore(); });
-    webServer.on("/factory-reset", HTTP_POST, [this]() { handleFactoryReset(); });
-    webServer.on("/config", HTTP_GET, [this]() { handleConfig(); });
-    webServer.on("/progress", HTTP_GET, [this]() { handleUpdateProgress(); });
-    webServer.on("/status", HTTP_GET, [this]() { handleSystemStatus(); });
-    webServer.onNotFound([this]() { handleNotFound(); });
+    // Snapshots cover every persisted config store
+    snapshots.setRoot(config.backupPath.c_str());
+    addSnapshotFile("maintenance", "/config.json");
+    addSnapshotFile("protocol", "/protocol_config.json");
+    return true;
 }
 
 void Maintenance::update() {
     if (webServerRunning) {
-        webServer.handleClient();
+        telemetry.setMaintenanceStatus(static_cast<int>(currentState.load()), updateProgress);
+        telemetry.update();
+    }
+
+    if (currentState == MaintenanceState::IDLE) {
+        startNextJob();
     }
 
     switch (currentState) {
         case MaintenanceState::CHECKING_UPDATE:
-            if (checkForUpdates()) {
-                currentState = MaintenanceState::DOWNLOADING_UPDATE;
-            } else {
-                currentState = MaintenanceState::IDLE;
-            }
+            // A successful update restarts; "No update available" is not
+            // a failure. Either way the queue goes on from IDLE.
+            finishJob(checkForUpdates() || lastError.isEmpty());
+            currentState = MaintenanceState::IDLE;
             break;
             
         case MaintenanceState::DOWNLOADING_UPDATE:
@@ -69,27 +118,19 @@ void Maintenance::update() {
             break;
             
         case MaintenanceState::BACKING_UP:
-            if (backupSystem()) {
-                currentState = MaintenanceState::IDLE;
-            } else {
-                currentState = MaintenanceState::ERROR;
-            }
+            // A failure stays on the job and in lastError; the queue moves on
+            finishJob(backupSystem());
+            currentState = MaintenanceState::IDLE;
             break;
             
         case MaintenanceState::RESTORING:
-            if (restoreSystem()) {
-                currentState = MaintenanceState::IDLE;
-            } else {
-                currentState = MaintenanceState::ERROR;
-            }
+            finishJob(restoreSystem());
+            currentState = MaintenanceState::IDLE;
             break;
             
         case MaintenanceState::FACTORY_RESET:
-            if (factoryReset()) {
-                currentState = MaintenanceState::IDLE;
-            } else {
-                currentState = MaintenanceState::ERROR;
-            }
+            finishJob(factoryReset());
+            currentState = MaintenanceState::IDLE;
             break;
             
         default:
@@ -107,7 +148,7 @@ void Maintenance::startWebServer() {
 
 void Maintenance::stopWebServer() {
     if (webServerRunning) {
-        webServer.close();
+        webServer.end();
         webServerRunning = false;
         logMaintenanceEvent("Web server stopped");
     }
@@ -117,89 +158,291 @@ bool Maintenance::isWebServerRunning() const {
     return webServerRunning;
 }
 
-void Maintenance::handleRoot() {
-    String html = "<html><body>";
-    html += "<h1>CERISE Gateway Maintenance</h1>";
-    html += "<p>Device ID: " + config.deviceId + "</p>";
-    html += "<p>Firmware Version: " + config.firmwareVersion + "</p>";
-    html += "<p><a href='/update'>Check for Updates</a></p>";
-    html += "<p><a href='/backup'>Create Backup</a></p>";
-    html += "<p><a href='/restore'>Restore from Backup</a></p>";
-    html += "<p><a href='/factory-reset'>Factory Reset</a></p>";
-    html += "<p><a href='/config'>Configuration</a></p>";
-    html += "<p><a href='/status'>System Status</a></p>";
-    html += "</body></html>";
-    webServer.send(200, "text/html", html);
-}
-
-void Maintenance::handleUpdate() {
-    if (checkForUpdates()) {
-        webServer.send(200, "text/plain", "Update started");
-    } else {
-        webServer.send(400, "text/plain", "No updates available");
+TelemetryHub& Maintenance::getTelemetry() {
+    return telemetry;
+}
+
+void Maintenance::setProgressHook(std::function<void()> hook) {
+    progressHook = hook;
+}
+
+void Maintenance::setCaptureControl(std::function<bool(bool start, bool toFlash)> control) {
+    captureControl = control;
+}
+
+void Maintenance::setBootTimeline(std::function<String()> timeline) {
+    bootTimeline = timeline;
+}
+
+void Maintenance::setProtocolConfigControl(std::function<bool(const String& json)> control) {
+    protocolConfigControl = control;
+}
+
+void Maintenance::setProtocolConfigReport(std::function<String()> report) {
+    protocolConfigReport = report;
+}
+
+void Maintenance::setProtocolConfigRestore(std::function<bool(const String& json)> restore) {
+    protocolConfigRestore = restore;
+}
+
+uint32_t Maintenance::queueJob(MaintenanceState action) {
+    uint32_t id = 0;
+    xSemaphoreTake(stateMutex, portMAX_DELAY);
+    // Reuse the oldest finished slot; refuse when every slot is pending
+    MaintenanceJob* slot = nullptr;
+    for (size_t i = 0; i < MAX_JOBS; i++) {
+        MaintenanceJob& job = jobs[i];
+        bool free = job.id == 0 || job.status == MaintenanceJobStatus::DONE
+                    || job.status == MaintenanceJobStatus::FAILED;
+        if (free && (slot == nullptr || job.id < slot->id)) {
+            slot = &job;
+        }
     }
+    if (slot != nullptr) {
+        id = nextJobId++;
+        slot->id = id;
+        slot->action = action;
+        slot->status = MaintenanceJobStatus::QUEUED;
+        slot->message[0] = '\0';
+    }
+    xSemaphoreGive(stateMutex);
+    return id;
 }
 
-void Maintenance::handleBackup() {
-    if (backupSystem()) {
-        webServer.send(200, "text/plain", "Backup created successfully");
-    } else {
-        webServer.send(500, "text/plain", "Backup failed: " + lastError);
+bool Maintenance::getJob(uint32_t id, MaintenanceJob& job) const {
+    bool found = false;
+    xSemaphoreTake(stateMutex, portMAX_DELAY);
+    for (size_t i = 0; i < MAX_JOBS; i++) {
+        if (id != 0 && jobs[i].id == id) {
+            job = jobs[i];
+            found = true;
+            break;
+        }
     }
+    xSemaphoreGive(stateMutex);
+    return found;
 }
 
-void Maintenance::handleRestore() {
-    if (restoreSystem()) {
-        webServer.send(200, "text/plain", "System restored successfully");
-    } else {
-        webServer.send(500, "text/plain", "Restore failed: " + lastError);
+void Maintenance::startNextJob() {
+    MaintenanceJob* next = nullptr;
+    xSemaphoreTake(stateMutex, portMAX_DELAY);
+    for (size_t i = 0; i < MAX_JOBS; i++) {
+        if (jobs[i].id != 0 && jobs[i].status == MaintenanceJobStatus::QUEUED
+            && (next == nullptr || jobs[i].id < next->id)) {
+            next = &jobs[i];
+        }
+    }
+    if (next != nullptr) {
+        next->status = MaintenanceJobStatus::RUNNING;
+        activeJobId = next->id;
+        currentState = next->action;
+    }
+    xSemaphoreGive(stateMutex);
+
+    if (next != nullptr) {
+        clearError();
     }
 }
 
-void Maintenance::handleFactoryReset() {
-    if (factoryReset()) {
-        webServer.send(200, "text/plain", "Factory reset completed");
-    } else {
-        webServer.send(500, "text/plain", "Factory reset failed: " + lastError);
+void Maintenance::finishJob(bool success) {
+    if (activeJobId == 0) {
+        return;
     }
+    xSemaphoreTake(stateMutex, portMAX_DELAY);
+    for (size_t i = 0; i < MAX_JOBS; i++) {
+        if (jobs[i].id == activeJobId) {
+            jobs[i].status = success ? MaintenanceJobStatus::DONE : MaintenanceJobStatus::FAILED;
+            strlcpy(jobs[i].message, lastError.c_str(), sizeof(jobs[i].message));
+            break;
+        }
+    }
+    activeJobId = 0;
+    xSemaphoreGive(stateMutex);
+}
+
+// Writes a JSON string literal without building an intermediate String
+static void printJsonString(Print& out, const char* value) {
+    out.print('"');
+    for (const char* c = value; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            out.print('\\');
+            out.print(*c);
+        } else if ((uint8_t)*c < 0x20) {
+            out.printf("\\u%04x", *c);
+        } else {
+            out.print(*c);
+        }
+    }
+    out.print('"');
+}
+
+static const char* jobStatusName(MaintenanceJobStatus status) {
+    switch (status) {
+        case MaintenanceJobStatus::QUEUED:
+            return "queued";
+        case MaintenanceJobStatus::RUNNING:
+            return "running";
+        case MaintenanceJobStatus::DONE:
+            return "done";
+        default:
+            return "failed";
+    }
+}
+
+void Maintenance::handleRoot(AsyncWebServerRequest* request) {
+    AsyncResponseStream* response = request->beginResponseStream("text/html");
+    response->print("<html><body>");
+    response->print("<h1>CERISE Gateway Maintenance</h1>");
+    response->printf("<p>Device ID: %s</p>", config.deviceId.c_str());
+    response->printf("<p>Firmware Version: %s</p>", config.firmwareVersion.c_str());
+    response->print("<p><a href='/update'>Check for Updates</a></p>");
+    response->print("<p><a href='/backup'>Create Backup</a></p>");
+    response->print("<p><a href='/restore'>Restore from Backup</a></p>");
+    response->print("<p><a href='/factory-reset'>Factory Reset</a></p>");
+    response->print("<p><a href='/config'>Configuration</a></p>");
+    response->print("<p><a href='/config/protocols'>Last Protocol Config Change</a></p>");
+    response->print("<p><a href='/status'>System Status</a></p>");
+    response->print("</body></html>");
+    request->send(response);
+}
+
+void Maintenance::handleJobRequest(AsyncWebServerRequest* request, MaintenanceState action) {
+    uint32_t id = queueJob(action);
+    if (id == 0) {
+        request->send(503, "application/json", "{\"error\":\"Job queue full\"}");
+        return;
+    }
+
+    AsyncResponseStream* response = request->beginResponseStream("application/json");
+    response->setCode(202);
+    response->addHeader("Location", "/jobs?id=" + String(id));
+    response->printf("{\"job\":%u,\"status\":\"queued\"}", (unsigned)id);
+    request->send(response);
 }
 
-void Maintenance::handleConfig() {
-    DynamicJsonDocument doc(1024);
-    doc["deviceId"] = config.deviceId;
-    doc["firmwareVersion"] = config.firmwareVersion;
-    doc["autoUpdate"] = config.autoUpdate;
-    doc["updateServer"] = config.updateServer;
-    
-    String response;
-    serializeJson(doc, response);
-    webServer.send(200, "application/json", response);
+void Maintenance::handleJobStatus(AsyncWebServerRequest* request) {
+    MaintenanceJob job;
+    if (!request->hasParam("id") || !getJob(request->getParam("id")->value().toInt(), job)) {
+        request->send(404, "application/json", "{\"error\":\"Unknown job\"}");
+        return;
+    }
+
+    AsyncResponseStream* response = request->beginResponseStream("application/json");
+    response->printf("{\"job\":%u,\"action\":%d,\"status\":\"%s\",\"message\":",
+                     (unsigned)job.id, static_cast<int>(job.action), jobStatusName(job.status));
+    printJsonString(*response, job.message);
+    response->print('}');
+    request->send(response);
+}
+
+void Maintenance::handleConfig(AsyncWebServerRequest* request) {
+    AsyncResponseStream* response = request->beginResponseStream("application/json");
+    response->print("{\"deviceId\":");
+    printJsonString(*response, config.deviceId.c_str());
+    response->print(",\"firmwareVersion\":");
+    printJsonString(*response, config.firmwareVersion.c_str());
+    response->printf(",\"autoUpdate\":%s,\"updateServer\":", config.autoUpdate ? "true" : "false");
+    printJsonString(*response, config.updateServer.c_str());
+    response->print('}');
+    request->send(response);
+}
+
+void Maintenance::handleUpdateProgress(AsyncWebServerRequest* request) {
+    AsyncResponseStream* response = request->beginResponseStream("application/json");
+    response->printf("{\"progress\":%.1f,\"state\":%d}", updateProgress.load(),
+                     static_cast<int>(currentState.load()));
+    request->send(response);
+}
+
+void Maintenance::handleSystemStatus(AsyncWebServerRequest* request) {
+    char error[64];
+    xSemaphoreTake(stateMutex, portMAX_DELAY);
+    strlcpy(error, lastError.c_str(), sizeof(error));
+    xSemaphoreGive(stateMutex);
+
+    AsyncResponseStream* response = request->beginResponseStream("application/json");
+    response->printf("{\"state\":%d,\"error\":", static_cast<int>(currentState.load()));
+    printJsonString(*response, error);
+    response->printf(",\"webServerRunning\":%s,\"remoteDebugEnabled\":%s}",
+                     webServerRunning ? "true" : "false",
+                     remoteDebugEnabled ? "true" : "false");
+    request->send(response);
+}
+
+void Maintenance::handleCaptureRequest(AsyncWebServerRequest* request, bool start) {
+    bool toFlash = request->hasParam("target") && request->getParam("target")->value() == "flash";
+    if (!captureControl || !captureControl(start, toFlash)) {
+        request->send(503, "application/json", "{\"error\":\"Capture unavailable\"}");
+        return;
+    }
+    AsyncResponseStream* response = request->beginResponseStream("application/json");
+    response->setCode(202);
+    response->printf("{\"capture\":\"%s\",\"target\":\"%s\"}", start ? "starting" : "stopping",
+                     toFlash ? "flash" : "ram");
+    request->send(response);
 }
 
-void Maintenance::handleUpdateProgress() {
-    DynamicJsonDocument doc(256);
-    doc["progress"] = updateProgress;
-    doc["state"] = static_cast<int>(currentState);
-    
-    String response;
-    serializeJson(doc, response);
-    webServer.send(200, "application/json", response);
+void Maintenance::handleCaptureDownload(AsyncWebServerRequest* request) {
+    if (!SPIFFS.exists(CAPTURE_TRACE_FILE)) {
+        request->send(404, "application/json", "{\"error\":\"No capture\"}");
+        return;
+    }
+    request->send(SPIFFS, CAPTURE_TRACE_FILE, "application/octet-stream", true);
 }
 
-void Maintenance::handleSystemStatus() {
-    DynamicJsonDocument doc(512);
-    doc["state"] = static_cast<int>(currentState);
-    doc["error"] = lastError;
-    doc["webServerRunning"] = webServerRunning;
-    doc["remoteDebugEnabled"] = remoteDebugEnabled;
-    
-    String response;
-    serializeJson(doc, response);
-    webServer.send(200, "application/json", response);
+void Maintenance::handleBootTimeline(AsyncWebServerRequest* request) {
+    if (!bootTimeline) {
+        request->send(404, "application/json", "{\"error\":\"No boot timeline\"}");
+        return;
+    }
+    request->send(200, "application/json", bootTimeline());
+}
+
+void Maintenance::handleProtocolConfigBody(AsyncWebServerRequest* request, uint8_t* data, size_t length,
+                                           size_t index, size_t total) {
+    // Collected in the request's scratch pointer, which the server frees
+    if (total > MAX_CONFIG_BODY) {
+        return;
+    }
+    if (index == 0) {
+        request->_tempObject = malloc(total + 1);
+    }
+    char* body = (char*)request->_tempObject;
+    if (body == nullptr || index + length > total) {
+        return;
+    }
+    memcpy(body + index, data, length);
+    body[index + length] = '\0';
 }
 
-void Maintenance::handleNotFound() {
-    webServer.send(404, "text/plain", "Not found");
+void Maintenance::handleProtocolConfigRequest(AsyncWebServerRequest* request) {
+    const char* body = (const char*)request->_tempObject;
+    if (body == nullptr || body[0] == '\0') {
+        request->send(400, "application/json", "{\"error\":\"Expected a JSON object of at most 2048 bytes\"}");
+        return;
+    }
+    if (!protocolConfigControl || !protocolConfigControl(String(body))) {
+        request->send(503, "application/json", "{\"error\":\"Config change unavailable\"}");
+        return;
+    }
+    AsyncResponseStream* response = request->beginResponseStream("application/json");
+    response->setCode(202);
+    response->addHeader("Location", "/config/protocols");
+    response->print("{\"status\":\"queued\"}");
+    request->send(response);
+}
+
+void Maintenance::handleProtocolConfigReport(AsyncWebServerRequest* request) {
+    if (!protocolConfigReport) {
+        request->send(404, "application/json", "{\"error\":\"No config change yet\"}");
+        return;
+    }
+    request->send(200, "application/json", protocolConfigReport());
+}
+
+void Maintenance::handleNotFound(AsyncWebServerRequest* request) {
+    request->send(404, "text/plain", "Not found");
 }
 
 bool Maintenance::checkForUpdates() {
@@ -233,6 +476,15 @@ bool Maintenance::checkForUpdates() {
     String latestVersion = doc["version"].as<String>();
     if (latestVersion != config.firmwareVersion) {
         String updateUrl = doc["url"].as<String>();
+
+        // Prefer a binary diff against the running image when the server offers one
+        JsonObject delta = doc["delta"];
+        if (!delta.isNull() && delta["from"].as<String>() == config.firmwareVersion) {
+            if (performDeltaUpdate(delta["url"].as<String>(), delta["md5"] | "")) {
+                return true;
+            }
+            logMaintenanceEvent("Delta update failed, falling back to full image");
+        }
         return performUpdate(updateUrl);
     }
 
@@ -268,88 +520,238 @@ bool Maintenance::performUpdate(const String& url) {
         return false;
     }
 
+    // Chunked instead of Update.writeStream(), which blocks for as long as
+    // the server keeps the socket open without sending anything
     WiFiClient * stream = http.getStreamPtr();
-    size_t written = Update.writeStream(*stream);
+    uint8_t buffer[1024];
+    int written = 0;
+    unsigned long lastData = millis();
+    while (written < contentLength && http.connected()) {
+        size_t available = stream->available();
+        if (available == 0) {
+            if (millis() - lastData > OTA_STALL_TIMEOUT_MS) {
+                break;
+            }
+            delay(1);
+            continue;
+        }
+        lastData = millis();
+        int count = stream->readBytes(buffer, available > sizeof(buffer) ? sizeof(buffer) : available);
+        if (Update.write(buffer, count) != (size_t)count) {
+            break;
+        }
+        written += count;
+        updateProgress = 100.0f * written / contentLength;
+        if (progressHook) {
+            progressHook();
+        }
+    }
+    http.end();
     
     if (written == contentLength && Update.end()) {
         logMaintenanceEvent("Update successful");
         ESP.restart();
         return true;
     } else {
-        setError("Update failed");
+        Update.abort();
+        setError(written < contentLength ? "Update stalled at " + String(written) + " bytes" : "Update failed");
         return false;
     }
 }
 
-bool Maintenance::backupSystem() {
-    String backupFile = config.backupPath + "/backup_" + String(millis()) + ".json";
-    File file = SPIFFS.open(backupFile, "w");
-    
-    if (!file) {
-        setError("Failed to create backup file");
+bool Maintenance::performDeltaUpdate(const String& url, const String& md5) {
+    if (WiFi.status() != WL_CONNECTED) {
+        setError("No WiFi connection");
         return false;
     }
 
-    DynamicJsonDocument doc(2048);
-    doc["deviceId"] = config.deviceId;
-    doc["firmwareVersion"] = config.firmwareVersion;
-    doc["timestamp"] = String(millis());
-    
-    // Add system configuration
-    JsonObject systemConfig = doc.createNestedObject("systemConfig");
-    systemConfig["autoUpdate"] = config.autoUpdate;
-    systemConfig["updateServer"] = config.updateServer;
-    
-    if (serializeJson(doc, file) == 0) {
-        setError("Failed to write backup data");
-        file.close();
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    if (running == nullptr) {
+        setError("Running partition not found");
+        return false;
+    }
+    // The patch is built against the .bin, not the partition: past the image
+    // end the partition holds erased 0xFF where the patcher expects zeros
+    esp_partition_pos_t position = {running->address, running->size};
+    esp_image_metadata_t image;
+    if (esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &position, &image) != ESP_OK) {
+        setError("Running image does not verify");
         return false;
     }
 
-    file.close();
-    logMaintenanceEvent("Backup created: " + backupFile);
-    return true;
-}
+    HTTPClient http;
+    http.begin(url);
 
-bool Maintenance::restoreSystem() {
-    File root = SPIFFS.open(config.backupPath);
-    if (!root) {
-        setError("Failed to open backup directory");
+    int httpCode = http.GET();
+    if (httpCode != HTTP_CODE_OK) {
+        setError("Failed to download patch: " + String(httpCode));
+        http.end();
         return false;
     }
 
-    File file = root.openNextFile();
-    if (!file) {
-        setError("No backup files found");
+    // Target size is only known once the patch header arrives, so let
+    // Update size the write from the OTA partition itself
+    if (!Update.begin(UPDATE_SIZE_UNKNOWN)) {
+        setError("Not enough space for update");
+        http.end();
+        return false;
+    }
+    if (!md5.isEmpty()) {
+        Update.setMD5(md5.c_str());
+    }
+
+    deltaPatcher.begin(
+        [running](uint32_t offset, uint8_t* buffer, size_t length) {
+            return esp_partition_read(running, offset, buffer, length) == ESP_OK;
+        },
+        [](const uint8_t* data, size_t length) {
+            return Update.write(const_cast<uint8_t*>(data), length) == length;
+        },
+        image.image_len);
+
+    currentState = MaintenanceState::INSTALLING_UPDATE;
+    updateProgress = 0.0f;
+
+    WiFiClient* stream = http.getStreamPtr();
+    int remaining = http.getSize();
+    uint8_t buffer[512];
+    bool ok = true;
+    unsigned long lastData = millis();
+    while (ok && http.connected() && (remaining > 0 || remaining == -1)) {
+        size_t available = stream->available();
+        if (available == 0) {
+            if (millis() - lastData > OTA_STALL_TIMEOUT_MS) {
+                break;
+            }
+            delay(1);
+            continue;
+        }
+        lastData = millis();
+        int count = stream->readBytes(buffer, available > sizeof(buffer) ? sizeof(buffer) : available);
+        ok = deltaPatcher.write(buffer, count);
+        if (remaining > 0) {
+            remaining -= count;
+        }
+        if (deltaPatcher.getTargetSize() > 0) {
+            updateProgress = 100.0f * deltaPatcher.getBytesWritten() / deltaPatcher.getTargetSize();
+        }
+        // The network task is blocked here, so keep dashboards fed with OTA progress
+        telemetry.setMaintenanceStatus(static_cast<int>(currentState.load()), updateProgress);
+        telemetry.update();
+        if (progressHook) {
+            progressHook();
+        }
+    }
+    http.end();
+
+    if (!ok || !deltaPatcher.finish()) {
+        setError(String("Delta patch failed: ") + deltaPatcher.getLastError());
+        Update.abort();
         return false;
     }
 
-    DynamicJsonDocument doc(2048);
-    DeserializationError error = deserializeJson(doc, file);
-    file.close();
-    
-    if (error) {
-        setError("Failed to parse backup data");
+    // Update.end() checks the MD5 of the reconstructed image
+    if (!Update.end(true)) {
+        setError("Delta update verification failed");
         return false;
     }
 
-    // Restore configuration
-    config.deviceId = doc["deviceId"].as<String>();
-    config.firmwareVersion = doc["firmwareVersion"].as<String>();
-    
-    JsonObject systemConfig = doc["systemConfig"];
-    config.autoUpdate = systemConfig["autoUpdate"] | true;
-    config.updateServer = systemConfig["updateServer"] | config.updateServer;
+    logMaintenanceEvent("Delta update successful");
+    ESP.restart();
+    return true;
+}
 
+bool Maintenance::backupSystem() {
+    // Make sure the snapshot sees the in-memory configuration
     if (!saveConfig()) {
-        setError("Failed to save restored configuration");
         return false;
     }
 
-    logMaintenanceEvent("System restored from backup");
+    if (!snapshots.create(millis())) {
+        setError(String("Backup failed: ") + snapshots.getLastError().c_str());
+        return false;
+    }
+
+    const SnapshotStats& stats = snapshots.getStats();
+    logMaintenanceEvent("Snapshot " + String(snapshots.getLatestSequence()) + " created ("
+                        + String(stats.chunksWritten) + " chunks written, "
+                        + String(stats.chunksReused) + " reused)");
     return true;
 }
 
+bool Maintenance::restoreSystem() {
+    rebootNeededFor = "";
+    if (!snapshots.restoreLatest()) {
+        setError(String("Restore failed: ") + snapshots.getLastError().c_str());
+        return false;
+    }
+
+    if (!loadConfig()) {
+        setError("Failed to load restored configuration");
+        return false;
+    }
+
+    logMaintenanceEvent("System restored from snapshot " + String(snapshots.getRestoredSequence()));
+    // The protocol manager belongs to the network task; queue the restored
+    // fields like a change from the web UI, so only what differs reconnects
+    std::vector<uint8_t> protocolConfig;
+    if (snapshotStorage.readFile("/protocol_config.json", protocolConfig) && !protocolConfig.empty()) {
+        String json;
+        json.concat((const char*)protocolConfig.data(), protocolConfig.size());
+        if (!protocolConfigRestore || !protocolConfigRestore(json)) {
+            noteRebootNeeded("protocol");
+        }
+    }
+    if (!rebootNeededFor.isEmpty()) {
+        // Kept on the job, which still succeeded
+        setError("Restored; reboot to apply " + rebootNeededFor);
+    }
+    return true;
+}
+
+void Maintenance::addSnapshotSource(const String& name,
+                                    std::function<bool(std::vector<uint8_t>&)> exportData,
+                                    std::function<bool(const uint8_t*, size_t)> importData) {
+    snapshots.addSource(name.c_str(), exportData, importData);
+}
+
+void Maintenance::addSnapshotFile(const String& name, const String& path, bool readAtBoot) {
+    std::string filePath = path.c_str();
+    snapshots.addSource(name.c_str(),
+        [this, filePath](std::vector<uint8_t>& data) {
+            // A store that was never saved is snapshotted as empty
+            return !snapshotStorage.exists(filePath) || snapshotStorage.readFile(filePath, data);
+        },
+        [this, filePath, name, readAtBoot](const uint8_t* data, size_t length) {
+            std::vector<uint8_t> current;
+            if (snapshotStorage.exists(filePath) && !snapshotStorage.readFile(filePath, current)) {
+                current.clear();
+            }
+            if (current.size() == length && std::equal(current.begin(), current.end(), data)) {
+                return true;
+            }
+            if (readAtBoot) {
+                noteRebootNeeded(name);
+            }
+            // Snapshotted empty because it was never saved: remove it again
+            if (length == 0) {
+                return snapshotStorage.remove(filePath);
+            }
+            return snapshotStorage.writeFile(filePath, data, length);
+        });
+}
+
+void Maintenance::noteRebootNeeded(const String& name) {
+    if (!rebootNeededFor.isEmpty()) {
+        rebootNeededFor += ", ";
+    }
+    rebootNeededFor += name;
+}
+
+void Maintenance::setBackupRetention(size_t count) {
+    snapshots.setRetention(count);
+}
+
 bool Maintenance::factoryReset() {
     if (!formatStorage()) {
         setError("Failed to format storage");
@@ -462,15 +864,74 @@ bool Maintenance::formatStorage() {
 }
 
 void Maintenance::setError(const String& error) {
+    if (stateMutex != nullptr) {
+        xSemaphoreTake(stateMutex, portMAX_DELAY);
+    }
     lastError = error;
+    if (stateMutex != nullptr) {
+        xSemaphoreGive(stateMutex);
+    }
     logMaintenanceEvent("Error: " + error);
 }
 
 void Maintenance::clearError() {
+    if (stateMutex != nullptr) {
+        xSemaphoreTake(stateMutex, portMAX_DELAY);
+    }
     lastError = "";
+    if (stateMutex != nullptr) {
+        xSemaphoreGive(stateMutex);
+    }
 }
 
 void Maintenance::logMaintenanceEvent(const String& event) {
     // TODO: Implement proper logging system
     Serial.println("[Maintenance] " + event);
-} 
\ No newline at end of file
+} 
+
+bool SpiffsSnapshotStorage::writeFile(const std::string& path, const uint8_t* data, size_t length) {
+    File file = SPIFFS.open(path.c_str(), "w");
+    if (!file) {
+        return false;
+    }
+    size_t written = file.write(data, length);
+    file.close();
+    return written == length;
+}
+
+bool SpiffsSnapshotStorage::readFile(const std::string& path, std::vector<uint8_t>& data) {
+    File file = SPIFFS.open(path.c_str(), "r");
+    if (!file) {
+        return false;
+    }
+    data.resize(file.size());
+    size_t count = file.read(data.data(), data.size());
+    file.close();
+    return count == data.size();
+}
+
+bool SpiffsSnapshotStorage::exists(const std::string& path) {
+    return SPIFFS.exists(path.c_str());
+}
+
+bool SpiffsSnapshotStorage::remove(const std::string& path) {
+    return SPIFFS.remove(path.c_str());
+}
+
+void SpiffsSnapshotStorage::list(const std::string& prefix, std::vector<std::string>& paths) {
+    // SPIFFS is flat: open the parent "directory" and filter on the full prefix
+    size_t slash = prefix.find_last_of('/');
+    std::string directory = slash == 0 ? "/" : prefix.substr(0, slash);
+    File dir = SPIFFS.open(directory.c_str());
+    if (!dir) {
+        return;
+    }
+    File file = dir.openNextFile();
+    while (file) {
+        std::string path = file.path();
+        if (path.compare(0, prefix.size(), prefix) == 0) {
+            paths.push_back(path);
+        }
+        file = dir.openNextFile();
+    }
+}
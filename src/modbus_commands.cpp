@@ -0,0 +1,373 @@
+#include "modbus_commands.h"
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+static uint32_t commandClock() {
+#ifdef ARDUINO
+    return millis();
+#else
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+ModbusCommandQueue::ModbusCommandQueue(ModbusRtuMaster& master)
+    : master(master)
+    , clock(commandClock)
+    , nextSequence(0)
+    , lastUnit(0)
+    , phase(Phase::IDLE)
+    , batchUnit(0)
+    , batchStart(0)
+    , batchCount(0)
+    , batchVerify(false)
+{
+    memset(entries, 0, sizeof(entries));
+    memset(&stats, 0, sizeof(stats));
+}
+
+void ModbusCommandQueue::setClock(uint32_t (*clock)()) {
+    this->clock = clock;
+}
+
+void ModbusCommandQueue::setAckCallback(AckCallback callback) {
+    ackCallback = callback;
+}
+
+void ModbusCommandQueue::setWriteCallback(WriteCallback callback) {
+    writeCallback = callback;
+}
+
+bool ModbusCommandQueue::addWritableRange(uint8_t unit, uint16_t start, uint16_t count) {
+    if (count == 0 || (uint32_t)start + count > 0x10000) {
+        return false;
+    }
+    WritableRange range = {unit, start, count};
+    writable.push_back(range);
+    return true;
+}
+
+void ModbusCommandQueue::clearWritableRanges() {
+    writable.clear();
+}
+
+bool ModbusCommandQueue::isWritable(uint8_t unit, uint16_t start, uint16_t count) const {
+    for (size_t i = 0; i < writable.size(); i++) {
+        const WritableRange& range = writable[i];
+        if (range.unit == unit && start >= range.start &&
+            (uint32_t)start + count <= (uint32_t)range.start + range.count) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ModbusCommandQueue::submit(const ModbusCommand& command) {
+    stats.submitted++;
+    // Unit 0 is broadcast and gets no reply, so it cannot be acknowledged
+    if (command.id[0] == '\0' || memchr(command.id, '\0', sizeof(command.id)) == nullptr ||
+        command.unit == 0 || command.unit > 247 ||
+        command.count == 0 || command.count > ModbusRtuMaster::MAX_WRITE_REGISTERS ||
+        (uint32_t)command.start + command.count > 0x10000 ||
+        !isWritable(command.unit, command.start, command.count)) {
+        reject(command, CommandStatus::REJECTED);
+        return false;
+    }
+
+    Entry* slot = nullptr;
+    for (size_t i = 0; i < MAX_COMMANDS && !slot; i++) {
+        if (!entries[i].used) {
+            slot = &entries[i];
+        }
+    }
+    if (!slot) {
+        reject(command, CommandStatus::QUEUE_FULL);
+        return false;
+    }
+
+    uint32_t now = clock();
+    slot->used = true;
+    slot->inFlight = false;
+    slot->deferred = false;
+    slot->sequence = nextSequence++;
+    slot->receivedAt = now;
+    slot->expiresAt = now + (command.expiryMs ? command.expiryMs : DEFAULT_EXPIRY_MS);
+    slot->attempts = 0;
+    slot->command = command;
+    return true;
+}
+
+void ModbusCommandQueue::update() {
+    uint32_t now = clock();
+    for (size_t i = 0; i < MAX_COMMANDS; i++) {
+        Entry& entry = entries[i];
+        if (entry.used && !entry.inFlight && (int32_t)(now - entry.expiresAt) >= 0) {
+            acknowledge(entry, CommandStatus::EXPIRED, ModbusException::NONE);
+        }
+    }
+}
+
+bool ModbusCommandQueue::dispatch(uint32_t now, uint32_t pollDueInMs) {
+    if (phase != Phase::IDLE || master.isBusy()) {
+        return false;
+    }
+    Entry* first = selectNext();
+    if (!first) {
+        return false;
+    }
+    buildBatch(*first);
+
+    // Polls keep their period unless the command has waited long enough
+    if (estimateMs() > pollDueInMs && first->command.priority != URGENT_PRIORITY &&
+        now - first->receivedAt < MAX_DEFER_MS) {
+        for (size_t i = 0; i < MAX_COMMANDS; i++) {
+            Entry& entry = entries[i];
+            if (entry.used && entry.inFlight) {
+                entry.inFlight = false;
+                if (!entry.deferred) {
+                    entry.deferred = true;
+                    stats.deferred++;
+                }
+            }
+        }
+        return false;
+    }
+    lastUnit = batchUnit;
+    return startWrite();
+}
+
+bool ModbusCommandQueue::isActive() const {
+    return phase != Phase::IDLE;
+}
+
+size_t ModbusCommandQueue::getPendingCount() const {
+    size_t count = 0;
+    for (size_t i = 0; i < MAX_COMMANDS; i++) {
+        if (entries[i].used) {
+            count++;
+        }
+    }
+    return count;
+}
+
+const ModbusCommandStats& ModbusCommandQueue::getStats() const {
+    return stats;
+}
+
+ModbusCommandQueue::Entry* ModbusCommandQueue::selectNext() {
+    // Most urgent priority first; slaves take turns within it, each slave's
+    // commands in arrival order
+    Entry* best = nullptr;
+    uint8_t bestTurn = 0;
+    for (size_t i = 0; i < MAX_COMMANDS; i++) {
+        Entry& entry = entries[i];
+        if (!entry.used || entry.inFlight) {
+            continue;
+        }
+        uint8_t turn = (uint8_t)(entry.command.unit - lastUnit - 1);
+        if (!best || entry.command.priority < best->command.priority ||
+            (entry.command.priority == best->command.priority &&
+             (turn < bestTurn || (turn == bestTurn && entry.sequence < best->sequence)))) {
+            best = &entry;
+            bestTurn = turn;
+        }
+    }
+    return best;
+}
+
+void ModbusCommandQueue::buildBatch(Entry& first) {
+    batchUnit = first.command.unit;
+    uint32_t low = first.command.start;
+    uint32_t high = low + first.command.count;
+    first.inFlight = true;
+
+    // Grow the range while another pending write for the slave touches it
+    bool grown = true;
+    while (grown) {
+        grown = false;
+        for (size_t i = 0; i < MAX_COMMANDS; i++) {
+            Entry& entry = entries[i];
+            if (!entry.used || entry.inFlight || entry.command.unit != batchUnit) {
+                continue;
+            }
+            uint32_t start = entry.command.start;
+            uint32_t end = start + entry.command.count;
+            if (start > high || end < low) {
+                continue;
+            }
+            uint32_t newLow = start < low ? start : low;
+            uint32_t newHigh = end > high ? end : high;
+            if (newHigh - newLow > ModbusRtuMaster::MAX_WRITE_REGISTERS) {
+                continue;
+            }
+            low = newLow;
+            high = newHigh;
+            entry.inFlight = true;
+            grown = true;
+        }
+    }
+    batchStart = (uint16_t)low;
+    batchCount = (uint16_t)(high - low);
+
+    // Apply in arrival order so the newest value of a register wins
+    batchVerify = false;
+    size_t members = 0;
+    uint32_t applied = 0;
+    bool pendingApply = true;
+    while (pendingApply) {
+        Entry* oldest = nullptr;
+        for (size_t i = 0; i < MAX_COMMANDS; i++) {
+            Entry& entry = entries[i];
+            if (entry.used && entry.inFlight && (members == 0 || entry.sequence > applied) &&
+                (!oldest || entry.sequence < oldest->sequence)) {
+                oldest = &entry;
+            }
+        }
+        pendingApply = oldest != nullptr;
+        if (oldest) {
+            memcpy(batchValues + (oldest->command.start - batchStart), oldest->command.values,
+                   oldest->command.count * sizeof(uint16_t));
+            batchVerify = batchVerify || oldest->command.verify;
+            applied = oldest->sequence;
+            members++;
+        }
+    }
+    if (members > 1) {
+        stats.merged += members;
+    }
+}
+
+uint32_t ModbusCommandQueue::estimateMs() const {
+    // FC06 echoes 8 bytes; FC16 sends 9 + 2n and gets 8 back
+    size_t request = batchCount == 1 ? 8 : 9 + 2 * (size_t)batchCount;
+    uint32_t total = master.exchangeMs(request, 8) + TURNAROUND_MS;
+    if (batchVerify) {
+        total += master.exchangeMs(8, 5 + 2 * (size_t)batchCount) + TURNAROUND_MS;
+    }
+    return total;
+}
+
+bool ModbusCommandQueue::startWrite() {
+    for (size_t i = 0; i < MAX_COMMANDS; i++) {
+        if (entries[i].used && entries[i].inFlight) {
+            entries[i].attempts++;
+        }
+    }
+    stats.writes++;
+    phase = Phase::WRITING;
+    if (!master.write(batchUnit, batchStart, batchValues, batchCount,
+                      [this](uint8_t exception, const uint16_t*, uint16_t) { onWritten(exception); })) {
+        finishBatch(CommandStatus::EXCEPTION, ModbusException::GATEWAY_TARGET_NO_RESPONSE);
+        return false;
+    }
+    return true;
+}
+
+void ModbusCommandQueue::onWritten(uint8_t exception) {
+    if (exception == ModbusException::NONE) {
+        if (writeCallback) {
+            writeCallback(batchUnit, batchStart, batchCount);
+        }
+        if (!batchVerify) {
+            finishBatch(CommandStatus::OK, ModbusException::NONE);
+            return;
+        }
+        phase = Phase::VERIFYING;
+        if (!master.read(batchUnit, ModbusFunction::READ_HOLDING_REGISTERS, batchStart, batchCount,
+                         [this](uint8_t exception, const uint16_t* values, uint16_t count) {
+                             onVerified(exception, values, count);
+                         })) {
+            onVerified(ModbusException::GATEWAY_TARGET_NO_RESPONSE, nullptr, 0);
+        }
+        return;
+    }
+
+    // A lost or garbled frame, or a busy slave, is worth one more try
+    bool retry = exception == ModbusException::TIMEOUT || exception == ModbusException::BAD_FRAME ||
+                 exception == ModbusException::SLAVE_DEVICE_BUSY;
+    for (size_t i = 0; i < MAX_COMMANDS && retry; i++) {
+        if (entries[i].used && entries[i].inFlight && entries[i].attempts >= MAX_ATTEMPTS) {
+            retry = false;
+        }
+    }
+    if (!retry) {
+        finishBatch(CommandStatus::EXCEPTION, exception);
+        return;
+    }
+    for (size_t i = 0; i < MAX_COMMANDS; i++) {
+        entries[i].inFlight = false;
+    }
+    phase = Phase::IDLE;
+}
+
+void ModbusCommandQueue::onVerified(uint8_t exception, const uint16_t* values, uint16_t count) {
+    phase = Phase::IDLE;
+    for (size_t i = 0; i < MAX_COMMANDS; i++) {
+        Entry& entry = entries[i];
+        if (!entry.used || !entry.inFlight) {
+            continue;
+        }
+        if (!entry.command.verify) {
+            acknowledge(entry, CommandStatus::OK, ModbusException::NONE);
+            continue;
+        }
+        if (exception != ModbusException::NONE || count != batchCount) {
+            acknowledge(entry, CommandStatus::VERIFY_FAILED, exception);
+            continue;
+        }
+        // Compare against what the batch wrote: a newer merged command may
+        // have replaced this one's value
+        size_t offset = entry.command.start - batchStart;
+        bool match = memcmp(values + offset, batchValues + offset, entry.command.count * sizeof(uint16_t)) == 0;
+        acknowledge(entry, match ? CommandStatus::OK : CommandStatus::VERIFY_FAILED, ModbusException::NONE);
+    }
+}
+
+void ModbusCommandQueue::finishBatch(CommandStatus status, uint8_t exception) {
+    phase = Phase::IDLE;
+    for (size_t i = 0; i < MAX_COMMANDS; i++) {
+        if (entries[i].used && entries[i].inFlight) {
+            acknowledge(entries[i], status, exception);
+        }
+    }
+}
+
+void ModbusCommandQueue::acknowledge(Entry& entry, CommandStatus status, uint8_t exception) {
+    ModbusCommandAck ack;
+    memcpy(ack.id, entry.command.id, sizeof(ack.id));
+    ack.unit = entry.command.unit;
+    ack.status = status;
+    ack.exception = exception;
+    ack.attempts = entry.attempts;
+    ack.latencyMs = clock() - entry.receivedAt;
+    entry.used = false;
+    entry.inFlight = false;
+    if (status == CommandStatus::OK) {
+        stats.completed++;
+    } else {
+        stats.failed++;
+    }
+    if (ackCallback) {
+        ackCallback(ack);
+    }
+}
+
+void ModbusCommandQueue::reject(const ModbusCommand& command, CommandStatus status) {
+    stats.rejected++;
+    ModbusCommandAck ack;
+    memcpy(ack.id, command.id, sizeof(ack.id));
+    ack.id[sizeof(ack.id) - 1] = '\0';
+    ack.unit = command.unit;
+    ack.status = status;
+    ack.exception = ModbusException::NONE;
+    ack.attempts = 0;
+    ack.latencyMs = 0;
+    if (ackCallback) {
+        ackCallback(ack);
+    }
+}
@@ -0,0 +1,1021 @@
+#include "modbus_gateway.h"
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+static uint32_t defaultClock() {
+#ifdef ARDUINO
+    return millis();
+#else
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+uint16_t modbusCrc16(const uint8_t* data, size_t length) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (uint16_t)((crc >> 1) ^ 0xA001) : (uint16_t)(crc >> 1);
+        }
+    }
+    return crc;
+}
+
+static void putU16(uint8_t* data, uint16_t value) {
+    data[0] = (uint8_t)(value >> 8);
+    data[1] = (uint8_t)value;
+}
+
+static uint16_t getU16(const uint8_t* data) {
+    return (uint16_t)((data[0] << 8) | data[1]);
+}
+
+#ifdef ARDUINO
+bool StreamModbusSerial::write(const uint8_t* data, size_t length) {
+    // Drive the MAX485 only for the duration of the frame
+    digitalWrite(dePin, HIGH);
+    digitalWrite(rePin, HIGH);
+    size_t written = stream.write(data, length);
+    stream.flush();
+    digitalWrite(dePin, LOW);
+    digitalWrite(rePin, LOW);
+    return written == length;
+}
+
+int StreamModbusSerial::read(uint8_t* data, size_t capacity) {
+    size_t count = 0;
+    while (count < capacity && stream.available() > 0) {
+        data[count++] = (uint8_t)stream.read();
+    }
+    return (int)count;
+}
+
+bool WiFiModbusServerPort::begin(uint16_t port) {
+    this->port = port;
+    started = false;
+    return true;
+}
+
+int WiFiModbusServerPort::accept() {
+    // The listener can only be opened once the station has an address
+    if (!started) {
+        if (WiFi.status() != WL_CONNECTED) {
+            return -1;
+        }
+        server.begin(port);
+        server.setNoDelay(true);
+        started = true;
+    }
+    WiFiClient client = server.available();
+    if (!client) {
+        return -1;
+    }
+    for (size_t slot = 0; slot < MAX_CLIENTS; slot++) {
+        if (!clients[slot].connected()) {
+            clients[slot].stop();
+            clients[slot] = client;
+            return (int)slot;
+        }
+    }
+    client.stop();
+    return -1;
+}
+
+bool WiFiModbusServerPort::connected(int slot) {
+    return clients[slot].connected();
+}
+
+int WiFiModbusServerPort::read(int slot, uint8_t* data, size_t capacity) {
+    int available = clients[slot].available();
+    if (available <= 0) {
+        return 0;
+    }
+    return clients[slot].read(data, (size_t)available < capacity ? (size_t)available : capacity);
+}
+
+size_t WiFiModbusServerPort::write(int slot, const uint8_t* data, size_t length) {
+    return clients[slot].write(data, length);
+}
+
+void WiFiModbusServerPort::close(int slot) {
+    clients[slot].stop();
+}
+#else
+PosixModbusServerPort::PosixModbusServerPort()
+    : listener(-1)
+    , localPort(0)
+{
+    for (size_t slot = 0; slot < MAX_CLIENTS; slot++) {
+        clients[slot] = -1;
+    }
+}
+
+PosixModbusServerPort::~PosixModbusServerPort() {
+    for (size_t slot = 0; slot < MAX_CLIENTS; slot++) {
+        close((int)slot);
+    }
+    if (listener >= 0) {
+        ::close(listener);
+    }
+}
+
+bool PosixModbusServerPort::begin(uint16_t port) {
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) {
+        return false;
+    }
+    int enable = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(listener, (sockaddr*)&address, sizeof(address)) < 0 || listen(listener, MAX_CLIENTS) < 0) {
+        ::close(listener);
+        listener = -1;
+        return false;
+    }
+    fcntl(listener, F_SETFL, fcntl(listener, F_GETFL, 0) | O_NONBLOCK);
+
+    socklen_t length = sizeof(address);
+    getsockname(listener, (sockaddr*)&address, &length);
+    localPort = ntohs(address.sin_port);
+    return true;
+}
+
+int PosixModbusServerPort::accept() {
+    if (listener < 0) {
+        return -1;
+    }
+    int client = ::accept(listener, nullptr, nullptr);
+    if (client < 0) {
+        return -1;
+    }
+    fcntl(client, F_SETFL, fcntl(client, F_GETFL, 0) | O_NONBLOCK);
+    int enable = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    for (size_t slot = 0; slot < MAX_CLIENTS; slot++) {
+        if (clients[slot] < 0) {
+            clients[slot] = client;
+            return (int)slot;
+        }
+    }
+    ::close(client);
+    return -1;
+}
+
+bool PosixModbusServerPort::connected(int slot) {
+    return clients[slot] >= 0;
+}
+
+int PosixModbusServerPort::read(int slot, uint8_t* data, size_t capacity) {
+    if (clients[slot] < 0) {
+        return -1;
+    }
+    ssize_t received = recv(clients[slot], data, capacity, MSG_DONTWAIT);
+    if (received > 0) {
+        return (int)received;
+    }
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 0;
+    }
+    // Orderly shutdown or a reset
+    close(slot);
+    return -1;
+}
+
+size_t PosixModbusServerPort::write(int slot, const uint8_t* data, size_t length) {
+    size_t written = 0;
+    while (clients[slot] >= 0 && written < length) {
+        ssize_t sent = send(clients[slot], data + written, length - written, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                continue;
+            }
+            close(slot);
+            break;
+        }
+        written += (size_t)sent;
+    }
+    return written;
+}
+
+void PosixModbusServerPort::close(int slot) {
+    if (clients[slot] >= 0) {
+        ::close(clients[slot]);
+        clients[slot] = -1;
+    }
+}
+
+uint16_t PosixModbusServerPort::getLocalPort() const {
+    return localPort;
+}
+#endif
+
+// ModbusRtuMaster
+ModbusRtuMaster::ModbusRtuMaster(ModbusSerial& serial)
+    : serial(serial)
+    , clock(defaultClock)
+    , responseTimeoutMs(DEFAULT_RESPONSE_TIMEOUT_MS)
+    , busy(false)
+    , unit(0)
+    , function(0)
+    , count(0)
+    , sentAt(0)
+    , sampledAt(0)
+    , idleSince(0)
+    , txLength(0)
+    , rxLength(0)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+void ModbusRtuMaster::setClock(uint32_t (*clock)()) {
+    this->clock = clock ? clock : defaultClock;
+}
+
+void ModbusRtuMaster::setResponseTimeout(uint32_t ms) {
+    responseTimeoutMs = ms;
+}
+
+bool ModbusRtuMaster::read(uint8_t unit, uint8_t function, uint16_t start, uint16_t count, Callback callback) {
+    if (busy || count == 0 || count > MAX_READ_REGISTERS
+        || (function != ModbusFunction::READ_HOLDING_REGISTERS && function != ModbusFunction::READ_INPUT_REGISTERS)) {
+        return false;
+    }
+    uint8_t frame[8];
+    frame[0] = unit;
+    frame[1] = function;
+    putU16(frame + 2, start);
+    putU16(frame + 4, count);
+    this->unit = unit;
+    this->function = function;
+    this->count = count;
+    return send(frame, 6, callback);
+}
+
+bool ModbusRtuMaster::write(uint8_t unit, uint16_t start, const uint16_t* values, uint16_t count, Callback callback) {
+    if (busy || count == 0 || count > MAX_WRITE_REGISTERS) {
+        return false;
+    }
+    uint8_t frame[9 + 2 * MAX_WRITE_REGISTERS];
+    size_t length;
+    frame[0] = unit;
+    putU16(frame + 2, start);
+    if (count == 1) {
+        frame[1] = ModbusFunction::WRITE_SINGLE_REGISTER;
+        putU16(frame + 4, values[0]);
+        length = 6;
+    } else {
+        frame[1] = ModbusFunction::WRITE_MULTIPLE_REGISTERS;
+        putU16(frame + 4, count);
+        frame[6] = (uint8_t)(count * 2);
+        for (uint16_t i = 0; i < count; i++) {
+            putU16(frame + 7 + i * 2, values[i]);
+        }
+        length = 7 + count * 2;
+    }
+    this->unit = unit;
+    this->function = frame[1];
+    this->count = count;
+    return send(frame, length, callback);
+}
+
+bool ModbusRtuMaster::send(uint8_t* frame, size_t length, Callback done) {
+    uint16_t crc = modbusCrc16(frame, length);
+    frame[length] = (uint8_t)crc;
+    frame[length + 1] = (uint8_t)(crc >> 8);
+    memcpy(tx, frame, length + 2);
+    txLength = length + 2;
+    busy = true;
+    rxLength = 0;
+    callback = done;
+    stats.transactions++;
+    // Goes out from update() once the bus has been silent long enough
+    update();
+    return true;
+}
+
+void ModbusRtuMaster::update() {
+    if (!busy) {
+        return;
+    }
+    if (txLength > 0) {
+        // Keep the 3.5 character gap that delimits RTU frames
+        uint32_t now = clock();
+        if (now - idleSince < silentIntervalMs()) {
+            return;
+        }
+        // Discard anything left over from a previous, timed out exchange
+        uint8_t stale[32];
+        while (serial.read(stale, sizeof(stale)) > 0) {
+        }
+        sentAt = now;
+        sampledAt = now + (uint32_t)(txLength * (10000000UL / serial.getBaud()) / 1000);
+        bool written = serial.write(tx, txLength);
+        txLength = 0;
+        if (!written) {
+            stats.badFrames++;
+            finish(ModbusException::BAD_FRAME, nullptr, 0);
+        }
+        return;
+    }
+
+    int received = serial.read(rx + rxLength, sizeof(rx) - rxLength);
+    if (received > 0) {
+        rxLength += (size_t)received;
+    }
+
+    size_t expected = expectedLength();
+    if (expected > 0 && rxLength >= expected) {
+        uint16_t crc = modbusCrc16(rx, expected - 2);
+        if (rx[0] != unit || (rx[1] & 0x7F) != function
+            || rx[expected - 2] != (uint8_t)crc || rx[expected - 1] != (uint8_t)(crc >> 8)) {
+            stats.badFrames++;
+            finish(ModbusException::BAD_FRAME, nullptr, 0);
+            return;
+        }
+        if (rx[1] & 0x80) {
+            stats.exceptions++;
+            finish(rx[2], nullptr, 0);
+            return;
+        }
+        if (function == ModbusFunction::READ_HOLDING_REGISTERS || function == ModbusFunction::READ_INPUT_REGISTERS) {
+            if (rx[2] != count * 2) {
+                stats.badFrames++;
+                finish(ModbusException::BAD_FRAME, nullptr, 0);
+                return;
+            }
+            uint16_t values[MAX_READ_REGISTERS];
+            for (uint16_t i = 0; i < count; i++) {
+                values[i] = getU16(rx + 3 + i * 2);
+            }
+            finish(ModbusException::NONE, values, count);
+        } else {
+            finish(ModbusException::NONE, nullptr, count);
+        }
+        return;
+    }
+
+    // The timeout runs from the end of our request, and allows for a full response on the wire
+    if (clock() - sentAt > responseTimeoutMs + responseWireMs()) {
+        stats.timeouts++;
+        finish(ModbusException::TIMEOUT, nullptr, 0);
+    }
+}
+
+bool ModbusRtuMaster::isBusy() const {
+    return busy;
+}
+
+uint32_t ModbusRtuMaster::msUntilDue() const {
+    if (!busy) {
+        return NEVER;
+    }
+    uint32_t now = clock();
+    if (txLength > 0) {
+        uint32_t silent = now - idleSince;
+        return silent >= silentIntervalMs() ? 0 : silentIntervalMs() - silent;
+    }
+    uint32_t waited = now - sentAt;
+    uint32_t limit = responseTimeoutMs + responseWireMs() + 1;
+    return waited >= limit ? 0 : limit - waited;
+}
+
+uint32_t ModbusRtuMaster::getSampledAt() const {
+    return sampledAt;
+}
+
+const ModbusRtuStats& ModbusRtuMaster::getStats() const {
+    return stats;
+}
+
+void ModbusRtuMaster::finish(uint8_t exception, const uint16_t* values, uint16_t valueCount) {
+    busy = false;
+    idleSince = clock();
+    stats.busyMs += idleSince - sentAt;
+    // The callback may start the next transaction
+    Callback done = callback;
+    callback = nullptr;
+    if (done) {
+        done(exception, values, valueCount);
+    }
+}
+
+uint32_t ModbusRtuMaster::responseWireMs() const {
+    uint32_t characterUs = 10000000UL / serial.getBaud();
+    return (uint32_t)((8 + 5 + 2 * (uint32_t)count) * characterUs / 1000) + 1;
+}
+
+size_t ModbusRtuMaster::expectedLength() const {
+    if (rxLength < 3) {
+        return 0;
+    }
+    if (rx[1] & 0x80) {
+        return 5;
+    }
+    if (function == ModbusFunction::READ_HOLDING_REGISTERS || function == ModbusFunction::READ_INPUT_REGISTERS) {
+        return 5 + rx[2];
+    }
+    return 8;
+}
+
+uint32_t ModbusRtuMaster::exchangeMs(size_t requestBytes, size_t responseBytes) const {
+    uint32_t baud = serial.getBaud();
+    return silentIntervalMs() + (uint32_t)(((requestBytes + responseBytes) * 10000 + baud - 1) / baud);
+}
+
+uint32_t ModbusRtuMaster::silentIntervalMs() const {
+    // Fixed 1.75 ms above 19200 baud, per the serial line spec
+    uint32_t baud = serial.getBaud();
+    if (baud > 19200) {
+        return 2;
+    }
+    return (35000 + baud - 1) / baud;
+}
+
+// RegisterCache
+RegisterCache::RegisterCache() {
+}
+
+int RegisterCache::addBlock(uint8_t unit, uint8_t function, uint16_t start, uint16_t count, uint32_t maxAgeMs,
+                            uint32_t pollIntervalMs) {
+    if (blocks.size() >= MAX_BLOCKS || count == 0 || count > ModbusRtuMaster::MAX_READ_REGISTERS
+        || (uint32_t)start + count > 0x10000) {
+        return -1;
+    }
+    Block block;
+    block.unit = unit;
+    block.function = function;
+    block.start = start;
+    block.count = count;
+    block.maxAgeMs = maxAgeMs;
+    block.pollIntervalMs = pollIntervalMs ? pollIntervalMs : maxAgeMs / 2;
+    block.lastPollAt = 0;
+    block.polled = false;
+    block.values.assign(count, 0);
+    block.updatedAt.assign(count, 0);
+    block.valid.assign(count, 0);
+    blocks.push_back(block);
+    return (int)blocks.size() - 1;
+}
+
+void RegisterCache::clear() {
+    blocks.clear();
+}
+
+bool RegisterCache::lookup(uint8_t unit, uint8_t function, uint16_t start, uint16_t count, uint32_t now,
+                           uint16_t* out) const {
+    for (uint32_t address = start; address < (uint32_t)start + count; address++) {
+        bool fresh = false;
+        for (size_t i = 0; i < blocks.size() && !fresh; i++) {
+            const Block& block = blocks[i];
+            if (block.unit != unit || block.function != function
+                || address < block.start || address >= (uint32_t)block.start + block.count) {
+                continue;
+            }
+            size_t offset = address - block.start;
+            if (block.valid[offset] && now - block.updatedAt[offset] <= block.maxAgeMs) {
+                out[address - start] = block.values[offset];
+                fresh = true;
+            }
+        }
+        if (!fresh) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void RegisterCache::store(uint8_t unit, uint8_t function, uint16_t start, uint16_t count, const uint16_t* values,
+                          uint32_t now) {
+    for (size_t i = 0; i < blocks.size(); i++) {
+        Block& block = blocks[i];
+        if (block.unit != unit || block.function != function) {
+            continue;
+        }
+        uint32_t from = start > block.start ? start : block.start;
+        uint32_t to = (uint32_t)start + count;
+        if ((uint32_t)block.start + block.count < to) {
+            to = (uint32_t)block.start + block.count;
+        }
+        for (uint32_t address = from; address < to; address++) {
+            size_t offset = address - block.start;
+            block.values[offset] = values[address - start];
+            block.updatedAt[offset] = now;
+            block.valid[offset] = 1;
+        }
+    }
+}
+
+void RegisterCache::invalidate(uint8_t unit, uint8_t function, uint16_t start, uint16_t count) {
+    for (size_t i = 0; i < blocks.size(); i++) {
+        Block& block = blocks[i];
+        if (block.unit != unit || block.function != function) {
+            continue;
+        }
+        for (uint32_t address = start; address < (uint32_t)start + count; address++) {
+            if (address >= block.start && address < (uint32_t)block.start + block.count) {
+                block.valid[address - block.start] = 0;
+            }
+        }
+    }
+}
+
+int RegisterCache::findBlock(uint8_t unit, uint8_t function, uint16_t start, uint16_t count) const {
+    for (size_t i = 0; i < blocks.size(); i++) {
+        const Block& block = blocks[i];
+        if (block.unit == unit && block.function == function && start >= block.start
+            && (uint32_t)start + count <= (uint32_t)block.start + block.count) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+int RegisterCache::nextPoll(uint32_t now) const {
+    int best = -1;
+    uint32_t bestOverdue = 0;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        const Block& block = blocks[i];
+        if (!block.polled) {
+            return (int)i;
+        }
+        uint32_t age = now - block.lastPollAt;
+        if (age >= block.pollIntervalMs && (best < 0 || age - block.pollIntervalMs > bestOverdue)) {
+            best = (int)i;
+            bestOverdue = age - block.pollIntervalMs;
+        }
+    }
+    return best;
+}
+
+uint32_t RegisterCache::nextPollDueIn(uint32_t now) const {
+    uint32_t soonest = NO_POLL_DUE;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        const Block& block = blocks[i];
+        uint32_t age = now - block.lastPollAt;
+        if (!block.polled || age >= block.pollIntervalMs) {
+            return 0;
+        }
+        if (block.pollIntervalMs - age < soonest) {
+            soonest = block.pollIntervalMs - age;
+        }
+    }
+    return soonest;
+}
+
+void RegisterCache::markPolled(size_t block, uint32_t now) {
+    blocks[block].polled = true;
+    blocks[block].lastPollAt = now;
+}
+
+size_t RegisterCache::getBlockCount() const {
+    return blocks.size();
+}
+
+const RegisterCache::Block& RegisterCache::getBlock(size_t index) const {
+    return blocks[index];
+}
+
+// ModbusTcpGateway
+ModbusTcpGateway::ModbusTcpGateway(ModbusTcpServerPort& port, ModbusRtuMaster& master)
+    : port(port)
+    , master(master)
+    , clock(defaultClock)
+    , nextSequence(0)
+    , readInFlight(false)
+    , flightUnit(0)
+    , flightFunction(0)
+    , flightStart(0)
+    , flightCount(0)
+    , flightStartedAt(0)
+{
+    for (size_t slot = 0; slot < ModbusTcpServerPort::MAX_CLIENTS; slot++) {
+        rxLength[slot] = 0;
+        slotOpen[slot] = false;
+        generation[slot] = 0;
+    }
+    for (size_t i = 0; i < MAX_PENDING; i++) {
+        pending[i].active = false;
+        pending[i].inFlight = false;
+    }
+    memset(&stats, 0, sizeof(stats));
+}
+
+void ModbusTcpGateway::setClock(uint32_t (*clock)()) {
+    this->clock = clock ? clock : defaultClock;
+}
+
+RegisterCache& ModbusTcpGateway::getCache() {
+    return cache;
+}
+
+void ModbusTcpGateway::setBlockCallback(std::function<void(size_t, const uint16_t*, uint16_t, uint32_t)> callback) {
+    blockCallback = callback;
+}
+
+void ModbusTcpGateway::setIdleTask(std::function<bool(uint32_t, uint32_t)> task) {
+    idleTask = task;
+}
+
+bool ModbusTcpGateway::begin(uint16_t port) {
+    return this->port.begin(port);
+}
+
+void ModbusTcpGateway::update() {
+    int slot;
+    while ((slot = port.accept()) >= 0) {
+        // The port may have recycled a slot whose disconnect we have not seen yet
+        if (slotOpen[slot]) {
+            dropClient(slot);
+        }
+        slotOpen[slot] = true;
+        generation[slot]++;
+        rxLength[slot] = 0;
+    }
+    for (slot = 0; slot < (int)ModbusTcpServerPort::MAX_CLIENTS; slot++) {
+        if (!slotOpen[slot]) {
+            continue;
+        }
+        if (!port.connected(slot)) {
+            dropClient(slot);
+            continue;
+        }
+        receive(slot);
+    }
+
+    master.update();
+    uint32_t now = clock();
+    serveFromCache(now);
+    startTransaction(now);
+}
+
+size_t ModbusTcpGateway::getPendingCount() const {
+    size_t count = 0;
+    for (size_t i = 0; i < MAX_PENDING; i++) {
+        if (pending[i].active) {
+            count++;
+        }
+    }
+    return count;
+}
+
+const ModbusGatewayStats& ModbusTcpGateway::getStats() const {
+    return stats;
+}
+
+void ModbusTcpGateway::receive(int slot) {
+    int received = port.read(slot, rx[slot] + rxLength[slot], MAX_FRAME_SIZE - rxLength[slot]);
+    if (received < 0) {
+        dropClient(slot);
+        return;
+    }
+    rxLength[slot] += (size_t)received;
+
+    // MBAP: transaction, protocol, length (unit + PDU), then the unit id
+    while (rxLength[slot] >= 6) {
+        uint16_t length = getU16(rx[slot] + 4);
+        size_t total = 6 + (size_t)length;
+        if (getU16(rx[slot] + 2) != 0 || length < 2 || total > MAX_FRAME_SIZE) {
+            // Not Modbus; there is no way to resynchronise a TCP stream
+            port.close(slot);
+            dropClient(slot);
+            return;
+        }
+        if (rxLength[slot] < total) {
+            break;
+        }
+        handleFrame(slot, rx[slot], total);
+        memmove(rx[slot], rx[slot] + total, rxLength[slot] - total);
+        rxLength[slot] -= total;
+    }
+}
+
+void ModbusTcpGateway::dropClient(int slot) {
+    slotOpen[slot] = false;
+    rxLength[slot] = 0;
+    // In-flight requests finish on the bus; their responses are discarded by generation
+    for (size_t i = 0; i < MAX_PENDING; i++) {
+        if (pending[i].active && !pending[i].inFlight && pending[i].slot == slot) {
+            pending[i].active = false;
+        }
+    }
+}
+
+void ModbusTcpGateway::handleFrame(int slot, const uint8_t* frame, size_t length) {
+    Pending request;
+    request.active = true;
+    request.inFlight = false;
+    request.sequence = nextSequence++;
+    request.slot = (uint8_t)slot;
+    request.generation = generation[slot];
+    request.transaction = getU16(frame);
+    request.unit = frame[6];
+    request.function = frame[7];
+    request.start = 0;
+    request.count = 0;
+
+    const uint8_t* pdu = frame + 7;
+    size_t pduLength = length - 7;
+    stats.requests++;
+
+    switch (request.function) {
+        case ModbusFunction::READ_HOLDING_REGISTERS:
+        case ModbusFunction::READ_INPUT_REGISTERS:
+            if (pduLength != 5) {
+                respondException(request, ModbusException::ILLEGAL_DATA_VALUE);
+                return;
+            }
+            request.start = getU16(pdu + 1);
+            request.count = getU16(pdu + 3);
+            if (request.count == 0 || request.count > ModbusRtuMaster::MAX_READ_REGISTERS) {
+                respondException(request, ModbusException::ILLEGAL_DATA_VALUE);
+                return;
+            }
+            break;
+
+        case ModbusFunction::WRITE_SINGLE_REGISTER:
+            if (pduLength != 5) {
+                respondException(request, ModbusException::ILLEGAL_DATA_VALUE);
+                return;
+            }
+            request.start = getU16(pdu + 1);
+            request.count = 1;
+            request.writeValues.push_back(getU16(pdu + 3));
+            break;
+
+        case ModbusFunction::WRITE_MULTIPLE_REGISTERS:
+            if (pduLength < 6) {
+                respondException(request, ModbusException::ILLEGAL_DATA_VALUE);
+                return;
+            }
+            request.start = getU16(pdu + 1);
+            request.count = getU16(pdu + 3);
+            if (request.count == 0 || request.count > ModbusRtuMaster::MAX_WRITE_REGISTERS
+                || pdu[5] != request.count * 2 || pduLength != 6 + (size_t)pdu[5]) {
+                respondException(request, ModbusException::ILLEGAL_DATA_VALUE);
+                return;
+            }
+            for (uint16_t i = 0; i < request.count; i++) {
+                request.writeValues.push_back(getU16(pdu + 6 + i * 2));
+            }
+            break;
+
+        default:
+            respondException(request, ModbusException::ILLEGAL_FUNCTION);
+            return;
+    }
+    if ((uint32_t)request.start + request.count > 0x10000) {
+        respondException(request, ModbusException::ILLEGAL_DATA_ADDRESS);
+        return;
+    }
+
+    if (request.writeValues.empty()) {
+        uint16_t values[ModbusRtuMaster::MAX_READ_REGISTERS];
+        if (cache.lookup(request.unit, request.function, request.start, request.count, clock(), values)) {
+            stats.cacheHits++;
+            respondRead(request, values);
+            return;
+        }
+        if (joinFlight(request)) {
+            stats.coalesced++;
+        }
+    }
+
+    for (size_t i = 0; i < MAX_PENDING; i++) {
+        if (!pending[i].active) {
+            pending[i] = request;
+            return;
+        }
+    }
+    stats.busyRejects++;
+    respondException(request, ModbusException::SLAVE_DEVICE_BUSY);
+}
+
+void ModbusTcpGateway::serveFromCache(uint32_t now) {
+    uint16_t values[ModbusRtuMaster::MAX_READ_REGISTERS];
+    for (size_t i = 0; i < MAX_PENDING; i++) {
+        Pending& request = pending[i];
+        if (!request.active || request.inFlight || !request.writeValues.empty()) {
+            continue;
+        }
+        if (cache.lookup(request.unit, request.function, request.start, request.count, now, values)) {
+            stats.cacheHits++;
+            respondRead(request, values);
+            request.active = false;
+        }
+    }
+}
+
+bool ModbusTcpGateway::joinFlight(Pending& request) const {
+    if (!readInFlight || request.unit != flightUnit || request.function != flightFunction
+        || request.start < flightStart || (uint32_t)request.start + request.count > (uint32_t)flightStart + flightCount) {
+        return false;
+    }
+    request.inFlight = true;
+    return true;
+}
+
+void ModbusTcpGateway::startTransaction(uint32_t now) {
+    if (master.isBusy()) {
+        return;
+    }
+
+    // Oldest waiting request first, so writes keep their order relative to reads
+    Pending* first = nullptr;
+    for (size_t i = 0; i < MAX_PENDING; i++) {
+        Pending& request = pending[i];
+        if (request.active && !request.inFlight && (!first || request.sequence < first->sequence)) {
+            first = &request;
+        }
+    }
+
+    if (!first) {
+        if (idleTask && idleTask(now, cache.nextPollDueIn(now))) {
+            return;
+        }
+        int block = cache.nextPoll(now);
+        if (block < 0) {
+            return;
+        }
+        const RegisterCache::Block& poll = cache.getBlock((size_t)block);
+        uint8_t unit = poll.unit;
+        uint8_t function = poll.function;
+        uint16_t start = poll.start;
+        uint16_t count = poll.count;
+        cache.markPolled((size_t)block, now);
+        readInFlight = true;
+        flightUnit = unit;
+        flightFunction = function;
+        flightStart = start;
+        flightCount = count;
+        flightStartedAt = now;
+        stats.polls++;
+        if (!master.read(unit, function, start, count,
+                         [this, unit, function, start](uint8_t exception, const uint16_t* values, uint16_t count) {
+                             completeRead(unit, function, start, exception, values, count);
+                         })) {
+            readInFlight = false;
+        }
+        return;
+    }
+
+    if (!first->writeValues.empty()) {
+        Pending* request = first;
+        request->inFlight = true;
+        stats.serialWrites++;
+        if (!master.write(request->unit, request->start, request->writeValues.data(), request->count,
+                          [this, request](uint8_t exception, const uint16_t*, uint16_t) {
+                              completeWrite(*request, exception);
+                          })) {
+            completeWrite(*request, ModbusException::GATEWAY_TARGET_NO_RESPONSE);
+        }
+        return;
+    }
+
+    // Read a whole configured block when the request falls inside one, so the cache benefits
+    uint32_t low = first->start;
+    uint32_t high = (uint32_t)first->start + first->count;
+    int block = cache.findBlock(first->unit, first->function, first->start, first->count);
+    if (block >= 0) {
+        low = cache.getBlock((size_t)block).start;
+        high = low + cache.getBlock((size_t)block).count;
+    }
+
+    // Merge every other waiting read of the same unit and table that fits in one request
+    uint32_t merged = 0;
+    for (size_t i = 0; i < MAX_PENDING; i++) {
+        Pending& request = pending[i];
+        if (!request.active || request.inFlight || !request.writeValues.empty()
+            || request.unit != first->unit || request.function != first->function) {
+            continue;
+        }
+        uint32_t newLow = request.start < low ? request.start : low;
+        uint32_t newHigh = (uint32_t)request.start + request.count > high ? (uint32_t)request.start + request.count : high;
+        if (&request != first && newHigh - newLow > ModbusRtuMaster::MAX_READ_REGISTERS) {
+            continue;
+        }
+        low = newLow;
+        high = newHigh;
+        request.inFlight = true;
+        merged++;
+    }
+
+    uint8_t unit = first->unit;
+    uint8_t function = first->function;
+    uint16_t start = (uint16_t)low;
+    readInFlight = true;
+    flightUnit = unit;
+    flightFunction = function;
+    flightStart = start;
+    flightCount = (uint16_t)(high - low);
+    flightStartedAt = now;
+    stats.serialReads++;
+    stats.coalesced += merged - 1;
+    auto done = [this, unit, function, start](uint8_t exception, const uint16_t* values, uint16_t count) {
+        completeRead(unit, function, start, exception, values, count);
+    };
+    if (!master.read(unit, function, start, (uint16_t)(high - low), done)) {
+        completeRead(unit, function, start, ModbusException::GATEWAY_TARGET_NO_RESPONSE, nullptr, 0);
+    }
+}
+
+void ModbusTcpGateway::completeRead(uint8_t unit, uint8_t function, uint16_t start, uint8_t exception,
+                                    const uint16_t* values, uint16_t count) {
+    uint32_t now = clock();
+    readInFlight = false;
+    if (exception == ModbusException::NONE) {
+        cache.store(unit, function, start, count, values, now);
+        for (size_t i = 0; i < cache.getBlockCount(); i++) {
+            const RegisterCache::Block& block = cache.getBlock(i);
+            if (block.unit == unit && block.function == function && block.start >= start
+                && (uint32_t)block.start + block.count <= (uint32_t)start + count) {
+                // Poll intervals count from the request, so bus time does not make them drift
+                cache.markPolled(i, flightStartedAt);
+                if (blockCallback) {
+                    blockCallback(i, values + (block.start - start), block.count, master.getSampledAt());
+                }
+            }
+        }
+    }
+
+    // Only one transaction is on the bus at a time, so every in-flight read belongs to it
+    for (size_t i = 0; i < MAX_PENDING; i++) {
+        Pending& request = pending[i];
+        if (!request.active || !request.inFlight || !request.writeValues.empty()) {
+            continue;
+        }
+        if (exception == ModbusException::NONE) {
+            respondRead(request, values + (request.start - start));
+        } else {
+            respondException(request, exception >= ModbusException::TIMEOUT
+                                          ? ModbusException::GATEWAY_TARGET_NO_RESPONSE : exception);
+        }
+        request.active = false;
+        request.inFlight = false;
+    }
+}
+
+void ModbusTcpGateway::completeWrite(Pending& request, uint8_t exception) {
+    if (exception == ModbusException::NONE) {
+        // The slave may clamp or reject values silently; re-read rather than trust them
+        cache.invalidate(request.unit, ModbusFunction::READ_HOLDING_REGISTERS, request.start, request.count);
+        uint8_t pdu[5];
+        pdu[0] = request.function;
+        putU16(pdu + 1, request.start);
+        putU16(pdu + 3, request.function == ModbusFunction::WRITE_SINGLE_REGISTER ? request.writeValues[0] : request.count);
+        respond(request.slot, request.generation, request.transaction, request.unit, pdu, sizeof(pdu));
+    } else {
+        respondException(request, exception >= ModbusException::TIMEOUT
+                                      ? ModbusException::GATEWAY_TARGET_NO_RESPONSE : exception);
+    }
+    request.active = false;
+    request.inFlight = false;
+    request.writeValues.clear();
+}
+
+void ModbusTcpGateway::respondRead(const Pending& request, const uint16_t* values) {
+    uint8_t pdu[2 + 2 * ModbusRtuMaster::MAX_READ_REGISTERS];
+    pdu[0] = request.function;
+    pdu[1] = (uint8_t)(request.count * 2);
+    for (uint16_t i = 0; i < request.count; i++) {
+        putU16(pdu + 2 + i * 2, values[i]);
+    }
+    respond(request.slot, request.generation, request.transaction, request.unit, pdu, 2 + request.count * 2);
+}
+
+void ModbusTcpGateway::respondException(const Pending& request, uint8_t exception) {
+    uint8_t pdu[2] = { (uint8_t)(request.function | 0x80), exception };
+    stats.exceptions++;
+    respond(request.slot, request.generation, request.transaction, request.unit, pdu, sizeof(pdu));
+}
+
+void ModbusTcpGateway::respond(uint8_t slot, uint32_t generation, uint16_t transaction, uint8_t unit,
+                               const uint8_t* pdu, size_t length) {
+    // The client that asked may have gone, or its slot been reused
+    if (!slotOpen[slot] || this->generation[slot] != generation) {
+        return;
+    }
+    uint8_t frame[MAX_FRAME_SIZE];
+    putU16(frame, transaction);
+    putU16(frame + 2, 0);
+    putU16(frame + 4, (uint16_t)(length + 1));
+    frame[6] = unit;
+    memcpy(frame + 7, pdu, length);
+    port.write(slot, frame, 7 + length);
+}
@@ -0,0 +1,723 @@
+#include "mqtt_session.h"
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+static uint32_t defaultClock() {
+#ifdef ARDUINO
+    return millis();
+#else
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+size_t mqttEncodeLength(uint8_t* out, uint32_t length) {
+    size_t count = 0;
+    do {
+        uint8_t byte = length % 128;
+        length /= 128;
+        if (length > 0) {
+            byte |= 0x80;
+        }
+        out[count++] = byte;
+    } while (length > 0 && count < 4);
+    return count;
+}
+
+void mqttAppendString(std::vector<uint8_t>& out, const char* value, size_t length) {
+    out.push_back((uint8_t)(length >> 8));
+    out.push_back((uint8_t)length);
+    out.insert(out.end(), (const uint8_t*)value, (const uint8_t*)value + length);
+}
+
+static void appendHeader(std::vector<uint8_t>& out, uint8_t header, uint32_t remaining) {
+    uint8_t length[4];
+    out.push_back(header);
+    out.insert(out.end(), length, length + mqttEncodeLength(length, remaining));
+}
+
+#ifdef ARDUINO
+bool ClientMqttTransport::open(const char* host, uint16_t port) {
+    return client.connect(host, port) == 1;
+}
+
+void ClientMqttTransport::close() {
+    client.stop();
+}
+
+bool ClientMqttTransport::isOpen() {
+    return client.connected();
+}
+
+int ClientMqttTransport::read(uint8_t* data, size_t length) {
+    int available = client.available();
+    if (available <= 0) {
+        return 0;
+    }
+    return client.read(data, (size_t)available < length ? available : length);
+}
+
+size_t ClientMqttTransport::write(const uint8_t* data, size_t length) {
+    return client.write(data, length);
+}
+#endif
+
+// MqttPacketReader
+MqttPacketReader::MqttPacketReader() {
+    reset();
+}
+
+void MqttPacketReader::reset() {
+    stage = Stage::HEADER;
+    header = 0;
+    remaining = 0;
+    received = 0;
+    lengthBytes = 0;
+    truncated = false;
+    malformed = false;
+}
+
+bool MqttPacketReader::feed(uint8_t byte) {
+    switch (stage) {
+        case Stage::COMPLETE:
+            reset();
+            // fall through
+        case Stage::HEADER:
+            header = byte;
+            stage = Stage::LENGTH;
+            return false;
+
+        case Stage::LENGTH:
+            remaining |= (uint32_t)(byte & 0x7F) << (7 * lengthBytes);
+            lengthBytes++;
+            if (byte & 0x80) {
+                if (lengthBytes == 4) {
+                    reset();
+                    malformed = true;
+                }
+                return false;
+            }
+            if (remaining == 0) {
+                stage = Stage::COMPLETE;
+                return true;
+            }
+            stage = Stage::BODY;
+            return false;
+
+        case Stage::BODY:
+            if (received < MAX_PACKET_SIZE) {
+                body[received] = byte;
+            } else {
+                truncated = true;
+            }
+            received++;
+            if (received == remaining) {
+                stage = Stage::COMPLETE;
+                return true;
+            }
+            return false;
+    }
+    return false;
+}
+
+MqttPacketType MqttPacketReader::getType() const {
+    return static_cast<MqttPacketType>(header >> 4);
+}
+
+uint8_t MqttPacketReader::getFlags() const {
+    return header & 0x0F;
+}
+
+const uint8_t* MqttPacketReader::getBody() const {
+    return body;
+}
+
+size_t MqttPacketReader::getBodyLength() const {
+    return received < MAX_PACKET_SIZE ? received : MAX_PACKET_SIZE;
+}
+
+bool MqttPacketReader::isTruncated() const {
+    return truncated;
+}
+
+bool MqttPacketReader::isMalformed() const {
+    return malformed;
+}
+
+// MqttSession
+MqttSession::MqttSession(MqttTransport& transport)
+    : transport(transport)
+    , state(MqttSessionState::DISCONNECTED)
+    , port(1883)
+    , keepAliveSec(30)
+    , cleanSession(false)
+    , window(16)
+    , retransmitMs(5000)
+    , reconnectMs(5000)
+    , autoReconnect(false)
+    , clock(defaultClock)
+    , inflightCount(0)
+    , nextPacketId(1)
+    , nextSequence(0)
+    , qos2ReceivedCount(0)
+    , connectStartedAt(0)
+    , lastAttemptAt(0)
+    , lastOutbound(0)
+    , pingSentAt(0)
+    , pingOutstanding(false)
+    , stats()
+{
+    for (size_t i = 0; i < MAX_INFLIGHT; i++) {
+        slots[i].stage = Stage::FREE;
+        slots[i].packetId = 0;
+    }
+}
+
+void MqttSession::setServer(const std::string& newHost, uint16_t newPort) {
+    host = newHost;
+    port = newPort;
+}
+
+void MqttSession::setCredentials(const std::string& newClientId, const std::string& newUsername,
+                                 const std::string& newPassword) {
+    clientId = newClientId;
+    username = newUsername;
+    password = newPassword;
+}
+
+void MqttSession::setKeepAlive(uint16_t seconds) {
+    keepAliveSec = seconds;
+}
+
+void MqttSession::setCleanSession(bool clean) {
+    cleanSession = clean;
+}
+
+void MqttSession::setInflightWindow(size_t newWindow) {
+    // Shrinking below the current count just stops new publishes until acks drain
+    window = newWindow < 1 ? 1 : (newWindow > MAX_INFLIGHT ? MAX_INFLIGHT : newWindow);
+}
+
+void MqttSession::setRetransmitInterval(uint32_t ms) {
+    retransmitMs = ms;
+}
+
+void MqttSession::setReconnectInterval(uint32_t ms) {
+    reconnectMs = ms;
+}
+
+void MqttSession::setMessageCallback(std::function<void(const char*, const uint8_t*, size_t)> callback) {
+    messageCallback = callback;
+}
+
+void MqttSession::setClock(uint32_t (*newClock)()) {
+    clock = newClock;
+}
+
+bool MqttSession::connect() {
+    uint32_t now = clock();
+    autoReconnect = true;
+    lastAttemptAt = now;
+    if (host.empty()) {
+        lastError = "No broker configured";
+        return false;
+    }
+    if (state != MqttSessionState::DISCONNECTED) {
+        transport.close();
+        state = MqttSessionState::DISCONNECTED;
+    }
+    reader.reset();
+    pingOutstanding = false;
+    if (!transport.open(host.c_str(), port)) {
+        lastError = "Failed to open connection to " + host;
+        return false;
+    }
+
+    uint8_t flags = cleanSession ? 0x02 : 0x00;
+    uint32_t remaining = 10 + 2 + clientId.size();
+    if (!username.empty()) {
+        flags |= 0x80;
+        remaining += 2 + username.size();
+        if (!password.empty()) {
+            flags |= 0x40;
+            remaining += 2 + password.size();
+        }
+    }
+
+    txBuffer.clear();
+    appendHeader(txBuffer, 0x10, remaining);
+    mqttAppendString(txBuffer, "MQTT", 4);
+    txBuffer.push_back(4); // protocol level 3.1.1
+    txBuffer.push_back(flags);
+    txBuffer.push_back((uint8_t)(keepAliveSec >> 8));
+    txBuffer.push_back((uint8_t)keepAliveSec);
+    mqttAppendString(txBuffer, clientId.c_str(), clientId.size());
+    if (flags & 0x80) {
+        mqttAppendString(txBuffer, username.c_str(), username.size());
+    }
+    if (flags & 0x40) {
+        mqttAppendString(txBuffer, password.c_str(), password.size());
+    }
+
+    state = MqttSessionState::CONNECTING;
+    connectStartedAt = now;
+    return send(txBuffer.data(), txBuffer.size());
+}
+
+void MqttSession::disconnect() {
+    autoReconnect = false;
+    if (state == MqttSessionState::CONNECTED) {
+        const uint8_t packet[] = {0xE0, 0x00};
+        transport.write(packet, sizeof(packet));
+    }
+    transport.close();
+    state = MqttSessionState::DISCONNECTED;
+}
+
+void MqttSession::loop() {
+    uint32_t now = clock();
+    if (state == MqttSessionState::DISCONNECTED) {
+        if (autoReconnect && reconnectMs > 0 && now - lastAttemptAt >= reconnectMs) {
+            connect();
+        }
+        return;
+    }
+    if (!transport.isOpen()) {
+        connectionLost("Connection closed by peer");
+        return;
+    }
+
+    uint8_t chunk[128];
+    int count;
+    while (state != MqttSessionState::DISCONNECTED && (count = transport.read(chunk, sizeof(chunk))) > 0) {
+        for (int i = 0; i < count && state != MqttSessionState::DISCONNECTED; i++) {
+            if (reader.feed(chunk[i])) {
+                handlePacket();
+            } else if (reader.isMalformed()) {
+                connectionLost("Malformed packet length");
+            }
+        }
+    }
+
+    if (state != MqttSessionState::DISCONNECTED) {
+        checkTimers(clock());
+    }
+}
+
+bool MqttSession::publish(const char* topic, const uint8_t* payload, size_t length, uint8_t qos, bool retain) {
+    size_t topicLength = strlen(topic);
+    if (qos > 2 || topicLength == 0 || topicLength > 0xFFFF) {
+        lastError = "Invalid publish arguments";
+        return false;
+    }
+    uint8_t header = 0x30 | (qos << 1) | (retain ? 0x01 : 0x00);
+    uint32_t remaining = 2 + topicLength + (qos > 0 ? 2 : 0) + length;
+
+    if (qos == 0) {
+        if (!isConnected()) {
+            return false;
+        }
+        txBuffer.clear();
+        appendHeader(txBuffer, header, remaining);
+        mqttAppendString(txBuffer, topic, topicLength);
+        txBuffer.insert(txBuffer.end(), payload, payload + length);
+        if (!send(txBuffer.data(), txBuffer.size())) {
+            return false;
+        }
+        stats.published++;
+        return true;
+    }
+
+    if (inflightCount >= window) {
+        stats.windowFull++;
+        return false;
+    }
+    InflightSlot* slot = nullptr;
+    for (size_t i = 0; i < MAX_INFLIGHT; i++) {
+        if (slots[i].stage == Stage::FREE) {
+            slot = &slots[i];
+            break;
+        }
+    }
+    if (slot == nullptr) {
+        stats.windowFull++;
+        return false;
+    }
+
+    uint16_t packetId = allocatePacketId();
+    // The slot's buffer keeps its capacity between messages
+    slot->packet.clear();
+    appendHeader(slot->packet, header, remaining);
+    mqttAppendString(slot->packet, topic, topicLength);
+    slot->packet.push_back((uint8_t)(packetId >> 8));
+    slot->packet.push_back((uint8_t)packetId);
+    slot->packet.insert(slot->packet.end(), payload, payload + length);
+
+    uint32_t now = clock();
+    slot->stage = qos == 1 ? Stage::AWAIT_PUBACK : Stage::AWAIT_PUBREC;
+    slot->packetId = packetId;
+    slot->attempts = 0;
+    slot->sequence = nextSequence++;
+    slot->firstSentAt = now;
+    slot->sentAt = now;
+    inflightCount++;
+    stats.published++;
+
+    // While offline the message waits in its slot and goes out after CONNACK
+    if (isConnected()) {
+        sendSlot(*slot, false);
+    }
+    return true;
+}
+
+bool MqttSession::subscribe(const char* topic, uint8_t qos) {
+    size_t topicLength = strlen(topic);
+    if (!isConnected() || qos > 2 || topicLength == 0 || topicLength > 0xFFFF) {
+        return false;
+    }
+    uint16_t packetId = allocatePacketId();
+    txBuffer.clear();
+    appendHeader(txBuffer, 0x82, 2 + 2 + topicLength + 1);
+    txBuffer.push_back((uint8_t)(packetId >> 8));
+    txBuffer.push_back((uint8_t)packetId);
+    mqttAppendString(txBuffer, topic, topicLength);
+    txBuffer.push_back(qos);
+    return send(txBuffer.data(), txBuffer.size());
+}
+
+bool MqttSession::canPublish(uint8_t qos) const {
+    return qos == 0 ? isConnected() : inflightCount < window;
+}
+
+MqttSessionState MqttSession::getState() const {
+    return state;
+}
+
+bool MqttSession::isConnected() const {
+    return state == MqttSessionState::CONNECTED;
+}
+
+size_t MqttSession::getInflightCount() const {
+    return inflightCount;
+}
+
+size_t MqttSession::getInflightWindow() const {
+    return window;
+}
+
+const MqttSessionStats& MqttSession::getStats() const {
+    return stats;
+}
+
+const std::string& MqttSession::getLastError() const {
+    return lastError;
+}
+
+// Private methods
+void MqttSession::handlePacket() {
+    const uint8_t* body = reader.getBody();
+    size_t length = reader.getBodyLength();
+    MqttPacketType type = reader.getType();
+
+    switch (type) {
+        case MqttPacketType::CONNACK: {
+            if (state != MqttSessionState::CONNECTING || length < 2) {
+                connectionLost("Unexpected CONNACK");
+                return;
+            }
+            if (body[1] != 0) {
+                connectionLost("Connection refused, code " + std::to_string(body[1]));
+                return;
+            }
+            bool sessionPresent = (body[0] & 0x01) != 0;
+            state = MqttSessionState::CONNECTED;
+            stats.connects++;
+            if (sessionPresent) {
+                stats.resumed++;
+            } else {
+                // The broker has no record of half-finished inbound QoS 2 flows
+                qos2ReceivedCount = 0;
+            }
+            lastError.clear();
+            resendInflight();
+            return;
+        }
+
+        case MqttPacketType::PUBLISH:
+            handlePublish();
+            return;
+
+        case MqttPacketType::PUBACK:
+        case MqttPacketType::PUBREC:
+        case MqttPacketType::PUBCOMP:
+        case MqttPacketType::PUBREL:
+            if (length >= 2) {
+                handleAck(type, (uint16_t)((body[0] << 8) | body[1]));
+            }
+            return;
+
+        case MqttPacketType::SUBACK:
+            if (length >= 3 && body[2] == 0x80) {
+                lastError = "Subscription rejected";
+            }
+            return;
+
+        case MqttPacketType::PINGRESP:
+            pingOutstanding = false;
+            return;
+
+        default:
+            return;
+    }
+}
+
+void MqttSession::handlePublish() {
+    const uint8_t* body = reader.getBody();
+    size_t length = reader.getBodyLength();
+    uint8_t qos = (reader.getFlags() >> 1) & 0x03;
+    if (length < 2 || qos > 2) {
+        connectionLost("Malformed PUBLISH");
+        return;
+    }
+    size_t topicLength = (body[0] << 8) | body[1];
+    size_t offset = 2 + topicLength;
+    uint16_t packetId = 0;
+    if (qos > 0) {
+        if (offset + 2 > length) {
+            connectionLost("Malformed PUBLISH");
+            return;
+        }
+        packetId = (uint16_t)((body[offset] << 8) | body[offset + 1]);
+        offset += 2;
+    }
+    if (offset > length) {
+        connectionLost("Malformed PUBLISH");
+        return;
+    }
+
+    bool deliver = !reader.isTruncated() && topicLength <= MAX_TOPIC_LENGTH;
+    if (qos == 2) {
+        for (size_t i = 0; i < qos2ReceivedCount; i++) {
+            if (qos2Received[i] == packetId) {
+                deliver = false; // duplicate of a flow awaiting PUBREL
+                break;
+            }
+        }
+        if (deliver) {
+            if (qos2ReceivedCount == MAX_QOS2_RECEIVED) {
+                memmove(qos2Received, qos2Received + 1, sizeof(qos2Received[0]) * (MAX_QOS2_RECEIVED - 1));
+                qos2ReceivedCount--;
+            }
+            qos2Received[qos2ReceivedCount++] = packetId;
+        }
+    }
+
+    if (deliver && messageCallback) {
+        memcpy(topicBuffer, body + 2, topicLength);
+        topicBuffer[topicLength] = '\0';
+        messageCallback(topicBuffer, body + offset, length - offset);
+    }
+
+    if (qos == 1) {
+        sendAck(MqttPacketType::PUBACK, packetId);
+    } else if (qos == 2) {
+        sendAck(MqttPacketType::PUBREC, packetId);
+    }
+}
+
+void MqttSession::handleAck(MqttPacketType type, uint16_t packetId) {
+    uint32_t now = clock();
+    InflightSlot* slot = findSlot(packetId);
+
+    switch (type) {
+        case MqttPacketType::PUBACK:
+            if (slot != nullptr && slot->stage == Stage::AWAIT_PUBACK) {
+                releaseSlot(*slot, now);
+            }
+            break;
+
+        case MqttPacketType::PUBREC:
+            if (slot != nullptr && slot->stage == Stage::AWAIT_PUBREC) {
+                // Payload is no longer needed; from here on only PUBREL is retried
+                slot->stage = Stage::AWAIT_PUBCOMP;
+                slot->attempts = 1;
+                slot->sentAt = now;
+            }
+            // Answer duplicates too, the broker may have missed our PUBREL
+            sendAck(MqttPacketType::PUBREL, packetId);
+            break;
+
+        case MqttPacketType::PUBCOMP:
+            if (slot != nullptr && slot->stage == Stage::AWAIT_PUBCOMP) {
+                releaseSlot(*slot, now);
+            }
+            break;
+
+        case MqttPacketType::PUBREL:
+            for (size_t i = 0; i < qos2ReceivedCount; i++) {
+                if (qos2Received[i] == packetId) {
+                    qos2Received[i] = qos2Received[--qos2ReceivedCount];
+                    break;
+                }
+            }
+            sendAck(MqttPacketType::PUBCOMP, packetId);
+            break;
+
+        default:
+            break;
+    }
+}
+
+void MqttSession::resendInflight() {
+    // Re-send in original publish order (MQTT 3.1.1, 4.6)
+    InflightSlot* ordered[MAX_INFLIGHT];
+    size_t count = 0;
+    for (size_t i = 0; i < MAX_INFLIGHT; i++) {
+        if (slots[i].stage == Stage::FREE) {
+            continue;
+        }
+        size_t j = count++;
+        while (j > 0 && (int32_t)(ordered[j - 1]->sequence - slots[i].sequence) > 0) {
+            ordered[j] = ordered[j - 1];
+            j--;
+        }
+        ordered[j] = &slots[i];
+    }
+
+    for (size_t i = 0; i < count && isConnected(); i++) {
+        InflightSlot& slot = *ordered[i];
+        if (slot.stage == Stage::AWAIT_PUBCOMP) {
+            sendAck(MqttPacketType::PUBREL, slot.packetId);
+            slot.sentAt = clock();
+        } else {
+            sendSlot(slot, slot.attempts > 0);
+        }
+    }
+}
+
+void MqttSession::checkTimers(uint32_t now) {
+    if (state == MqttSessionState::CONNECTING) {
+        if (now - connectStartedAt >= CONNECT_TIMEOUT_MS) {
+            connectionLost("Timed out waiting for CONNACK");
+        }
+        return;
+    }
+
+    if (retransmitMs > 0) {
+        for (size_t i = 0; i < MAX_INFLIGHT && isConnected(); i++) {
+            InflightSlot& slot = slots[i];
+            if (slot.stage == Stage::FREE) {
+                continue;
+            }
+            // Back off up to 8x the base interval for a link that stays lossy
+            uint8_t shift = slot.attempts > 1 ? slot.attempts - 1 : 0;
+            uint32_t interval = retransmitMs << (shift < 3 ? shift : 3);
+            if (now - slot.sentAt < interval) {
+                continue;
+            }
+            stats.retransmits++;
+            if (slot.stage == Stage::AWAIT_PUBCOMP) {
+                if (slot.attempts < 255) {
+                    slot.attempts++;
+                }
+                slot.sentAt = now;
+                sendAck(MqttPacketType::PUBREL, slot.packetId);
+            } else {
+                sendSlot(slot, true);
+            }
+        }
+    }
+
+    if (keepAliveSec > 0 && isConnected()) {
+        uint32_t keepAliveMs = (uint32_t)keepAliveSec * 1000;
+        if (pingOutstanding) {
+            if (now - pingSentAt >= keepAliveMs) {
+                connectionLost("Keep-alive timeout");
+            }
+        } else if (now - lastOutbound >= keepAliveMs) {
+            const uint8_t packet[] = {0xC0, 0x00};
+            pingOutstanding = true;
+            pingSentAt = now;
+            send(packet, sizeof(packet));
+        }
+    }
+}
+
+void MqttSession::connectionLost(const std::string& error) {
+    lastError = error;
+    if (state == MqttSessionState::CONNECTED) {
+        stats.connectionsLost++;
+    }
+    transport.close();
+    state = MqttSessionState::DISCONNECTED;
+    // Back off from the moment the link failed, not from the last attempt
+    lastAttemptAt = clock();
+}
+
+bool MqttSession::send(const uint8_t* data, size_t length) {
+    if (transport.write(data, length) != length) {
+        connectionLost("Write failed");
+        return false;
+    }
+    lastOutbound = clock();
+    return true;
+}
+
+bool MqttSession::sendAck(MqttPacketType type, uint16_t packetId) {
+    uint8_t header = (uint8_t)type << 4;
+    if (type == MqttPacketType::PUBREL) {
+        header |= 0x02;
+    }
+    const uint8_t packet[] = {header, 0x02, (uint8_t)(packetId >> 8), (uint8_t)packetId};
+    return send(packet, sizeof(packet));
+}
+
+bool MqttSession::sendSlot(InflightSlot& slot, bool duplicate) {
+    if (duplicate) {
+        slot.packet[0] |= 0x08;
+    }
+    if (slot.attempts < 255) {
+        slot.attempts++;
+    }
+    slot.sentAt = clock();
+    return send(slot.packet.data(), slot.packet.size());
+}
+
+MqttSession::InflightSlot* MqttSession::findSlot(uint16_t packetId) {
+    for (size_t i = 0; i < MAX_INFLIGHT; i++) {
+        if (slots[i].stage != Stage::FREE && slots[i].packetId == packetId) {
+            return &slots[i];
+        }
+    }
+    return nullptr;
+}
+
+uint16_t MqttSession::allocatePacketId() {
+    // At most MAX_INFLIGHT IDs are taken, so this finds a free one quickly
+    while (true) {
+        uint16_t packetId = nextPacketId++;
+        if (nextPacketId == 0) {
+            nextPacketId = 1;
+        }
+        if (findSlot(packetId) == nullptr) {
+            return packetId;
+        }
+    }
+}
+
+void MqttSession::releaseSlot(InflightSlot& slot, uint32_t now) {
+    uint32_t latency = now - slot.firstSentAt;
+    stats.acknowledged++;
+    stats.totalAckLatencyMs += latency;
+    if (latency > stats.maxAckLatencyMs) {
+        stats.maxAckLatencyMs = latency;
+    }
+    slot.stage = Stage::FREE;
+    slot.packet.clear();
+    inflightCount--;
+}
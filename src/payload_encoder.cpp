@@ -0,0 +1,469 @@
+#include "payload_encoder.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+PayloadBuffer::PayloadBuffer(uint8_t* data, size_t capacity)
+    : buffer(data)
+    , capacity(capacity)
+    , used(0)
+    , overflow(false)
+{
+}
+
+void PayloadBuffer::put(uint8_t byte) {
+    if (used < capacity) {
+        buffer[used++] = byte;
+    } else {
+        overflow = true;
+    }
+}
+
+void PayloadBuffer::put(const void* data, size_t length) {
+    if (length > capacity - used) {
+        overflow = true;
+        return;
+    }
+    memcpy(buffer + used, data, length);
+    used += length;
+}
+
+void PayloadBuffer::reset() {
+    used = 0;
+    overflow = false;
+}
+
+const uint8_t* PayloadBuffer::data() const {
+    return buffer;
+}
+
+size_t PayloadBuffer::length() const {
+    return used;
+}
+
+bool PayloadBuffer::overflowed() const {
+    return overflow;
+}
+
+// CBOR (RFC 8949)
+void CborWriter::writeHead(uint8_t major, uint64_t value) {
+    major <<= 5;
+    if (value < 24) {
+        out.put(major | (uint8_t)value);
+    } else if (value <= 0xFF) {
+        out.put(major | 24);
+        out.put((uint8_t)value);
+    } else if (value <= 0xFFFF) {
+        out.put(major | 25);
+        out.put((uint8_t)(value >> 8));
+        out.put((uint8_t)value);
+    } else if (value <= 0xFFFFFFFFULL) {
+        out.put(major | 26);
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            out.put((uint8_t)(value >> shift));
+        }
+    } else {
+        out.put(major | 27);
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            out.put((uint8_t)(value >> shift));
+        }
+    }
+}
+
+void CborWriter::beginMap(size_t count) {
+    writeHead(5, count);
+}
+
+void CborWriter::beginArray(size_t count) {
+    writeHead(4, count);
+}
+
+void CborWriter::key(const char* name) {
+    writeString(name);
+}
+
+void CborWriter::writeUint(uint64_t value) {
+    writeHead(0, value);
+}
+
+void CborWriter::writeInt(int64_t value) {
+    if (value >= 0) {
+        writeHead(0, (uint64_t)value);
+    } else {
+        writeHead(1, (uint64_t)(-1 - value));
+    }
+}
+
+void CborWriter::writeFloat(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    out.put(0xFA);
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.put((uint8_t)(bits >> shift));
+    }
+}
+
+void CborWriter::writeBool(bool value) {
+    out.put(value ? 0xF5 : 0xF4);
+}
+
+void CborWriter::writeString(const char* value) {
+    size_t length = strlen(value);
+    writeHead(3, length);
+    out.put(value, length);
+}
+
+// MessagePack
+void MsgPackWriter::writeBigEndian(uint64_t value, size_t bytes) {
+    for (size_t i = bytes; i > 0; i--) {
+        out.put((uint8_t)(value >> (8 * (i - 1))));
+    }
+}
+
+void MsgPackWriter::beginMap(size_t count) {
+    if (count <= 15) {
+        out.put(0x80 | (uint8_t)count);
+    } else {
+        out.put(0xDE);
+        writeBigEndian(count, 2);
+    }
+}
+
+void MsgPackWriter::beginArray(size_t count) {
+    if (count <= 15) {
+        out.put(0x90 | (uint8_t)count);
+    } else if (count <= 0xFFFF) {
+        out.put(0xDC);
+        writeBigEndian(count, 2);
+    } else {
+        out.put(0xDD);
+        writeBigEndian(count, 4);
+    }
+}
+
+void MsgPackWriter::key(const char* name) {
+    writeString(name);
+}
+
+void MsgPackWriter::writeUint(uint64_t value) {
+    if (value <= 0x7F) {
+        out.put((uint8_t)value);
+    } else if (value <= 0xFF) {
+        out.put(0xCC);
+        writeBigEndian(value, 1);
+    } else if (value <= 0xFFFF) {
+        out.put(0xCD);
+        writeBigEndian(value, 2);
+    } else if (value <= 0xFFFFFFFFULL) {
+        out.put(0xCE);
+        writeBigEndian(value, 4);
+    } else {
+        out.put(0xCF);
+        writeBigEndian(value, 8);
+    }
+}
+
+void MsgPackWriter::writeInt(int64_t value) {
+    if (value >= 0) {
+        writeUint((uint64_t)value);
+    } else if (value >= -32) {
+        out.put((uint8_t)value);
+    } else if (value >= INT8_MIN) {
+        out.put(0xD0);
+        writeBigEndian((uint64_t)value, 1);
+    } else if (value >= INT16_MIN) {
+        out.put(0xD1);
+        writeBigEndian((uint64_t)value, 2);
+    } else if (value >= INT32_MIN) {
+        out.put(0xD2);
+        writeBigEndian((uint64_t)value, 4);
+    } else {
+        out.put(0xD3);
+        writeBigEndian((uint64_t)value, 8);
+    }
+}
+
+void MsgPackWriter::writeFloat(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    out.put(0xCA);
+    writeBigEndian(bits, 4);
+}
+
+void MsgPackWriter::writeBool(bool value) {
+    out.put(value ? 0xC3 : 0xC2);
+}
+
+void MsgPackWriter::writeString(const char* value) {
+    size_t length = strlen(value);
+    if (length <= 31) {
+        out.put(0xA0 | (uint8_t)length);
+    } else if (length <= 0xFF) {
+        out.put(0xD9);
+        writeBigEndian(length, 1);
+    } else {
+        out.put(0xDA);
+        writeBigEndian(length, 2);
+    }
+    out.put(value, length);
+}
+
+// JSON
+JsonWriter::JsonWriter(PayloadBuffer& out)
+    : PayloadWriter(out)
+    , depth(0)
+    , afterKey(false)
+{
+    first[0] = true;
+}
+
+void JsonWriter::separator() {
+    if (afterKey) {
+        afterKey = false;
+        return;
+    }
+    if (!first[depth]) {
+        out.put(',');
+    }
+    first[depth] = false;
+}
+
+void JsonWriter::appendf(const char* format, ...) {
+    char text[32];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (length > 0) {
+        out.put(text, (size_t)length < sizeof(text) ? length : sizeof(text) - 1);
+    }
+}
+
+void JsonWriter::beginMap(size_t) {
+    separator();
+    out.put('{');
+    if (depth + 1 < MAX_DEPTH) {
+        first[++depth] = true;
+    }
+}
+
+void JsonWriter::endMap() {
+    out.put('}');
+    if (depth > 0) {
+        depth--;
+    }
+}
+
+void JsonWriter::beginArray(size_t) {
+    separator();
+    out.put('[');
+    if (depth + 1 < MAX_DEPTH) {
+        first[++depth] = true;
+    }
+}
+
+void JsonWriter::endArray() {
+    out.put(']');
+    if (depth > 0) {
+        depth--;
+    }
+}
+
+void JsonWriter::key(const char* name) {
+    writeString(name);
+    out.put(':');
+    afterKey = true;
+}
+
+void JsonWriter::putDecimal(uint64_t value) {
+    // Integers dominate batch frames; skip vsnprintf for them
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (count > 0) {
+        out.put((uint8_t)digits[--count]);
+    }
+}
+
+void JsonWriter::writeUint(uint64_t value) {
+    separator();
+    putDecimal(value);
+}
+
+void JsonWriter::writeInt(int64_t value) {
+    separator();
+    if (value < 0) {
+        out.put('-');
+        putDecimal(0 - (uint64_t)value);
+    } else {
+        putDecimal((uint64_t)value);
+    }
+}
+
+void JsonWriter::writeFloat(float value) {
+    separator();
+    if (value != value) {
+        out.put("null", 4);
+        return;
+    }
+    appendf("%.7g", (double)value);
+}
+
+void JsonWriter::writeBool(bool value) {
+    separator();
+    if (value) {
+        out.put("true", 4);
+    } else {
+        out.put("false", 5);
+    }
+}
+
+void JsonWriter::writeString(const char* value) {
+    separator();
+    out.put('"');
+    for (const char* c = value; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            out.put('\\');
+            out.put((uint8_t)*c);
+        } else if ((uint8_t)*c < 0x20) {
+            appendf("\\u%04x", *c);
+        } else {
+            out.put((uint8_t)*c);
+        }
+    }
+    out.put('"');
+}
+
+// Protobuf
+static void putVarint(PayloadBuffer& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.put((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.put((uint8_t)value);
+}
+
+// Wall time of the first sample when the clock is synced, boot-relative otherwise
+static uint64_t batchBase(const Sample* samples, size_t count, const TimeBase* time) {
+    if (count == 0) {
+        return 0;
+    }
+    if (time == nullptr || !time->synced) {
+        return samples[0].timestampMs;
+    }
+    return time->unixMs + (int32_t)(samples[0].timestampMs - time->monotonicMs);
+}
+
+size_t encodeProtobuf(const ProtobufSchema& schema, const Sample* samples, size_t count, PayloadBuffer& out,
+                      const TimeBase* time) {
+    if (count == 0) {
+        return 0;
+    }
+    putVarint(out, (1 << 3) | 0);
+    putVarint(out, batchBase(samples, count, time));
+
+    for (size_t f = 0; f < schema.count; f++) {
+        const ProtobufField& field = schema.fields[f];
+        // Latest value of the point wins
+        const Sample* latest = nullptr;
+        for (size_t i = count; i > 0; i--) {
+            if (samples[i - 1].pointId == field.pointId) {
+                latest = &samples[i - 1];
+                break;
+            }
+        }
+        if (latest == nullptr) {
+            continue;
+        }
+
+        switch (field.type) {
+            case ProtobufType::FLOAT: {
+                uint32_t bits;
+                memcpy(&bits, &latest->value, sizeof(bits));
+                putVarint(out, ((uint32_t)field.fieldNumber << 3) | 5);
+                for (int shift = 0; shift < 32; shift += 8) {
+                    out.put((uint8_t)(bits >> shift));
+                }
+                break;
+            }
+            case ProtobufType::SINT32: {
+                int32_t value = (int32_t)latest->value;
+                putVarint(out, ((uint32_t)field.fieldNumber << 3) | 0);
+                putVarint(out, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+                break;
+            }
+            case ProtobufType::UINT32:
+                putVarint(out, ((uint32_t)field.fieldNumber << 3) | 0);
+                putVarint(out, latest->value > 0 ? (uint32_t)latest->value : 0);
+                break;
+        }
+    }
+    return out.overflowed() ? 0 : out.length();
+}
+
+static void writeBatch(PayloadWriter& writer, const Sample* samples, size_t count, const TimeBase* time) {
+    // Deltas are taken on the monotonic stamps, so they stay small either way
+    uint32_t first = count > 0 ? samples[0].timestampMs : 0;
+    writer.beginMap(2);
+    writer.key("t");
+    writer.writeUint(batchBase(samples, count, time));
+    writer.key("s");
+    writer.beginArray(count);
+    for (size_t i = 0; i < count; i++) {
+        writer.beginArray(3);
+        writer.writeUint(samples[i].pointId);
+        writer.writeFloat(samples[i].value);
+        writer.writeInt((int32_t)(samples[i].timestampMs - first));
+        writer.endArray();
+    }
+    writer.endArray();
+    writer.endMap();
+}
+
+size_t encodeSamples(PayloadFormat format, const Sample* samples, size_t count,
+                     PayloadBuffer& out, const ProtobufSchema* schema, const TimeBase* time) {
+    out.reset();
+    switch (format) {
+        case PayloadFormat::CBOR: {
+            CborWriter writer(out);
+            writeBatch(writer, samples, count, time);
+            break;
+        }
+        case PayloadFormat::MSGPACK: {
+            MsgPackWriter writer(out);
+            writeBatch(writer, samples, count, time);
+            break;
+        }
+        case PayloadFormat::PROTOBUF:
+            if (schema == nullptr) {
+                return 0;
+            }
+            return encodeProtobuf(*schema, samples, count, out, time);
+        default: {
+            JsonWriter writer(out);
+            writeBatch(writer, samples, count, time);
+            break;
+        }
+    }
+    return out.overflowed() ? 0 : out.length();
+}
+
+const char* payloadContentType(PayloadFormat format) {
+    switch (format) {
+        case PayloadFormat::CBOR:
+            return "application/cbor";
+        case PayloadFormat::MSGPACK:
+            return "application/msgpack";
+        case PayloadFormat::PROTOBUF:
+            return "application/x-protobuf";
+        default:
+            return "application/json";
+    }
+}
+
+bool isBinaryPayload(PayloadFormat format) {
+    return format != PayloadFormat::JSON;
+}
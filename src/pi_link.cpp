@@ -0,0 +1,522 @@
+#include "pi_link.h"
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <esp_random.h>
+#else
+#include <chrono>
+#include <random>
+#endif
+
+static uint32_t linkClock() {
+#ifdef ARDUINO
+    return millis();
+#else
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// A restarted side must not reuse its previous handshake nonce
+static uint32_t linkNonce() {
+#ifdef ARDUINO
+    return esp_random();
+#else
+    static std::random_device random;
+    return random();
+#endif
+}
+
+static const uint32_t CRC_TABLE[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t piLinkCrc32(uint32_t crc, const uint8_t* data, size_t length) {
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ CRC_TABLE[crc & 0x0F];
+        crc = (crc >> 4) ^ CRC_TABLE[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+size_t cobsEncode(const uint8_t* data, size_t length, uint8_t* out) {
+    size_t codeAt = 0;
+    size_t used = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] == 0) {
+            out[codeAt] = code;
+            codeAt = used++;
+            code = 1;
+            continue;
+        }
+        out[used++] = data[i];
+        // A full block of 254 non-zero bytes carries no implied zero
+        if (++code == 0xFF) {
+            out[codeAt] = code;
+            codeAt = used++;
+            code = 1;
+        }
+    }
+    out[codeAt] = code;
+    return used;
+}
+
+size_t cobsDecode(const uint8_t* data, size_t length, uint8_t* out, size_t capacity) {
+    size_t in = 0;
+    size_t used = 0;
+    while (in < length) {
+        uint8_t code = data[in++];
+        if (code == 0) {
+            return 0;
+        }
+        for (uint8_t i = 1; i < code; i++) {
+            if (in == length || data[in] == 0 || used == capacity) {
+                return 0;
+            }
+            out[used++] = data[in++];
+        }
+        if (code != 0xFF && in < length) {
+            if (used == capacity) {
+                return 0;
+            }
+            out[used++] = 0;
+        }
+    }
+    return used;
+}
+
+#ifdef ARDUINO
+void UartPiTransport::begin() {
+    // Buffer sizes only take effect before begin()
+    serial.setRxBufferSize(RX_BUFFER_SIZE);
+    serial.setTxBufferSize(TX_BUFFER_SIZE);
+    serial.begin(baud, SERIAL_8N1, rxPin, txPin);
+}
+
+size_t UartPiTransport::write(const uint8_t* data, size_t length) {
+    size_t room = serial.availableForWrite();
+    return serial.write(data, length < room ? length : room);
+}
+
+size_t UartPiTransport::read(uint8_t* data, size_t capacity) {
+    size_t available = serial.available();
+    return available == 0 ? 0 : serial.read(data, available < capacity ? available : capacity);
+}
+#endif
+
+PiLink::PiLink(PiLinkTransport& transport)
+    : transport(transport)
+    , clock(linkClock)
+    , receiveCallback(nullptr)
+    , retransmitMs(DEFAULT_RETRANSMIT_MS)
+    , started(false)
+{
+    reset();
+}
+
+void PiLink::setClock(uint32_t (*newClock)()) {
+    clock = newClock;
+}
+
+void PiLink::setRetransmitTimeout(uint32_t ms) {
+    retransmitMs = ms;
+}
+
+void PiLink::setReceiveCallback(ReceiveCallback callback) {
+    receiveCallback = callback;
+}
+
+void PiLink::begin() {
+    reset();
+    started = true;
+    startSync(clock());
+}
+
+void PiLink::reset() {
+    txUp = false;
+    syncDue = false;
+    txNonce = 0;
+    syncSentAt = 0;
+    firstSlot = 0;
+    base = 0;
+    sendNext = 0;
+    sentEnd = 0;
+    nextSeq = 0;
+    wentBack = false;
+    rxSynced = false;
+    expected = 0;
+    unacked = 0;
+    ackDueAt = 0;
+    ackNow = false;
+    nackSent = false;
+    nackDue = false;
+    resetAckDue = false;
+    peerNonce = 0;
+    rxLength = 0;
+    rxDiscarding = false;
+    // Whatever the peer holds of a partial frame ends at our first delimiter
+    txBuffer[0] = 0;
+    txLength = 1;
+    txOffset = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+void PiLink::update() {
+    if (!started) {
+        return;
+    }
+    uint32_t now = clock();
+    flush();
+    receive(now);
+
+    if (!txUp && now - syncSentAt >= SYNC_INTERVAL_MS) {
+        syncDue = true;
+    }
+    if (syncDue && queueNonce(FRAME_RESET, txNonce)) {
+        syncDue = false;
+        syncSentAt = now;
+    }
+    if (resetAckDue && queueNonce(FRAME_RESET_ACK, peerNonce)) {
+        resetAckDue = false;
+    }
+    if (nackDue && queueFrame(FRAME_NACK, 0, 0, nullptr, 0)) {
+        nackDue = false;
+    }
+
+    // Go back N: the oldest frame's timer covers the whole window
+    if (txUp && sendNext != base && now - slotFor(base).sentAt >= retransmitMs) {
+        stats.retransmits += (uint8_t)(sendNext - base);
+        sendNext = base;
+    }
+    transmit(now);
+
+    if (rxSynced && (ackNow || (unacked > 0 && (int32_t)(now - ackDueAt) >= 0))
+        && queueFrame(FRAME_ACK, 0, 0, nullptr, 0)) {
+        unacked = 0;
+        ackNow = false;
+    }
+    flush();
+}
+
+bool PiLink::send(PiChannel channel, const uint8_t* data, size_t length) {
+    if (!started || length > MAX_PAYLOAD || inFlight() >= WINDOW) {
+        return false;
+    }
+    Slot& slot = slots[(firstSlot + inFlight()) % WINDOW];
+    slot.channel = channel;
+    slot.length = (uint16_t)length;
+    memcpy(slot.payload, data, length);
+    nextSeq++;
+    // Straight out when the window allows; update() handles the rest
+    transmit(clock());
+    flush();
+    return true;
+}
+
+PiLinkState PiLink::getState() const {
+    if (!started) {
+        return PiLinkState::DOWN;
+    }
+    return txUp && rxSynced ? PiLinkState::UP : PiLinkState::SYNCING;
+}
+
+bool PiLink::isUp() const {
+    return getState() == PiLinkState::UP;
+}
+
+size_t PiLink::getPending() const {
+    return inFlight();
+}
+
+uint32_t PiLink::msUntilDue() const {
+    if (!started) {
+        return NEVER;
+    }
+    bool room = TX_BUFFER_SIZE - txLength >= MAX_ENCODED || txOffset == txLength;
+    if (room && (syncDue || resetAckDue || nackDue || ackNow || (txUp && sendNext != nextSeq))) {
+        return 0;
+    }
+    uint32_t now = clock();
+    uint32_t due = NEVER;
+    if (!txUp) {
+        uint32_t elapsed = now - syncSentAt;
+        due = elapsed >= SYNC_INTERVAL_MS ? 0 : SYNC_INTERVAL_MS - elapsed;
+    }
+    if (rxSynced && unacked > 0) {
+        int32_t left = (int32_t)(ackDueAt - now);
+        uint32_t ackIn = left > 0 ? (uint32_t)left : 0;
+        due = ackIn < due ? ackIn : due;
+    }
+    if (txUp && sendNext != base) {
+        uint32_t elapsed = now - slots[firstSlot].sentAt;
+        uint32_t resendIn = elapsed >= retransmitMs ? 0 : retransmitMs - elapsed;
+        due = resendIn < due ? resendIn : due;
+    }
+    return due;
+}
+
+bool PiLink::wantsWrite() const {
+    return txOffset < txLength;
+}
+
+const PiLinkStats& PiLink::getStats() const {
+    return stats;
+}
+
+void PiLink::startSync(uint32_t now) {
+    txUp = false;
+    syncDue = true;
+    syncSentAt = now;
+    txNonce = linkNonce();
+    // Everything unacknowledged goes again once the handshake completes
+    sendNext = base;
+    sentEnd = base;
+}
+
+void PiLink::receive(uint32_t now) {
+    // Bounded, so a flooding peer cannot starve the caller
+    uint8_t chunk[256];
+    for (int reads = 0; reads < 16; reads++) {
+        size_t count = transport.read(chunk, sizeof(chunk));
+        if (count == 0) {
+            return;
+        }
+        stats.bytesReceived += count;
+        for (size_t i = 0; i < count; i++) {
+            uint8_t byte = chunk[i];
+            if (byte == 0) {
+                if (!rxDiscarding && rxLength > 0) {
+                    size_t length = cobsDecode(rxBuffer, rxLength, rxFrame, sizeof(rxFrame));
+                    if (length == 0) {
+                        stats.framingErrors++;
+                    } else {
+                        handleFrame(rxFrame, length, now);
+                    }
+                }
+                rxLength = 0;
+                rxDiscarding = false;
+            } else if (rxDiscarding) {
+                continue;
+            } else if (rxLength == sizeof(rxBuffer)) {
+                stats.framingErrors++;
+                rxDiscarding = true;
+            } else {
+                rxBuffer[rxLength++] = byte;
+            }
+        }
+    }
+}
+
+void PiLink::handleFrame(const uint8_t* frame, size_t length, uint32_t now) {
+    if (length < HEADER_SIZE + CRC_SIZE) {
+        stats.framingErrors++;
+        return;
+    }
+    size_t bodyLength = length - CRC_SIZE;
+    const uint8_t* tail = frame + bodyLength;
+    uint32_t crc = (uint32_t)tail[0] | ((uint32_t)tail[1] << 8) | ((uint32_t)tail[2] << 16) | ((uint32_t)tail[3] << 24);
+    if (piLinkCrc32(0, frame, bodyLength) != crc) {
+        stats.crcErrors++;
+        return;
+    }
+
+    uint8_t type = frame[0];
+    uint8_t seq = frame[1];
+    uint8_t ack = frame[2];
+    const uint8_t* payload = frame + HEADER_SIZE;
+    size_t payloadLength = bodyLength - HEADER_SIZE;
+    uint32_t nonce = 0;
+    if (payloadLength == 4) {
+        nonce = (uint32_t)payload[0] | ((uint32_t)payload[1] << 8) | ((uint32_t)payload[2] << 16)
+                | ((uint32_t)payload[3] << 24);
+    }
+
+    switch (type) {
+        case FRAME_DATA:
+            if (!rxSynced) {
+                return;
+            }
+            handleAck(ack, false);
+            if (seq == expected) {
+                expected++;
+                nackSent = false;
+                if (unacked++ == 0) {
+                    ackDueAt = now + ACK_DELAY_MS;
+                }
+                if (unacked >= WINDOW / 2) {
+                    ackNow = true;
+                }
+                stats.framesReceived++;
+                if (receiveCallback) {
+                    receiveCallback(static_cast<PiChannel>(frame[3]), payload, payloadLength);
+                }
+            } else if ((uint8_t)(expected - seq) < 128) {
+                // Our ack got lost; say again how far we are
+                stats.duplicates++;
+                ackNow = true;
+            } else {
+                stats.outOfOrder++;
+                if (!nackSent) {
+                    nackSent = true;
+                    nackDue = true;
+                }
+            }
+            break;
+
+        case FRAME_ACK:
+        case FRAME_NACK:
+            if (rxSynced || txUp) {
+                handleAck(ack, type == FRAME_NACK);
+            }
+            break;
+
+        case FRAME_RESET:
+            if (payloadLength != 4) {
+                stats.framingErrors++;
+                return;
+            }
+            resetAckDue = true;
+            // A retried RESET of the handshake we already answered
+            if (rxSynced && nonce == peerNonce) {
+                return;
+            }
+            stats.resets++;
+            peerNonce = nonce;
+            rxSynced = true;
+            expected = 0;
+            unacked = 0;
+            ackNow = false;
+            nackSent = false;
+            nackDue = false;
+            // The peer restarted and forgot our sequence numbers as well
+            if (txUp) {
+                startSync(now);
+            }
+            break;
+
+        case FRAME_RESET_ACK:
+            if (txUp || payloadLength != 4 || nonce != txNonce) {
+                return;
+            }
+            txUp = true;
+            // Renumber what is queued so it starts at 0, as the peer expects
+            nextSeq = inFlight();
+            base = 0;
+            sendNext = 0;
+            sentEnd = 0;
+            wentBack = false;
+            break;
+
+        default:
+            stats.framingErrors++;
+            break;
+    }
+}
+
+void PiLink::handleAck(uint8_t ack, bool nack) {
+    if (!txUp) {
+        return;
+    }
+    uint8_t advance = (uint8_t)(ack - base);
+    // Only what went on the wire can be acknowledged
+    if (advance > (uint8_t)(sentEnd - base)) {
+        return;
+    }
+    if (advance > 0) {
+        firstSlot = (uint8_t)((firstSlot + advance) % WINDOW);
+        if ((uint8_t)(sendNext - base) < advance) {
+            sendNext = ack;
+        }
+        base = ack;
+        wentBack = false;
+    }
+    if (nack && !wentBack && sendNext != base) {
+        stats.retransmits += (uint8_t)(sendNext - base);
+        sendNext = base;
+        wentBack = true;
+    }
+}
+
+void PiLink::transmit(uint32_t now) {
+    while (txUp && sendNext != nextSeq) {
+        Slot& slot = slotFor(sendNext);
+        if (!queueFrame(FRAME_DATA, sendNext, static_cast<uint8_t>(slot.channel), slot.payload, slot.length)) {
+            return;
+        }
+        slot.sentAt = now;
+        stats.framesSent++;
+        sendNext++;
+        if ((uint8_t)(sendNext - base) > (uint8_t)(sentEnd - base)) {
+            sentEnd = sendNext;
+        }
+    }
+}
+
+bool PiLink::queueFrame(FrameType type, uint8_t seq, uint8_t channel, const uint8_t* payload, size_t length) {
+    if (txOffset == txLength) {
+        txOffset = 0;
+        txLength = 0;
+    }
+    size_t frameLength = HEADER_SIZE + length + CRC_SIZE;
+    size_t encodedMax = frameLength + frameLength / 254 + 2;
+    if (TX_BUFFER_SIZE - txLength < encodedMax) {
+        if (txOffset == 0 || TX_BUFFER_SIZE - (txLength - txOffset) < encodedMax) {
+            return false;
+        }
+        memmove(txBuffer, txBuffer + txOffset, txLength - txOffset);
+        txLength -= txOffset;
+        txOffset = 0;
+    }
+
+    txFrame[0] = type;
+    txFrame[1] = seq;
+    // Every frame carries our receive position once the peer's handshake is done
+    txFrame[2] = rxSynced ? expected : 0;
+    txFrame[3] = channel;
+    if (length > 0) {
+        memcpy(txFrame + HEADER_SIZE, payload, length);
+    }
+    uint32_t crc = piLinkCrc32(0, txFrame, HEADER_SIZE + length);
+    uint8_t* tail = txFrame + HEADER_SIZE + length;
+    tail[0] = (uint8_t)crc;
+    tail[1] = (uint8_t)(crc >> 8);
+    tail[2] = (uint8_t)(crc >> 16);
+    tail[3] = (uint8_t)(crc >> 24);
+
+    txLength += cobsEncode(txFrame, frameLength, txBuffer + txLength);
+    txBuffer[txLength++] = 0;
+    if (type == FRAME_DATA && rxSynced) {
+        unacked = 0;
+        ackNow = false;
+    }
+    return true;
+}
+
+bool PiLink::queueNonce(FrameType type, uint32_t nonce) {
+    uint8_t payload[4] = {(uint8_t)nonce, (uint8_t)(nonce >> 8), (uint8_t)(nonce >> 16), (uint8_t)(nonce >> 24)};
+    return queueFrame(type, 0, 0, payload, sizeof(payload));
+}
+
+void PiLink::flush() {
+    while (txOffset < txLength) {
+        size_t written = transport.write(txBuffer + txOffset, txLength - txOffset);
+        if (written == 0) {
+            return;
+        }
+        txOffset += written;
+        stats.bytesSent += written;
+    }
+}
+
+PiLink::Slot& PiLink::slotFor(uint8_t seq) {
+    return slots[(firstSlot + (uint8_t)(seq - base)) % WINDOW];
+}
+
+uint8_t PiLink::inFlight() const {
+    return (uint8_t)(nextSeq - base);
+}
@@ -0,0 +1,77 @@
+#include "protocol_context.h"
+
+ProtocolContext::ProtocolContext()
+    : messageCallback(nullptr)
+{
+    memset(&compressionStats, 0, sizeof(compressionStats));
+    for (size_t i = 0; i < PROTOCOL_TYPE_COUNT; i++) {
+        states[i] = ProtocolState::DISCONNECTED;
+        names[i] = "?";
+    }
+}
+
+ProtocolState ProtocolContext::getState(ProtocolType protocol) const {
+    return states[static_cast<size_t>(protocol)];
+}
+
+void ProtocolContext::setState(ProtocolType protocol, ProtocolState state) {
+    states[static_cast<size_t>(protocol)] = state;
+}
+
+bool ProtocolContext::isConnected(ProtocolType protocol) const {
+    return states[static_cast<size_t>(protocol)] == ProtocolState::CONNECTED;
+}
+
+const String& ProtocolContext::getLastError(ProtocolType protocol) const {
+    return lastErrors[static_cast<size_t>(protocol)];
+}
+
+void ProtocolContext::setError(ProtocolType protocol, const String& error) {
+    lastErrors[static_cast<size_t>(protocol)] = error;
+    log(protocol, "Error: " + error);
+}
+
+void ProtocolContext::clearError(ProtocolType protocol) {
+    lastErrors[static_cast<size_t>(protocol)] = "";
+}
+
+void ProtocolContext::setName(ProtocolType protocol, const char* name) {
+    names[static_cast<size_t>(protocol)] = name;
+}
+
+void ProtocolContext::log(ProtocolType protocol, const String& event) const {
+    Serial.println("[" + String(names[static_cast<size_t>(protocol)]) + "] " + event);
+}
+
+void ProtocolContext::deliver(const ProtocolMessage& message) const {
+    if (messageCallback) {
+        messageCallback(message);
+    }
+}
+
+size_t ProtocolContext::compress(const String& payload, DeflateContainer container, size_t headroom) {
+    if (payload.length() < MIN_COMPRESS_SIZE) {
+        compressionStats.skipped++;
+        return 0;
+    }
+    uint32_t startedAt = micros();
+    size_t length = deflate.compress(container, (const uint8_t*)payload.c_str(), payload.length(),
+                                     compressBuffer + headroom, sizeof(compressBuffer) - headroom);
+    compressionStats.busyUs += micros() - startedAt;
+    if (length == 0 || length >= payload.length()) {
+        compressionStats.skipped++;
+        return 0;
+    }
+    compressionStats.messages++;
+    compressionStats.bytesIn += payload.length();
+    compressionStats.bytesOut += length;
+    return length;
+}
+
+uint8_t* ProtocolContext::compressed() {
+    return compressBuffer;
+}
+
+const CompressionStats& ProtocolContext::getCompressionStats() const {
+    return compressionStats;
+}
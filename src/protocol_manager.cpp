@@ -1,168 +1,553 @@
 #include "protocol_manager.h"
-#include <WiFiUdp.h>
+#include <limits>
+
+// Visitors handed to the driver registry; each call resolves to the
+// concrete driver at compile time
+namespace {
+
+struct NameOp {
+    ProtocolContext& context;
+    template <typename Driver>
+    void operator()(Driver&) {
+        context.setName(Driver::TYPE, Driver::name());
+    }
+};
+
+struct BeginOp {
+    template <typename Driver>
+    void operator()(Driver& driver) {
+        driver.begin();
+    }
+};
+
+struct UpdateOp {
+    template <typename Driver>
+    void operator()(Driver& driver) {
+        driver.update();
+    }
+};
+
+struct ConnectOp {
+    bool result;
+    template <typename Driver>
+    void operator()(Driver& driver) {
+        result = driver.connect();
+    }
+};
+
+struct DisconnectOp {
+    template <typename Driver>
+    void operator()(Driver& driver) {
+        driver.disconnect();
+    }
+};
+
+struct ConfiguredOp {
+    bool result;
+    template <typename Driver>
+    void operator()(Driver& driver) {
+        result = driver.isConfigured();
+    }
+};
+
+struct LinkDownOp {
+    template <typename Driver>
+    void operator()(Driver& driver) {
+        driver.linkDown();
+    }
+};
+
+struct SendOp {
+    const ProtocolMessage& message;
+    bool attempted;
+    bool sent;
+    uint32_t latencyMs;
+    template <typename Driver>
+    void operator()(Driver& driver) {
+        if (!driver.canSend(message)) {
+            return;
+        }
+        uint32_t start = millis();
+        attempted = true;
+        sent = driver.publish(message);
+        latencyMs = driver.latencyMs(millis() - start);
+    }
+};
+
+struct SubscribeOp {
+    const String& topic;
+    bool result;
+    template <typename Driver>
+    void operator()(Driver& driver) {
+        result = driver.subscribe(topic);
+    }
+};
+
+struct ReconfigureOp {
+    template <typename Driver>
+    void operator()(Driver& driver) {
+        driver.reconfigure();
+    }
+};
+
+struct InflightOp {
+    size_t result;
+    template <typename Driver>
+    void operator()(const Driver& driver) {
+        result = driver.inflight();
+    }
+};
+
+const uint8_t MQTT_BIT = protocolBit(ProtocolType::MQTT);
+const uint8_t HTTP_BITS = protocolBit(ProtocolType::HTTP) | protocolBit(ProtocolType::HTTPS);
+const uint8_t TLS_BITS = protocolBit(ProtocolType::MQTT) | protocolBit(ProtocolType::HTTPS)
+                         | protocolBit(ProtocolType::WEBSOCKET);
+const uint8_t WS_BIT = protocolBit(ProtocolType::WEBSOCKET);
+const uint8_t COAP_BIT = protocolBit(ProtocolType::COAP);
+const uint8_t CUSTOM_BIT = protocolBit(ProtocolType::CUSTOM);
+
+// Which uplinks each saved field belongs to, and how a change reaches them
+const FieldRule CONFIG_RULES[] = {
+    {"mqttBroker", MQTT_BIT, FieldEffect::RECONNECT},
+    {"mqttPort", MQTT_BIT, FieldEffect::RECONNECT},
+    {"mqttUsername", MQTT_BIT, FieldEffect::RECONNECT},
+    {"mqttPassword", MQTT_BIT, FieldEffect::RECONNECT},
+    {"mqttClientId", MQTT_BIT, FieldEffect::RECONNECT},
+    // Topics are built per message by the application
+    {"mqttTopicPrefix", MQTT_BIT, FieldEffect::LIVE},
+    {"mqttInflightWindow", MQTT_BIT, FieldEffect::LIVE},
+    {"mqttRetransmitMs", MQTT_BIT, FieldEffect::LIVE},
+    {"mqttUseTls", MQTT_BIT, FieldEffect::RECONNECT},
+    {"httpServer", HTTP_BITS, FieldEffect::RECONNECT},
+    {"httpPort", HTTP_BITS, FieldEffect::RECONNECT},
+    {"useHttps", HTTP_BITS, FieldEffect::RECONNECT},
+    {"httpUsername", HTTP_BITS, FieldEffect::RECONNECT},
+    {"httpPassword", HTTP_BITS, FieldEffect::RECONNECT},
+    // Decided per request
+    {"httpCompress", HTTP_BITS, FieldEffect::LIVE},
+    {"wsServer", WS_BIT, FieldEffect::RECONNECT},
+    {"wsPort", WS_BIT, FieldEffect::RECONNECT},
+    {"wsPath", WS_BIT, FieldEffect::RECONNECT},
+    {"wsSecure", WS_BIT, FieldEffect::RECONNECT},
+    // The subprotocol is negotiated in the handshake
+    {"wsCompress", WS_BIT, FieldEffect::RECONNECT},
+    {"tlsCaFile", TLS_BITS, FieldEffect::TLS},
+    {"tlsCertFile", TLS_BITS, FieldEffect::TLS},
+    {"tlsKeyFile", TLS_BITS, FieldEffect::TLS},
+    {"coapServer", COAP_BIT, FieldEffect::RECONNECT},
+    {"coapPort", COAP_BIT, FieldEffect::RECONNECT},
+    {"customProtocol", CUSTOM_BIT, FieldEffect::RECONNECT},
+    {"customConfig", CUSTOM_BIT, FieldEffect::RECONNECT},
+};
+
+const size_t CONFIG_RULE_COUNT = sizeof(CONFIG_RULES) / sizeof(CONFIG_RULES[0]);
+
+void putText(ConfigValues& values, const char* key, const String& value) {
+    values.push_back({key, value.c_str()});
+}
+
+void putNumber(ConfigValues& values, const char* key, uint32_t value) {
+    values.push_back({key, std::to_string(value)});
+}
+
+void putFlag(ConfigValues& values, const char* key, bool value) {
+    values.push_back({key, value ? "true" : "false"});
+}
+
+ConfigValues toValues(const ProtocolConfig& config) {
+    ConfigValues values;
+    putText(values, "mqttBroker", config.mqttBroker);
+    putNumber(values, "mqttPort", config.mqttPort);
+    putText(values, "mqttUsername", config.mqttUsername);
+    putText(values, "mqttPassword", config.mqttPassword);
+    putText(values, "mqttClientId", config.mqttClientId);
+    putText(values, "mqttTopicPrefix", config.mqttTopicPrefix);
+    putNumber(values, "mqttInflightWindow", config.mqttInflightWindow);
+    putNumber(values, "mqttRetransmitMs", config.mqttRetransmitMs);
+    putFlag(values, "mqttUseTls", config.mqttUseTls);
+    putText(values, "httpServer", config.httpServer);
+    putNumber(values, "httpPort", config.httpPort);
+    putFlag(values, "useHttps", config.useHttps);
+    putText(values, "httpUsername", config.httpUsername);
+    putText(values, "httpPassword", config.httpPassword);
+    putFlag(values, "httpCompress", config.httpCompress);
+    putText(values, "wsServer", config.wsServer);
+    putNumber(values, "wsPort", config.wsPort);
+    putText(values, "wsPath", config.wsPath);
+    putFlag(values, "wsSecure", config.wsSecure);
+    putFlag(values, "wsCompress", config.wsCompress);
+    putText(values, "tlsCaFile", config.tlsCaFile);
+    putText(values, "tlsCertFile", config.tlsCertFile);
+    putText(values, "tlsKeyFile", config.tlsKeyFile);
+    putText(values, "coapServer", config.coapServer);
+    putNumber(values, "coapPort", config.coapPort);
+    putText(values, "customProtocol", config.customProtocol);
+    putText(values, "customConfig", config.customConfig);
+    return values;
+}
+
+// Parses text values back into typed fields; remembers the first bad one
+class ConfigReader {
+public:
+    explicit ConfigReader(const ConfigValues& values) : values(values) {}
+
+    void text(const char* key, String& out) {
+        const std::string* value = find(key);
+        if (value != nullptr) {
+            out = value->c_str();
+        }
+    }
+
+    template <typename T>
+    void number(const char* key, T& out) {
+        const std::string* value = find(key);
+        if (value == nullptr) {
+            return;
+        }
+        char* end = nullptr;
+        unsigned long parsed = strtoul(value->c_str(), &end, 10);
+        if (value->empty() || *end != '\0' || (*value)[0] == '-' || parsed > std::numeric_limits<T>::max()) {
+            fail(key, "is not a valid number");
+            return;
+        }
+        out = (T)parsed;
+    }
+
+    void flag(const char* key, bool& out) {
+        const std::string* value = find(key);
+        if (value == nullptr) {
+            return;
+        }
+        if (*value == "true" || *value == "1") {
+            out = true;
+        } else if (*value == "false" || *value == "0") {
+            out = false;
+        } else {
+            fail(key, "must be true or false");
+        }
+    }
+
+    bool ok() const {
+        return error.empty();
+    }
+
+    const std::string& getError() const {
+        return error;
+    }
+
+private:
+    const ConfigValues& values;
+    std::string error;
+
+    const std::string* find(const char* key) const {
+        for (const ConfigField& field : values) {
+            if (field.key == key) {
+                return &field.value;
+            }
+        }
+        return nullptr;
+    }
+
+    void fail(const char* key, const char* reason) {
+        if (error.empty()) {
+            error = std::string(key) + " " + reason;
+        }
+    }
+};
+
+bool fromValues(const ConfigValues& values, ProtocolConfig& config, std::string& error) {
+    ConfigReader reader(values);
+    reader.text("mqttBroker", config.mqttBroker);
+    reader.number("mqttPort", config.mqttPort);
+    reader.text("mqttUsername", config.mqttUsername);
+    reader.text("mqttPassword", config.mqttPassword);
+    reader.text("mqttClientId", config.mqttClientId);
+    reader.text("mqttTopicPrefix", config.mqttTopicPrefix);
+    reader.number("mqttInflightWindow", config.mqttInflightWindow);
+    reader.number("mqttRetransmitMs", config.mqttRetransmitMs);
+    reader.flag("mqttUseTls", config.mqttUseTls);
+    reader.text("httpServer", config.httpServer);
+    reader.number("httpPort", config.httpPort);
+    reader.flag("useHttps", config.useHttps);
+    reader.text("httpUsername", config.httpUsername);
+    reader.text("httpPassword", config.httpPassword);
+    reader.flag("httpCompress", config.httpCompress);
+    reader.text("wsServer", config.wsServer);
+    reader.number("wsPort", config.wsPort);
+    reader.text("wsPath", config.wsPath);
+    reader.flag("wsSecure", config.wsSecure);
+    reader.flag("wsCompress", config.wsCompress);
+    reader.text("tlsCaFile", config.tlsCaFile);
+    reader.text("tlsCertFile", config.tlsCertFile);
+    reader.text("tlsKeyFile", config.tlsKeyFile);
+    reader.text("coapServer", config.coapServer);
+    reader.number("coapPort", config.coapPort);
+    reader.text("customProtocol", config.customProtocol);
+    reader.text("customConfig", config.customConfig);
+    error = reader.getError();
+    return reader.ok();
+}
+
+}
 
 ProtocolManager::ProtocolManager()
-    : mqttClient(wifiClient)
-    , messageCallback(nullptr)
-    , udp(new WiFiUDP())
-    , coap(*udp)
+    : drivers(context)
+    , configApplier(*this, CONFIG_RULES, CONFIG_RULE_COUNT)
+    , configReportCallback(nullptr)
+    , protobufSchema(nullptr)
+    , timeService(nullptr)
+    , messagePool(MAX_QUEUE_SIZE)
+    , scheduler(MAX_QUEUE_SIZE)
 {
-    // Initialize states
-    states[ProtocolType::MQTT] = ProtocolState::DISCONNECTED;
-    states[ProtocolType::HTTP] = ProtocolState::DISCONNECTED;
-    states[ProtocolType::HTTPS] = ProtocolState::DISCONNECTED;
-    states[ProtocolType::WEBSOCKET] = ProtocolState::DISCONNECTED;
-    states[ProtocolType::COAP] = ProtocolState::DISCONNECTED;
-    states[ProtocolType::CUSTOM] = ProtocolState::DISCONNECTED;
+    NameOp name = {context};
+    drivers.forEach(name);
+
+    for (size_t i = 0; i < PROTOCOL_TYPE_COUNT; i++) {
+        protocolFormats[i] = PayloadFormat::JSON;
+        held[i] = false;
+    }
+    for (size_t slot = MAX_QUEUE_SIZE; slot-- > 0;) {
+        freeSlots.push_back((uint16_t)slot);
+    }
     
     // Set default configuration
+    ProtocolConfig& config = context.config;
     config.mqttPort = 1883;
+    config.mqttInflightWindow = 16;
+    config.mqttRetransmitMs = 5000;
+    config.mqttUseTls = false;
     config.httpPort = 80;
     config.wsPort = 80;
     config.coapPort = 5683;
     config.useHttps = false;
+    config.httpCompress = false;
     config.wsSecure = false;
+    config.wsCompress = false;
+    config.tlsCaFile = "/certs/ca.pem";
+    config.tlsCertFile = "/certs/client.crt";
+    config.tlsKeyFile = "/certs/client.key";
     config.mqttClientId = "CERISE-GW-" + String((uint32_t)ESP.getEfuseMac(), HEX);
+
+    configApplier.setReportCallback([this](const ApplyReport& report) {
+        Serial.println("[Config] " + String(exportApplyReport(report).c_str()));
+        if (configReportCallback) {
+            configReportCallback(report);
+        }
+    });
 }
 
 void ProtocolManager::begin() {
-    // Initialize MQTT
-    mqttClient.setCallback([this](char* topic, byte* payload, unsigned int length) {
-        handleMqttMessage(topic, payload, length);
-    });
+    BeginOp begin;
+    drivers.forEach(begin);
     
-    // Initialize WebSocket
-    webSocket.onEvent([this](WStype_t type, uint8_t* payload, size_t length) {
-        handleWebSocketEvent(type, payload, length);
-    });
-    
-    // Initialize CoAP
-    coap.response([this](CoapPacket& packet, IPAddress ip, int port) {
-        handleCoapResponse(packet, ip, port);
-    });
-    coap.start();
-    
-    // Load configuration
+    // Load configuration; certificates are parsed once here, not per connection
     loadConfig();
+    loadTlsCredentials();
 }
 
 void ProtocolManager::update() {
-    // Update MQTT
-    if (states[ProtocolType::MQTT] == ProtocolState::CONNECTED) {
-        mqttClient.loop();
-    }
+    UpdateOp update;
+    drivers.forEach(update);
+
+    // A config change in progress drains, swaps or reconnects its uplinks
+    configApplier.update();
     
-    // Update WebSocket
-    if (states[ProtocolType::WEBSOCKET] == ProtocolState::CONNECTED) {
-        webSocket.loop();
-    }
+    // Health first, so queued traffic moves off a failed uplink this tick
+    refreshUplinkHealth();
     
     // Process message queue
     processMessageQueue();
 }
 
 bool ProtocolManager::connect(ProtocolType protocol) {
-    switch (protocol) {
-        case ProtocolType::MQTT:
-            return connectMqtt();
-        case ProtocolType::HTTP:
-        case ProtocolType::HTTPS:
-            return connectHttp(protocol == ProtocolType::HTTPS);
-        case ProtocolType::WEBSOCKET:
-            return connectWebSocket();
-        case ProtocolType::COAP:
-            return connectCoap();
-        case ProtocolType::CUSTOM:
-            return connectCustom();
-        default:
-            return false;
-    }
+    ConnectOp connect = {false};
+    drivers.visit(protocol, connect);
+    return connect.result;
 }
 
 void ProtocolManager::disconnect(ProtocolType protocol) {
-    switch (protocol) {
-        case ProtocolType::MQTT:
-            mqttClient.disconnect();
-            break;
-        case ProtocolType::WEBSOCKET:
-            webSocket.disconnect();
-            break;
-        case ProtocolType::COAP:
-            // CoAP doesn't have a stop method, just mark as disconnected
-            break;
-        default:
-            break;
-    }
-    states[protocol] = ProtocolState::DISCONNECTED;
+    DisconnectOp disconnect;
+    drivers.visit(protocol, disconnect);
 }
 
 bool ProtocolManager::isConnected(ProtocolType protocol) const {
-    return states.at(protocol) == ProtocolState::CONNECTED;
+    return context.isConnected(protocol);
 }
 
 bool ProtocolManager::publish(const ProtocolMessage& message) {
-    if (!isConnected(message.protocol)) {
-        return addToQueue(message);
+    // Everything goes through the scheduler, so priorities and rate limits
+    // apply; with an idle queue and tokens to spare it leaves right away
+    if (!addToQueue(message)) {
+        return false;
     }
-    
-    switch (message.protocol) {
-        case ProtocolType::MQTT:
-            return mqttClient.publish(message.topic.c_str(), message.payload.c_str(), message.retain);
-            
-        case ProtocolType::HTTP:
-        case ProtocolType::HTTPS:
-            return publishHttp(message);
-            
-        case ProtocolType::WEBSOCKET: {
-            // Create a non-const copy of the payload for WebSocket
-            String payloadCopy = message.payload;
-            return webSocket.sendTXT(payloadCopy);
+    processMessageQueue();
+    return true;
+}
+
+bool ProtocolManager::dispatch(const ProtocolMessage& message) {
+    ProtocolType targets[UplinkRouter::MAX_UPLINKS];
+    size_t count = context.router.route(message.topic.c_str(), message.protocol, millis(), targets);
+    // Mirrored messages count as delivered once any uplink took them
+    bool delivered = false;
+    for (size_t i = 0; i < count; i++) {
+        if (sendVia(message, targets[i])) {
+            delivered = true;
         }
-            
-        case ProtocolType::COAP:
-            return publishCoap(message);
-            
-        case ProtocolType::CUSTOM:
-            return publishCustom(message);
-            
-        default:
-            return false;
     }
+    return delivered;
 }
 
-bool ProtocolManager::subscribe(const String& topic, ProtocolType protocol) {
-    switch (protocol) {
-        case ProtocolType::MQTT:
-            return mqttClient.subscribe(topic.c_str());
-            
-        case ProtocolType::WEBSOCKET:
-            // WebSocket doesn't have a subscription mechanism
+bool ProtocolManager::sendVia(const ProtocolMessage& message, ProtocolType protocol) {
+    // A held uplink is draining for a config change; its messages wait
+    if (!isConnected(protocol) || held[static_cast<size_t>(protocol)]) {
+        return false;
+    }
+    // Charged only once routing has picked this uplink; a failed send gets
+    // its token back since the message stays queued
+    TokenBucket& bucket = uplinkBuckets[static_cast<size_t>(protocol)];
+    if (!bucket.consume(millis())) {
+        return false;
+    }
+    SendOp send = {message, false, false, 0};
+    drivers.visit(protocol, send);
+    if (!send.attempted) {
+        bucket.refund();
+        return false;
+    }
+    context.router.recordResult(protocol, send.sent, send.latencyMs, millis());
+    if (!send.sent) {
+        bucket.refund();
+        context.setError(protocol, "Failed to send on " + message.topic);
+    } else if (!context.getLastError(protocol).isEmpty()) {
+        context.clearError(protocol);
+    }
+    return send.sent;
+}
+
+bool ProtocolManager::publishSamples(const String& topic, const Sample* samples, size_t count,
+                                     ProtocolType protocol, uint8_t qos, MessagePriority priority) {
+    PayloadFormat format = getPayloadFormat(protocol, topic);
+    PayloadBuffer buffer(payloadBuffer, sizeof(payloadBuffer));
+    TimeBase timeBase;
+    if (timeService != nullptr) {
+        timeBase = timeService->timeBase();
+    }
+    size_t length = encodeSamples(format, samples, count, buffer, protobufSchema,
+                                  timeService != nullptr ? &timeBase : nullptr);
+    if (length == 0) {
+        context.setError(protocol, "Failed to encode payload for " + topic);
+        return false;
+    }
+
+    ProtocolMessage message;
+    message.topic = topic;
+    message.payload.reserve(length);
+    message.payload.concat((const char*)payloadBuffer, length);
+    message.protocol = protocol;
+    message.retain = false;
+    message.qos = qos;
+    message.isResponse = false;
+    message.format = format;
+    message.priority = priority;
+    return publish(message);
+}
+
+void ProtocolManager::setPayloadFormat(ProtocolType protocol, PayloadFormat format) {
+    protocolFormats[static_cast<size_t>(protocol)] = format;
+}
+
+void ProtocolManager::setTopicPayloadFormat(const String& topicPrefix, PayloadFormat format) {
+    for (auto& rule : topicFormats) {
+        if (rule.first == topicPrefix) {
+            rule.second = format;
+            return;
+        }
+    }
+    topicFormats.push_back(std::make_pair(topicPrefix, format));
+}
+
+void ProtocolManager::setProtobufSchema(const ProtobufSchema* schema) {
+    protobufSchema = schema;
+}
+
+void ProtocolManager::setTimeService(const TimeService* time) {
+    timeService = time;
+}
+
+bool ProtocolManager::setRoute(const String& topicPrefix, RoutePolicy policy,
+                               const UplinkChoice* uplinks, size_t count) {
+    return context.router.setRoute(topicPrefix.c_str(), policy, uplinks, count);
+}
+
+bool ProtocolManager::removeRoute(const String& topicPrefix) {
+    return context.router.removeRoute(topicPrefix.c_str());
+}
+
+const UplinkHealth& ProtocolManager::getUplinkHealth(ProtocolType protocol) const {
+    return context.router.getHealth(protocol);
+}
+
+bool ProtocolManager::hasHealthyUplink() const {
+    uint32_t now = millis();
+    for (size_t i = 0; i < PROTOCOL_TYPE_COUNT; i++) {
+        if (context.router.isHealthy(static_cast<ProtocolType>(i), now)) {
             return true;
-            
-        case ProtocolType::COAP:
-            return subscribeCoap(topic);
-            
-        default:
-            return false;
+        }
+    }
+    return false;
+}
+
+PayloadFormat ProtocolManager::getPayloadFormat(ProtocolType protocol, const String& topic) const {
+    // Longest matching topic prefix wins over the protocol default
+    const std::pair<String, PayloadFormat>* best = nullptr;
+    for (const auto& rule : topicFormats) {
+        if (topic.startsWith(rule.first) && (best == nullptr || rule.first.length() > best->first.length())) {
+            best = &rule;
+        }
     }
+    return best != nullptr ? best->second : protocolFormats[static_cast<size_t>(protocol)];
+}
+
+void ProtocolManager::setSchedulingMode(SchedulingMode mode) {
+    scheduler.setMode(mode);
+}
+
+void ProtocolManager::setPriorityWeight(MessagePriority priority, uint8_t weight) {
+    scheduler.setWeight(priority, weight);
+}
+
+void ProtocolManager::setRateLimit(ProtocolType protocol, float messagesPerSecond, uint16_t burst) {
+    uplinkBuckets[static_cast<size_t>(protocol)].configure(messagesPerSecond, burst);
+}
+
+bool ProtocolManager::setTopicRateLimit(const String& topicPrefix, float messagesPerSecond, uint16_t burst) {
+    return scheduler.setTopicLimit(topicPrefix.c_str(), messagesPerSecond, burst) >= 0;
+}
+
+const PriorityStats& ProtocolManager::getPriorityStats(MessagePriority priority) const {
+    return scheduler.getStats(priority);
+}
+
+bool ProtocolManager::subscribe(const String& topic, ProtocolType protocol) {
+    SubscribeOp subscribe = {topic, false};
+    drivers.visit(protocol, subscribe);
+    return subscribe.result;
 }
 
 void ProtocolManager::setMessageCallback(void (*callback)(const ProtocolMessage&)) {
-    messageCallback = callback;
+    context.messageCallback = callback;
 }
 
 void ProtocolManager::setConfig(const ProtocolConfig& newConfig) {
-    if (validateConfig(newConfig)) {
-        config = newConfig;
-        saveConfig();
-    }
+    configApplier.apply(toValues(newConfig));
 }
 
 ProtocolConfig ProtocolManager::getConfig() const {
-    return config;
+    return context.config;
 }
 
 bool ProtocolManager::saveConfig() {
+    const ProtocolConfig& config = context.config;
     File file = SPIFFS.open("/protocol_config.json", "w");
     if (!file) {
         return false;
@@ -175,15 +560,23 @@ bool ProtocolManager::saveConfig() {
     doc["mqttPassword"] = config.mqttPassword;
     doc["mqttClientId"] = config.mqttClientId;
     doc["mqttTopicPrefix"] = config.mqttTopicPrefix;
+    doc["mqttInflightWindow"] = config.mqttInflightWindow;
+    doc["mqttRetransmitMs"] = config.mqttRetransmitMs;
+    doc["mqttUseTls"] = config.mqttUseTls;
     doc["httpServer"] = config.httpServer;
     doc["httpPort"] = config.httpPort;
     doc["useHttps"] = config.useHttps;
     doc["httpUsername"] = config.httpUsername;
     doc["httpPassword"] = config.httpPassword;
+    doc["httpCompress"] = config.httpCompress;
     doc["wsServer"] = config.wsServer;
     doc["wsPort"] = config.wsPort;
     doc["wsPath"] = config.wsPath;
     doc["wsSecure"] = config.wsSecure;
+    doc["wsCompress"] = config.wsCompress;
+    doc["tlsCaFile"] = config.tlsCaFile;
+    doc["tlsCertFile"] = config.tlsCertFile;
+    doc["tlsKeyFile"] = config.tlsKeyFile;
     doc["coapServer"] = config.coapServer;
     doc["coapPort"] = config.coapPort;
     doc["customProtocol"] = config.customProtocol;
@@ -199,6 +592,7 @@ bool ProtocolManager::saveConfig() {
 }
 
 bool ProtocolManager::loadConfig() {
+    ProtocolConfig& config = context.config;
     if (!SPIFFS.exists("/protocol_config.json")) {
         return saveConfig();
     }
@@ -222,15 +616,23 @@ bool ProtocolManager::loadConfig() {
     config.mqttPassword = doc["mqttPassword"] | config.mqttPassword;
     config.mqttClientId = doc["mqttClientId"] | config.mqttClientId;
     config.mqttTopicPrefix = doc["mqttTopicPrefix"] | config.mqttTopicPrefix;
+    config.mqttInflightWindow = doc["mqttInflightWindow"] | config.mqttInflightWindow;
+    config.mqttRetransmitMs = doc["mqttRetransmitMs"] | config.mqttRetransmitMs;
+    config.mqttUseTls = doc["mqttUseTls"] | config.mqttUseTls;
     config.httpServer = doc["httpServer"] | config.httpServer;
     config.httpPort = doc["httpPort"] | config.httpPort;
     config.useHttps = doc["useHttps"] | config.useHttps;
     config.httpUsername = doc["httpUsername"] | config.httpUsername;
     config.httpPassword = doc["httpPassword"] | config.httpPassword;
+    config.httpCompress = doc["httpCompress"] | config.httpCompress;
     config.wsServer = doc["wsServer"] | config.wsServer;
     config.wsPort = doc["wsPort"] | config.wsPort;
     config.wsPath = doc["wsPath"] | config.wsPath;
     config.wsSecure = doc["wsSecure"] | config.wsSecure;
+    config.wsCompress = doc["wsCompress"] | config.wsCompress;
+    config.tlsCaFile = doc["tlsCaFile"] | config.tlsCaFile;
+    config.tlsCertFile = doc["tlsCertFile"] | config.tlsCertFile;
+    config.tlsKeyFile = doc["tlsKeyFile"] | config.tlsKeyFile;
     config.coapServer = doc["coapServer"] | config.coapServer;
     config.coapPort = doc["coapPort"] | config.coapPort;
     config.customProtocol = doc["customProtocol"] | config.customProtocol;
@@ -239,226 +641,277 @@ bool ProtocolManager::loadConfig() {
     return true;
 }
 
-void ProtocolManager::setMqttCallback(void (*callback)(char*, uint8_t*, unsigned int)) {
-    mqttClient.setCallback(callback);
+uint32_t ProtocolManager::applyConfigJson(const String& json) {
+    DynamicJsonDocument doc(2048);
+    DeserializationError error = deserializeJson(doc, json);
+    if (error || !doc.is<JsonObject>()) {
+        ApplyReport report;
+        report.id = 0;
+        report.result = ApplyResult::REJECTED;
+        report.reconnected = 0;
+        report.failed = 0;
+        report.drainMs = 0;
+        report.durationMs = 0;
+        report.error = "expected a JSON object";
+        if (configReportCallback) {
+            configReportCallback(report);
+        }
+        return 0;
+    }
+
+    ConfigValues changes;
+    for (JsonPair field : doc.as<JsonObject>()) {
+        String value;
+        if (field.value().is<const char*>()) {
+            value = field.value().as<const char*>();
+        } else if (!field.value().isNull()) {
+            // Numbers and booleans in their JSON spelling
+            serializeJson(field.value(), value);
+        }
+        changes.push_back({field.key().c_str(), value.c_str()});
+    }
+    return configApplier.apply(changes);
 }
 
-void ProtocolManager::setWebSocketCallback(void (*callback)(WStype_t, uint8_t*, size_t)) {
-    webSocket.onEvent(callback);
+void ProtocolManager::setConfigReportCallback(ConfigApplier::ReportCallback callback) {
+    configReportCallback = callback;
 }
 
-void ProtocolManager::setCoapCallback(void (*callback)(CoapPacket&, IPAddress, int)) {
-    coap.response(callback);
+const ApplyReport& ProtocolManager::getConfigReport() const {
+    return configApplier.getLastReport();
 }
 
-ProtocolState ProtocolManager::getState(ProtocolType protocol) const {
-    return states.at(protocol);
+bool ProtocolManager::isApplyingConfig() const {
+    return configApplier.isBusy();
 }
 
-String ProtocolManager::getLastError(ProtocolType protocol) const {
-    return lastErrors.at(protocol);
+ConfigValues ProtocolManager::currentValues() const {
+    return toValues(context.config);
 }
 
-// Private methods
-bool ProtocolManager::connectMqtt() {
-    states[ProtocolType::MQTT] = ProtocolState::CONNECTING;
-    
-    mqttClient.setServer(config.mqttBroker.c_str(), config.mqttPort);
-    
-    if (mqttClient.connect(config.mqttClientId.c_str(),
-                         config.mqttUsername.c_str(),
-                         config.mqttPassword.c_str())) {
-        states[ProtocolType::MQTT] = ProtocolState::CONNECTED;
-        logProtocolEvent(ProtocolType::MQTT, "Connected to MQTT broker");
-        return true;
-    } else {
-        states[ProtocolType::MQTT] = ProtocolState::ERROR;
-        setError(ProtocolType::MQTT, "Failed to connect to MQTT broker");
-        return false;
+bool ProtocolManager::validate(const ConfigValues& values, std::string& error) {
+    ProtocolConfig config = context.config;
+    return fromValues(values, config, error) && validateConfig(config, error);
+}
+
+void ProtocolManager::install(const ConfigValues& values, bool reloadTls) {
+    // Already validated; connections are the applier's business
+    std::string error;
+    ProtocolConfig config = context.config;
+    fromValues(values, config, error);
+    context.config = config;
+    if (reloadTls) {
+        loadTlsCredentials();
     }
+    ReconfigureOp reconfigure;
+    drivers.forEach(reconfigure);
 }
 
-bool ProtocolManager::connectHttp(bool useHttps) {
-    states[ProtocolType::HTTP] = ProtocolState::CONNECTING;
-    
-    // HTTP/HTTPS doesn't maintain a persistent connection
-    states[ProtocolType::HTTP] = ProtocolState::CONNECTED;
-    return true;
+bool ProtocolManager::persist(const ConfigValues&) {
+    // Only called for the values just installed
+    return saveConfig();
 }
 
-bool ProtocolManager::connectWebSocket() {
-    states[ProtocolType::WEBSOCKET] = ProtocolState::CONNECTING;
-    
-    if (config.wsSecure) {
-        webSocket.beginSSL(config.wsServer.c_str(), config.wsPort, config.wsPath.c_str());
-    } else {
-        webSocket.begin(config.wsServer.c_str(), config.wsPort, config.wsPath.c_str());
-    }
-    
-    webSocket.onEvent([this](WStype_t type, uint8_t* payload, size_t length) {
-        handleWebSocketEvent(type, payload, length);
-    });
-    
-    states[ProtocolType::WEBSOCKET] = ProtocolState::CONNECTED;
-    return true;
+void ProtocolManager::hold(ProtocolType protocol, bool isHeld) {
+    held[static_cast<size_t>(protocol)] = isHeld;
 }
 
-bool ProtocolManager::connectCoap() {
-    states[ProtocolType::COAP] = ProtocolState::CONNECTING;
-    
-    if (coap.start()) {
-        states[ProtocolType::COAP] = ProtocolState::CONNECTED;
-        return true;
-    } else {
-        states[ProtocolType::COAP] = ProtocolState::ERROR;
-        setError(ProtocolType::COAP, "Failed to start CoAP server");
-        return false;
-    }
+size_t ProtocolManager::inflight(ProtocolType protocol) const {
+    InflightOp inflight = {0};
+    drivers.visit(protocol, inflight);
+    return inflight.result;
 }
 
-bool ProtocolManager::connectCustom() {
-    states[ProtocolType::CUSTOM] = ProtocolState::CONNECTING;
-    // Implement custom protocol connection
-    states[ProtocolType::CUSTOM] = ProtocolState::CONNECTED;
-    return true;
+void ProtocolManager::setMqttCallback(void (*callback)(char*, uint8_t*, unsigned int)) {
+    drivers.get<MqttDriver>().getSession().setMessageCallback(
+        [callback](const char* topic, const uint8_t* payload, size_t length) {
+            callback(const_cast<char*>(topic), const_cast<uint8_t*>(payload), length);
+        });
 }
 
-void ProtocolManager::handleMqttMessage(char* topic, byte* payload, unsigned int length) {
-    if (messageCallback) {
-        ProtocolMessage message;
-        message.topic = String(topic);
-        message.payload = String((char*)payload);
-        message.protocol = ProtocolType::MQTT;
-        message.isResponse = false;
-        messageCallback(message);
-    }
-}
-
-void ProtocolManager::handleWebSocketEvent(WStype_t type, uint8_t* payload, size_t length) {
-    switch (type) {
-        case WStype_DISCONNECTED:
-            states[ProtocolType::WEBSOCKET] = ProtocolState::DISCONNECTED;
-            break;
-            
-        case WStype_CONNECTED:
-            states[ProtocolType::WEBSOCKET] = ProtocolState::CONNECTED;
-            break;
-            
-        case WStype_TEXT:
-            if (messageCallback) {
-                ProtocolMessage message;
-                message.topic = "websocket";
-                message.payload = String((char*)payload);
-                message.protocol = ProtocolType::WEBSOCKET;
-                message.isResponse = false;
-                messageCallback(message);
-            }
-            break;
-            
-        default:
-            break;
-    }
+void ProtocolManager::setWebSocketCallback(void (*callback)(WStype_t, uint8_t*, size_t)) {
+    drivers.get<WebSocketDriver>().setEventCallback(callback);
 }
 
-void ProtocolManager::handleCoapResponse(CoapPacket& packet, IPAddress ip, int port) {
-    if (messageCallback) {
-        ProtocolMessage message;
-        message.topic = String(packet.messageid);
-        message.payload = String((char*)packet.payload);
-        message.protocol = ProtocolType::COAP;
-        message.isResponse = true;
-        messageCallback(message);
-    }
+void ProtocolManager::setCoapCallback(void (*callback)(const String&, const CoapResponse&)) {
+    drivers.get<CoapDriver>().setResponseCallback(callback);
 }
 
-void ProtocolManager::setError(ProtocolType protocol, const String& error) {
-    lastErrors[protocol] = error;
-    logProtocolEvent(protocol, "Error: " + error);
+ProtocolState ProtocolManager::getState(ProtocolType protocol) const {
+    return context.getState(protocol);
 }
 
-void ProtocolManager::clearError(ProtocolType protocol) {
-    lastErrors[protocol] = "";
+String ProtocolManager::getLastError(ProtocolType protocol) const {
+    return context.getLastError(protocol);
 }
 
-bool ProtocolManager::validateConfig(const ProtocolConfig& config) {
-    // Add validation logic here
-    return true;
+size_t ProtocolManager::getQueueSize() const {
+    return scheduler.size() + drivers.get<MqttDriver>().getSession().getInflightCount();
 }
 
-void ProtocolManager::logProtocolEvent(ProtocolType protocol, const String& event) {
-    String protocolName;
-    switch (protocol) {
-        case ProtocolType::MQTT:
-            protocolName = "MQTT";
-            break;
-        case ProtocolType::HTTP:
-            protocolName = "HTTP";
-            break;
-        case ProtocolType::HTTPS:
-            protocolName = "HTTPS";
-            break;
-        case ProtocolType::WEBSOCKET:
-            protocolName = "WebSocket";
-            break;
-        case ProtocolType::COAP:
-            protocolName = "CoAP";
-            break;
-        case ProtocolType::CUSTOM:
-            protocolName = "Custom";
-            break;
-    }
-    Serial.println("[" + protocolName + "] " + event);
+const MqttSessionStats& ProtocolManager::getMqttStats() const {
+    return drivers.get<MqttDriver>().getSession().getStats();
 }
 
-void ProtocolManager::processMessageQueue() {
-    if (messageQueue.empty()) {
+const TlsHandshakeStats& ProtocolManager::getTlsStats() const {
+    return context.tls.getStats();
+}
+
+const CompressionStats& ProtocolManager::getCompressionStats() const {
+    return context.getCompressionStats();
+}
+
+// Private methods
+void ProtocolManager::handleLinkEvent(WifiEvent event) {
+    if (event == WifiEvent::LINK_DOWN) {
+        // Let the router move traffic off every uplink until the link returns
+        LinkDownOp linkDown;
+        drivers.forEach(linkDown);
         return;
     }
 
-    auto it = messageQueue.begin();
-    while (it != messageQueue.end()) {
-        if (publish(*it)) {
-            it = messageQueue.erase(it);
-        } else {
-            ++it;
+    // LINK_UP or ROAMED: bring back whatever is configured but not up
+    for (size_t i = 0; i < PROTOCOL_TYPE_COUNT; i++) {
+        ProtocolType protocol = static_cast<ProtocolType>(i);
+        if (isConfigured(protocol) && !isConnected(protocol)) {
+            context.log(protocol, event == WifiEvent::ROAMED ? "Reconnecting after roam" : "Reconnecting after link up");
+            connect(protocol);
         }
     }
 }
 
-bool ProtocolManager::addToQueue(const ProtocolMessage& message) {
-    if (messageQueue.size() >= MAX_QUEUE_SIZE) {
+bool ProtocolManager::resetConnections() {
+    DisconnectOp disconnect;
+    drivers.forEach(disconnect);
+
+    bool connected = true;
+    for (size_t i = 0; i < PROTOCOL_TYPE_COUNT; i++) {
+        ProtocolType protocol = static_cast<ProtocolType>(i);
+        if (isConfigured(protocol)) {
+            context.log(protocol, "Reconnecting after reset");
+            connected = connect(protocol) && connected;
+        }
+    }
+    return connected;
+}
+
+bool ProtocolManager::isConfigured(ProtocolType protocol) {
+    ConfiguredOp configured = {false};
+    drivers.visit(protocol, configured);
+    return configured.result;
+}
+
+bool ProtocolManager::loadTlsCredentials() {
+    const ProtocolConfig& config = context.config;
+    TlsContextManager& tls = context.tls;
+    const struct {
+        TlsCredentialKind kind;
+        const String& path;
+    } files[] = {
+        {TlsCredentialKind::CA, config.tlsCaFile},
+        {TlsCredentialKind::CERTIFICATE, config.tlsCertFile},
+        {TlsCredentialKind::PRIVATE_KEY, config.tlsKeyFile},
+    };
+
+    bool valid = true;
+    for (const auto& entry : files) {
+        if (entry.path.isEmpty() || !SPIFFS.exists(entry.path)) {
+            tls.credentials().clear(entry.kind);
+            continue;
+        }
+        File file = SPIFFS.open(entry.path, "r");
+        if (!file) {
+            valid = false;
+            continue;
+        }
+        String pem = file.readString();
+        file.close();
+        if (!tls.credentials().load(entry.kind, pem.c_str(), pem.length())) {
+            Serial.println("[TLS] Invalid PEM in " + entry.path);
+            valid = false;
+        }
+    }
+
+    if (!tls.credentials().get(TlsCredentialKind::CA)) {
+        Serial.println("[TLS] No CA loaded, server certificates will not be verified");
+    }
+    return valid;
+}
+
+bool ProtocolManager::validateConfig(const ProtocolConfig& config, std::string& error) {
+    if (config.mqttPort == 0 || config.httpPort == 0 || config.wsPort == 0 || config.coapPort == 0) {
+        error = "ports must be 1-65535";
+        return false;
+    }
+    if (config.mqttInflightWindow == 0 || config.mqttInflightWindow > MqttSession::MAX_INFLIGHT) {
+        error = "mqttInflightWindow must be 1-" + std::to_string(MqttSession::MAX_INFLIGHT);
+        return false;
+    }
+    if (config.mqttRetransmitMs < 1000) {
+        error = "mqttRetransmitMs must be at least 1000";
+        return false;
+    }
+    if (!config.wsPath.isEmpty() && !config.wsPath.startsWith("/")) {
+        error = "wsPath must start with /";
         return false;
     }
-    messageQueue.push_back(message);
     return true;
 }
 
-bool ProtocolManager::publishHttp(const ProtocolMessage& message) {
-    HTTPClient http;
-    String url = (config.useHttps ? "https://" : "http://") + config.httpServer + message.topic;
-    
-    http.begin(url);
-    if (!config.httpUsername.isEmpty()) {
-        http.setAuthorization(config.httpUsername.c_str(), config.httpPassword.c_str());
+void ProtocolManager::processMessageQueue() {
+    if (scheduler.size() == 0) {
+        return;
     }
-    
-    int httpCode = http.POST(message.payload);
-    http.end();
-    
-    return httpCode == HTTP_CODE_OK;
-}
 
-bool ProtocolManager::publishCoap(const ProtocolMessage& message) {
-    return coap.put(IPAddress().fromString(config.coapServer), config.coapPort,
-                   message.topic.c_str(), message.payload.c_str());
+    // Pop until nothing is sendable under the rate limits; messages no uplink
+    // would take are deferred so the rest of their class can still go
+    uint32_t now = millis();
+    QueuedEntry deferred[MAX_QUEUE_SIZE];
+    size_t deferredCount = 0;
+    QueuedEntry entry;
+    while (scheduler.pop(now, entry)) {
+        if (dispatch(messagePool[entry.handle])) {
+            scheduler.delivered(entry, now);
+            messagePool[entry.handle] = ProtocolMessage();
+            freeSlots.push_back(entry.handle);
+        } else {
+            deferred[deferredCount++] = entry;
+        }
+    }
+    while (deferredCount > 0) {
+        scheduler.restore(deferred[--deferredCount]);
+    }
 }
 
-bool ProtocolManager::publishCustom(const ProtocolMessage& message) {
-    // Implement custom protocol publishing
-    return true;
+void ProtocolManager::refreshUplinkHealth() {
+    uint32_t now = millis();
+    for (size_t i = 0; i < PROTOCOL_TYPE_COUNT; i++) {
+        ProtocolType protocol = static_cast<ProtocolType>(i);
+        // A held uplink counts as down, so failover routes move off it while it drains
+        bool usable = context.isConnected(protocol) && !held[i];
+        context.router.updateLink(protocol, usable, !context.getLastError(protocol).isEmpty(), now);
+    }
 }
 
-bool ProtocolManager::subscribeCoap(const String& topic) {
-    // Implement CoAP subscription
-    return true;
-} 
\ No newline at end of file
+bool ProtocolManager::addToQueue(const ProtocolMessage& message) {
+    if (freeSlots.empty()) {
+        // A full queue only makes room for something more urgent
+        uint16_t victim;
+        if (!scheduler.evictBelow(message.priority, victim)) {
+            return false;
+        }
+        context.log(messagePool[victim].protocol, "Queue full, dropped " + messagePool[victim].topic);
+        freeSlots.push_back(victim);
+    }
+    uint16_t slot = freeSlots.back();
+    freeSlots.pop_back();
+    messagePool[slot] = message;
+
+    QueuedEntry entry;
+    entry.handle = slot;
+    entry.priority = message.priority;
+    entry.protocol = message.protocol;
+    entry.topicClass = (int8_t)scheduler.classify(message.topic.c_str());
+    entry.enqueuedAt = millis();
+    return scheduler.enqueue(entry);
+}
@@ -0,0 +1,738 @@
+#include "rules_engine.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+static uint32_t defaultClock() {
+#ifdef ARDUINO
+    return millis();
+#else
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+struct RuleFunction {
+    const char* name;
+    uint8_t arguments;
+    RuleOp op;
+};
+
+static const RuleFunction ruleFunctions[] = {
+    {"abs", 1, RuleOp::ABS},
+    {"sqrt", 1, RuleOp::SQRT},
+    {"round", 1, RuleOp::ROUND},
+    {"min", 2, RuleOp::MIN},
+    {"max", 2, RuleOp::MAX},
+    {"clamp", 3, RuleOp::CLAMP},
+    {"scale", 5, RuleOp::SCALE},
+};
+
+// Recursive-descent compiler emitting postfix bytecode. Every operator is
+// evaluated eagerly (no jumps): expressions have no side effects, so && || ?:
+// need no short-circuit and the VM stays a straight loop.
+class RuleCompiler {
+public:
+    RuleCompiler(RulesEngine& engine, const char* source, std::vector<uint8_t>& out, std::vector<uint16_t>& inputs)
+        : engine(engine), source(source), position(0), out(out), inputs(inputs), depth(0), maxDepth(0) {}
+
+    bool compile() {
+        if (!parseTernary()) {
+            return false;
+        }
+        skipSpaces();
+        if (source[position] != '\0') {
+            return fail("unexpected character");
+        }
+        if (maxDepth > (int)RulesEngine::MAX_STACK) {
+            return fail("expression too deep");
+        }
+        return true;
+    }
+
+    std::string error;
+
+private:
+    RulesEngine& engine;
+    const char* source;
+    size_t position;
+    std::vector<uint8_t>& out;
+    std::vector<uint16_t>& inputs;
+    int depth;
+    int maxDepth;
+
+    bool fail(const char* message) {
+        error = std::string(message) + " at column " + std::to_string(position + 1);
+        return false;
+    }
+
+    void skipSpaces() {
+        while (source[position] == ' ' || source[position] == '\t') {
+            position++;
+        }
+    }
+
+    bool accept(const char* token) {
+        skipSpaces();
+        size_t length = strlen(token);
+        if (strncmp(source + position, token, length) != 0) {
+            return false;
+        }
+        // "<" must not swallow the first half of "<="
+        if (length == 1 && strchr("<>=!", token[0]) && source[position + 1] == '=') {
+            return false;
+        }
+        position += length;
+        return true;
+    }
+
+    void emit(RuleOp op, int stackEffect) {
+        out.push_back((uint8_t)op);
+        depth += stackEffect;
+        if (depth > maxDepth) {
+            maxDepth = depth;
+        }
+    }
+
+    void emitOperand(uint16_t operand) {
+        out.push_back((uint8_t)operand);
+        out.push_back((uint8_t)(operand >> 8));
+    }
+
+    bool emitConstant(float value) {
+        size_t index = 0;
+        while (index < engine.constants.size() && engine.constants[index] != value) {
+            index++;
+        }
+        if (index == engine.constants.size()) {
+            if (index > 0xFFFF) {
+                return fail("too many constants");
+            }
+            engine.constants.push_back(value);
+        }
+        emit(RuleOp::CONST, 1);
+        emitOperand((uint16_t)index);
+        return true;
+    }
+
+    bool emitPoint(uint32_t id) {
+        if (id >= RulesEngine::MAX_POINTS) {
+            return fail("point id out of range");
+        }
+        emit(RuleOp::POINT, 1);
+        emitOperand((uint16_t)id);
+        for (uint16_t input : inputs) {
+            if (input == id) {
+                return true;
+            }
+        }
+        inputs.push_back((uint16_t)id);
+        return true;
+    }
+
+    bool parseTernary() {
+        if (!parseOr()) {
+            return false;
+        }
+        if (!accept("?")) {
+            return true;
+        }
+        if (!parseTernary()) {
+            return false;
+        }
+        if (!accept(":")) {
+            return fail("expected ':'");
+        }
+        if (!parseTernary()) {
+            return false;
+        }
+        emit(RuleOp::SELECT, -2);
+        return true;
+    }
+
+    bool parseOr() {
+        if (!parseAnd()) {
+            return false;
+        }
+        while (accept("||")) {
+            if (!parseAnd()) {
+                return false;
+            }
+            emit(RuleOp::OR, -1);
+        }
+        return true;
+    }
+
+    bool parseAnd() {
+        if (!parseEquality()) {
+            return false;
+        }
+        while (accept("&&")) {
+            if (!parseEquality()) {
+                return false;
+            }
+            emit(RuleOp::AND, -1);
+        }
+        return true;
+    }
+
+    bool parseEquality() {
+        if (!parseRelational()) {
+            return false;
+        }
+        while (true) {
+            RuleOp op;
+            if (accept("==")) {
+                op = RuleOp::EQ;
+            } else if (accept("!=")) {
+                op = RuleOp::NE;
+            } else {
+                return true;
+            }
+            if (!parseRelational()) {
+                return false;
+            }
+            emit(op, -1);
+        }
+    }
+
+    bool parseRelational() {
+        if (!parseAdditive()) {
+            return false;
+        }
+        while (true) {
+            RuleOp op;
+            if (accept("<=")) {
+                op = RuleOp::LE;
+            } else if (accept(">=")) {
+                op = RuleOp::GE;
+            } else if (accept("<")) {
+                op = RuleOp::LT;
+            } else if (accept(">")) {
+                op = RuleOp::GT;
+            } else {
+                return true;
+            }
+            if (!parseAdditive()) {
+                return false;
+            }
+            emit(op, -1);
+        }
+    }
+
+    bool parseAdditive() {
+        if (!parseTerm()) {
+            return false;
+        }
+        while (true) {
+            RuleOp op;
+            if (accept("+")) {
+                op = RuleOp::ADD;
+            } else if (accept("-")) {
+                op = RuleOp::SUB;
+            } else {
+                return true;
+            }
+            if (!parseTerm()) {
+                return false;
+            }
+            emit(op, -1);
+        }
+    }
+
+    bool parseTerm() {
+        if (!parseUnary()) {
+            return false;
+        }
+        while (true) {
+            RuleOp op;
+            if (accept("*")) {
+                op = RuleOp::MUL;
+            } else if (accept("/")) {
+                op = RuleOp::DIV;
+            } else if (accept("%")) {
+                op = RuleOp::MOD;
+            } else {
+                return true;
+            }
+            if (!parseUnary()) {
+                return false;
+            }
+            emit(op, -1);
+        }
+    }
+
+    bool parseUnary() {
+        if (accept("-")) {
+            if (!parseUnary()) {
+                return false;
+            }
+            emit(RuleOp::NEG, 0);
+            return true;
+        }
+        if (accept("!")) {
+            if (!parseUnary()) {
+                return false;
+            }
+            emit(RuleOp::NOT, 0);
+            return true;
+        }
+        return parsePrimary();
+    }
+
+    bool parsePrimary() {
+        skipSpaces();
+        char c = source[position];
+        if (c == '(') {
+            position++;
+            if (!parseTernary()) {
+                return false;
+            }
+            return accept(")") || fail("expected ')'");
+        }
+        if ((c >= '0' && c <= '9') || c == '.') {
+            char* end;
+            float value = strtof(source + position, &end);
+            if (end == source + position) {
+                return fail("bad number");
+            }
+            position = end - source;
+            return emitConstant(value);
+        }
+        if (!isalpha((unsigned char)c) && c != '_') {
+            return fail("expected a value");
+        }
+
+        size_t start = position;
+        while (isalnum((unsigned char)source[position]) || source[position] == '_') {
+            position++;
+        }
+        std::string word(source + start, position - start);
+
+        if (accept("(")) {
+            return parseCall(word);
+        }
+        if (word == "true" || word == "false") {
+            return emitConstant(word == "true" ? 1.0f : 0.0f);
+        }
+        if (word.size() > 1 && word[0] == 'p' && word.find_first_not_of("0123456789", 1) == std::string::npos) {
+            return emitPoint((uint32_t)atoi(word.c_str() + 1));
+        }
+        for (const auto& name : engine.names) {
+            if (name.first == word) {
+                return emitPoint(name.second);
+            }
+        }
+        position = start;
+        return fail(("unknown point '" + word + "'").c_str());
+    }
+
+    bool parseCall(const std::string& word) {
+        const RuleFunction* function = nullptr;
+        for (const RuleFunction& candidate : ruleFunctions) {
+            if (word == candidate.name) {
+                function = &candidate;
+            }
+        }
+        if (!function) {
+            return fail(("unknown function '" + word + "'").c_str());
+        }
+        for (uint8_t i = 0; i < function->arguments; i++) {
+            if (i > 0 && !accept(",")) {
+                return fail("expected ','");
+            }
+            if (!parseTernary()) {
+                return false;
+            }
+        }
+        if (!accept(")")) {
+            return fail("expected ')'");
+        }
+        emit(function->op, 1 - function->arguments);
+        return true;
+    }
+};
+
+RulesEngine::RulesEngine() : clock(defaultClock) {
+    clear();
+}
+
+void RulesEngine::setClock(uint32_t (*newClock)()) {
+    clock = newClock;
+}
+
+bool RulesEngine::definePoint(const char* name, uint16_t id) {
+    if (id >= MAX_POINTS || !name || !(isalpha((unsigned char)name[0]) || name[0] == '_')) {
+        lastError = "bad point name or id";
+        return false;
+    }
+    for (auto& entry : names) {
+        if (entry.first == name) {
+            entry.second = id;
+            return true;
+        }
+    }
+    names.push_back(std::make_pair(std::string(name), id));
+    return true;
+}
+
+int RulesEngine::addDerived(uint16_t target, const char* expression) {
+    if (target >= MAX_POINTS) {
+        lastError = "target point out of range";
+        return -1;
+    }
+    return addRule(RuleKind::DERIVED, target, expression, "", 0);
+}
+
+int RulesEngine::addAlarm(const char* name, const char* expression, uint32_t holdMs, uint16_t statePoint) {
+    if (statePoint != NO_POINT && statePoint >= MAX_POINTS) {
+        lastError = "state point out of range";
+        return -1;
+    }
+    return addRule(RuleKind::ALARM, statePoint, expression, name ? name : "", holdMs);
+}
+
+void RulesEngine::clear() {
+    for (uint16_t i = 0; i < MAX_POINTS; i++) {
+        values[i] = 0;
+        known[i] = false;
+        firstDependent[i] = -1;
+        isTarget[i] = false;
+    }
+    names.clear();
+    rules.clear();
+    code.clear();
+    constants.clear();
+    inputs.clear();
+    dependents.clear();
+    memset(&stats, 0, sizeof(stats));
+    lastError.clear();
+}
+
+void RulesEngine::setOutput(std::function<void(uint16_t, float)> newOutput) {
+    output = newOutput;
+}
+
+void RulesEngine::setAlarmCallback(std::function<void(const char*, bool)> callback) {
+    alarmCallback = callback;
+}
+
+void RulesEngine::onSample(uint16_t pointId, float value) {
+    if (pointId >= MAX_POINTS) {
+        return;
+    }
+    stats.samples++;
+    values[pointId] = value;
+    known[pointId] = true;
+    propagate(pointId, clock());
+}
+
+void RulesEngine::update() {
+    uint32_t now = clock();
+    for (Rule& rule : rules) {
+        if (rule.kind == RuleKind::ALARM && rule.pending && !rule.active && now - rule.pendingSince >= rule.holdMs) {
+            setAlarm(rule, true);
+        }
+    }
+}
+
+bool RulesEngine::getPoint(uint16_t pointId, float& value) const {
+    if (pointId >= MAX_POINTS || !known[pointId]) {
+        return false;
+    }
+    value = values[pointId];
+    return true;
+}
+
+bool RulesEngine::isAlarmActive(size_t rule) const {
+    return rule < rules.size() && rules[rule].active;
+}
+
+size_t RulesEngine::getRuleCount() const {
+    return rules.size();
+}
+
+size_t RulesEngine::getCodeSize() const {
+    return code.size();
+}
+
+const RulesStats& RulesEngine::getStats() const {
+    return stats;
+}
+
+const std::string& RulesEngine::getLastError() const {
+    return lastError;
+}
+
+// Private methods
+int RulesEngine::addRule(RuleKind kind, uint16_t target, const char* expression, const char* name, uint32_t holdMs) {
+    if (rules.size() >= MAX_RULES) {
+        lastError = "too many rules";
+        return -1;
+    }
+    if (!expression) {
+        lastError = "empty expression";
+        return -1;
+    }
+
+    std::vector<uint8_t> bytecode;
+    std::vector<uint16_t> ruleInputs;
+    size_t constantCount = constants.size();
+    RuleCompiler compiler(*this, expression, bytecode, ruleInputs);
+    if (!compiler.compile()) {
+        constants.resize(constantCount);
+        lastError = compiler.error;
+        return -1;
+    }
+    if (code.size() + bytecode.size() > MAX_CODE_SIZE) {
+        constants.resize(constantCount);
+        lastError = "rule program too large";
+        return -1;
+    }
+    if (kind == RuleKind::DERIVED) {
+        // Derived rules may only read targets of earlier rules, so the
+        // dependency graph cannot loop
+        const char* conflict = nullptr;
+        if (isTarget[target]) {
+            conflict = "point is already derived by another rule";
+        }
+        for (uint16_t input : ruleInputs) {
+            if (input == target) {
+                conflict = "rule reads its own target";
+            }
+        }
+        for (int16_t link = firstDependent[target]; link >= 0; link = dependents[link].next) {
+            if (rules[dependents[link].rule].kind == RuleKind::DERIVED) {
+                conflict = "target is read by an earlier rule";
+            }
+        }
+        if (conflict) {
+            constants.resize(constantCount);
+            lastError = conflict;
+            return -1;
+        }
+    }
+
+    Rule rule;
+    rule.kind = kind;
+    rule.target = target;
+    rule.codeStart = code.size();
+    rule.codeLength = bytecode.size();
+    rule.inputStart = inputs.size();
+    rule.inputCount = ruleInputs.size();
+    rule.holdMs = holdMs;
+    rule.active = false;
+    rule.pending = false;
+    rule.pendingSince = 0;
+    rule.name = name;
+    code.insert(code.end(), bytecode.begin(), bytecode.end());
+    inputs.insert(inputs.end(), ruleInputs.begin(), ruleInputs.end());
+
+    uint16_t index = rules.size();
+    for (uint16_t input : ruleInputs) {
+        // Append so dependents run in rule order
+        Dependent link = {index, -1};
+        int16_t* slot = &firstDependent[input];
+        while (*slot >= 0) {
+            slot = &dependents[*slot].next;
+        }
+        *slot = dependents.size();
+        dependents.push_back(link);
+    }
+    if (kind == RuleKind::DERIVED) {
+        isTarget[target] = true;
+    }
+    rules.push_back(rule);
+    lastError.clear();
+    return index;
+}
+
+bool RulesEngine::execute(const Rule& rule, float& result) {
+    float stack[MAX_STACK];
+    int top = -1;
+    const uint8_t* pc = code.data() + rule.codeStart;
+    const uint8_t* end = pc + rule.codeLength;
+
+    while (pc < end) {
+        RuleOp op = (RuleOp)*pc++;
+        switch (op) {
+            case RuleOp::CONST:
+                stack[++top] = constants[pc[0] | (pc[1] << 8)];
+                pc += 2;
+                break;
+            case RuleOp::POINT:
+                stack[++top] = values[pc[0] | (pc[1] << 8)];
+                pc += 2;
+                break;
+            case RuleOp::NEG:
+                stack[top] = -stack[top];
+                break;
+            case RuleOp::NOT:
+                stack[top] = stack[top] == 0.0f ? 1.0f : 0.0f;
+                break;
+            case RuleOp::ADD:
+                top--;
+                stack[top] += stack[top + 1];
+                break;
+            case RuleOp::SUB:
+                top--;
+                stack[top] -= stack[top + 1];
+                break;
+            case RuleOp::MUL:
+                top--;
+                stack[top] *= stack[top + 1];
+                break;
+            case RuleOp::DIV:
+                top--;
+                stack[top] /= stack[top + 1];
+                break;
+            case RuleOp::MOD:
+                top--;
+                stack[top] = fmodf(stack[top], stack[top + 1]);
+                break;
+            case RuleOp::LT:
+                top--;
+                stack[top] = stack[top] < stack[top + 1] ? 1.0f : 0.0f;
+                break;
+            case RuleOp::LE:
+                top--;
+                stack[top] = stack[top] <= stack[top + 1] ? 1.0f : 0.0f;
+                break;
+            case RuleOp::GT:
+                top--;
+                stack[top] = stack[top] > stack[top + 1] ? 1.0f : 0.0f;
+                break;
+            case RuleOp::GE:
+                top--;
+                stack[top] = stack[top] >= stack[top + 1] ? 1.0f : 0.0f;
+                break;
+            case RuleOp::EQ:
+                top--;
+                stack[top] = stack[top] == stack[top + 1] ? 1.0f : 0.0f;
+                break;
+            case RuleOp::NE:
+                top--;
+                stack[top] = stack[top] != stack[top + 1] ? 1.0f : 0.0f;
+                break;
+            case RuleOp::AND:
+                top--;
+                stack[top] = (stack[top] != 0.0f && stack[top + 1] != 0.0f) ? 1.0f : 0.0f;
+                break;
+            case RuleOp::OR:
+                top--;
+                stack[top] = (stack[top] != 0.0f || stack[top + 1] != 0.0f) ? 1.0f : 0.0f;
+                break;
+            case RuleOp::SELECT:
+                top -= 2;
+                stack[top] = stack[top] != 0.0f ? stack[top + 1] : stack[top + 2];
+                break;
+            case RuleOp::ABS:
+                stack[top] = fabsf(stack[top]);
+                break;
+            case RuleOp::SQRT:
+                stack[top] = sqrtf(stack[top]);
+                break;
+            case RuleOp::ROUND:
+                stack[top] = roundf(stack[top]);
+                break;
+            case RuleOp::MIN:
+                top--;
+                stack[top] = stack[top + 1] < stack[top] ? stack[top + 1] : stack[top];
+                break;
+            case RuleOp::MAX:
+                top--;
+                stack[top] = stack[top + 1] > stack[top] ? stack[top + 1] : stack[top];
+                break;
+            case RuleOp::CLAMP:
+                top -= 2;
+                if (stack[top] < stack[top + 1]) {
+                    stack[top] = stack[top + 1];
+                } else if (stack[top] > stack[top + 2]) {
+                    stack[top] = stack[top + 2];
+                }
+                break;
+            case RuleOp::SCALE: {
+                top -= 4;
+                float span = stack[top + 2] - stack[top + 1];
+                stack[top] = stack[top + 3] + (stack[top] - stack[top + 1]) * (stack[top + 4] - stack[top + 3]) / span;
+                break;
+            }
+        }
+    }
+    result = stack[top];
+    return isfinite(result);
+}
+
+void RulesEngine::evaluate(size_t index, uint32_t now) {
+    Rule& rule = rules[index];
+    for (uint16_t i = 0; i < rule.inputCount; i++) {
+        if (!known[inputs[rule.inputStart + i]]) {
+            stats.skipped++;
+            return;
+        }
+    }
+
+    float result;
+    stats.evaluations++;
+    if (!execute(rule, result)) {
+        stats.invalid++;
+        return;
+    }
+
+    if (rule.kind == RuleKind::DERIVED) {
+        values[rule.target] = result;
+        known[rule.target] = true;
+        if (output) {
+            output(rule.target, result);
+        }
+        propagate(rule.target, now);
+        return;
+    }
+
+    bool condition = result != 0.0f;
+    if (!condition) {
+        rule.pending = false;
+        if (rule.active) {
+            setAlarm(rule, false);
+        }
+    } else if (!rule.active) {
+        if (!rule.pending) {
+            rule.pending = true;
+            rule.pendingSince = now;
+        }
+        if (now - rule.pendingSince >= rule.holdMs) {
+            setAlarm(rule, true);
+        }
+    }
+}
+
+void RulesEngine::propagate(uint16_t pointId, uint32_t now) {
+    for (int16_t link = firstDependent[pointId]; link >= 0; link = dependents[link].next) {
+        evaluate(dependents[link].rule, now);
+    }
+}
+
+void RulesEngine::setAlarm(Rule& rule, bool active) {
+    rule.active = active;
+    rule.pending = false;
+    if (active) {
+        stats.alarmsRaised++;
+    } else {
+        stats.alarmsCleared++;
+    }
+    if (alarmCallback) {
+        alarmCallback(rule.name.c_str(), active);
+    }
+    if (rule.target != NO_POINT && output) {
+        values[rule.target] = active ? 1.0f : 0.0f;
+        known[rule.target] = true;
+        output(rule.target, values[rule.target]);
+    }
+}
@@ -0,0 +1,461 @@
+#include "serial_trace.h"
+#include <string.h>
+
+#ifdef ARDUINO
+#include <SPIFFS.h>
+#include <esp_timer.h>
+#else
+#include <chrono>
+#endif
+
+static uint64_t defaultClockUs() {
+#ifdef ARDUINO
+    return (uint64_t)esp_timer_get_time();
+#else
+    using namespace std::chrono;
+    return (uint64_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static const uint8_t TRACE_MAGIC[4] = {'S', 'B', 'T', '1'};
+static const uint8_t TAG_CHANNEL_MASK = 0x07;
+static const uint8_t TAG_TX = 0x08;
+
+static size_t putVarint(uint8_t* out, uint64_t value) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (uint8_t)value;
+    return length;
+}
+
+RamTraceSink::RamTraceSink(uint8_t* buffer, size_t capacity)
+    : buffer(buffer)
+    , capacity(capacity)
+    , used(0)
+{
+}
+
+bool RamTraceSink::write(const uint8_t* data, size_t length) {
+    if (length > capacity - used) {
+        return false;
+    }
+    memcpy(buffer + used, data, length);
+    used += length;
+    return true;
+}
+
+void RamTraceSink::reset() {
+    used = 0;
+}
+
+void RamTraceSink::setBuffer(uint8_t* buffer, size_t capacity) {
+    this->buffer = buffer;
+    this->capacity = capacity;
+    used = 0;
+}
+
+const uint8_t* RamTraceSink::data() const {
+    return buffer;
+}
+
+size_t RamTraceSink::length() const {
+    return used;
+}
+
+#ifdef ARDUINO
+bool SpiffsTraceSink::open(const char* path) {
+    file = SPIFFS.open(path, FILE_WRITE);
+    written = 0;
+    buffered = 0;
+    return (bool)file;
+}
+
+void SpiffsTraceSink::close() {
+    flush();
+    file.close();
+}
+
+bool SpiffsTraceSink::write(const uint8_t* data, size_t length) {
+    if (!file || written + buffered + length > maxBytes) {
+        return false;
+    }
+    if (buffered + length > BUFFER_SIZE) {
+        flush();
+    }
+    if (length > BUFFER_SIZE) {
+        written += file.write(data, length);
+        return true;
+    }
+    memcpy(buffer + buffered, data, length);
+    buffered += length;
+    return true;
+}
+
+void SpiffsTraceSink::flush() {
+    if (file && buffered > 0) {
+        written += file.write(buffer, buffered);
+    }
+    buffered = 0;
+}
+#endif
+
+TraceRecorder::TraceRecorder()
+    : clock(defaultClockUs)
+    , sink(nullptr)
+    , startedAt(0)
+    , lastRecordAt(0)
+    , hasPending(false)
+    , pendingChannel(TraceChannel::MODBUS)
+    , pendingDirection(TraceDirection::RX)
+    , pendingAt(0)
+    , pendingLastByteAt(0)
+    , pendingLength(0)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+void TraceRecorder::setClock(uint64_t (*clock)()) {
+    this->clock = clock;
+}
+
+bool TraceRecorder::begin(TraceSink& sink) {
+    memset(&stats, 0, sizeof(stats));
+    hasPending = false;
+    pendingLength = 0;
+    startedAt = clock();
+    lastRecordAt = 0;
+    if (!sink.write(TRACE_MAGIC, sizeof(TRACE_MAGIC))) {
+        return false;
+    }
+    stats.traceBytes = sizeof(TRACE_MAGIC);
+    this->sink = &sink;
+    return true;
+}
+
+void TraceRecorder::end() {
+    if (sink == nullptr) {
+        return;
+    }
+    flush();
+    sink->flush();
+    sink = nullptr;
+}
+
+bool TraceRecorder::isRecording() const {
+    return sink != nullptr;
+}
+
+void TraceRecorder::record(TraceChannel channel, TraceDirection direction, const uint8_t* data, size_t length) {
+    if (sink == nullptr || length == 0) {
+        return;
+    }
+    uint64_t now = clock() - startedAt;
+    stats.bytes += length;
+
+    if (hasPending && (pendingChannel != channel || pendingDirection != direction ||
+                       now - pendingLastByteAt > COALESCE_US)) {
+        flush();
+    }
+    while (length > 0) {
+        if (!hasPending) {
+            hasPending = true;
+            pendingChannel = channel;
+            pendingDirection = direction;
+            pendingAt = now;
+            pendingLength = 0;
+        }
+        size_t chunk = MAX_PENDING - pendingLength;
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(pending + pendingLength, data, chunk);
+        pendingLength += chunk;
+        pendingLastByteAt = now;
+        data += chunk;
+        length -= chunk;
+        if (pendingLength == MAX_PENDING) {
+            flush();
+        }
+    }
+}
+
+void TraceRecorder::flush() {
+    if (!hasPending) {
+        return;
+    }
+    hasPending = false;
+    emit(pending, pendingLength);
+    pendingLength = 0;
+}
+
+const TraceRecorderStats& TraceRecorder::getStats() const {
+    return stats;
+}
+
+void TraceRecorder::emit(const uint8_t* data, size_t length) {
+    // Header and bytes in one write so a full sink never leaves half a record
+    uint8_t record[MAX_HEADER + MAX_PENDING];
+    size_t used = 0;
+    uint8_t tag = (uint8_t)pendingChannel;
+    if (pendingDirection == TraceDirection::TX) {
+        tag |= TAG_TX;
+    }
+    record[used++] = tag;
+    used += putVarint(record + used, pendingAt - lastRecordAt);
+    used += putVarint(record + used, length);
+    memcpy(record + used, data, length);
+    used += length;
+
+    if (!sink->write(record, used)) {
+        stats.droppedBytes += length;
+        return;
+    }
+    lastRecordAt = pendingAt;
+    stats.records++;
+    stats.traceBytes += used;
+}
+
+TraceReader::TraceReader(const uint8_t* data, size_t length)
+    : data(data)
+    , length(length)
+    , offset(0)
+    , timeUs(0)
+    , valid(false)
+{
+    rewind();
+}
+
+bool TraceReader::isValid() const {
+    return valid;
+}
+
+void TraceReader::rewind() {
+    valid = length >= sizeof(TRACE_MAGIC) && memcmp(data, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0;
+    offset = sizeof(TRACE_MAGIC);
+    timeUs = 0;
+}
+
+bool TraceReader::readVarint(uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (offset >= length) {
+            return false;
+        }
+        uint8_t byte = data[offset++];
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TraceReader::next(TraceRecord& record) {
+    if (!valid || offset >= length) {
+        return false;
+    }
+    uint8_t tag = data[offset++];
+    uint64_t delta = 0;
+    uint64_t count = 0;
+    if ((tag & TAG_CHANNEL_MASK) > (uint8_t)TraceChannel::MODBUS ||
+        !readVarint(delta) || !readVarint(count) || count > length - offset) {
+        // A truncated or foreign tail ends the trace
+        valid = false;
+        return false;
+    }
+    timeUs += delta;
+    record.timeUs = timeUs;
+    record.channel = (TraceChannel)(tag & TAG_CHANNEL_MASK);
+    record.direction = (tag & TAG_TX) ? TraceDirection::TX : TraceDirection::RX;
+    record.data = data + offset;
+    record.length = (uint16_t)count;
+    offset += (size_t)count;
+    return true;
+}
+
+TraceReplayer::TraceReplayer(const uint8_t* data, size_t length)
+    : reader(data, length)
+    , clock(defaultClockUs)
+    , speed(ReplaySpeed::RECORDED)
+    , startedAt(0)
+    , hasNext(false)
+    , finished(true)
+{
+    memset(&nextRecord, 0, sizeof(nextRecord));
+}
+
+void TraceReplayer::setClock(uint64_t (*clock)()) {
+    this->clock = clock;
+}
+
+void TraceReplayer::setSpeed(ReplaySpeed speed) {
+    this->speed = speed;
+}
+
+void TraceReplayer::setHandler(TraceChannel channel, Handler handler) {
+    if ((size_t)channel < CHANNEL_COUNT) {
+        handlers[(size_t)channel] = handler;
+    }
+}
+
+bool TraceReplayer::begin() {
+    reader.rewind();
+    if (!reader.isValid()) {
+        finished = true;
+        return false;
+    }
+    startedAt = clock();
+    hasNext = reader.next(nextRecord);
+    finished = !hasNext;
+    return true;
+}
+
+bool TraceReplayer::update() {
+    while (hasNext && (speed == ReplaySpeed::AS_FAST_AS_POSSIBLE || clock() - startedAt >= nextRecord.timeUs)) {
+        deliver(nextRecord);
+        hasNext = reader.next(nextRecord);
+    }
+    finished = !hasNext;
+    return !finished;
+}
+
+size_t TraceReplayer::run() {
+    size_t delivered = 0;
+    while (hasNext) {
+        deliver(nextRecord);
+        delivered++;
+        hasNext = reader.next(nextRecord);
+    }
+    finished = true;
+    return delivered;
+}
+
+bool TraceReplayer::isFinished() const {
+    return finished;
+}
+
+void TraceReplayer::deliver(const TraceRecord& record) {
+    const Handler& handler = handlers[(size_t)record.channel];
+    if (handler) {
+        handler(record);
+    }
+}
+
+bool CaptureModbusSerial::write(const uint8_t* data, size_t length) {
+    recorder.record(TraceChannel::MODBUS, TraceDirection::TX, data, length);
+    return serial.write(data, length);
+}
+
+int CaptureModbusSerial::read(uint8_t* data, size_t capacity) {
+    int count = serial.read(data, capacity);
+    if (count > 0) {
+        recorder.record(TraceChannel::MODBUS, TraceDirection::RX, data, (size_t)count);
+    }
+    return count;
+}
+
+ReplayModbusSerial::ReplayModbusSerial(const uint8_t* data, size_t length, uint32_t baud)
+    : reader(data, length)
+    , baud(baud)
+    , clock(defaultClockUs)
+    , speed(ReplaySpeed::RECORDED)
+    , hasNext(false)
+    , responseLength(0)
+    , responseRead(0)
+{
+    memset(&nextRecord, 0, sizeof(nextRecord));
+    memset(&stats, 0, sizeof(stats));
+    advance();
+}
+
+void ReplayModbusSerial::setClock(uint64_t (*clock)()) {
+    this->clock = clock;
+}
+
+void ReplayModbusSerial::setSpeed(ReplaySpeed speed) {
+    this->speed = speed;
+}
+
+void ReplayModbusSerial::advance() {
+    // Only the Modbus records matter here
+    do {
+        hasNext = reader.next(nextRecord);
+    } while (hasNext && nextRecord.channel != TraceChannel::MODBUS);
+}
+
+bool ReplayModbusSerial::write(const uint8_t* data, size_t length) {
+    stats.requests++;
+    responseLength = 0;
+    responseRead = 0;
+
+    // Late bytes of the previous exchange were never read: skip to the request
+    while (hasNext && nextRecord.direction != TraceDirection::TX) {
+        advance();
+    }
+    if (!hasNext) {
+        stats.unanswered++;
+        return true;
+    }
+    if (nextRecord.length != length || memcmp(nextRecord.data, data, length) != 0) {
+        stats.mismatches++;
+    }
+
+    // The response keeps its recorded distance from the request; bytes
+    // coalesced into one record follow each other at the line rate
+    uint64_t now = clock();
+    uint64_t requestAt = nextRecord.timeUs;
+    uint32_t charUs = baud > 0 ? 10 * 1000000 / baud : 0;
+    advance();
+    while (hasNext && nextRecord.direction == TraceDirection::RX) {
+        for (uint16_t i = 0; i < nextRecord.length && responseLength < MAX_RESPONSE; i++) {
+            response[responseLength] = nextRecord.data[i];
+            responseAt[responseLength] = speed == ReplaySpeed::RECORDED
+                ? now + (nextRecord.timeUs - requestAt) + (uint64_t)i * charUs
+                : now;
+            responseLength++;
+        }
+        advance();
+    }
+    return true;
+}
+
+int ReplayModbusSerial::read(uint8_t* data, size_t capacity) {
+    uint64_t now = clock();
+    size_t count = 0;
+    while (count < capacity && responseRead < responseLength && responseAt[responseRead] <= now) {
+        data[count++] = response[responseRead++];
+    }
+    return (int)count;
+}
+
+bool ReplayModbusSerial::isFinished() const {
+    return !hasNext && responseRead == responseLength;
+}
+
+const ReplayModbusStats& ReplayModbusSerial::getStats() const {
+    return stats;
+}
+
+#ifdef ARDUINO
+int CaptureStream::read() {
+    int value = stream.read();
+    if (value >= 0) {
+        uint8_t byte = (uint8_t)value;
+        recorder.record(channel, TraceDirection::RX, &byte, 1);
+    }
+    return value;
+}
+
+size_t CaptureStream::write(uint8_t value) {
+    recorder.record(channel, TraceDirection::TX, &value, 1);
+    return stream.write(value);
+}
+
+size_t CaptureStream::write(const uint8_t* data, size_t length) {
+    recorder.record(channel, TraceDirection::TX, data, length);
+    return stream.write(data, length);
+}
+#endif
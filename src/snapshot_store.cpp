@@ -0,0 +1,372 @@
+#include "snapshot_store.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <set>
+
+static const uint8_t CHUNK_RAW = 0;
+static const uint8_t CHUNK_LZ = 1;
+
+uint64_t snapshotHash(const uint8_t* data, size_t length) {
+    // FNV-1a, 64 bit
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static void putLe(std::vector<uint8_t>& out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+        out.push_back((uint8_t)(value >> (8 * i)));
+    }
+}
+
+static bool getLe(const std::vector<uint8_t>& in, size_t& pos, size_t bytes, uint64_t& value) {
+    if (pos + bytes > in.size()) {
+        return false;
+    }
+    value = 0;
+    for (size_t i = 0; i < bytes; i++) {
+        value |= (uint64_t)in[pos + i] << (8 * i);
+    }
+    pos += bytes;
+    return true;
+}
+
+SnapshotStore::SnapshotStore(SnapshotStorage& storage, const std::string& root)
+    : storage(storage)
+    , root(root)
+    , retention(DEFAULT_RETENTION)
+    , restoredSequence(0)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+void SnapshotStore::addSource(const std::string& name,
+                              std::function<bool(std::vector<uint8_t>&)> exportData,
+                              std::function<bool(const uint8_t*, size_t)> importData) {
+    SnapshotSource source;
+    source.name = name;
+    source.exportData = exportData;
+    source.importData = importData;
+    sources.push_back(source);
+}
+
+void SnapshotStore::setRetention(size_t count) {
+    retention = count > 0 ? count : 1;
+}
+
+void SnapshotStore::setRoot(const std::string& path) {
+    root = path;
+}
+
+bool SnapshotStore::create(uint32_t timestamp) {
+    Manifest manifest;
+    manifest.sequence = getLatestSequence() + 1;
+    manifest.timestamp = timestamp;
+
+    std::vector<uint8_t> data;
+    for (const SnapshotSource& source : sources) {
+        data.clear();
+        if (!source.exportData || !source.exportData(data)) {
+            return fail("Failed to export " + source.name);
+        }
+
+        SourceEntry entry;
+        entry.name = source.name;
+        entry.length = (uint32_t)data.size();
+        for (size_t offset = 0; offset < data.size(); offset += CHUNK_SIZE) {
+            size_t length = std::min(CHUNK_SIZE, data.size() - offset);
+            uint64_t hash;
+            if (!writeChunk(data.data() + offset, length, hash)) {
+                return false;
+            }
+            entry.chunks.push_back(hash);
+        }
+        manifest.sources.push_back(entry);
+    }
+
+    // The manifest is written last: an interrupted snapshot leaves only
+    // unreferenced chunks, which the next prune collects
+    if (!writeManifest(manifest)) {
+        return false;
+    }
+    // The snapshot itself is complete even if collection is skipped
+    prune();
+    return true;
+}
+
+bool SnapshotStore::restoreLatest() {
+    std::vector<uint32_t> sequences;
+    listSequences(sequences);
+    if (sequences.empty()) {
+        return fail("No snapshots found");
+    }
+
+    // Newest first; fall back to older snapshots if one fails verification
+    for (auto it = sequences.rbegin(); it != sequences.rend(); ++it) {
+        Manifest manifest;
+        std::vector<std::vector<uint8_t>> contents;
+        if (!readManifest(*it, manifest) || !loadSources(manifest, contents)) {
+            continue;
+        }
+
+        for (size_t i = 0; i < manifest.sources.size(); i++) {
+            for (const SnapshotSource& source : sources) {
+                if (source.name != manifest.sources[i].name || !source.importData) {
+                    continue;
+                }
+                if (!source.importData(contents[i].data(), contents[i].size())) {
+                    return fail("Failed to import " + source.name);
+                }
+            }
+        }
+        restoredSequence = manifest.sequence;
+        lastError.clear();
+        return true;
+    }
+    return fail("No valid snapshot found");
+}
+
+bool SnapshotStore::verify(uint32_t sequence) {
+    Manifest manifest;
+    std::vector<std::vector<uint8_t>> contents;
+    return readManifest(sequence, manifest) && loadSources(manifest, contents);
+}
+
+size_t SnapshotStore::getSnapshotCount() {
+    std::vector<uint32_t> sequences;
+    listSequences(sequences);
+    return sequences.size();
+}
+
+uint32_t SnapshotStore::getLatestSequence() {
+    std::vector<uint32_t> sequences;
+    listSequences(sequences);
+    return sequences.empty() ? 0 : sequences.back();
+}
+
+uint32_t SnapshotStore::getRestoredSequence() const {
+    return restoredSequence;
+}
+
+const SnapshotStats& SnapshotStore::getStats() const {
+    return stats;
+}
+
+const std::string& SnapshotStore::getLastError() const {
+    return lastError;
+}
+
+std::string SnapshotStore::manifestPath(uint32_t sequence) const {
+    char name[16];
+    snprintf(name, sizeof(name), "/m_%08lu", (unsigned long)sequence);
+    return root + name;
+}
+
+std::string SnapshotStore::chunkPath(uint64_t hash) const {
+    char name[24];
+    snprintf(name, sizeof(name), "/c/%08lx%08lx",
+             (unsigned long)(hash >> 32), (unsigned long)(hash & 0xFFFFFFFF));
+    return root + name;
+}
+
+void SnapshotStore::listSequences(std::vector<uint32_t>& sequences) {
+    std::vector<std::string> paths;
+    std::string prefix = root + "/m_";
+    storage.list(prefix, paths);
+    for (const std::string& path : paths) {
+        sequences.push_back((uint32_t)strtoul(path.c_str() + prefix.size(), nullptr, 10));
+    }
+    std::sort(sequences.begin(), sequences.end());
+}
+
+bool SnapshotStore::writeChunk(const uint8_t* data, size_t length, uint64_t& hash) {
+    hash = snapshotHash(data, length);
+    std::string path = chunkPath(hash);
+    // Reused only if it still holds these bytes; a damaged chunk would
+    // otherwise break every later snapshot sharing it
+    if (storage.exists(path)) {
+        std::vector<uint8_t> existing;
+        if (readChunk(hash, existing) && existing.size() == length) {
+            stats.chunksReused++;
+            return true;
+        }
+        stats.chunksRepaired++;
+    }
+
+    std::vector<uint8_t> chunk(3 + LzCodec::maxCompressedSize(length));
+    size_t compressed = codec.compress(data, length, chunk.data() + 3, chunk.size() - 3);
+    if (compressed > 0 && compressed < length) {
+        chunk[0] = CHUNK_LZ;
+        chunk.resize(3 + compressed);
+    } else {
+        chunk[0] = CHUNK_RAW;
+        memcpy(chunk.data() + 3, data, length);
+        chunk.resize(3 + length);
+    }
+    chunk[1] = (uint8_t)length;
+    chunk[2] = (uint8_t)(length >> 8);
+
+    if (!storage.writeFile(path, chunk.data(), chunk.size())) {
+        return fail("Failed to write chunk " + path);
+    }
+    stats.chunksWritten++;
+    stats.bytesWritten += chunk.size();
+    return true;
+}
+
+bool SnapshotStore::readChunk(uint64_t hash, std::vector<uint8_t>& data) {
+    std::vector<uint8_t> chunk;
+    if (!storage.readFile(chunkPath(hash), chunk) || chunk.size() < 3) {
+        return fail("Missing chunk");
+    }
+
+    size_t length = chunk[1] | ((size_t)chunk[2] << 8);
+    data.resize(length);
+    if (chunk[0] == CHUNK_LZ) {
+        if (LzCodec::decompress(chunk.data() + 3, chunk.size() - 3, data.data(), length) != length) {
+            return fail("Corrupted chunk");
+        }
+    } else if (chunk[0] == CHUNK_RAW && chunk.size() - 3 == length) {
+        memcpy(data.data(), chunk.data() + 3, length);
+    } else {
+        return fail("Corrupted chunk");
+    }
+
+    if (snapshotHash(data.data(), data.size()) != hash) {
+        return fail("Chunk hash mismatch");
+    }
+    return true;
+}
+
+bool SnapshotStore::writeManifest(const Manifest& manifest) {
+    std::vector<uint8_t> out = {'C', 'S', 'M', '1'};
+    putLe(out, manifest.sequence, 4);
+    putLe(out, manifest.timestamp, 4);
+    putLe(out, manifest.sources.size(), 1);
+    for (const SourceEntry& entry : manifest.sources) {
+        putLe(out, entry.name.size(), 1);
+        out.insert(out.end(), entry.name.begin(), entry.name.end());
+        putLe(out, entry.length, 4);
+        putLe(out, entry.chunks.size(), 2);
+        for (uint64_t hash : entry.chunks) {
+            putLe(out, hash, 8);
+        }
+    }
+    putLe(out, (uint32_t)snapshotHash(out.data(), out.size()), 4);
+
+    if (!storage.writeFile(manifestPath(manifest.sequence), out.data(), out.size())) {
+        return fail("Failed to write manifest");
+    }
+    stats.bytesWritten += out.size();
+    return true;
+}
+
+bool SnapshotStore::readManifest(uint32_t sequence, Manifest& manifest) {
+    std::vector<uint8_t> in;
+    if (!storage.readFile(manifestPath(sequence), in) || in.size() < 17
+        || memcmp(in.data(), "CSM1", 4) != 0) {
+        return fail("Invalid manifest");
+    }
+
+    size_t pos = in.size() - 4;
+    uint64_t checksum = 0;
+    getLe(in, pos, 4, checksum);
+    if ((uint32_t)snapshotHash(in.data(), in.size() - 4) != (uint32_t)checksum) {
+        return fail("Manifest checksum mismatch");
+    }
+
+    pos = 4;
+    uint64_t value = 0;
+    getLe(in, pos, 4, value);
+    manifest.sequence = (uint32_t)value;
+    getLe(in, pos, 4, value);
+    manifest.timestamp = (uint32_t)value;
+    getLe(in, pos, 1, value);
+    size_t count = (size_t)value;
+
+    manifest.sources.clear();
+    for (size_t i = 0; i < count; i++) {
+        SourceEntry entry;
+        uint64_t nameLength, length, chunkCount;
+        if (!getLe(in, pos, 1, nameLength) || pos + nameLength > in.size()) {
+            return fail("Truncated manifest");
+        }
+        entry.name.assign((const char*)in.data() + pos, nameLength);
+        pos += nameLength;
+        if (!getLe(in, pos, 4, length) || !getLe(in, pos, 2, chunkCount)) {
+            return fail("Truncated manifest");
+        }
+        entry.length = (uint32_t)length;
+        for (uint64_t c = 0; c < chunkCount; c++) {
+            uint64_t hash;
+            if (!getLe(in, pos, 8, hash)) {
+                return fail("Truncated manifest");
+            }
+            entry.chunks.push_back(hash);
+        }
+        manifest.sources.push_back(entry);
+    }
+    return true;
+}
+
+bool SnapshotStore::loadSources(const Manifest& manifest, std::vector<std::vector<uint8_t>>& contents) {
+    contents.assign(manifest.sources.size(), std::vector<uint8_t>());
+    std::vector<uint8_t> chunk;
+    for (size_t i = 0; i < manifest.sources.size(); i++) {
+        const SourceEntry& entry = manifest.sources[i];
+        contents[i].reserve(entry.length);
+        for (uint64_t hash : entry.chunks) {
+            if (!readChunk(hash, chunk)) {
+                return false;
+            }
+            contents[i].insert(contents[i].end(), chunk.begin(), chunk.end());
+        }
+        if (contents[i].size() != entry.length) {
+            return fail("Source length mismatch for " + entry.name);
+        }
+    }
+    return true;
+}
+
+bool SnapshotStore::prune() {
+    std::vector<uint32_t> sequences;
+    listSequences(sequences);
+    while (sequences.size() > retention) {
+        storage.remove(manifestPath(sequences.front()));
+        sequences.erase(sequences.begin());
+    }
+
+    // Collect chunks no longer referenced by any retained manifest
+    std::set<std::string> referenced;
+    for (uint32_t sequence : sequences) {
+        Manifest manifest;
+        // Its chunks would look unreferenced; keep every chunk instead
+        if (!readManifest(sequence, manifest)) {
+            return false;
+        }
+        for (const SourceEntry& entry : manifest.sources) {
+            for (uint64_t hash : entry.chunks) {
+                referenced.insert(chunkPath(hash));
+            }
+        }
+    }
+
+    std::vector<std::string> chunks;
+    storage.list(root + "/c/", chunks);
+    for (const std::string& path : chunks) {
+        if (referenced.find(path) == referenced.end() && storage.remove(path)) {
+            stats.chunksRemoved++;
+        }
+    }
+    return true;
+}
+
+bool SnapshotStore::fail(const std::string& error) {
+    lastError = error;
+    return false;
+}
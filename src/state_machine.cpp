@@ -6,72 +6,86 @@ StateMachine::StateMachine()
     , zigbeeState(ZigbeeState::IDLE)
     , modbusState(ModbusState::IDLE)
     , analogState(AnalogState::IDLE)
+    , maintenanceStage(-1)
+    , storageStage(-1)
+    , loraStage(-1)
+    , zigbeeStage(-1)
+    , modbusStage(-1)
     , loraSerial(LORA_RX_PIN, LORA_TX_PIN)
     , zigbeeSerial(ZIGBEE_RX_PIN, ZIGBEE_TX_PIN)
-    , led(LED_COUNT, LED_RGB_PIN, NEO_GRB + NEO_KHZ800)
+    , loraStream(loraSerial, traceRecorder, TraceChannel::LORA)
+    , zigbeeStream(zigbeeSerial, traceRecorder, TraceChannel::ZIGBEE)
+    , modbusSerial(Serial2, MODBUS_DE_PIN, MODBUS_RE_PIN, MODBUS_BAUD)
+    , modbusCapture(modbusSerial, traceRecorder)
+    , modbusMaster(modbusCapture)
+    , modbusGateway(modbusPort, modbusMaster)
+    , modbusCommands(modbusMaster)
+    , ledDriver(LED_RGB_PIN, LED_RMT_CHANNEL)
+    , indicator(ledDriver)
+    , recoveryRequested(false)
+    , captureRequested(false)
+    , captureRequest(CaptureTarget::NONE)
+    , captureTarget(CaptureTarget::NONE)
+    , ramTraceSink(nullptr, 0)
+    , flashTraceSink(CAPTURE_FLASH_MAX_BYTES)
+    , droppedSamples(0)
+    , evaluatingAt(0)
+    , evaluating(false)
+    , lastAnalogRead(0)
 {
 }
 
 void StateMachine::begin() {
-    // Initialize all modules
-    initLora();
-    initZigbee();
-    initModbus();
-    initAnalog();
-    initLed();
-    initMaintenance();
+    // Modules are initialized by the boot graph from update()
+    initBoot();
     
     // Set initial state
     setState(SystemState::INIT);
 }
 
 void StateMachine::update() {
+    if (!boot.isComplete()) {
+        updateBoot();
+    }
+    if (recoveryRequested.exchange(false)) {
+        recoverModules();
+    }
+    if (captureRequested.exchange(false)) {
+        CaptureTarget target = captureRequest.load();
+        stopCapture();
+        if (target != CaptureTarget::NONE) {
+            startCapture(target);
+        }
+    }
+
     switch (currentState) {
         case SystemState::INIT:
-            // Initialize all modules and move to configuration
-            setState(SystemState::LORA_CONFIG);
+            setState(SystemState::BOOTING);
             break;
 
-        case SystemState::LORA_CONFIG:
+        case SystemState::BOOTING:
+            // The radios configure while storage and the uplink come up;
+            // acquisition starts once a source and an uplink are ready
             updateLora();
-            if (loraState == LoraState::IDLE) {
-                setState(SystemState::ZIGBEE_CONFIG);
-            }
-            break;
-
-        case SystemState::ZIGBEE_CONFIG:
             updateZigbee();
-            if (zigbeeState == ZigbeeState::IDLE) {
-                setState(SystemState::MODBUS_CONFIG);
-            }
-            break;
-
-        case SystemState::MODBUS_CONFIG:
-            updateModbus();
-            if (modbusState == ModbusState::IDLE) {
-                setState(SystemState::ANALOG_READING);
-            }
-            break;
-
-        case SystemState::ANALOG_READING:
-            updateAnalog();
-            if (analogState == AnalogState::IDLE) {
+            if (boot.isForwardingReady() || boot.isComplete()) {
                 setState(SystemState::DATA_PROCESSING);
             }
             break;
 
         case SystemState::DATA_PROCESSING:
-            // Process collected data
+            // Rules run as samples arrive; this only raises held alarms
+            rules.update();
             updateLora();
             updateZigbee();
-            updateModbus();
+            // Stages still booting are skipped until ready
+            if (boot.isReady(modbusStage)) {
+                updateModbus();
+            }
             updateAnalog();
-            updateLed();
-            updateMaintenance();
             break;
 
         case SystemState::MAINTENANCE:
-            updateMaintenance();
             if (maintenance.getState() == MaintenanceState::IDLE) {
                 setState(SystemState::DATA_PROCESSING);
             }
@@ -81,13 +95,17 @@ void StateMachine::update() {
             handleError();
             break;
     }
+    // Patterns run off the clock in every state; the LED is only written on change
+    updateLed();
 }
 
 void StateMachine::setState(SystemState newState) {
     currentState = newState;
+    indicator.setFault(newState == SystemState::ERROR);
     // Update LED color based on state
     switch (newState) {
         case SystemState::INIT:
+        case SystemState::BOOTING:
             updateLedColor(0, 0, 255); // Blue
             break;
         case SystemState::MAINTENANCE:
@@ -106,6 +124,209 @@ SystemState StateMachine::getCurrentState() const {
     return currentState;
 }
 
+BootOrchestrator& StateMachine::getBoot() {
+    return boot;
+}
+
+void StateMachine::setSampleSink(std::function<bool(const Sample&)> sink) {
+    sampleSink = sink;
+}
+
+uint32_t StateMachine::getDroppedSamples() const {
+    return droppedSamples;
+}
+
+void StateMachine::setUplinkQueueDepth(size_t depth) {
+    maintenance.getTelemetry().setQueueDepth(depth);
+    indicator.setBacklog(depth);
+}
+
+void StateMachine::setLinkUp(bool up) {
+    indicator.setLinkUp(up);
+}
+
+void StateMachine::setFaultHandler(std::function<void()> handler) {
+    faultHandler = handler;
+}
+
+void StateMachine::setHeartbeat(std::function<void()> beat) {
+    maintenance.setProgressHook(beat);
+}
+
+bool StateMachine::requestRecovery() {
+    // Runs on the supervisor's task; the acquisition task does the work
+    recoveryRequested = true;
+    return true;
+}
+
+bool StateMachine::requestCapture(CaptureTarget target) {
+    // Runs on the web server's task; the acquisition task owns the UARTs
+    captureRequest = target;
+    captureRequested = true;
+    return true;
+}
+
+bool StateMachine::submitModbusCommand(const ModbusCommand& command) {
+    // Runs on the network task; validation happens when the queue takes it
+    return commandInbox.push(command);
+}
+
+void StateMachine::setCommandAckSink(std::function<bool(const ModbusCommandAck&)> sink) {
+    commandAckSink = sink;
+}
+
+void StateMachine::setProtocolConfigHooks(std::function<bool(const String& json)> control,
+                                          std::function<String()> report,
+                                          std::function<bool(const String& json)> restore) {
+    maintenance.setProtocolConfigControl(control);
+    maintenance.setProtocolConfigReport(report);
+    maintenance.setProtocolConfigRestore(restore);
+}
+
+void StateMachine::startCapture(CaptureTarget target) {
+    bool started = false;
+    if (target == CaptureTarget::FLASH) {
+        started = flashTraceSink.open(CAPTURE_TRACE_FILE) && traceRecorder.begin(flashTraceSink);
+    } else {
+        captureRam.resize(CAPTURE_RAM_SIZE);
+        ramTraceSink.setBuffer(captureRam.data(), captureRam.size());
+        started = traceRecorder.begin(ramTraceSink);
+    }
+    if (!started) {
+        Serial.println("[Capture] Failed to start");
+        flashTraceSink.close();
+        captureRam.clear();
+        captureRam.shrink_to_fit();
+        return;
+    }
+    captureTarget = target;
+    Serial.printf("[Capture] Recording to %s\n", target == CaptureTarget::FLASH ? "flash" : "RAM");
+}
+
+void StateMachine::stopCapture() {
+    if (!traceRecorder.isRecording()) {
+        return;
+    }
+    traceRecorder.end();
+    if (captureTarget == CaptureTarget::FLASH) {
+        flashTraceSink.close();
+    } else {
+        File file = SPIFFS.open(CAPTURE_TRACE_FILE, FILE_WRITE);
+        if (file) {
+            file.write(ramTraceSink.data(), ramTraceSink.length());
+            file.close();
+        }
+        captureRam.clear();
+        captureRam.shrink_to_fit();
+    }
+    captureTarget = CaptureTarget::NONE;
+    const TraceRecorderStats& stats = traceRecorder.getStats();
+    Serial.printf("[Capture] %u records, %u bytes captured, %u dropped, %u byte trace\n",
+                  (unsigned)stats.records, (unsigned)stats.bytes, (unsigned)stats.droppedBytes,
+                  (unsigned)stats.traceBytes);
+}
+
+void StateMachine::emitSample(SampleSource source, uint16_t pointId, float value, uint32_t timestampMs) {
+    pushSample(source, pointId, value, timestampMs);
+    // Derived points and alarm states come back through the rules output
+    evaluatingAt = timestampMs;
+    evaluating = true;
+    rules.onSample(pointId, value);
+    evaluating = false;
+}
+
+void StateMachine::pushSample(SampleSource source, uint16_t pointId, float value, uint32_t timestampMs) {
+    if (!sampleSink) {
+        return;
+    }
+    Sample sample;
+    sample.pointId = pointId;
+    sample.source = source;
+    sample.value = value;
+    sample.timestampMs = timestampMs;
+    // The sink must not block acquisition; a full queue drops the sample
+    if (!sampleSink(sample)) {
+        droppedSamples++;
+    }
+}
+
+void StateMachine::initBoot() {
+    boot.setLogCallback([](const char* line) { Serial.printf("[Boot] %s\n", line); });
+    maintenanceStage = boot.addStage("maintenance", BootRole::NONE, [this]() {
+        initMaintenance();
+        return BootStartResult::READY;
+    });
+    storageStage = boot.addStage("storage", BootRole::NONE, [this]() { return startStorage(); },
+                                 STORAGE_BOOT_TIMEOUT_MS);
+    boot.addDependency(storageStage, maintenanceStage);
+    boot.addStage("led", BootRole::NONE, [this]() {
+        initLed();
+        return BootStartResult::READY;
+    });
+    // The radios are ready once updateLora()/updateZigbee() leave CONFIGURING
+    loraStage = boot.addStage("lora", BootRole::SOURCE, [this]() {
+        initLora();
+        return BootStartResult::PENDING;
+    });
+    zigbeeStage = boot.addStage("zigbee", BootRole::SOURCE, [this]() {
+        initZigbee();
+        return BootStartResult::PENDING;
+    });
+    boot.addStage("analog", BootRole::SOURCE, [this]() {
+        initAnalog();
+        return BootStartResult::READY;
+    });
+    int rulesStage = boot.addStage("rules", BootRole::NONE, [this]() {
+        initRules();
+        return BootStartResult::READY;
+    });
+    boot.addDependency(rulesStage, storageStage);
+    // Polled blocks are evaluated by the rules, so the gateway follows them
+    modbusStage = boot.addStage("modbus", BootRole::SOURCE, [this]() {
+        initModbus();
+        initModbusGateway();
+        return BootStartResult::READY;
+    });
+    boot.addDependency(modbusStage, storageStage);
+    boot.addDependency(modbusStage, rulesStage);
+
+    maintenance.setBootTimeline([this]() { return String(boot.exportTimeline().c_str()); });
+    boot.begin();
+}
+
+BootStartResult StateMachine::startStorage() {
+    // Mounting (and formatting a blank partition) runs on its own task so
+    // the radios, LED and analog inputs come up meanwhile
+    BaseType_t created = xTaskCreate(
+        [](void* arg) {
+            StateMachine* self = static_cast<StateMachine*>(arg);
+            if (self->maintenance.mountStorage()) {
+                self->boot.markReady(self->storageStage);
+            } else {
+                self->boot.markFailed(self->storageStage);
+            }
+            vTaskDelete(nullptr);
+        },
+        "boot_storage", STORAGE_TASK_STACK, this, 3, nullptr);
+    if (created == pdPASS) {
+        return BootStartResult::PENDING;
+    }
+    return maintenance.mountStorage() ? BootStartResult::READY : BootStartResult::FAILED;
+}
+
+void StateMachine::updateBoot() {
+    if (loraState != LoraState::CONFIGURING) {
+        boot.markReady(loraStage);
+    }
+    if (zigbeeState != ZigbeeState::CONFIGURING) {
+        boot.markReady(zigbeeStage);
+    }
+    boot.update();
+    if (boot.isComplete()) {
+        Serial.printf("[Boot] %s\n", boot.exportTimeline().c_str());
+    }
+}
+
 void StateMachine::initLora() {
     pinMode(LORA_AUX_PIN, INPUT);
     pinMode(LORA_M0_PIN, OUTPUT);
@@ -132,7 +353,7 @@ void StateMachine::initModbus() {
     digitalWrite(MODBUS_DE_PIN, LOW);
     digitalWrite(MODBUS_RE_PIN, LOW);
     
-    //modbus.begin(9600); //TODO: Set the correct baud rate
+    Serial2.begin(MODBUS_BAUD, SERIAL_8N1, MODBUS_RX_PIN, MODBUS_TX_PIN);
     modbusState = ModbusState::IDLE;
 }
 
@@ -143,13 +364,131 @@ void StateMachine::initAnalog() {
 }
 
 void StateMachine::initLed() {
-    led.begin();
-    led.setBrightness(50);
+    indicator.setBrightness(LED_BRIGHTNESS);
+    indicator.setLinkUp(false); // until Wi-Fi reports LINK_UP
     updateLedColor(0, 0, 255); // Blue for initialization
+    if (!indicator.begin()) {
+        Serial.println("[LED] Failed to start RMT channel");
+    }
 }
 
 void StateMachine::initMaintenance() {
     maintenance.begin();
+    maintenance.setCaptureControl([this](bool start, bool toFlash) {
+        return requestCapture(!start ? CaptureTarget::NONE : toFlash ? CaptureTarget::FLASH : CaptureTarget::RAM);
+    });
+}
+
+void StateMachine::initRules() {
+    rules.setOutput([this](uint16_t pointId, float value) {
+        // Alarms released by a hold timer come from rules.update() instead
+        pushSample(SampleSource::DERIVED, pointId, value, evaluating ? evaluatingAt : millis());
+    });
+    rules.setAlarmCallback([](const char* name, bool active) {
+        Serial.printf("[Rules] Alarm %s %s\n", name, active ? "raised" : "cleared");
+    });
+    // Rules are compiled here only, so a restored set applies after a reboot
+    maintenance.addSnapshotFile("rules", RULES_CONFIG_FILE, true);
+
+    if (!SPIFFS.exists(RULES_CONFIG_FILE)) {
+        return;
+    }
+    File file = SPIFFS.open(RULES_CONFIG_FILE, "r");
+    if (!file) {
+        return;
+    }
+    DynamicJsonDocument doc(8192);
+    DeserializationError error = deserializeJson(doc, file);
+    file.close();
+    if (error) {
+        Serial.println("[Rules] Invalid " RULES_CONFIG_FILE);
+        return;
+    }
+
+    // {"points": {"name": id}, "derived": [{"point", "expr"}],
+    //  "alarms": [{"name", "expr", "holdMs", "point"}]}
+    for (JsonPair point : doc["points"].as<JsonObject>()) {
+        rules.definePoint(point.key().c_str(), point.value().as<uint16_t>());
+    }
+    for (JsonObject rule : doc["derived"].as<JsonArray>()) {
+        if (rules.addDerived(rule["point"] | (uint16_t)RulesEngine::NO_POINT, rule["expr"] | "") < 0) {
+            Serial.println("[Rules] " + String(rule["expr"] | "") + ": " + rules.getLastError().c_str());
+        }
+    }
+    for (JsonObject rule : doc["alarms"].as<JsonArray>()) {
+        if (rules.addAlarm(rule["name"] | "alarm", rule["expr"] | "", rule["holdMs"] | 0,
+                           rule["point"] | (uint16_t)RulesEngine::NO_POINT) < 0) {
+            Serial.println("[Rules] " + String(rule["expr"] | "") + ": " + rules.getLastError().c_str());
+        }
+    }
+    Serial.printf("[Rules] %u rules, %u bytes of bytecode\n", (unsigned)rules.getRuleCount(),
+                  (unsigned)rules.getCodeSize());
+}
+
+void StateMachine::initModbusGateway() {
+    // Polled blocks may be published as points: point + i for register start + i
+    modbusGateway.setBlockCallback([this](size_t block, const uint16_t* values, uint16_t count,
+                                          uint32_t sampledAt) {
+        uint16_t firstPoint = block < modbusBlockPoints.size() ? modbusBlockPoints[block] : RulesEngine::NO_POINT;
+        if (firstPoint == RulesEngine::NO_POINT) {
+            return;
+        }
+        for (uint16_t i = 0; i < count; i++) {
+            emitSample(SampleSource::MODBUS, firstPoint + i, values[i], sampledAt);
+        }
+    });
+
+    // Commands take the bus only where they fit between polls
+    modbusGateway.setIdleTask([this](uint32_t now, uint32_t pollDueInMs) {
+        return modbusCommands.dispatch(now, pollDueInMs);
+    });
+    modbusCommands.setWriteCallback([this](uint8_t unit, uint16_t start, uint16_t count) {
+        modbusGateway.getCache().invalidate(unit, ModbusFunction::READ_HOLDING_REGISTERS, start, count);
+    });
+    modbusCommands.setAckCallback([this](const ModbusCommandAck& ack) {
+        if (!commandAckSink || !commandAckSink(ack)) {
+            Serial.printf("[Modbus] Command %s ack dropped\n", ack.id);
+        }
+    });
+
+    // Poll blocks and writable ranges; like the rules, read only here
+    maintenance.addSnapshotFile("modbus", MODBUS_CONFIG_FILE, true);
+
+    uint16_t tcpPort = MODBUS_TCP_PORT;
+    File file = SPIFFS.exists(MODBUS_CONFIG_FILE) ? SPIFFS.open(MODBUS_CONFIG_FILE, "r") : File();
+    if (file) {
+        DynamicJsonDocument doc(4096);
+        DeserializationError error = deserializeJson(doc, file);
+        file.close();
+        if (error) {
+            Serial.println("[Modbus] Invalid " MODBUS_CONFIG_FILE);
+        } else {
+            // {"tcpPort", "responseTimeoutMs",
+            //  "blocks": [{"unit", "function", "start", "count", "maxAgeMs", "pollMs", "point"}],
+            //  "writable": [{"unit", "start", "count"}]}
+            tcpPort = doc["tcpPort"] | MODBUS_TCP_PORT;
+            modbusMaster.setResponseTimeout(doc["responseTimeoutMs"] | (uint32_t)ModbusRtuMaster::DEFAULT_RESPONSE_TIMEOUT_MS);
+            for (JsonObject block : doc["blocks"].as<JsonArray>()) {
+                int index = modbusGateway.getCache().addBlock(block["unit"] | 1,
+                                                              block["function"] | ModbusFunction::READ_HOLDING_REGISTERS,
+                                                              block["start"] | 0, block["count"] | 1,
+                                                              block["maxAgeMs"] | 1000, block["pollMs"] | 0);
+                if (index < 0) {
+                    Serial.println("[Modbus] Invalid block in " MODBUS_CONFIG_FILE);
+                    continue;
+                }
+                modbusBlockPoints.push_back(block["point"] | (uint16_t)RulesEngine::NO_POINT);
+            }
+            for (JsonObject range : doc["writable"].as<JsonArray>()) {
+                if (!modbusCommands.addWritableRange(range["unit"] | 1, range["start"] | 0, range["count"] | 0)) {
+                    Serial.println("[Modbus] Invalid writable range in " MODBUS_CONFIG_FILE);
+                }
+            }
+        }
+    }
+    modbusGateway.begin(tcpPort);
+    Serial.printf("[Modbus] TCP gateway on port %u, %u cached blocks\n", (unsigned)tcpPort,
+                  (unsigned)modbusGateway.getCache().getBlockCount());
 }
 
 void StateMachine::updateLora() {
@@ -165,7 +504,9 @@ void StateMachine::updateLora() {
             break;
             
         case LoraState::RECEIVING:
-            // Handle reception
+            // Handle reception through loraStream so captures include it;
+            // stamp each frame with millis() at its first byte and pass
+            // that to emitSample()
             break;
             
         case LoraState::ERROR:
@@ -190,7 +531,9 @@ void StateMachine::updateZigbee() {
             break;
             
         case ZigbeeState::RECEIVING:
-            // Handle reception
+            // Handle reception through zigbeeStream so captures include it;
+            // stamp each frame with millis() at its first byte and pass
+            // that to emitSample()
             break;
             
         case ZigbeeState::ERROR:
@@ -204,19 +547,24 @@ void StateMachine::updateZigbee() {
 
 void StateMachine::updateModbus() {
     switch (modbusState) {
+        case ModbusState::IDLE:
         case ModbusState::READING:
-            // Set to receive mode
-            digitalWrite(MODBUS_DE_PIN, LOW);
-            digitalWrite(MODBUS_RE_PIN, LOW);
-            // Add your Modbus reading logic here
-            break;
-            
-        case ModbusState::WRITING:
-            // Set to transmit mode
-            digitalWrite(MODBUS_DE_PIN, HIGH);
-            digitalWrite(MODBUS_RE_PIN, HIGH);
-            // Add your Modbus writing logic here
+        case ModbusState::WRITING: {
+            ModbusCommand command;
+            while (commandInbox.pop(command)) {
+                modbusCommands.submit(command);
+            }
+            modbusCommands.update();
+            // The RTU master drives DE/RE per frame; TCP requests, downlink
+            // commands and the poller share it
+            modbusGateway.update();
+            if (!modbusMaster.isBusy()) {
+                modbusState = ModbusState::IDLE;
+            } else {
+                modbusState = modbusCommands.isActive() ? ModbusState::WRITING : ModbusState::READING;
+            }
             break;
+        }
             
         case ModbusState::ERROR:
             handleError();
@@ -231,13 +579,26 @@ void StateMachine::updateAnalog() {
     switch (analogState) {
         case AnalogState::READING:
         {
-            // Read analog inputs
+            // Read analog inputs; both are stamped with the start of the conversion
+            uint32_t sampledAt = millis();
             int value1 = analogRead(ANALOG_INPUT_1);
             int value2 = analogRead(ANALOG_INPUT_2);
             // Process the values as needed
+            maintenance.getTelemetry().recordSensorValue(0, value1);
+            maintenance.getTelemetry().recordSensorValue(1, value2);
+            emitSample(SampleSource::ANALOG, 0, value1, sampledAt);
+            emitSample(SampleSource::ANALOG, 1, value2, sampledAt);
+            lastAnalogRead = sampledAt;
             analogState = AnalogState::IDLE;
             break;
         }
+
+        case AnalogState::IDLE:
+            if (currentState == SystemState::DATA_PROCESSING
+                && millis() - lastAnalogRead >= ANALOG_POLL_INTERVAL_MS) {
+                analogState = AnalogState::READING;
+            }
+            break;
             
         case AnalogState::ERROR:
             handleError();
@@ -249,21 +610,48 @@ void StateMachine::updateAnalog() {
 }
 
 void StateMachine::updateLed() {
-    led.show();
+    MaintenanceState state = maintenance.getState();
+    bool updating = state == MaintenanceState::DOWNLOADING_UPDATE || state == MaintenanceState::INSTALLING_UPDATE;
+    indicator.setProgress(updating ? maintenance.getUpdateProgress() : -1.0f);
+    indicator.update(millis());
+}
+
+void StateMachine::startMaintenanceServer() {
+    // Snapshot jobs come in over HTTP; by then the rules and Modbus stages
+    // have registered their files. A failed or skipped stage registers
+    // nothing, and factory reset and restore are needed most then.
+    if (boot.isReady(maintenanceStage) && boot.isSettled(modbusStage)) {
+        maintenance.startWebServer();
+    }
 }
 
 void StateMachine::updateMaintenance() {
-    maintenance.update();
+    // Routes, the job mutex and the telemetry hub come from initMaintenance()
+    if (boot.isReady(maintenanceStage)) {
+        maintenance.update();
+    }
 }
 
 void StateMachine::handleError() {
-    updateLedColor(255, 0, 0); // Red for error
-    // Add error handling logic here
+    indicator.setFault(true);
+    // The supervisor decides how far to escalate
+    if (faultHandler) {
+        faultHandler();
+    }
+}
+
+void StateMachine::recoverModules() {
+    Serial.println("[StateMachine] Reinitializing field-bus modules");
+    initLora();
+    initZigbee();
+    initModbus();
+    initAnalog();
+    setState(SystemState::INIT);
 }
 
 void StateMachine::updateLedColor(uint8_t r, uint8_t g, uint8_t b) {
-    led.setPixelColor(0, r, g, b);
-    led.show();
+    // Picked up by the next updateLed()
+    indicator.setBase({r, g, b});
 }
 
 // Maintenance methods
@@ -301,4 +689,8 @@ String StateMachine::getMaintenanceError() const {
 
 float StateMachine::getUpdateProgress() const {
     return maintenance.getUpdateProgress();
-} 
\ No newline at end of file
+}
+
+SystemConfig StateMachine::getSystemConfig() const {
+    return maintenance.getConfig();
+}
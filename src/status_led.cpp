@@ -0,0 +1,194 @@
+#include "status_led.h"
+
+static const LedColor LED_OFF = {0, 0, 0};
+static const LedColor LED_FAULT = {255, 0, 0};
+static const LedColor LED_OTA = {255, 165, 0};
+
+#ifdef ARDUINO
+// 40 MHz RMT clock (APB / 2): 25 ns per tick
+static const uint8_t RMT_CLOCK_DIVIDER = 2;
+static const uint16_t T0H_TICKS = 16;   // 0.40 us
+static const uint16_t T0L_TICKS = 34;   // 0.85 us
+static const uint16_t T1H_TICKS = 32;   // 0.80 us
+static const uint16_t T1L_TICKS = 18;   // 0.45 us
+
+bool RmtLedDriver::begin() {
+    rmt_config_t config = RMT_DEFAULT_CONFIG_TX((gpio_num_t)pin, channel);
+    config.clk_div = RMT_CLOCK_DIVIDER;
+    if (rmt_config(&config) != ESP_OK || rmt_driver_install(channel, 0, 0) != ESP_OK) {
+        return false;
+    }
+    installed = true;
+    return true;
+}
+
+bool RmtLedDriver::isBusy() const {
+    return installed && rmt_wait_tx_done(channel, 0) != ESP_OK;
+}
+
+bool RmtLedDriver::show(const LedColor* pixels, size_t count) {
+    if (!installed || count > MAX_PIXELS || isBusy()) {
+        return false;
+    }
+    // WS2812 takes G, R, B, most significant bit first
+    size_t item = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t grb = ((uint32_t)pixels[i].g << 16) | ((uint32_t)pixels[i].r << 8) | pixels[i].b;
+        for (int bit = 23; bit >= 0; bit--) {
+            bool one = (grb >> bit) & 1;
+            items[item].level0 = 1;
+            items[item].duration0 = one ? T1H_TICKS : T0H_TICKS;
+            items[item].level1 = 0;
+            items[item].duration1 = one ? T1L_TICKS : T0L_TICKS;
+            item++;
+        }
+    }
+    // The line idles low between frames, which is the latch
+    return rmt_write_items(channel, items, (int)item, false) == ESP_OK;
+}
+#endif
+
+StatusIndicator::StatusIndicator(LedDriver& driver)
+    : driver(driver)
+    , brightness(255)
+    , backlogThreshold(DEFAULT_BACKLOG_THRESHOLD)
+    , backlogFull(DEFAULT_BACKLOG_FULL)
+    , base(LED_OFF)
+    , fault(false)
+    , linkUp(true)
+    , backlog(0)
+    , progressPermille(-1)
+    , started(false)
+    , shown(false)
+    , lastShown(LED_OFF)
+    , lastFrameAt(0)
+    , stats{0, 0, 0}
+{
+}
+
+bool StatusIndicator::begin() {
+    started = driver.begin();
+    shown = false;
+    return started;
+}
+
+void StatusIndicator::setBrightness(uint8_t brightness) {
+    this->brightness = brightness;
+}
+
+void StatusIndicator::setBacklogThresholds(uint16_t threshold, uint16_t full) {
+    backlogThreshold = threshold;
+    backlogFull = full > threshold ? full : (uint16_t)(threshold + 1);
+}
+
+void StatusIndicator::setBase(LedColor color) {
+    base = color;
+}
+
+void StatusIndicator::setFault(bool fault) {
+    this->fault = fault;
+}
+
+void StatusIndicator::setLinkUp(bool up) {
+    linkUp = up;
+}
+
+void StatusIndicator::setBacklog(size_t depth) {
+    backlog = (uint16_t)(depth > 0xFFFF ? 0xFFFF : depth);
+}
+
+void StatusIndicator::setProgress(float percent) {
+    if (percent < 0) {
+        progressPermille = -1;
+    } else {
+        progressPermille = (int16_t)(percent > 100 ? 1000 : percent * 10);
+    }
+}
+
+void StatusIndicator::update(uint32_t now) {
+    if (!started || (shown && now - lastFrameAt < FRAME_INTERVAL_MS)) {
+        return;
+    }
+    lastFrameAt = now;
+    stats.frames++;
+    LedColor color = compute(now);
+    if (shown && color == lastShown) {
+        return;
+    }
+    // A frame still on the wire: the next one picks the change up
+    if (driver.isBusy()) {
+        stats.busySkips++;
+        return;
+    }
+    if (driver.show(&color, 1)) {
+        lastShown = color;
+        shown = true;
+        stats.transmissions++;
+    }
+}
+
+LedColor StatusIndicator::compute(uint32_t now) const {
+    LedColor color;
+    int16_t progress = progressPermille;
+    switch (getPattern()) {
+        case LedPattern::SOLID:
+            color = fault ? LED_FAULT : base;
+            break;
+
+        case LedPattern::BLINK:
+            if (progress >= 0) {
+                // On for 10% of the period at the start of an update, 90% at the end
+                uint32_t onMs = OTA_PERIOD_MS * (100 + (uint32_t)progress * 8 / 10) / 1000;
+                color = now % OTA_PERIOD_MS < onMs ? LED_OTA : LED_OFF;
+            } else {
+                color = now % BLINK_PERIOD_MS < BLINK_PERIOD_MS / 2 ? base : LED_OFF;
+            }
+            break;
+
+        case LedPattern::BREATHE: {
+            uint32_t period = breathePeriodMs(backlog);
+            uint32_t phase = now % period;
+            uint32_t ramp = phase < period / 2 ? phase : period - phase;
+            uint32_t triangle = ramp * 510 / period;
+            // Squared for a perceptually even fade; never quite dark
+            uint8_t level = (uint8_t)(16 + triangle * triangle * 239 / (255 * 255));
+            color = scale(base, level);
+            break;
+        }
+    }
+    return scale(color, brightness);
+}
+
+LedPattern StatusIndicator::getPattern() const {
+    if (fault) {
+        return LedPattern::SOLID;
+    }
+    if (progressPermille >= 0 || !linkUp) {
+        return LedPattern::BLINK;
+    }
+    if (backlog >= backlogThreshold) {
+        return LedPattern::BREATHE;
+    }
+    return LedPattern::SOLID;
+}
+
+const StatusIndicatorStats& StatusIndicator::getStats() const {
+    return stats;
+}
+
+LedColor StatusIndicator::scale(LedColor color, uint8_t level) {
+    LedColor scaled;
+    scaled.r = (uint8_t)((color.r * (level + 1)) >> 8);
+    scaled.g = (uint8_t)((color.g * (level + 1)) >> 8);
+    scaled.b = (uint8_t)((color.b * (level + 1)) >> 8);
+    return scaled;
+}
+
+uint32_t StatusIndicator::breathePeriodMs(uint16_t depth) const {
+    if (depth >= backlogFull) {
+        return BREATHE_FAST_MS;
+    }
+    uint32_t span = backlogFull - backlogThreshold;
+    uint32_t over = depth > backlogThreshold ? depth - backlogThreshold : 0;
+    return BREATHE_SLOW_MS - (BREATHE_SLOW_MS - BREATHE_FAST_MS) * over / span;
+}
@@ -0,0 +1,434 @@
+#include "supervisor.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <SPIFFS.h>
+#include <esp_system.h>
+#include <esp_task_wdt.h>
+#else
+#include <chrono>
+#endif
+
+static uint32_t defaultClock() {
+#ifdef ARDUINO
+    return millis();
+#else
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+#ifdef ARDUINO
+static const char* const SUPERVISOR_LOG_FILE = "/supervisor.bin";
+static const uint32_t SUPERVISOR_LOG_MAGIC = 0x53564C31; // "SVL1"
+
+bool EspSupervisorHal::beginWatchdog(uint32_t timeoutMs) {
+    // The core has already started the task WDT; on IDF 4.x init only
+    // changes its timeout. Panic so the next boot reads TASK_WATCHDOG.
+    if (esp_task_wdt_init((timeoutMs + 999) / 1000, true) != ESP_OK) {
+        return false;
+    }
+    esp_err_t err = esp_task_wdt_add(nullptr);
+    // INVALID_ARG: this task is already subscribed
+    return err == ESP_OK || err == ESP_ERR_INVALID_ARG;
+}
+
+void EspSupervisorHal::feedWatchdog() {
+    esp_task_wdt_reset();
+}
+
+void EspSupervisorHal::restart() {
+    Serial.flush();
+    ESP.restart();
+}
+
+ResetCause EspSupervisorHal::resetCause() {
+    switch (esp_reset_reason()) {
+        case ESP_RST_POWERON:
+            return ResetCause::POWER_ON;
+        case ESP_RST_EXT:
+            return ResetCause::EXTERNAL;
+        case ESP_RST_SW:
+            return ResetCause::SOFTWARE;
+        case ESP_RST_PANIC:
+            return ResetCause::PANIC;
+        case ESP_RST_TASK_WDT:
+            return ResetCause::TASK_WATCHDOG;
+        case ESP_RST_INT_WDT:
+        case ESP_RST_WDT:
+            return ResetCause::OTHER_WATCHDOG;
+        case ESP_RST_BROWNOUT:
+            return ResetCause::BROWNOUT;
+        case ESP_RST_DEEPSLEEP:
+            return ResetCause::DEEP_SLEEP;
+        default:
+            return ResetCause::UNKNOWN;
+    }
+}
+
+bool EspSupervisorHal::loadLog(SupervisorLog& log) {
+    File file = SPIFFS.open(SUPERVISOR_LOG_FILE, "r");
+    if (!file) {
+        return false;
+    }
+    uint32_t magic = 0;
+    bool ok = file.read((uint8_t*)&magic, sizeof(magic)) == sizeof(magic) && magic == SUPERVISOR_LOG_MAGIC &&
+              file.read((uint8_t*)&log, sizeof(log)) == sizeof(log);
+    file.close();
+    return ok;
+}
+
+bool EspSupervisorHal::saveLog(const SupervisorLog& log) {
+    File file = SPIFFS.open(SUPERVISOR_LOG_FILE, "w");
+    if (!file) {
+        return false;
+    }
+    bool ok = file.write((const uint8_t*)&SUPERVISOR_LOG_MAGIC, sizeof(SUPERVISOR_LOG_MAGIC)) == sizeof(SUPERVISOR_LOG_MAGIC) &&
+              file.write((const uint8_t*)&log, sizeof(log)) == sizeof(log);
+    file.close();
+    return ok;
+}
+#endif
+
+const char* resetCauseName(ResetCause cause) {
+    switch (cause) {
+        case ResetCause::POWER_ON:
+            return "power-on";
+        case ResetCause::EXTERNAL:
+            return "external";
+        case ResetCause::SOFTWARE:
+            return "software";
+        case ResetCause::PANIC:
+            return "panic";
+        case ResetCause::TASK_WATCHDOG:
+            return "task watchdog";
+        case ResetCause::OTHER_WATCHDOG:
+            return "watchdog";
+        case ResetCause::BROWNOUT:
+            return "brownout";
+        case ResetCause::DEEP_SLEEP:
+            return "deep sleep";
+        default:
+            return "unknown";
+    }
+}
+
+const char* recoveryLevelName(RecoveryLevel level) {
+    switch (level) {
+        case RecoveryLevel::SOFT:
+            return "soft recovery";
+        case RecoveryLevel::PROTOCOL_RESET:
+            return "protocol reset";
+        case RecoveryLevel::REBOOT:
+            return "reboot";
+        default:
+            return "none";
+    }
+}
+
+Supervisor::Supervisor(SupervisorHal& hal)
+    : hal(hal)
+    , clock(defaultClock)
+    , startedAt(0)
+    , stableMs(DEFAULT_STABLE_MS)
+    , moduleCount(0)
+    , logCallback(nullptr)
+    , resetCause(ResetCause::UNKNOWN)
+    , watchdogFeeds(0)
+    , rebooting(false)
+{
+    memset(&log, 0, sizeof(log));
+}
+
+void Supervisor::setClock(uint32_t (*newClock)()) {
+    clock = newClock;
+}
+
+void Supervisor::setStableInterval(uint32_t ms) {
+    stableMs = ms;
+}
+
+int Supervisor::addModule(const char* name, uint32_t deadlineMs, RecoveryHandler recover) {
+    if (moduleCount >= MAX_MODULES || deadlineMs == 0) {
+        return -1;
+    }
+    uint32_t now = clock();
+    Module& module = modules[moduleCount];
+    module.name = name;
+    module.deadlineMs = deadlineMs;
+    module.recover = recover;
+    module.lastBeat.store(now);
+    module.fault.store(false);
+    module.faulted = false;
+    module.stale = false;
+    module.level = RecoveryLevel::NONE;
+    module.nextStepAt = now;
+    module.freshSince = now;
+    module.lastCreditAt = now;
+    module.health = 100;
+    module.misses = 0;
+    module.recoveries = 0;
+    return (int)moduleCount++;
+}
+
+void Supervisor::setProtocolReset(RecoveryHandler reset) {
+    protocolReset = reset;
+}
+
+void Supervisor::setLogCallback(void (*callback)(const char*)) {
+    logCallback = callback;
+}
+
+bool Supervisor::begin() {
+    uint32_t now = clock();
+    startedAt = now;
+
+    if (!hal.loadLog(log)) {
+        memset(&log, 0, sizeof(log));
+    }
+    log.bootCount++;
+    resetCause = hal.resetCause();
+
+    // Power-on and wake-up are routine; anything else, or a breadcrumb from
+    // an escalation in progress, goes into the post-mortem ring
+    if (log.hasPending || (resetCause != ResetCause::POWER_ON && resetCause != ResetCause::DEEP_SLEEP)) {
+        ResetRecord record;
+        if (log.hasPending) {
+            record = log.pending;
+        } else {
+            memset(&record, 0, sizeof(record));
+        }
+        record.bootCount = log.bootCount - 1;
+        record.cause = resetCause;
+        log.records[log.next] = record;
+        log.next = (uint8_t)((log.next + 1) % SupervisorLog::MAX_RECORDS);
+        if (log.count < SupervisorLog::MAX_RECORDS) {
+            log.count++;
+        }
+        if (record.level != RecoveryLevel::NONE) {
+            emitLog("Previous boot ended by %s during %s of %s (%u ms without heartbeat, up %u ms)",
+                    resetCauseName(record.cause), recoveryLevelName(record.level), record.module,
+                    (unsigned)record.staleMs, (unsigned)record.uptimeMs);
+        } else {
+            emitLog("Previous boot ended by %s", resetCauseName(record.cause));
+        }
+    }
+    log.hasPending = false;
+    hal.saveLog(log);
+
+    // Setup time does not count against the deadlines
+    for (size_t i = 0; i < moduleCount; i++) {
+        modules[i].lastBeat.store(now);
+        modules[i].freshSince = now;
+        modules[i].lastCreditAt = now;
+    }
+    emitLog("Boot %u, %u modules, watchdog %u ms", (unsigned)log.bootCount, (unsigned)moduleCount,
+            (unsigned)getWatchdogTimeoutMs());
+    return hal.beginWatchdog(getWatchdogTimeoutMs());
+}
+
+void Supervisor::update() {
+    if (rebooting) {
+        return;
+    }
+    uint32_t now = clock();
+    bool allFresh = true;
+    for (size_t i = 0; i < moduleCount && !rebooting; i++) {
+        checkModule(modules[i], now);
+        if (modules[i].stale) {
+            allFresh = false;
+        }
+    }
+    if (allFresh && !rebooting) {
+        hal.feedWatchdog();
+        watchdogFeeds++;
+    }
+}
+
+void Supervisor::heartbeat(int module) {
+    if (module < 0 || (size_t)module >= moduleCount) {
+        return;
+    }
+    modules[module].lastBeat.store(clock());
+}
+
+void Supervisor::reportFault(int module) {
+    if (module < 0 || (size_t)module >= moduleCount) {
+        return;
+    }
+    modules[module].fault.store(true);
+}
+
+uint32_t Supervisor::getWatchdogTimeoutMs() const {
+    // Stale after one deadline, then soft, protocol and reboot one deadline
+    // apart: the watchdog must outlast two deadlines without a feed
+    uint32_t longest = 0;
+    for (size_t i = 0; i < moduleCount; i++) {
+        if (modules[i].deadlineMs > longest) {
+            longest = modules[i].deadlineMs;
+        }
+    }
+    return longest > 0 ? longest * 3 : 30000;
+}
+
+size_t Supervisor::getModuleCount() const {
+    return moduleCount;
+}
+
+bool Supervisor::getModuleStatus(size_t index, ModuleStatus& status) const {
+    if (index >= moduleCount) {
+        return false;
+    }
+    const Module& module = modules[index];
+    status.name = module.name;
+    status.deadlineMs = module.deadlineMs;
+    status.ageMs = clock() - module.lastBeat.load();
+    status.stale = module.stale;
+    status.level = module.level;
+    status.health = module.health;
+    status.misses = module.misses;
+    status.recoveries = module.recoveries;
+    return true;
+}
+
+uint8_t Supervisor::getHealth() const {
+    uint8_t health = 100;
+    for (size_t i = 0; i < moduleCount; i++) {
+        if (modules[i].health < health) {
+            health = modules[i].health;
+        }
+    }
+    return health;
+}
+
+ResetCause Supervisor::getResetCause() const {
+    return resetCause;
+}
+
+const SupervisorLog& Supervisor::getLog() const {
+    return log;
+}
+
+uint32_t Supervisor::getWatchdogFeeds() const {
+    return watchdogFeeds;
+}
+
+void Supervisor::checkModule(Module& module, uint32_t now) {
+    if (module.fault.exchange(false)) {
+        module.faulted = true;
+    }
+    bool late = now - module.lastBeat.load() > module.deadlineMs;
+
+    if (module.stale) {
+        // Each step gets one deadline to show an effect
+        if ((int32_t)(now - module.nextStepAt) < 0) {
+            return;
+        }
+        if (!late && !module.faulted) {
+            module.stale = false;
+            module.freshSince = now;
+            module.lastCreditAt = now;
+            if (log.hasPending && strncmp(log.pending.module, module.name, sizeof(log.pending.module) - 1) == 0) {
+                log.hasPending = false;
+                hal.saveLog(log);
+            }
+            emitLog("%s recovered after %s", module.name, recoveryLevelName(module.level));
+            return;
+        }
+        module.faulted = false;
+        escalate(module, now);
+        return;
+    }
+
+    if (late || module.faulted) {
+        module.stale = true;
+        module.misses++;
+        penalize(module, MISS_PENALTY);
+        if (module.faulted) {
+            emitLog("%s reported a fault", module.name);
+        } else {
+            emitLog("%s missed its heartbeat (%u ms, deadline %u ms)", module.name,
+                    (unsigned)(now - module.lastBeat.load()), (unsigned)module.deadlineMs);
+        }
+        module.faulted = false;
+        escalate(module, now);
+        return;
+    }
+
+    // Fresh: a level reached recently is remembered until the module has
+    // been stable for a while, and health comes back slowly
+    if (module.level != RecoveryLevel::NONE && now - module.freshSince >= stableMs) {
+        module.level = RecoveryLevel::NONE;
+    }
+    if (now - module.lastCreditAt >= module.deadlineMs) {
+        module.lastCreditAt = now;
+        module.health = module.health + FRESH_CREDIT > 100 ? 100 : module.health + FRESH_CREDIT;
+    }
+}
+
+void Supervisor::escalate(Module& module, uint32_t now) {
+    for (;;) {
+        if (module.level != RecoveryLevel::REBOOT) {
+            module.level = static_cast<RecoveryLevel>(static_cast<uint8_t>(module.level) + 1);
+        }
+        penalize(module, ESCALATION_PENALTY);
+        // Written before acting: if the step itself hangs, the watchdog
+        // reset that follows is still attributed
+        writePending(module, now);
+        if (runStep(module) || module.level == RecoveryLevel::REBOOT) {
+            break;
+        }
+        emitLog("%s: %s not available or failed", module.name, recoveryLevelName(module.level));
+    }
+    module.nextStepAt = now + module.deadlineMs;
+}
+
+bool Supervisor::runStep(Module& module) {
+    emitLog("%s: %s", module.name, recoveryLevelName(module.level));
+    switch (module.level) {
+        case RecoveryLevel::SOFT:
+            module.recoveries++;
+            return module.recover && module.recover();
+        case RecoveryLevel::PROTOCOL_RESET:
+            module.recoveries++;
+            return protocolReset && protocolReset();
+        case RecoveryLevel::REBOOT:
+            rebooting = true;
+            hal.restart();
+            return true;
+        default:
+            return false;
+    }
+}
+
+void Supervisor::writePending(const Module& module, uint32_t now) {
+    ResetRecord& pending = log.pending;
+    memset(&pending, 0, sizeof(pending));
+    pending.bootCount = log.bootCount;
+    pending.cause = ResetCause::UNKNOWN;
+    pending.level = module.level;
+    strncpy(pending.module, module.name, sizeof(pending.module) - 1);
+    pending.uptimeMs = now - startedAt;
+    pending.staleMs = now - module.lastBeat.load();
+    log.hasPending = true;
+    hal.saveLog(log);
+}
+
+void Supervisor::penalize(Module& module, uint8_t points) {
+    module.health = module.health > points ? module.health - points : 0;
+}
+
+void Supervisor::emitLog(const char* format, ...) {
+    if (!logCallback) {
+        return;
+    }
+    char line[160];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    logCallback(line);
+}
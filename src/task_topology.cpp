@@ -0,0 +1,161 @@
+#include "task_topology.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+TaskTopology::TaskTopology()
+    : taskCount(0)
+    , running(false)
+{
+}
+
+TaskTopology::~TaskTopology() {
+    stop();
+}
+
+bool TaskTopology::addTask(const TaskSpec& spec) {
+    if (running || taskCount >= MAX_TASKS || !spec.body) {
+        return false;
+    }
+    TaskSlot& slot = slots[taskCount++];
+    slot.spec = spec;
+    slot.owner = this;
+    slot.iterations = 0;
+    slot.busyUs = 0;
+    slot.maxBusyUs = 0;
+    slot.lastBusyUs = 0;
+    slot.lastSampleUs = 0;
+    slot.finished = true;
+    return true;
+}
+
+bool TaskTopology::start() {
+    if (running) {
+        return false;
+    }
+    running = true;
+    uint32_t now = nowUs();
+    for (size_t i = 0; i < taskCount; i++) {
+        TaskSlot& slot = slots[i];
+        slot.lastSampleUs = now;
+        slot.finished = false;
+#ifdef ARDUINO
+        BaseType_t core = slot.spec.core < 0 ? tskNO_AFFINITY : slot.spec.core;
+        if (xTaskCreatePinnedToCore(runTask, slot.spec.name, slot.spec.stackSize, &slot,
+                                    slot.spec.priority, &slot.handle, core) != pdPASS) {
+            slot.finished = true;
+            stop();
+            return false;
+        }
+#else
+        // Host threads are left to the OS scheduler; the core is informational
+        slot.thread = std::thread(runTask, &slot);
+#endif
+    }
+    return true;
+}
+
+void TaskTopology::stop() {
+    if (!running) {
+        return;
+    }
+    running = false;
+    for (size_t i = 0; i < taskCount; i++) {
+#ifdef ARDUINO
+        // Tasks notice the flag at the end of their current period and exit
+        while (!slots[i].finished) {
+            vTaskDelay(1);
+        }
+#else
+        if (slots[i].thread.joinable()) {
+            slots[i].thread.join();
+        }
+#endif
+    }
+}
+
+size_t TaskTopology::getTaskCount() const {
+    return taskCount;
+}
+
+bool TaskTopology::sampleStats(size_t index, TaskStats& stats) {
+    if (index >= taskCount) {
+        return false;
+    }
+    TaskSlot& slot = slots[index];
+    uint32_t now = nowUs();
+    uint32_t busy = slot.busyUs.load();
+    uint32_t wall = now - slot.lastSampleUs;
+
+    stats.name = slot.spec.name;
+    stats.core = slot.spec.core;
+    stats.iterations = slot.iterations.load();
+    stats.maxBusyUs = slot.maxBusyUs.exchange(0);
+    stats.utilization = wall > 0 ? (float)(busy - slot.lastBusyUs) / wall : 0.0f;
+
+    slot.lastBusyUs = busy;
+    slot.lastSampleUs = now;
+    return true;
+}
+
+bool TaskTopology::isRunning() const {
+    return running;
+}
+
+void TaskTopology::runTask(void* arg) {
+    TaskSlot* slot = static_cast<TaskSlot*>(arg);
+    uint32_t periodUs = slot->spec.periodMs * 1000;
+    uint32_t next = nowUs();
+
+    while (slot->owner->running) {
+        uint32_t begin = nowUs();
+        slot->spec.body();
+        uint32_t elapsed = nowUs() - begin;
+
+        slot->busyUs += elapsed;
+        slot->iterations++;
+        if (elapsed > slot->maxBusyUs) {
+            slot->maxBusyUs = elapsed;
+        }
+
+        // Fixed-rate schedule; if the body overran, restart from now
+        next += periodUs;
+        if ((int32_t)(nowUs() - next) > 0) {
+            next = nowUs();
+        }
+        sleepUntilUs(next);
+    }
+
+    slot->finished = true;
+#ifdef ARDUINO
+    vTaskDelete(nullptr);
+#endif
+}
+
+uint32_t TaskTopology::nowUs() {
+#ifdef ARDUINO
+    return micros();
+#else
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void TaskTopology::sleepUntilUs(uint32_t deadline) {
+    int32_t remaining = (int32_t)(deadline - nowUs());
+#ifdef ARDUINO
+    // Always yield at least one tick so lower-priority tasks and the idle
+    // task (which feeds the task watchdog) get to run
+    TickType_t ticks = remaining > 0 ? pdMS_TO_TICKS(remaining / 1000) : 0;
+    vTaskDelay(ticks > 0 ? ticks : 1);
+#else
+    if (remaining > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(remaining));
+    } else {
+        std::this_thread::yield();
+    }
+#endif
+}
@@ -0,0 +1,187 @@
+#include "telemetry_hub.h"
+
+TelemetryHub::TelemetryHub(const char* path)
+    : socket(path)
+    , clientsMutex(nullptr)
+    , clientCount(0)
+    , maintenanceState(0)
+    , updateProgress(0.0f)
+    , queueDepth(0)
+    , sensorCount(0)
+    , intervalMs(DEFAULT_INTERVAL_MS)
+    , lastPush(0)
+    , droppedClients(0)
+{
+    memset(clients, 0, sizeof(clients));
+    memset(&snapshot, 0, sizeof(snapshot));
+    for (size_t i = 0; i < TelemetrySnapshot::MAX_SENSORS; i++) {
+        sensorValues[i] = 0.0f;
+    }
+}
+
+void TelemetryHub::begin(AsyncWebServer& server) {
+    clientsMutex = xSemaphoreCreateMutex();
+    socket.onEvent([this](AsyncWebSocket*, AsyncWebSocketClient* client, AwsEventType type, void*, uint8_t*,
+                          size_t) { handleEvent(client, type); });
+    server.addHandler(&socket);
+}
+
+void TelemetryHub::update() {
+    unsigned long now = millis();
+    if (now - lastPush < intervalMs) {
+        return;
+    }
+    lastPush = now;
+    push();
+}
+
+void TelemetryHub::setMaintenanceStatus(int state, float progress) {
+    maintenanceState = state;
+    updateProgress = progress;
+}
+
+void TelemetryHub::setQueueDepth(size_t depth) {
+    queueDepth = (uint16_t)(depth > 0xFFFF ? 0xFFFF : depth);
+}
+
+void TelemetryHub::recordSensorValue(uint8_t channel, float value) {
+    if (channel >= TelemetrySnapshot::MAX_SENSORS) {
+        return;
+    }
+    sensorValues[channel] = value;
+    if (channel >= sensorCount) {
+        sensorCount = (uint8_t)(channel + 1);
+    }
+}
+
+void TelemetryHub::setInterval(uint32_t interval) {
+    intervalMs = interval;
+}
+
+size_t TelemetryHub::getClientCount() const {
+    if (clientsMutex == nullptr) {
+        return 0;
+    }
+    xSemaphoreTake(clientsMutex, portMAX_DELAY);
+    size_t count = clientCount;
+    xSemaphoreGive(clientsMutex);
+    return count;
+}
+
+uint32_t TelemetryHub::getDroppedClients() const {
+    return droppedClients;
+}
+
+size_t TelemetryHub::serialize(const TelemetrySnapshot& s, char* out, size_t size) {
+    int length = snprintf(out, size,
+                          "{\"uptime\":%lu,\"heap\":%lu,\"minHeap\":%lu,\"state\":%d,"
+                          "\"progress\":%.1f,\"queue\":%u,\"sensors\":[",
+                          (unsigned long)s.uptimeMs, (unsigned long)s.freeHeap,
+                          (unsigned long)s.minFreeHeap, s.maintenanceState,
+                          s.updateProgress, (unsigned)s.queueDepth);
+    for (uint8_t i = 0; i < s.sensorCount && length > 0 && (size_t)length < size; i++) {
+        length += snprintf(out + length, size - length, i == 0 ? "%.3f" : ",%.3f", s.sensorValues[i]);
+    }
+    if (length > 0 && (size_t)length < size) {
+        length += snprintf(out + length, size - length, "]}");
+    }
+    if (length <= 0 || (size_t)length >= size) {
+        return 0;
+    }
+    return length;
+}
+
+void TelemetryHub::handleEvent(AsyncWebSocketClient* client, AwsEventType type) {
+    // Runs on the async_tcp task, which adds and frees the clients
+    if (type == WS_EVT_CONNECT) {
+        // Closes the oldest clients beyond the limit; they leave the set
+        // on their disconnect event
+        socket.cleanupClients(MAX_CLIENTS);
+        xSemaphoreTake(clientsMutex, portMAX_DELAY);
+        bool added = clientCount < MAX_CLIENTS + 1;
+        if (added) {
+            clients[clientCount++] = client;
+        }
+        xSemaphoreGive(clientsMutex);
+        if (!added) {
+            client->close(1013, "Too many clients");
+        }
+    } else if (type == WS_EVT_DISCONNECT) {
+        // Blocks the free until a push holding the lock is done with it
+        xSemaphoreTake(clientsMutex, portMAX_DELAY);
+        for (size_t i = 0; i < clientCount; i++) {
+            if (clients[i] == client) {
+                clients[i] = clients[--clientCount];
+                break;
+            }
+        }
+        xSemaphoreGive(clientsMutex);
+    }
+}
+
+void TelemetryHub::push() {
+    snapshot.uptimeMs = millis();
+    snapshot.freeHeap = ESP.getFreeHeap();
+    snapshot.minFreeHeap = ESP.getMinFreeHeap();
+    snapshot.maintenanceState = maintenanceState;
+    snapshot.updateProgress = updateProgress;
+    snapshot.queueDepth = queueDepth;
+    snapshot.sensorCount = sensorCount;
+    for (uint8_t i = 0; i < snapshot.sensorCount; i++) {
+        snapshot.sensorValues[i] = sensorValues[i];
+    }
+
+    size_t length = serialize(snapshot, buffer, sizeof(buffer));
+    if (length == 0) {
+        return;
+    }
+
+    releaseSentBuffers();
+    xSemaphoreTake(clientsMutex, portMAX_DELAY);
+    if (clientCount > 0) {
+        dropSlowClients();
+
+        // One reference-counted buffer is shared by every subscriber. Not
+        // textAll(): that walks the socket's own list, which async_tcp
+        // changes outside the lock.
+        AsyncWebSocketMessageBuffer* message = new AsyncWebSocketMessageBuffer(length);
+        if (message != nullptr && message->get() != nullptr) {
+            memcpy(message->get(), buffer, length);
+            for (size_t i = 0; i < clientCount; i++) {
+                if (clients[i]->status() == WS_CONNECTED) {
+                    clients[i]->text(message);
+                }
+            }
+            sentBuffers.push_back(message);
+        } else {
+            delete message;
+        }
+    }
+    xSemaphoreGive(clientsMutex);
+}
+
+void TelemetryHub::releaseSentBuffers() {
+    // Each queued frame holds a reference until async_tcp has sent it
+    size_t kept = 0;
+    for (AsyncWebSocketMessageBuffer* message : sentBuffers) {
+        if (message->canDelete()) {
+            delete message;
+        } else {
+            sentBuffers[kept++] = message;
+        }
+    }
+    sentBuffers.resize(kept);
+}
+
+void TelemetryHub::dropSlowClients() {
+    // A client whose send queue is still full from earlier ticks would only
+    // make us buffer more frames for it; disconnect it instead. Called with
+    // the lock held, so none of these is freed meanwhile.
+    for (size_t i = 0; i < clientCount; i++) {
+        AsyncWebSocketClient* client = clients[i];
+        if (client->status() == WS_CONNECTED && client->queueIsFull()) {
+            client->close(1008, "Too slow");
+            droppedClients++;
+        }
+    }
+}
@@ -0,0 +1,341 @@
+#include "time_service.h"
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_timer.h>
+#else
+#include <chrono>
+#endif
+
+static uint64_t defaultClock() {
+#ifdef ARDUINO
+    return (uint64_t)esp_timer_get_time();
+#else
+    using namespace std::chrono;
+    return (uint64_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Seconds from the NTP epoch (1900) to the Unix epoch
+static const uint64_t NTP_UNIX_OFFSET_S = 2208988800ULL;
+
+#ifdef ARDUINO
+bool UdpSntpTransport::begin(const char* server, uint16_t port) {
+    if (WiFi.hostByName(server, serverAddress) != 1) {
+        return false;
+    }
+    serverPort = port;
+    if (!started) {
+        started = udp.begin(LOCAL_PORT) == 1;
+    }
+    return started;
+}
+
+bool UdpSntpTransport::send(const uint8_t* data, size_t length) {
+    if (!started || !udp.beginPacket(serverAddress, serverPort)) {
+        return false;
+    }
+    udp.write(data, length);
+    return udp.endPacket() == 1;
+}
+
+int UdpSntpTransport::receive(uint8_t* data, size_t capacity) {
+    if (!started) {
+        return 0;
+    }
+    int size = udp.parsePacket();
+    if (size <= 0) {
+        return 0;
+    }
+    if (udp.remoteIP() != serverAddress || udp.remotePort() != serverPort) {
+        udp.flush();
+        return 0;
+    }
+    return udp.read(data, capacity);
+}
+#endif
+
+// TimeService
+TimeService::TimeService()
+    : clock(defaultClock)
+    , stepThresholdMs(DEFAULT_STEP_THRESHOLD_MS)
+    , maxSlewPpm(DEFAULT_MAX_SLEW_PPM)
+{
+    reset();
+}
+
+void TimeService::setClock(uint64_t (*clock)()) {
+    this->clock = clock;
+}
+
+void TimeService::setStepThreshold(uint32_t ms) {
+    stepThresholdMs = ms;
+}
+
+void TimeService::setMaxSlew(uint32_t ppm) {
+    maxSlewPpm = ppm;
+}
+
+void TimeService::reset() {
+    synced = false;
+    anchorUs = 0;
+    anchorOffsetUs = 0;
+    slewUs = 0;
+    lastSyncUs = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+int64_t TimeService::slewApplied(uint64_t monoUs) const {
+    if (monoUs <= anchorUs || slewUs == 0) {
+        return 0;
+    }
+    int64_t limit = (int64_t)((monoUs - anchorUs) * maxSlewPpm / 1000000);
+    if (slewUs > 0) {
+        return slewUs < limit ? slewUs : limit;
+    }
+    return -slewUs < limit ? slewUs : -limit;
+}
+
+int64_t TimeService::offsetAt(uint64_t monoUs) const {
+    int64_t elapsed = (int64_t)(monoUs - anchorUs);
+    return anchorOffsetUs + slewApplied(monoUs) + elapsed * stats.driftPpb / 1000000000;
+}
+
+void TimeService::reanchor(uint64_t monoUs) {
+    // Keeps the offset continuous: only what is still to be slewed moves
+    int64_t offset = offsetAt(monoUs);
+    slewUs -= slewApplied(monoUs);
+    anchorOffsetUs = offset;
+    anchorUs = monoUs;
+}
+
+void TimeService::discipline(uint64_t unixUs, uint64_t monoUs) {
+    int64_t measured = (int64_t)(unixUs - monoUs);
+    stats.syncs++;
+
+    if (!synced) {
+        synced = true;
+        stats.steps++;
+        stats.lastErrorUs = 0;
+        anchorUs = monoUs;
+        anchorOffsetUs = measured;
+        slewUs = 0;
+        lastSyncUs = monoUs;
+        return;
+    }
+
+    // What the clock would read once the pending slew has run out
+    int64_t predicted = offsetAt(monoUs) + (slewUs - slewApplied(monoUs));
+    int64_t error = measured - predicted;
+    stats.lastErrorUs = measured - offsetAt(monoUs);
+
+    if (error > (int64_t)stepThresholdMs * 1000 || error < -(int64_t)stepThresholdMs * 1000) {
+        stats.steps++;
+        anchorUs = monoUs;
+        anchorOffsetUs = measured;
+        slewUs = 0;
+        lastSyncUs = monoUs;
+        return;
+    }
+
+    // Whatever the previous correction did not account for is frequency error
+    int64_t drift = stats.driftPpb;
+    if (monoUs - lastSyncUs >= (uint64_t)MIN_DRIFT_INTERVAL_MS * 1000) {
+        drift += error * 1000000000 / (int64_t)(monoUs - lastSyncUs) / 4;
+        if (drift > MAX_DRIFT_PPB) {
+            drift = MAX_DRIFT_PPB;
+        } else if (drift < -MAX_DRIFT_PPB) {
+            drift = -MAX_DRIFT_PPB;
+        }
+    }
+    uint64_t now = clock();
+    reanchor(now > monoUs ? now : monoUs);
+    stats.driftPpb = (int32_t)drift;
+    slewUs = measured - anchorOffsetUs;
+    lastSyncUs = monoUs;
+}
+
+uint64_t TimeService::monotonicUs() const {
+    return clock();
+}
+
+uint64_t TimeService::nowUnixUs() const {
+    return toUnixUs(clock());
+}
+
+uint64_t TimeService::toUnixUs(uint64_t monoUs) const {
+    if (!synced) {
+        return 0;
+    }
+    return monoUs + offsetAt(monoUs);
+}
+
+uint64_t TimeService::toUnixMs(uint32_t monoMs) const {
+    uint64_t nowMs = clock() / 1000;
+    uint32_t age = (uint32_t)nowMs - monoMs;
+    uint64_t sampleMs = age <= nowMs ? nowMs - age : 0;
+    return toUnixUs(sampleMs * 1000) / 1000;
+}
+
+TimeBase TimeService::timeBase() const {
+    uint64_t nowMs = clock() / 1000;
+    TimeBase base;
+    base.monotonicMs = (uint32_t)nowMs;
+    base.unixMs = toUnixUs(nowMs * 1000) / 1000;
+    base.synced = synced;
+    return base;
+}
+
+bool TimeService::isSynced() const {
+    return synced;
+}
+
+const TimeServiceStats& TimeService::getStats() const {
+    return stats;
+}
+
+// SntpClient
+static void putBigEndian64(uint8_t* out, uint64_t value) {
+    for (int i = 7; i >= 0; i--) {
+        out[i] = (uint8_t)value;
+        value >>= 8;
+    }
+}
+
+static uint64_t getBigEndian64(const uint8_t* in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+static uint64_t ntpToUnixUs(uint64_t timestamp) {
+    uint64_t seconds = timestamp >> 32;
+    uint64_t fraction = timestamp & 0xFFFFFFFFULL;
+    // Era 1 starts in 2036; a gateway built now never sees a date before 1968
+    if (seconds < 0x80000000ULL) {
+        seconds += 0x100000000ULL;
+    }
+    return (seconds - NTP_UNIX_OFFSET_S) * 1000000 + ((fraction * 1000000) >> 32);
+}
+
+SntpClient::SntpClient(SntpTransport& transport, TimeService& time)
+    : transport(transport)
+    , time(time)
+    , pollIntervalMs(DEFAULT_POLL_INTERVAL_MS)
+    , maxDelayMs(DEFAULT_MAX_DELAY_MS)
+    , retryMs(MIN_RETRY_MS)
+    , nextRequestAt(0)
+    , sentAt(0)
+    , nonce(0)
+    , waiting(false)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+void SntpClient::setPollInterval(uint32_t ms) {
+    pollIntervalMs = ms;
+}
+
+void SntpClient::setMaxDelay(uint32_t ms) {
+    maxDelayMs = ms;
+}
+
+void SntpClient::syncNow() {
+    if (!waiting) {
+        nextRequestAt = time.monotonicUs();
+        retryMs = MIN_RETRY_MS;
+    }
+}
+
+void SntpClient::update() {
+    uint64_t now = time.monotonicUs();
+    if (!waiting) {
+        if (now >= nextRequestAt) {
+            sendRequest(now);
+        }
+        return;
+    }
+
+    uint8_t packet[64];
+    int size;
+    while ((size = transport.receive(packet, sizeof(packet))) > 0) {
+        if (handleResponse(packet, (size_t)size, time.monotonicUs())) {
+            return;
+        }
+    }
+    if (now - sentAt > (uint64_t)RESPONSE_TIMEOUT_MS * 1000) {
+        stats.timeouts++;
+        waiting = false;
+        scheduleRetry(now);
+    }
+}
+
+void SntpClient::sendRequest(uint64_t now) {
+    uint8_t packet[PACKET_SIZE];
+    memset(packet, 0, sizeof(packet));
+    packet[0] = 0x23;  // LI 0, version 4, client
+    // The server echoes the transmit field as its originate stamp, which
+    // pairs the reply with this request and nothing older
+    nonce = (now << 16) ^ (stats.requests + 1);
+    putBigEndian64(packet + 40, nonce);
+    if (!transport.send(packet, sizeof(packet))) {
+        scheduleRetry(now);
+        return;
+    }
+    stats.requests++;
+    sentAt = now;
+    waiting = true;
+}
+
+bool SntpClient::handleResponse(const uint8_t* packet, size_t length, uint64_t receivedAt) {
+    if (length < PACKET_SIZE || (packet[0] & 0x07) != 4 || getBigEndian64(packet + 24) != nonce) {
+        return false;
+    }
+    stats.responses++;
+    waiting = false;
+
+    // Unsynchronised server (LI 3) or kiss-o'-death (stratum 0)
+    uint8_t leap = packet[0] >> 6;
+    uint64_t received = getBigEndian64(packet + 32);
+    uint64_t transmitted = getBigEndian64(packet + 40);
+    if (leap == 3 || packet[1] == 0 || received == 0 || transmitted < received) {
+        stats.rejected++;
+        scheduleRetry(receivedAt);
+        return true;
+    }
+
+    uint64_t serverReceivedUs = ntpToUnixUs(received);
+    uint64_t serverTransmitUs = ntpToUnixUs(transmitted);
+    uint64_t serverHoldUs = serverTransmitUs - serverReceivedUs;
+    uint64_t roundTripUs = receivedAt - sentAt;
+    uint64_t delayUs = roundTripUs > serverHoldUs ? roundTripUs - serverHoldUs : 0;
+    stats.lastDelayUs = (uint32_t)delayUs;
+    // A slow exchange has an asymmetric path as likely as not
+    if (delayUs > (uint64_t)maxDelayMs * 1000) {
+        stats.rejected++;
+        scheduleRetry(receivedAt);
+        return true;
+    }
+
+    time.discipline(serverReceivedUs + serverHoldUs / 2, sentAt + roundTripUs / 2);
+    retryMs = MIN_RETRY_MS;
+    nextRequestAt = receivedAt + (uint64_t)pollIntervalMs * 1000;
+    return true;
+}
+
+void SntpClient::scheduleRetry(uint64_t now) {
+    nextRequestAt = now + (uint64_t)retryMs * 1000;
+    retryMs = retryMs * 2 < pollIntervalMs ? retryMs * 2 : pollIntervalMs;
+}
+
+bool SntpClient::isWaiting() const {
+    return waiting;
+}
+
+const SntpStats& SntpClient::getStats() const {
+    return stats;
+}
@@ -0,0 +1,384 @@
+#include "tls_context.h"
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+static uint32_t defaultClock() {
+#ifdef ARDUINO
+    return millis();
+#else
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static const char* const credentialLabels[] = {"CERTIFICATE", "CERTIFICATE", "PRIVATE KEY"};
+
+static int base64Value(char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+// Decodes the first bytes of a base64 body and reports the decoded size, which
+// is all a DER length check needs
+static bool decodeHeader(const char* body, size_t length, uint8_t* header, size_t headerCapacity, size_t& decoded) {
+    uint32_t bits = 0;
+    int bitCount = 0;
+    size_t padding = 0;
+    decoded = 0;
+    for (size_t i = 0; i < length; i++) {
+        char c = body[i];
+        if (c == '\r' || c == '\n' || c == ' ' || c == '\t') {
+            continue;
+        }
+        if (c == '=') {
+            padding++;
+            continue;
+        }
+        int value = base64Value(c);
+        if (value < 0 || padding > 0) {
+            return false;
+        }
+        bits = (bits << 6) | (uint32_t)value;
+        bitCount += 6;
+        if (bitCount >= 8) {
+            bitCount -= 8;
+            if (decoded < headerCapacity) {
+                header[decoded] = (uint8_t)(bits >> bitCount);
+            }
+            decoded++;
+        }
+    }
+    return padding <= 2;
+}
+
+static bool validDerSequence(const uint8_t* header, size_t available, size_t total) {
+    if (available < 2 || header[0] != 0x30) {
+        return false;
+    }
+    size_t length = header[1];
+    size_t headerLength = 2;
+    if (length & 0x80) {
+        size_t bytes = length & 0x7F;
+        if (bytes == 0 || bytes > 3 || available < 2 + bytes) {
+            return false;
+        }
+        length = 0;
+        for (size_t i = 0; i < bytes; i++) {
+            length = (length << 8) | header[2 + i];
+        }
+        headerLength += bytes;
+    }
+    return headerLength + length == total;
+}
+
+size_t pemCountBlocks(const char* pem, size_t length, const char* label) {
+    static const char begin[] = "-----BEGIN ";
+    static const char end[] = "-----END ";
+    std::string text(pem, length);
+    size_t count = 0;
+    size_t position = 0;
+
+    while ((position = text.find(begin, position)) != std::string::npos) {
+        size_t labelStart = position + sizeof(begin) - 1;
+        size_t labelEnd = text.find("-----", labelStart);
+        if (labelEnd == std::string::npos) {
+            return 0;
+        }
+        std::string blockLabel = text.substr(labelStart, labelEnd - labelStart);
+        size_t bodyStart = labelEnd + 5;
+        size_t footer = text.find(end + blockLabel + "-----", bodyStart);
+        if (footer == std::string::npos) {
+            return 0;
+        }
+        position = footer + sizeof(end) - 1 + blockLabel.size() + 5;
+        if (blockLabel.find(label) == std::string::npos) {
+            continue;
+        }
+
+        uint8_t header[5];
+        size_t decoded;
+        if (!decodeHeader(text.data() + bodyStart, footer - bodyStart, header, sizeof(header), decoded) ||
+            !validDerSequence(header, decoded < sizeof(header) ? decoded : sizeof(header), decoded)) {
+            return 0;
+        }
+        count++;
+    }
+    return count;
+}
+
+static uint32_t fnv1a(const char* data, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// TlsCredentials
+TlsCredentials::TlsCredentials() : parses(0) {
+    for (int i = 0; i < 3; i++) {
+        fingerprint[i] = 0;
+        blocks[i] = 0;
+    }
+}
+
+bool TlsCredentials::load(TlsCredentialKind kind, const char* text, size_t length) {
+    size_t index = (size_t)kind;
+    uint32_t hash = fnv1a(text, length);
+    if (blocks[index] > 0 && hash == fingerprint[index] && pem[index].size() == length &&
+        memcmp(pem[index].data(), text, length) == 0) {
+        return true;
+    }
+
+    parses++;
+    size_t count = pemCountBlocks(text, length, credentialLabels[index]);
+    // A client certificate or key is a single block; a CA bundle may hold several
+    if (count == 0 || (kind != TlsCredentialKind::CA && count != 1)) {
+        return false;
+    }
+    pem[index].assign(text, length);
+    fingerprint[index] = hash;
+    blocks[index] = count;
+    return true;
+}
+
+void TlsCredentials::clear(TlsCredentialKind kind) {
+    size_t index = (size_t)kind;
+    pem[index].clear();
+    fingerprint[index] = 0;
+    blocks[index] = 0;
+}
+
+const char* TlsCredentials::get(TlsCredentialKind kind) const {
+    size_t index = (size_t)kind;
+    return blocks[index] > 0 ? pem[index].c_str() : nullptr;
+}
+
+bool TlsCredentials::hasClientIdentity() const {
+    return blocks[(size_t)TlsCredentialKind::CERTIFICATE] > 0 && blocks[(size_t)TlsCredentialKind::PRIVATE_KEY] > 0;
+}
+
+size_t TlsCredentials::getCaCount() const {
+    return blocks[(size_t)TlsCredentialKind::CA];
+}
+
+uint32_t TlsCredentials::getParseCount() const {
+    return parses;
+}
+
+// TlsContextManager
+TlsContextManager::TlsContextManager() : clock(defaultClock), endpointCount(0) {
+    memset(&totals, 0, sizeof(totals));
+}
+
+void TlsContextManager::setClock(uint32_t (*newClock)()) {
+    clock = newClock;
+}
+
+TlsCredentials& TlsContextManager::credentials() {
+    return store;
+}
+
+const TlsCredentials& TlsContextManager::credentials() const {
+    return store;
+}
+
+bool TlsContextManager::acquire(TlsSocket& socket, const char* host, uint16_t port) {
+    Endpoint* current = findBySocket(socket);
+    if (current && current->port == port && current->host == host && socket.isOpen()) {
+        current->lastUsedAt = clock();
+        current->stats.reused++;
+        totals.reused++;
+        return true;
+    }
+    release(socket);
+
+    Endpoint& endpoint = endpointFor(host, port);
+    uint32_t start = clock();
+    bool success = socket.open(host, port, store);
+    uint32_t now = clock();
+    endpoint.lastUsedAt = now;
+    record(endpoint, now - start, success);
+    if (success) {
+        endpoint.socket = &socket;
+    }
+    return success;
+}
+
+void TlsContextManager::release(TlsSocket& socket) {
+    Endpoint* endpoint = findBySocket(socket);
+    if (endpoint) {
+        endpoint->socket = nullptr;
+    }
+    if (socket.isOpen()) {
+        socket.close();
+    }
+}
+
+void TlsContextManager::recordHandshake(const char* host, uint16_t port, uint32_t durationMs, bool success) {
+    Endpoint& endpoint = endpointFor(host, port);
+    endpoint.lastUsedAt = clock();
+    record(endpoint, durationMs, success);
+}
+
+const TlsHandshakeStats& TlsContextManager::getStats() const {
+    return totals;
+}
+
+const TlsHandshakeStats* TlsContextManager::getEndpointStats(const char* host, uint16_t port) const {
+    for (size_t i = 0; i < endpointCount; i++) {
+        if (endpoints[i].port == port && endpoints[i].host == host) {
+            return &endpoints[i].stats;
+        }
+    }
+    return nullptr;
+}
+
+TlsContextManager::Endpoint* TlsContextManager::findEndpoint(const char* host, uint16_t port) {
+    for (size_t i = 0; i < endpointCount; i++) {
+        if (endpoints[i].port == port && endpoints[i].host == host) {
+            return &endpoints[i];
+        }
+    }
+    return nullptr;
+}
+
+TlsContextManager::Endpoint& TlsContextManager::endpointFor(const char* host, uint16_t port) {
+    Endpoint* existing = findEndpoint(host, port);
+    if (existing) {
+        return *existing;
+    }
+
+    // Table full: reuse the slot idle the longest
+    Endpoint* slot;
+    if (endpointCount < MAX_ENDPOINTS) {
+        slot = &endpoints[endpointCount++];
+    } else {
+        slot = &endpoints[0];
+        uint32_t now = clock();
+        for (size_t i = 1; i < MAX_ENDPOINTS; i++) {
+            if (now - endpoints[i].lastUsedAt > now - slot->lastUsedAt) {
+                slot = &endpoints[i];
+            }
+        }
+    }
+    slot->host = host;
+    slot->port = port;
+    slot->socket = nullptr;
+    slot->lastUsedAt = clock();
+    memset(&slot->stats, 0, sizeof(slot->stats));
+    return *slot;
+}
+
+TlsContextManager::Endpoint* TlsContextManager::findBySocket(const TlsSocket& socket) {
+    for (size_t i = 0; i < endpointCount; i++) {
+        if (endpoints[i].socket == &socket) {
+            return &endpoints[i];
+        }
+    }
+    return nullptr;
+}
+
+void TlsContextManager::record(Endpoint& endpoint, uint32_t durationMs, bool success) {
+    TlsHandshakeStats* targets[] = {&endpoint.stats, &totals};
+    for (TlsHandshakeStats* stats : targets) {
+        if (!success) {
+            stats->failures++;
+            continue;
+        }
+        stats->handshakes++;
+        stats->lastHandshakeMs = durationMs;
+        stats->totalHandshakeMs += durationMs;
+        if (durationMs > stats->maxHandshakeMs) {
+            stats->maxHandshakeMs = durationMs;
+        }
+    }
+}
+
+#ifdef ARDUINO
+// SecureClientSocket
+bool SecureClientSocket::open(const char* host, uint16_t port, const TlsCredentials& credentials) {
+    // The client keeps pointers, so the PEM buffers are shared, not copied
+    const char* ca = credentials.get(TlsCredentialKind::CA);
+    if (ca) {
+        client.setCACert(ca);
+    } else {
+        client.setInsecure();
+    }
+    if (credentials.hasClientIdentity()) {
+        client.setCertificate(credentials.get(TlsCredentialKind::CERTIFICATE));
+        client.setPrivateKey(credentials.get(TlsCredentialKind::PRIVATE_KEY));
+    }
+    return client.connect(host, port) == 1;
+}
+
+void SecureClientSocket::close() {
+    client.stop();
+}
+
+bool SecureClientSocket::isOpen() {
+    return client.connected();
+}
+
+// TlsMqttTransport
+TlsMqttTransport::TlsMqttTransport(WiFiClient& plain, WiFiClientSecure& secure, SecureClientSocket& socket,
+                                   TlsContextManager& tls)
+    : plain(plain), secure(secure), socket(socket), tls(tls), useTls(false) {}
+
+void TlsMqttTransport::setSecure(bool secureLink) {
+    if (secureLink != useTls) {
+        close();
+        useTls = secureLink;
+    }
+}
+
+bool TlsMqttTransport::open(const char* host, uint16_t port) {
+    if (!useTls) {
+        return plain.connect(host, port) == 1;
+    }
+    // A new MQTT session always needs a fresh stream, never a reused one
+    tls.release(socket);
+    return tls.acquire(socket, host, port);
+}
+
+void TlsMqttTransport::close() {
+    if (useTls) {
+        tls.release(socket);
+    } else {
+        plain.stop();
+    }
+}
+
+bool TlsMqttTransport::isOpen() {
+    return active().connected();
+}
+
+int TlsMqttTransport::read(uint8_t* data, size_t length) {
+    Client& client = active();
+    int available = client.available();
+    if (available <= 0) {
+        return 0;
+    }
+    return client.read(data, (size_t)available < length ? available : length);
+}
+
+size_t TlsMqttTransport::write(const uint8_t* data, size_t length) {
+    return active().write(data, length);
+}
+
+Client& TlsMqttTransport::active() {
+    if (useTls) {
+        return secure;
+    }
+    return plain;
+}
+#endif
@@ -0,0 +1,200 @@
+#include "uplink_router.h"
+#include <string.h>
+
+UplinkRouter::UplinkRouter()
+    : cooldownMs(DEFAULT_COOLDOWN_MS)
+{
+    memset(health, 0, sizeof(health));
+}
+
+bool UplinkRouter::setRoute(const std::string& topicPrefix, RoutePolicy policy,
+                            const UplinkChoice* uplinks, size_t count) {
+    if (count == 0 || count > MAX_UPLINKS) {
+        return false;
+    }
+    Route route;
+    route.prefix = topicPrefix;
+    route.policy = policy;
+    route.count = count;
+    for (size_t i = 0; i < count; i++) {
+        if (static_cast<size_t>(uplinks[i].protocol) >= PROTOCOL_COUNT) {
+            return false;
+        }
+        route.uplinks[i] = uplinks[i];
+        if (route.uplinks[i].weight == 0) {
+            route.uplinks[i].weight = 1;
+        }
+        route.current[i] = 0;
+    }
+
+    for (auto& existing : routes) {
+        if (existing.prefix == topicPrefix) {
+            existing = route;
+            return true;
+        }
+    }
+    routes.push_back(route);
+    return true;
+}
+
+bool UplinkRouter::removeRoute(const std::string& topicPrefix) {
+    for (auto it = routes.begin(); it != routes.end(); ++it) {
+        if (it->prefix == topicPrefix) {
+            routes.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+void UplinkRouter::setCooldown(uint32_t ms) {
+    cooldownMs = ms;
+}
+
+void UplinkRouter::updateLink(ProtocolType protocol, bool connected, bool errorActive, uint32_t now) {
+    UplinkHealth& link = health[static_cast<size_t>(protocol)];
+    if (errorActive && !link.errorActive) {
+        link.lastFailureAt = now;
+    }
+    link.connected = connected;
+    link.errorActive = errorActive;
+}
+
+void UplinkRouter::recordResult(ProtocolType protocol, bool success, uint32_t latencyMs, uint32_t now) {
+    UplinkHealth& link = health[static_cast<size_t>(protocol)];
+    if (success) {
+        link.sent++;
+        link.consecutiveFailures = 0;
+        // EWMA with alpha 1/4; the first sample seeds it
+        link.latencyMs = link.sent == 1 ? latencyMs : (link.latencyMs * 3 + latencyMs) / 4;
+    } else {
+        link.failed++;
+        link.consecutiveFailures++;
+        link.lastFailureAt = now;
+    }
+}
+
+size_t UplinkRouter::route(const char* topic, ProtocolType protocol, uint32_t now, ProtocolType* targets) {
+    Route* route = findRoute(topic);
+    if (route == nullptr) {
+        targets[0] = protocol;
+        return 1;
+    }
+
+    switch (route->policy) {
+        case RoutePolicy::MIRROR: {
+            size_t count = 0;
+            for (size_t i = 0; i < route->count; i++) {
+                if (rank(route->uplinks[i].protocol, now) == 2) {
+                    targets[count++] = route->uplinks[i].protocol;
+                }
+            }
+            if (count > 0) {
+                return count;
+            }
+            break;
+        }
+
+        case RoutePolicy::WEIGHTED:
+            targets[0] = pickWeighted(*route, now);
+            return 1;
+
+        default:
+            break;
+    }
+    targets[0] = pickFailover(*route, now);
+    return 1;
+}
+
+bool UplinkRouter::isHealthy(ProtocolType protocol, uint32_t now) const {
+    return rank(protocol, now) == 2;
+}
+
+const UplinkHealth& UplinkRouter::getHealth(ProtocolType protocol) const {
+    return health[static_cast<size_t>(protocol)];
+}
+
+size_t UplinkRouter::getRouteCount() const {
+    return routes.size();
+}
+
+// Private methods
+UplinkRouter::Route* UplinkRouter::findRoute(const char* topic) {
+    Route* best = nullptr;
+    for (auto& route : routes) {
+        if (strncmp(topic, route.prefix.c_str(), route.prefix.size()) == 0 &&
+            (best == nullptr || route.prefix.size() > best->prefix.size())) {
+            best = &route;
+        }
+    }
+    return best;
+}
+
+// 2: healthy, 1: connected but failed within the cooldown, 0: down
+int UplinkRouter::rank(ProtocolType protocol, uint32_t now) const {
+    const UplinkHealth& link = health[static_cast<size_t>(protocol)];
+    if (!link.connected) {
+        return 0;
+    }
+    bool failing = link.errorActive || link.consecutiveFailures > 0;
+    if (failing && now - link.lastFailureAt < cooldownMs) {
+        return 1;
+    }
+    return 2;
+}
+
+ProtocolType UplinkRouter::pickFailover(const Route& route, uint32_t now) const {
+    // Best rank wins, ties go to the earlier (higher priority) uplink. With
+    // everything down the primary is returned so the message is queued.
+    size_t best = 0;
+    int bestRank = -1;
+    for (size_t i = 0; i < route.count; i++) {
+        int linkRank = rank(route.uplinks[i].protocol, now);
+        if (linkRank > bestRank) {
+            best = i;
+            bestRank = linkRank;
+        }
+    }
+    return route.uplinks[best].protocol;
+}
+
+ProtocolType UplinkRouter::pickWeighted(Route& route, uint32_t now) {
+    uint32_t bestLatency = UINT32_MAX;
+    bool anyHealthy = false;
+    for (size_t i = 0; i < route.count; i++) {
+        if (rank(route.uplinks[i].protocol, now) == 2) {
+            uint32_t latency = health[static_cast<size_t>(route.uplinks[i].protocol)].latencyMs;
+            bestLatency = latency < bestLatency ? latency : bestLatency;
+            anyHealthy = true;
+        }
+    }
+    if (!anyHealthy) {
+        return pickFailover(route, now);
+    }
+    if (bestLatency == 0) {
+        bestLatency = 1;
+    }
+
+    // Smooth weighted round-robin; a link twice as slow as the fastest gets
+    // half its configured share
+    int32_t total = 0;
+    size_t chosen = route.count;
+    for (size_t i = 0; i < route.count; i++) {
+        if (rank(route.uplinks[i].protocol, now) != 2) {
+            route.current[i] = 0;
+            continue;
+        }
+        uint32_t latency = health[static_cast<size_t>(route.uplinks[i].protocol)].latencyMs;
+        int32_t weight = (int32_t)((uint32_t)route.uplinks[i].weight * 16 * bestLatency / (latency > bestLatency ? latency : bestLatency));
+        if (weight < 1) {
+            weight = 1;
+        }
+        route.current[i] += weight;
+        total += weight;
+        if (chosen == route.count || route.current[i] > route.current[chosen]) {
+            chosen = i;
+        }
+    }
+    route.current[chosen] -= total;
+    return route.uplinks[chosen].protocol;
+}
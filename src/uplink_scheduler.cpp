@@ -0,0 +1,251 @@
+#include "uplink_scheduler.h"
+#include <string.h>
+
+static const uint32_t MICRO_TOKENS = 1000000;
+
+// TokenBucket
+TokenBucket::TokenBucket()
+    : ratePerMs(0)
+    , capacity(0)
+    , tokens(0)
+    , lastRefill(0)
+    , started(false)
+{
+}
+
+void TokenBucket::configure(float ratePerSecond, uint16_t burst) {
+    // One token per second is 1000 micro-tokens per millisecond
+    ratePerMs = ratePerSecond > 0 ? (uint32_t)(ratePerSecond * 1000.0f + 0.5f) : 0;
+    if (ratePerMs == 0 && ratePerSecond > 0) {
+        ratePerMs = 1;
+    }
+    capacity = (uint32_t)(burst > 0 ? burst : 1) * MICRO_TOKENS;
+    tokens = capacity;
+    started = false;
+}
+
+bool TokenBucket::isLimited() const {
+    return ratePerMs > 0;
+}
+
+bool TokenBucket::available(uint32_t now) {
+    if (!isLimited()) {
+        return true;
+    }
+    refill(now);
+    return tokens >= MICRO_TOKENS;
+}
+
+bool TokenBucket::consume(uint32_t now) {
+    if (!available(now)) {
+        return false;
+    }
+    if (isLimited()) {
+        tokens -= MICRO_TOKENS;
+    }
+    return true;
+}
+
+void TokenBucket::refund() {
+    if (isLimited()) {
+        tokens = tokens + MICRO_TOKENS > capacity ? capacity : tokens + MICRO_TOKENS;
+    }
+}
+
+void TokenBucket::refill(uint32_t now) {
+    if (!started) {
+        started = true;
+        lastRefill = now;
+        return;
+    }
+    uint32_t elapsed = now - lastRefill;
+    if (elapsed == 0) {
+        return;
+    }
+    lastRefill = now;
+    uint64_t refilled = (uint64_t)tokens + (uint64_t)elapsed * ratePerMs;
+    tokens = refilled > capacity ? capacity : (uint32_t)refilled;
+}
+
+// UplinkScheduler
+UplinkScheduler::UplinkScheduler(size_t capacity)
+    : capacity(capacity)
+    , count(0)
+    , mode(SchedulingMode::STRICT)
+{
+    // Default weights for WEIGHTED mode: 8:4:2:1
+    for (size_t i = 0; i < PRIORITY_COUNT; i++) {
+        weights[i] = (uint8_t)(8 >> i);
+        current[i] = 0;
+        queues[i].reserve(capacity);
+    }
+    memset(stats, 0, sizeof(stats));
+}
+
+void UplinkScheduler::setMode(SchedulingMode mode) {
+    this->mode = mode;
+}
+
+void UplinkScheduler::setWeight(MessagePriority priority, uint8_t weight) {
+    weights[static_cast<size_t>(priority)] = weight > 0 ? weight : 1;
+}
+
+int UplinkScheduler::setTopicLimit(const std::string& topicPrefix, float ratePerSecond, uint16_t burst) {
+    for (size_t i = 0; i < topicClasses.size(); i++) {
+        if (topicClasses[i].prefix == topicPrefix) {
+            topicClasses[i].bucket.configure(ratePerSecond, burst);
+            return (int)i;
+        }
+    }
+    if (topicClasses.size() >= MAX_TOPIC_CLASSES) {
+        return -1;
+    }
+    TopicClass topicClass;
+    topicClass.prefix = topicPrefix;
+    topicClass.bucket.configure(ratePerSecond, burst);
+    topicClasses.push_back(topicClass);
+    return (int)topicClasses.size() - 1;
+}
+
+int UplinkScheduler::classify(const char* topic) const {
+    // Longest matching prefix, as for routes and payload formats
+    int best = -1;
+    size_t bestLength = 0;
+    for (size_t i = 0; i < topicClasses.size(); i++) {
+        const std::string& prefix = topicClasses[i].prefix;
+        if (strncmp(topic, prefix.c_str(), prefix.size()) == 0 && (best < 0 || prefix.size() > bestLength)) {
+            best = (int)i;
+            bestLength = prefix.size();
+        }
+    }
+    return best;
+}
+
+bool UplinkScheduler::enqueue(const QueuedEntry& entry) {
+    PriorityStats& classStats = stats[static_cast<size_t>(entry.priority)];
+    if (count >= capacity) {
+        classStats.dropped++;
+        return false;
+    }
+    queues[static_cast<size_t>(entry.priority)].push_back(entry);
+    count++;
+    classStats.enqueued++;
+    return true;
+}
+
+bool UplinkScheduler::evictBelow(MessagePriority priority, uint16_t& handle) {
+    for (size_t p = PRIORITY_COUNT; p-- > static_cast<size_t>(priority) + 1;) {
+        if (!queues[p].empty()) {
+            // The newest entry is the least useful one to keep
+            handle = queues[p].back().handle;
+            queues[p].pop_back();
+            count--;
+            stats[p].dropped++;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool UplinkScheduler::pop(uint32_t now, QueuedEntry& entry) {
+    int eligible[PRIORITY_COUNT];
+    size_t chosen = PRIORITY_COUNT;
+
+    if (mode == SchedulingMode::STRICT) {
+        for (size_t p = 0; p < PRIORITY_COUNT && chosen == PRIORITY_COUNT; p++) {
+            eligible[p] = findEligible(p, now);
+            if (eligible[p] >= 0) {
+                chosen = p;
+            }
+        }
+    } else {
+        int32_t total = 0;
+        for (size_t p = 0; p < PRIORITY_COUNT; p++) {
+            eligible[p] = findEligible(p, now);
+            if (eligible[p] < 0) {
+                continue;
+            }
+            current[p] += weights[p];
+            total += weights[p];
+            if (chosen == PRIORITY_COUNT || current[p] > current[chosen]) {
+                chosen = p;
+            }
+        }
+        if (chosen != PRIORITY_COUNT) {
+            current[chosen] -= total;
+        }
+    }
+    if (chosen == PRIORITY_COUNT) {
+        return false;
+    }
+
+    std::vector<QueuedEntry>& queue = queues[chosen];
+    entry = queue[(size_t)eligible[chosen]];
+    queue.erase(queue.begin() + eligible[chosen]);
+    count--;
+    TokenBucket* bucket = topicBucket(entry.topicClass);
+    if (bucket) {
+        bucket->consume(now);
+    }
+    return true;
+}
+
+void UplinkScheduler::restore(const QueuedEntry& entry) {
+    std::vector<QueuedEntry>& queue = queues[static_cast<size_t>(entry.priority)];
+    queue.insert(queue.begin(), entry);
+    count++;
+    TokenBucket* bucket = topicBucket(entry.topicClass);
+    if (bucket) {
+        bucket->refund();
+    }
+}
+
+void UplinkScheduler::delivered(const QueuedEntry& entry, uint32_t now) {
+    PriorityStats& classStats = stats[static_cast<size_t>(entry.priority)];
+    uint32_t delay = now - entry.enqueuedAt;
+    classStats.delivered++;
+    classStats.totalDelayMs += delay;
+    if (delay > classStats.maxDelayMs) {
+        classStats.maxDelayMs = delay;
+    }
+}
+
+size_t UplinkScheduler::size() const {
+    return count;
+}
+
+size_t UplinkScheduler::size(MessagePriority priority) const {
+    return queues[static_cast<size_t>(priority)].size();
+}
+
+const PriorityStats& UplinkScheduler::getStats(MessagePriority priority) const {
+    return stats[static_cast<size_t>(priority)];
+}
+
+uint32_t UplinkScheduler::getMeanDelayMs(MessagePriority priority) const {
+    const PriorityStats& classStats = stats[static_cast<size_t>(priority)];
+    return classStats.delivered ? (uint32_t)(classStats.totalDelayMs / classStats.delivered) : 0;
+}
+
+int UplinkScheduler::findEligible(size_t priority, uint32_t now) {
+    const std::vector<QueuedEntry>& queue = queues[priority];
+    if (queue.empty()) {
+        return -1;
+    }
+    // Entries behind a rate-limited one may still go if they use another bucket
+    for (size_t i = 0; i < queue.size(); i++) {
+        TokenBucket* bucket = topicBucket(queue[i].topicClass);
+        if (!bucket || bucket->available(now)) {
+            return (int)i;
+        }
+    }
+    stats[priority].throttled++;
+    return -1;
+}
+
+TokenBucket* UplinkScheduler::topicBucket(int8_t topicClass) {
+    if (topicClass < 0 || (size_t)topicClass >= topicClasses.size()) {
+        return nullptr;
+    }
+    return &topicClasses[(size_t)topicClass].bucket;
+}
@@ -0,0 +1,430 @@
+#include "wifi_manager.h"
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <WiFi.h>
+#include <SPIFFS.h>
+#else
+#include <chrono>
+#endif
+
+static uint32_t defaultClock() {
+#ifdef ARDUINO
+    return millis();
+#else
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+#ifdef ARDUINO
+static const char* const FAST_PATH_FILE = "/wifi_fastpath.bin";
+static const uint32_t FAST_PATH_MAGIC = 0x57465031; // "WFP1"
+
+void EspWifiHal::begin(const char* ssid, const char* password, const uint8_t* bssid, int32_t channel,
+                       const WifiIpConfig* staticIp) {
+    // The manager owns reconnects; the driver must not race it
+    WiFi.persistent(false);
+    WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(false);
+    if (staticIp) {
+        WiFi.config(IPAddress(staticIp->ip), IPAddress(staticIp->gateway), IPAddress(staticIp->subnet),
+                    IPAddress(staticIp->dns));
+    } else {
+        WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+    }
+    WiFi.begin(ssid, password, channel, bssid);
+}
+
+void EspWifiHal::disconnect() {
+    WiFi.disconnect(false);
+}
+
+WifiLinkStatus EspWifiHal::status() {
+    switch (WiFi.status()) {
+        case WL_CONNECTED:
+            return WifiLinkStatus::CONNECTED;
+        case WL_CONNECT_FAILED:
+        case WL_NO_SSID_AVAIL:
+        case WL_CONNECTION_LOST:
+            return WifiLinkStatus::FAILED;
+        case WL_IDLE_STATUS:
+        case WL_DISCONNECTED:
+            return WifiLinkStatus::CONNECTING;
+        default:
+            return WifiLinkStatus::IDLE;
+    }
+}
+
+bool EspWifiHal::startScan() {
+    // Asynchronous, active, 120 ms per channel
+    return WiFi.scanNetworks(true, false, false, 120) != WIFI_SCAN_FAILED;
+}
+
+int EspWifiHal::scanResults(WifiScanResult* results, size_t capacity) {
+    int16_t found = WiFi.scanComplete();
+    if (found == WIFI_SCAN_RUNNING) {
+        return -1;
+    }
+    if (found < 0) {
+        return 0;
+    }
+    size_t count = (size_t)found < capacity ? found : capacity;
+    for (size_t i = 0; i < count; i++) {
+        strncpy(results[i].ssid, WiFi.SSID(i).c_str(), sizeof(results[i].ssid) - 1);
+        results[i].ssid[sizeof(results[i].ssid) - 1] = '\0';
+        memcpy(results[i].bssid, WiFi.BSSID(i), 6);
+        results[i].channel = WiFi.channel(i);
+        results[i].rssi = WiFi.RSSI(i);
+    }
+    WiFi.scanDelete();
+    return count;
+}
+
+int32_t EspWifiHal::rssi() {
+    return WiFi.RSSI();
+}
+
+bool EspWifiHal::linkInfo(uint8_t bssid[6], int32_t& channel, WifiIpConfig& ip) {
+    const uint8_t* current = WiFi.BSSID();
+    if (!current) {
+        return false;
+    }
+    memcpy(bssid, current, 6);
+    channel = WiFi.channel();
+    ip.ip = (uint32_t)WiFi.localIP();
+    ip.gateway = (uint32_t)WiFi.gatewayIP();
+    ip.subnet = (uint32_t)WiFi.subnetMask();
+    ip.dns = (uint32_t)WiFi.dnsIP();
+    return true;
+}
+
+bool EspWifiHal::loadFastPath(WifiFastPath& path) {
+    File file = SPIFFS.open(FAST_PATH_FILE, "r");
+    if (!file) {
+        return false;
+    }
+    uint32_t magic = 0;
+    bool ok = file.read((uint8_t*)&magic, sizeof(magic)) == sizeof(magic) && magic == FAST_PATH_MAGIC &&
+              file.read((uint8_t*)&path, sizeof(path)) == sizeof(path);
+    file.close();
+    return ok && path.valid;
+}
+
+bool EspWifiHal::saveFastPath(const WifiFastPath& path) {
+    File file = SPIFFS.open(FAST_PATH_FILE, "w");
+    if (!file) {
+        return false;
+    }
+    bool ok = file.write((const uint8_t*)&FAST_PATH_MAGIC, sizeof(FAST_PATH_MAGIC)) == sizeof(FAST_PATH_MAGIC) &&
+              file.write((const uint8_t*)&path, sizeof(path)) == sizeof(path);
+    file.close();
+    return ok;
+}
+#endif
+
+WifiManager::WifiManager(WifiHal& hal)
+    : hal(hal)
+    , clock(defaultClock)
+    , state(WifiManagerState::IDLE)
+    , staticIpFastPath(true)
+    , roamThreshold(DEFAULT_ROAM_THRESHOLD_DBM)
+    , linkUp(false)
+    , attemptStartedAt(0)
+    , outageStartedAt(0)
+    , retryAt(0)
+    , retryDelayMs(MIN_RETRY_MS)
+    , lastRssiSampleAt(0)
+    , lastRoamScanAt(0)
+    , smoothedRssi(0)
+    , listenerCount(0)
+{
+    memset(&fastPath, 0, sizeof(fastPath));
+    memset(currentBssid, 0, sizeof(currentBssid));
+    memset(&stats, 0, sizeof(stats));
+}
+
+void WifiManager::setClock(uint32_t (*newClock)()) {
+    clock = newClock;
+}
+
+void WifiManager::setRoamThreshold(int32_t dbm) {
+    roamThreshold = dbm;
+}
+
+void WifiManager::setStaticIpFastPath(bool enable) {
+    staticIpFastPath = enable;
+}
+
+bool WifiManager::addListener(std::function<void(WifiEvent)> listener) {
+    if (listenerCount >= MAX_LISTENERS) {
+        return false;
+    }
+    listeners[listenerCount++] = listener;
+    return true;
+}
+
+bool WifiManager::begin(const char* newSsid, const char* newPassword) {
+    if (!newSsid || newSsid[0] == '\0') {
+        return false;
+    }
+    ssid = newSsid;
+    password = newPassword ? newPassword : "";
+    retryDelayMs = MIN_RETRY_MS;
+
+    uint32_t now = clock();
+    outageStartedAt = now;
+    if (!hal.loadFastPath(fastPath)) {
+        fastPath.valid = false;
+    }
+    if (fastPath.valid) {
+        startFastConnect(now);
+    } else {
+        startScan(now);
+    }
+    return true;
+}
+
+void WifiManager::stop() {
+    hal.disconnect();
+    state = WifiManagerState::IDLE;
+    if (linkUp) {
+        linkUp = false;
+        emit(WifiEvent::LINK_DOWN);
+    }
+}
+
+void WifiManager::update() {
+    uint32_t now = clock();
+    switch (state) {
+        case WifiManagerState::FAST_CONNECT:
+        case WifiManagerState::CONNECTING:
+        case WifiManagerState::ROAMING:
+            updateAttempt(now);
+            break;
+        case WifiManagerState::SCANNING:
+            updateScan(now);
+            break;
+        case WifiManagerState::CONNECTED:
+        case WifiManagerState::ROAM_SCANNING:
+            updateConnected(now);
+            break;
+        case WifiManagerState::WAITING:
+            if ((int32_t)(now - retryAt) >= 0) {
+                outageStartedAt = now;
+                if (fastPath.valid) {
+                    startFastConnect(now);
+                } else {
+                    startScan(now);
+                }
+            }
+            break;
+        case WifiManagerState::IDLE:
+            break;
+    }
+}
+
+WifiManagerState WifiManager::getState() const {
+    return state;
+}
+
+bool WifiManager::isConnected() const {
+    return linkUp;
+}
+
+int32_t WifiManager::getRssi() const {
+    return smoothedRssi / RSSI_SCALE;
+}
+
+const WifiStats& WifiManager::getStats() const {
+    return stats;
+}
+
+// Private methods
+void WifiManager::startFastConnect(uint32_t now) {
+    state = WifiManagerState::FAST_CONNECT;
+    attemptStartedAt = now;
+    bool useStaticIp = staticIpFastPath && fastPath.ip.ip != 0;
+    hal.begin(ssid.c_str(), password.c_str(), fastPath.bssid, fastPath.channel, useStaticIp ? &fastPath.ip : nullptr);
+}
+
+void WifiManager::startScan(uint32_t now) {
+    attemptStartedAt = now;
+    if (!hal.startScan()) {
+        // Let the driver search every channel itself
+        startConnect(nullptr, 0, now);
+        return;
+    }
+    state = WifiManagerState::SCANNING;
+}
+
+void WifiManager::startConnect(const uint8_t* bssid, int32_t channel, uint32_t now) {
+    state = WifiManagerState::CONNECTING;
+    attemptStartedAt = now;
+    hal.begin(ssid.c_str(), password.c_str(), bssid, channel, nullptr);
+}
+
+void WifiManager::updateAttempt(uint32_t now) {
+    WifiLinkStatus status = hal.status();
+    if (status == WifiLinkStatus::CONNECTED) {
+        onConnected(now);
+        return;
+    }
+    uint32_t timeout = state == WifiManagerState::CONNECTING ? CONNECT_TIMEOUT_MS : FAST_CONNECT_TIMEOUT_MS;
+    if (status != WifiLinkStatus::FAILED && now - attemptStartedAt < timeout) {
+        return;
+    }
+
+    hal.disconnect();
+    if (state == WifiManagerState::FAST_CONNECT) {
+        // The AP moved or went away; forget it and look again
+        stats.fastPathMisses++;
+        fastPath.valid = false;
+        hal.saveFastPath(fastPath);
+        startScan(now);
+    } else if (state == WifiManagerState::ROAMING) {
+        // The better AP would not take us; recover like any link loss
+        linkUp = false;
+        stats.linkDowns++;
+        emit(WifiEvent::LINK_DOWN);
+        outageStartedAt = attemptStartedAt;
+        startScan(now);
+    } else {
+        stats.failures++;
+        scheduleRetry(now);
+    }
+}
+
+void WifiManager::updateScan(uint32_t now) {
+    int count = hal.scanResults(scan, MAX_SCAN_RESULTS);
+    if (count < 0) {
+        if (now - attemptStartedAt >= SCAN_TIMEOUT_MS) {
+            startConnect(nullptr, 0, now);
+        }
+        return;
+    }
+    // Nothing visible may still be a hidden SSID; the driver gets to try
+    const WifiScanResult* best = strongest(count, nullptr);
+    startConnect(best ? best->bssid : nullptr, best ? best->channel : 0, now);
+}
+
+void WifiManager::updateConnected(uint32_t now) {
+    if (hal.status() != WifiLinkStatus::CONNECTED) {
+        onLinkLost(now);
+        return;
+    }
+
+    if (state == WifiManagerState::ROAM_SCANNING) {
+        int count = hal.scanResults(scan, MAX_SCAN_RESULTS);
+        if (count >= 0) {
+            state = WifiManagerState::CONNECTED;
+            const WifiScanResult* best = strongest(count, currentBssid);
+            if (best && best->rssi >= getRssi() + ROAM_HYSTERESIS_DB) {
+                state = WifiManagerState::ROAMING;
+                attemptStartedAt = now;
+                bool useStaticIp = staticIpFastPath && fastPath.ip.ip != 0;
+                hal.begin(ssid.c_str(), password.c_str(), best->bssid, best->channel,
+                          useStaticIp ? &fastPath.ip : nullptr);
+                return;
+            }
+        } else if (now - lastRoamScanAt >= SCAN_TIMEOUT_MS) {
+            state = WifiManagerState::CONNECTED;
+        }
+    }
+
+    if (now - lastRssiSampleAt < RSSI_SAMPLE_MS) {
+        return;
+    }
+    lastRssiSampleAt = now;
+    // Exponential average kept in fixed point so it does not stall short of the input
+    smoothedRssi += (hal.rssi() * RSSI_SCALE - smoothedRssi) / 4;
+    if (state == WifiManagerState::CONNECTED && getRssi() < roamThreshold &&
+        now - lastRoamScanAt >= ROAM_SCAN_INTERVAL_MS) {
+        lastRoamScanAt = now;
+        if (hal.startScan()) {
+            state = WifiManagerState::ROAM_SCANNING;
+        }
+    }
+}
+
+void WifiManager::onConnected(uint32_t now) {
+    bool roamed = state == WifiManagerState::ROAMING;
+    if (state == WifiManagerState::FAST_CONNECT) {
+        stats.fastConnects++;
+    }
+    stats.connects++;
+
+    uint8_t bssid[6];
+    int32_t channel;
+    WifiIpConfig ip;
+    if (hal.linkInfo(bssid, channel, ip)) {
+        memcpy(currentBssid, bssid, sizeof(bssid));
+        if (!fastPath.valid || memcmp(fastPath.bssid, bssid, sizeof(bssid)) != 0 || fastPath.channel != channel ||
+            memcmp(&fastPath.ip, &ip, sizeof(ip)) != 0) {
+            fastPath.valid = true;
+            memcpy(fastPath.bssid, bssid, sizeof(bssid));
+            fastPath.channel = channel;
+            fastPath.ip = ip;
+            hal.saveFastPath(fastPath);
+        }
+    }
+
+    state = WifiManagerState::CONNECTED;
+    retryDelayMs = MIN_RETRY_MS;
+    smoothedRssi = hal.rssi() * RSSI_SCALE;
+    lastRssiSampleAt = now;
+    lastRoamScanAt = now - ROAM_SCAN_INTERVAL_MS;
+
+    if (roamed && linkUp) {
+        stats.roams++;
+        emit(WifiEvent::ROAMED);
+    } else {
+        stats.lastConnectMs = now - outageStartedAt;
+        linkUp = true;
+        emit(WifiEvent::LINK_UP);
+    }
+}
+
+void WifiManager::onLinkLost(uint32_t now) {
+    hal.disconnect();
+    if (linkUp) {
+        linkUp = false;
+        stats.linkDowns++;
+        emit(WifiEvent::LINK_DOWN);
+    }
+    outageStartedAt = now;
+    if (fastPath.valid) {
+        startFastConnect(now);
+    } else {
+        startScan(now);
+    }
+}
+
+void WifiManager::scheduleRetry(uint32_t now) {
+    state = WifiManagerState::WAITING;
+    retryAt = now + retryDelayMs;
+    retryDelayMs = retryDelayMs * 2 > MAX_RETRY_MS ? MAX_RETRY_MS : retryDelayMs * 2;
+}
+
+const WifiScanResult* WifiManager::strongest(int count, const uint8_t* exclude) {
+    const WifiScanResult* best = nullptr;
+    for (int i = 0; i < count; i++) {
+        if (ssid != scan[i].ssid) {
+            continue;
+        }
+        if (exclude && memcmp(scan[i].bssid, exclude, 6) == 0) {
+            continue;
+        }
+        if (!best || scan[i].rssi > best->rssi) {
+            best = &scan[i];
+        }
+    }
+    return best;
+}
+
+void WifiManager::emit(WifiEvent event) {
+    for (size_t i = 0; i < listenerCount; i++) {
+        listeners[i](event);
+    }
+}
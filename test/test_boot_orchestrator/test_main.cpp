@@ -0,0 +1,313 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/boot_orchestrator.cpp"
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "boot_orchestrator.h"
+
+static uint32_t fakeNow = 1000;
+static uint32_t fakeClock() {
+    return fakeNow;
+}
+
+static BootStartResult pending() {
+    return BootStartResult::PENDING;
+}
+
+void test_independent_stages_start_together() {
+    fakeNow = 1000;
+    BootOrchestrator boot;
+    boot.setClock(fakeClock);
+    std::vector<std::string> order;
+    int storage = boot.addStage("storage", BootRole::NONE, [&]() {
+        order.push_back("storage");
+        return BootStartResult::PENDING;
+    });
+    int lora = boot.addStage("lora", BootRole::SOURCE, [&]() {
+        order.push_back("lora");
+        return BootStartResult::PENDING;
+    });
+    int analog = boot.addStage("analog", BootRole::SOURCE, [&]() {
+        order.push_back("analog");
+        return BootStartResult::READY;
+    });
+    int rules = boot.addStage("rules", BootRole::NONE, [&]() {
+        order.push_back("rules");
+        return BootStartResult::READY;
+    });
+    int gateway = boot.addStage("gateway", BootRole::SOURCE, [&]() {
+        order.push_back("gateway");
+        return BootStartResult::READY;
+    });
+    TEST_ASSERT_TRUE(boot.addDependency(rules, storage));
+    TEST_ASSERT_TRUE(boot.addDependency(gateway, storage));
+    TEST_ASSERT_TRUE(boot.addDependency(gateway, rules));
+    // Only on earlier stages, so the graph cannot loop
+    TEST_ASSERT_FALSE(boot.addDependency(storage, gateway));
+    TEST_ASSERT_FALSE(boot.addDependency(rules, rules));
+    TEST_ASSERT_EQUAL(lora, boot.findStage("lora"));
+    TEST_ASSERT_EQUAL(-1, boot.findStage("zigbee"));
+
+    // Nothing starts before begin()
+    boot.update();
+    TEST_ASSERT_EQUAL(0, (int)order.size());
+
+    boot.begin();
+    boot.update();
+    TEST_ASSERT_EQUAL(3, (int)order.size());
+    TEST_ASSERT_EQUAL(BootStageState::STARTING, boot.getState(storage));
+    TEST_ASSERT_EQUAL(BootStageState::STARTING, boot.getState(lora));
+    TEST_ASSERT_TRUE(boot.isReady(analog));
+    TEST_ASSERT_EQUAL(BootStageState::WAITING, boot.getState(rules));
+
+    // Storage finishes on its own task; both dependents follow in one update
+    fakeNow = 1800;
+    boot.markReady(storage);
+    fakeNow = 1810;
+    boot.update();
+    TEST_ASSERT_TRUE(boot.isReady(rules));
+    TEST_ASSERT_TRUE(boot.isReady(gateway));
+    TEST_ASSERT_EQUAL_STRING("rules", order[3].c_str());
+    TEST_ASSERT_EQUAL_STRING("gateway", order[4].c_str());
+    TEST_ASSERT_FALSE(boot.isComplete());
+
+    BootStageRecord record;
+    TEST_ASSERT_TRUE(boot.getStage(storage, record));
+    TEST_ASSERT_EQUAL_UINT32(0, record.startedAtMs);
+    // Stamped when signalled, not when the orchestrator noticed
+    TEST_ASSERT_EQUAL_UINT32(800, record.finishedAtMs);
+
+    boot.markReady(lora);
+    boot.update();
+    TEST_ASSERT_TRUE(boot.isComplete());
+    TEST_ASSERT_EQUAL_UINT32(810, boot.getCompletedAt());
+    // A finished boot takes no more stages
+    TEST_ASSERT_EQUAL(-1, boot.addStage("late", BootRole::NONE, pending));
+}
+
+void test_forwarding_needs_a_source_and_an_uplink() {
+    fakeNow = 0;
+    BootOrchestrator boot;
+    boot.setClock(fakeClock);
+    int storage = boot.addStage("storage", BootRole::NONE, pending);
+    int analog = boot.addStage("analog", BootRole::SOURCE, pending);
+    int zigbee = boot.addStage("zigbee", BootRole::SOURCE, pending);
+    int wifi = boot.addStage("wifi", BootRole::NONE, pending);
+    int mqtt = boot.addStage("mqtt", BootRole::UPLINK, pending);
+    boot.addDependency(wifi, storage);
+    boot.addDependency(mqtt, wifi);
+    boot.begin();
+    boot.update();
+
+    // Signals for stages that have not started are dropped
+    boot.markReady(mqtt);
+    fakeNow = 100;
+    boot.markReady(storage);
+    boot.markReady(analog);
+    boot.update();
+    TEST_ASSERT_EQUAL(BootStageState::STARTING, boot.getState(wifi));
+    TEST_ASSERT_EQUAL(BootStageState::WAITING, boot.getState(mqtt));
+    TEST_ASSERT_FALSE(boot.isForwardingReady());
+
+    fakeNow = 900;
+    boot.markReady(wifi);
+    boot.update();
+    // The early signal was dropped: mqtt waits for its own
+    TEST_ASSERT_EQUAL(BootStageState::STARTING, boot.getState(mqtt));
+    fakeNow = 1200;
+    boot.markReady(mqtt);
+    boot.update();
+    TEST_ASSERT_TRUE(boot.isForwardingReady());
+    TEST_ASSERT_EQUAL_UINT32(1200, boot.getForwardingReadyAt());
+    // Zigbee is still configuring: forwarding does not wait for it
+    TEST_ASSERT_FALSE(boot.isComplete());
+    TEST_ASSERT_EQUAL(BootStageState::STARTING, boot.getState(zigbee));
+}
+
+void test_failures_and_timeouts_skip_dependents() {
+    fakeNow = 0;
+    std::vector<std::string> lines;
+    BootOrchestrator boot;
+    boot.setClock(fakeClock);
+    boot.setLogCallback([&](const char* line) { lines.push_back(line); });
+    int storage = boot.addStage("storage", BootRole::NONE, []() { return BootStartResult::FAILED; });
+    int rules = boot.addStage("rules", BootRole::NONE, pending);
+    int gateway = boot.addStage("gateway", BootRole::SOURCE, pending);
+    int wifi = boot.addStage("wifi", BootRole::NONE, pending, 5000);
+    int mqtt = boot.addStage("mqtt", BootRole::UPLINK, pending);
+    int analog = boot.addStage("analog", BootRole::SOURCE, []() { return BootStartResult::READY; });
+    boot.addDependency(rules, storage);
+    boot.addDependency(gateway, rules);
+    boot.addDependency(mqtt, wifi);
+    boot.begin();
+    boot.update();
+    TEST_ASSERT_EQUAL(BootStageState::FAILED, boot.getState(storage));
+    TEST_ASSERT_EQUAL(BootStageState::SKIPPED, boot.getState(rules));
+    TEST_ASSERT_EQUAL(BootStageState::SKIPPED, boot.getState(gateway));
+    TEST_ASSERT_TRUE(boot.isSettled(gateway));
+    TEST_ASSERT_TRUE(boot.isReady(analog));
+
+    fakeNow = 4999;
+    boot.update();
+    TEST_ASSERT_EQUAL(BootStageState::STARTING, boot.getState(wifi));
+    TEST_ASSERT_FALSE(boot.isSettled(wifi));
+    fakeNow = 5000;
+    boot.update();
+    TEST_ASSERT_EQUAL(BootStageState::FAILED, boot.getState(wifi));
+    TEST_ASSERT_TRUE(boot.isSettled(wifi));
+    TEST_ASSERT_EQUAL(BootStageState::SKIPPED, boot.getState(mqtt));
+    // Everything settled: complete without ever reaching forwarding
+    TEST_ASSERT_TRUE(boot.isComplete());
+    TEST_ASSERT_FALSE(boot.isForwardingReady());
+    TEST_ASSERT_EQUAL_UINT32(BootOrchestrator::NOT_YET, boot.getForwardingReadyAt());
+
+    bool timedOut = false;
+    for (const std::string& line : lines) {
+        timedOut = timedOut || line.find("wifi timed out") != std::string::npos;
+    }
+    TEST_ASSERT_TRUE(timedOut);
+
+    // A late signal does not revive a failed stage
+    boot.markReady(wifi);
+    boot.update();
+    TEST_ASSERT_EQUAL(BootStageState::FAILED, boot.getState(wifi));
+}
+
+void test_timeline_export() {
+    fakeNow = 0;
+    BootOrchestrator boot;
+    boot.setClock(fakeClock);
+    int storage = boot.addStage("storage", BootRole::NONE, pending);
+    int mqtt = boot.addStage("mqtt", BootRole::UPLINK, pending);
+    int analog = boot.addStage("analog", BootRole::SOURCE, []() {
+        fakeNow += 3;   // inline work is timed too
+        return BootStartResult::READY;
+    });
+    boot.addDependency(mqtt, storage);
+    (void)analog;
+    boot.begin();
+    boot.update();
+
+    std::string partial = boot.exportTimeline();
+    TEST_ASSERT_NOT_NULL(strstr(partial.c_str(), "\"forwardingMs\":null"));
+    TEST_ASSERT_NOT_NULL(strstr(partial.c_str(), "{\"name\":\"mqtt\",\"role\":\"uplink\",\"state\":\"waiting\",\"after\":[\"storage\"]}"));
+
+    fakeNow = 500;
+    boot.markReady(storage);
+    boot.update();
+    fakeNow = 1250;
+    boot.markReady(mqtt);
+    boot.update();
+    std::string json = boot.exportTimeline();
+    TEST_MESSAGE(json.c_str());
+    TEST_ASSERT_NOT_NULL(strstr(json.c_str(), "\"forwardingMs\":1250,\"completeMs\":1250"));
+    TEST_ASSERT_NOT_NULL(strstr(json.c_str(), "{\"name\":\"storage\",\"role\":\"none\",\"state\":\"ready\",\"startMs\":0,\"endMs\":500,\"durationMs\":500,\"after\":[]}"));
+    TEST_ASSERT_NOT_NULL(strstr(json.c_str(), "\"name\":\"analog\",\"role\":\"source\",\"state\":\"ready\",\"startMs\":0,\"endMs\":3,\"durationMs\":3"));
+    TEST_ASSERT_NOT_NULL(strstr(json.c_str(), "\"name\":\"mqtt\",\"role\":\"uplink\",\"state\":\"ready\",\"startMs\":500,\"endMs\":1250"));
+}
+
+// Boot of the gateway with representative stage durations (ms), run
+// sequentially as begin() did, and through the orchestrator. Sequentially,
+// Wi-Fi only starts after every module's init has returned.
+struct SimStage {
+    const char* name;
+    BootRole role;
+    uint32_t durationMs;
+    const char* after[2];
+};
+
+static const SimStage SIM_STAGES[] = {
+    {"maintenance", BootRole::NONE, 40, {nullptr, nullptr}},
+    {"storage", BootRole::NONE, 850, {"maintenance", nullptr}},
+    {"led", BootRole::NONE, 2, {nullptr, nullptr}},
+    {"lora", BootRole::SOURCE, 300, {nullptr, nullptr}},
+    {"zigbee", BootRole::SOURCE, 450, {nullptr, nullptr}},
+    {"analog", BootRole::SOURCE, 1, {nullptr, nullptr}},
+    {"rules", BootRole::NONE, 60, {"storage", nullptr}},
+    {"modbus", BootRole::SOURCE, 120, {"storage", "rules"}},
+    {"protocols", BootRole::NONE, 700, {"storage", nullptr}},
+    {"wifi", BootRole::NONE, 2200, {"storage", nullptr}},
+    {"mqtt", BootRole::UPLINK, 600, {"wifi", "protocols"}},
+    {"sntp", BootRole::NONE, 250, {"wifi", nullptr}},
+};
+static const size_t SIM_COUNT = sizeof(SIM_STAGES) / sizeof(SIM_STAGES[0]);
+
+void test_boot_time_against_sequential_init() {
+    // Sequential: each stage after the previous one; forwarding once mqtt is up
+    uint32_t sequential = 0;
+    uint32_t sequentialForwarding = 0;
+    for (size_t i = 0; i < SIM_COUNT; i++) {
+        sequential += SIM_STAGES[i].durationMs;
+        if (strcmp(SIM_STAGES[i].name, "mqtt") == 0) {
+            sequentialForwarding = sequential;
+        }
+    }
+
+    fakeNow = 0;
+    BootOrchestrator boot;
+    boot.setClock(fakeClock);
+    uint32_t doneAt[SIM_COUNT];
+    int ids[SIM_COUNT];
+    for (size_t i = 0; i < SIM_COUNT; i++) {
+        doneAt[i] = BootOrchestrator::NOT_YET;
+        ids[i] = boot.addStage(SIM_STAGES[i].name, SIM_STAGES[i].role, [&doneAt, i]() {
+            doneAt[i] = fakeNow + SIM_STAGES[i].durationMs;
+            return BootStartResult::PENDING;
+        });
+        for (const char* after : SIM_STAGES[i].after) {
+            if (after) {
+                TEST_ASSERT_TRUE(boot.addDependency(ids[i], boot.findStage(after)));
+            }
+        }
+    }
+    boot.begin();
+    while (!boot.isComplete() && fakeNow < 60000) {
+        for (size_t i = 0; i < SIM_COUNT; i++) {
+            if (doneAt[i] == fakeNow) {
+                boot.markReady(ids[i]);
+            }
+        }
+        boot.update();
+        fakeNow++;
+    }
+    TEST_ASSERT_TRUE(boot.isComplete());
+
+    char message[160];
+    snprintf(message, sizeof(message), "sequential init: forwarding at %u ms, complete at %u ms",
+             (unsigned)sequentialForwarding, (unsigned)sequential);
+    TEST_MESSAGE(message);
+    snprintf(message, sizeof(message), "dependency graph: forwarding at %u ms, complete at %u ms",
+             (unsigned)boot.getForwardingReadyAt(), (unsigned)boot.getCompletedAt());
+    TEST_MESSAGE(message);
+
+    // Both bounded by the critical path: maintenance -> storage -> wifi -> mqtt
+    uint32_t criticalPath = 40 + 850 + 2200 + 600;
+    TEST_ASSERT_UINT32_WITHIN(5, criticalPath, boot.getForwardingReadyAt());
+    TEST_ASSERT_UINT32_WITHIN(5, criticalPath, boot.getCompletedAt());
+    TEST_ASSERT_LESS_THAN(sequentialForwarding, boot.getForwardingReadyAt());
+}
+
+int runUnityTests() {
+    UNITY_BEGIN();
+    RUN_TEST(test_independent_stages_start_together);
+    RUN_TEST(test_forwarding_needs_a_source_and_an_uplink);
+    RUN_TEST(test_failures_and_timeouts_skip_dependents);
+    RUN_TEST(test_timeline_export);
+    RUN_TEST(test_boot_time_against_sequential_init);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
@@ -0,0 +1,445 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/coap_engine.cpp"
+
+#include <unity.h>
+#include <stdio.h>
+#include <deque>
+#include <map>
+#include "coap_engine.h"
+
+static uint32_t virtualNow = 0;
+
+static uint32_t virtualClock() {
+    return virtualNow;
+}
+
+// UDP stand-in with a tiny CoAP server behind it. Datagrams are handled as
+// soon as the client sends them; replies wait in a queue until update().
+class LoopbackServer : public CoapTransport {
+public:
+    std::map<std::string, std::string> resources;
+    uint32_t dropNext = 0;
+    bool separate = false;
+    uint8_t serverSzx = 2; // 64-byte Block2 blocks
+    uint32_t datagramsFromClient = 0;
+    uint32_t datagramsToClient = 0;
+    uint32_t resets = 0;
+
+    struct Observer {
+        std::vector<uint8_t> token;
+        std::string path;
+        uint32_t sequence;
+        uint16_t lastMessageId;
+    };
+    std::vector<Observer> observers;
+
+    bool send(const uint8_t* data, size_t length) override {
+        datagramsFromClient++;
+        if (dropNext > 0) {
+            dropNext--;
+            return true;
+        }
+        CoapMessage message;
+        if (!coapParse(data, length, message)) {
+            return false;
+        }
+        handle(message);
+        return true;
+    }
+
+    int receive(uint8_t* data, size_t capacity) override {
+        if (toClient.empty()) {
+            return 0;
+        }
+        std::vector<uint8_t> datagram = toClient.front();
+        toClient.pop_front();
+        size_t length = datagram.size() < capacity ? datagram.size() : capacity;
+        memcpy(data, datagram.data(), length);
+        return (int)length;
+    }
+
+    void notify(const std::string& path, const std::string& value, bool confirmable, int sequenceOverride = -1) {
+        resources[path] = value;
+        for (Observer& observer : observers) {
+            if (observer.path != path) {
+                continue;
+            }
+            uint32_t sequence = sequenceOverride >= 0 ? (uint32_t)sequenceOverride : ++observer.sequence;
+            observer.lastMessageId = messageId++;
+            respond(confirmable ? CoapType::CON : CoapType::NON, observer.lastMessageId, observer.token,
+                    CoapCode::CONTENT, &sequence, value, 0, false);
+        }
+    }
+
+private:
+    std::deque<std::vector<uint8_t>> toClient;
+    std::string upload;
+    uint16_t messageId = 0x7000;
+
+    void respond(CoapType type, uint16_t id, const std::vector<uint8_t>& token, uint8_t code,
+                 const uint32_t* observe, const std::string& body, uint32_t block2Num, bool echoBlock1,
+                 uint32_t block1 = 0) {
+        uint8_t datagram[CoapEngine::MAX_DATAGRAM_SIZE];
+        CoapWriter writer(datagram, sizeof(datagram));
+        writer.header(type, code, id, token.data(), token.size());
+        if (observe != nullptr) {
+            writer.optionUint(CoapOptionNumber::OBSERVE, *observe);
+        }
+        size_t size = (size_t)1 << (serverSzx + 4);
+        const uint8_t* payload = (const uint8_t*)body.data();
+        size_t length = body.size();
+        if (body.size() > size) {
+            size_t offset = block2Num * size;
+            bool more = offset + size < body.size();
+            writer.optionUint(CoapOptionNumber::BLOCK2, (block2Num << 4) | (more ? 8 : 0) | serverSzx);
+            payload += offset;
+            length = more ? size : body.size() - offset;
+        }
+        if (echoBlock1) {
+            writer.optionUint(CoapOptionNumber::BLOCK1, block1);
+        }
+        writer.payload(payload, length);
+        toClient.push_back(std::vector<uint8_t>(datagram, datagram + writer.length()));
+        datagramsToClient++;
+    }
+
+    void handle(const CoapMessage& message) {
+        if (message.type == CoapType::RST) {
+            resets++;
+            for (auto it = observers.begin(); it != observers.end(); ++it) {
+                if (it->lastMessageId == message.messageId) {
+                    observers.erase(it);
+                    break;
+                }
+            }
+            return;
+        }
+        if (message.type == CoapType::ACK) {
+            return;
+        }
+
+        std::string path;
+        for (size_t i = 0; i < message.optionCount; i++) {
+            if (message.options[i].number == CoapOptionNumber::URI_PATH) {
+                path += "/" + std::string((const char*)message.options[i].value, message.options[i].length);
+            }
+        }
+        std::vector<uint8_t> token(message.token, message.token + message.tokenLength);
+        uint8_t code = CoapCode::NOT_FOUND;
+        std::string body;
+        uint32_t block2Num = 0;
+        uint32_t observeValue;
+        uint32_t sequence = 0;
+        const uint32_t* observe = nullptr;
+        bool echoBlock1 = false;
+        uint32_t block1 = 0;
+
+        if (message.code == (uint8_t)CoapMethod::GET) {
+            uint32_t block2;
+            if (message.getUint(CoapOptionNumber::BLOCK2, block2)) {
+                block2Num = block2 >> 4;
+            }
+            if (message.getUint(CoapOptionNumber::OBSERVE, observeValue)) {
+                if (observeValue == 0) {
+                    observers.push_back({token, path, 1, 0});
+                    sequence = 1;
+                    observe = &sequence;
+                } else {
+                    for (auto it = observers.begin(); it != observers.end(); ++it) {
+                        if (it->token == token) {
+                            observers.erase(it);
+                            break;
+                        }
+                    }
+                }
+            }
+            if (resources.count(path)) {
+                code = CoapCode::CONTENT;
+                body = resources[path];
+            }
+        } else {
+            if (message.getUint(CoapOptionNumber::BLOCK1, block1)) {
+                size_t size = (size_t)1 << ((block1 & 7) + 4);
+                // Retransmitted blocks overwrite instead of appending twice
+                upload.resize((block1 >> 4) * size);
+                upload.append((const char*)message.payload, message.payloadLength);
+                echoBlock1 = true;
+                code = (block1 & 8) ? CoapCode::CONTINUE : CoapCode::CHANGED;
+                if (!(block1 & 8)) {
+                    resources[path] = upload;
+                }
+            } else {
+                resources[path] = std::string((const char*)message.payload, message.payloadLength);
+                code = CoapCode::CHANGED;
+            }
+        }
+
+        if (separate && message.type == CoapType::CON) {
+            const std::vector<uint8_t> none;
+            respond(CoapType::ACK, message.messageId, none, CoapCode::EMPTY, nullptr, "", 0, false);
+            respond(CoapType::CON, messageId++, token, code, observe, body, block2Num, echoBlock1, block1);
+        } else {
+            respond(message.type == CoapType::CON ? CoapType::ACK : CoapType::NON,
+                    message.type == CoapType::CON ? message.messageId : messageId++,
+                    token, code, observe, body, block2Num, echoBlock1, block1);
+        }
+    }
+};
+
+struct Result {
+    int calls = 0;
+    CoapStatus status = CoapStatus::TIMEOUT;
+    uint8_t code = 0;
+    std::string body;
+    bool notification = false;
+};
+
+static CoapCallback collect(Result& result) {
+    return [&result](uint32_t, const CoapResponse& response) {
+        result.calls++;
+        result.status = response.status;
+        result.code = response.code;
+        result.body.assign((const char*)response.payload, response.length);
+        result.notification = response.notification;
+    };
+}
+
+static void run(CoapEngine& engine, uint32_t ms) {
+    for (uint32_t i = 0; i < ms; i += 10) {
+        virtualNow += 10;
+        engine.update();
+    }
+}
+
+static void setupEngine(CoapEngine& engine) {
+    engine.setClock(virtualClock);
+    engine.setSeed(1234);
+}
+
+void test_codec_round_trip() {
+    uint8_t buffer[600];
+    const uint8_t token[] = {1, 2, 3};
+    std::string longValue(300, 'x');
+    CoapWriter writer(buffer, sizeof(buffer));
+    writer.header(CoapType::CON, (uint8_t)CoapMethod::PUT, 0xBEEF, token, sizeof(token));
+    writer.uriPath("/cerise//samples/");
+    writer.optionUint(CoapOptionNumber::CONTENT_FORMAT, 60);
+    writer.optionUint(CoapOptionNumber::BLOCK1, 0x1C);
+    writer.option(300, (const uint8_t*)longValue.data(), longValue.size());
+    writer.payload((const uint8_t*)"abc", 3);
+    TEST_ASSERT_FALSE(writer.overflowed());
+
+    CoapMessage message;
+    TEST_ASSERT_TRUE(coapParse(buffer, writer.length(), message));
+    TEST_ASSERT_EQUAL(CoapType::CON, message.type);
+    TEST_ASSERT_EQUAL(0xBEEF, message.messageId);
+    TEST_ASSERT_EQUAL(3, message.tokenLength);
+    TEST_ASSERT_EQUAL(5, message.optionCount);
+    TEST_ASSERT_EQUAL_MEMORY("cerise", message.options[0].value, 6);
+    TEST_ASSERT_EQUAL_MEMORY("samples", message.options[1].value, 7);
+    uint32_t value;
+    TEST_ASSERT_TRUE(message.getUint(CoapOptionNumber::CONTENT_FORMAT, value));
+    TEST_ASSERT_EQUAL(60, value);
+    TEST_ASSERT_TRUE(message.getUint(CoapOptionNumber::BLOCK1, value));
+    TEST_ASSERT_EQUAL(0x1C, value);
+    TEST_ASSERT_EQUAL(300, message.find(300)->length);
+    TEST_ASSERT_EQUAL(3, message.payloadLength);
+    TEST_ASSERT_EQUAL_MEMORY("abc", message.payload, 3);
+
+    TEST_ASSERT_FALSE(coapParse(buffer, 3, message));
+}
+
+void test_confirmable_retransmits_then_times_out() {
+    LoopbackServer server;
+    server.resources["/status"] = "ok";
+    CoapEngine engine(server);
+    setupEngine(engine);
+
+    Result result;
+    server.dropNext = 2;
+    TEST_ASSERT_NOT_EQUAL(0, engine.request(CoapMethod::GET, "/status", nullptr, 0, -1, true, collect(result)));
+    run(engine, 2900);
+    TEST_ASSERT_EQUAL(0, result.calls);
+    run(engine, 12000);
+    TEST_ASSERT_EQUAL(1, result.calls);
+    TEST_ASSERT_EQUAL(CoapStatus::RESPONSE, result.status);
+    TEST_ASSERT_EQUAL_STRING("ok", result.body.c_str());
+    TEST_ASSERT_EQUAL(2, engine.getStats().retransmits);
+
+    // No answer at all: 4 retransmits with doubling timeouts, then TIMEOUT
+    Result lost;
+    server.dropNext = 100;
+    uint32_t start = virtualNow;
+    engine.request(CoapMethod::GET, "/status", nullptr, 0, -1, true, collect(lost));
+    while (lost.calls == 0 && virtualNow - start < 200000) {
+        run(engine, 10);
+    }
+    TEST_ASSERT_EQUAL(CoapStatus::TIMEOUT, lost.status);
+    TEST_ASSERT_EQUAL(6, engine.getStats().retransmits);
+    // 2+4+8+16+32 s of timeouts, scaled by the 1..1.5 random factor
+    TEST_ASSERT_GREATER_OR_EQUAL(62000, virtualNow - start);
+    TEST_ASSERT_LESS_THAN(93100, virtualNow - start);
+    TEST_ASSERT_EQUAL(0, engine.getActiveCount());
+}
+
+void test_block1_upload_and_block2_download() {
+    LoopbackServer server;
+    CoapEngine engine(server);
+    setupEngine(engine);
+    TEST_ASSERT_TRUE(engine.setBlockSize(256));
+
+    std::string body;
+    for (int i = 0; i < 3000; i++) {
+        body += (char)('a' + i % 26);
+    }
+    Result upload;
+    engine.request(CoapMethod::PUT, "/cerise/log", (const uint8_t*)body.data(), body.size(), 0, true, collect(upload));
+    run(engine, 100);
+    TEST_ASSERT_EQUAL(1, upload.calls);
+    TEST_ASSERT_EQUAL(CoapCode::CHANGED, upload.code);
+    TEST_ASSERT_EQUAL(12, engine.getStats().blocksSent);
+    TEST_ASSERT_TRUE(server.resources["/cerise/log"] == body);
+
+    // Server answers in 64-byte Block2 blocks; one lost block is retried
+    Result download;
+    server.dropNext = 0;
+    engine.request(CoapMethod::GET, "/cerise/log", nullptr, 0, -1, true, collect(download));
+    run(engine, 10);
+    server.dropNext = 1;
+    run(engine, 5000);
+    TEST_ASSERT_EQUAL(1, download.calls);
+    TEST_ASSERT_EQUAL(CoapStatus::RESPONSE, download.status);
+    TEST_ASSERT_EQUAL(3000, download.body.size());
+    TEST_ASSERT_TRUE(download.body == body);
+    TEST_ASSERT_EQUAL(47, engine.getStats().blocksReceived);
+}
+
+void test_separate_response_is_acknowledged() {
+    LoopbackServer server;
+    server.resources["/slow"] = "done";
+    server.separate = true;
+    CoapEngine engine(server);
+    setupEngine(engine);
+
+    Result result;
+    engine.request(CoapMethod::GET, "/slow", nullptr, 0, -1, true, collect(result));
+    uint32_t sent = server.datagramsFromClient;
+    run(engine, 10000);
+    TEST_ASSERT_EQUAL(1, result.calls);
+    TEST_ASSERT_EQUAL_STRING("done", result.body.c_str());
+    // Request plus the empty ACK for the server's CON, no retransmissions
+    TEST_ASSERT_EQUAL(sent + 1, server.datagramsFromClient);
+    TEST_ASSERT_EQUAL(0, engine.getStats().retransmits);
+}
+
+void test_observe_notifications_and_cancel() {
+    LoopbackServer server;
+    server.resources["/cerise/setpoint"] = "20";
+    CoapEngine engine(server);
+    setupEngine(engine);
+
+    Result result;
+    uint32_t handle = engine.observe("/cerise/setpoint", collect(result));
+    run(engine, 100);
+    TEST_ASSERT_TRUE(engine.isObserving(handle));
+    TEST_ASSERT_EQUAL(1, result.calls);
+    TEST_ASSERT_TRUE(result.notification);
+
+    server.notify("/cerise/setpoint", "21", true);
+    run(engine, 100);
+    server.notify("/cerise/setpoint", "22", false);
+    run(engine, 100);
+    TEST_ASSERT_EQUAL(3, result.calls);
+    TEST_ASSERT_EQUAL_STRING("22", result.body.c_str());
+
+    // A reordered, older notification is ignored
+    server.notify("/cerise/setpoint", "stale", false, 2);
+    run(engine, 100);
+    TEST_ASSERT_EQUAL(3, result.calls);
+
+    TEST_ASSERT_TRUE(engine.cancel(handle));
+    run(engine, 100);
+    TEST_ASSERT_EQUAL(0, server.observers.size());
+    TEST_ASSERT_EQUAL(0, engine.getActiveCount());
+    server.observers.push_back({std::vector<uint8_t>{1, 2, 3, 4}, "/cerise/setpoint", 9, 0});
+    server.notify("/cerise/setpoint", "23", true);
+    run(engine, 100);
+    TEST_ASSERT_EQUAL(3, result.calls);
+    TEST_ASSERT_EQUAL(1, server.resets);
+    TEST_ASSERT_EQUAL(0, server.observers.size());
+}
+
+void test_benchmark_observe_vs_polling() {
+    // Setpoint changes 10 times in 60 s; compare 1 s polling with Observe
+    const uint32_t changes[] = {3100, 9400, 15250, 21800, 27300, 33900, 40050, 46600, 52200, 58700};
+    uint32_t datagrams[2];
+    uint32_t totalDelay[2] = {0, 0};
+
+    for (int mode = 0; mode < 2; mode++) {
+        LoopbackServer server;
+        server.resources["/cerise/setpoint"] = "0";
+        CoapEngine engine(server);
+        setupEngine(engine);
+        std::string seen = "0";
+        uint32_t changedAt = 0;
+        auto track = [&](uint32_t, const CoapResponse& response) {
+            std::string value((const char*)response.payload, response.length);
+            if (value != seen) {
+                seen = value;
+                totalDelay[mode] += virtualNow - changedAt;
+            }
+        };
+
+        uint32_t start = virtualNow;
+        uint32_t nextPoll = start;
+        size_t next = 0;
+        if (mode == 1) {
+            engine.observe("/cerise/setpoint", track);
+        }
+        while (virtualNow - start < 60000) {
+            if (next < 10 && virtualNow - start >= changes[next]) {
+                changedAt = virtualNow;
+                server.notify("/cerise/setpoint", std::to_string(++next), true);
+            }
+            if (mode == 0 && virtualNow >= nextPoll) {
+                engine.request(CoapMethod::GET, "/cerise/setpoint", nullptr, 0, -1, true, track);
+                nextPoll += 1000;
+            }
+            run(engine, 10);
+        }
+        datagrams[mode] = server.datagramsFromClient + server.datagramsToClient;
+    }
+
+    char message[160];
+    snprintf(message, sizeof(message), "polling 1 s: %u datagrams, mean change latency %u ms",
+             (unsigned)datagrams[0], (unsigned)(totalDelay[0] / 10));
+    TEST_MESSAGE(message);
+    snprintf(message, sizeof(message), "observe:     %u datagrams, mean change latency %u ms",
+             (unsigned)datagrams[1], (unsigned)(totalDelay[1] / 10));
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_THAN(datagrams[0] / 4, datagrams[1]);
+    TEST_ASSERT_LESS_THAN(totalDelay[0], totalDelay[1]);
+}
+
+int runUnityTests() {
+    UNITY_BEGIN();
+    RUN_TEST(test_codec_round_trip);
+    RUN_TEST(test_confirmable_retransmits_then_times_out);
+    RUN_TEST(test_block1_upload_and_block2_download);
+    RUN_TEST(test_separate_response_is_acknowledged);
+    RUN_TEST(test_observe_notifications_and_cancel);
+    RUN_TEST(test_benchmark_observe_vs_polling);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
@@ -0,0 +1,367 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/deflate_encoder.cpp"
+#include "../../src/lz_codec.cpp"
+#include "../../src/payload_encoder.cpp"
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "deflate_encoder.h"
+#include "lz_codec.h"
+#include "payload_encoder.h"
+
+// Inflater for the subset the encoder produces: fixed Huffman blocks
+class FixedInflater {
+public:
+    FixedInflater(const uint8_t* data, size_t length) : data(data), length(length), bit(0) {}
+
+    bool inflate(std::vector<uint8_t>& out) {
+        bool final = false;
+        while (!final) {
+            final = bits(1) == 1;
+            if (bits(2) != 1) {
+                return false;
+            }
+            for (;;) {
+                int symbol = literal();
+                if (symbol < 0) {
+                    return false;
+                }
+                if (symbol < 256) {
+                    out.push_back((uint8_t)symbol);
+                    continue;
+                }
+                if (symbol == 256) {
+                    break;
+                }
+                int code = symbol - 257;
+                if (code > 28) {
+                    return false;
+                }
+                size_t copy = LENGTH_BASE[code] + bits(LENGTH_EXTRA[code]);
+                int distanceCode = (int)reversed(5);
+                if (distanceCode > 29) {
+                    return false;
+                }
+                size_t distance = DISTANCE_BASE[distanceCode] + bits(DISTANCE_EXTRA[distanceCode]);
+                if (distance > out.size()) {
+                    return false;
+                }
+                for (size_t i = 0; i < copy; i++) {
+                    out.push_back(out[out.size() - distance]);
+                }
+            }
+        }
+        return bit <= length * 8;
+    }
+
+    size_t consumed() const {
+        return (bit + 7) / 8;
+    }
+
+private:
+    const uint8_t* data;
+    size_t length;
+    size_t bit;
+
+    uint32_t bits(uint8_t count) {
+        uint32_t value = 0;
+        for (uint8_t i = 0; i < count; i++, bit++) {
+            if (bit / 8 < length && (data[bit / 8] >> (bit % 8)) & 1) {
+                value |= 1u << i;
+            }
+        }
+        return value;
+    }
+
+    uint32_t reversed(uint8_t count) {
+        uint32_t value = 0;
+        for (uint8_t i = 0; i < count; i++) {
+            value = (value << 1) | bits(1);
+        }
+        return value;
+    }
+
+    int literal() {
+        uint32_t code = reversed(7);
+        if (code <= 0x17) {
+            return 256 + (int)code;
+        }
+        code = (code << 1) | bits(1);
+        if (code >= 0x30 && code <= 0xBF) {
+            return (int)(code - 0x30);
+        }
+        if (code >= 0xC0 && code <= 0xC7) {
+            return 280 + (int)(code - 0xC0);
+        }
+        code = (code << 1) | bits(1);
+        if (code >= 0x190 && code <= 0x1FF) {
+            return 144 + (int)(code - 0x190);
+        }
+        return -1;
+    }
+};
+
+static std::vector<uint8_t> deflateAll(DeflateEncoder& encoder, DeflateContainer container, const uint8_t* input,
+                                       size_t length, size_t chunk) {
+    std::vector<uint8_t> out;
+    encoder.begin(container, [&out](const uint8_t* data, size_t count) {
+        out.insert(out.end(), data, data + count);
+        return true;
+    });
+    for (size_t i = 0; i < length; i += chunk) {
+        encoder.write(input + i, length - i < chunk ? length - i : chunk);
+    }
+    encoder.finish();
+    return out;
+}
+
+static uint32_t readLe32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Telemetry as it goes out: JSON sample batches plus a status document
+static std::vector<std::string> recordedPayloads() {
+    std::vector<std::string> payloads;
+    uint32_t seed = 7;
+    uint8_t buffer[4096];
+    for (int batch = 0; batch < 40; batch++) {
+        Sample samples[32];
+        for (int i = 0; i < 32; i++) {
+            seed = seed * 1103515245 + 12345;
+            uint16_t point = (uint16_t)(i % 8);
+            float value;
+            if (point < 4) {
+                // Temperatures at 0.1 degree resolution
+                value = roundf((20.0f + point * 3.5f + sinf((batch * 32 + i) * 0.01f) * 2.0f) * 10.0f) / 10.0f;
+            } else {
+                // Raw Modbus registers
+                value = (float)(1000 + point * 250 + (seed >> 16) % 8);
+            }
+            samples[i] = {point, point < 4 ? SampleSource::ANALOG : SampleSource::MODBUS, value,
+                          (uint32_t)(batch * 32000 + i * 1000)};
+        }
+        PayloadBuffer out(buffer, sizeof(buffer));
+        size_t length = encodeSamples(PayloadFormat::JSON, samples, 32, out);
+        payloads.push_back(std::string((const char*)buffer, length));
+    }
+    for (int i = 0; i < 10; i++) {
+        char status[512];
+        snprintf(status, sizeof(status),
+                 "{\"deviceId\":\"CERISE-GW-3C71BF4A\",\"uptime\":%d,\"heap\":%d,\"rssi\":%d,"
+                 "\"protocols\":{\"MQTT\":\"CONNECTED\",\"HTTP\":\"CONNECTED\",\"WebSocket\":\"DISCONNECTED\","
+                 "\"CoAP\":\"DISCONNECTED\"},\"queue\":%d,\"modbus\":{\"requests\":%d,\"cacheHits\":%d,"
+                 "\"serialReads\":%d,\"timeouts\":0},\"supervisor\":{\"acquisition\":100,\"network\":%d}}",
+                 3600 + i * 60, 182000 - i * 40, -61 - i % 5, i % 3, 1200 + i * 17, 1100 + i * 15, 100 + i * 2,
+                 100 - i % 2 * 5);
+        payloads.push_back(status);
+    }
+    return payloads;
+}
+
+void test_checksums() {
+    const uint8_t* check = (const uint8_t*)"123456789";
+    TEST_ASSERT_EQUAL_HEX32(0xCBF43926, DeflateEncoder::crc32(0, check, 9));
+    TEST_ASSERT_EQUAL_HEX32(0x11E60398, DeflateEncoder::adler32(1, (const uint8_t*)"Wikipedia", 9));
+}
+
+void test_raw_round_trip() {
+    static DeflateEncoder encoder;
+    std::string text;
+    for (int i = 0; i < 200; i++) {
+        text += "{\"id\":" + std::to_string(i % 7) + ",\"v\":" + std::to_string(i * 13 % 101) + "},";
+    }
+    std::vector<uint8_t> out = deflateAll(encoder, DeflateContainer::RAW, (const uint8_t*)text.data(),
+                                          text.size(), text.size());
+    TEST_ASSERT_TRUE(out.size() < text.size() / 3);
+
+    std::vector<uint8_t> decoded;
+    FixedInflater inflater(out.data(), out.size());
+    TEST_ASSERT_TRUE(inflater.inflate(decoded));
+    TEST_ASSERT_EQUAL(text.size(), decoded.size());
+    TEST_ASSERT_EQUAL_MEMORY(text.data(), decoded.data(), text.size());
+    TEST_ASSERT_EQUAL(out.size(), encoder.getTotalOut());
+    TEST_ASSERT_EQUAL(text.size(), encoder.getTotalIn());
+}
+
+void test_streaming_matches_one_shot_across_window() {
+    static DeflateEncoder encoder;
+    // Longer than the window, with repeats both near and beyond it
+    std::vector<uint8_t> input;
+    uint32_t seed = 99;
+    for (int i = 0; i < 12000; i++) {
+        seed = seed * 1103515245 + 12345;
+        input.push_back(i % 3000 < 1500 ? (uint8_t)('a' + (seed >> 16) % 4) : (uint8_t)(input[i - 1500]));
+    }
+    std::vector<uint8_t> whole = deflateAll(encoder, DeflateContainer::RAW, input.data(), input.size(), input.size());
+    static const size_t chunks[] = {1, 7, 300, 4096};
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+        std::vector<uint8_t> streamed = deflateAll(encoder, DeflateContainer::RAW, input.data(), input.size(), chunks[c]);
+        std::vector<uint8_t> decoded;
+        FixedInflater inflater(streamed.data(), streamed.size());
+        TEST_ASSERT_TRUE(inflater.inflate(decoded));
+        TEST_ASSERT_EQUAL(input.size(), decoded.size());
+        TEST_ASSERT_EQUAL_MEMORY(input.data(), decoded.data(), input.size());
+        // Chunking only moves where the look-ahead waits, not what is found
+        TEST_ASSERT_TRUE(streamed.size() <= whole.size() + whole.size() / 50);
+    }
+}
+
+void test_gzip_and_zlib_framing() {
+    static DeflateEncoder encoder;
+    const char* text = "temperature=21.5;temperature=21.5;temperature=21.6;humidity=40;humidity=41";
+    size_t length = strlen(text);
+
+    std::vector<uint8_t> gzip = deflateAll(encoder, DeflateContainer::GZIP, (const uint8_t*)text, length, 16);
+    TEST_ASSERT_EQUAL_HEX8(0x1F, gzip[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x8B, gzip[1]);
+    TEST_ASSERT_EQUAL_HEX8(8, gzip[2]);
+    TEST_ASSERT_EQUAL_HEX32(DeflateEncoder::crc32(0, (const uint8_t*)text, length), readLe32(&gzip[gzip.size() - 8]));
+    TEST_ASSERT_EQUAL(length, readLe32(&gzip[gzip.size() - 4]));
+    std::vector<uint8_t> decoded;
+    FixedInflater gzipInflater(gzip.data() + 10, gzip.size() - 18);
+    TEST_ASSERT_TRUE(gzipInflater.inflate(decoded));
+    TEST_ASSERT_EQUAL_MEMORY(text, decoded.data(), length);
+
+    std::vector<uint8_t> zlib = deflateAll(encoder, DeflateContainer::ZLIB, (const uint8_t*)text, length, length);
+    TEST_ASSERT_EQUAL(0, ((zlib[0] << 8) | zlib[1]) % 31);
+    TEST_ASSERT_EQUAL_HEX8(8, zlib[0] & 0x0F);
+    uint32_t adler = ((uint32_t)zlib[zlib.size() - 4] << 24) | ((uint32_t)zlib[zlib.size() - 3] << 16)
+                     | ((uint32_t)zlib[zlib.size() - 2] << 8) | zlib[zlib.size() - 1];
+    TEST_ASSERT_EQUAL_HEX32(DeflateEncoder::adler32(1, (const uint8_t*)text, length), adler);
+}
+
+void test_one_shot_reports_overflow() {
+    static DeflateEncoder encoder;
+    uint8_t input[600];
+    uint32_t seed = 3;
+    for (size_t i = 0; i < sizeof(input); i++) {
+        seed = seed * 1103515245 + 12345;
+        input[i] = (uint8_t)(seed >> 16);
+    }
+    uint8_t output[700];
+    // Noise does not compress; fixed codes cost up to 9 bits per byte
+    TEST_ASSERT_EQUAL(0, encoder.compress(DeflateContainer::RAW, input, sizeof(input), output, 500));
+    size_t length = encoder.compress(DeflateContainer::RAW, input, sizeof(input), output, sizeof(output));
+    TEST_ASSERT_TRUE(length > sizeof(input));
+
+    std::vector<uint8_t> decoded;
+    FixedInflater inflater(output, length);
+    TEST_ASSERT_TRUE(inflater.inflate(decoded));
+    TEST_ASSERT_EQUAL_MEMORY(input, decoded.data(), sizeof(input));
+}
+
+void test_benchmark_recorded_payloads() {
+    using namespace std::chrono;
+    static DeflateEncoder encoder;
+    static LzCodec lz;
+    std::vector<std::string> payloads = recordedPayloads();
+    static uint8_t output[8192];
+
+    size_t rawBytes = 0;
+    size_t deflateBytes = 0;
+    size_t gzipBytes = 0;
+    size_t lzBytes = 0;
+    const int ROUNDS = 50;
+
+    auto started = steady_clock::now();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (const std::string& payload : payloads) {
+            size_t length = encoder.compress(DeflateContainer::RAW, (const uint8_t*)payload.data(), payload.size(),
+                                             output, sizeof(output));
+            TEST_ASSERT_TRUE(length > 0);
+            if (round == 0) {
+                rawBytes += payload.size();
+                deflateBytes += length;
+                std::vector<uint8_t> decoded;
+                FixedInflater inflater(output, length);
+                TEST_ASSERT_TRUE(inflater.inflate(decoded));
+                TEST_ASSERT_EQUAL_MEMORY(payload.data(), decoded.data(), payload.size());
+            }
+        }
+    }
+    double deflateUs = duration_cast<nanoseconds>(steady_clock::now() - started).count() / 1000.0 / ROUNDS;
+
+    for (const std::string& payload : payloads) {
+        gzipBytes += encoder.compress(DeflateContainer::GZIP, (const uint8_t*)payload.data(), payload.size(), output,
+                                      sizeof(output));
+    }
+
+    started = steady_clock::now();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (const std::string& payload : payloads) {
+            size_t length = lz.compress((const uint8_t*)payload.data(), payload.size(), output, sizeof(output));
+            if (round == 0) {
+                lzBytes += length;
+            }
+        }
+    }
+    double lzUs = duration_cast<nanoseconds>(steady_clock::now() - started).count() / 1000.0 / ROUNDS;
+
+    // The same points as one JSON object per sample, for comparison
+    size_t verboseRaw = 0;
+    size_t verboseBytes = 0;
+    for (int batch = 0; batch < 40; batch++) {
+        std::string verbose = "[";
+        for (int i = 0; i < 32; i++) {
+            char item[128];
+            snprintf(item, sizeof(item), "%s{\"pointId\":%d,\"value\":%d,\"timestamp\":%d}", i > 0 ? "," : "",
+                     i % 8, 2000 + i % 8 * 250 + (batch + i) % 8, batch * 32000 + i * 1000);
+            verbose += item;
+        }
+        verbose += "]";
+        verboseRaw += verbose.size();
+        verboseBytes += encoder.compress(DeflateContainer::RAW, (const uint8_t*)verbose.data(), verbose.size(),
+                                         output, sizeof(output));
+    }
+
+    double kb = rawBytes / 1024.0;
+    char message[160];
+    snprintf(message, sizeof(message), "%u payloads, %u bytes (avg %u per message)", (unsigned)payloads.size(),
+             (unsigned)rawBytes, (unsigned)(rawBytes / payloads.size()));
+    TEST_MESSAGE(message);
+    snprintf(message, sizeof(message), "deflate: %u bytes, ratio %.2fx, %.2f us/KB on host", (unsigned)deflateBytes,
+             (double)rawBytes / deflateBytes, deflateUs / kb);
+    TEST_MESSAGE(message);
+    snprintf(message, sizeof(message), "gzip (HTTP body): %u bytes, ratio %.2fx", (unsigned)gzipBytes,
+             (double)rawBytes / gzipBytes);
+    TEST_MESSAGE(message);
+    snprintf(message, sizeof(message), "LZSS (snapshot codec, not decodable by stock zlib): %u bytes, ratio %.2fx, %.2f us/KB",
+             (unsigned)lzBytes, (double)rawBytes / lzBytes, lzUs / kb);
+    TEST_MESSAGE(message);
+    snprintf(message, sizeof(message), "verbose JSON (object per sample): %u -> %u bytes, ratio %.2fx",
+             (unsigned)verboseRaw, (unsigned)verboseBytes, (double)verboseRaw / verboseBytes);
+    TEST_MESSAGE(message);
+
+    // The batch layout is already compact (point ids and time deltas), so
+    // most of the remaining redundancy is in digits and punctuation
+    TEST_ASSERT_TRUE(rawBytes * 2 > deflateBytes * 3);
+    TEST_ASSERT_TRUE(deflateBytes < lzBytes);
+}
+
+int runUnityTests() {
+    UNITY_BEGIN();
+    RUN_TEST(test_checksums);
+    RUN_TEST(test_raw_round_trip);
+    RUN_TEST(test_streaming_matches_one_shot_across_window);
+    RUN_TEST(test_gzip_and_zlib_framing);
+    RUN_TEST(test_one_shot_reports_overflow);
+    RUN_TEST(test_benchmark_recorded_payloads);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
@@ -0,0 +1,148 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/delta_update.cpp"
+#include "../../host/delta_diff.cpp"
+
+#include <unity.h>
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+#include "delta_update.h"
+
+// Firmware images under test. A real pair can be supplied with
+// -D DELTA_OLD_IMAGE=\"old.bin\" -D DELTA_NEW_IMAGE=\"new.bin\"
+static std::vector<uint8_t> oldImage;
+static std::vector<uint8_t> newImage;
+
+static bool loadFile(const char* path, std::vector<uint8_t>& out) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        out.insert(out.end(), buffer, buffer + n);
+    }
+    fclose(file);
+    return true;
+}
+
+// Synthetic pair: instruction-like data with scattered relocated constants,
+// one inserted function and one removed block
+static void makeSyntheticPair() {
+    uint32_t seed = 0x12345678;
+    oldImage.resize(512 * 1024);
+    for (size_t i = 0; i < oldImage.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        oldImage[i] = (seed >> 16) & 0x3F;
+    }
+
+    newImage = oldImage;
+    for (size_t i = 0; i < 400; i++) {
+        seed = seed * 1103515245 + 12345;
+        newImage[(seed >> 8) % newImage.size()] += 4;
+    }
+    std::vector<uint8_t> inserted(3000);
+    for (size_t i = 0; i < inserted.size(); i++) {
+        inserted[i] = (uint8_t)(i * 7);
+    }
+    newImage.insert(newImage.begin() + 200 * 1024, inserted.begin(), inserted.end());
+    newImage.erase(newImage.begin() + 380 * 1024, newImage.begin() + 381 * 1024);
+}
+
+static bool applyPatch(const std::vector<uint8_t>& patch, std::vector<uint8_t>& out, size_t chunkSize) {
+    DeltaPatcher patcher;
+    out.clear();
+    patcher.begin(
+        [](uint32_t offset, uint8_t* buffer, size_t length) {
+            memcpy(buffer, oldImage.data() + offset, length);
+            return true;
+        },
+        [&out](const uint8_t* data, size_t length) {
+            out.insert(out.end(), data, data + length);
+            return true;
+        },
+        (uint32_t)oldImage.size());
+
+    for (size_t i = 0; i < patch.size(); i += chunkSize) {
+        size_t n = patch.size() - i < chunkSize ? patch.size() - i : chunkSize;
+        if (!patcher.write(patch.data() + i, n)) {
+            return false;
+        }
+    }
+    return patcher.finish();
+}
+
+void test_patch_reconstructs_target() {
+    std::vector<uint8_t> patch = makeDeltaPatch(oldImage, newImage);
+    std::vector<uint8_t> out;
+    TEST_ASSERT_TRUE(applyPatch(patch, out, 1));
+    TEST_ASSERT_EQUAL(newImage.size(), out.size());
+    TEST_ASSERT_TRUE(out == newImage);
+    TEST_ASSERT_LESS_THAN(newImage.size() / 4, patch.size());
+}
+
+void test_corrupted_patch_is_rejected() {
+    std::vector<uint8_t> patch = makeDeltaPatch(oldImage, newImage);
+    patch[patch.size() - 10] ^= 0x55;
+    std::vector<uint8_t> out;
+    TEST_ASSERT_FALSE(applyPatch(patch, out, 1460));
+
+    std::vector<uint8_t> truncated(patch.begin(), patch.begin() + patch.size() / 2);
+    TEST_ASSERT_FALSE(applyPatch(truncated, out, 1460));
+
+    std::vector<uint8_t> badMagic = patch;
+    badMagic[0] = 'X';
+    TEST_ASSERT_FALSE(applyPatch(badMagic, out, 1460));
+}
+
+void test_benchmark_patch_apply() {
+    std::vector<uint8_t> patch = makeDeltaPatch(oldImage, newImage);
+    std::vector<uint8_t> out;
+    out.reserve(newImage.size());
+
+    const int rounds = 20;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        TEST_ASSERT_TRUE(applyPatch(patch, out, 1460));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    char message[200];
+    snprintf(message, sizeof(message),
+             "image %u B, patch %u B (%.1f%%), apply %.1f MB/s, patcher RAM %u B",
+             (unsigned)newImage.size(), (unsigned)patch.size(),
+             100.0 * patch.size() / newImage.size(),
+             rounds * newImage.size() / seconds / (1024.0 * 1024.0),
+             (unsigned)sizeof(DeltaPatcher));
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_THAN(2048, sizeof(DeltaPatcher));
+}
+
+int runUnityTests() {
+#if defined(DELTA_OLD_IMAGE) && defined(DELTA_NEW_IMAGE)
+    if (!loadFile(DELTA_OLD_IMAGE, oldImage) || !loadFile(DELTA_NEW_IMAGE, newImage)) {
+        makeSyntheticPair();
+    }
+#else
+    (void)loadFile;
+    makeSyntheticPair();
+#endif
+    UNITY_BEGIN();
+    RUN_TEST(test_patch_reconstructs_target);
+    RUN_TEST(test_corrupted_patch_is_rejected);
+    RUN_TEST(test_benchmark_patch_apply);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
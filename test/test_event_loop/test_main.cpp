@@ -0,0 +1,360 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/modbus_gateway.cpp"
+#ifdef __linux__
+#include "../../host/event_loop.cpp"
+#include "../../host/posix_serial.cpp"
+#include "../../host/bus_poller.cpp"
+#endif
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <memory>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include "../../host/event_loop.h"
+#include "../../host/bus_poller.h"
+
+static double cpuSeconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static void runFor(EventLoop& loop, uint32_t ms) {
+    uint32_t start = EventLoop::monotonicMs();
+    uint32_t elapsed;
+    while ((elapsed = EventLoop::monotonicMs() - start) < ms) {
+        loop.runOnce((int)(ms - elapsed));
+    }
+}
+
+void test_timers_fire_in_order() {
+    EventLoop loop;
+    TEST_ASSERT_TRUE(loop.begin());
+    std::vector<int> order;
+    loop.addTimer(30, 0, [&]() { order.push_back(30); });
+    loop.addTimer(10, 0, [&]() { order.push_back(10); });
+    uint32_t late = loop.addTimer(20, 0, [&]() { order.push_back(20); });
+    // Rearmed past the others
+    loop.rearmTimer(late, 50);
+    int periodic = 0;
+    uint32_t tick = loop.addTimer(5, 5, [&]() { periodic++; });
+    uint32_t disarmed = loop.addTimer(15, 0, [&]() { order.push_back(15); });
+    loop.rearmTimer(disarmed, EventLoop::NEVER);
+    uint32_t self = 0;
+    self = loop.addTimer(1, 1, [&]() {
+        order.push_back(1);
+        loop.removeTimer(self);
+    });
+
+    uint32_t start = EventLoop::monotonicMs();
+    runFor(loop, 60);
+    loop.removeTimer(tick);
+    TEST_ASSERT_EQUAL(4, (int)order.size());
+    TEST_ASSERT_EQUAL(1, order[0]);
+    TEST_ASSERT_EQUAL(10, order[1]);
+    TEST_ASSERT_EQUAL(30, order[2]);
+    TEST_ASSERT_EQUAL(20, order[3]);
+    TEST_ASSERT_INT_WITHIN(3, 12, periodic);
+    // Fired and disarmed one-shots stay registered until removed
+    TEST_ASSERT_EQUAL(4, (int)loop.getTimerCount());
+
+    // Rearmed from its own callback, a one-shot becomes a chain
+    int chain = 0;
+    uint32_t chained = 0;
+    chained = loop.addTimer(0, 0, [&]() {
+        if (++chain < 5) {
+            loop.rearmTimer(chained, 2);
+        }
+    });
+    runFor(loop, 30);
+    TEST_ASSERT_EQUAL(5, chain);
+    TEST_ASSERT_TRUE(EventLoop::monotonicMs() - start >= 90);
+}
+
+void test_descriptors_wake_the_loop() {
+    EventLoop loop;
+    TEST_ASSERT_TRUE(loop.begin());
+    int first[2];
+    int second[2];
+    TEST_ASSERT_EQUAL(0, pipe2(first, O_NONBLOCK));
+    TEST_ASSERT_EQUAL(0, pipe2(second, O_NONBLOCK));
+    int reads = 0;
+    TEST_ASSERT_TRUE(loop.watch(first[0], EPOLLIN, [&](uint32_t events) {
+        char buffer[16];
+        TEST_ASSERT_TRUE(events & EPOLLIN);
+        while (read(first[0], buffer, sizeof(buffer)) > 0) {
+        }
+        reads++;
+    }));
+    // Removes itself and the other watch: the other's pending event is skipped
+    int closed = 0;
+    TEST_ASSERT_TRUE(loop.watch(second[0], EPOLLIN, [&](uint32_t) {
+        closed++;
+        loop.unwatch(second[0]);
+        loop.unwatch(first[0]);
+    }));
+    TEST_ASSERT_FALSE(loop.watch(first[0], EPOLLIN, [](uint32_t) {}));
+
+    // Nothing to do: the wait runs its full length
+    uint32_t start = EventLoop::monotonicMs();
+    TEST_ASSERT_EQUAL(0, loop.runOnce(20));
+    TEST_ASSERT_UINT32_WITHIN(5, 22, EventLoop::monotonicMs() - start + 2);
+
+    TEST_ASSERT_EQUAL(1, (int)write(first[1], "x", 1));
+    TEST_ASSERT_EQUAL(1, loop.runOnce(100));
+    TEST_ASSERT_EQUAL(1, reads);
+
+    TEST_ASSERT_EQUAL(1, (int)write(second[1], "x", 1));
+    TEST_ASSERT_EQUAL(1, (int)write(first[1], "x", 1));
+    loop.runOnce(100);
+    TEST_ASSERT_EQUAL(1, closed);
+    TEST_ASSERT_EQUAL(0, (int)loop.getWatchCount());
+    TEST_ASSERT_EQUAL(0, loop.runOnce(10));
+
+    // stop() from a callback ends run()
+    loop.addTimer(5, 0, [&]() { loop.stop(); });
+    loop.run();
+    for (int fd : {first[0], first[1], second[0], second[1]}) {
+        close(fd);
+    }
+}
+
+// RTU slave on the far end of a pty: answers FC 3/4 reads for any unit,
+// register r of unit u holding u * 1000 + r
+class SimSlave {
+public:
+    SimSlave(EventLoop& loop, PosixSerialTransport& serial) : requests(0), loop(loop), serial(serial), length(0) {
+        loop.watch(serial.getFd(), EPOLLIN, [this](uint32_t) { receive(); });
+    }
+
+    ~SimSlave() {
+        loop.unwatch(serial.getFd());
+    }
+
+    static uint16_t valueOf(uint8_t unit, uint16_t reg) {
+        return (uint16_t)(unit * 1000 + reg);
+    }
+
+    uint32_t requests;
+
+private:
+    EventLoop& loop;
+    PosixSerialTransport& serial;
+    uint8_t request[64];
+    size_t length;
+
+    void receive() {
+        size_t count;
+        while ((count = serial.read(request + length, sizeof(request) - length)) > 0) {
+            length += count;
+        }
+        if (length < 8) {
+            return;
+        }
+        uint16_t crc = modbusCrc16(request, 6);
+        uint16_t start = (uint16_t)(request[2] << 8 | request[3]);
+        uint16_t registers = (uint16_t)(request[4] << 8 | request[5]);
+        length = 0;
+        if (request[6] != (uint8_t)crc || request[7] != (uint8_t)(crc >> 8)) {
+            return;
+        }
+        requests++;
+        uint8_t response[5 + 2 * ModbusRtuMaster::MAX_READ_REGISTERS];
+        response[0] = request[0];
+        response[1] = request[1];
+        response[2] = (uint8_t)(registers * 2);
+        for (uint16_t i = 0; i < registers; i++) {
+            uint16_t value = valueOf(request[0], (uint16_t)(start + i));
+            response[3 + i * 2] = (uint8_t)(value >> 8);
+            response[4 + i * 2] = (uint8_t)value;
+        }
+        size_t size = 3 + registers * 2;
+        crc = modbusCrc16(response, size);
+        response[size] = (uint8_t)crc;
+        response[size + 1] = (uint8_t)(crc >> 8);
+        serial.write(response, size + 2);
+    }
+};
+
+// Dozens of RS-485 lines with a few slaves each, every line on a pty pair
+// whose far end is a simulated slave in the same loop
+struct Site {
+    static const int LINES = 32;
+    static const int UNITS = 4;
+    static const uint16_t REGISTERS = 40;
+
+    EventLoop loop;
+    std::vector<std::unique_ptr<PosixSerialTransport>> ends;
+    std::vector<std::unique_ptr<SimSlave>> slaves;
+    std::vector<std::unique_ptr<BusPoller>> pollers;
+    uint64_t samples;
+    uint32_t wrong;
+
+    explicit Site(uint32_t intervalMs) : samples(0), wrong(0) {
+        TEST_ASSERT_TRUE(loop.begin());
+        for (int line = 0; line < LINES; line++) {
+            int master = posix_openpt(O_RDWR | O_NOCTTY);
+            TEST_ASSERT_TRUE(master >= 0 && grantpt(master) == 0 && unlockpt(master) == 0);
+            std::unique_ptr<PosixSerialTransport> slaveEnd(new PosixSerialTransport());
+            std::unique_ptr<PosixSerialTransport> masterEnd(new PosixSerialTransport());
+            TEST_ASSERT_TRUE(slaveEnd->open(ptsname(master), 0));
+            TEST_ASSERT_TRUE(masterEnd->adopt(master, 0));
+            slaves.push_back(std::unique_ptr<SimSlave>(new SimSlave(loop, *slaveEnd)));
+
+            std::unique_ptr<BusPoller> poller(new BusPoller(loop, *masterEnd, 115200));
+            for (int unit = 1; unit <= UNITS; unit++) {
+                uint16_t firstPoint = (uint16_t)((line * UNITS + unit - 1) * REGISTERS);
+                TEST_ASSERT_TRUE(poller->addBlock((uint8_t)unit, ModbusFunction::READ_HOLDING_REGISTERS, 0,
+                                                  REGISTERS, intervalMs, firstPoint) >= 0);
+            }
+            poller->setSampleCallback([this](const Sample* batch, size_t count) {
+                for (size_t i = 0; i < count; i++) {
+                    uint16_t block = batch[i].pointId / REGISTERS;
+                    uint8_t unit = (uint8_t)(block % UNITS + 1);
+                    if (batch[i].value != SimSlave::valueOf(unit, batch[i].pointId % REGISTERS)) {
+                        wrong++;
+                    }
+                }
+                samples += count;
+            });
+            TEST_ASSERT_TRUE(poller->begin());
+            pollers.push_back(std::move(poller));
+            ends.push_back(std::move(slaveEnd));
+            ends.push_back(std::move(masterEnd));
+        }
+    }
+
+    ~Site() {
+        // Before the pty ends they watch
+        pollers.clear();
+        slaves.clear();
+    }
+
+    uint32_t polls() const {
+        uint32_t total = 0;
+        for (const auto& poller : pollers) {
+            total += poller->getStats().polls;
+        }
+        return total;
+    }
+
+    uint32_t failures() const {
+        uint32_t total = 0;
+        for (const auto& poller : pollers) {
+            total += poller->getStats().failures;
+        }
+        return total;
+    }
+};
+
+struct LoadResult {
+    double cpuPercent;
+    double wakeupsPerSecond;
+};
+
+static LoadResult measure(EventLoop& loop, uint32_t ms) {
+    uint64_t wakeups = loop.getStats().wakeups;
+    double cpu = cpuSeconds();
+    runFor(loop, ms);
+    LoadResult result;
+    result.cpuPercent = (cpuSeconds() - cpu) * 100000.0 / ms;
+    result.wakeupsPerSecond = (loop.getStats().wakeups - wakeups) * 1000.0 / ms;
+    return result;
+}
+
+void test_site_load_and_idle_cost() {
+    char message[192];
+    const int points = Site::LINES * Site::UNITS * Site::REGISTERS;
+
+    // Under load: every block every 250 ms, 20480 points per second
+    {
+        Site site(250);
+        runFor(site.loop, 100);
+        uint32_t polls = site.polls();
+        uint64_t samples = site.samples;
+        LoadResult load = measure(site.loop, 2000);
+        uint32_t expected = Site::LINES * Site::UNITS * 2000 / 250;
+        TEST_ASSERT_UINT32_WITHIN(expected / 10, expected, site.polls() - polls);
+        TEST_ASSERT_EQUAL_UINT32(0, site.failures());
+        TEST_ASSERT_EQUAL_UINT32(0, site.wrong);
+        // Every finished poll delivered its block; at most one per line is on the wire
+        TEST_ASSERT_UINT32_WITHIN(Site::LINES * Site::REGISTERS, site.polls() * Site::REGISTERS,
+                                  (uint32_t)site.samples);
+        uint32_t exchanges = 0;
+        uint32_t busyMs = 0;
+        for (const auto& poller : site.pollers) {
+            exchanges += poller->getBusStats().transactions;
+            busyMs += poller->getBusStats().busyMs;
+        }
+        snprintf(message, sizeof(message),
+                 "load: %d lines, %d points every 250 ms: %.0f samples/s, %.1f%% cpu (slaves included), "
+                 "%.0f wakeups/s, %.2f ms per exchange",
+                 Site::LINES, points, (site.samples - samples) / 2.0, load.cpuPercent, load.wakeupsPerSecond,
+                 exchanges ? (double)busyMs / exchanges : 0.0);
+        TEST_MESSAGE(message);
+    }
+
+    // Idle: after the first round nothing is due for a minute
+    {
+        Site site(60000);
+        runFor(site.loop, 300);
+        TEST_ASSERT_EQUAL_UINT32(Site::LINES * Site::UNITS, site.polls());
+        TEST_ASSERT_EQUAL((uint64_t)points, site.samples);
+        LoadResult idle = measure(site.loop, 1000);
+        TEST_ASSERT_TRUE(idle.wakeupsPerSecond < 2);
+        snprintf(message, sizeof(message), "idle: %.2f%% cpu, %.0f wakeups/s", idle.cpuPercent,
+                 idle.wakeupsPerSecond);
+        TEST_MESSAGE(message);
+
+        // The same lines serviced like the firmware loop: every line read
+        // every 10 ms whether or not anything arrived
+        double cpu = cpuSeconds();
+        uint32_t start = EventLoop::monotonicMs();
+        uint32_t wakeups = 0;
+        uint8_t buffer[64];
+        while (EventLoop::monotonicMs() - start < 1000) {
+            for (size_t i = 1; i < site.ends.size(); i += 2) {
+                site.ends[i]->read(buffer, sizeof(buffer));
+            }
+            wakeups++;
+            usleep(10000);
+        }
+        double polledCpu = (cpuSeconds() - cpu) * 100000.0 / (EventLoop::monotonicMs() - start);
+        snprintf(message, sizeof(message),
+                 "idle, polled every 10 ms: %.2f%% cpu, %u wakeups/s, up to 10 ms added to each response",
+                 polledCpu, (unsigned)wakeups);
+        TEST_MESSAGE(message);
+        TEST_ASSERT_TRUE(wakeups > 50 * idle.wakeupsPerSecond);
+    }
+}
+#endif
+
+int runUnityTests() {
+    UNITY_BEGIN();
+#ifdef __linux__
+    RUN_TEST(test_timers_fire_in_order);
+    RUN_TEST(test_descriptors_wake_the_loop);
+    RUN_TEST(test_site_load_and_idle_cost);
+#endif
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
@@ -0,0 +1,398 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/modbus_gateway.cpp"
+#include "../../src/modbus_commands.cpp"
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "modbus_commands.h"
+
+static uint32_t fakeNow = 0;
+static uint32_t fakeClock() {
+    return fakeNow;
+}
+
+// Two RTU slaves (units 1 and 2) sharing a 9600 baud line
+class SimulatedBus : public ModbusSerial {
+public:
+    static const uint32_t BAUD = 9600;
+    static const uint32_t TURNAROUND_MS = 5;
+    static const uint16_t REGISTER_COUNT = 200;
+
+    uint16_t holding[3][REGISTER_COUNT];
+    bool online;
+    int dropRequests;           // requests to ignore before answering again
+    int stuckRegister;          // ignores writes when >= 0
+    uint32_t wireMs;
+    std::vector<std::vector<uint8_t>> requests;
+
+    SimulatedBus() : online(true), dropRequests(0), stuckRegister(-1), wireMs(0), readyAt(0) {
+        memset(holding, 0, sizeof(holding));
+    }
+
+    static uint32_t frameMs(size_t bytes) {
+        return (uint32_t)((bytes * 10 * 1000 + BAUD - 1) / BAUD);
+    }
+
+    bool write(const uint8_t* data, size_t length) override {
+        requests.push_back(std::vector<uint8_t>(data, data + length));
+        wireMs += frameMs(length);
+        uint8_t unit = data[0];
+        if (!online || unit == 0 || unit > 2) {
+            return true;
+        }
+        if (dropRequests > 0) {
+            dropRequests--;
+            return true;
+        }
+        uint8_t function = data[1];
+        uint16_t start = getU16(data + 2);
+        uint16_t count = getU16(data + 4);
+        uint16_t* table = holding[unit];
+        response.clear();
+        response.push_back(unit);
+        if (function == ModbusFunction::READ_HOLDING_REGISTERS) {
+            response.push_back(function);
+            response.push_back((uint8_t)(count * 2));
+            for (uint16_t i = 0; i < count; i++) {
+                response.push_back((uint8_t)(table[start + i] >> 8));
+                response.push_back((uint8_t)table[start + i]);
+            }
+        } else if (function == ModbusFunction::WRITE_SINGLE_REGISTER) {
+            if ((int)start != stuckRegister) {
+                table[start] = count;
+            }
+            response.insert(response.end(), data + 1, data + 6);
+        } else if (function == ModbusFunction::WRITE_MULTIPLE_REGISTERS) {
+            for (uint16_t i = 0; i < count; i++) {
+                if ((int)(start + i) != stuckRegister) {
+                    table[start + i] = getU16(data + 7 + i * 2);
+                }
+            }
+            response.insert(response.end(), data + 1, data + 6);
+        }
+        uint16_t crc = modbusCrc16(response.data(), response.size());
+        response.push_back((uint8_t)crc);
+        response.push_back((uint8_t)(crc >> 8));
+        wireMs += frameMs(response.size());
+        readyAt = fakeNow + frameMs(length) + TURNAROUND_MS + frameMs(response.size());
+        return true;
+    }
+
+    int read(uint8_t* data, size_t capacity) override {
+        if (response.empty() || fakeNow < readyAt || capacity < response.size()) {
+            return 0;
+        }
+        size_t length = response.size();
+        memcpy(data, response.data(), length);
+        response.clear();
+        return (int)length;
+    }
+
+    uint32_t getBaud() const override {
+        return BAUD;
+    }
+
+private:
+    std::vector<uint8_t> response;
+    uint32_t readyAt;
+};
+
+static ModbusCommand makeCommand(const char* id, uint8_t unit, uint16_t start, std::vector<uint16_t> values,
+                                 uint8_t priority = 5, bool verify = true) {
+    ModbusCommand command;
+    memset(&command, 0, sizeof(command));
+    strncpy(command.id, id, sizeof(command.id) - 1);
+    command.unit = unit;
+    command.start = start;
+    command.count = (uint16_t)values.size();
+    for (size_t i = 0; i < values.size() && i < ModbusRtuMaster::MAX_WRITE_REGISTERS; i++) {
+        command.values[i] = values[i];
+    }
+    command.priority = priority;
+    command.verify = verify;
+    return command;
+}
+
+struct CommandFixture {
+    SimulatedBus bus;
+    ModbusRtuMaster master;
+    ModbusCommandQueue queue;
+    std::vector<ModbusCommandAck> acks;
+
+    CommandFixture() : master(bus), queue(master) {
+        master.setClock(fakeClock);
+        queue.setClock(fakeClock);
+        queue.addWritableRange(1, 0, 100);
+        queue.addWritableRange(2, 0, 100);
+        queue.setAckCallback([this](const ModbusCommandAck& ack) { acks.push_back(ack); });
+    }
+
+    // Bus to itself: every idle moment goes to the queue
+    void run(uint32_t ms) {
+        for (uint32_t i = 0; i < ms; i++) {
+            master.update();
+            queue.update();
+            queue.dispatch(fakeNow, RegisterCache::NO_POLL_DUE);
+            fakeNow++;
+        }
+    }
+
+    const ModbusCommandAck* ack(const char* id) const {
+        for (size_t i = 0; i < acks.size(); i++) {
+            if (strcmp(acks[i].id, id) == 0) {
+                return &acks[i];
+            }
+        }
+        return nullptr;
+    }
+};
+
+void test_commands_are_validated() {
+    fakeNow = 100;
+    CommandFixture fixture;
+    TEST_ASSERT_FALSE(fixture.queue.submit(makeCommand("broadcast", 0, 10, {1})));
+    TEST_ASSERT_FALSE(fixture.queue.submit(makeCommand("empty", 1, 10, {})));
+    TEST_ASSERT_FALSE(fixture.queue.submit(makeCommand("outside", 1, 99, {1, 2})));
+    TEST_ASSERT_FALSE(fixture.queue.submit(makeCommand("unit3", 3, 10, {1})));
+    TEST_ASSERT_FALSE(fixture.queue.submit(makeCommand("", 1, 10, {1})));
+    TEST_ASSERT_EQUAL(5, fixture.acks.size());
+    TEST_ASSERT_EQUAL(CommandStatus::REJECTED, fixture.ack("outside")->status);
+    TEST_ASSERT_EQUAL(0, fixture.queue.getPendingCount());
+
+    for (size_t i = 0; i < ModbusCommandQueue::MAX_COMMANDS; i++) {
+        char id[16];
+        snprintf(id, sizeof(id), "c%u", (unsigned)i);
+        TEST_ASSERT_TRUE(fixture.queue.submit(makeCommand(id, 1, (uint16_t)(i * 4), {(uint16_t)i})));
+    }
+    TEST_ASSERT_FALSE(fixture.queue.submit(makeCommand("overflow", 1, 90, {1})));
+    TEST_ASSERT_EQUAL(CommandStatus::QUEUE_FULL, fixture.ack("overflow")->status);
+    TEST_ASSERT_EQUAL(6, fixture.queue.getStats().rejected);
+
+    // Nothing reaches the bus before its expiry when the bus is never idle
+    fakeNow += ModbusCommandQueue::DEFAULT_EXPIRY_MS;
+    fixture.queue.update();
+    TEST_ASSERT_EQUAL(CommandStatus::EXPIRED, fixture.ack("c0")->status);
+    TEST_ASSERT_EQUAL(0, fixture.queue.getPendingCount());
+    TEST_ASSERT_EQUAL(0, fixture.bus.requests.size());
+}
+
+void test_adjacent_writes_are_merged_and_verified() {
+    fakeNow = 1000;
+    CommandFixture fixture;
+    TEST_ASSERT_TRUE(fixture.queue.submit(makeCommand("a", 1, 10, {100})));
+    TEST_ASSERT_TRUE(fixture.queue.submit(makeCommand("b", 1, 11, {110, 120})));
+    TEST_ASSERT_TRUE(fixture.queue.submit(makeCommand("c", 1, 13, {130})));
+    // Newer value for register 11 wins over "b"
+    TEST_ASSERT_TRUE(fixture.queue.submit(makeCommand("d", 1, 11, {999}, 5, false)));
+    // Not adjacent: its own FC06 write
+    TEST_ASSERT_TRUE(fixture.queue.submit(makeCommand("e", 1, 40, {400})));
+    fixture.run(500);
+
+    TEST_ASSERT_EQUAL(5, fixture.acks.size());
+    for (size_t i = 0; i < fixture.acks.size(); i++) {
+        TEST_ASSERT_EQUAL(CommandStatus::OK, fixture.acks[i].status);
+        TEST_ASSERT_EQUAL(1, fixture.acks[i].attempts);
+    }
+    TEST_ASSERT_EQUAL(100, fixture.bus.holding[1][10]);
+    TEST_ASSERT_EQUAL(999, fixture.bus.holding[1][11]);
+    TEST_ASSERT_EQUAL(120, fixture.bus.holding[1][12]);
+    TEST_ASSERT_EQUAL(130, fixture.bus.holding[1][13]);
+    TEST_ASSERT_EQUAL(400, fixture.bus.holding[1][40]);
+
+    // FC16 10..13 and its read-back, then FC06 40 and its read-back
+    TEST_ASSERT_EQUAL(2, fixture.queue.getStats().writes);
+    TEST_ASSERT_EQUAL(4, fixture.queue.getStats().merged);
+    TEST_ASSERT_EQUAL(4, fixture.bus.requests.size());
+    TEST_ASSERT_EQUAL_HEX8(ModbusFunction::WRITE_MULTIPLE_REGISTERS, fixture.bus.requests[0][1]);
+    TEST_ASSERT_EQUAL(4, getU16(fixture.bus.requests[0].data() + 4));
+    TEST_ASSERT_EQUAL_HEX8(ModbusFunction::READ_HOLDING_REGISTERS, fixture.bus.requests[1][1]);
+    TEST_ASSERT_EQUAL_HEX8(ModbusFunction::WRITE_SINGLE_REGISTER, fixture.bus.requests[2][1]);
+}
+
+void test_verify_retry_and_failures() {
+    fakeNow = 5000;
+    CommandFixture fixture;
+    uint32_t invalidated = 0;
+    fixture.queue.setWriteCallback([&](uint8_t, uint16_t, uint16_t count) { invalidated += count; });
+
+    // A register the slave refuses to change fails its read-back only
+    fixture.bus.stuckRegister = 21;
+    TEST_ASSERT_TRUE(fixture.queue.submit(makeCommand("ok", 1, 20, {7})));
+    TEST_ASSERT_TRUE(fixture.queue.submit(makeCommand("stuck", 1, 21, {8})));
+    fixture.run(500);
+    TEST_ASSERT_EQUAL(CommandStatus::OK, fixture.ack("ok")->status);
+    TEST_ASSERT_EQUAL(CommandStatus::VERIFY_FAILED, fixture.ack("stuck")->status);
+    TEST_ASSERT_EQUAL(2, invalidated);
+
+    // One lost request is retried
+    fixture.bus.dropRequests = 1;
+    TEST_ASSERT_TRUE(fixture.queue.submit(makeCommand("retried", 2, 5, {55})));
+    fixture.run(1000);
+    TEST_ASSERT_EQUAL(CommandStatus::OK, fixture.ack("retried")->status);
+    TEST_ASSERT_EQUAL(2, fixture.ack("retried")->attempts);
+    TEST_ASSERT_EQUAL(55, fixture.bus.holding[2][5]);
+
+    // A dead slave gives up after MAX_ATTEMPTS
+    fixture.bus.online = false;
+    TEST_ASSERT_TRUE(fixture.queue.submit(makeCommand("dead", 2, 6, {66})));
+    fixture.run(2000);
+    TEST_ASSERT_EQUAL(CommandStatus::EXCEPTION, fixture.ack("dead")->status);
+    TEST_ASSERT_EQUAL_HEX8(ModbusException::TIMEOUT, fixture.ack("dead")->exception);
+    TEST_ASSERT_EQUAL(ModbusCommandQueue::MAX_ATTEMPTS, fixture.ack("dead")->attempts);
+    TEST_ASSERT_GREATER_OR_EQUAL(2 * ModbusRtuMaster::DEFAULT_RESPONSE_TIMEOUT_MS, fixture.ack("dead")->latencyMs);
+    TEST_ASSERT_FALSE(fixture.queue.isActive());
+}
+
+void test_priority_and_slave_rotation() {
+    fakeNow = 9000;
+    CommandFixture fixture;
+    TEST_ASSERT_TRUE(fixture.queue.submit(makeCommand("u1-a", 1, 0, {1}, 5, false)));
+    TEST_ASSERT_TRUE(fixture.queue.submit(makeCommand("u1-b", 1, 50, {2}, 5, false)));
+    TEST_ASSERT_TRUE(fixture.queue.submit(makeCommand("u1-c", 1, 70, {3}, 5, false)));
+    TEST_ASSERT_TRUE(fixture.queue.submit(makeCommand("u2-a", 2, 0, {4}, 5, false)));
+    TEST_ASSERT_TRUE(fixture.queue.submit(makeCommand("u2-b", 2, 50, {5}, 5, false)));
+    TEST_ASSERT_TRUE(fixture.queue.submit(makeCommand("stop", 2, 90, {0}, ModbusCommandQueue::URGENT_PRIORITY, false)));
+    fixture.run(1000);
+
+    const char* expected[] = { "stop", "u1-a", "u2-a", "u1-b", "u2-b", "u1-c" };
+    TEST_ASSERT_EQUAL(6, fixture.acks.size());
+    for (size_t i = 0; i < 6; i++) {
+        TEST_ASSERT_EQUAL_STRING(expected[i], fixture.acks[i].id);
+    }
+}
+
+struct LoadResult {
+    double meanLatencyMs;
+    uint32_t p95LatencyMs;
+    uint32_t maxLatencyMs;
+    uint32_t maxPollLateMs;
+    uint32_t completed;
+};
+
+// Two blocks polled every 500 ms while commands arrive about every 700 ms
+static LoadResult runLoad(bool commands, bool respectPolls) {
+    fakeNow = 1;
+    SimulatedBus bus;
+    ModbusRtuMaster master(bus);
+    master.setClock(fakeClock);
+    PosixModbusServerPort port;
+    ModbusTcpGateway gateway(port, master);
+    gateway.setClock(fakeClock);
+    gateway.getCache().addBlock(1, ModbusFunction::READ_HOLDING_REGISTERS, 100, 20, 1000, 500);
+    gateway.getCache().addBlock(2, ModbusFunction::READ_HOLDING_REGISTERS, 100, 20, 1000, 500);
+    gateway.begin(0);
+
+    ModbusCommandQueue queue(master);
+    queue.setClock(fakeClock);
+    queue.addWritableRange(1, 0, 100);
+    queue.addWritableRange(2, 0, 100);
+    std::vector<uint32_t> latencies;
+    queue.setAckCallback([&](const ModbusCommandAck& ack) {
+        if (ack.status == CommandStatus::OK) {
+            latencies.push_back(ack.latencyMs);
+        }
+    });
+    queue.setWriteCallback([&](uint8_t unit, uint16_t start, uint16_t count) {
+        gateway.getCache().invalidate(unit, ModbusFunction::READ_HOLDING_REGISTERS, start, count);
+    });
+    gateway.setIdleTask([&](uint32_t now, uint32_t pollDueInMs) {
+        return queue.dispatch(now, respectPolls ? pollDueInMs : RegisterCache::NO_POLL_DUE);
+    });
+
+    uint32_t lastRefresh[2] = { 0, 0 };
+    uint32_t maxLate = 0;
+    gateway.setBlockCallback([&](size_t block, const uint16_t*, uint16_t, uint32_t sampledAt) {
+        // Skip the start-up polls
+        if (lastRefresh[block] != 0 && fakeNow > 2000) {
+            uint32_t interval = sampledAt - lastRefresh[block];
+            if (interval > 500 && interval - 500 > maxLate) {
+                maxLate = interval - 500;
+            }
+        }
+        lastRefresh[block] = sampledAt;
+    });
+
+    uint32_t seed = 12345;
+    uint32_t nextCommandAt = 1500;
+    int sent = 0;
+    while (fakeNow < 120000) {
+        if (commands && fakeNow >= nextCommandAt) {
+            char id[16];
+            snprintf(id, sizeof(id), "cmd-%d", sent);
+            seed = seed * 1103515245u + 12345u;
+            uint8_t unit = (uint8_t)(1 + (seed >> 16) % 2);
+            uint16_t count = (uint16_t)(1 + (seed >> 20) % 4);
+            std::vector<uint16_t> values(count, (uint16_t)sent);
+            queue.submit(makeCommand(id, unit, (uint16_t)((seed >> 8) % 90), values));
+            sent++;
+            nextCommandAt = fakeNow + 200 + (seed >> 12) % 1000;
+        }
+        queue.update();
+        gateway.update();
+        fakeNow++;
+    }
+
+    LoadResult result;
+    std::sort(latencies.begin(), latencies.end());
+    double sum = 0;
+    for (size_t i = 0; i < latencies.size(); i++) {
+        sum += latencies[i];
+    }
+    result.completed = (uint32_t)latencies.size();
+    result.meanLatencyMs = latencies.empty() ? 0 : sum / latencies.size();
+    result.p95LatencyMs = latencies.empty() ? 0 : latencies[latencies.size() * 95 / 100];
+    result.maxLatencyMs = latencies.empty() ? 0 : latencies.back();
+    result.maxPollLateMs = maxLate;
+    return result;
+}
+
+void test_latency_against_polling_schedule() {
+    LoadResult baseline = runLoad(false, true);
+    LoadResult scheduled = runLoad(true, true);
+    LoadResult greedy = runLoad(true, false);
+
+    char message[200];
+    snprintf(message, sizeof(message), "polls only:        max poll lateness %u ms", (unsigned)baseline.maxPollLateMs);
+    TEST_MESSAGE(message);
+    snprintf(message, sizeof(message), "fit between polls: %u commands, latency mean %.1f / p95 %u / max %u ms, max poll lateness %u ms",
+             (unsigned)scheduled.completed, scheduled.meanLatencyMs, (unsigned)scheduled.p95LatencyMs,
+             (unsigned)scheduled.maxLatencyMs, (unsigned)scheduled.maxPollLateMs);
+    TEST_MESSAGE(message);
+    snprintf(message, sizeof(message), "first idle moment: %u commands, latency mean %.1f / p95 %u / max %u ms, max poll lateness %u ms",
+             (unsigned)greedy.completed, greedy.meanLatencyMs, (unsigned)greedy.p95LatencyMs,
+             (unsigned)greedy.maxLatencyMs, (unsigned)greedy.maxPollLateMs);
+    TEST_MESSAGE(message);
+
+    TEST_ASSERT_GREATER_THAN(100, scheduled.completed);
+    TEST_ASSERT_EQUAL(greedy.completed, scheduled.completed);
+    // Commands wait at most the deferral limit plus one exchange
+    TEST_ASSERT_LESS_OR_EQUAL(ModbusCommandQueue::MAX_DEFER_MS + 150, scheduled.maxLatencyMs);
+    // Polls stay within a few ms of their period; writes on the first idle moment push them back
+    TEST_ASSERT_LESS_OR_EQUAL(baseline.maxPollLateMs + 5, scheduled.maxPollLateMs);
+    TEST_ASSERT_GREATER_THAN(scheduled.maxPollLateMs, greedy.maxPollLateMs);
+}
+
+int runUnityTests() {
+    UNITY_BEGIN();
+    RUN_TEST(test_commands_are_validated);
+    RUN_TEST(test_adjacent_writes_are_merged_and_verified);
+    RUN_TEST(test_verify_retry_and_failures);
+    RUN_TEST(test_priority_and_slave_rotation);
+    RUN_TEST(test_latency_against_polling_schedule);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
@@ -0,0 +1,493 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/modbus_gateway.cpp"
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "modbus_gateway.h"
+
+static uint32_t fakeNow = 0;
+static uint32_t fakeClock() {
+    return fakeNow;
+}
+
+// RTU slave behind a 9600 baud line: the reply becomes readable once the
+// request and the response would both have crossed the wire
+class SimulatedRtuSlave : public ModbusSerial {
+public:
+    static const uint32_t BAUD = 9600;
+    static const uint32_t TURNAROUND_MS = 5;
+    static const uint16_t REGISTER_COUNT = 1000;
+
+    uint8_t unit;
+    bool online;
+    uint16_t holding[REGISTER_COUNT];
+    uint16_t input[REGISTER_COUNT];
+    uint32_t requests;
+    uint32_t wireMs;
+
+    SimulatedRtuSlave() : unit(1), online(true), requests(0), wireMs(0), readyAt(0) {
+        for (uint16_t i = 0; i < REGISTER_COUNT; i++) {
+            holding[i] = (uint16_t)(i * 3);
+            input[i] = (uint16_t)(1000 + i);
+        }
+    }
+
+    static uint32_t frameMs(size_t bytes) {
+        return (uint32_t)((bytes * 10 * 1000 + BAUD - 1) / BAUD);
+    }
+
+    bool write(const uint8_t* data, size_t length) override {
+        requests++;
+        wireMs += frameMs(length);
+        uint16_t crc = modbusCrc16(data, length - 2);
+        if (!online || data[0] != unit || data[length - 2] != (uint8_t)crc || data[length - 1] != (uint8_t)(crc >> 8)) {
+            return true;
+        }
+        uint8_t function = data[1];
+        uint16_t start = getU16(data + 2);
+        uint16_t count = getU16(data + 4);
+        response.clear();
+        response.push_back(unit);
+        if ((uint32_t)start + (function == ModbusFunction::WRITE_SINGLE_REGISTER ? 1 : count) > REGISTER_COUNT) {
+            response.push_back((uint8_t)(function | 0x80));
+            response.push_back(ModbusException::ILLEGAL_DATA_ADDRESS);
+        } else if (function == ModbusFunction::READ_HOLDING_REGISTERS || function == ModbusFunction::READ_INPUT_REGISTERS) {
+            const uint16_t* table = function == ModbusFunction::READ_HOLDING_REGISTERS ? holding : input;
+            response.push_back(function);
+            response.push_back((uint8_t)(count * 2));
+            for (uint16_t i = 0; i < count; i++) {
+                response.push_back((uint8_t)(table[start + i] >> 8));
+                response.push_back((uint8_t)table[start + i]);
+            }
+        } else if (function == ModbusFunction::WRITE_SINGLE_REGISTER) {
+            holding[start] = count;
+            response.insert(response.end(), data + 1, data + 6);
+        } else if (function == ModbusFunction::WRITE_MULTIPLE_REGISTERS) {
+            for (uint16_t i = 0; i < count; i++) {
+                holding[start + i] = getU16(data + 7 + i * 2);
+            }
+            response.insert(response.end(), data + 1, data + 6);
+        }
+        uint16_t responseCrc = modbusCrc16(response.data(), response.size());
+        response.push_back((uint8_t)responseCrc);
+        response.push_back((uint8_t)(responseCrc >> 8));
+        wireMs += frameMs(response.size());
+        readyAt = fakeNow + frameMs(length) + TURNAROUND_MS + frameMs(response.size());
+        return true;
+    }
+
+    int read(uint8_t* data, size_t capacity) override {
+        if (response.empty() || fakeNow < readyAt || capacity < response.size()) {
+            return 0;
+        }
+        size_t length = response.size();
+        memcpy(data, response.data(), length);
+        response.clear();
+        return (int)length;
+    }
+
+    uint32_t getBaud() const override {
+        return BAUD;
+    }
+
+private:
+    std::vector<uint8_t> response;
+    uint32_t readyAt;
+};
+
+static int connectClient(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void sendRequest(int fd, uint16_t transaction, uint8_t unit, const uint8_t* pdu, size_t length) {
+    uint8_t frame[260];
+    putU16(frame, transaction);
+    putU16(frame + 2, 0);
+    putU16(frame + 4, (uint16_t)(length + 1));
+    frame[6] = unit;
+    memcpy(frame + 7, pdu, length);
+    send(fd, frame, 7 + length, 0);
+}
+
+static void sendRead(int fd, uint16_t transaction, uint8_t function, uint16_t start, uint16_t count) {
+    uint8_t pdu[5] = { function };
+    putU16(pdu + 1, start);
+    putU16(pdu + 3, count);
+    sendRequest(fd, transaction, 1, pdu, sizeof(pdu));
+}
+
+// Polls one client for a complete MBAP frame without blocking
+struct TcpClient {
+    int fd;
+    uint8_t frame[260];
+    size_t length;
+
+    bool poll() {
+        ssize_t received = recv(fd, frame + length, sizeof(frame) - length, MSG_DONTWAIT);
+        if (received > 0) {
+            length += (size_t)received;
+        }
+        return length >= 6 && length >= 6 + (size_t)getU16(frame + 4);
+    }
+
+    uint16_t value(size_t index) const {
+        return getU16(frame + 9 + index * 2);
+    }
+};
+
+// Runs the gateway on the virtual clock until every client has a reply
+static bool pumpUntilAnswered(ModbusTcpGateway& gateway, TcpClient* clients, size_t count, uint32_t limitMs = 2000) {
+    for (uint32_t elapsed = 0; elapsed < limitMs; elapsed++) {
+        gateway.update();
+        bool done = true;
+        for (size_t i = 0; i < count; i++) {
+            done = clients[i].poll() && done;
+        }
+        if (done) {
+            return true;
+        }
+        fakeNow++;
+    }
+    return false;
+}
+
+static void pump(ModbusTcpGateway& gateway, uint32_t ms) {
+    for (uint32_t i = 0; i < ms; i++) {
+        gateway.update();
+        fakeNow++;
+    }
+}
+
+struct GatewayFixture {
+    SimulatedRtuSlave slave;
+    ModbusRtuMaster master;
+    PosixModbusServerPort port;
+    ModbusTcpGateway gateway;
+
+    GatewayFixture() : master(slave), gateway(port, master) {
+        master.setClock(fakeClock);
+        gateway.setClock(fakeClock);
+    }
+
+    bool start() {
+        return gateway.begin(0);
+    }
+
+    TcpClient connectTo() {
+        TcpClient client;
+        client.fd = connectClient(port.getLocalPort());
+        client.length = 0;
+        // Let the gateway accept before anything is sent
+        gateway.update();
+        return client;
+    }
+};
+
+void test_crc_and_rtu_master() {
+    const uint8_t request[] = { 0x01, 0x03, 0x00, 0x00, 0x00, 0x0A };
+    TEST_ASSERT_EQUAL_HEX16(0xCDC5, modbusCrc16(request, sizeof(request)));
+
+    fakeNow = 0;
+    SimulatedRtuSlave slave;
+    ModbusRtuMaster master(slave);
+    master.setClock(fakeClock);
+
+    uint8_t lastException = 0xFF;
+    uint16_t lastValues[4] = { 0 };
+    ModbusRtuMaster::Callback done = [&](uint8_t exception, const uint16_t* values, uint16_t count) {
+        lastException = exception;
+        for (uint16_t i = 0; values && i < count && i < 4; i++) {
+            lastValues[i] = values[i];
+        }
+    };
+
+    TEST_ASSERT_TRUE(master.read(1, ModbusFunction::READ_HOLDING_REGISTERS, 10, 4, done));
+    TEST_ASSERT_TRUE(master.isBusy());
+    TEST_ASSERT_FALSE(master.read(1, ModbusFunction::READ_HOLDING_REGISTERS, 0, 1, done));
+    while (master.isBusy() && fakeNow < 1000) {
+        fakeNow++;
+        master.update();
+    }
+    TEST_ASSERT_EQUAL(ModbusException::NONE, lastException);
+    TEST_ASSERT_EQUAL(30, lastValues[0]);
+    TEST_ASSERT_EQUAL(39, lastValues[3]);
+    // 3.5 character gap, then 8 + 13 bytes at 9600 baud plus the turnaround
+    TEST_ASSERT_INT_WITHIN(2, 32, (int)fakeNow);
+
+    // Slave exceptions are passed through
+    TEST_ASSERT_TRUE(master.read(1, ModbusFunction::READ_INPUT_REGISTERS, 999, 2, done));
+    while (master.isBusy() && fakeNow < 2000) {
+        fakeNow++;
+        master.update();
+    }
+    TEST_ASSERT_EQUAL(ModbusException::ILLEGAL_DATA_ADDRESS, lastException);
+
+    // A silent slave times out
+    slave.online = false;
+    uint32_t sent = fakeNow;
+    TEST_ASSERT_TRUE(master.write(1, 5, lastValues, 2, done));
+    while (master.isBusy() && fakeNow < 5000) {
+        fakeNow++;
+        master.update();
+    }
+    TEST_ASSERT_EQUAL(ModbusException::TIMEOUT, lastException);
+    TEST_ASSERT_GREATER_OR_EQUAL(ModbusRtuMaster::DEFAULT_RESPONSE_TIMEOUT_MS, fakeNow - sent);
+    TEST_ASSERT_EQUAL(1, master.getStats().timeouts);
+    TEST_ASSERT_EQUAL(1, master.getStats().exceptions);
+}
+
+void test_reads_are_served_from_cache() {
+    fakeNow = 1;
+    GatewayFixture fixture;
+    TEST_ASSERT_EQUAL(0, fixture.gateway.getCache().addBlock(1, ModbusFunction::READ_HOLDING_REGISTERS, 0, 20, 2000, 1000));
+    TEST_ASSERT_TRUE(fixture.start());
+    TcpClient client = fixture.connectTo();
+    TEST_ASSERT_TRUE(client.fd >= 0);
+
+    // The poller fills the block right away
+    pump(fixture.gateway, 100);
+    TEST_ASSERT_EQUAL(1, fixture.slave.requests);
+
+    sendRead(client.fd, 7, ModbusFunction::READ_HOLDING_REGISTERS, 4, 6);
+    TEST_ASSERT_TRUE(pumpUntilAnswered(fixture.gateway, &client, 1));
+    TEST_ASSERT_EQUAL(7, getU16(client.frame));
+    TEST_ASSERT_EQUAL(ModbusFunction::READ_HOLDING_REGISTERS, client.frame[7]);
+    TEST_ASSERT_EQUAL(12, client.frame[8]);
+    TEST_ASSERT_EQUAL(12, client.value(0));
+    TEST_ASSERT_EQUAL(27, client.value(5));
+    TEST_ASSERT_EQUAL(1, fixture.slave.requests);
+    TEST_ASSERT_EQUAL(1, fixture.gateway.getStats().cacheHits);
+
+    // The poller refreshes the block in the background; TCP reads never touch the bus
+    fixture.slave.holding[4] = 4444;
+    for (int i = 0; i < 10; i++) {
+        pump(fixture.gateway, 500);
+        client.length = 0;
+        sendRead(client.fd, (uint16_t)(100 + i), ModbusFunction::READ_HOLDING_REGISTERS, 0, 20);
+        TEST_ASSERT_TRUE(pumpUntilAnswered(fixture.gateway, &client, 1));
+    }
+    TEST_ASSERT_EQUAL(4444, client.value(4));
+    TEST_ASSERT_EQUAL(6, fixture.slave.requests);
+    TEST_ASSERT_EQUAL(11, fixture.gateway.getStats().cacheHits);
+    TEST_ASSERT_EQUAL(0, fixture.gateway.getStats().serialReads);
+
+    // Registers outside any block go to the bus
+    client.length = 0;
+    sendRead(client.fd, 200, ModbusFunction::READ_INPUT_REGISTERS, 50, 2);
+    TEST_ASSERT_TRUE(pumpUntilAnswered(fixture.gateway, &client, 1));
+    TEST_ASSERT_EQUAL(1050, client.value(0));
+    TEST_ASSERT_EQUAL(1, fixture.gateway.getStats().serialReads);
+    close(client.fd);
+}
+
+void test_concurrent_requests_share_one_serial_read() {
+    fakeNow = 1;
+    GatewayFixture fixture;
+    TEST_ASSERT_TRUE(fixture.start());
+    TcpClient clients[4];
+    for (int i = 0; i < 4; i++) {
+        clients[i] = fixture.connectTo();
+        TEST_ASSERT_TRUE(clients[i].fd >= 0);
+    }
+
+    // Three overlapping holding-register reads and one input-register read, all at once
+    sendRead(clients[0].fd, 1, ModbusFunction::READ_HOLDING_REGISTERS, 0, 10);
+    sendRead(clients[1].fd, 2, ModbusFunction::READ_HOLDING_REGISTERS, 5, 10);
+    sendRead(clients[2].fd, 3, ModbusFunction::READ_HOLDING_REGISTERS, 10, 20);
+    sendRead(clients[3].fd, 4, ModbusFunction::READ_INPUT_REGISTERS, 0, 5);
+    TEST_ASSERT_TRUE(pumpUntilAnswered(fixture.gateway, clients, 4));
+    TEST_ASSERT_EQUAL(2, fixture.slave.requests);
+    TEST_ASSERT_EQUAL(2, fixture.gateway.getStats().coalesced);
+    TEST_ASSERT_EQUAL(0, clients[0].value(0));
+    TEST_ASSERT_EQUAL(15, clients[1].value(0));
+    TEST_ASSERT_EQUAL(20, clients[1].frame[8]);
+    TEST_ASSERT_EQUAL(87, clients[2].value(19));
+    TEST_ASSERT_EQUAL(1004, clients[3].value(4));
+
+    // A request arriving while a covering read is on the bus joins it
+    for (int i = 0; i < 2; i++) {
+        clients[i].length = 0;
+    }
+    sendRead(clients[0].fd, 5, ModbusFunction::READ_HOLDING_REGISTERS, 100, 30);
+    pump(fixture.gateway, 10);
+    sendRead(clients[1].fd, 6, ModbusFunction::READ_HOLDING_REGISTERS, 110, 5);
+    TEST_ASSERT_TRUE(pumpUntilAnswered(fixture.gateway, clients, 2));
+    TEST_ASSERT_EQUAL(3, fixture.slave.requests);
+    TEST_ASSERT_EQUAL(330, clients[1].value(0));
+    TEST_ASSERT_EQUAL(0, fixture.gateway.getPendingCount());
+
+    for (int i = 0; i < 4; i++) {
+        close(clients[i].fd);
+    }
+}
+
+void test_writes_and_errors() {
+    fakeNow = 1;
+    GatewayFixture fixture;
+    fixture.gateway.getCache().addBlock(1, ModbusFunction::READ_HOLDING_REGISTERS, 0, 10, 10000);
+    TEST_ASSERT_TRUE(fixture.start());
+    TcpClient client = fixture.connectTo();
+    pump(fixture.gateway, 100);
+
+    // Single write goes through and invalidates the cached copy
+    uint8_t writeSingle[5] = { ModbusFunction::WRITE_SINGLE_REGISTER };
+    putU16(writeSingle + 1, 3);
+    putU16(writeSingle + 3, 777);
+    sendRequest(client.fd, 1, 1, writeSingle, sizeof(writeSingle));
+    TEST_ASSERT_TRUE(pumpUntilAnswered(fixture.gateway, &client, 1));
+    TEST_ASSERT_EQUAL(12, (int)client.length);
+    TEST_ASSERT_EQUAL(777, getU16(client.frame + 10));
+    TEST_ASSERT_EQUAL(777, fixture.slave.holding[3]);
+
+    uint32_t before = fixture.slave.requests;
+    client.length = 0;
+    sendRead(client.fd, 2, ModbusFunction::READ_HOLDING_REGISTERS, 0, 10);
+    TEST_ASSERT_TRUE(pumpUntilAnswered(fixture.gateway, &client, 1));
+    TEST_ASSERT_EQUAL(777, client.value(3));
+    TEST_ASSERT_EQUAL(before + 1, fixture.slave.requests);
+
+    uint8_t writeMultiple[10] = { ModbusFunction::WRITE_MULTIPLE_REGISTERS };
+    putU16(writeMultiple + 1, 20);
+    putU16(writeMultiple + 3, 2);
+    writeMultiple[5] = 4;
+    putU16(writeMultiple + 6, 1);
+    putU16(writeMultiple + 8, 2);
+    client.length = 0;
+    sendRequest(client.fd, 3, 1, writeMultiple, sizeof(writeMultiple));
+    TEST_ASSERT_TRUE(pumpUntilAnswered(fixture.gateway, &client, 1));
+    TEST_ASSERT_EQUAL(ModbusFunction::WRITE_MULTIPLE_REGISTERS, client.frame[7]);
+    TEST_ASSERT_EQUAL(2, fixture.slave.holding[21]);
+
+    // Unsupported function
+    uint8_t readCoils[5] = { 0x01, 0, 0, 0, 8 };
+    client.length = 0;
+    sendRequest(client.fd, 4, 1, readCoils, sizeof(readCoils));
+    TEST_ASSERT_TRUE(pumpUntilAnswered(fixture.gateway, &client, 1));
+    TEST_ASSERT_EQUAL(0x81, client.frame[7]);
+    TEST_ASSERT_EQUAL(ModbusException::ILLEGAL_FUNCTION, client.frame[8]);
+
+    // Slave exception passed through, then an absent slave
+    client.length = 0;
+    sendRead(client.fd, 5, ModbusFunction::READ_HOLDING_REGISTERS, 990, 20);
+    TEST_ASSERT_TRUE(pumpUntilAnswered(fixture.gateway, &client, 1));
+    TEST_ASSERT_EQUAL(0x83, client.frame[7]);
+    TEST_ASSERT_EQUAL(ModbusException::ILLEGAL_DATA_ADDRESS, client.frame[8]);
+
+    fixture.slave.online = false;
+    client.length = 0;
+    sendRead(client.fd, 6, ModbusFunction::READ_HOLDING_REGISTERS, 500, 2);
+    TEST_ASSERT_TRUE(pumpUntilAnswered(fixture.gateway, &client, 1));
+    TEST_ASSERT_EQUAL(0x83, client.frame[7]);
+    TEST_ASSERT_EQUAL(ModbusException::GATEWAY_TARGET_NO_RESPONSE, client.frame[8]);
+    close(client.fd);
+}
+
+// Four SCADA masters each polling the same 20 registers every 500 ms,
+// staggered, for one minute of simulated time
+static void runScadaLoad(bool cached, uint32_t& serialTransactions, uint32_t& wireMs, double& meanLatencyMs,
+                         uint32_t& answered) {
+    fakeNow = 1;
+    GatewayFixture fixture;
+    if (cached) {
+        fixture.gateway.getCache().addBlock(1, ModbusFunction::READ_HOLDING_REGISTERS, 0, 20, 1000, 500);
+    }
+    fixture.start();
+    TcpClient clients[4];
+    uint32_t nextAt[4];
+    uint32_t sentAt[4];
+    bool waiting[4];
+    for (int i = 0; i < 4; i++) {
+        clients[i] = fixture.connectTo();
+        nextAt[i] = 100 + i * 125;
+        waiting[i] = false;
+    }
+
+    uint64_t latencyTotal = 0;
+    answered = 0;
+    uint16_t transaction = 0;
+    for (; fakeNow < 60000; fakeNow++) {
+        for (int i = 0; i < 4; i++) {
+            if (!waiting[i] && fakeNow >= nextAt[i]) {
+                clients[i].length = 0;
+                sendRead(clients[i].fd, transaction++, ModbusFunction::READ_HOLDING_REGISTERS, 0, 20);
+                sentAt[i] = fakeNow;
+                waiting[i] = true;
+            }
+        }
+        fixture.gateway.update();
+        for (int i = 0; i < 4; i++) {
+            if (waiting[i] && clients[i].poll()) {
+                latencyTotal += fakeNow - sentAt[i];
+                answered++;
+                waiting[i] = false;
+                nextAt[i] += 500;
+            }
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        close(clients[i].fd);
+    }
+    serialTransactions = fixture.slave.requests;
+    wireMs = fixture.slave.wireMs;
+    meanLatencyMs = answered ? (double)latencyTotal / answered : 0;
+}
+
+void test_bus_load_with_and_without_cache() {
+    uint32_t directTransactions, directWireMs, directAnswered;
+    uint32_t cachedTransactions, cachedWireMs, cachedAnswered;
+    double directLatency, cachedLatency;
+    runScadaLoad(false, directTransactions, directWireMs, directLatency, directAnswered);
+    runScadaLoad(true, cachedTransactions, cachedWireMs, cachedLatency, cachedAnswered);
+
+    char message[200];
+    snprintf(message, sizeof(message), "pass-through: %u requests -> %u serial reads, bus %.1f%% busy, mean latency %.1f ms",
+             (unsigned)directAnswered, (unsigned)directTransactions, directWireMs / 600.0, directLatency);
+    TEST_MESSAGE(message);
+    snprintf(message, sizeof(message), "cached:       %u requests -> %u serial reads, bus %.1f%% busy, mean latency %.1f ms",
+             (unsigned)cachedAnswered, (unsigned)cachedTransactions, cachedWireMs / 600.0, cachedLatency);
+    TEST_MESSAGE(message);
+
+    TEST_ASSERT_GREATER_OR_EQUAL(470, cachedAnswered);
+    TEST_ASSERT_GREATER_OR_EQUAL(470, directAnswered);
+    // One poll per 500 ms regardless of how many masters ask
+    TEST_ASSERT_INT_WITHIN(5, 120, (int)cachedTransactions);
+    TEST_ASSERT_LESS_THAN(directTransactions / 3, cachedTransactions);
+    TEST_ASSERT_TRUE(cachedLatency < 2.0);
+}
+
+int runUnityTests() {
+    UNITY_BEGIN();
+    RUN_TEST(test_crc_and_rtu_master);
+    RUN_TEST(test_reads_are_served_from_cache);
+    RUN_TEST(test_concurrent_requests_share_one_serial_read);
+    RUN_TEST(test_writes_and_errors);
+    RUN_TEST(test_bus_load_with_and_without_cache);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
@@ -0,0 +1,407 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/mqtt_session.cpp"
+
+#include <unity.h>
+#include <stdio.h>
+#include <deque>
+#include <map>
+#include <set>
+#include "mqtt_session.h"
+
+static uint32_t virtualNow = 0;
+
+static uint32_t virtualClock() {
+    return virtualNow;
+}
+
+// Stand-in broker behind a link with a fixed round-trip time. Bytes written
+// by the client reach the broker after rtt/2, replies come back after
+// another rtt/2. Time only moves when the test advances virtualNow.
+class SimulatedBroker : public MqttTransport {
+public:
+    uint32_t rttMs = 100;
+    uint32_t dropAcks = 0;          // swallow this many PUBACK/PUBREC replies
+    uint32_t resetAfterPublishes = 0; // drop the link after this many PUBLISH
+    bool sessionStored = false;
+
+    uint32_t connects = 0;
+    uint32_t publishes = 0;
+    uint32_t duplicates = 0;
+    uint32_t redelivered = 0;
+    std::map<uint32_t, uint32_t> delivered; // message sequence -> count
+
+    bool open(const char*, uint16_t) override {
+        linkOpen = true;
+        toBroker.clear();
+        toClient.clear();
+        reader.reset();
+        return true;
+    }
+
+    void close() override {
+        linkOpen = false;
+        toBroker.clear();
+        toClient.clear();
+    }
+
+    bool isOpen() override {
+        pump();
+        return linkOpen;
+    }
+
+    int read(uint8_t* data, size_t length) override {
+        pump();
+        size_t count = 0;
+        while (count < length && !toClient.empty() && toClient.front().deliverAt <= virtualNow) {
+            Segment& segment = toClient.front();
+            size_t take = segment.bytes.size() - segment.offset;
+            if (take > length - count) {
+                take = length - count;
+            }
+            memcpy(data + count, segment.bytes.data() + segment.offset, take);
+            segment.offset += take;
+            count += take;
+            if (segment.offset == segment.bytes.size()) {
+                toClient.pop_front();
+            }
+        }
+        return (int)count;
+    }
+
+    size_t write(const uint8_t* data, size_t length) override {
+        if (!linkOpen) {
+            return 0;
+        }
+        toBroker.push_back({virtualNow + rttMs / 2, std::vector<uint8_t>(data, data + length), 0});
+        return length;
+    }
+
+    void injectPublish(const char* topic, const char* payload, uint8_t qos, uint16_t packetId, bool duplicate) {
+        std::vector<uint8_t> packet;
+        uint8_t length[4];
+        size_t topicLength = strlen(topic);
+        size_t payloadLength = strlen(payload);
+        packet.push_back(0x30 | (qos << 1) | (duplicate ? 0x08 : 0));
+        size_t n = mqttEncodeLength(length, 2 + topicLength + (qos > 0 ? 2 : 0) + payloadLength);
+        packet.insert(packet.end(), length, length + n);
+        mqttAppendString(packet, topic, topicLength);
+        if (qos > 0) {
+            packet.push_back(packetId >> 8);
+            packet.push_back(packetId & 0xFF);
+        }
+        packet.insert(packet.end(), payload, payload + payloadLength);
+        toClient.push_back({virtualNow + rttMs / 2, packet, 0});
+    }
+
+    std::vector<uint8_t> lastAckFromClient;
+
+private:
+    struct Segment {
+        uint32_t deliverAt;
+        std::vector<uint8_t> bytes;
+        size_t offset;
+    };
+
+    bool linkOpen = false;
+    std::deque<Segment> toBroker;
+    std::deque<Segment> toClient;
+    MqttPacketReader reader;
+    std::set<uint16_t> qos2Pending;
+
+    void reply(uint32_t at, std::initializer_list<uint8_t> bytes) {
+        toClient.push_back({at + rttMs / 2, std::vector<uint8_t>(bytes), 0});
+    }
+
+    void pump() {
+        while (linkOpen && !toBroker.empty() && toBroker.front().deliverAt <= virtualNow) {
+            Segment segment = toBroker.front();
+            toBroker.pop_front();
+            for (uint8_t byte : segment.bytes) {
+                if (reader.feed(byte)) {
+                    handle(segment.deliverAt);
+                    if (!linkOpen) {
+                        return;
+                    }
+                }
+            }
+        }
+    }
+
+    void handle(uint32_t at) {
+        const uint8_t* body = reader.getBody();
+        uint16_t packetId;
+        switch (reader.getType()) {
+            case MqttPacketType::CONNECT: {
+                bool clean = (body[7] & 0x02) != 0;
+                bool present = !clean && sessionStored;
+                sessionStored = !clean;
+                if (clean) {
+                    qos2Pending.clear();
+                }
+                connects++;
+                reply(at, {0x20, 0x02, (uint8_t)(present ? 1 : 0), 0x00});
+                break;
+            }
+            case MqttPacketType::PUBLISH: {
+                uint8_t qos = (reader.getFlags() >> 1) & 0x03;
+                size_t topicLength = (body[0] << 8) | body[1];
+                packetId = (body[2 + topicLength] << 8) | body[3 + topicLength];
+                uint32_t sequence;
+                memcpy(&sequence, body + 4 + topicLength, sizeof(sequence));
+                publishes++;
+                if (reader.getFlags() & 0x08) {
+                    duplicates++;
+                }
+                // QoS 2: a packet ID awaiting PUBREL is not delivered again
+                if (qos == 1 || qos2Pending.insert(packetId).second) {
+                    if (delivered[sequence]++ > 0) {
+                        redelivered++;
+                    }
+                }
+                if (resetAfterPublishes > 0 && publishes == resetAfterPublishes) {
+                    close();
+                    return;
+                }
+                if (dropAcks > 0) {
+                    dropAcks--;
+                    break;
+                }
+                reply(at, {(uint8_t)(qos == 1 ? 0x40 : 0x50), 0x02, (uint8_t)(packetId >> 8), (uint8_t)packetId});
+                break;
+            }
+            case MqttPacketType::PUBREL:
+                packetId = (body[0] << 8) | body[1];
+                qos2Pending.erase(packetId);
+                reply(at, {0x70, 0x02, body[0], body[1]});
+                break;
+            case MqttPacketType::PUBACK:
+            case MqttPacketType::PUBREC:
+            case MqttPacketType::PUBCOMP:
+                lastAckFromClient.assign(body, body + reader.getBodyLength());
+                lastAckFromClient.insert(lastAckFromClient.begin(), (uint8_t)reader.getType());
+                if (reader.getType() == MqttPacketType::PUBREC) {
+                    reply(at, {0x62, 0x02, body[0], body[1]});
+                }
+                break;
+            case MqttPacketType::PINGREQ:
+                reply(at, {0xD0, 0x00});
+                break;
+            default:
+                break;
+        }
+    }
+};
+
+static void setupSession(MqttSession& session, size_t window) {
+    session.setClock(virtualClock);
+    session.setServer("broker.local", 1883);
+    session.setCredentials("cerise-test", "", "");
+    session.setInflightWindow(window);
+    session.setRetransmitInterval(2000);
+    session.setReconnectInterval(100);
+}
+
+static bool runUntilConnected(MqttSession& session) {
+    session.connect();
+    for (int i = 0; i < 5000 && !session.isConnected(); i++) {
+        virtualNow++;
+        session.loop();
+    }
+    return session.isConnected();
+}
+
+// Publishes count messages as fast as the window allows; returns virtual ms
+static uint32_t pumpMessages(MqttSession& session, uint32_t count, uint8_t qos) {
+    uint32_t start = virtualNow;
+    uint32_t sent = 0;
+    uint8_t payload[32] = {0};
+    while (session.getStats().acknowledged < count && virtualNow - start < 3600000) {
+        while (sent < count && session.canPublish(qos)) {
+            memcpy(payload, &sent, sizeof(sent));
+            if (!session.publish("cerise/samples", payload, sizeof(payload), qos)) {
+                break;
+            }
+            sent++;
+        }
+        virtualNow++;
+        session.loop();
+    }
+    return virtualNow - start;
+}
+
+void test_reader_handles_split_and_malformed_frames() {
+    MqttPacketReader reader;
+    const uint8_t puback[] = {0x40, 0x02, 0x12, 0x34};
+    for (size_t i = 0; i < 3; i++) {
+        TEST_ASSERT_FALSE(reader.feed(puback[i]));
+    }
+    TEST_ASSERT_TRUE(reader.feed(puback[3]));
+    TEST_ASSERT_EQUAL(MqttPacketType::PUBACK, reader.getType());
+    TEST_ASSERT_EQUAL(2, reader.getBodyLength());
+
+    // Multi-byte remaining length (200 = 0xC8 0x01)
+    TEST_ASSERT_FALSE(reader.feed(0x30));
+    TEST_ASSERT_FALSE(reader.feed(0xC8));
+    TEST_ASSERT_FALSE(reader.feed(0x01));
+    for (int i = 0; i < 199; i++) {
+        TEST_ASSERT_FALSE(reader.feed(0));
+    }
+    TEST_ASSERT_TRUE(reader.feed(0));
+    TEST_ASSERT_EQUAL(200, reader.getBodyLength());
+
+    const uint8_t bad[] = {0x30, 0xFF, 0xFF, 0xFF, 0xFF};
+    for (uint8_t byte : bad) {
+        reader.feed(byte);
+    }
+    TEST_ASSERT_TRUE(reader.isMalformed());
+}
+
+void test_window_limits_outstanding_publishes() {
+    SimulatedBroker broker;
+    MqttSession session(broker);
+    setupSession(session, 4);
+    TEST_ASSERT_TRUE(runUntilConnected(session));
+
+    uint8_t payload[4] = {0};
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_TRUE(session.publish("t", payload, sizeof(payload), 1));
+    }
+    TEST_ASSERT_FALSE(session.canPublish(1));
+    TEST_ASSERT_FALSE(session.publish("t", payload, sizeof(payload), 1));
+    TEST_ASSERT_EQUAL(1, session.getStats().windowFull);
+    TEST_ASSERT_EQUAL(4, session.getInflightCount());
+
+    virtualNow += broker.rttMs;
+    session.loop();
+    TEST_ASSERT_EQUAL(0, session.getInflightCount());
+    TEST_ASSERT_EQUAL(4, session.getStats().acknowledged);
+}
+
+void test_lost_ack_is_retransmitted_with_dup() {
+    SimulatedBroker broker;
+    MqttSession session(broker);
+    setupSession(session, 8);
+    TEST_ASSERT_TRUE(runUntilConnected(session));
+
+    broker.dropAcks = 1;
+    uint32_t sequence = 7;
+    TEST_ASSERT_TRUE(session.publish("t", (const uint8_t*)&sequence, sizeof(sequence), 1));
+    for (int i = 0; i < 1500; i++) {
+        virtualNow++;
+        session.loop();
+    }
+    TEST_ASSERT_EQUAL(1, session.getInflightCount());
+    for (int i = 0; i < 1500; i++) {
+        virtualNow++;
+        session.loop();
+    }
+    TEST_ASSERT_EQUAL(0, session.getInflightCount());
+    TEST_ASSERT_EQUAL(1, session.getStats().retransmits);
+    TEST_ASSERT_EQUAL(1, broker.duplicates);
+    TEST_ASSERT_EQUAL(2, broker.delivered[7]); // QoS 1 is at-least-once
+}
+
+void test_qos2_exactly_once_across_reconnect() {
+    SimulatedBroker broker;
+    broker.rttMs = 200;
+    broker.resetAfterPublishes = 10;
+    MqttSession session(broker);
+    setupSession(session, 16);
+    TEST_ASSERT_TRUE(runUntilConnected(session));
+
+    uint32_t elapsed = pumpMessages(session, 64, 2);
+    const MqttSessionStats& stats = session.getStats();
+    TEST_ASSERT_EQUAL(64, stats.acknowledged);
+    TEST_ASSERT_EQUAL(1, stats.connectionsLost);
+    TEST_ASSERT_EQUAL(1, stats.resumed);
+    TEST_ASSERT_EQUAL(2, broker.connects);
+    TEST_ASSERT_GREATER_THAN(0, broker.duplicates);
+    TEST_ASSERT_EQUAL(64, broker.delivered.size());
+    TEST_ASSERT_EQUAL(0, broker.redelivered);
+
+    char message[120];
+    snprintf(message, sizeof(message), "QoS 2, 64 msgs with one link reset: %u ms virtual, %u DUP re-sends",
+             (unsigned)elapsed, (unsigned)broker.duplicates);
+    TEST_MESSAGE(message);
+}
+
+void test_inbound_qos1_and_qos2_delivery() {
+    SimulatedBroker broker;
+    MqttSession session(broker);
+    setupSession(session, 8);
+    int received = 0;
+    session.setMessageCallback([&received](const char* topic, const uint8_t* payload, size_t length) {
+        TEST_ASSERT_EQUAL_STRING("cmd/relay", topic);
+        TEST_ASSERT_EQUAL(2, length);
+        TEST_ASSERT_EQUAL_MEMORY("on", payload, 2);
+        received++;
+    });
+    TEST_ASSERT_TRUE(runUntilConnected(session));
+
+    broker.injectPublish("cmd/relay", "on", 1, 5, false);
+    virtualNow += broker.rttMs;
+    session.loop();
+    virtualNow += broker.rttMs;
+    broker.isOpen();
+    TEST_ASSERT_EQUAL(1, received);
+    TEST_ASSERT_EQUAL(MqttPacketType::PUBACK, (MqttPacketType)broker.lastAckFromClient[0]);
+
+    // Duplicate QoS 2 before PUBREL must not be delivered twice
+    broker.injectPublish("cmd/relay", "on", 2, 6, false);
+    broker.injectPublish("cmd/relay", "on", 2, 6, true);
+    virtualNow += broker.rttMs;
+    session.loop();
+    virtualNow += broker.rttMs;
+    session.loop();
+    TEST_ASSERT_EQUAL(2, received);
+}
+
+void test_benchmark_throughput_vs_window() {
+    const uint32_t rtts[] = {50, 200, 500};
+    const size_t windows[] = {1, 4, 16, 32};
+    const uint32_t count = 400;
+    char message[160];
+
+    for (uint32_t rtt : rtts) {
+        double rates[4];
+        for (size_t w = 0; w < 4; w++) {
+            SimulatedBroker broker;
+            broker.rttMs = rtt;
+            MqttSession session(broker);
+            setupSession(session, windows[w]);
+            TEST_ASSERT_TRUE(runUntilConnected(session));
+            uint32_t elapsed = pumpMessages(session, count, 1);
+            TEST_ASSERT_EQUAL(count, session.getStats().acknowledged);
+            TEST_ASSERT_EQUAL(count, broker.delivered.size());
+            rates[w] = count * 1000.0 / elapsed;
+        }
+        snprintf(message, sizeof(message),
+                 "RTT %3u ms, QoS 1 msg/s: window 1 %.1f | 4 %.1f | 16 %.1f | 32 %.1f",
+                 (unsigned)rtt, rates[0], rates[1], rates[2], rates[3]);
+        TEST_MESSAGE(message);
+        TEST_ASSERT_GREATER_THAN(rates[0] * 12, rates[2]);
+    }
+}
+
+int runUnityTests() {
+    UNITY_BEGIN();
+    RUN_TEST(test_reader_handles_split_and_malformed_frames);
+    RUN_TEST(test_window_limits_outstanding_publishes);
+    RUN_TEST(test_lost_ack_is_retransmitted_with_dup);
+    RUN_TEST(test_qos2_exactly_once_across_reconnect);
+    RUN_TEST(test_inbound_qos1_and_qos2_delivery);
+    RUN_TEST(test_benchmark_throughput_vs_window);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
@@ -0,0 +1,162 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/payload_encoder.cpp"
+
+#include <unity.h>
+#include <stdio.h>
+#include <chrono>
+#include "payload_encoder.h"
+
+static Sample batch[32];
+
+static void makeBatch() {
+    for (size_t i = 0; i < 32; i++) {
+        batch[i].pointId = (uint16_t)(i % 8);
+        batch[i].source = SampleSource::MODBUS;
+        batch[i].value = 20.0f + 0.37f * i;
+        batch[i].timestampMs = 1000000 + 250 * i;
+    }
+}
+
+void test_cbor_known_encoding() {
+    uint8_t data[64];
+    PayloadBuffer out(data, sizeof(data));
+    CborWriter writer(out);
+    writer.beginMap(2);
+    writer.key("a");
+    writer.writeUint(500);
+    writer.key("b");
+    writer.writeInt(-10);
+    const uint8_t expected[] = {0xA2, 0x61, 'a', 0x19, 0x01, 0xF4, 0x61, 'b', 0x29};
+    TEST_ASSERT_EQUAL(sizeof(expected), out.length());
+    TEST_ASSERT_EQUAL_MEMORY(expected, data, sizeof(expected));
+}
+
+void test_msgpack_known_encoding() {
+    uint8_t data[64];
+    PayloadBuffer out(data, sizeof(data));
+    MsgPackWriter writer(out);
+    writer.beginArray(4);
+    writer.writeUint(5);
+    writer.writeUint(300);
+    writer.writeInt(-5);
+    writer.writeFloat(1.5f);
+    const uint8_t expected[] = {0x94, 0x05, 0xCD, 0x01, 0x2C, 0xFB, 0xCA, 0x3F, 0xC0, 0x00, 0x00};
+    TEST_ASSERT_EQUAL(sizeof(expected), out.length());
+    TEST_ASSERT_EQUAL_MEMORY(expected, data, sizeof(expected));
+}
+
+void test_json_batch_layout() {
+    uint8_t data[128];
+    PayloadBuffer out(data, sizeof(data));
+    Sample samples[2] = {
+        {1, SampleSource::ANALOG, 2.5f, 1000},
+        {2, SampleSource::ANALOG, -1.0f, 1250},
+    };
+    size_t length = encodeSamples(PayloadFormat::JSON, samples, 2, out);
+    TEST_ASSERT_GREATER_THAN(0, length);
+    data[length] = 0;
+    TEST_ASSERT_EQUAL_STRING("{\"t\":1000,\"s\":[[1,2.5,0],[2,-1,250]]}", (const char*)data);
+}
+
+void test_protobuf_schema_frame() {
+    static const ProtobufField fields[] = {
+        {0, 2, ProtobufType::FLOAT},
+        {1, 3, ProtobufType::SINT32},
+        {9, 4, ProtobufType::UINT32},
+    };
+    ProtobufSchema schema = {fields, 3};
+    Sample samples[3] = {
+        {0, SampleSource::ANALOG, 1.0f, 5},
+        {1, SampleSource::ANALOG, -2.0f, 6},
+        {0, SampleSource::ANALOG, 2.0f, 7},
+    };
+    uint8_t data[64];
+    PayloadBuffer out(data, sizeof(data));
+    size_t length = encodeSamples(PayloadFormat::PROTOBUF, samples, 3, out, &schema);
+    // ts=5 | field 2 fixed32 2.0f (latest) | field 3 sint32 -2; point 9 absent
+    const uint8_t expected[] = {0x08, 0x05, 0x15, 0x00, 0x00, 0x00, 0x40, 0x18, 0x03};
+    TEST_ASSERT_EQUAL(sizeof(expected), length);
+    TEST_ASSERT_EQUAL_MEMORY(expected, data, sizeof(expected));
+
+    TEST_ASSERT_EQUAL(0, encodeSamples(PayloadFormat::PROTOBUF, samples, 3, out, nullptr));
+}
+
+void test_overflow_is_reported() {
+    uint8_t data[16];
+    PayloadBuffer out(data, sizeof(data));
+    TEST_ASSERT_EQUAL(0, encodeSamples(PayloadFormat::JSON, batch, 32, out));
+    TEST_ASSERT_TRUE(out.overflowed());
+}
+
+// Per-sample JSON as ProtocolManager published it before batching encoders
+static size_t encodeLegacyJson(const Sample* samples, size_t count, char* out, size_t size) {
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += snprintf(out, size, "{\"v\":%.3f,\"t\":%lu}", samples[i].value, (unsigned long)samples[i].timestampMs);
+    }
+    return total;
+}
+
+void test_benchmark_formats() {
+    static const ProtobufField fields[] = {
+        {0, 2, ProtobufType::FLOAT}, {1, 3, ProtobufType::FLOAT}, {2, 4, ProtobufType::FLOAT},
+        {3, 5, ProtobufType::FLOAT}, {4, 6, ProtobufType::FLOAT}, {5, 7, ProtobufType::FLOAT},
+        {6, 8, ProtobufType::FLOAT}, {7, 9, ProtobufType::FLOAT},
+    };
+    ProtobufSchema schema = {fields, 8};
+    const PayloadFormat formats[] = {PayloadFormat::JSON, PayloadFormat::CBOR, PayloadFormat::MSGPACK, PayloadFormat::PROTOBUF};
+    const char* names[] = {"json", "cbor", "msgpack", "protobuf"};
+    const int rounds = 20000;
+    uint8_t data[1024];
+    PayloadBuffer out(data, sizeof(data));
+
+    char legacy[64];
+    auto start = std::chrono::steady_clock::now();
+    size_t legacyBytes = 0;
+    for (int r = 0; r < rounds; r++) {
+        legacyBytes = encodeLegacyJson(batch, 32, legacy, sizeof(legacy));
+    }
+    double legacyNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+    char message[128];
+    snprintf(message, sizeof(message), "legacy json: %4u B, %7.0f ns per 32 samples", (unsigned)legacyBytes, legacyNs);
+    TEST_MESSAGE(message);
+
+    size_t sizes[4];
+    for (int f = 0; f < 4; f++) {
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++) {
+            sizes[f] = encodeSamples(formats[f], batch, 32, out, &schema);
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+        snprintf(message, sizeof(message), "%-11s: %4u B, %7.0f ns per 32 samples", names[f], (unsigned)sizes[f], ns);
+        TEST_MESSAGE(message);
+        TEST_ASSERT_GREATER_THAN(0, sizes[f]);
+    }
+    TEST_ASSERT_LESS_THAN(sizes[0], sizes[1]);
+    TEST_ASSERT_LESS_THAN(sizes[0], sizes[2]);
+    TEST_ASSERT_LESS_THAN(legacyBytes / 2, sizes[1]);
+}
+
+int runUnityTests() {
+    makeBatch();
+    UNITY_BEGIN();
+    RUN_TEST(test_cbor_known_encoding);
+    RUN_TEST(test_msgpack_known_encoding);
+    RUN_TEST(test_json_batch_layout);
+    RUN_TEST(test_protobuf_schema_frame);
+    RUN_TEST(test_overflow_is_reported);
+    RUN_TEST(test_benchmark_formats);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
@@ -0,0 +1,393 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/pi_link.cpp"
+#ifdef __linux__
+#include "../../host/posix_serial.cpp"
+#endif
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <vector>
+#include "pi_link.h"
+#ifdef __linux__
+#include <fcntl.h>
+#include <stdlib.h>
+#include "../../host/posix_serial.h"
+#endif
+
+static uint32_t fakeNow = 0;
+static uint32_t fakeClock() {
+    return fakeNow;
+}
+
+// One direction of a serial line: bounded like a UART buffer, and able to
+// drop or flip bytes
+struct Wire {
+    std::deque<uint8_t> bytes;
+    size_t capacity = 4096;
+    uint32_t damageEvery = 0;   // on average, 0 = clean
+    uint32_t rng = 12345;
+    uint32_t damaged = 0;
+
+    uint32_t next() {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        return rng;
+    }
+};
+
+class WireTransport : public PiLinkTransport {
+public:
+    WireTransport(Wire& out, Wire& in) : out(out), in(in) {}
+
+    size_t write(const uint8_t* data, size_t length) override {
+        size_t taken = 0;
+        while (taken < length && out.bytes.size() < out.capacity) {
+            uint8_t byte = data[taken++];
+            if (out.damageEvery != 0 && out.next() % out.damageEvery == 0) {
+                out.damaged++;
+                if (out.next() & 1) {
+                    continue;
+                }
+                byte ^= (uint8_t)(1 + out.next() % 255);
+            }
+            out.bytes.push_back(byte);
+        }
+        return taken;
+    }
+
+    size_t read(uint8_t* data, size_t capacity) override {
+        size_t count = 0;
+        while (count < capacity && !in.bytes.empty()) {
+            data[count++] = in.bytes.front();
+            in.bytes.pop_front();
+        }
+        return count;
+    }
+
+private:
+    Wire& out;
+    Wire& in;
+};
+
+// Gateway and Pi ends over two wires
+struct LinkPair {
+    Wire toPi;
+    Wire toGateway;
+    WireTransport gatewaySide;
+    WireTransport piSide;
+    PiLink gateway;
+    PiLink pi;
+    std::vector<std::vector<uint8_t>> received;
+
+    LinkPair() : gatewaySide(toPi, toGateway), piSide(toGateway, toPi), gateway(gatewaySide), pi(piSide) {
+        gateway.setClock(fakeClock);
+        pi.setClock(fakeClock);
+        pi.setReceiveCallback([this](PiChannel channel, const uint8_t* data, size_t length) {
+            if (channel == PiChannel::SAMPLES) {
+                received.push_back(std::vector<uint8_t>(data, data + length));
+            }
+        });
+    }
+
+    void run(uint32_t ms) {
+        for (uint32_t i = 0; i < ms; i++) {
+            fakeNow++;
+            gateway.update();
+            pi.update();
+        }
+    }
+};
+
+static std::vector<uint8_t> numbered(uint32_t number, size_t length) {
+    std::vector<uint8_t> message(length);
+    for (size_t i = 0; i < length; i++) {
+        message[i] = (uint8_t)(number * 31 + i);
+    }
+    memcpy(message.data(), &number, sizeof(number));
+    return message;
+}
+
+void test_cobs_round_trip() {
+    const size_t lengths[] = {1, 2, 253, 254, 255, 508, 520};
+    uint8_t data[600];
+    uint8_t encoded[700];
+    uint8_t decoded[600];
+    uint32_t rng = 1;
+    for (size_t length : lengths) {
+        for (int pattern = 0; pattern < 3; pattern++) {
+            for (size_t i = 0; i < length; i++) {
+                rng = rng * 1103515245 + 12345;
+                data[i] = pattern == 0 ? 0 : pattern == 1 ? (uint8_t)(1 + i % 255) : (uint8_t)(rng >> 16) & 0x03;
+            }
+            size_t size = cobsEncode(data, length, encoded);
+            TEST_ASSERT_LESS_OR_EQUAL(length + length / 254 + 1, size);
+            TEST_ASSERT_NULL(memchr(encoded, 0, size));
+            TEST_ASSERT_EQUAL(length, cobsDecode(encoded, size, decoded, sizeof(decoded)));
+            TEST_ASSERT_EQUAL_MEMORY(data, decoded, length);
+        }
+    }
+
+    // Zeros inside a frame, a block that claims more than is there, no room
+    const uint8_t zero[] = {0x03, 0x11, 0x00, 0x22};
+    const uint8_t truncated[] = {0x05, 0x11, 0x22};
+    const uint8_t fits[] = {0x03, 0x11, 0x22, 0x02, 0x33};
+    TEST_ASSERT_EQUAL(0, cobsDecode(zero, sizeof(zero), decoded, sizeof(decoded)));
+    TEST_ASSERT_EQUAL(0, cobsDecode(truncated, sizeof(truncated), decoded, sizeof(decoded)));
+    TEST_ASSERT_EQUAL(4, cobsDecode(fits, sizeof(fits), decoded, sizeof(decoded)));
+    TEST_ASSERT_EQUAL(0, cobsDecode(fits, sizeof(fits), decoded, 3));
+}
+
+void test_handshake_and_ordered_delivery() {
+    fakeNow = 1000;
+    LinkPair link;
+    std::vector<uint8_t> early = numbered(0, 100);
+    // Queued before the link is up, sent once it is
+    link.gateway.begin();
+    TEST_ASSERT_TRUE(link.gateway.send(PiChannel::SAMPLES, early.data(), early.size()));
+    link.run(5);
+    TEST_ASSERT_EQUAL(PiLinkState::SYNCING, link.gateway.getState());
+    link.pi.begin();
+    link.run(300);
+    TEST_ASSERT_TRUE(link.gateway.isUp());
+    TEST_ASSERT_TRUE(link.pi.isUp());
+    TEST_ASSERT_EQUAL(1, (int)link.received.size());
+
+    uint32_t sent = 1;
+    for (int round = 0; round < 200; round++) {
+        std::vector<uint8_t> message = numbered(sent, 1 + (sent * 37) % PiLink::MAX_PAYLOAD);
+        if (link.gateway.send(PiChannel::SAMPLES, message.data(), message.size())) {
+            sent++;
+        }
+        link.run(1);
+    }
+    link.run(100);
+    TEST_ASSERT_EQUAL(sent, link.received.size());
+    for (uint32_t i = 0; i < sent; i++) {
+        TEST_ASSERT_TRUE(link.received[i] == numbered(i, i == 0 ? 100 : 1 + (i * 37) % PiLink::MAX_PAYLOAD));
+    }
+    TEST_ASSERT_EQUAL(0, (int)link.gateway.getPending());
+    TEST_ASSERT_EQUAL_UINT32(0, link.gateway.getStats().retransmits);
+
+    // Payload limit and window
+    std::vector<uint8_t> big(PiLink::MAX_PAYLOAD + 1);
+    TEST_ASSERT_FALSE(link.gateway.send(PiChannel::SAMPLES, big.data(), big.size()));
+    for (int i = 0; i < PiLink::WINDOW; i++) {
+        TEST_ASSERT_TRUE(link.gateway.send(PiChannel::SAMPLES, big.data(), 10));
+    }
+    TEST_ASSERT_FALSE(link.gateway.send(PiChannel::SAMPLES, big.data(), 10));
+    link.run(10);
+    TEST_ASSERT_TRUE(link.gateway.send(PiChannel::SAMPLES, big.data(), 10));
+}
+
+void test_damaged_line_loses_nothing() {
+    fakeNow = 1000;
+    LinkPair link;
+    // Roughly one byte in 2000 dropped or flipped, both ways
+    link.toPi.damageEvery = 2000;
+    link.toGateway.damageEvery = 2000;
+    link.gateway.begin();
+    link.pi.begin();
+    link.run(1000);
+    TEST_ASSERT_TRUE(link.gateway.isUp());
+
+    const uint32_t COUNT = 3000;
+    uint32_t sent = 0;
+    uint32_t start = fakeNow;
+    while (link.received.size() < COUNT && fakeNow - start < 60000) {
+        while (sent < COUNT) {
+            std::vector<uint8_t> message = numbered(sent, 200);
+            if (!link.gateway.send(PiChannel::SAMPLES, message.data(), message.size())) {
+                break;
+            }
+            sent++;
+        }
+        link.run(1);
+    }
+    TEST_ASSERT_EQUAL(COUNT, link.received.size());
+    for (uint32_t i = 0; i < COUNT; i++) {
+        TEST_ASSERT_TRUE(link.received[i] == numbered(i, 200));
+    }
+    const PiLinkStats& pi = link.pi.getStats();
+    const PiLinkStats& gateway = link.gateway.getStats();
+    TEST_ASSERT_GREATER_THAN(0, link.toPi.damaged);
+    TEST_ASSERT_GREATER_THAN(0, pi.crcErrors + pi.framingErrors);
+    TEST_ASSERT_GREATER_THAN(0, gateway.retransmits);
+
+    char message[160];
+    snprintf(message, sizeof(message),
+             "damaged line: %u bytes damaged, %u CRC + %u framing errors, %u retransmits, %u out of order",
+             (unsigned)(link.toPi.damaged + link.toGateway.damaged), (unsigned)(pi.crcErrors + gateway.crcErrors),
+             (unsigned)(pi.framingErrors + gateway.framingErrors), (unsigned)gateway.retransmits,
+             (unsigned)pi.outOfOrder);
+    TEST_MESSAGE(message);
+}
+
+void test_peer_restart_resyncs() {
+    fakeNow = 1000;
+    LinkPair link;
+    link.gateway.begin();
+    link.pi.begin();
+    link.run(300);
+    std::vector<uint8_t> message = numbered(1, 64);
+    for (int i = 0; i < 40; i++) {
+        link.gateway.send(PiChannel::SAMPLES, message.data(), message.size());
+        link.run(1);
+    }
+    link.run(50);
+    TEST_ASSERT_EQUAL(40, (int)link.received.size());
+
+    // The Pi reboots with messages in flight towards it
+    uint32_t resets = link.gateway.getStats().resets;
+    link.gateway.send(PiChannel::SAMPLES, message.data(), message.size());
+    link.toPi.bytes.clear();
+    link.pi.begin();
+    TEST_ASSERT_EQUAL(PiLinkState::SYNCING, link.pi.getState());
+    link.run(600);
+    TEST_ASSERT_TRUE(link.gateway.isUp());
+    TEST_ASSERT_TRUE(link.pi.isUp());
+    TEST_ASSERT_EQUAL_UINT32(resets + 1, link.gateway.getStats().resets);
+    // The lost message came again, renumbered for the new session
+    TEST_ASSERT_EQUAL(41, (int)link.received.size());
+    link.gateway.send(PiChannel::SAMPLES, message.data(), message.size());
+    link.run(10);
+    TEST_ASSERT_EQUAL(42, (int)link.received.size());
+
+    // The gateway reboots: it starts numbering from 0 again and the Pi follows
+    link.gateway.begin();
+    link.run(600);
+    TEST_ASSERT_TRUE(link.gateway.isUp());
+    link.gateway.send(PiChannel::SAMPLES, message.data(), message.size());
+    link.run(10);
+    TEST_ASSERT_EQUAL(43, (int)link.received.size());
+}
+
+#ifdef __linux__
+static uint32_t realClock() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t nowUs() {
+    using namespace std::chrono;
+    return (uint64_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Gateway on the pty master, the Pi end (as pilinkd runs it) on the slave;
+// both ends of the real framing, tty layer and kernel buffers in between
+void test_pty_throughput_and_latency() {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    TEST_ASSERT_TRUE(master >= 0 && grantpt(master) == 0 && unlockpt(master) == 0);
+    PosixSerialTransport gatewaySerial;
+    PosixSerialTransport piSerial;
+    TEST_ASSERT_TRUE(piSerial.open(ptsname(master), 0));
+    TEST_ASSERT_TRUE(gatewaySerial.adopt(master, 0));
+
+    PiLink gateway(gatewaySerial);
+    PiLink pi(piSerial);
+    gateway.setClock(realClock);
+    pi.setClock(realClock);
+    uint32_t stored = 0;
+    uint64_t storedBytes = 0;
+    pi.setReceiveCallback([&](PiChannel channel, const uint8_t* data, size_t length) {
+        if (channel == PiChannel::LOOPBACK) {
+            pi.send(channel, data, length);
+        } else {
+            stored++;
+            storedBytes += length;
+        }
+    });
+    uint64_t echoedAt = 0;
+    gateway.setReceiveCallback([&](PiChannel, const uint8_t*, size_t) { echoedAt = nowUs(); });
+    gateway.begin();
+    pi.begin();
+    uint64_t deadline = nowUs() + 2000000;
+    while (!(gateway.isUp() && pi.isUp()) && nowUs() < deadline) {
+        gateway.update();
+        pi.update();
+    }
+    TEST_ASSERT_TRUE(gateway.isUp() && pi.isUp());
+
+    // Throughput: full payloads, as many as the window takes
+    const uint32_t COUNT = 4000;
+    uint8_t payload[PiLink::MAX_PAYLOAD];
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = (uint8_t)i;
+    }
+    uint32_t sent = 0;
+    uint64_t start = nowUs();
+    deadline = start + 20000000;
+    while (stored < COUNT && nowUs() < deadline) {
+        while (sent < COUNT && gateway.send(PiChannel::SAMPLES, payload, sizeof(payload))) {
+            sent++;
+        }
+        gateway.update();
+        pi.update();
+    }
+    uint64_t elapsedUs = nowUs() - start;
+    TEST_ASSERT_EQUAL_UINT32(COUNT, stored);
+    uint64_t wireBytes = gateway.getStats().bytesSent;
+
+    // Latency: one 32-byte echo at a time, round trip
+    const int ROUNDS = 500;
+    std::vector<uint32_t> roundTrips;
+    uint8_t ping[32] = {0};
+    for (int i = 0; i < ROUNDS; i++) {
+        echoedAt = 0;
+        uint64_t sentAt = nowUs();
+        gateway.send(PiChannel::LOOPBACK, ping, sizeof(ping));
+        while (echoedAt == 0 && nowUs() - sentAt < 1000000) {
+            pi.update();
+            gateway.update();
+        }
+        TEST_ASSERT_NOT_EQUAL(0, echoedAt);
+        roundTrips.push_back((uint32_t)(echoedAt - sentAt));
+    }
+    std::sort(roundTrips.begin(), roundTrips.end());
+    TEST_ASSERT_EQUAL_UINT32(0, gateway.getStats().crcErrors + pi.getStats().crcErrors);
+
+    double efficiency = (double)storedBytes / (double)wireBytes;
+    char message[160];
+    snprintf(message, sizeof(message), "pty: %u x %u B in %.1f ms, %.1f MB/s of payload, %.1f%% of wire bytes",
+             (unsigned)COUNT, (unsigned)sizeof(payload), elapsedUs / 1000.0, storedBytes / (double)elapsedUs,
+             efficiency * 100);
+    TEST_MESSAGE(message);
+    // 10 bits per byte on a UART
+    snprintf(message, sizeof(message), "at 2 Mbaud: %.1f kB/s of payload (line limit 200 kB/s)",
+             200.0 * efficiency);
+    TEST_MESSAGE(message);
+    snprintf(message, sizeof(message), "echo round trip over %d pings: p50 %u us, p99 %u us, max %u us", ROUNDS,
+             (unsigned)roundTrips[ROUNDS / 2], (unsigned)roundTrips[ROUNDS * 99 / 100],
+             (unsigned)roundTrips[ROUNDS - 1]);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_GREATER_THAN(0.95, efficiency);
+}
+#endif
+
+int runUnityTests() {
+    UNITY_BEGIN();
+    RUN_TEST(test_cobs_round_trip);
+    RUN_TEST(test_handshake_and_ordered_delivery);
+    RUN_TEST(test_damaged_line_loses_nothing);
+    RUN_TEST(test_peer_restart_resyncs);
+#ifdef __linux__
+    RUN_TEST(test_pty_throughput_and_latency);
+#endif
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
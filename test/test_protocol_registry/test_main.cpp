@@ -0,0 +1,215 @@
+#include <unity.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include "protocol_registry.h"
+
+// Stand-ins for ProtocolContext and the drivers: only the registry is under test
+struct FakeContext {
+    ProtocolState states[PROTOCOL_TYPE_COUNT];
+    const char* names[PROTOCOL_TYPE_COUNT];
+    uint32_t sent[PROTOCOL_TYPE_COUNT];
+    uint32_t payloadBytes;
+
+    FakeContext() : payloadBytes(0) {
+        for (size_t i = 0; i < PROTOCOL_TYPE_COUNT; i++) {
+            states[i] = ProtocolState::DISCONNECTED;
+            names[i] = "?";
+            sent[i] = 0;
+        }
+    }
+};
+
+template <ProtocolType Type>
+class FakeDriver {
+public:
+    static const ProtocolType TYPE = Type;
+
+    explicit FakeDriver(FakeContext& context) : connects(0), context(context) {}
+    static const char* name() { return Type == ProtocolType::MQTT ? "MQTT" : Type == ProtocolType::COAP ? "CoAP" : "TCP"; }
+
+    bool connect() {
+        connects++;
+        context.states[static_cast<size_t>(Type)] = ProtocolState::CONNECTED;
+        return true;
+    }
+
+    bool publish(size_t length) {
+        context.sent[static_cast<size_t>(Type)]++;
+        context.payloadBytes += (uint32_t)length;
+        return true;
+    }
+
+    int connects;
+
+private:
+    FakeContext& context;
+};
+
+typedef FakeDriver<ProtocolType::MQTT> FakeMqtt;
+typedef FakeDriver<ProtocolType::COAP> FakeCoap;
+typedef FakeDriver<ProtocolType::CUSTOM> FakeTcp;
+typedef DriverRegistry<FakeMqtt, FakeCoap, FakeTcp> FakeDrivers;
+
+struct ConnectOp {
+    bool result;
+    template <typename Driver>
+    void operator()(Driver& driver) {
+        result = driver.connect();
+    }
+};
+
+struct PublishOp {
+    size_t length;
+    bool result;
+    template <typename Driver>
+    void operator()(Driver& driver) {
+        result = driver.publish(length);
+    }
+};
+
+struct NameOp {
+    FakeContext& context;
+    char order[32];
+    template <typename Driver>
+    void operator()(Driver&) {
+        context.names[static_cast<size_t>(Driver::TYPE)] = Driver::name();
+        strncat(order, Driver::name(), sizeof(order) - strlen(order) - 1);
+    }
+};
+
+void test_visit_dispatches_by_type() {
+    FakeContext context;
+    FakeDrivers drivers(context);
+    TEST_ASSERT_EQUAL(3, FakeDrivers::COUNT);
+    TEST_ASSERT_TRUE(FakeDrivers::contains(ProtocolType::COAP));
+    TEST_ASSERT_FALSE(FakeDrivers::contains(ProtocolType::HTTPS));
+
+    ConnectOp connect = {false};
+    TEST_ASSERT_TRUE(drivers.visit(ProtocolType::COAP, connect));
+    TEST_ASSERT_TRUE(connect.result);
+    TEST_ASSERT_EQUAL(1, drivers.get<FakeCoap>().connects);
+    TEST_ASSERT_EQUAL(0, drivers.get<FakeMqtt>().connects);
+    TEST_ASSERT_TRUE(context.states[static_cast<size_t>(ProtocolType::COAP)] == ProtocolState::CONNECTED);
+    TEST_ASSERT_TRUE(context.states[static_cast<size_t>(ProtocolType::MQTT)] == ProtocolState::DISCONNECTED);
+
+    // No driver registered: the visitor is not called
+    connect.result = false;
+    TEST_ASSERT_FALSE(drivers.visit(ProtocolType::HTTPS, connect));
+    TEST_ASSERT_FALSE(connect.result);
+
+    PublishOp publish = {5, false};
+    TEST_ASSERT_TRUE(drivers.visit(ProtocolType::CUSTOM, publish));
+    TEST_ASSERT_TRUE(publish.result);
+    TEST_ASSERT_EQUAL(1, context.sent[static_cast<size_t>(ProtocolType::CUSTOM)]);
+    TEST_ASSERT_EQUAL(5, context.payloadBytes);
+}
+
+void test_for_each_in_registration_order() {
+    FakeContext context;
+    FakeDrivers drivers(context);
+    NameOp name = {context, ""};
+    drivers.forEach(name);
+    TEST_ASSERT_EQUAL_STRING("MQTTCoAPTCP", name.order);
+    TEST_ASSERT_EQUAL_STRING("CoAP", context.names[static_cast<size_t>(ProtocolType::COAP)]);
+    TEST_ASSERT_EQUAL_STRING("?", context.names[static_cast<size_t>(ProtocolType::HTTP)]);
+
+    const FakeDrivers& constDrivers = drivers;
+    drivers.get<FakeTcp>().connects = 7;
+    TEST_ASSERT_EQUAL(7, constDrivers.get<FakeTcp>().connects);
+}
+
+// Hot path of publish(): "is the uplink up" plus a call into the protocol,
+// once through std::map state and a switch, once through the flat array and
+// the registry
+static const size_t MESSAGES = 2000000;
+
+static uint32_t switchPublish(FakeContext& context, ProtocolType protocol, size_t length) {
+    switch (protocol) {
+        case ProtocolType::MQTT:
+        case ProtocolType::COAP:
+        case ProtocolType::CUSTOM:
+            context.sent[static_cast<size_t>(protocol)]++;
+            context.payloadBytes += (uint32_t)length;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+void test_benchmark_state_lookup_and_dispatch() {
+    static const ProtocolType mix[] = {ProtocolType::MQTT, ProtocolType::MQTT, ProtocolType::COAP,
+                                       ProtocolType::CUSTOM, ProtocolType::HTTP};
+    static const size_t MIX = sizeof(mix) / sizeof(mix[0]);
+
+    FakeContext mapContext;
+    std::map<ProtocolType, ProtocolState> states;
+    for (size_t i = 0; i < PROTOCOL_TYPE_COUNT; i++) {
+        states[static_cast<ProtocolType>(i)] = ProtocolState::DISCONNECTED;
+    }
+    states[ProtocolType::MQTT] = ProtocolState::CONNECTED;
+    states[ProtocolType::COAP] = ProtocolState::CONNECTED;
+    states[ProtocolType::CUSTOM] = ProtocolState::CONNECTED;
+
+    auto start = std::chrono::steady_clock::now();
+    uint32_t mapSent = 0;
+    for (size_t i = 0; i < MESSAGES; i++) {
+        ProtocolType protocol = mix[i % MIX];
+        if (states.at(protocol) == ProtocolState::CONNECTED) {
+            mapSent += switchPublish(mapContext, protocol, i & 0xFF);
+        }
+    }
+    double mapNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / MESSAGES;
+
+    FakeContext flatContext;
+    FakeDrivers drivers(flatContext);
+    ConnectOp connect = {false};
+    drivers.visit(ProtocolType::MQTT, connect);
+    drivers.visit(ProtocolType::COAP, connect);
+    drivers.visit(ProtocolType::CUSTOM, connect);
+
+    start = std::chrono::steady_clock::now();
+    uint32_t flatSent = 0;
+    for (size_t i = 0; i < MESSAGES; i++) {
+        ProtocolType protocol = mix[i % MIX];
+        if (flatContext.states[static_cast<size_t>(protocol)] == ProtocolState::CONNECTED) {
+            PublishOp publish = {i & 0xFF, false};
+            drivers.visit(protocol, publish);
+            flatSent += publish.result ? 1 : 0;
+        }
+    }
+    double flatNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / MESSAGES;
+
+    char line[128];
+    snprintf(line, sizeof(line), "std::map + switch:  %.2f ns/message", mapNs);
+    TEST_MESSAGE(line);
+    snprintf(line, sizeof(line), "flat array + registry: %.2f ns/message", flatNs);
+    TEST_MESSAGE(line);
+
+    // Same work on both paths
+    TEST_ASSERT_EQUAL(mapSent, flatSent);
+    TEST_ASSERT_EQUAL(MESSAGES / MIX * 4, flatSent);
+    TEST_ASSERT_EQUAL(mapContext.payloadBytes, flatContext.payloadBytes);
+}
+
+int runUnityTests() {
+    UNITY_BEGIN();
+    RUN_TEST(test_visit_dispatches_by_type);
+    RUN_TEST(test_for_each_in_registration_order);
+    RUN_TEST(test_benchmark_state_lookup_and_dispatch);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
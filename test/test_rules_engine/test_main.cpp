@@ -0,0 +1,222 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/rules_engine.cpp"
+
+#include <unity.h>
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include "rules_engine.h"
+
+static uint32_t fakeNow = 0;
+static uint32_t fakeClock() {
+    return fakeNow;
+}
+
+static float evaluate(const char* expression, float p0 = 0, float p1 = 0) {
+    RulesEngine engine;
+    float result = NAN;
+    if (engine.addDerived(200, expression) < 0) {
+        return NAN;
+    }
+    engine.setOutput([&result](uint16_t, float value) { result = value; });
+    engine.onSample(1, p1);
+    engine.onSample(0, p0);
+    if (isnan(result)) {
+        // Constant expressions have no inputs; read them back through a dependent
+        engine.getPoint(200, result);
+    }
+    return result;
+}
+
+void test_expressions_compile_and_evaluate() {
+    TEST_ASSERT_EQUAL_FLOAT(7.0f, evaluate("p0 + p1 * 2", 3, 2));
+    TEST_ASSERT_EQUAL_FLOAT(10.0f, evaluate("(p0 + p1) * 2", 3, 2));
+    TEST_ASSERT_EQUAL_FLOAT(-1.0f, evaluate("-p0 + 2", 3));
+    TEST_ASSERT_EQUAL_FLOAT(1.0f, evaluate("p0 >= 3 && !(p1 < 1)", 3, 2));
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, evaluate("p0 > 3 || p1 != 2", 3, 2));
+    TEST_ASSERT_EQUAL_FLOAT(5.0f, evaluate("p0 < p1 ? p0 : p1 + 3", 3, 2));
+    TEST_ASSERT_EQUAL_FLOAT(1.0f, evaluate("p0 % 2", 7));
+    // 4-20 mA on a 12-bit ADC to 0-10 bar, then clamped
+    TEST_ASSERT_FLOAT_WITHIN(1e-4, 5.0f, evaluate("scale(p0, 819, 4095, 0, 10)", 2457));
+    TEST_ASSERT_EQUAL_FLOAT(10.0f, evaluate("clamp(scale(p0, 819, 4095, 0, 10), 0, 10)", 5000));
+    TEST_ASSERT_EQUAL_FLOAT(4.0f, evaluate("max(abs(p0), sqrt(p1))", -4, 9));
+    TEST_ASSERT_EQUAL_FLOAT(3.0f, evaluate("round(min(p0, p1))", 2.6f, 9));
+    // Celsius to Fahrenheit
+    TEST_ASSERT_EQUAL_FLOAT(212.0f, evaluate("p0 * 9 / 5 + 32", 100));
+}
+
+void test_compile_errors_are_reported() {
+    RulesEngine engine;
+    TEST_ASSERT_EQUAL(-1, engine.addDerived(10, "p0 +"));
+    TEST_ASSERT_EQUAL(-1, engine.addDerived(10, "foo(p0)"));
+    TEST_ASSERT_EQUAL_STRING("unknown function 'foo' at column 5", engine.getLastError().c_str());
+    TEST_ASSERT_EQUAL(-1, engine.addDerived(10, "tank + 1"));
+    TEST_ASSERT_EQUAL(-1, engine.addDerived(10, "p999"));
+    TEST_ASSERT_EQUAL(-1, engine.addDerived(10, "(p0 + 1"));
+    TEST_ASSERT_EQUAL(-1, engine.addDerived(10, "p10 + 1"));
+    TEST_ASSERT_EQUAL(-1, engine.addDerived(10, "clamp(p0, 1)"));
+
+    // Deep nesting is bounded by the VM stack
+    std::string deep = "p0";
+    for (int i = 0; i < 20; i++) {
+        deep = "1 + (" + deep + ")";
+    }
+    TEST_ASSERT_EQUAL(-1, engine.addDerived(10, deep.c_str()));
+
+    // Cycles: 11 reads 12, so 12 may not be derived from 11 afterwards
+    TEST_ASSERT_EQUAL(0, engine.addDerived(11, "p12 * 2"));
+    TEST_ASSERT_EQUAL(-1, engine.addDerived(12, "p11 + 1"));
+    TEST_ASSERT_EQUAL(-1, engine.addDerived(11, "p0"));
+    TEST_ASSERT_EQUAL(1, engine.getRuleCount());
+}
+
+void test_derived_points_cascade_and_use_names() {
+    RulesEngine engine;
+    TEST_ASSERT_TRUE(engine.definePoint("level_raw", 0));
+    TEST_ASSERT_TRUE(engine.definePoint("level", 100));
+    TEST_ASSERT_TRUE(engine.definePoint("volume", 101));
+    TEST_ASSERT_EQUAL(0, engine.addDerived(100, "scale(level_raw, 0, 4095, 0, 5)"));
+    TEST_ASSERT_EQUAL(1, engine.addDerived(101, "level * 3.2"));
+
+    std::vector<std::pair<uint16_t, float>> outputs;
+    engine.setOutput([&outputs](uint16_t id, float value) { outputs.push_back(std::make_pair(id, value)); });
+    engine.onSample(0, 4095);
+    TEST_ASSERT_EQUAL(2, (int)outputs.size());
+    TEST_ASSERT_EQUAL(100, outputs[0].first);
+    TEST_ASSERT_EQUAL_FLOAT(5.0f, outputs[0].second);
+    TEST_ASSERT_EQUAL(101, outputs[1].first);
+    TEST_ASSERT_EQUAL_FLOAT(16.0f, outputs[1].second);
+
+    // Unrelated points trigger nothing; division by zero is dropped
+    outputs.clear();
+    engine.onSample(7, 1);
+    TEST_ASSERT_EQUAL(0, (int)outputs.size());
+    TEST_ASSERT_TRUE(engine.addDerived(102, "volume / p8") >= 0);
+    engine.onSample(8, 0);
+    TEST_ASSERT_EQUAL(0, (int)outputs.size());
+    TEST_ASSERT_EQUAL(1, engine.getStats().invalid);
+}
+
+void test_alarms_with_hold_time() {
+    fakeNow = 0;
+    RulesEngine engine;
+    engine.setClock(fakeClock);
+    std::vector<std::pair<std::string, bool>> events;
+    std::vector<std::pair<uint16_t, float>> outputs;
+    engine.setAlarmCallback([&events](const char* name, bool active) { events.push_back(std::make_pair(std::string(name), active)); });
+    engine.setOutput([&outputs](uint16_t id, float value) { outputs.push_back(std::make_pair(id, value)); });
+
+    int highIndex = engine.addAlarm("pressure_high", "p0 > 8", 5000, 150);
+    int missingIndex = engine.addAlarm("flow_missing", "p0 > 2 && p1 < 0.5");
+    TEST_ASSERT_EQUAL(0, highIndex);
+    TEST_ASSERT_EQUAL(1, missingIndex);
+
+    // p1 has no value yet: the second alarm cannot be evaluated
+    engine.onSample(0, 9);
+    TEST_ASSERT_EQUAL(0, (int)events.size());
+    TEST_ASSERT_EQUAL(1, engine.getStats().skipped);
+
+    // A spike shorter than the hold time never raises
+    fakeNow = 2000;
+    engine.onSample(0, 7);
+    fakeNow = 3000;
+    engine.onSample(0, 9);
+    fakeNow = 7000;
+    engine.update();
+    TEST_ASSERT_FALSE(engine.isAlarmActive(highIndex));
+    fakeNow = 8000;
+    engine.update();
+    TEST_ASSERT_TRUE(engine.isAlarmActive(highIndex));
+    TEST_ASSERT_EQUAL(1, (int)events.size());
+    TEST_ASSERT_EQUAL_STRING("pressure_high", events[0].first.c_str());
+    TEST_ASSERT_EQUAL(150, outputs.back().first);
+    TEST_ASSERT_EQUAL_FLOAT(1.0f, outputs.back().second);
+
+    engine.onSample(1, 0.1f);
+    TEST_ASSERT_TRUE(engine.isAlarmActive(missingIndex));
+    engine.onSample(0, 1);
+    TEST_ASSERT_FALSE(engine.isAlarmActive(highIndex));
+    TEST_ASSERT_FALSE(engine.isAlarmActive(missingIndex));
+    TEST_ASSERT_EQUAL(4, (int)events.size());
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, outputs.back().second);
+}
+
+// 16 field points recorded at 1 s over ~2 hours, replayed as fast as possible
+// through 64 rules (scaling, conversions, derived points and alarms)
+static void recordTrace(std::vector<std::pair<uint16_t, float>>& trace) {
+    uint32_t seed = 12345;
+    for (int second = 0; second < 8000; second++) {
+        for (uint16_t point = 0; point < 16; point++) {
+            seed = seed * 1103515245u + 12345u;
+            float noise = (float)((seed >> 16) & 0x3FF) / 1024.0f - 0.5f;
+            float value = 2048.0f + 1500.0f * sinf(second / (30.0f + point)) + 40.0f * noise;
+            trace.push_back(std::make_pair(point, value));
+        }
+    }
+}
+
+void test_rules_per_second_on_recorded_data() {
+    RulesEngine engine;
+    char expression[96];
+    // Rules go in dependency order: scaling, then everything derived from it
+    for (uint16_t point = 0; point < 16; point++) {
+        snprintf(expression, sizeof(expression), "scale(p%u, 819, 4095, 0, 100)", point);
+        TEST_ASSERT_TRUE(engine.addDerived(100 + point, expression) >= 0);
+    }
+    for (uint16_t point = 0; point < 16; point++) {
+        snprintf(expression, sizeof(expression), "p%u * 9 / 5 + 32", 100 + point);
+        TEST_ASSERT_TRUE(engine.addDerived(120 + point, expression) >= 0);
+        snprintf(expression, sizeof(expression), "clamp((p%u + p%u) / 2, 0, 100)", 100 + point, 100 + (point + 1) % 16);
+        TEST_ASSERT_TRUE(engine.addDerived(140 + point, expression) >= 0);
+        snprintf(expression, sizeof(expression), "p%u > 90 || (p%u < 5 && p%u > 10)", 100 + point, 100 + point, point);
+        TEST_ASSERT_TRUE(engine.addAlarm("limit", expression, 3000, 160 + point) >= 0);
+    }
+    uint32_t outputs = 0;
+    engine.setOutput([&outputs](uint16_t, float) { outputs++; });
+
+    std::vector<std::pair<uint16_t, float>> trace;
+    recordTrace(trace);
+
+    // Alarm hold times follow the recording's time base, not the replay speed
+    fakeNow = 0;
+    engine.setClock(fakeClock);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < trace.size(); i++) {
+        fakeNow = (uint32_t)(i / 16) * 1000;
+        engine.onSample(trace[i].first, trace[i].second);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double rate = engine.getStats().evaluations / seconds;
+
+    char message[160];
+    snprintf(message, sizeof(message), "%u rules, %u bytes of bytecode, %u samples -> %u evaluations in %.1f ms (%.0f rules/s)",
+             (unsigned)engine.getRuleCount(), (unsigned)engine.getCodeSize(), (unsigned)trace.size(),
+             (unsigned)engine.getStats().evaluations, seconds * 1000.0, rate);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_GREATER_THAN(0, outputs);
+    TEST_ASSERT_GREATER_THAN(0, engine.getStats().alarmsRaised);
+    TEST_ASSERT_GREATER_OR_EQUAL(10000.0, rate);
+}
+
+int runUnityTests() {
+    UNITY_BEGIN();
+    RUN_TEST(test_expressions_compile_and_evaluate);
+    RUN_TEST(test_compile_errors_are_reported);
+    RUN_TEST(test_derived_points_cascade_and_use_names);
+    RUN_TEST(test_alarms_with_hold_time);
+    RUN_TEST(test_rules_per_second_on_recorded_data);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
@@ -0,0 +1,361 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/modbus_gateway.cpp"
+#include "../../src/serial_trace.cpp"
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "serial_trace.h"
+
+static uint64_t fakeNowUs = 0;
+static uint64_t fakeClockUs() {
+    return fakeNowUs;
+}
+static uint32_t fakeClockMs() {
+    return (uint32_t)(fakeNowUs / 1000);
+}
+
+// RTU slave on a 9600 baud line that hands out its reply byte by byte, as
+// a UART FIFO would
+class ByteWiseRtuSlave : public ModbusSerial {
+public:
+    static const uint32_t BAUD = 9600;
+    static const uint32_t CHAR_US = 10 * 1000000 / BAUD;
+    static const uint32_t TURNAROUND_US = 4000;
+
+    uint16_t holding[100];
+
+    ByteWiseRtuSlave(uint16_t seed) : readyFrom(0), readIndex(0) {
+        for (uint16_t i = 0; i < 100; i++) {
+            holding[i] = (uint16_t)(seed + i * 7);
+        }
+    }
+
+    bool write(const uint8_t* data, size_t length) override {
+        uint16_t start = getU16(data + 2);
+        uint16_t count = getU16(data + 4);
+        response.clear();
+        readIndex = 0;
+        response.push_back(data[0]);
+        response.push_back(data[1]);
+        response.push_back((uint8_t)(count * 2));
+        for (uint16_t i = 0; i < count; i++) {
+            response.push_back((uint8_t)(holding[start + i] >> 8));
+            response.push_back((uint8_t)holding[start + i]);
+        }
+        uint16_t crc = modbusCrc16(response.data(), response.size());
+        response.push_back((uint8_t)crc);
+        response.push_back((uint8_t)(crc >> 8));
+        readyFrom = fakeNowUs + length * CHAR_US + TURNAROUND_US;
+        return true;
+    }
+
+    int read(uint8_t* data, size_t capacity) override {
+        size_t count = 0;
+        while (count < capacity && readIndex < response.size() &&
+               fakeNowUs >= readyFrom + (readIndex + 1) * CHAR_US) {
+            data[count++] = response[readIndex++];
+        }
+        return (int)count;
+    }
+
+    uint32_t getBaud() const override {
+        return BAUD;
+    }
+
+private:
+    std::vector<uint8_t> response;
+    uint64_t readyFrom;
+    size_t readIndex;
+};
+
+struct PollResult {
+    std::vector<uint16_t> values;
+    uint32_t elapsedMs;
+};
+
+// Polls three blocks in turn, the way initModbusGateway's poll list does
+static PollResult pollSession(ModbusSerial& serial, int rounds) {
+    ModbusRtuMaster master(serial);
+    master.setClock(fakeClockMs);
+    PollResult result;
+    uint64_t startedAt = fakeNowUs;
+    const uint16_t starts[3] = { 0, 20, 50 };
+    for (int round = 0; round < rounds; round++) {
+        for (int block = 0; block < 3; block++) {
+            bool done = false;
+            master.read(1, ModbusFunction::READ_HOLDING_REGISTERS, starts[block], 10,
+                        [&](uint8_t exception, const uint16_t* values, uint16_t count) {
+                            done = true;
+                            if (exception == ModbusException::NONE) {
+                                result.values.insert(result.values.end(), values, values + count);
+                            }
+                        });
+            while (!done && fakeNowUs - startedAt < 60000000ULL) {
+                fakeNowUs += 250;
+                master.update();
+            }
+        }
+    }
+    result.elapsedMs = (uint32_t)((fakeNowUs - startedAt) / 1000);
+    return result;
+}
+
+static std::vector<uint8_t> captureSession(ByteWiseRtuSlave& slave, int rounds, PollResult& live) {
+    static uint8_t buffer[32768];
+    RamTraceSink sink(buffer, sizeof(buffer));
+    TraceRecorder recorder;
+    recorder.setClock(fakeClockUs);
+    CaptureModbusSerial capture(slave, recorder);
+    recorder.begin(sink);
+    live = pollSession(capture, rounds);
+    recorder.end();
+    return std::vector<uint8_t>(sink.data(), sink.data() + sink.length());
+}
+
+void test_records_are_coalesced_and_timestamped() {
+    fakeNowUs = 1000000;
+    uint8_t buffer[256];
+    RamTraceSink sink(buffer, sizeof(buffer));
+    TraceRecorder recorder;
+    recorder.setClock(fakeClockUs);
+    TEST_ASSERT_TRUE(recorder.begin(sink));
+
+    const uint8_t request[] = { 0x01, 0x03, 0x00, 0x00, 0x00, 0x02, 0xC4, 0x0B };
+    recorder.record(TraceChannel::MODBUS, TraceDirection::TX, request, sizeof(request));
+    // Reply bytes 1 ms apart arrive as one record
+    fakeNowUs += 10000;
+    for (uint8_t i = 0; i < 9; i++) {
+        recorder.record(TraceChannel::MODBUS, TraceDirection::RX, &i, 1);
+        fakeNowUs += 1000;
+    }
+    // A LoRa byte between them splits nothing on Modbus but gets its own record
+    fakeNowUs += 5000;
+    const uint8_t lora[] = { 0xAA, 0x55 };
+    recorder.record(TraceChannel::LORA, TraceDirection::RX, lora, sizeof(lora));
+    recorder.end();
+    TEST_ASSERT_FALSE(recorder.isRecording());
+
+    TEST_ASSERT_EQUAL(3, recorder.getStats().records);
+    TEST_ASSERT_EQUAL(19, recorder.getStats().bytes);
+    TEST_ASSERT_EQUAL(sink.length(), recorder.getStats().traceBytes);
+    // 4 magic + 3 records of 3-4 header bytes around 19 data bytes
+    TEST_ASSERT_LESS_OR_EQUAL(4 + 3 * 4 + 19, sink.length());
+
+    TraceReader reader(sink.data(), sink.length());
+    TEST_ASSERT_TRUE(reader.isValid());
+    TraceRecord record;
+    TEST_ASSERT_TRUE(reader.next(record));
+    TEST_ASSERT_EQUAL(TraceChannel::MODBUS, record.channel);
+    TEST_ASSERT_EQUAL(TraceDirection::TX, record.direction);
+    TEST_ASSERT_EQUAL(0, (int)record.timeUs);
+    TEST_ASSERT_EQUAL_MEMORY(request, record.data, sizeof(request));
+    TEST_ASSERT_TRUE(reader.next(record));
+    TEST_ASSERT_EQUAL(TraceDirection::RX, record.direction);
+    TEST_ASSERT_EQUAL(10000, (int)record.timeUs);
+    TEST_ASSERT_EQUAL(9, record.length);
+    TEST_ASSERT_EQUAL(8, record.data[8]);
+    TEST_ASSERT_TRUE(reader.next(record));
+    TEST_ASSERT_EQUAL(TraceChannel::LORA, record.channel);
+    TEST_ASSERT_EQUAL(24000, (int)record.timeUs);
+    TEST_ASSERT_FALSE(reader.next(record));
+
+    // A truncated tail ends the trace instead of reading past it
+    TraceReader truncated(sink.data(), sink.length() - 1);
+    size_t count = 0;
+    while (truncated.next(record)) {
+        count++;
+    }
+    TEST_ASSERT_EQUAL(2, count);
+    const uint8_t foreign[] = { 'X', 'B', 'T', '1', 0x00 };
+    TraceReader other(foreign, sizeof(foreign));
+    TEST_ASSERT_FALSE(other.isValid());
+    TEST_ASSERT_FALSE(other.next(record));
+}
+
+void test_full_sink_drops_whole_records() {
+    fakeNowUs = 0;
+    uint8_t buffer[64];
+    RamTraceSink sink(buffer, sizeof(buffer));
+    TraceRecorder recorder;
+    recorder.setClock(fakeClockUs);
+    TEST_ASSERT_TRUE(recorder.begin(sink));
+
+    uint8_t frame[20];
+    memset(frame, 0x5A, sizeof(frame));
+    for (int i = 0; i < 5; i++) {
+        recorder.record(TraceChannel::ZIGBEE, TraceDirection::RX, frame, sizeof(frame));
+        fakeNowUs += 50000;
+    }
+    recorder.end();
+
+    // 4 + 2 x 23 fit; the rest is counted, not half-written
+    TEST_ASSERT_EQUAL(2, recorder.getStats().records);
+    TEST_ASSERT_EQUAL(60, recorder.getStats().droppedBytes);
+    TraceReader reader(sink.data(), sink.length());
+    TraceRecord record;
+    size_t count = 0;
+    while (reader.next(record)) {
+        count++;
+    }
+    TEST_ASSERT_EQUAL(2, count);
+    TEST_ASSERT_TRUE(reader.isValid());
+}
+
+void test_modbus_replay_reproduces_the_session() {
+    fakeNowUs = 5000000;
+    ByteWiseRtuSlave slave(100);
+    PollResult live;
+    std::vector<uint8_t> trace = captureSession(slave, 4, live);
+    TEST_ASSERT_EQUAL(4 * 3 * 10, live.values.size());
+
+    // The slave is gone; the trace alone answers the master
+    fakeNowUs = 90000000;
+    ReplayModbusSerial replay(trace.data(), trace.size(), ByteWiseRtuSlave::BAUD);
+    replay.setClock(fakeClockUs);
+    PollResult recorded = pollSession(replay, 4);
+    TEST_ASSERT_EQUAL(0, replay.getStats().mismatches);
+    TEST_ASSERT_EQUAL(0, replay.getStats().unanswered);
+    TEST_ASSERT_TRUE(replay.isFinished());
+    TEST_ASSERT_TRUE(recorded.values == live.values);
+    // Recorded speed keeps the bus timing to within a poll step per exchange
+    TEST_ASSERT_INT_WITHIN(12, (int)live.elapsedMs, (int)recorded.elapsedMs);
+
+    ReplayModbusSerial fast(trace.data(), trace.size(), ByteWiseRtuSlave::BAUD);
+    fast.setClock(fakeClockUs);
+    fast.setSpeed(ReplaySpeed::AS_FAST_AS_POSSIBLE);
+    PollResult quick = pollSession(fast, 4);
+    TEST_ASSERT_TRUE(quick.values == live.values);
+    TEST_ASSERT_LESS_THAN(live.elapsedMs / 4, quick.elapsedMs);
+
+    // A request that differs from the capture is counted, and running past
+    // the end leaves the master to time out
+    ReplayModbusSerial drift(trace.data(), trace.size(), ByteWiseRtuSlave::BAUD);
+    drift.setClock(fakeClockUs);
+    ModbusRtuMaster master(drift);
+    master.setClock(fakeClockMs);
+    master.read(1, ModbusFunction::READ_HOLDING_REGISTERS, 1, 10, nullptr);
+    while (master.isBusy()) {
+        fakeNowUs += 250;
+        master.update();
+    }
+    TEST_ASSERT_EQUAL(1, drift.getStats().mismatches);
+
+    char message[160];
+    snprintf(message, sizeof(message), "%u exchanges: live %u ms, recorded replay %u ms, fast replay %u ms, trace %u bytes",
+             12u, (unsigned)live.elapsedMs, (unsigned)recorded.elapsedMs, (unsigned)quick.elapsedMs,
+             (unsigned)trace.size());
+    TEST_MESSAGE(message);
+}
+
+void test_replayer_delivers_per_channel_on_time() {
+    fakeNowUs = 0;
+    uint8_t buffer[512];
+    RamTraceSink sink(buffer, sizeof(buffer));
+    TraceRecorder recorder;
+    recorder.setClock(fakeClockUs);
+    recorder.begin(sink);
+    const uint8_t frame[] = { 1, 2, 3 };
+    for (int i = 0; i < 10; i++) {
+        recorder.record(i % 2 ? TraceChannel::LORA : TraceChannel::ZIGBEE, TraceDirection::RX, frame, sizeof(frame));
+        fakeNowUs += 100000;
+    }
+    recorder.end();
+
+    std::vector<uint64_t> loraAt;
+    size_t zigbee = 0;
+    fakeNowUs = 7000000;
+    TraceReplayer replayer(sink.data(), sink.length());
+    replayer.setClock(fakeClockUs);
+    replayer.setHandler(TraceChannel::LORA, [&](const TraceRecord& record) {
+        TEST_ASSERT_EQUAL(3, record.length);
+        loraAt.push_back(fakeNowUs - 7000000);
+    });
+    replayer.setHandler(TraceChannel::ZIGBEE, [&](const TraceRecord&) { zigbee++; });
+    TEST_ASSERT_TRUE(replayer.begin());
+    while (replayer.update()) {
+        fakeNowUs += 1000;
+    }
+    TEST_ASSERT_EQUAL(5, loraAt.size());
+    TEST_ASSERT_EQUAL(5, zigbee);
+    for (size_t i = 0; i < loraAt.size(); i++) {
+        TEST_ASSERT_EQUAL(100000 + 200000 * i, (int)loraAt[i]);
+    }
+
+    // As fast as possible: everything in one update
+    zigbee = 0;
+    replayer.setSpeed(ReplaySpeed::AS_FAST_AS_POSSIBLE);
+    TEST_ASSERT_TRUE(replayer.begin());
+    TEST_ASSERT_FALSE(replayer.update());
+    TEST_ASSERT_EQUAL(5, zigbee);
+    TEST_ASSERT_TRUE(replayer.begin());
+    TEST_ASSERT_EQUAL(10, replayer.run());
+    TEST_ASSERT_TRUE(replayer.isFinished());
+}
+
+void test_trace_throughput() {
+    // Ten minutes of Modbus capture: 3 blocks polled every second
+    fakeNowUs = 0;
+    ByteWiseRtuSlave slave(7);
+    static uint8_t buffer[1 << 20];
+    RamTraceSink sink(buffer, sizeof(buffer));
+    TraceRecorder recorder;
+    recorder.setClock(fakeClockUs);
+    CaptureModbusSerial capture(slave, recorder);
+    recorder.begin(sink);
+    uint32_t exchanges = 0;
+    while (fakeNowUs < 600ULL * 1000000) {
+        pollSession(capture, 1);
+        exchanges += 3;
+        fakeNowUs = (fakeNowUs / 1000000 + 1) * 1000000;
+    }
+    recorder.end();
+    const TraceRecorderStats& stats = recorder.getStats();
+    TEST_ASSERT_EQUAL(0, stats.droppedBytes);
+    TEST_ASSERT_EQUAL(exchanges * 2, stats.records);
+    double overhead = (double)(stats.traceBytes - stats.bytes) / stats.bytes;
+    // Tag, delta and length cost 4-5 bytes on frames of 8 and 25 bytes
+    TEST_ASSERT_TRUE(overhead < 0.35);
+
+    auto started = std::chrono::steady_clock::now();
+    const int passes = 20;
+    size_t records = 0;
+    for (int pass = 0; pass < passes; pass++) {
+        TraceReplayer replayer(sink.data(), sink.length());
+        replayer.begin();
+        records += replayer.run();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    TEST_ASSERT_EQUAL(passes * stats.records, records);
+
+    char message[200];
+    snprintf(message, sizeof(message), "10 min capture: %u exchanges, %u bus bytes -> %u trace bytes (%.1f%% framing), "
+             "replay parse %.0f MB/s",
+             (unsigned)exchanges, (unsigned)stats.bytes, (unsigned)stats.traceBytes, overhead * 100,
+             passes * sink.length() / seconds / 1e6);
+    TEST_MESSAGE(message);
+}
+
+int runUnityTests() {
+    UNITY_BEGIN();
+    RUN_TEST(test_records_are_coalesced_and_timestamped);
+    RUN_TEST(test_full_sink_drops_whole_records);
+    RUN_TEST(test_modbus_replay_reproduces_the_session);
+    RUN_TEST(test_replayer_delivers_per_channel_on_time);
+    RUN_TEST(test_trace_throughput);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
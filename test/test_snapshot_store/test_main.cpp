@@ -0,0 +1,267 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/lz_codec.cpp"
+#include "../../src/snapshot_store.cpp"
+
+#include <unity.h>
+#include <stdio.h>
+#include <chrono>
+#include <map>
+#include "snapshot_store.h"
+
+// SPIFFS stand-in; usedBytes() approximates flash footprint with the
+// 256-byte SPIFFS page granularity
+class MemoryStorage : public SnapshotStorage {
+public:
+    std::map<std::string, std::vector<uint8_t>> files;
+
+    bool writeFile(const std::string& path, const uint8_t* data, size_t length) override {
+        files[path].assign(data, data + length);
+        return true;
+    }
+    bool readFile(const std::string& path, std::vector<uint8_t>& data) override {
+        auto it = files.find(path);
+        if (it == files.end()) {
+            return false;
+        }
+        data = it->second;
+        return true;
+    }
+    bool exists(const std::string& path) override {
+        return files.count(path) > 0;
+    }
+    bool remove(const std::string& path) override {
+        return files.erase(path) > 0;
+    }
+    void list(const std::string& prefix, std::vector<std::string>& paths) override {
+        for (auto& entry : files) {
+            if (entry.first.compare(0, prefix.size(), prefix) == 0) {
+                paths.push_back(entry.first);
+            }
+        }
+    }
+    size_t usedBytes() const {
+        size_t total = 0;
+        for (auto& entry : files) {
+            total += (entry.second.size() + 255) / 256 * 256;
+        }
+        return total;
+    }
+};
+
+static std::string maintenanceConfig;
+static std::string protocolConfig;
+static std::string pollList;
+
+static void resetConfigs() {
+    maintenanceConfig = "{\"deviceId\":\"CERISE-GW-1a2b3c\",\"firmwareVersion\":\"1.0.0\","
+                        "\"autoUpdate\":true,\"updateServer\":\"https://update.cerise-gw.com\"}";
+    protocolConfig = "{\"mqttBroker\":\"broker.local\",\"mqttPort\":1883,\"mqttClientId\":\"gw\","
+                     "\"httpServer\":\"api.local\",\"httpPort\":80,\"wsServer\":\"ws.local\"}";
+    pollList.clear();
+    for (int i = 0; i < 120; i++) {
+        char line[64];
+        snprintf(line, sizeof(line), "{\"slave\":%d,\"register\":%d,\"count\":2,\"period\":1000},", i % 8 + 1, 40001 + i * 2);
+        pollList += line;
+    }
+}
+
+static std::string chunkFile(const std::string& content) {
+    uint64_t hash = snapshotHash((const uint8_t*)content.data(), content.size());
+    char path[40];
+    snprintf(path, sizeof(path), "/backup/c/%08lx%08lx", (unsigned long)(hash >> 32), (unsigned long)(hash & 0xFFFFFFFF));
+    return path;
+}
+
+static void addSource(SnapshotStore& store, const char* name, std::string& value) {
+    store.addSource(name,
+        [&value](std::vector<uint8_t>& data) {
+            data.assign(value.begin(), value.end());
+            return true;
+        },
+        [&value](const uint8_t* data, size_t length) {
+            value.assign((const char*)data, length);
+            return true;
+        });
+}
+
+static void addSources(SnapshotStore& store) {
+    addSource(store, "maintenance", maintenanceConfig);
+    addSource(store, "protocol", protocolConfig);
+    addSource(store, "polls", pollList);
+}
+
+void test_lz_roundtrip() {
+    LzCodec codec;
+    resetConfigs();
+    std::vector<uint8_t> out(LzCodec::maxCompressedSize(pollList.size()));
+    size_t n = codec.compress((const uint8_t*)pollList.data(), pollList.size(), out.data(), out.size());
+    TEST_ASSERT_GREATER_THAN(0, n);
+    TEST_ASSERT_LESS_THAN(pollList.size() / 3, n);
+
+    std::vector<uint8_t> back(pollList.size());
+    TEST_ASSERT_EQUAL(pollList.size(), LzCodec::decompress(out.data(), n, back.data(), back.size()));
+    TEST_ASSERT_EQUAL_MEMORY(pollList.data(), back.data(), back.size());
+}
+
+void test_backup_and_restore_latest() {
+    MemoryStorage storage;
+    SnapshotStore store(storage);
+    addSources(store);
+    resetConfigs();
+
+    TEST_ASSERT_TRUE(store.create(1000));
+    protocolConfig = "{\"mqttBroker\":\"new-broker\"}";
+    TEST_ASSERT_TRUE(store.create(2000));
+
+    protocolConfig = "garbage";
+    maintenanceConfig = "garbage";
+    TEST_ASSERT_TRUE(store.restoreLatest());
+    TEST_ASSERT_EQUAL(2, store.getRestoredSequence());
+    TEST_ASSERT_EQUAL_STRING("{\"mqttBroker\":\"new-broker\"}", protocolConfig.c_str());
+    TEST_ASSERT_TRUE(maintenanceConfig.find("CERISE-GW") != std::string::npos);
+}
+
+void test_unchanged_stores_are_deduplicated() {
+    MemoryStorage storage;
+    SnapshotStore store(storage);
+    addSources(store);
+    resetConfigs();
+
+    TEST_ASSERT_TRUE(store.create(1000));
+    uint32_t firstChunks = store.getStats().chunksWritten;
+    protocolConfig += " ";
+    TEST_ASSERT_TRUE(store.create(2000));
+    TEST_ASSERT_EQUAL(firstChunks + 1, store.getStats().chunksWritten);
+}
+
+void test_retention_prunes_old_snapshots_and_chunks() {
+    MemoryStorage storage;
+    SnapshotStore store(storage);
+    store.setRetention(3);
+    addSources(store);
+    resetConfigs();
+
+    for (int i = 0; i < 10; i++) {
+        protocolConfig = "{\"revision\":" + std::to_string(i) + "}";
+        TEST_ASSERT_TRUE(store.create(i));
+    }
+    TEST_ASSERT_EQUAL(3, store.getSnapshotCount());
+    TEST_ASSERT_EQUAL(10, store.getLatestSequence());
+
+    std::vector<std::string> chunks;
+    storage.list("/backup/c/", chunks);
+    // Shared maintenance and poll chunks plus one protocol chunk per snapshot
+    size_t pollChunks = (pollList.size() + SnapshotStore::CHUNK_SIZE - 1) / SnapshotStore::CHUNK_SIZE;
+    TEST_ASSERT_EQUAL(1 + pollChunks + 3, chunks.size());
+}
+
+void test_corrupted_latest_falls_back_to_previous() {
+    MemoryStorage storage;
+    SnapshotStore store(storage);
+    addSources(store);
+    resetConfigs();
+
+    protocolConfig = "{\"revision\":1}";
+    TEST_ASSERT_TRUE(store.create(1));
+    protocolConfig = "{\"revision\":2}";
+    TEST_ASSERT_TRUE(store.create(2));
+
+    // Flip a byte in the chunk only snapshot 2 references
+    std::string path = chunkFile("{\"revision\":2}");
+    TEST_ASSERT_TRUE(storage.exists(path));
+    storage.files[path].back() ^= 0x01;
+
+    TEST_ASSERT_FALSE(store.verify(2));
+    TEST_ASSERT_TRUE(store.restoreLatest());
+    TEST_ASSERT_EQUAL(1, store.getRestoredSequence());
+    TEST_ASSERT_EQUAL_STRING("{\"revision\":1}", protocolConfig.c_str());
+}
+
+void test_damaged_chunk_is_rewritten() {
+    MemoryStorage storage;
+    SnapshotStore store(storage);
+    addSources(store);
+    resetConfigs();
+
+    TEST_ASSERT_TRUE(store.create(1));
+    std::string path = chunkFile(maintenanceConfig);
+    storage.files[path].resize(storage.files[path].size() / 2);
+
+    // The next snapshot shares the chunk; it must not inherit the damage
+    TEST_ASSERT_TRUE(store.create(2));
+    TEST_ASSERT_EQUAL(1, store.getStats().chunksRepaired);
+    TEST_ASSERT_TRUE(store.verify(2));
+}
+
+void test_unreadable_manifest_keeps_chunks() {
+    MemoryStorage storage;
+    SnapshotStore store(storage);
+    addSources(store);
+    resetConfigs();
+
+    protocolConfig = "{\"revision\":1}";
+    TEST_ASSERT_TRUE(store.create(1));
+    storage.files["/backup/m_00000001"].back() ^= 0x01;
+
+    protocolConfig = "{\"revision\":2}";
+    TEST_ASSERT_TRUE(store.create(2));
+    TEST_ASSERT_EQUAL(0, store.getStats().chunksRemoved);
+    TEST_ASSERT_TRUE(storage.exists(chunkFile("{\"revision\":1}")));
+}
+
+void test_benchmark_backup_restore() {
+    MemoryStorage storage;
+    SnapshotStore store(storage);
+    addSources(store);
+    resetConfigs();
+    size_t rawSize = maintenanceConfig.size() + protocolConfig.size() + pollList.size();
+
+    const int rounds = 50;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        protocolConfig = "{\"revision\":" + std::to_string(i) + "}";
+        TEST_ASSERT_TRUE(store.create(i));
+    }
+    double backupSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        TEST_ASSERT_TRUE(store.restoreLatest());
+    }
+    double restoreSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    char message[200];
+    snprintf(message, sizeof(message),
+             "raw %u B, %u snapshots in %u B flash (one-shot JSON per snapshot: %u B), "
+             "backup %.1f us, restore %.1f us",
+             (unsigned)rawSize, (unsigned)store.getSnapshotCount(), (unsigned)storage.usedBytes(),
+             (unsigned)((rawSize + 255) / 256 * 256 * store.getSnapshotCount()),
+             backupSeconds * 1e6 / rounds, restoreSeconds * 1e6 / rounds);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_THAN(rawSize * store.getSnapshotCount() / 2, storage.usedBytes());
+}
+
+int runUnityTests() {
+    UNITY_BEGIN();
+    RUN_TEST(test_lz_roundtrip);
+    RUN_TEST(test_backup_and_restore_latest);
+    RUN_TEST(test_unchanged_stores_are_deduplicated);
+    RUN_TEST(test_retention_prunes_old_snapshots_and_chunks);
+    RUN_TEST(test_corrupted_latest_falls_back_to_previous);
+    RUN_TEST(test_damaged_chunk_is_rewritten);
+    RUN_TEST(test_unreadable_manifest_keeps_chunks);
+    RUN_TEST(test_benchmark_backup_restore);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
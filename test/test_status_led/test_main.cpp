@@ -0,0 +1,265 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/status_led.cpp"
+
+#include <unity.h>
+#include <stdio.h>
+#include "status_led.h"
+
+static const LedColor GREEN = {0, 255, 0};
+static const LedColor RED = {255, 0, 0};
+static const LedColor ORANGE = {255, 165, 0};
+static const LedColor OFF = {0, 0, 0};
+
+class FakeLedDriver : public LedDriver {
+public:
+    bool busy;
+    uint32_t shows;
+    LedColor last;
+
+    FakeLedDriver() : busy(false), shows(0), last(OFF) {}
+
+    bool begin() override {
+        return true;
+    }
+
+    bool isBusy() const override {
+        return busy;
+    }
+
+    bool show(const LedColor* pixels, size_t count) override {
+        if (busy || count != 1) {
+            return false;
+        }
+        last = pixels[0];
+        shows++;
+        return true;
+    }
+};
+
+static void assertColor(LedColor expected, LedColor actual) {
+    TEST_ASSERT_EQUAL_UINT8(expected.r, actual.r);
+    TEST_ASSERT_EQUAL_UINT8(expected.g, actual.g);
+    TEST_ASSERT_EQUAL_UINT8(expected.b, actual.b);
+}
+
+static uint32_t luminance(LedColor color) {
+    return (uint32_t)color.r + color.g + color.b;
+}
+
+void test_pattern_priority() {
+    FakeLedDriver driver;
+    StatusIndicator indicator(driver);
+    indicator.setBase(GREEN);
+    TEST_ASSERT_EQUAL(LedPattern::SOLID, indicator.getPattern());
+    assertColor(GREEN, indicator.compute(123));
+
+    indicator.setBacklog(StatusIndicator::DEFAULT_BACKLOG_THRESHOLD - 1);
+    TEST_ASSERT_EQUAL(LedPattern::SOLID, indicator.getPattern());
+    indicator.setBacklog(StatusIndicator::DEFAULT_BACKLOG_THRESHOLD);
+    TEST_ASSERT_EQUAL(LedPattern::BREATHE, indicator.getPattern());
+
+    // Link down outranks the backlog, an update outranks both, a fault everything
+    indicator.setLinkUp(false);
+    TEST_ASSERT_EQUAL(LedPattern::BLINK, indicator.getPattern());
+    assertColor(GREEN, indicator.compute(0));
+    indicator.setProgress(50);
+    assertColor(ORANGE, indicator.compute(0));
+    indicator.setFault(true);
+    TEST_ASSERT_EQUAL(LedPattern::SOLID, indicator.getPattern());
+    assertColor(RED, indicator.compute(0));
+    assertColor(RED, indicator.compute(700));
+
+    indicator.setFault(false);
+    indicator.setProgress(-1);
+    indicator.setLinkUp(true);
+    indicator.setBacklog(0);
+    assertColor(GREEN, indicator.compute(700));
+
+    // Brightness scales every pattern
+    indicator.setBrightness(50);
+    LedColor dimmed = indicator.compute(0);
+    TEST_ASSERT_EQUAL_UINT8(0, dimmed.r);
+    TEST_ASSERT_EQUAL_UINT8(50, dimmed.g);
+}
+
+void test_blink_and_ota_timing() {
+    FakeLedDriver driver;
+    StatusIndicator indicator(driver);
+    indicator.setBase(GREEN);
+    indicator.setLinkUp(false);
+    // 1 Hz, 50% duty, from the clock rather than the loop count
+    assertColor(GREEN, indicator.compute(10000));
+    assertColor(GREEN, indicator.compute(10499));
+    assertColor(OFF, indicator.compute(10500));
+    assertColor(OFF, indicator.compute(10999));
+    assertColor(GREEN, indicator.compute(11000));
+
+    // OTA: on-time grows from 10% to 90% of the period with progress
+    indicator.setProgress(0);
+    assertColor(ORANGE, indicator.compute(5099));
+    assertColor(OFF, indicator.compute(5100));
+    indicator.setProgress(50);
+    assertColor(ORANGE, indicator.compute(5499));
+    assertColor(OFF, indicator.compute(5500));
+    indicator.setProgress(100);
+    assertColor(ORANGE, indicator.compute(5899));
+    assertColor(OFF, indicator.compute(5900));
+    indicator.setProgress(250);
+    assertColor(ORANGE, indicator.compute(5899));
+}
+
+void test_breathe_speeds_up_with_backlog() {
+    FakeLedDriver driver;
+    StatusIndicator indicator(driver);
+    indicator.setBase(GREEN);
+
+    // At the threshold: one slow breath; dim at the ends, full at the middle
+    indicator.setBacklog(StatusIndicator::DEFAULT_BACKLOG_THRESHOLD);
+    uint32_t slow = StatusIndicator::BREATHE_SLOW_MS;
+    LedColor dim = indicator.compute(0);
+    TEST_ASSERT_GREATER_THAN(0, luminance(dim));
+    TEST_ASSERT_LESS_THAN(luminance(GREEN) / 8, luminance(dim));
+    assertColor(GREEN, indicator.compute(slow / 2));
+    TEST_ASSERT_LESS_THAN(luminance(indicator.compute(slow / 2)), luminance(indicator.compute(slow / 4)));
+    assertColor(dim, indicator.compute(slow));
+
+    // Full backlog: four times as fast
+    indicator.setBacklog(StatusIndicator::DEFAULT_BACKLOG_FULL);
+    uint32_t fast = StatusIndicator::BREATHE_FAST_MS;
+    assertColor(GREEN, indicator.compute(fast / 2));
+    assertColor(dim, indicator.compute(fast));
+
+    // In between, the period shrinks monotonically
+    uint32_t previousPeakAt = slow / 2;
+    for (uint16_t depth = 64; depth < StatusIndicator::DEFAULT_BACKLOG_FULL; depth += 64) {
+        indicator.setBacklog(depth);
+        uint32_t peakAt = 0;
+        uint32_t peak = 0;
+        for (uint32_t t = 0; t <= slow / 2; t += 10) {
+            uint32_t level = luminance(indicator.compute(t));
+            if (level > peak) {
+                peak = level;
+                peakAt = t;
+            }
+        }
+        TEST_ASSERT_LESS_THAN(previousPeakAt, peakAt);
+        previousPeakAt = peakAt;
+    }
+}
+
+void test_transmits_only_on_change() {
+    FakeLedDriver driver;
+    StatusIndicator indicator(driver);
+    indicator.setBase(GREEN);
+    TEST_ASSERT_TRUE(indicator.begin());
+
+    // A solid color for a minute of 1 ms loop iterations: one frame on the wire
+    for (uint32_t now = 0; now < 60000; now++) {
+        indicator.update(now);
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, driver.shows);
+    TEST_ASSERT_EQUAL_UINT32(1, indicator.getStats().transmissions);
+    // Evaluated once per frame interval, not per loop
+    TEST_ASSERT_LESS_OR_EQUAL(60000 / StatusIndicator::FRAME_INTERVAL_MS + 1, indicator.getStats().frames);
+
+    // A new state shows within one frame interval
+    indicator.setBase(RED);
+    uint32_t now = 60000;
+    while (driver.last != RED && now < 60100) {
+        indicator.update(now++);
+    }
+    assertColor(RED, driver.last);
+    TEST_ASSERT_LESS_OR_EQUAL(60000 + StatusIndicator::FRAME_INTERVAL_MS, now);
+    TEST_ASSERT_EQUAL_UINT32(2, driver.shows);
+
+    // A blink writes twice per period
+    indicator.setLinkUp(false);
+    uint32_t before = driver.shows;
+    for (uint32_t t = 70000; t < 80000; t++) {
+        indicator.update(t);
+    }
+    TEST_ASSERT_UINT32_WITHIN(1, 20, driver.shows - before);
+}
+
+void test_busy_driver_defers_the_change() {
+    FakeLedDriver driver;
+    StatusIndicator indicator(driver);
+    indicator.setBase(GREEN);
+    indicator.begin();
+    indicator.update(0);
+    TEST_ASSERT_EQUAL_UINT32(1, driver.shows);
+
+    // The previous frame is still being clocked out: nothing waits for it
+    driver.busy = true;
+    indicator.setBase(RED);
+    indicator.update(20);
+    indicator.update(40);
+    TEST_ASSERT_EQUAL_UINT32(1, driver.shows);
+    TEST_ASSERT_EQUAL_UINT32(2, indicator.getStats().busySkips);
+    assertColor(GREEN, driver.last);
+
+    driver.busy = false;
+    indicator.update(60);
+    assertColor(RED, driver.last);
+    TEST_ASSERT_EQUAL_UINT32(2, driver.shows);
+
+    // Nothing is written before begin()
+    FakeLedDriver idle;
+    StatusIndicator stopped(idle);
+    stopped.setBase(GREEN);
+    stopped.update(0);
+    TEST_ASSERT_EQUAL_UINT32(0, idle.shows);
+}
+
+// One simulated minute at a 1 kHz acquisition loop: 20 s healthy, 20 s with
+// the link down, 20 s with a growing uplink backlog. The previous loop sent a
+// frame every iteration; a bit-banged WS2812 frame holds interrupts off for
+// 24 bits x 1.25 us.
+void test_transmissions_per_minute() {
+    FakeLedDriver driver;
+    StatusIndicator indicator(driver);
+    indicator.setBrightness(50);
+    indicator.setBase(GREEN);
+    indicator.begin();
+    for (uint32_t now = 0; now < 60000; now++) {
+        indicator.setLinkUp(now < 20000 || now >= 40000);
+        indicator.setBacklog(now < 40000 ? 0 : (now - 40000) / 60);
+        indicator.update(now);
+    }
+    const double FRAME_US = 24 * 1.25;
+    uint32_t everyLoop = 60000;
+    char message[160];
+    snprintf(message, sizeof(message), "show every loop: %u frames, %.0f ms with interrupts off",
+             (unsigned)everyLoop, everyLoop * FRAME_US / 1000.0);
+    TEST_MESSAGE(message);
+    snprintf(message, sizeof(message), "on change (RMT): %u frames of %u evaluations, 0 ms with interrupts off, %u busy skips",
+             (unsigned)driver.shows, (unsigned)indicator.getStats().frames, (unsigned)indicator.getStats().busySkips);
+    TEST_MESSAGE(message);
+
+    TEST_ASSERT_GREATER_THAN(40, driver.shows);
+    TEST_ASSERT_LESS_OR_EQUAL(indicator.getStats().frames, driver.shows);
+    TEST_ASSERT_LESS_THAN(everyLoop / 20, driver.shows);
+}
+
+int runUnityTests() {
+    UNITY_BEGIN();
+    RUN_TEST(test_pattern_priority);
+    RUN_TEST(test_blink_and_ota_timing);
+    RUN_TEST(test_breathe_speeds_up_with_backlog);
+    RUN_TEST(test_transmits_only_on_change);
+    RUN_TEST(test_busy_driver_defers_the_change);
+    RUN_TEST(test_transmissions_per_minute);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
@@ -0,0 +1,420 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/supervisor.cpp"
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include "supervisor.h"
+
+static uint32_t fakeNow = 0;
+static uint32_t fakeClock() {
+    return fakeNow;
+}
+
+class FakeSupervisorHal : public SupervisorHal {
+public:
+    FakeSupervisorHal() : watchdogTimeoutMs(0), feeds(0), restarts(0), saves(0), cause(ResetCause::POWER_ON), stored(false) {
+        memset(&storage, 0, sizeof(storage));
+    }
+
+    bool beginWatchdog(uint32_t timeoutMs) override {
+        watchdogTimeoutMs = timeoutMs;
+        return true;
+    }
+    void feedWatchdog() override {
+        feeds++;
+        lastFeedAt = fakeNow;
+    }
+    void restart() override {
+        restarts++;
+    }
+    ResetCause resetCause() override {
+        return cause;
+    }
+    bool loadLog(SupervisorLog& log) override {
+        if (!stored) {
+            return false;
+        }
+        log = storage;
+        return true;
+    }
+    bool saveLog(const SupervisorLog& log) override {
+        storage = log;
+        stored = true;
+        saves++;
+        return true;
+    }
+
+    uint32_t watchdogTimeoutMs;
+    uint32_t feeds;
+    uint32_t lastFeedAt;
+    uint32_t restarts;
+    uint32_t saves;
+    ResetCause cause;
+    SupervisorLog storage;
+    bool stored;
+};
+
+struct Handlers {
+    int softCalls;
+    int resetCalls;
+    bool softResult;
+    bool resetResult;
+};
+static Handlers handlers;
+
+static void resetHandlers() {
+    handlers.softCalls = 0;
+    handlers.resetCalls = 0;
+    handlers.softResult = true;
+    handlers.resetResult = true;
+}
+
+static int addModule(Supervisor& supervisor, const char* name, uint32_t deadlineMs) {
+    return supervisor.addModule(name, deadlineMs, []() {
+        handlers.softCalls++;
+        return handlers.softResult;
+    });
+}
+
+static void setupSupervisor(Supervisor& supervisor) {
+    supervisor.setClock(fakeClock);
+    supervisor.setProtocolReset([]() {
+        handlers.resetCalls++;
+        return handlers.resetResult;
+    });
+}
+
+// Runs the supervisor every 100 ms; beating modules beat every 100 ms too
+static void run(Supervisor& supervisor, uint32_t durationMs, int beating = -1, int beating2 = -1) {
+    for (uint32_t end = fakeNow + durationMs; fakeNow < end;) {
+        fakeNow += 100;
+        supervisor.heartbeat(beating);
+        supervisor.heartbeat(beating2);
+        supervisor.update();
+    }
+}
+
+void test_fresh_heartbeats_feed_watchdog() {
+    fakeNow = 1000;
+    resetHandlers();
+    FakeSupervisorHal hal;
+    Supervisor supervisor(hal);
+    setupSupervisor(supervisor);
+    int network = addModule(supervisor, "network", 2000);
+    int acquisition = addModule(supervisor, "acquisition", 1000);
+    TEST_ASSERT_EQUAL(0, network);
+    TEST_ASSERT_EQUAL(1, acquisition);
+    TEST_ASSERT_TRUE(supervisor.begin());
+    TEST_ASSERT_EQUAL(6000, hal.watchdogTimeoutMs);
+
+    run(supervisor, 10000, network, acquisition);
+    TEST_ASSERT_EQUAL(100, hal.feeds);
+    TEST_ASSERT_EQUAL(0, handlers.softCalls);
+    TEST_ASSERT_EQUAL(100, supervisor.getHealth());
+
+    // Power-on boots are not post-mortem material
+    TEST_ASSERT_EQUAL(1, supervisor.getLog().bootCount);
+    TEST_ASSERT_EQUAL(0, supervisor.getLog().count);
+}
+
+void test_escalation_ladder_to_reboot() {
+    fakeNow = 0;
+    resetHandlers();
+    FakeSupervisorHal hal;
+    Supervisor supervisor(hal);
+    setupSupervisor(supervisor);
+    int network = addModule(supervisor, "network", 2000);
+    int acquisition = addModule(supervisor, "acquisition", 1000);
+    supervisor.begin();
+    run(supervisor, 1000, network, acquisition);
+
+    // The network task hangs at t=1000; only acquisition keeps beating
+    uint32_t feedsBefore = hal.feeds;
+    run(supervisor, 2000, acquisition);
+    TEST_ASSERT_EQUAL(0, handlers.softCalls);
+    run(supervisor, 100, acquisition);
+    TEST_ASSERT_EQUAL(1, handlers.softCalls);
+    TEST_ASSERT_EQUAL(0, handlers.resetCalls);
+    // No feeding from the moment the module went stale
+    TEST_ASSERT_EQUAL(feedsBefore + 20, hal.feeds);
+
+    ModuleStatus status;
+    TEST_ASSERT_TRUE(supervisor.getModuleStatus(network, status));
+    TEST_ASSERT_TRUE(status.stale);
+    TEST_ASSERT_EQUAL((int)RecoveryLevel::SOFT, (int)status.level);
+    TEST_ASSERT_TRUE(hal.storage.hasPending);
+    TEST_ASSERT_EQUAL_STRING("network", hal.storage.pending.module);
+
+    // One deadline of grace per step
+    run(supervisor, 1900, acquisition);
+    TEST_ASSERT_EQUAL(0, handlers.resetCalls);
+    run(supervisor, 100, acquisition);
+    TEST_ASSERT_EQUAL(1, handlers.resetCalls);
+    TEST_ASSERT_EQUAL(0, hal.restarts);
+    run(supervisor, 2000, acquisition);
+    TEST_ASSERT_EQUAL(1, hal.restarts);
+    TEST_ASSERT_EQUAL((int)RecoveryLevel::REBOOT, (int)hal.storage.pending.level);
+    TEST_ASSERT_EQUAL(6100, hal.storage.pending.staleMs);
+
+    // The reboot came before the hardware watchdog would have fired
+    TEST_ASSERT_TRUE(fakeNow - hal.lastFeedAt < hal.watchdogTimeoutMs);
+    TEST_ASSERT_EQUAL(feedsBefore + 20, hal.feeds);
+
+    // Nothing more happens while the restart is under way
+    run(supervisor, 5000, acquisition);
+    TEST_ASSERT_EQUAL(1, hal.restarts);
+}
+
+void test_recovery_and_level_decay() {
+    fakeNow = 0;
+    resetHandlers();
+    FakeSupervisorHal hal;
+    Supervisor supervisor(hal);
+    setupSupervisor(supervisor);
+    supervisor.setStableInterval(60000);
+    int network = addModule(supervisor, "network", 2000);
+    supervisor.begin();
+    run(supervisor, 1000, network);
+
+    // Stall, soft recovery, back to life within the grace period
+    run(supervisor, 2100);
+    TEST_ASSERT_EQUAL(1, handlers.softCalls);
+    run(supervisor, 2000, network);
+    ModuleStatus status;
+    supervisor.getModuleStatus(network, status);
+    TEST_ASSERT_FALSE(status.stale);
+    TEST_ASSERT_EQUAL((int)RecoveryLevel::SOFT, (int)status.level);
+    TEST_ASSERT_FALSE(hal.storage.hasPending);
+    TEST_ASSERT_EQUAL(50, status.health);
+
+    // Failing again soon after: the ladder resumes where it left off
+    run(supervisor, 10000, network);
+    run(supervisor, 2100);
+    TEST_ASSERT_EQUAL(1, handlers.softCalls);
+    TEST_ASSERT_EQUAL(1, handlers.resetCalls);
+    run(supervisor, 2000, network);
+
+    // After a stable interval the next stall starts from the bottom again
+    run(supervisor, 60000, network);
+    supervisor.getModuleStatus(network, status);
+    TEST_ASSERT_EQUAL((int)RecoveryLevel::NONE, (int)status.level);
+    TEST_ASSERT_EQUAL(100, status.health);
+    TEST_ASSERT_EQUAL(2, status.misses);
+    run(supervisor, 2100);
+    TEST_ASSERT_EQUAL(2, handlers.softCalls);
+    TEST_ASSERT_EQUAL(1, handlers.resetCalls);
+    TEST_ASSERT_EQUAL(0, hal.restarts);
+}
+
+void test_failing_steps_are_skipped() {
+    fakeNow = 0;
+    resetHandlers();
+    handlers.softResult = false;
+    FakeSupervisorHal hal;
+    Supervisor supervisor(hal);
+    setupSupervisor(supervisor);
+    int network = addModule(supervisor, "network", 2000);
+    int noHandler = supervisor.addModule("lora", 2000);
+    supervisor.begin();
+    run(supervisor, 1000, network, noHandler);
+
+    // A soft recovery that fails moves straight on to the protocol reset
+    run(supervisor, 2100, noHandler);
+    TEST_ASSERT_EQUAL(1, handlers.softCalls);
+    TEST_ASSERT_EQUAL(1, handlers.resetCalls);
+    ModuleStatus status;
+    supervisor.getModuleStatus(network, status);
+    TEST_ASSERT_EQUAL((int)RecoveryLevel::PROTOCOL_RESET, (int)status.level);
+
+    // Nothing left to try: reboot at once
+    handlers.resetResult = false;
+    run(supervisor, 5000, network);
+    TEST_ASSERT_EQUAL(2, handlers.resetCalls);
+    TEST_ASSERT_EQUAL(1, hal.restarts);
+    TEST_ASSERT_EQUAL_STRING("lora", hal.storage.pending.module);
+}
+
+void test_reported_fault_climbs_one_step_per_grace() {
+    fakeNow = 0;
+    resetHandlers();
+    handlers.softResult = true;
+    FakeSupervisorHal hal;
+    Supervisor supervisor(hal);
+    setupSupervisor(supervisor);
+    int acquisition = addModule(supervisor, "acquisition", 1000);
+    supervisor.begin();
+    run(supervisor, 500, acquisition);
+
+    // A module stuck in its error state reports every iteration
+    for (int i = 0; i < 25; i++) {
+        supervisor.reportFault(acquisition);
+        run(supervisor, 100, acquisition);
+    }
+    TEST_ASSERT_EQUAL(1, handlers.softCalls);
+    TEST_ASSERT_EQUAL(1, handlers.resetCalls);
+    TEST_ASSERT_EQUAL(1, hal.restarts);
+
+    // The same fault once, then quiet: soft recovery only
+    fakeNow = 0;
+    resetHandlers();
+    FakeSupervisorHal hal2;
+    Supervisor supervisor2(hal2);
+    setupSupervisor(supervisor2);
+    acquisition = addModule(supervisor2, "acquisition", 1000);
+    supervisor2.begin();
+    supervisor2.reportFault(acquisition);
+    run(supervisor2, 5000, acquisition);
+    TEST_ASSERT_EQUAL(1, handlers.softCalls);
+    TEST_ASSERT_EQUAL(0, handlers.resetCalls);
+    TEST_ASSERT_EQUAL(0, hal2.restarts);
+    TEST_ASSERT_EQUAL(40, hal2.feeds);
+}
+
+void test_reset_records_survive_reboots() {
+    fakeNow = 0;
+    resetHandlers();
+    FakeSupervisorHal hal;
+    {
+        Supervisor supervisor(hal);
+        setupSupervisor(supervisor);
+        int network = addModule(supervisor, "network", 2000);
+        supervisor.begin();
+        run(supervisor, 1000, network);
+        // Soft recovery starts, then the task WDT resets the chip
+        run(supervisor, 2100);
+        TEST_ASSERT_TRUE(hal.storage.hasPending);
+    }
+
+    hal.cause = ResetCause::TASK_WATCHDOG;
+    {
+        Supervisor supervisor(hal);
+        setupSupervisor(supervisor);
+        addModule(supervisor, "network", 2000);
+        supervisor.begin();
+        const SupervisorLog& log = supervisor.getLog();
+        TEST_ASSERT_EQUAL(2, log.bootCount);
+        TEST_ASSERT_EQUAL(1, log.count);
+        TEST_ASSERT_FALSE(log.hasPending);
+        const ResetRecord& record = log.records[0];
+        TEST_ASSERT_EQUAL(1, record.bootCount);
+        TEST_ASSERT_EQUAL((int)ResetCause::TASK_WATCHDOG, (int)record.cause);
+        TEST_ASSERT_EQUAL((int)RecoveryLevel::SOFT, (int)record.level);
+        TEST_ASSERT_EQUAL_STRING("network", record.module);
+        TEST_ASSERT_EQUAL(3100, record.uptimeMs);
+    }
+
+    // Unexplained resets are recorded too; the ring keeps the newest
+    hal.cause = ResetCause::BROWNOUT;
+    for (int boot = 0; boot < 10; boot++) {
+        Supervisor supervisor(hal);
+        supervisor.setClock(fakeClock);
+        supervisor.begin();
+    }
+    TEST_ASSERT_EQUAL(12, hal.storage.bootCount);
+    TEST_ASSERT_EQUAL(SupervisorLog::MAX_RECORDS, hal.storage.count);
+    const ResetRecord& newest = hal.storage.records[(hal.storage.next + SupervisorLog::MAX_RECORDS - 1) % SupervisorLog::MAX_RECORDS];
+    TEST_ASSERT_EQUAL(11, newest.bootCount);
+    TEST_ASSERT_EQUAL((int)ResetCause::BROWNOUT, (int)newest.cause);
+    TEST_ASSERT_EQUAL((int)RecoveryLevel::NONE, (int)newest.level);
+}
+
+// A hundred stalls with a mix of causes: most clear with a reinit, some need
+// the uplinks torn down, a few only go away with a reboot. A bare task WDT
+// reboots on every one of them.
+static int stallCure = 0;  // 0 clears after the soft step, 1 after the reset, 2 never
+static bool stallHung = false;
+
+static Supervisor* bootSupervisor(FakeSupervisorHal& hal, int& module) {
+    Supervisor* supervisor = new Supervisor(hal);
+    supervisor->setClock(fakeClock);
+    supervisor->setStableInterval(60000);
+    module = supervisor->addModule("network", 2000, []() {
+        handlers.softCalls++;
+        if (stallCure == 0) {
+            stallHung = false;
+        }
+        return true;
+    });
+    supervisor->setProtocolReset([]() {
+        handlers.resetCalls++;
+        if (stallCure == 1) {
+            stallHung = false;
+        }
+        return true;
+    });
+    supervisor->begin();
+    return supervisor;
+}
+
+void test_simulated_stalls_reboots_avoided() {
+    fakeNow = 0;
+    resetHandlers();
+    FakeSupervisorHal hal;
+    int network;
+    Supervisor* supervisor = bootSupervisor(hal, network);
+
+    uint32_t seed = 12345;
+    const int STALLS = 100;
+    int reboots = 0;
+    uint32_t stalledMs = 0;
+    for (int i = 0; i < STALLS; i++) {
+        seed = seed * 1103515245u + 12345u;
+        int roll = (int)((seed >> 16) % 100);
+        stallCure = roll < 70 ? 0 : roll < 92 ? 1 : 2;
+        run(*supervisor, 70000, network);
+
+        stallHung = true;
+        uint32_t stalledAt = fakeNow;
+        uint32_t restarts = hal.restarts;
+        while (stallHung && hal.restarts == restarts) {
+            fakeNow += 100;
+            supervisor->update();
+        }
+        stalledMs += fakeNow - stalledAt;
+        if (hal.restarts != restarts) {
+            reboots++;
+            hal.cause = ResetCause::SOFTWARE;
+            delete supervisor;
+            supervisor = bootSupervisor(hal, network);
+        }
+        stallHung = false;
+    }
+    delete supervisor;
+
+    char line[160];
+    snprintf(line, sizeof(line), "task WDT only: %d reboots for %d stalls", STALLS, STALLS);
+    TEST_MESSAGE(line);
+    snprintf(line, sizeof(line), "supervisor:    %d reboots, %d soft recoveries, %d protocol resets, %u ms mean stall",
+             reboots, handlers.softCalls, handlers.resetCalls, (unsigned)(stalledMs / STALLS));
+    TEST_MESSAGE(line);
+
+    TEST_ASSERT_TRUE(reboots < STALLS / 5);
+    TEST_ASSERT_EQUAL(STALLS, handlers.softCalls);
+    TEST_ASSERT_EQUAL(reboots < (int)SupervisorLog::MAX_RECORDS ? reboots : (int)SupervisorLog::MAX_RECORDS,
+                      hal.storage.count);
+}
+
+int runUnityTests() {
+    UNITY_BEGIN();
+    RUN_TEST(test_fresh_heartbeats_feed_watchdog);
+    RUN_TEST(test_escalation_ladder_to_reboot);
+    RUN_TEST(test_recovery_and_level_decay);
+    RUN_TEST(test_failing_steps_are_skipped);
+    RUN_TEST(test_reported_fault_climbs_one_step_per_grace);
+    RUN_TEST(test_reset_records_survive_reboots);
+    RUN_TEST(test_simulated_stalls_reboots_avoided);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
@@ -0,0 +1,131 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/task_topology.cpp"
+
+#include <unity.h>
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+#include "sample.h"
+#include "spsc_queue.h"
+#include "task_topology.h"
+
+void test_queue_fifo_and_capacity() {
+    SpscQueue<int, 8> queue;
+    TEST_ASSERT_EQUAL(7, queue.capacity());
+    for (int i = 0; i < 7; i++) {
+        TEST_ASSERT_TRUE(queue.push(i));
+    }
+    TEST_ASSERT_FALSE(queue.push(99));
+    TEST_ASSERT_EQUAL(7, queue.size());
+
+    int value;
+    for (int i = 0; i < 7; i++) {
+        TEST_ASSERT_TRUE(queue.pop(value));
+        TEST_ASSERT_EQUAL(i, value);
+    }
+    TEST_ASSERT_FALSE(queue.pop(value));
+    TEST_ASSERT_TRUE(queue.empty());
+}
+
+void test_benchmark_cross_thread_handoff() {
+    static SpscQueue<Sample, 256> queue;
+    const uint32_t count = 2000000;
+    bool ordered = true;
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread consumer([&ordered, count]() {
+        Sample sample;
+        uint32_t expected = 0;
+        while (expected < count) {
+            if (queue.pop(sample)) {
+                ordered = ordered && sample.timestampMs == expected;
+                expected++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+    for (uint32_t i = 0; i < count; i++) {
+        Sample sample = {(uint16_t)(i & 0xFFFF), SampleSource::ANALOG, (float)i, i};
+        while (!queue.push(sample)) {
+            std::this_thread::yield();
+        }
+    }
+    consumer.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    char message[120];
+    snprintf(message, sizeof(message), "SPSC hand-off: %.1f ns/sample (%.1f M samples/s)",
+             seconds * 1e9 / count, count / seconds / 1e6);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_TRUE(ordered);
+}
+
+void test_topology_runs_pipeline_and_reports_load() {
+    static SpscQueue<Sample, 256> queue;
+    std::atomic<uint32_t> produced(0);
+    std::atomic<uint32_t> consumed(0);
+    std::atomic<uint64_t> latencyUs(0);
+
+    TaskTopology topology;
+    TEST_ASSERT_TRUE(topology.addTask({"acquisition", ACQUISITION_CORE, 5, 8192, 1, [&]() {
+        // Simulate ~200 us of bus work per period, then hand off a sample
+        auto begin = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() - begin < std::chrono::microseconds(200)) {
+        }
+        uint32_t now = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        Sample sample = {0, SampleSource::MODBUS, 1.0f, now};
+        if (queue.push(sample)) {
+            produced++;
+        }
+    }}));
+    TEST_ASSERT_TRUE(topology.addTask({"network", NETWORK_CORE, 4, 8192, 1, [&]() {
+        Sample sample;
+        while (queue.pop(sample)) {
+            uint32_t now = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+            latencyUs += now - sample.timestampMs;
+            consumed++;
+        }
+    }}));
+
+    TEST_ASSERT_TRUE(topology.start());
+    TEST_ASSERT_FALSE(topology.addTask({"late", 0, 1, 1024, 1, []() {}}));
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    TaskStats acquisition, network;
+    TEST_ASSERT_TRUE(topology.sampleStats(0, acquisition));
+    TEST_ASSERT_TRUE(topology.sampleStats(1, network));
+    topology.stop();
+
+    char message[160];
+    snprintf(message, sizeof(message),
+             "%u samples, mean queue latency %.1f us, acquisition %.0f%% cpu, network %.0f%% cpu",
+             (unsigned)consumed.load(), consumed ? (double)latencyUs / consumed : 0.0,
+             acquisition.utilization * 100.0f, network.utilization * 100.0f);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_GREATER_THAN(50, consumed.load());
+    TEST_ASSERT_GREATER_THAN(0.05f, acquisition.utilization);
+    TEST_ASSERT_LESS_THAN(acquisition.utilization, network.utilization);
+    TEST_ASSERT_FALSE(topology.isRunning());
+}
+
+int runUnityTests() {
+    UNITY_BEGIN();
+    RUN_TEST(test_queue_fifo_and_capacity);
+    RUN_TEST(test_benchmark_cross_thread_handoff);
+    RUN_TEST(test_topology_runs_pipeline_and_reports_load);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
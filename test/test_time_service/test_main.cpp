@@ -0,0 +1,389 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/time_service.cpp"
+#include "../../src/payload_encoder.cpp"
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "time_service.h"
+#include "payload_encoder.h"
+
+static uint64_t fakeNow = 0;
+static uint64_t fakeClock() {
+    return fakeNow;
+}
+
+static const uint64_t UNIX_2025_US = 1735689600ULL * 1000000;
+
+static void putNtp(uint8_t* out, uint64_t unixUs) {
+    uint64_t seconds = (unixUs / 1000000 + 2208988800ULL) & 0xFFFFFFFFULL;
+    uint64_t fraction = ((unixUs % 1000000) << 32) / 1000000;
+    uint64_t value = (seconds << 32) | fraction;
+    for (int i = 7; i >= 0; i--) {
+        out[i] = (uint8_t)value;
+        value >>= 8;
+    }
+}
+
+// NTP server whose clock is the true time; the gateway's monotonic clock
+// runs at (1 + driftPpm) against it
+class FakeNtpServer : public SntpTransport {
+public:
+    FakeNtpServer()
+        : epochUs(UNIX_2025_US), driftPpm(0), upUs(2000), downUs(2000), holdUs(100), stratum(2), leap(0),
+          corruptNonce(false), drop(false), pending(false), deliverAt(0), requests(0) {}
+
+    uint64_t trueTimeAt(uint64_t monoUs) const {
+        return epochUs + (uint64_t)((double)monoUs / (1.0 + driftPpm / 1e6));
+    }
+
+    bool send(const uint8_t* data, size_t length) override {
+        if (length != SntpClient::PACKET_SIZE || (data[0] & 0x07) != 3) {
+            return false;
+        }
+        requests++;
+        if (drop) {
+            return true;
+        }
+        memset(reply, 0, sizeof(reply));
+        reply[0] = (uint8_t)((leap << 6) | (4 << 3) | 4);
+        reply[1] = stratum;
+        memcpy(reply + 24, data + 40, 8);
+        if (corruptNonce) {
+            reply[31] ^= 1;
+        }
+        uint64_t received = trueTimeAt(fakeNow + upUs);
+        putNtp(reply + 32, received);
+        putNtp(reply + 40, received + holdUs);
+        deliverAt = fakeNow + upUs + holdUs + downUs;
+        pending = true;
+        return true;
+    }
+
+    int receive(uint8_t* data, size_t capacity) override {
+        if (!pending || fakeNow < deliverAt || capacity < sizeof(reply)) {
+            return 0;
+        }
+        pending = false;
+        memcpy(data, reply, sizeof(reply));
+        return sizeof(reply);
+    }
+
+    uint64_t epochUs;
+    double driftPpm;
+    uint64_t upUs;
+    uint64_t downUs;
+    uint64_t holdUs;
+    uint8_t stratum;
+    uint8_t leap;
+    bool corruptNonce;
+    bool drop;
+    bool pending;
+    uint64_t deliverAt;
+    uint32_t requests;
+
+private:
+    uint8_t reply[SntpClient::PACKET_SIZE];
+};
+
+static TimeService makeService() {
+    fakeNow = 1000000;
+    TimeService time;
+    time.setClock(fakeClock);
+    return time;
+}
+
+static int64_t diff(uint64_t a, uint64_t b) {
+    return (int64_t)(a - b);
+}
+
+// Runs the client in 100 us steps until the exchange completes
+static void runExchange(SntpClient& client) {
+    client.update();
+    for (int i = 0; i < 30000 && client.isWaiting(); i++) {
+        fakeNow += 100;
+        client.update();
+    }
+}
+
+void test_first_sync_steps() {
+    TimeService time = makeService();
+    TEST_ASSERT_FALSE(time.isSynced());
+    TEST_ASSERT_EQUAL(0, (uint32_t)time.nowUnixUs());
+
+    time.discipline(UNIX_2025_US, fakeNow);
+    TEST_ASSERT_TRUE(time.isSynced());
+    TEST_ASSERT_TRUE(time.nowUnixUs() == UNIX_2025_US);
+    fakeNow += 2500000;
+    TEST_ASSERT_TRUE(time.nowUnixUs() == UNIX_2025_US + 2500000);
+    TEST_ASSERT_EQUAL(1, time.getStats().steps);
+}
+
+void test_small_error_is_slewed_monotonically() {
+    TimeService time = makeService();
+    time.discipline(UNIX_2025_US, fakeNow);
+
+    // The clock is 200 ms ahead; the correction must not run time backwards
+    fakeNow += 10000000;
+    time.discipline(UNIX_2025_US + 10000000 - 200000, fakeNow);
+    TEST_ASSERT_EQUAL(1, time.getStats().steps);
+    TEST_ASSERT_TRUE(time.getStats().lastErrorUs == -200000);
+
+    uint64_t previous = time.nowUnixUs();
+    TEST_ASSERT_TRUE(previous == UNIX_2025_US + 10000000);
+    for (int i = 0; i < 600; i++) {
+        fakeNow += 1000000;
+        uint64_t current = time.nowUnixUs();
+        TEST_ASSERT_TRUE(current > previous);
+        // At most 500 ppm slower than real time
+        TEST_ASSERT_TRUE(current - previous >= 1000000 - 500);
+        previous = current;
+    }
+    // 200 ms at 500 ppm takes 400 s; the drift estimate absorbs part of it
+    int64_t remaining = diff(time.nowUnixUs(), UNIX_2025_US + 10000000 + 600000000 - 200000);
+    TEST_ASSERT_TRUE(remaining < 20000 && remaining > -20000);
+}
+
+void test_large_error_steps() {
+    TimeService time = makeService();
+    time.discipline(UNIX_2025_US, fakeNow);
+    fakeNow += 5000000;
+    time.discipline(UNIX_2025_US + 5000000 + 3600000000ULL, fakeNow);
+    TEST_ASSERT_EQUAL(2, time.getStats().steps);
+    TEST_ASSERT_TRUE(time.nowUnixUs() == UNIX_2025_US + 5000000 + 3600000000ULL);
+}
+
+void test_sample_stamps_convert_across_wrap() {
+    TimeService time = makeService();
+    // 30 ms after millis() wrapped
+    fakeNow = 0x100000000ULL * 1000 + 30000;
+    time.discipline(UNIX_2025_US, fakeNow);
+    uint32_t beforeWrap = 0xFFFFFFFFu - 19;
+    TEST_ASSERT_TRUE(time.toUnixMs(beforeWrap) == UNIX_2025_US / 1000 - 50);
+    TEST_ASSERT_TRUE(time.toUnixMs(10) == UNIX_2025_US / 1000 - 20);
+
+    TimeBase base = time.timeBase();
+    TEST_ASSERT_TRUE(base.synced);
+    TEST_ASSERT_EQUAL(30, base.monotonicMs);
+    TEST_ASSERT_TRUE(base.unixMs == UNIX_2025_US / 1000);
+}
+
+void test_encoder_writes_unix_base() {
+    Sample samples[2] = {{1, SampleSource::ANALOG, 1.5f, 1000}, {2, SampleSource::MODBUS, 2.0f, 1010}};
+    uint8_t data[128];
+    PayloadBuffer out(data, sizeof(data));
+
+    TimeBase base = {1735689600000ULL, 1200, true};
+    size_t length = encodeSamples(PayloadFormat::JSON, samples, 2, out, nullptr, &base);
+    const char* expected = "{\"t\":1735689599800,\"s\":[[1,1.5,0],[2,2,10]]}";
+    TEST_ASSERT_EQUAL(strlen(expected), length);
+    TEST_ASSERT_EQUAL_MEMORY(expected, data, length);
+
+    // Unsynced keeps boot-relative milliseconds
+    base.synced = false;
+    length = encodeSamples(PayloadFormat::JSON, samples, 2, out, nullptr, &base);
+    expected = "{\"t\":1000,\"s\":[[1,1.5,0],[2,2,10]]}";
+    TEST_ASSERT_EQUAL(strlen(expected), length);
+    TEST_ASSERT_EQUAL_MEMORY(expected, data, length);
+}
+
+void test_sntp_exchange_sets_clock() {
+    TimeService time = makeService();
+    FakeNtpServer server;
+    server.upUs = 3000;
+    server.downUs = 3000;
+    SntpClient client(server, time);
+
+    runExchange(client);
+    TEST_ASSERT_TRUE(time.isSynced());
+    TEST_ASSERT_EQUAL(1, client.getStats().responses);
+    TEST_ASSERT_EQUAL(6000, client.getStats().lastDelayUs);
+    // Symmetric path: the midpoint estimate is exact to the microsecond
+    int64_t error = diff(time.nowUnixUs(), server.trueTimeAt(fakeNow));
+    TEST_ASSERT_TRUE(error <= 1 && error >= -1);
+
+    // Nothing more until the poll interval has passed
+    client.update();
+    TEST_ASSERT_EQUAL(1, server.requests);
+    fakeNow += (uint64_t)SntpClient::DEFAULT_POLL_INTERVAL_MS * 1000;
+    client.update();
+    TEST_ASSERT_EQUAL(2, server.requests);
+}
+
+void test_sntp_rejects_bad_replies() {
+    TimeService time = makeService();
+    FakeNtpServer server;
+    SntpClient client(server, time);
+
+    // Kiss-o'-death
+    server.stratum = 0;
+    runExchange(client);
+    TEST_ASSERT_FALSE(time.isSynced());
+    TEST_ASSERT_EQUAL(1, client.getStats().rejected);
+
+    // Unsynchronised server
+    server.stratum = 2;
+    server.leap = 3;
+    fakeNow += SntpClient::MIN_RETRY_MS * 1000;
+    runExchange(client);
+    TEST_ASSERT_FALSE(time.isSynced());
+    TEST_ASSERT_EQUAL(2, client.getStats().rejected);
+
+    // A reply to some other request is ignored and the request times out
+    server.leap = 0;
+    server.corruptNonce = true;
+    fakeNow += SntpClient::MIN_RETRY_MS * 2 * 1000;
+    runExchange(client);
+    TEST_ASSERT_FALSE(time.isSynced());
+    TEST_ASSERT_EQUAL(1, client.getStats().timeouts);
+
+    // Too slow a round trip
+    server.corruptNonce = false;
+    server.downUs = 600000;
+    fakeNow += SntpClient::MIN_RETRY_MS * 4 * 1000;
+    runExchange(client);
+    TEST_ASSERT_FALSE(time.isSynced());
+    TEST_ASSERT_EQUAL(3, client.getStats().rejected);
+
+    server.downUs = 2000;
+    fakeNow += SntpClient::MIN_RETRY_MS * 8 * 1000;
+    runExchange(client);
+    TEST_ASSERT_TRUE(time.isSynced());
+}
+
+void test_sntp_backoff_and_sync_now() {
+    TimeService time = makeService();
+    FakeNtpServer server;
+    server.drop = true;
+    SntpClient client(server, time);
+
+    // Timeouts back off 4 s, 8 s, 16 s...
+    uint32_t delays[3];
+    for (int i = 0; i < 3; i++) {
+        runExchange(client);
+        uint32_t requests = server.requests;
+        uint64_t startedAt = fakeNow;
+        while (server.requests == requests) {
+            fakeNow += 100000;
+            client.update();
+        }
+        delays[i] = (uint32_t)((fakeNow - startedAt) / 1000);
+    }
+    TEST_ASSERT_TRUE(delays[0] >= 4000 && delays[0] < 4200);
+    TEST_ASSERT_TRUE(delays[1] >= 8000 && delays[1] < 8200);
+    TEST_ASSERT_TRUE(delays[2] >= 16000 && delays[2] < 16200);
+
+    // A link event asks again at once and resets the backoff
+    server.drop = false;
+    runExchange(client);
+    TEST_ASSERT_FALSE(client.isWaiting());
+    fakeNow += 10000;
+    client.syncNow();
+    uint32_t requests = server.requests;
+    client.update();
+    TEST_ASSERT_EQUAL(requests + 1, server.requests);
+}
+
+// One day with a 40 ppm crystal, polling every 1024 s over a path with
+// up to 4 ms of asymmetry; sample stamps are checked every second once the
+// first few hours have let the frequency estimate settle
+void test_simulated_drift_error() {
+    static const uint64_t DAY_US = 86400ULL * 1000000;
+    static const uint64_t POLL_US = 1024ULL * 1000000;
+
+    static const uint64_t SETTLE_US = 4ULL * 3600 * 1000000;
+
+    struct Result {
+        int64_t maxErrorUs;
+        uint32_t jumps;
+    };
+    Result results[3];
+    const char* names[3] = {"sync once", "step each poll", "slew + drift"};
+
+    for (int mode = 0; mode < 3; mode++) {
+        TimeService time = makeService();
+        FakeNtpServer server;
+        server.driftPpm = 40;
+        SntpClient client(server, time);
+        client.setPollInterval(1024000);
+        if (mode == 1) {
+            time.setStepThreshold(0);
+        }
+
+        uint32_t seed = 12345;
+        Result result = {0, 0};
+        uint64_t previous = 0;
+        uint64_t previousMono = 0;
+        uint64_t lastPoll = 0;
+        uint64_t start = fakeNow;
+        while (fakeNow - start < DAY_US) {
+            bool poll = fakeNow - start == 0 || (mode != 0 && fakeNow - lastPoll >= POLL_US);
+            if (poll) {
+                seed = seed * 1103515245 + 12345;
+                server.upUs = 2000 + (seed >> 16) % 4000;
+                server.downUs = 2000 + (seed >> 8) % 4000;
+                client.syncNow();
+                runExchange(client);
+                lastPoll = fakeNow;
+            }
+            uint64_t stamped = time.toUnixMs((uint32_t)(fakeNow / 1000)) * 1000;
+            int64_t error = diff(stamped, server.trueTimeAt(fakeNow - fakeNow % 1000));
+            if (error < 0) {
+                error = -error;
+            }
+            if (error > result.maxErrorUs && fakeNow - start > SETTLE_US) {
+                result.maxErrorUs = error;
+            }
+            // Consecutive stamps should be as far apart as the readings
+            uint64_t mono = fakeNow - fakeNow % 1000;
+            int64_t step = diff(stamped, previous) - diff(mono, previousMono);
+            if (previous != 0 && (step > 1000 || step < -1000)) {
+                result.jumps++;
+            }
+            previous = stamped;
+            previousMono = mono;
+            fakeNow += 1000000;
+        }
+        results[mode] = result;
+
+        char message[128];
+        snprintf(message, sizeof(message), "%-15s max error %7.2f ms, %u jumps over 1 ms, drift estimate %ld ppb",
+                 names[mode], result.maxErrorUs / 1000.0, (unsigned)result.jumps,
+                 (long)time.getStats().driftPpb);
+        TEST_MESSAGE(message);
+    }
+
+    // Free-running, 40 ppm over a day is about 3.5 s
+    TEST_ASSERT_TRUE(results[0].maxErrorUs > 3000000);
+    TEST_ASSERT_TRUE(results[2].maxErrorUs < 10000);
+    TEST_ASSERT_EQUAL(0, results[2].jumps);
+    TEST_ASSERT_TRUE(results[1].jumps > 0);
+    TEST_ASSERT_TRUE(results[2].maxErrorUs < results[1].maxErrorUs);
+}
+
+int runUnityTests() {
+    UNITY_BEGIN();
+    RUN_TEST(test_first_sync_steps);
+    RUN_TEST(test_small_error_is_slewed_monotonically);
+    RUN_TEST(test_large_error_steps);
+    RUN_TEST(test_sample_stamps_convert_across_wrap);
+    RUN_TEST(test_encoder_writes_unix_base);
+    RUN_TEST(test_sntp_exchange_sets_clock);
+    RUN_TEST(test_sntp_rejects_bad_replies);
+    RUN_TEST(test_sntp_backoff_and_sync_now);
+    RUN_TEST(test_simulated_drift_error);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
@@ -0,0 +1,197 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/tls_context.cpp"
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "tls_context.h"
+
+static uint32_t fakeNow = 0;
+static uint32_t fakeClock() {
+    return fakeNow;
+}
+
+static std::string pemBlock(const char* label, const char* body) {
+    return std::string("-----BEGIN ") + label + "-----\n" + body + "\n-----END " + label + "-----\n";
+}
+
+// DER SEQUENCEs with short (5 bytes) and long form (133 bytes) lengths
+static const char shortDer[] = "MAMCAQU=";
+static const char longDer[] =
+    "MIGCBIAAAQIDBAUGBwgJCgsMDQ4PEBESExQVFhcYGRobHB0eHyAhIiMkJSYnKCkqKywtLi8w\n"
+    "MTIzNDU2Nzg5Ojs8PT4/QEFCQ0RFRkdISUpLTE1OT1BRUlNUVVZXWFlaW1xdXl9gYWJjZGVm\n"
+    "Z2hpamtsbW5vcHFyc3R1dnd4eXp7fH1+fw==";
+
+// Server side of a TLS link: every open is a full handshake that burns
+// handshakeMs of (virtual) CPU, and the server drops idle connections
+struct FakeTlsSocket : public TlsSocket {
+    uint32_t handshakeMs = 900;
+    uint32_t idleTimeoutMs = 30000;
+    bool connected = false;
+    uint32_t lastActivity = 0;
+    uint32_t opens = 0;
+    bool sawCa = false;
+
+    bool open(const char*, uint16_t, const TlsCredentials& credentials) override {
+        fakeNow += handshakeMs;
+        opens++;
+        sawCa = credentials.get(TlsCredentialKind::CA) != nullptr;
+        connected = true;
+        lastActivity = fakeNow;
+        return true;
+    }
+    void close() override {
+        connected = false;
+    }
+    bool isOpen() override {
+        if (connected && fakeNow - lastActivity >= idleTimeoutMs) {
+            connected = false;
+        }
+        return connected;
+    }
+    void request() {
+        fakeNow += 20;
+        lastActivity = fakeNow;
+    }
+};
+
+void test_pem_blocks_are_validated() {
+    std::string bundle = pemBlock("CERTIFICATE", shortDer) + pemBlock("CERTIFICATE", longDer);
+    TEST_ASSERT_EQUAL(2, pemCountBlocks(bundle.c_str(), bundle.size(), "CERTIFICATE"));
+
+    std::string key = pemBlock("EC PARAMETERS", "BggqhkjOPQMBBw==") + pemBlock("EC PRIVATE KEY", shortDer);
+    TEST_ASSERT_EQUAL(1, pemCountBlocks(key.c_str(), key.size(), "PRIVATE KEY"));
+
+    // Truncated body: the DER length no longer matches
+    std::string truncated = pemBlock("CERTIFICATE", "MIGCBIAAAQIDBAUG");
+    TEST_ASSERT_EQUAL(0, pemCountBlocks(truncated.c_str(), truncated.size(), "CERTIFICATE"));
+    std::string unterminated = "-----BEGIN CERTIFICATE-----\nMAMCAQU=\n";
+    TEST_ASSERT_EQUAL(0, pemCountBlocks(unterminated.c_str(), unterminated.size(), "CERTIFICATE"));
+}
+
+void test_credentials_parse_once() {
+    TlsCredentials credentials;
+    std::string ca = pemBlock("CERTIFICATE", longDer);
+    for (int i = 0; i < 10; i++) {
+        TEST_ASSERT_TRUE(credentials.load(TlsCredentialKind::CA, ca.c_str(), ca.size()));
+    }
+    TEST_ASSERT_EQUAL(1, credentials.getParseCount());
+    TEST_ASSERT_EQUAL(1, credentials.getCaCount());
+    const char* stored = credentials.get(TlsCredentialKind::CA);
+    TEST_ASSERT_NOT_NULL(stored);
+
+    // A bad reload keeps the previous CA in place
+    std::string broken = pemBlock("CERTIFICATE", "MIGC");
+    TEST_ASSERT_FALSE(credentials.load(TlsCredentialKind::CA, broken.c_str(), broken.size()));
+    TEST_ASSERT_EQUAL_STRING(ca.c_str(), credentials.get(TlsCredentialKind::CA));
+
+    // A client identity needs exactly one certificate and one key
+    std::string two = pemBlock("CERTIFICATE", shortDer) + pemBlock("CERTIFICATE", shortDer);
+    TEST_ASSERT_FALSE(credentials.load(TlsCredentialKind::CERTIFICATE, two.c_str(), two.size()));
+    std::string cert = pemBlock("CERTIFICATE", shortDer);
+    std::string key = pemBlock("PRIVATE KEY", shortDer);
+    TEST_ASSERT_TRUE(credentials.load(TlsCredentialKind::CERTIFICATE, cert.c_str(), cert.size()));
+    TEST_ASSERT_FALSE(credentials.hasClientIdentity());
+    TEST_ASSERT_TRUE(credentials.load(TlsCredentialKind::PRIVATE_KEY, key.c_str(), key.size()));
+    TEST_ASSERT_TRUE(credentials.hasClientIdentity());
+}
+
+void test_sockets_are_reused_per_endpoint() {
+    fakeNow = 0;
+    TlsContextManager tls;
+    tls.setClock(fakeClock);
+    std::string ca = pemBlock("CERTIFICATE", shortDer);
+    tls.credentials().load(TlsCredentialKind::CA, ca.c_str(), ca.size());
+    FakeTlsSocket https;
+    FakeTlsSocket mqtt;
+
+    TEST_ASSERT_TRUE(tls.acquire(https, "api.example", 443));
+    TEST_ASSERT_TRUE(https.sawCa);
+    https.request();
+    TEST_ASSERT_TRUE(tls.acquire(https, "api.example", 443));
+    TEST_ASSERT_TRUE(tls.acquire(mqtt, "broker.example", 8883));
+    TEST_ASSERT_EQUAL(1, https.opens);
+
+    // Pointing the socket at another endpoint needs a new handshake
+    TEST_ASSERT_TRUE(tls.acquire(https, "backup.example", 443));
+    TEST_ASSERT_EQUAL(2, https.opens);
+
+    const TlsHandshakeStats* api = tls.getEndpointStats("api.example", 443);
+    TEST_ASSERT_NOT_NULL(api);
+    TEST_ASSERT_EQUAL(1, api->handshakes);
+    TEST_ASSERT_EQUAL(1, api->reused);
+    TEST_ASSERT_EQUAL(900, api->maxHandshakeMs);
+    TEST_ASSERT_EQUAL(3, tls.getStats().handshakes);
+    TEST_ASSERT_EQUAL(2700, tls.getStats().totalHandshakeMs);
+
+    // Server-side idle close is detected and a fresh handshake follows
+    fakeNow += 60000;
+    TEST_ASSERT_TRUE(tls.acquire(mqtt, "broker.example", 8883));
+    TEST_ASSERT_EQUAL(2, mqtt.opens);
+
+    tls.recordHandshake("ws.example", 443, 1200, true);
+    TEST_ASSERT_EQUAL(1200, tls.getStats().maxHandshakeMs);
+}
+
+void test_https_uplink_handshake_cost() {
+    const int requests = 120;
+    const uint32_t intervalMs = 5000;
+
+    // Before: a new TLS context for every POST
+    fakeNow = 0;
+    TlsContextManager perRequest;
+    perRequest.setClock(fakeClock);
+    FakeTlsSocket legacy;
+    for (int i = 0; i < requests; i++) {
+        perRequest.acquire(legacy, "api.example", 443);
+        legacy.request();
+        perRequest.release(legacy);
+        fakeNow += intervalMs;
+    }
+
+    // After: the connection stays up between POSTs
+    fakeNow = 0;
+    TlsContextManager shared;
+    shared.setClock(fakeClock);
+    FakeTlsSocket pooled;
+    for (int i = 0; i < requests; i++) {
+        shared.acquire(pooled, "api.example", 443);
+        pooled.request();
+        fakeNow += intervalMs;
+    }
+
+    char message[160];
+    snprintf(message, sizeof(message), "per request: %u handshakes, %u ms of handshake CPU",
+             (unsigned)perRequest.getStats().handshakes, (unsigned)perRequest.getStats().totalHandshakeMs);
+    TEST_MESSAGE(message);
+    snprintf(message, sizeof(message), "shared:      %u handshakes, %u ms of handshake CPU, %u reused",
+             (unsigned)shared.getStats().handshakes, (unsigned)shared.getStats().totalHandshakeMs,
+             (unsigned)shared.getStats().reused);
+    TEST_MESSAGE(message);
+
+    TEST_ASSERT_EQUAL(requests, perRequest.getStats().handshakes);
+    TEST_ASSERT_EQUAL(1, shared.getStats().handshakes);
+    TEST_ASSERT_EQUAL(requests - 1, shared.getStats().reused);
+}
+
+int runUnityTests() {
+    UNITY_BEGIN();
+    RUN_TEST(test_pem_blocks_are_validated);
+    RUN_TEST(test_credentials_parse_once);
+    RUN_TEST(test_sockets_are_reused_per_endpoint);
+    RUN_TEST(test_https_uplink_handshake_cost);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
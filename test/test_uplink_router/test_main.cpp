@@ -0,0 +1,214 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/uplink_router.cpp"
+
+#include <unity.h>
+#include <stdio.h>
+#include <deque>
+#include "uplink_router.h"
+
+static const UplinkChoice samplesUplinks[] = {
+    {ProtocolType::MQTT, 1},
+    {ProtocolType::HTTP, 1},
+    {ProtocolType::WEBSOCKET, 1},
+};
+
+static void allConnected(UplinkRouter& router, uint32_t now) {
+    router.updateLink(ProtocolType::MQTT, true, false, now);
+    router.updateLink(ProtocolType::HTTP, true, false, now);
+    router.updateLink(ProtocolType::WEBSOCKET, true, false, now);
+}
+
+void test_unrouted_topic_keeps_its_protocol() {
+    UplinkRouter router;
+    ProtocolType targets[UplinkRouter::MAX_UPLINKS];
+    TEST_ASSERT_EQUAL(1, router.route("cerise/status", ProtocolType::COAP, 0, targets));
+    TEST_ASSERT_EQUAL(ProtocolType::COAP, targets[0]);
+}
+
+void test_failover_moves_and_fails_back() {
+    UplinkRouter router;
+    router.setRoute("cerise/", RoutePolicy::FAILOVER, samplesUplinks, 3);
+    allConnected(router, 0);
+    ProtocolType targets[UplinkRouter::MAX_UPLINKS];
+
+    TEST_ASSERT_EQUAL(1, router.route("cerise/samples", ProtocolType::MQTT, 0, targets));
+    TEST_ASSERT_EQUAL(ProtocolType::MQTT, targets[0]);
+
+    router.updateLink(ProtocolType::MQTT, false, true, 100);
+    router.route("cerise/samples", ProtocolType::MQTT, 100, targets);
+    TEST_ASSERT_EQUAL(ProtocolType::HTTP, targets[0]);
+
+    // Send failures on a link that still reports connected demote it too
+    router.recordResult(ProtocolType::HTTP, false, 0, 200);
+    router.route("cerise/samples", ProtocolType::MQTT, 200, targets);
+    TEST_ASSERT_EQUAL(ProtocolType::WEBSOCKET, targets[0]);
+
+    // After the cooldown HTTP is probed again; MQTT returns once its error clears
+    router.route("cerise/samples", ProtocolType::MQTT, 200 + UplinkRouter::DEFAULT_COOLDOWN_MS, targets);
+    TEST_ASSERT_EQUAL(ProtocolType::HTTP, targets[0]);
+    router.updateLink(ProtocolType::MQTT, true, false, 6000);
+    router.route("cerise/samples", ProtocolType::MQTT, 6000, targets);
+    TEST_ASSERT_EQUAL(ProtocolType::MQTT, targets[0]);
+}
+
+void test_mirror_uses_every_healthy_uplink() {
+    UplinkRouter router;
+    router.setRoute("alarm", RoutePolicy::MIRROR, samplesUplinks, 3);
+    allConnected(router, 0);
+    ProtocolType targets[UplinkRouter::MAX_UPLINKS];
+    TEST_ASSERT_EQUAL(3, router.route("alarm/fire", ProtocolType::MQTT, 0, targets));
+
+    router.updateLink(ProtocolType::HTTP, false, false, 10);
+    TEST_ASSERT_EQUAL(2, router.route("alarm/fire", ProtocolType::MQTT, 10, targets));
+    TEST_ASSERT_EQUAL(ProtocolType::MQTT, targets[0]);
+    TEST_ASSERT_EQUAL(ProtocolType::WEBSOCKET, targets[1]);
+}
+
+void test_weighted_split_follows_weight_and_latency() {
+    const UplinkChoice uplinks[] = {{ProtocolType::MQTT, 3}, {ProtocolType::HTTP, 1}};
+    UplinkRouter router;
+    router.setRoute("bulk", RoutePolicy::WEIGHTED, uplinks, 2);
+    allConnected(router, 0);
+    router.recordResult(ProtocolType::MQTT, true, 40, 0);
+    router.recordResult(ProtocolType::HTTP, true, 40, 0);
+
+    ProtocolType targets[UplinkRouter::MAX_UPLINKS];
+    int mqtt = 0;
+    for (int i = 0; i < 400; i++) {
+        router.route("bulk/x", ProtocolType::MQTT, 0, targets);
+        mqtt += targets[0] == ProtocolType::MQTT;
+    }
+    TEST_ASSERT_EQUAL(300, mqtt);
+
+    // MQTT becomes 3x slower: its share drops to even
+    for (int i = 0; i < 20; i++) {
+        router.recordResult(ProtocolType::MQTT, true, 120, 0);
+    }
+    mqtt = 0;
+    for (int i = 0; i < 400; i++) {
+        router.route("bulk/x", ProtocolType::MQTT, 0, targets);
+        mqtt += targets[0] == ProtocolType::MQTT;
+    }
+    TEST_ASSERT_INT_WITHIN(20, 200, mqtt);
+}
+
+// Link outages over a 10 minute run, one tick every 100 ms
+struct Outage {
+    ProtocolType protocol;
+    uint32_t from;
+    uint32_t to;
+    bool silent; // still reports connected, sends fail
+};
+
+static const Outage outages[] = {
+    {ProtocolType::MQTT, 60000, 180000, false},
+    {ProtocolType::HTTP, 120000, 150000, true},
+    {ProtocolType::MQTT, 300000, 302000, false},
+    {ProtocolType::WEBSOCKET, 290000, 400000, false},
+    {ProtocolType::MQTT, 450000, 460000, true},
+    {ProtocolType::HTTP, 455000, 458000, false},
+};
+
+static bool linkDown(ProtocolType protocol, uint32_t now, bool silentOnly) {
+    for (const Outage& outage : outages) {
+        if (outage.protocol == protocol && now >= outage.from && now < outage.to &&
+            (!silentOnly || outage.silent)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+struct Continuity {
+    uint32_t produced;
+    uint32_t deliveredFirstTick;
+    uint32_t maxDelayMs;
+    uint32_t maxQueue;
+};
+
+static Continuity simulate(bool routed) {
+    const uint32_t tickMs = 100;
+    UplinkRouter router;
+    if (routed) {
+        router.setRoute("cerise/", RoutePolicy::FAILOVER, samplesUplinks, 3);
+    }
+    std::deque<uint32_t> queue;
+    Continuity result = {0, 0, 0, 0};
+    bool lastError[3] = {false, false, false};
+    const ProtocolType protocols[] = {ProtocolType::MQTT, ProtocolType::HTTP, ProtocolType::WEBSOCKET};
+
+    for (uint32_t now = 0; now < 600000; now += tickMs) {
+        // What ProtocolManager::refreshUplinkHealth feeds in each tick
+        for (int p = 0; p < 3; p++) {
+            bool hardDown = linkDown(protocols[p], now, false) && !linkDown(protocols[p], now, true);
+            router.updateLink(protocols[p], !hardDown, lastError[p], now);
+        }
+        queue.push_back(now);
+        result.produced++;
+
+        // Drain like processMessageQueue: route every queued message again
+        while (!queue.empty()) {
+            ProtocolType targets[UplinkRouter::MAX_UPLINKS];
+            router.route("cerise/samples", ProtocolType::MQTT, now, targets);
+            int p = targets[0] == ProtocolType::MQTT ? 0 : (targets[0] == ProtocolType::HTTP ? 1 : 2);
+            bool success = !linkDown(targets[0], now, false);
+            router.recordResult(targets[0], success, 30, now);
+            lastError[p] = !success;
+            if (!success) {
+                break;
+            }
+            uint32_t delay = now - queue.front();
+            if (delay == 0) {
+                result.deliveredFirstTick++;
+            }
+            if (delay > result.maxDelayMs) {
+                result.maxDelayMs = delay;
+            }
+            queue.pop_front();
+        }
+        if (queue.size() > result.maxQueue) {
+            result.maxQueue = queue.size();
+        }
+    }
+    return result;
+}
+
+void test_scheduled_link_failures_delivery_continuity() {
+    Continuity bound = simulate(false);
+    Continuity routed = simulate(true);
+
+    char message[160];
+    snprintf(message, sizeof(message), "MQTT only: %.2f%% on first tick, max delay %u ms, max queue %u",
+             100.0 * bound.deliveredFirstTick / bound.produced, (unsigned)bound.maxDelayMs, (unsigned)bound.maxQueue);
+    TEST_MESSAGE(message);
+    snprintf(message, sizeof(message), "failover:  %.2f%% on first tick, max delay %u ms, max queue %u",
+             100.0 * routed.deliveredFirstTick / routed.produced, (unsigned)routed.maxDelayMs, (unsigned)routed.maxQueue);
+    TEST_MESSAGE(message);
+
+    TEST_ASSERT_GREATER_THAN(60000, bound.maxDelayMs);
+    // A failed uplink costs at most one tick before traffic moves
+    TEST_ASSERT_LESS_OR_EQUAL(100, routed.maxDelayMs);
+    TEST_ASSERT_LESS_OR_EQUAL(2, routed.maxQueue);
+}
+
+int runUnityTests() {
+    UNITY_BEGIN();
+    RUN_TEST(test_unrouted_topic_keeps_its_protocol);
+    RUN_TEST(test_failover_moves_and_fails_back);
+    RUN_TEST(test_mirror_uses_every_healthy_uplink);
+    RUN_TEST(test_weighted_split_follows_weight_and_latency);
+    RUN_TEST(test_scheduled_link_failures_delivery_continuity);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
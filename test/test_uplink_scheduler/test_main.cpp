@@ -0,0 +1,291 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/uplink_scheduler.cpp"
+
+#include <unity.h>
+#include <stdio.h>
+#include <vector>
+#include "uplink_scheduler.h"
+
+static QueuedEntry makeEntry(uint16_t handle, MessagePriority priority, uint32_t now,
+                             ProtocolType protocol = ProtocolType::MQTT, int8_t topicClass = -1) {
+    QueuedEntry entry;
+    entry.handle = handle;
+    entry.priority = priority;
+    entry.protocol = protocol;
+    entry.topicClass = topicClass;
+    entry.enqueuedAt = now;
+    return entry;
+}
+
+void test_token_bucket_rate_and_burst() {
+    TokenBucket bucket;
+    TEST_ASSERT_FALSE(bucket.isLimited());
+    TEST_ASSERT_TRUE(bucket.consume(0));
+
+    // 2 per second with a burst of 3
+    bucket.configure(2.0f, 3);
+    int taken = 0;
+    while (bucket.consume(1000)) {
+        taken++;
+    }
+    TEST_ASSERT_EQUAL(3, taken);
+    TEST_ASSERT_FALSE(bucket.available(1499));
+    TEST_ASSERT_TRUE(bucket.consume(1500));
+    TEST_ASSERT_FALSE(bucket.available(1500));
+
+    // Over ten seconds the rate holds, however often it is polled
+    taken = 0;
+    for (uint32_t now = 1500; now <= 11500; now++) {
+        if (bucket.consume(now)) {
+            taken++;
+        }
+    }
+    TEST_ASSERT_INT_WITHIN(1, 20, taken);
+
+    bucket.refund();
+    TEST_ASSERT_TRUE(bucket.available(11500));
+}
+
+void test_strict_priority_and_restore_order() {
+    UplinkScheduler scheduler(8);
+    TEST_ASSERT_TRUE(scheduler.enqueue(makeEntry(1, MessagePriority::BULK, 0)));
+    TEST_ASSERT_TRUE(scheduler.enqueue(makeEntry(2, MessagePriority::TELEMETRY, 0)));
+    TEST_ASSERT_TRUE(scheduler.enqueue(makeEntry(3, MessagePriority::TELEMETRY, 0)));
+    TEST_ASSERT_TRUE(scheduler.enqueue(makeEntry(4, MessagePriority::ALARM, 5)));
+
+    QueuedEntry entry;
+    TEST_ASSERT_TRUE(scheduler.pop(10, entry));
+    TEST_ASSERT_EQUAL(4, entry.handle);
+    scheduler.delivered(entry, 10);
+    TEST_ASSERT_EQUAL(5, scheduler.getMeanDelayMs(MessagePriority::ALARM));
+
+    // Failed dispatches go back in front, in their original order
+    QueuedEntry first;
+    QueuedEntry second;
+    TEST_ASSERT_TRUE(scheduler.pop(10, first));
+    TEST_ASSERT_TRUE(scheduler.pop(10, second));
+    TEST_ASSERT_EQUAL(2, first.handle);
+    TEST_ASSERT_EQUAL(3, second.handle);
+    scheduler.restore(second);
+    scheduler.restore(first);
+    TEST_ASSERT_TRUE(scheduler.pop(10, entry));
+    TEST_ASSERT_EQUAL(2, entry.handle);
+
+    // A full queue makes room for an alarm by dropping the newest bulk entry
+    for (uint16_t handle = 10; scheduler.size() < 8; handle++) {
+        scheduler.enqueue(makeEntry(handle, MessagePriority::BULK, 20));
+    }
+    TEST_ASSERT_FALSE(scheduler.enqueue(makeEntry(30, MessagePriority::ALARM, 20)));
+    uint16_t evicted = 0;
+    TEST_ASSERT_TRUE(scheduler.evictBelow(MessagePriority::ALARM, evicted));
+    TEST_ASSERT_EQUAL(15, evicted);
+    TEST_ASSERT_TRUE(scheduler.enqueue(makeEntry(evicted, MessagePriority::ALARM, 20)));
+    TEST_ASSERT_FALSE(scheduler.evictBelow(MessagePriority::BULK, evicted));
+    TEST_ASSERT_EQUAL(1, scheduler.getStats(MessagePriority::BULK).dropped);
+    TEST_ASSERT_EQUAL(1, scheduler.getStats(MessagePriority::ALARM).dropped);
+}
+
+void test_weighted_dequeue_shares_by_weight() {
+    UplinkScheduler scheduler(400);
+    scheduler.setMode(SchedulingMode::WEIGHTED);
+    for (uint16_t i = 0; i < 100; i++) {
+        scheduler.enqueue(makeEntry(i, MessagePriority::CONTROL, 0));
+        scheduler.enqueue(makeEntry(i, MessagePriority::TELEMETRY, 0));
+        scheduler.enqueue(makeEntry(i, MessagePriority::BULK, 0));
+    }
+    // Default weights 4:2:1 for these classes
+    int served[UplinkScheduler::PRIORITY_COUNT] = { 0 };
+    QueuedEntry entry;
+    for (int i = 0; i < 70; i++) {
+        TEST_ASSERT_TRUE(scheduler.pop(0, entry));
+        served[static_cast<size_t>(entry.priority)]++;
+    }
+    TEST_ASSERT_EQUAL(40, served[1]);
+    TEST_ASSERT_EQUAL(20, served[2]);
+    TEST_ASSERT_EQUAL(10, served[3]);
+}
+
+void test_topic_limits() {
+    UplinkScheduler scheduler(100);
+    int flood = scheduler.setTopicLimit("sensors/pump7", 5.0f, 5);
+    TEST_ASSERT_EQUAL(0, flood);
+    TEST_ASSERT_EQUAL(0, scheduler.classify("sensors/pump7/pressure"));
+    TEST_ASSERT_EQUAL(-1, scheduler.classify("sensors/pump8/pressure"));
+
+    // A misbehaving sensor floods; other sensors are unaffected by it, and the
+    // HTTP entries are left to the uplink limits since routing may move them
+    uint16_t handle = 0;
+    for (int i = 0; i < 50; i++) {
+        scheduler.enqueue(makeEntry(handle++, MessagePriority::TELEMETRY, 0, ProtocolType::MQTT, (int8_t)flood));
+    }
+    for (int i = 0; i < 10; i++) {
+        scheduler.enqueue(makeEntry(handle++, MessagePriority::TELEMETRY, 0, ProtocolType::MQTT));
+    }
+    scheduler.enqueue(makeEntry(handle++, MessagePriority::TELEMETRY, 0, ProtocolType::HTTP));
+    scheduler.enqueue(makeEntry(handle++, MessagePriority::TELEMETRY, 0, ProtocolType::HTTP));
+
+    int fromFlood = 0;
+    int others = 0;
+    int http = 0;
+    QueuedEntry entry;
+    while (scheduler.pop(0, entry)) {
+        if (entry.protocol == ProtocolType::HTTP) {
+            http++;
+        } else if (entry.topicClass == flood) {
+            fromFlood++;
+        } else {
+            others++;
+        }
+    }
+    TEST_ASSERT_EQUAL(5, fromFlood);
+    TEST_ASSERT_EQUAL(10, others);
+    TEST_ASSERT_EQUAL(2, http);
+    TEST_ASSERT_GREATER_THAN(0, scheduler.getStats(MessagePriority::TELEMETRY).throttled);
+
+    // One second later the flood gets its next five
+    fromFlood = 0;
+    while (scheduler.pop(1000, entry)) {
+        fromFlood += entry.topicClass == flood ? 1 : 0;
+    }
+    TEST_ASSERT_EQUAL(5, fromFlood);
+    TEST_ASSERT_EQUAL(40, (int)scheduler.size());
+}
+
+// An uplink that takes 20 ms per message (50 msg/s) against 100 msg/s of
+// telemetry, with an alarm every second, over two simulated minutes. Same
+// loop as ProtocolManager::processMessageQueue(): pop until nothing is
+// sendable, restore whatever the link refused.
+struct LoadResult {
+    uint32_t alarmsDelivered;
+    uint32_t alarmsDropped;
+    uint32_t alarmMeanMs;
+    uint32_t alarmMaxMs;
+    uint32_t telemetryMeanMs;
+    uint32_t telemetryDropped;
+};
+
+static LoadResult runSaturatedUplink(bool usePriorities, float telemetryLimit) {
+    const size_t capacity = 50;
+    UplinkScheduler scheduler(capacity);
+    if (telemetryLimit > 0) {
+        scheduler.setTopicLimit("telemetry/", telemetryLimit, 10);
+    }
+    std::vector<uint16_t> freeHandles;
+    std::vector<bool> isAlarm(capacity, false);
+    for (uint16_t handle = 0; handle < capacity; handle++) {
+        freeHandles.push_back(handle);
+    }
+
+    uint32_t linkBusyUntil = 0;
+    uint32_t alarmsDelivered = 0;
+    uint32_t alarmTotal = 0;
+    uint32_t alarmMax = 0;
+    uint32_t alarmsDropped = 0;
+    for (uint32_t now = 0; now < 120000; now++) {
+        bool alarmDue = now % 1000 == 507;
+        bool telemetryDue = now % 10 == 0;
+        for (int produce = 0; produce < 2; produce++) {
+            bool alarm = produce == 0;
+            if ((alarm && !alarmDue) || (!alarm && !telemetryDue)) {
+                continue;
+            }
+            MessagePriority priority = alarm && usePriorities ? MessagePriority::ALARM : MessagePriority::TELEMETRY;
+            if (freeHandles.empty()) {
+                uint16_t victim;
+                if (!scheduler.evictBelow(priority, victim)) {
+                    // Refused by the full scheduler, which counts the drop
+                    scheduler.enqueue(makeEntry(0, priority, now));
+                    alarmsDropped += alarm ? 1 : 0;
+                    continue;
+                }
+                alarmsDropped += isAlarm[victim] ? 1 : 0;
+                freeHandles.push_back(victim);
+            }
+            uint16_t handle = freeHandles.back();
+            freeHandles.pop_back();
+            isAlarm[handle] = alarm;
+            scheduler.enqueue(makeEntry(handle, priority, now, ProtocolType::MQTT,
+                                        (int8_t)scheduler.classify(alarm ? "alarms/tank1" : "telemetry/tank1")));
+        }
+
+        QueuedEntry held[capacity];
+        size_t heldCount = 0;
+        QueuedEntry entry;
+        while (scheduler.pop(now, entry)) {
+            if (now < linkBusyUntil) {
+                held[heldCount++] = entry;
+                continue;
+            }
+            linkBusyUntil = now + 20;
+            scheduler.delivered(entry, now);
+            if (isAlarm[entry.handle]) {
+                uint32_t delay = now - entry.enqueuedAt;
+                alarmsDelivered++;
+                alarmTotal += delay;
+                alarmMax = delay > alarmMax ? delay : alarmMax;
+            }
+            freeHandles.push_back(entry.handle);
+        }
+        while (heldCount > 0) {
+            scheduler.restore(held[--heldCount]);
+        }
+    }
+
+    LoadResult result;
+    result.alarmsDelivered = alarmsDelivered;
+    result.alarmsDropped = alarmsDropped;
+    result.alarmMeanMs = alarmsDelivered ? alarmTotal / alarmsDelivered : 0;
+    result.alarmMaxMs = alarmMax;
+    result.telemetryMeanMs = scheduler.getMeanDelayMs(MessagePriority::TELEMETRY);
+    result.telemetryDropped = scheduler.getStats(MessagePriority::TELEMETRY).dropped;
+    return result;
+}
+
+static void report(const char* label, const LoadResult& result) {
+    char message[200];
+    snprintf(message, sizeof(message),
+             "%s: alarms %u delivered / %u dropped, alarm latency mean %u ms max %u ms, telemetry mean %u ms, %u dropped",
+             label, (unsigned)result.alarmsDelivered, (unsigned)result.alarmsDropped, (unsigned)result.alarmMeanMs,
+             (unsigned)result.alarmMaxMs, (unsigned)result.telemetryMeanMs, (unsigned)result.telemetryDropped);
+    TEST_MESSAGE(message);
+}
+
+void test_alarm_latency_under_saturating_telemetry() {
+    LoadResult fifo = runSaturatedUplink(false, 0);
+    LoadResult priority = runSaturatedUplink(true, 0);
+    LoadResult limited = runSaturatedUplink(true, 40.0f);
+    report("single FIFO       ", fifo);
+    report("priority classes  ", priority);
+    report("priority + 40/s TB", limited);
+
+    // Behind a full FIFO an alarm waits for ~50 messages at 20 ms each
+    TEST_ASSERT_GREATER_THAN(500, fifo.alarmMeanMs);
+    // With its own class it waits at most for the message already on the link
+    TEST_ASSERT_EQUAL(120, priority.alarmsDelivered);
+    TEST_ASSERT_EQUAL(0, priority.alarmsDropped);
+    TEST_ASSERT_LESS_OR_EQUAL(20, priority.alarmMaxMs);
+    TEST_ASSERT_EQUAL(120, limited.alarmsDelivered);
+    TEST_ASSERT_LESS_OR_EQUAL(20, limited.alarmMaxMs);
+}
+
+int runUnityTests() {
+    UNITY_BEGIN();
+    RUN_TEST(test_token_bucket_rate_and_burst);
+    RUN_TEST(test_strict_priority_and_restore_order);
+    RUN_TEST(test_weighted_dequeue_shares_by_weight);
+    RUN_TEST(test_topic_limits);
+    RUN_TEST(test_alarm_latency_under_saturating_telemetry);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif
@@ -0,0 +1,313 @@
+// Força a inclusão dos arquivos .cpp
+#include "../../src/wifi_manager.cpp"
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "wifi_manager.h"
+
+static uint32_t fakeNow = 0;
+static uint32_t fakeClock() {
+    return fakeNow;
+}
+
+struct FakeAp {
+    uint8_t bssid[6];
+    int32_t channel;
+    int32_t rssi;
+    bool up;
+};
+
+// Radio model with typical ESP32 costs: association on a known channel
+// ~80 ms, an all-channel probe by the driver ~2 s, an async scan ~2.2 s and
+// DHCP ~1.2 s. The fast-path file survives "reboots" (new managers).
+struct FakeWifiHal : public WifiHal {
+    std::vector<FakeAp> aps;
+    WifiFastPath stored;
+    bool hasStored = false;
+
+    int target = -1;
+    bool associating = false;
+    bool connected = false;
+    bool failed = false;
+    uint32_t readyAt = 0;
+    bool scanning = false;
+    uint32_t scanDoneAt = 0;
+    int begins = 0;
+    bool lastBeginStatic = false;
+
+    void begin(const char*, const char*, const uint8_t* bssid, int32_t channel, const WifiIpConfig* staticIp) override {
+        begins++;
+        connected = false;
+        failed = false;
+        associating = true;
+        lastBeginStatic = staticIp != nullptr;
+        target = -1;
+        uint32_t cost = 0;
+        if (bssid) {
+            for (size_t i = 0; i < aps.size(); i++) {
+                if (aps[i].up && memcmp(aps[i].bssid, bssid, 6) == 0 && (channel == 0 || aps[i].channel == channel)) {
+                    target = i;
+                }
+            }
+            cost = channel ? 80 : 2000;
+        } else {
+            for (size_t i = 0; i < aps.size(); i++) {
+                if (aps[i].up && (target < 0 || aps[i].rssi > aps[target].rssi)) {
+                    target = i;
+                }
+            }
+            cost = 2000;
+        }
+        readyAt = fakeNow + cost + (staticIp ? 0 : 1200);
+    }
+    void disconnect() override {
+        connected = false;
+        associating = false;
+    }
+    WifiLinkStatus status() override {
+        if (connected) {
+            if (!aps[target].up) {
+                connected = false;
+                return WifiLinkStatus::FAILED;
+            }
+            return WifiLinkStatus::CONNECTED;
+        }
+        if (!associating) {
+            return WifiLinkStatus::IDLE;
+        }
+        if (target < 0) {
+            // The driver gives up after probing for a while
+            return fakeNow >= readyAt + 3000 ? WifiLinkStatus::FAILED : WifiLinkStatus::CONNECTING;
+        }
+        if (fakeNow >= readyAt) {
+            associating = false;
+            connected = true;
+            return WifiLinkStatus::CONNECTED;
+        }
+        return WifiLinkStatus::CONNECTING;
+    }
+    bool startScan() override {
+        scanning = true;
+        scanDoneAt = fakeNow + 2200;
+        return true;
+    }
+    int scanResults(WifiScanResult* results, size_t capacity) override {
+        if (!scanning || fakeNow < scanDoneAt) {
+            return -1;
+        }
+        scanning = false;
+        size_t count = 0;
+        for (const FakeAp& ap : aps) {
+            if (ap.up && count < capacity) {
+                strcpy(results[count].ssid, "cerise");
+                memcpy(results[count].bssid, ap.bssid, 6);
+                results[count].channel = ap.channel;
+                results[count].rssi = ap.rssi;
+                count++;
+            }
+        }
+        return count;
+    }
+    int32_t rssi() override {
+        return connected ? aps[target].rssi : 0;
+    }
+    bool linkInfo(uint8_t bssid[6], int32_t& channel, WifiIpConfig& ip) override {
+        if (!connected) {
+            return false;
+        }
+        memcpy(bssid, aps[target].bssid, 6);
+        channel = aps[target].channel;
+        ip = {0x0A01A8C0, 0x0101A8C0, 0x00FFFFFF, 0x0101A8C0};
+        return true;
+    }
+    bool loadFastPath(WifiFastPath& path) override {
+        path = stored;
+        return hasStored && stored.valid;
+    }
+    bool saveFastPath(const WifiFastPath& path) override {
+        stored = path;
+        hasStored = true;
+        return true;
+    }
+};
+
+static FakeWifiHal twoAccessPoints() {
+    FakeWifiHal hal;
+    hal.aps.push_back({{0x24, 0x0A, 0xC4, 0x00, 0x00, 0x01}, 6, -60, true});
+    hal.aps.push_back({{0x24, 0x0A, 0xC4, 0x00, 0x00, 0x02}, 11, -67, true});
+    return hal;
+}
+
+struct EventLog {
+    std::vector<WifiEvent> events;
+    void attach(WifiManager& manager) {
+        manager.addListener([this](WifiEvent event) { events.push_back(event); });
+    }
+};
+
+static void run(WifiManager& manager, uint32_t durationMs) {
+    for (uint32_t elapsed = 0; elapsed < durationMs; elapsed += 10) {
+        fakeNow += 10;
+        manager.update();
+    }
+}
+
+// Time from begin() to link up
+static uint32_t connectTime(FakeWifiHal& hal) {
+    WifiManager manager(hal);
+    manager.setClock(fakeClock);
+    manager.begin("cerise", "secret");
+    run(manager, 20000);
+    return manager.isConnected() ? manager.getStats().lastConnectMs : UINT32_MAX;
+}
+
+void test_cold_boot_scans_then_fast_path_after_reboot() {
+    fakeNow = 1000;
+    FakeWifiHal hal = twoAccessPoints();
+
+    WifiManager first(hal);
+    first.setClock(fakeClock);
+    EventLog log;
+    log.attach(first);
+    TEST_ASSERT_FALSE(first.begin("", ""));
+    TEST_ASSERT_TRUE(first.begin("cerise", "secret"));
+    TEST_ASSERT_EQUAL(WifiManagerState::SCANNING, first.getState());
+    run(first, 5000);
+    TEST_ASSERT_TRUE(first.isConnected());
+    TEST_ASSERT_EQUAL(1, (int)log.events.size());
+    TEST_ASSERT_EQUAL(WifiEvent::LINK_UP, log.events[0]);
+    TEST_ASSERT_TRUE(hal.stored.valid);
+    TEST_ASSERT_EQUAL(6, hal.stored.channel);
+    TEST_ASSERT_EQUAL(0, first.getStats().fastConnects);
+
+    // Reboot: straight to the stored AP with the stored IP, no scan or DHCP
+    WifiManager second(hal);
+    second.setClock(fakeClock);
+    second.begin("cerise", "secret");
+    TEST_ASSERT_EQUAL(WifiManagerState::FAST_CONNECT, second.getState());
+    run(second, 200);
+    TEST_ASSERT_TRUE(second.isConnected());
+    TEST_ASSERT_TRUE(hal.lastBeginStatic);
+    TEST_ASSERT_EQUAL(1, second.getStats().fastConnects);
+    TEST_ASSERT_LESS_OR_EQUAL(100, second.getStats().lastConnectMs);
+}
+
+void test_stale_fast_path_falls_back_to_scan() {
+    fakeNow = 1000;
+    FakeWifiHal hal = twoAccessPoints();
+    connectTime(hal);
+
+    // The AP was moved to another channel while we were off
+    hal.aps[0].channel = 1;
+    WifiManager manager(hal);
+    manager.setClock(fakeClock);
+    manager.begin("cerise", "secret");
+    run(manager, 8000);
+    TEST_ASSERT_TRUE(manager.isConnected());
+    TEST_ASSERT_EQUAL(1, manager.getStats().fastPathMisses);
+    TEST_ASSERT_EQUAL(1, hal.stored.channel);
+}
+
+void test_link_loss_reconnects_and_reports() {
+    fakeNow = 1000;
+    FakeWifiHal hal = twoAccessPoints();
+    WifiManager manager(hal);
+    manager.setClock(fakeClock);
+    EventLog log;
+    log.attach(manager);
+    manager.begin("cerise", "secret");
+    run(manager, 5000);
+
+    // Both APs go down for 20 s
+    hal.aps[0].up = false;
+    hal.aps[1].up = false;
+    run(manager, 20000);
+    TEST_ASSERT_FALSE(manager.isConnected());
+    TEST_ASSERT_EQUAL(2, (int)log.events.size());
+    TEST_ASSERT_EQUAL(WifiEvent::LINK_DOWN, log.events[1]);
+    TEST_ASSERT_GREATER_THAN(0, manager.getStats().failures);
+
+    hal.aps[0].up = true;
+    hal.aps[1].up = true;
+    run(manager, 60000);
+    TEST_ASSERT_TRUE(manager.isConnected());
+    TEST_ASSERT_EQUAL(3, (int)log.events.size());
+    TEST_ASSERT_EQUAL(WifiEvent::LINK_UP, log.events[2]);
+    TEST_ASSERT_EQUAL(1, manager.getStats().linkDowns);
+}
+
+void test_background_roaming_on_weak_signal() {
+    fakeNow = 1000;
+    FakeWifiHal hal = twoAccessPoints();
+    WifiManager manager(hal);
+    manager.setClock(fakeClock);
+    EventLog log;
+    log.attach(manager);
+    manager.begin("cerise", "secret");
+    run(manager, 5000);
+    TEST_ASSERT_EQUAL(0, hal.target);
+
+    // Signal sags, but the other AP is only slightly better: stay
+    hal.aps[0].rssi = -78;
+    hal.aps[1].rssi = -74;
+    run(manager, 20000);
+    TEST_ASSERT_EQUAL(0, hal.target);
+    TEST_ASSERT_EQUAL(0, manager.getStats().roams);
+
+    // Walking towards the other AP; the next roam scan is allowed after the interval
+    hal.aps[1].rssi = -58;
+    run(manager, WifiManager::ROAM_SCAN_INTERVAL_MS + 5000);
+    TEST_ASSERT_EQUAL(1, hal.target);
+    TEST_ASSERT_EQUAL(1, manager.getStats().roams);
+    TEST_ASSERT_TRUE(manager.isConnected());
+    TEST_ASSERT_EQUAL(2, (int)log.events.size());
+    TEST_ASSERT_EQUAL(WifiEvent::ROAMED, log.events[1]);
+    TEST_ASSERT_EQUAL(11, hal.stored.channel);
+}
+
+void test_connect_time_cold_versus_fast_path() {
+    fakeNow = 1000;
+    FakeWifiHal hal = twoAccessPoints();
+    uint32_t cold = connectTime(hal);
+    uint32_t fast = connectTime(hal);
+
+    // Without the static-IP part of the fast path DHCP still runs
+    WifiManager dhcp(hal);
+    dhcp.setClock(fakeClock);
+    dhcp.setStaticIpFastPath(false);
+    dhcp.begin("cerise", "secret");
+    run(dhcp, 5000);
+    uint32_t bssidOnly = dhcp.getStats().lastConnectMs;
+
+    char message[160];
+    snprintf(message, sizeof(message), "cold boot (scan + DHCP): %u ms, BSSID/channel: %u ms, BSSID/channel + static IP: %u ms",
+             (unsigned)cold, (unsigned)bssidOnly, (unsigned)fast);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_GREATER_THAN(3000, cold);
+    TEST_ASSERT_LESS_OR_EQUAL(100, fast);
+    TEST_ASSERT_LESS_THAN(cold, bssidOnly);
+}
+
+int runUnityTests() {
+    UNITY_BEGIN();
+    RUN_TEST(test_cold_boot_scans_then_fast_path_after_reboot);
+    RUN_TEST(test_stale_fast_path_falls_back_to_scan);
+    RUN_TEST(test_link_loss_reconnects_and_reports);
+    RUN_TEST(test_background_roaming_on_weak_signal);
+    RUN_TEST(test_connect_time_cold_versus_fast_path);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    runUnityTests();
+}
+
+void loop() {}
+#else
+int main() {
+    return runUnityTests();
+}
+#endif